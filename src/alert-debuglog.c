@@ -120,6 +120,14 @@ static void AlertDebugLogFlowVars(AlertDebugLogThread *aft, Packet *p)
         }
         gv = gv->next;
     }
+
+    FlowIntSlot *fi = p->flow->flowints;
+    for (i = 0; i < p->flow->flowints_size; i++) {
+        if (fi[i].set) {
+            fprintf(aft->file_ctx->fp, "FLOWINT idx(%"PRIu32"):   "
+                    " %" PRIu32 "\n", i, fi[i].value);
+        }
+    }
 }
 
 /**
@@ -131,17 +139,16 @@ static void AlertDebugLogFlowVars(AlertDebugLogThread *aft, Packet *p)
  */
 static void AlertDebugLogFlowBits(AlertDebugLogThread *aft, Packet *p)
 {
-    GenericVar *gv = p->flow->flowvar;
-    while (gv != NULL) {
-        if (gv->type == DETECT_FLOWBITS) {
-            FlowBit *fb = (FlowBit *) gv;
-            char *name = VariableIdxGetName(fb->idx, fb->type);
+    uint32_t idx;
+    /* called with the flow locked, so read the bits directly */
+    for (idx = 0; idx < (uint32_t)p->flow->flowbits_size * 32; idx++) {
+        if (p->flow->flowbits[idx / 32] & ((uint32_t)1 << (idx % 32))) {
+            char *name = VariableIdxGetName(idx, DETECT_FLOWBITS);
             if (name != NULL) {
                 fprintf(aft->file_ctx->fp, "FLOWBIT:           %s\n",name);
                 SCFree(name);
             }
         }
-        gv = gv->next;
     }
 }
 
@@ -49,6 +49,9 @@
 
 #include "util-spm.h"
 #include "util-unittest.h"
+#include "util-atomic.h"
+
+#include "conf.h"
 
 #include "app-layer-dcerpc.h"
 
@@ -971,12 +974,19 @@ static uint32_t DCERPCParseREQUEST(DCERPC *dcerpc, uint8_t *input, uint32_t inpu
     SCReturnUInt((uint32_t)(p - input));
 }
 
+/** max number of stub data bytes buffered per request/response, 0 for no
+ *  limit. Set from "dcerpc.stub-depth". */
+static uint32_t dcerpc_stub_depth = 0;
+/** stub data bytes not buffered because of dcerpc_stub_depth */
+SC_ATOMIC_DECLARE(uint64_t, dcerpc_stub_skipped);
+
 static uint32_t StubDataParser(DCERPC *dcerpc, uint8_t *input, uint32_t input_len) {
     SCEnter();
     uint8_t **stub_data_buffer = NULL;
     uint32_t *stub_data_buffer_len = NULL;
     uint8_t *stub_data_fresh = NULL;
     uint16_t stub_len = 0;
+    uint16_t buffer_len = 0;
 
     /* request PDU.  Retrieve the request stub buffer */
     if (dcerpc->dcerpchdr.type == REQUEST) {
@@ -1023,18 +1033,33 @@ static uint32_t StubDataParser(DCERPC *dcerpc, uint8_t *input, uint32_t input_le
         dcerpc->pdu_fragged = 1;
     }
 
-    *stub_data_buffer = realloc(*stub_data_buffer, *stub_data_buffer_len + stub_len);
-    if (*stub_data_buffer == NULL) {
-        SCLogError(SC_ERR_MEM_ALLOC, "Error allocating memory");
-        goto end;
+    /* past the stub depth the bytes are only accounted for, not buffered.
+     * The stub isn't marked fresh then, so it isn't inspected again */
+    buffer_len = stub_len;
+    if (dcerpc_stub_depth > 0) {
+        if (*stub_data_buffer_len >= dcerpc_stub_depth)
+            buffer_len = 0;
+        else if (dcerpc_stub_depth - *stub_data_buffer_len < stub_len)
+            buffer_len = dcerpc_stub_depth - *stub_data_buffer_len;
+
+        if (buffer_len < stub_len)
+            SC_ATOMIC_ADD(dcerpc_stub_skipped, (uint64_t)(stub_len - buffer_len));
     }
-    memcpy(*stub_data_buffer + *stub_data_buffer_len, input, stub_len);
 
-    *stub_data_fresh = 1;
-    /* length of the buffered stub */
-    *stub_data_buffer_len += stub_len;
-    /* To see the total reassembled stubdata */
-    //hexdump(*stub_data_buffer, *stub_data_buffer_len);
+    if (buffer_len > 0) {
+        *stub_data_buffer = realloc(*stub_data_buffer, *stub_data_buffer_len + buffer_len);
+        if (*stub_data_buffer == NULL) {
+            SCLogError(SC_ERR_MEM_ALLOC, "Error allocating memory");
+            goto end;
+        }
+        memcpy(*stub_data_buffer + *stub_data_buffer_len, input, buffer_len);
+
+        *stub_data_fresh = 1;
+        /* length of the buffered stub */
+        *stub_data_buffer_len += buffer_len;
+        /* To see the total reassembled stubdata */
+        //hexdump(*stub_data_buffer, *stub_data_buffer_len);
+    }
 
     dcerpc->padleft -= stub_len;
     dcerpc->bytesprocessed += stub_len;
@@ -1714,6 +1739,23 @@ void DCERPCUpdateTransactionId(void *state, uint16_t *id) {
     SCReturn;
 }
 
+/**
+ * \brief Read the dcerpc parser settings. The stub depth is shared by
+ *        DCERPC over TCP and DCERPC over SMB.
+ */
+static void DCERPCParserConfig(void) {
+    intmax_t value = 0;
+
+    SC_ATOMIC_INIT(dcerpc_stub_skipped);
+
+    if ((ConfGetInt("dcerpc.stub-depth", &value)) == 1 && value > 0) {
+        dcerpc_stub_depth = (uint32_t)value;
+    } else {
+        dcerpc_stub_depth = 0;
+    }
+    SCLogDebug("dcerpc \"stub-depth\": %"PRIu32, dcerpc_stub_depth);
+}
+
 void RegisterDCERPCParsers(void) {
     AppLayerRegisterProto("dcerpc", ALPROTO_DCERPC, STREAM_TOSERVER,
             DCERPCParse);
@@ -1723,6 +1765,19 @@ void RegisterDCERPCParsers(void) {
             DCERPCStateFree);
     AppLayerRegisterTransactionIdFuncs(ALPROTO_DCERPC,
             DCERPCUpdateTransactionId, NULL);
+
+    DCERPCParserConfig();
+}
+
+/**
+ * \brief Print the number of stub data bytes that were not buffered
+ */
+void DCERPCAtExitPrintStats(void) {
+    if (dcerpc_stub_depth == 0)
+        return;
+
+    SCLogInfo("dcerpc: %"PRIu64" stub data bytes skipped past stub-depth %"PRIu32,
+            (uint64_t)SC_ATOMIC_GET(dcerpc_stub_skipped), dcerpc_stub_depth);
 }
 
 /* UNITTESTS */
@@ -5627,6 +5682,108 @@ end:
     return result;
 }
 
+/**
+ * \test DCERPC request stub data past the stub depth is parsed, but not
+ *       buffered.
+ */
+int DCERPCParserTest19(void) {
+    int result = 1;
+    Flow f;
+    int r = 0;
+    uint8_t request1[] = {
+        0x05, 0x00, 0x00, 0x03, 0x10, 0x00, 0x00, 0x00,
+        0x2C, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00,
+        0x0c, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02, 0x00,
+        0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08,
+        0x09, 0x0A, 0x0B, 0x0C
+    };
+    uint32_t request1_len = sizeof(request1);
+
+    uint8_t request2[] = {
+        0x0D, 0x0E
+    };
+    uint32_t request2_len = sizeof(request2);
+
+    uint8_t request3[] = {
+        0x0F, 0x10, 0x11, 0x12, 0x13, 0x14
+    };
+    uint32_t request3_len = sizeof(request3);
+
+    TcpSession ssn;
+    uint32_t depth = dcerpc_stub_depth;
+    uint64_t skipped = SC_ATOMIC_GET(dcerpc_stub_skipped);
+
+    memset(&f, 0, sizeof(f));
+    memset(&ssn, 0, sizeof(ssn));
+
+    FLOW_INITIALIZE(&f);
+    f.protoctx = (void *)&ssn;
+
+    StreamTcpInitConfig(TRUE);
+    FlowL7DataPtrInit(&f);
+
+    dcerpc_stub_depth = 13;
+
+    r = AppLayerParse(&f, ALPROTO_DCERPC, STREAM_TOSERVER|STREAM_START,
+                      request1, request1_len);
+    if (r != 0) {
+        printf("dcerpc header check returned %" PRId32 ", expected 0: ", r);
+        result = 0;
+        goto end;
+    }
+
+    DCERPCState *dcerpc_state = f.aldata[AlpGetStateIdx(ALPROTO_DCERPC)];
+    if (dcerpc_state == NULL) {
+        printf("no dcerpc state: ");
+        result = 0;
+        goto end;
+    }
+
+    result &= (dcerpc_state->dcerpc.bytesprocessed == 36);
+    result &= (dcerpc_state->dcerpc.dcerpcrequest.stub_data_buffer != NULL &&
+               dcerpc_state->dcerpc.dcerpcrequest.stub_data_buffer_len == 12);
+
+    /* 1 byte buffered, 1 byte skipped */
+    r = AppLayerParse(&f, ALPROTO_DCERPC, STREAM_TOSERVER,
+                      request2, request2_len);
+    if (r != 0) {
+        printf("dcerpc header check returned %" PRId32 ", expected 0: ", r);
+        result = 0;
+        goto end;
+    }
+
+    result &= (dcerpc_state->dcerpc.bytesprocessed == 38);
+    result &= (dcerpc_state->dcerpc.dcerpcrequest.stub_data_buffer_len == 13);
+    result &= (dcerpc_state->dcerpc.dcerpcrequest.stub_data_buffer[12] == 0x0D);
+
+    /* all skipped, but the pdu is still completed */
+    r = AppLayerParse(&f, ALPROTO_DCERPC, STREAM_TOSERVER,
+                      request3, request3_len);
+    if (r != 0) {
+        printf("dcerpc header check returned %" PRId32 ", expected 0: ", r);
+        result = 0;
+        goto end;
+    }
+
+    result &= (dcerpc_state->dcerpc.bytesprocessed == 0);
+    result &= (dcerpc_state->dcerpc.dcerpcrequest.stub_data_buffer_len == 13);
+    result &= (dcerpc_state->dcerpc.dcerpcrequest.stub_data_fresh == 0);
+    result &= (dcerpc_state->dcerpc.pdu_fragged == 0);
+
+    if (SC_ATOMIC_GET(dcerpc_stub_skipped) - skipped != 7) {
+        printf("expected 7 skipped bytes, got %"PRIu64": ",
+               (uint64_t)(SC_ATOMIC_GET(dcerpc_stub_skipped) - skipped));
+        result = 0;
+    }
+
+end:
+    dcerpc_stub_depth = depth;
+    FlowL7DataPtrFree(&f);
+    StreamTcpFreeConfig(TRUE);
+    FLOW_DESTROY(&f);
+    return result;
+}
+
 #endif /* UNITTESTS */
 
 void DCERPCParserRegisterTests(void) {
@@ -5650,6 +5807,7 @@ void DCERPCParserRegisterTests(void) {
     UtRegisterTest("DCERPCParserTest16", DCERPCParserTest16, 1);
     UtRegisterTest("DCERPCParserTest17", DCERPCParserTest17, 1);
     UtRegisterTest("DCERPCParserTest18", DCERPCParserTest18, 1);
+    UtRegisterTest("DCERPCParserTest19", DCERPCParserTest19, 1);
 #endif /* UNITTESTS */
 
     return;
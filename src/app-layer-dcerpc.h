@@ -36,6 +36,7 @@ typedef struct DCERPCState_ {
 } DCERPCState;
 
 void RegisterDCERPCParsers(void);
+void DCERPCAtExitPrintStats(void);
 void DCERPCParserTests(void);
 void DCERPCParserRegisterTests(void);
 
@@ -184,7 +184,8 @@ static uint16_t AlpProtoMatchSignature(AlpProtoSignature *s, uint8_t *buf,
     SCLogDebug("s->co->offset (%"PRIu16") s->co->depth (%"PRIu16")",
                 s->co->offset, s->co->depth);
 
-    uint8_t *found = SpmSearch(sbuf, sbuflen, s->co->content, s->co->content_len);
+    uint8_t *found = SpmCtxSearch(s->co->content, s->co->content_len,
+                                  sbuf, sbuflen, s->co->bm_ctx);
     if (found != NULL) {
         proto = s->proto;
     }
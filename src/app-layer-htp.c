@@ -48,6 +48,7 @@
 #include "util-debug.h"
 #include "app-layer-htp.h"
 #include "util-time.h"
+#include "util-atomic.h"
 #include <htp/htp.h>
 
 #include "util-unittest.h"
@@ -67,6 +68,8 @@ typedef struct HTPCfgRec_ {
 
     /** max size of the client body we inspect */
     uint32_t            request_body_limit;
+    /** max number of live transactions per flow */
+    uint16_t            tx_limit;
 } HTPCfgRec;
 
 /** Fast lookup tree (radix) for the various HTP configurations */
@@ -83,6 +86,11 @@ static uint64_t htp_state_memcnt = 0;
 
 static uint8_t need_htp_request_body = 0;
 
+/** transactions freed after inspection and logging */
+SC_ATOMIC_DECLARE(uint64_t, htp_tx_freed);
+/** transactions freed early because the flow hit its tx-limit */
+SC_ATOMIC_DECLARE(uint64_t, htp_tx_limit_freed);
+
 
 #if 0 /* Not used yet */
 /**
@@ -175,6 +183,101 @@ error:
     SCReturnPtr(NULL, "void");
 }
 
+/** \brief Free our per transaction user data, including the body chunks */
+static void HtpTxUserDataFree(SCHtpTxUserData *htud)
+{
+    HtpBodyFree(&htud->body);
+    if (htud->body_mpm_pids != NULL)
+        SCFree(htud->body_mpm_pids);
+    SCFree(htud);
+}
+
+/**
+ * \brief Destroy a transaction that libhtp is done with.
+ *
+ * \retval 1 transaction destroyed
+ * \retval 0 libhtp is still working on it
+ */
+static int HTPTransactionFree(HtpState *s, htp_tx_t *tx)
+{
+    /* libhtp looks up the transaction of the next response by index, so
+     * only transactions that have their response parsed are safe to go */
+    if (tx->progress != TX_PROGRESS_DONE || tx == s->connp->in_tx ||
+            tx == s->connp->out_tx)
+        return 0;
+
+    SCHtpTxUserData *htud = (SCHtpTxUserData *) htp_tx_get_user_data(tx);
+    if (htud != NULL) {
+        htp_tx_set_user_data(tx, NULL);
+        HtpTxUserDataFree(htud);
+    }
+
+    /* the tx is replaced by NULL in the list, the index of the other
+     * transactions is preserved */
+    htp_tx_destroy(tx);
+    return 1;
+}
+
+/**
+ * \brief Destroy the transactions before index 'upto', oldest first. Stops
+ *        at the first transaction libhtp is still working on.
+ *
+ * \param s http state
+ * \param upto index of the first transaction to keep
+ *
+ * \retval number of transactions destroyed
+ */
+static uint16_t HTPStateFreeTransactions(HtpState *s, uint16_t upto)
+{
+    uint16_t freed = 0;
+
+    if (s->connp == NULL || s->connp->conn == NULL)
+        return 0;
+
+    size_t size = list_size(s->connp->conn->transactions);
+    if (upto > size)
+        upto = (uint16_t)size;
+
+    for ( ; s->transaction_freed < upto; s->transaction_freed++) {
+        htp_tx_t *tx = list_get(s->connp->conn->transactions,
+                                s->transaction_freed);
+        if (tx == NULL)
+            continue;
+
+        if (HTPTransactionFree(s, tx) == 0)
+            break;
+
+        freed++;
+    }
+
+    SCLogDebug("state %p: freed %"PRIu16" transactions, %"PRIu16" freed in "
+               "total", s, freed, s->transaction_freed);
+    return freed;
+}
+
+/**
+ * \brief Enforce the per flow transaction limit by destroying the oldest
+ *        completed transactions, even if they are not inspected or logged
+ *        yet. Transactions libhtp is still working on are kept.
+ */
+static void HTPStateEnforceTxLimit(HtpState *s)
+{
+    if (s->tx_limit == 0 || s->connp == NULL || s->connp->conn == NULL)
+        return;
+
+    size_t size = list_size(s->connp->conn->transactions);
+    if (size - s->transaction_freed <= s->tx_limit)
+        return;
+
+    uint16_t freed = HTPStateFreeTransactions(s,
+            (uint16_t)(size - s->tx_limit));
+    if (freed > 0) {
+        SCLogDebug("state %p: tx-limit %"PRIu16" reached, freed %"PRIu16
+                   " transactions", s, s->tx_limit, freed);
+        SC_ATOMIC_ADD(htp_tx_limit_freed, (uint64_t)freed);
+    }
+}
+
 /** \brief Function to frees the HTTP state memory and also frees the HTTP
  *         connection parser memory which was used by the HTP library
  */
@@ -199,8 +302,7 @@ void HTPStateFree(void *state)
                 if (tx != NULL) {
                     SCHtpTxUserData *htud = (SCHtpTxUserData *) htp_tx_get_user_data(tx);
                     if (htud != NULL) {
-                        HtpBodyFree(&htud->body);
-                        SCFree(htud);
+                        HtpTxUserDataFree(htud);
                     }
                     htp_tx_set_user_data(tx, NULL);
                 }
@@ -246,20 +348,24 @@ void HTPStateUpdateTransactionId(void *state, uint16_t *id) {
 }
 
 /**
- *  \brief HTP transaction cleanup callback
+ *  \brief HTP transaction cleanup callback, called for each transaction id
+ *         the detection engine and the loggers are done with.
  *
- *  \warning We cannot actually free the transactions here. It seems that
- *           HTP only accepts freeing of transactions in the response callback.
+ *  \warning Transactions whose response is not fully parsed yet can't be
+ *           freed here, libhtp still needs them. Those are freed once their
+ *           response data is parsed.
  */
 void HTPStateTransactionFree(void *state, uint16_t id) {
     SCEnter();
 
     HtpState *s = (HtpState *)state;
 
-    s->transaction_done = id;
+    s->transaction_done = id + 1;
     SCLogDebug("state %p, id %"PRIu16, s, id);
 
-    /* we can't remove the actual transactions here */
+    uint16_t freed = HTPStateFreeTransactions(s, s->transaction_done);
+    if (freed > 0)
+        SC_ATOMIC_ADD(htp_tx_freed, (uint64_t)freed);
 
     SCReturn;
 }
@@ -359,11 +465,13 @@ static int HTPHandleRequestData(Flow *f, void *htp_state,
                 SCLogDebug("LIBHTP using config: %p", htp);
 
                 hstate->request_body_limit = htp_cfg_rec->request_body_limit;
+                hstate->tx_limit = htp_cfg_rec->tx_limit;
             }
         } else {
             SCLogDebug("Using default HTP config: %p", htp);
 
             hstate->request_body_limit = cfglist.request_body_limit;
+            hstate->tx_limit = cfglist.tx_limit;
         }
 
         if (NULL == htp) {
@@ -529,6 +637,12 @@ static int HTPHandleResponseData(Flow *f, void *htp_state,
             hstate->flags &= ~HTP_FLAG_NEW_BODY_SET;
      }
 
+    /* remove obsolete transactions that were still waiting for their
+     * response when the detection engine and the loggers were done */
+    uint16_t freed = HTPStateFreeTransactions(hstate, hstate->transaction_done);
+    if (freed > 0)
+        SC_ATOMIC_ADD(htp_tx_freed, (uint64_t)freed);
+
     /* if we the TCP connection is closed, then close the HTTP connection */
     if ((pstate->flags & APP_LAYER_PARSER_EOF) &&
             ! (hstate->flags & HTP_FLAG_STATE_CLOSED) &&
@@ -740,14 +854,17 @@ int HTPCallbackRequestBodyData(htp_tx_data_t *d)
  */
 void HTPAtExitPrintStats(void)
 {
-#ifdef DEBUG
     SCEnter();
+    SCLogInfo("htp: %"PRIu64" transactions freed after inspection, %"PRIu64
+              " freed early by tx-limit", (uint64_t)SC_ATOMIC_GET(htp_tx_freed),
+              (uint64_t)SC_ATOMIC_GET(htp_tx_limit_freed));
+#ifdef DEBUG
     SCMutexLock(&htp_state_mem_lock);
     SCLogDebug("http_state_memcnt %"PRIu64", http_state_memuse %"PRIu64"",
                 htp_state_memcnt, htp_state_memuse);
     SCMutexUnlock(&htp_state_mem_lock);
-    SCReturn;
 #endif
+    SCReturn;
 }
 
 /** \brief Clears the HTTP server configuration memory used by HTP library */
@@ -786,6 +903,8 @@ static int HTPCallbackRequest(htp_connp_t *connp) {
 
     SCLogDebug("HTTP request completed");
 
+    HTPStateEnforceTxLimit(hstate);
+
     SCReturnInt(HOOK_OK);
 }
 
@@ -806,24 +925,6 @@ static int HTPCallbackResponse(htp_connp_t *connp) {
     /* Unset the body inspection (if any) */
     hstate->flags &=~ HTP_FLAG_NEW_BODY_SET;
 
-    /* remove obsolete transactions */
-    size_t idx;
-    for (idx = 0; idx < hstate->transaction_done; idx++) {
-        htp_tx_t *tx = list_get(hstate->connp->conn->transactions, idx);
-        if (tx == NULL)
-            continue;
-
-        /* This will remove obsolete body chunks */
-        SCHtpTxUserData *htud = (SCHtpTxUserData *) htp_tx_get_user_data(tx);
-        if (htud != NULL) {
-            HtpBodyFree(&htud->body);
-            htp_tx_set_user_data(tx, NULL);
-            SCFree(htud);
-        }
-
-        htp_tx_destroy(tx);
-    }
-
     SCReturnInt(HOOK_OK);
 }
 
@@ -838,6 +939,9 @@ static void HTPConfigure(void)
 
     cfglist.next = NULL;
 
+    SC_ATOMIC_INIT(htp_tx_freed);
+    SC_ATOMIC_INIT(htp_tx_limit_freed);
+
     cfgtree = SCRadixCreateRadixTree(NULL, NULL);
     if (NULL == cfgtree) {
         SCLogError(SC_ERR_MEM_ALLOC, "Error initializing HTP config tree");
@@ -866,6 +970,7 @@ static void HTPConfigure(void)
     SCLogDebug("LIBHTP default config: %p", cfglist.cfg);
 
     cfglist.request_body_limit = HTP_CONFIG_DEFAULT_REQUEST_BODY_LIMIT;
+    cfglist.tx_limit = HTP_CONFIG_DEFAULT_TX_LIMIT;
     htp_config_register_request(cfglist.cfg, HTPCallbackRequest);
     htp_config_register_response(cfglist.cfg, HTPCallbackResponse);
     htp_config_set_generate_request_uri_normalized(cfglist.cfg, 1);
@@ -932,6 +1037,25 @@ static void HTPConfigure(void)
                     }
 
                 }
+            } else if (strcasecmp("tx-limit", p->name) == 0) {
+                /* max live transactions per flow */
+                TAILQ_FOREACH(pval, &p->head, next) {
+                    SCLogDebug("LIBHTP default: %s=%s",
+                               p->name, pval->val);
+
+                    int limit = atoi(pval->val);
+
+                    if (limit >= 0 && limit <= UINT16_MAX) {
+                        cfglist.tx_limit = (uint16_t)limit;
+                    } else {
+                        SCLogWarning(SC_ERR_UNKNOWN_VALUE,
+                                "LIBHTP malformed tx-limit \"%s\", using "
+                                "default %u", pval->val,
+                                HTP_CONFIG_DEFAULT_TX_LIMIT);
+                        cfglist.tx_limit = HTP_CONFIG_DEFAULT_TX_LIMIT;
+                        continue;
+                    }
+                }
             } else {
                 SCLogWarning(SC_ERR_UNKNOWN_VALUE,
                         "LIBHTP Ignoring unknown default config: %s",
@@ -988,6 +1112,7 @@ static void HTPConfigure(void)
             }
 
             htprec->request_body_limit = HTP_CONFIG_DEFAULT_REQUEST_BODY_LIMIT;
+            htprec->tx_limit = cfglist.tx_limit;
             htp_config_register_request(htp, HTPCallbackRequest);
             htp_config_register_response(htp, HTPCallbackResponse);
             htp_config_set_generate_request_uri_normalized(htp, 1);
@@ -1084,6 +1209,25 @@ static void HTPConfigure(void)
                         }
 
                     }
+                } else if (strcasecmp("tx-limit", p->name) == 0) {
+                    /* max live transactions per flow */
+                    TAILQ_FOREACH(pval, &p->head, next) {
+                        SCLogDebug("LIBHTP server %s: %s=%s",
+                                   s->name, p->name, pval->val);
+
+                        int limit = atoi(pval->val);
+
+                        if (limit >= 0 && limit <= UINT16_MAX) {
+                            htprec->tx_limit = (uint16_t)limit;
+                        } else {
+                            SCLogWarning(SC_ERR_UNKNOWN_VALUE,
+                                    "LIBHTP malformed tx-limit \"%s\", "
+                                    "using default %u", pval->val,
+                                    cfglist.tx_limit);
+                            htprec->tx_limit = cfglist.tx_limit;
+                            continue;
+                        }
+                    }
                 } else {
                     SCLogWarning(SC_ERR_UNKNOWN_VALUE,
                                  "LIBHTP Ignoring unknown server config: %s",
@@ -1109,6 +1253,7 @@ static void HtpConfigCreateBackup(void)
     cfglist_backup.cfg = cfglist.cfg;
     cfglist_backup.next = cfglist.next;
     cfglist_backup.request_body_limit = cfglist.request_body_limit;
+    cfglist_backup.tx_limit = cfglist.tx_limit;
 
     return;
 }
@@ -1118,6 +1263,7 @@ static void HtpConfigRestoreBackup(void)
     cfglist.cfg = cfglist_backup.cfg;
     cfglist.next = cfglist_backup.next;
     cfglist.request_body_limit = cfglist_backup.request_body_limit;
+    cfglist.tx_limit = cfglist_backup.tx_limit;
 
     return;
 }
@@ -2040,6 +2186,188 @@ end:
     return result;
 }
 
+/** \test Transactions are freed as soon as they are done, but not before
+ *        their response is parsed. */
+int HTPParserTest07(void) {
+    int result = 0;
+    Flow f;
+    HtpState *htp_state = NULL;
+    uint8_t httpbuf1[] = "GET /one HTTP/1.1\r\nHost: www.openinfosecfoundation.org\r\n\r\n"
+                         "GET /two HTTP/1.1\r\nHost: www.openinfosecfoundation.org\r\n\r\n"
+                         "GET /three HTTP/1.1\r\nHost: www.openinfosecfoundation.org\r\n\r\n";
+    uint32_t httplen1 = sizeof(httpbuf1) - 1; /* minus the \0 */
+    uint8_t httpbuf2[] = "HTTP/1.1 200 OK\r\nContent-Length: 0\r\n\r\n"
+                         "HTTP/1.1 200 OK\r\nContent-Length: 0\r\n\r\n";
+    uint32_t httplen2 = sizeof(httpbuf2) - 1; /* minus the \0 */
+    uint8_t httpbuf3[] = "HTTP/1.1 200 OK\r\nContent-Length: 0\r\n\r\n";
+    uint32_t httplen3 = sizeof(httpbuf3) - 1; /* minus the \0 */
+    TcpSession ssn;
+
+    memset(&f, 0, sizeof(f));
+    memset(&ssn, 0, sizeof(ssn));
+    f.protoctx = (void *)&ssn;
+    f.src.family = AF_INET;
+    f.dst.family = AF_INET;
+
+    StreamTcpInitConfig(TRUE);
+    FlowL7DataPtrInit(&f);
+
+    int r = AppLayerParse(&f, ALPROTO_HTTP, STREAM_TOSERVER|STREAM_START,
+                          httpbuf1, httplen1);
+    if (r != 0) {
+        printf("toserver chunk 1 returned %" PRId32 ", expected 0: ", r);
+        goto end;
+    }
+
+    r = AppLayerParse(&f, ALPROTO_HTTP, STREAM_TOCLIENT|STREAM_START,
+                      httpbuf2, httplen2);
+    if (r != 0) {
+        printf("toclient chunk 2 returned %" PRId32 ", expected 0: ", r);
+        goto end;
+    }
+
+    htp_state = f.aldata[AlpGetStateIdx(ALPROTO_HTTP)];
+    if (htp_state == NULL) {
+        printf("no http state: ");
+        goto end;
+    }
+
+    if (list_size(htp_state->connp->conn->transactions) != 3) {
+        printf("expected 3 transactions, got %"PRIuMAX": ",
+               (uintmax_t)list_size(htp_state->connp->conn->transactions));
+        goto end;
+    }
+
+    /* inspection and logging are done with all three */
+    HTPStateTransactionFree(htp_state, 0);
+    HTPStateTransactionFree(htp_state, 1);
+    HTPStateTransactionFree(htp_state, 2);
+
+    if (list_get(htp_state->connp->conn->transactions, 0) != NULL ||
+        list_get(htp_state->connp->conn->transactions, 1) != NULL) {
+        printf("transactions 0 and 1 should have been freed: ");
+        goto end;
+    }
+
+    /* the third has no response yet */
+    if (list_get(htp_state->connp->conn->transactions, 2) == NULL ||
+        htp_state->transaction_freed != 2) {
+        printf("transaction 2 shouldn't have been freed: ");
+        goto end;
+    }
+
+    r = AppLayerParse(&f, ALPROTO_HTTP, STREAM_TOCLIENT, httpbuf3, httplen3);
+    if (r != 0) {
+        printf("toclient chunk 3 returned %" PRId32 ", expected 0: ", r);
+        goto end;
+    }
+
+    if (list_get(htp_state->connp->conn->transactions, 2) != NULL ||
+        htp_state->transaction_freed != 3) {
+        printf("transaction 2 should have been freed after its response: ");
+        goto end;
+    }
+
+    result = 1;
+end:
+    FlowL7DataPtrFree(&f);
+    StreamTcpFreeConfig(TRUE);
+    if (htp_state != NULL)
+        HTPStateFree(htp_state);
+    return result;
+}
+
+/** \test Completed transactions are freed early when the flow has more
+ *        live transactions than the tx-limit. */
+int HTPParserTest08(void) {
+    int result = 0;
+    Flow f;
+    HtpState *htp_state = NULL;
+    uint8_t httpbuf1[] = "GET /one HTTP/1.1\r\nHost: www.openinfosecfoundation.org\r\n\r\n"
+                         "GET /two HTTP/1.1\r\nHost: www.openinfosecfoundation.org\r\n\r\n";
+    uint32_t httplen1 = sizeof(httpbuf1) - 1; /* minus the \0 */
+    uint8_t httpbuf2[] = "HTTP/1.1 200 OK\r\nContent-Length: 0\r\n\r\n"
+                         "HTTP/1.1 200 OK\r\nContent-Length: 0\r\n\r\n";
+    uint32_t httplen2 = sizeof(httpbuf2) - 1; /* minus the \0 */
+    uint8_t httpbuf3[] = "GET /three HTTP/1.1\r\nHost: www.openinfosecfoundation.org\r\n\r\n"
+                         "GET /four HTTP/1.1\r\nHost: www.openinfosecfoundation.org\r\n\r\n";
+    uint32_t httplen3 = sizeof(httpbuf3) - 1; /* minus the \0 */
+    TcpSession ssn;
+    uint16_t tx_limit = cfglist.tx_limit;
+    uint64_t limit_freed = SC_ATOMIC_GET(htp_tx_limit_freed);
+
+    memset(&f, 0, sizeof(f));
+    memset(&ssn, 0, sizeof(ssn));
+    f.protoctx = (void *)&ssn;
+    f.src.family = AF_INET;
+    f.dst.family = AF_INET;
+
+    StreamTcpInitConfig(TRUE);
+    FlowL7DataPtrInit(&f);
+
+    cfglist.tx_limit = 2;
+
+    int r = AppLayerParse(&f, ALPROTO_HTTP, STREAM_TOSERVER|STREAM_START,
+                          httpbuf1, httplen1);
+    if (r != 0) {
+        printf("toserver chunk 1 returned %" PRId32 ", expected 0: ", r);
+        goto end;
+    }
+
+    r = AppLayerParse(&f, ALPROTO_HTTP, STREAM_TOCLIENT|STREAM_START,
+                      httpbuf2, httplen2);
+    if (r != 0) {
+        printf("toclient chunk 2 returned %" PRId32 ", expected 0: ", r);
+        goto end;
+    }
+
+    /* two new requests make 4 live transactions, the 2 completed ones
+     * have to go, even though they were never inspected */
+    r = AppLayerParse(&f, ALPROTO_HTTP, STREAM_TOSERVER, httpbuf3, httplen3);
+    if (r != 0) {
+        printf("toserver chunk 3 returned %" PRId32 ", expected 0: ", r);
+        goto end;
+    }
+
+    htp_state = f.aldata[AlpGetStateIdx(ALPROTO_HTTP)];
+    if (htp_state == NULL) {
+        printf("no http state: ");
+        goto end;
+    }
+
+    if (htp_state->tx_limit != 2) {
+        printf("expected tx_limit 2, got %"PRIu16": ", htp_state->tx_limit);
+        goto end;
+    }
+
+    if (list_get(htp_state->connp->conn->transactions, 0) != NULL ||
+        list_get(htp_state->connp->conn->transactions, 1) != NULL) {
+        printf("transactions 0 and 1 should have been freed: ");
+        goto end;
+    }
+
+    if (list_get(htp_state->connp->conn->transactions, 2) == NULL ||
+        list_get(htp_state->connp->conn->transactions, 3) == NULL) {
+        printf("transactions 2 and 3 shouldn't have been freed: ");
+        goto end;
+    }
+
+    if (SC_ATOMIC_GET(htp_tx_limit_freed) - limit_freed != 2) {
+        printf("expected 2 transactions freed by the tx-limit, got %"PRIu64": ",
+               (uint64_t)(SC_ATOMIC_GET(htp_tx_limit_freed) - limit_freed));
+        goto end;
+    }
+
+    result = 1;
+end:
+    cfglist.tx_limit = tx_limit;
+    FlowL7DataPtrFree(&f);
+    StreamTcpFreeConfig(TRUE);
+    if (htp_state != NULL)
+        HTPStateFree(htp_state);
+    return result;
+}
+
 #endif /* UNITTESTS */
 
 /**
@@ -2053,6 +2381,8 @@ void HTPParserRegisterTests(void) {
     UtRegisterTest("HTPParserTest04", HTPParserTest04, 1);
     UtRegisterTest("HTPParserTest05", HTPParserTest05, 1);
     UtRegisterTest("HTPParserTest06", HTPParserTest06, 1);
+    UtRegisterTest("HTPParserTest07", HTPParserTest07, 1);
+    UtRegisterTest("HTPParserTest08", HTPParserTest08, 1);
     UtRegisterTest("HTPParserConfigTest01", HTPParserConfigTest01, 1);
     UtRegisterTest("HTPParserConfigTest02", HTPParserConfigTest02, 1);
     UtRegisterTest("HTPParserConfigTest03", HTPParserConfigTest03, 1);
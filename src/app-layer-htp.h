@@ -28,11 +28,14 @@
 #define __APP_LAYER_HTP_H__
 
 #include "util-radix-tree.h"
+#include "util-mpm.h"
 
 #include <htp/htp.h>
 
 /* default request body limit */
 #define HTP_CONFIG_DEFAULT_REQUEST_BODY_LIMIT    4096U
+/* default max number of live transactions per flow, 0 for no limit */
+#define HTP_CONFIG_DEFAULT_TX_LIMIT              0U
 
 #define HTP_FLAG_STATE_OPEN         0x01    /**< Flag to indicate that HTTP
                                              connection is open */
@@ -96,6 +99,13 @@ typedef struct SCHtpTxUserData_ {
     /* Holds the length of the htp request body seen so far */
     uint32_t content_len_so_far;
     uint8_t flags;
+    /* mpm state of the request body, so body chunks are scanned only once.
+     * The offset of the state holds the id of the last scanned chunk. */
+    MpmStreamState body_mpm_state;
+    /* pattern ids the mpm found in the request body so far */
+    uint32_t *body_mpm_pids;
+    uint16_t body_mpm_pids_cnt;
+    uint16_t body_mpm_pids_size;
 } SCHtpTxUserData;
 
 typedef struct HtpState_ {
@@ -104,7 +114,11 @@ typedef struct HtpState_ {
                                  each connection */
     uint8_t flags;
     uint16_t transaction_cnt;
-    uint16_t transaction_done;
+    uint16_t transaction_done;  /**< number of transactions the detection
+                                     engine and the loggers are done with */
+    uint16_t transaction_freed; /**< transactions below this index are
+                                     destroyed */
+    uint16_t tx_limit;          /**< max number of live transactions */
     uint32_t request_body_limit;
 } HtpState;
 
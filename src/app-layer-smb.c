@@ -44,6 +44,9 @@
 #include "util-spm.h"
 #include "util-unittest.h"
 #include "util-memcmp.h"
+#include "util-atomic.h"
+
+#include "conf.h"
 
 #include "app-layer-smb.h"
 
@@ -59,6 +62,12 @@ enum {
     SMB_FIELD_MAX,
 };
 
+/** max number of data bytes per READ/WRITE AndX command that are passed on
+ *  to the DCERPC parser, 0 for no limit. Set from "smb.data-depth". */
+static uint32_t smb_data_depth = 0;
+/** READ/WRITE AndX data bytes skipped because of smb_data_depth */
+SC_ATOMIC_DECLARE(uint64_t, smb_data_skipped);
+
 /**
  *  \brief SMB Write AndX Request Parsing
  */
@@ -595,6 +604,32 @@ static int32_t DataParser(void *smb_state, AppLayerParserState *pstate,
     SCReturnInt(parsed);
 }
 
+/**
+ * \brief Skip the READ/WRITE AndX data past the data depth. The bytes are
+ *        consumed without looking at them. A DCERPC PDU in the data can't
+ *        be followed after this, so the DCERPC parser starts over with the
+ *        data of the next command.
+ * \retval Number of bytes skipped
+ */
+static uint32_t SMBSkipData(SMBState *sstate, uint32_t input_len) {
+    SCEnter();
+
+    uint32_t skip = (sstate->bytecount.bytecountleft < input_len) ?
+        sstate->bytecount.bytecountleft : input_len;
+
+    sstate->bytecount.bytecountleft -= skip;
+    sstate->bytesprocessed += skip;
+    sstate->andx.dataparsed += skip;
+
+    sstate->dcerpc.bytesprocessed = 0;
+    sstate->dcerpc.pdu_fragged = 0;
+
+    SC_ATOMIC_ADD(smb_data_skipped, (uint64_t)skip);
+    SCLogDebug("skipped %"PRIu32" data bytes past data-depth", skip);
+
+    SCReturnUInt(skip);
+}
+
 /**
  * \brief Obtain SMB WordCount which is 2 times the value.
  * Reset bytecount.bytecountbytes to 0.
@@ -611,6 +646,7 @@ static uint32_t SMBGetWordCount(Flow *f, void *smb_state,
         sstate->wordcount.wordcountleft = sstate->wordcount.wordcount;
         sstate->bytesprocessed++;
         sstate->bytecount.bytecountbytes = 0;
+        sstate->andx.dataparsed = 0;
         sstate->andx.isandx = isAndX(sstate);
         SCLogDebug("Wordcount (%u):", sstate->wordcount.wordcount);
         SCReturnUInt(1U);
@@ -728,12 +764,33 @@ static uint32_t SMBParseByteCount(Flow *f, void *smb_state,
         }
 
         if (sstate->andx.datalength && input_len) {
+            uint32_t data_len = input_len;
+            /* only READ/WRITE data is subject to the data depth */
+            uint8_t depth_limited = (smb_data_depth > 0 &&
+                    (sstate->smb.command == SMB_COM_READ_ANDX ||
+                     sstate->smb.command == SMB_COM_WRITE_ANDX));
+
+            if (depth_limited) {
+                if (sstate->andx.dataparsed >= smb_data_depth) {
+                    parsed += SMBSkipData(sstate, input_len);
+                    SCReturnUInt(parsed);
+                }
+                if (smb_data_depth - sstate->andx.dataparsed < data_len)
+                    data_len = smb_data_depth - sstate->andx.dataparsed;
+            }
 		/* Uncomment the next line to help debug DCERPC over SMB */
 		//hexdump(f, input + parsed, input_len);
-            sres = DataParser(sstate, pstate, input + parsed, input_len, output);
+            sres = DataParser(sstate, pstate, input + parsed, data_len, output);
             if (sres != -1) {
                 parsed += (uint32_t)sres;
                 input_len -= (uint32_t)sres;
+                sstate->andx.dataparsed += (uint32_t)sres;
+
+                if (depth_limited && input_len &&
+                        sstate->andx.dataparsed >= smb_data_depth) {
+                    parsed += SMBSkipData(sstate, input_len);
+                    SCReturnUInt(parsed);
+                }
             } else { /* Did not Validate as DCERPC over SMB */
                 while (sstate->bytecount.bytecountleft-- && input_len--) {
                     SCLogDebug("0x%02x bytecount %"PRIu16"/%"PRIu16" input_len %"PRIu32, *p,
@@ -742,6 +799,7 @@ static uint32_t SMBParseByteCount(Flow *f, void *smb_state,
                     p++;
                 }
                 sstate->bytesprocessed += (p - input);
+                sstate->andx.dataparsed += (p - input);
                 SCReturnUInt((p - input));
             }
         }
@@ -1257,12 +1315,41 @@ void SMBUpdateTransactionId(void *state, uint16_t *id) {
     SCReturn;
 }
 
+/**
+ * \brief Read the smb parser settings.
+ */
+static void SMBParserConfig(void) {
+    intmax_t value = 0;
+
+    SC_ATOMIC_INIT(smb_data_skipped);
+
+    if ((ConfGetInt("smb.data-depth", &value)) == 1 && value > 0) {
+        smb_data_depth = (uint32_t)value;
+    } else {
+        smb_data_depth = 0;
+    }
+    SCLogDebug("smb \"data-depth\": %"PRIu32, smb_data_depth);
+}
+
+/**
+ * \brief Print the number of READ/WRITE data bytes that were skipped
+ */
+void SMBAtExitPrintStats(void) {
+    if (smb_data_depth == 0)
+        return;
+
+    SCLogInfo("smb: %"PRIu64" READ/WRITE data bytes skipped past data-depth %"PRIu32,
+            (uint64_t)SC_ATOMIC_GET(smb_data_skipped), smb_data_depth);
+}
+
 void RegisterSMBParsers(void) {
     AppLayerRegisterProto("smb", ALPROTO_SMB, STREAM_TOSERVER, SMBParse);
     AppLayerRegisterProto("smb", ALPROTO_SMB, STREAM_TOCLIENT, SMBParse);
     AppLayerRegisterStateFuncs(ALPROTO_SMB, SMBStateAlloc, SMBStateFree);
     AppLayerRegisterTransactionIdFuncs(ALPROTO_SMB,
             SMBUpdateTransactionId, NULL);
+
+    SMBParserConfig();
 }
 
 /* UNITTESTS */
@@ -1803,6 +1890,90 @@ end:
     return result;
 }
 
+/**
+ * \test WriteAndX data past the data depth is skipped and not handed to
+ *       the DCERPC parser.
+ */
+int SMBParserTest05(void) {
+    int result = 0;
+    Flow f;
+    uint8_t smbbuf[] = {
+    0x00, 0x00, 0x00, 0x88, 0xff, 0x53, 0x4d, 0x42,
+    0x2f, 0x00, 0x00, 0x00, 0x00, 0x18, 0x07, 0xc8,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x08, 0x7c, 0x05,
+    0x00, 0x08, 0x00, 0x00, 0x0e, 0xff, 0x00, 0x00,
+    0x00, 0x00, 0x40, 0x00, 0x00, 0x00, 0x00, 0xff,
+    0x00, 0x00, 0x00, 0x08, 0x00, 0x48, 0x00, 0x00,
+    0x00, 0x48, 0x00, 0x40, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x49, 0x00, 0xab, 0x05, 0x00, 0x0b, 0x03,
+    0x10, 0x00, 0x00, 0x00, 0x48, 0x00, 0x00, 0x00,
+    0x01, 0x00, 0x00, 0x00, 0xd0, 0x16, 0xd0, 0x16,
+    0x00, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x01, 0x00, 0x78, 0x56, 0x34, 0x12,
+    0x34, 0x12, 0xcd, 0xab, 0xef, 0x00, 0x01, 0x23,
+    0x45, 0x67, 0x89, 0xab, 0x01, 0x00, 0x00, 0x00,
+    0x04, 0x5d, 0x88, 0x8a, 0xeb, 0x1c, 0xc9, 0x11,
+    0x9f, 0xe8, 0x08, 0x00, 0x2b, 0x10, 0x48, 0x60,
+    0x02, 0x00, 0x00, 0x00 };
+    uint32_t smblen = sizeof(smbbuf);
+    TcpSession ssn;
+    uint32_t depth = smb_data_depth;
+    uint64_t skipped = SC_ATOMIC_GET(smb_data_skipped);
+
+    memset(&f, 0, sizeof(f));
+    memset(&ssn, 0, sizeof(ssn));
+    f.protoctx = (void *)&ssn;
+
+    StreamTcpInitConfig(TRUE);
+    FlowL7DataPtrInit(&f);
+
+    /* only the dcerpc header of the bind is parsed */
+    smb_data_depth = 16;
+
+    int r = AppLayerParse(&f, ALPROTO_SMB, STREAM_TOSERVER|STREAM_START, smbbuf, smblen);
+    if (r != 0) {
+        printf("smb header check returned %" PRId32 ", expected 0: ", r);
+        goto end;
+    }
+
+    SMBState *smb_state = f.aldata[AlpGetStateIdx(ALPROTO_SMB)];
+    if (smb_state == NULL) {
+        printf("no smb state: ");
+        goto end;
+    }
+
+    if (smb_state->smb.command != SMB_COM_WRITE_ANDX) {
+        printf("expected SMB command 0x%02x , got 0x%02x : ", SMB_COM_WRITE_ANDX, smb_state->smb.command);
+        goto end;
+    }
+
+    if (smb_state->bytesprocessed != 0) {
+        printf("expected the whole smb record to be consumed, bytesprocessed %u: ",
+               smb_state->bytesprocessed);
+        goto end;
+    }
+
+    if (smb_state->dcerpc.bytesprocessed != 0 ||
+        !TAILQ_EMPTY(&smb_state->dcerpc.dcerpcbindbindack.uuid_list)) {
+        printf("bind ctx items shouldn't have been parsed: ");
+        goto end;
+    }
+
+    if (SC_ATOMIC_GET(smb_data_skipped) - skipped != 56) {
+        printf("expected 56 skipped bytes, got %"PRIu64": ",
+               (uint64_t)(SC_ATOMIC_GET(smb_data_skipped) - skipped));
+        goto end;
+    }
+
+    result = 1;
+end:
+    smb_data_depth = depth;
+    FlowL7DataPtrFree(&f);
+    StreamTcpFreeConfig(TRUE);
+    return result;
+}
+
 #endif
 
 void SMBParserRegisterTests(void) {
@@ -1812,6 +1983,7 @@ void SMBParserRegisterTests(void) {
     UtRegisterTest("SMBParserTest02", SMBParserTest02, 1);
     UtRegisterTest("SMBParserTest03", SMBParserTest03, 1);
     UtRegisterTest("SMBParserTest04", SMBParserTest04, 1);
+    UtRegisterTest("SMBParserTest05", SMBParserTest05, 1);
 #endif
 }
 
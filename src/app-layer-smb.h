@@ -73,6 +73,8 @@ typedef struct SMBAndX_ {
     uint16_t datalength;
     uint16_t datalengthhigh;
     uint64_t dataoffset;
+    /* data bytes of the current command looked at so far */
+    uint32_t dataparsed;
 } SMBAndX;
 
 typedef struct SMBState_ {
@@ -158,6 +160,7 @@ typedef struct SMBState_ {
 #define SMB_COM_GET_PRINT_QUEUE	 	0xC3
 
 void RegisterSMBParsers(void);
+void SMBAtExitPrintStats(void);
 void SMBParserRegisterTests(void);
 int isAndX(SMBState *smb_state);
 
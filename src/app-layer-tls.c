@@ -162,6 +162,49 @@ static int TLSParseClientVersion(Flow *f, void *tls_state, AppLayerParserState *
     SCReturnInt(0);
 }
 
+/**
+ * \brief Skip the part of a record body that we didn't get to in an earlier
+ *        chunk of data. Record bodies are never parsed or stored, we only
+ *        keep track of how much of the current one is still to come.
+ *
+ *  \param  record_left Bytes of the record body still to skip, updated
+ *  \param  input       Pointer to the input data, updated
+ *  \param  input_len   Length of the input data, updated
+ *
+ *  \retval 1 if all of the input was part of the record body
+ *  \retval 0 if there is input left after the record body
+ */
+static inline int TLSSkipRecordBody(uint32_t *record_left, uint8_t **input,
+                                    uint32_t *input_len)
+{
+    if (*record_left >= *input_len) {
+        *record_left -= *input_len;
+        return 1;
+    }
+
+    *input += *record_left;
+    *input_len -= *record_left;
+    *record_left = 0;
+    return 0;
+}
+
+/**
+ * \brief Check if the data may be a SSLv2 record. TLS records start with
+ *        their content type, so anything else is left to the SSLv2 parser.
+ */
+static inline int TLSMaybeSSLv2Record(uint8_t *input)
+{
+    switch (*input) {
+        case TLS_CHANGE_CIPHER_SPEC:
+        case TLS_ALERT_PROTOCOL:
+        case TLS_HANDSHAKE_PROTOCOL:
+        case TLS_APPLICATION_PROTOCOL:
+            return 0;
+        default:
+            return 1;
+    }
+}
+
 /**
  * \brief Function to parse the TLS field in packet received from the client
  *
@@ -177,9 +220,23 @@ static int TLSParseClientRecord(Flow *f, void *tls_state, AppLayerParserState *p
 {
     SCEnter();
 
+    TlsState *state = (TlsState *)tls_state;
+
+    if (pstate == NULL)
+        SCReturnInt(-1);
+
+    /* skip the rest of a record body we've seen the header of before. In
+     * the encrypted phase this is where almost all data ends up. */
+    if (state->client_record_left > 0 && pstate->parse_field == 0) {
+        if (TLSSkipRecordBody(&state->client_record_left, &input, &input_len) == 1)
+            SCReturnInt(1);
+    }
+
     /* SSL client message should be larger than 9 bytes as we need to know, to
        what is the SSL version and message type */
-    if (input_len >= 9) {
+    if (input_len >= 9 && pstate->parse_field == 0 &&
+        TLSMaybeSSLv2Record(input))
+    {
         if (SSLParseClientRecord(f, tls_state, pstate, input, input_len, output)
                 == 1)
         {
@@ -196,9 +253,6 @@ static int TLSParseClientRecord(Flow *f, void *tls_state, AppLayerParserState *p
     int16_t u = 0;
     uint32_t offset = 0;
 
-    if (pstate == NULL)
-        SCReturnInt(-1);
-
     for (u = pstate->parse_field; u < max_fields; u++) {
         SCLogDebug("u %" PRIu32 "", u);
 
@@ -282,9 +336,13 @@ static int TLSParseClientRecord(Flow *f, void *tls_state, AppLayerParserState *p
 
                 /* if our input buffer is bigger than the data up to and
                  * including the current record, we instruct the parser to
-                 * expect another record of 3 fields */
-                if (input_len <= record_offset)
+                 * expect another record of 3 fields. Otherwise remember how
+                 * much of the record body is still to come, so we can skip
+                 * it without looking at it. */
+                if (input_len <= record_offset) {
+                    state->client_record_left = record_offset - input_len;
                     break;
+                }
 
                 max_fields += 3;
                 offset += record_len;
@@ -313,7 +371,20 @@ static int TLSParseServerRecord(Flow *f, void *tls_state, AppLayerParserState *p
 {
     SCEnter();
 
-    if (input_len >= 7) {
+    TlsState *state = (TlsState *)tls_state;
+
+    if (pstate == NULL)
+        SCReturnInt(-1);
+
+    /* skip the rest of a record body we've seen the header of before */
+    if (state->server_record_left > 0 && pstate->parse_field == 0) {
+        if (TLSSkipRecordBody(&state->server_record_left, &input, &input_len) == 1)
+            SCReturnInt(1);
+    }
+
+    if (input_len >= 7 && pstate->parse_field == 0 &&
+        TLSMaybeSSLv2Record(input))
+    {
         if (SSLParseServerRecord(f, tls_state, pstate, input, input_len, output)
                 == 1)
         {
@@ -330,9 +401,6 @@ static int TLSParseServerRecord(Flow *f, void *tls_state, AppLayerParserState *p
     int16_t u = 0;
     uint32_t offset = 0;
 
-    if (pstate == NULL)
-        SCReturnInt(-1);
-
     for (u = pstate->parse_field; u < max_fields; u++) {
         SCLogDebug("u %" PRIu32 "", u);
 
@@ -414,9 +482,12 @@ static int TLSParseServerRecord(Flow *f, void *tls_state, AppLayerParserState *p
 
                 /* if our input buffer is bigger than the data up to and
                  * including the current record, we instruct the parser to
-                 * expect another record of 3 fields */
-                if (input_len <= record_offset)
+                 * expect another record of 3 fields. Otherwise remember how
+                 * much of the record body is still to come. */
+                if (input_len <= record_offset) {
+                    state->server_record_left = record_offset - input_len;
                     break;
+                }
 
                 max_fields += 3;
                 offset += record_len;
@@ -840,7 +911,7 @@ end:
 static int TLSParserTest05(void) {
     int result = 1;
     Flow f;
-    uint8_t tlsbuf[] = { 0x16, 0x03, 0x01, 0x00, 0x01 };
+    uint8_t tlsbuf[] = { 0x16, 0x03, 0x01, 0x00, 0x00 };
     uint32_t tlslen = sizeof(tlsbuf);
     TcpSession ssn;
 
@@ -945,7 +1016,7 @@ end:
 static int TLSParserTest06(void) {
     int result = 1;
     Flow f;
-    uint8_t tlsbuf[] = { 0x16, 0x03, 0x01, 0x00, 0x01 };
+    uint8_t tlsbuf[] = { 0x16, 0x03, 0x01, 0x00, 0x00 };
     uint32_t tlslen = sizeof(tlsbuf);
     TcpSession ssn;
 
@@ -1280,7 +1351,7 @@ end:
 static int TLSParserTest08(void) {
     int result = 1;
     Flow f;
-    uint8_t tlsbuf[] = { 0x16, 0x03, 0x00, 0x00, 0x01 };
+    uint8_t tlsbuf[] = { 0x16, 0x03, 0x00, 0x00, 0x00 };
     uint32_t tlslen = sizeof(tlsbuf);
     TcpSession ssn;
 
@@ -1378,6 +1449,159 @@ end:
     return result;
 }
 
+/** \test   Test that the body of a record spanning 2 chunks is skipped and
+ *          not mistaken for a record header. */
+static int TLSParserTest09(void) {
+    int result = 0;
+    Flow f;
+    /* handshake record of 10 bytes, only 3 of them in this chunk */
+    uint8_t tlsbuf1[] = { 0x16, 0x03, 0x01, 0x00, 0x0a, 0x01, 0x02, 0x03 };
+    uint32_t tlslen1 = sizeof(tlsbuf1);
+    /* rest of the body, which looks like a change cipher spec record,
+     * followed by an alert record */
+    uint8_t tlsbuf2[] = { 0x14, 0x03, 0x01, 0x00, 0x00, 0x00, 0x00,
+                          0x15, 0x03, 0x01, 0x00, 0x00 };
+    uint32_t tlslen2 = sizeof(tlsbuf2);
+    TcpSession ssn;
+
+    memset(&f, 0, sizeof(f));
+    memset(&ssn, 0, sizeof(ssn));
+    f.protoctx = (void *)&ssn;
+
+    StreamTcpInitConfig(TRUE);
+    FlowL7DataPtrInit(&f);
+
+    int r = AppLayerParse(&f, ALPROTO_TLS, STREAM_TOSERVER, tlsbuf1, tlslen1);
+    if (r != 0) {
+        printf("toserver chunk 1 returned %" PRId32 ", expected 0: ", r);
+        goto end;
+    }
+
+    TlsState *tls_state = f.aldata[AlpGetStateIdx(ALPROTO_TLS)];
+    if (tls_state == NULL) {
+        printf("no tls state: ");
+        goto end;
+    }
+
+    if (tls_state->client_record_left != 7) {
+        printf("expected 7 bytes of record left, got %" PRIu32 ": ",
+                tls_state->client_record_left);
+        goto end;
+    }
+
+    r = AppLayerParse(&f, ALPROTO_TLS, STREAM_TOSERVER, tlsbuf2, tlslen2);
+    if (r != 0) {
+        printf("toserver chunk 2 returned %" PRId32 ", expected 0: ", r);
+        goto end;
+    }
+
+    if (tls_state->client_content_type != 0x15) {
+        printf("expected content_type %" PRIu8 ", got %" PRIu8 ": ", 0x15,
+                tls_state->client_content_type);
+        goto end;
+    }
+
+    if (tls_state->flags & TLS_FLAG_CLIENT_CHANGE_CIPHER_SPEC) {
+        printf("record body was parsed as a change cipher spec: ");
+        goto end;
+    }
+
+    if (tls_state->client_record_left != 0) {
+        printf("expected 0 bytes of record left, got %" PRIu32 ": ",
+                tls_state->client_record_left);
+        goto end;
+    }
+
+    result = 1;
+end:
+    FlowL7DataPtrFree(&f);
+    StreamTcpFreeConfig(TRUE);
+    return result;
+}
+
+/** \test   Test that inspection stops at the header of the first application
+ *          data record after the handshake, and that the rest of the record
+ *          is skipped. */
+static int TLSParserTest10(void) {
+    int result = 0;
+    Flow f;
+    uint8_t tlsbuf[] = { 0x16, 0x03, 0x01, 0x00, 0x00 };
+    uint32_t tlslen = sizeof(tlsbuf);
+    /* application data record of 256 bytes, only 4 of them in this chunk */
+    uint8_t appbuf[] = { 0x17, 0x03, 0x01, 0x01, 0x00,
+                         0x16, 0x03, 0x01, 0x00 };
+    uint32_t applen = sizeof(appbuf);
+    TcpSession ssn;
+
+    memset(&f, 0, sizeof(f));
+    memset(&ssn, 0, sizeof(ssn));
+    f.protoctx = (void *)&ssn;
+
+    StreamTcpInitConfig(TRUE);
+    FlowL7DataPtrInit(&f);
+
+    int r = AppLayerParse(&f, ALPROTO_TLS, STREAM_TOSERVER, tlsbuf, tlslen);
+    if (r != 0) {
+        printf("toserver chunk 1 returned %" PRId32 ", expected 0: ", r);
+        goto end;
+    }
+
+    r = AppLayerParse(&f, ALPROTO_TLS, STREAM_TOCLIENT, tlsbuf, tlslen);
+    if (r != 0) {
+        printf("toclient chunk 1 returned %" PRId32 ", expected 0: ", r);
+        goto end;
+    }
+
+    tlsbuf[0] = 0x14;
+
+    r = AppLayerParse(&f, ALPROTO_TLS, STREAM_TOSERVER, tlsbuf, tlslen);
+    if (r != 0) {
+        printf("toserver chunk 2 returned %" PRId32 ", expected 0: ", r);
+        goto end;
+    }
+
+    r = AppLayerParse(&f, ALPROTO_TLS, STREAM_TOCLIENT, tlsbuf, tlslen);
+    if (r != 0) {
+        printf("toclient chunk 2 returned %" PRId32 ", expected 0: ", r);
+        goto end;
+    }
+
+    r = AppLayerParse(&f, ALPROTO_TLS, STREAM_TOSERVER, appbuf, applen);
+    if (r != 0) {
+        printf("toserver chunk 3 returned %" PRId32 ", expected 0: ", r);
+        goto end;
+    }
+
+    TlsState *tls_state = f.aldata[AlpGetStateIdx(ALPROTO_TLS)];
+    if (tls_state == NULL) {
+        printf("no tls state: ");
+        goto end;
+    }
+
+    if (tls_state->client_content_type != 0x17) {
+        printf("expected content_type %" PRIu8 ", got %" PRIu8 ": ", 0x17,
+                tls_state->client_content_type);
+        goto end;
+    }
+
+    if (tls_state->client_record_left != 252) {
+        printf("expected 252 bytes of record left, got %" PRIu32 ": ",
+                tls_state->client_record_left);
+        goto end;
+    }
+
+    if (!(f.flags & FLOW_NOPAYLOAD_INSPECTION)) {
+        printf("no payload inspection flag should be set: ");
+        goto end;
+    }
+
+    result = 1;
+end:
+    FlowL7DataPtrFree(&f);
+    StreamTcpFreeConfig(TRUE);
+    return result;
+}
+
 #endif /* UNITTESTS */
 
 void TLSParserRegisterTests(void) {
@@ -1390,6 +1614,8 @@ void TLSParserRegisterTests(void) {
     UtRegisterTest("TLSParserTest06", TLSParserTest06, 1);
     UtRegisterTest("TLSParserTest07", TLSParserTest07, 1);
     UtRegisterTest("TLSParserTest08", TLSParserTest08, 1);
+    UtRegisterTest("TLSParserTest09", TLSParserTest09, 1);
+    UtRegisterTest("TLSParserTest10", TLSParserTest10, 1);
 
     UtRegisterTest("TLSParserMultimsgTest01", TLSParserMultimsgTest01, 1);
     UtRegisterTest("TLSParserMultimsgTest02", TLSParserMultimsgTest02, 1);
@@ -61,6 +61,11 @@ typedef struct TlsState_ {
 
     uint16_t server_version;        /**< Server TLS version storage field */
     uint8_t server_content_type;    /**< Server content type storage field */
+
+    uint32_t client_record_left;    /**< Bytes of the current client record
+                                         body not yet seen */
+    uint32_t server_record_left;    /**< Bytes of the current server record
+                                         body not yet seen */
 } TlsState;
 
 enum {
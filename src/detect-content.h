@@ -51,6 +51,9 @@
 #define DETECT_CONTENT_HMD_MPM           0x00020000
 #define DETECT_CONTENT_HCD_MPM           0x00040000
 
+/** fast pattern taken from a pcre of a rule without content */
+#define DETECT_CONTENT_PCRE_LITERAL      0x00080000
+
 #define DETECT_CONTENT_IS_SINGLE(c) (!((c)->flags & DETECT_CONTENT_DISTANCE || \
                                        (c)->flags & DETECT_CONTENT_WITHIN || \
                                        (c)->flags & DETECT_CONTENT_RELATIVE_NEXT || \
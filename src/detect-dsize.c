@@ -83,6 +83,29 @@ error:
     return;
 }
 
+/**
+ * \brief Match a payload size against the dsize: options of a sig
+ *
+ * \param dd pointer to the dsize data
+ * \param dsize payload size
+ *
+ * \retval 0 no match
+ * \retval 1 match
+ */
+int DetectDsizeMatchValue(const DetectDsizeData *dd, uint16_t dsize)
+{
+    if (dd->mode == DETECTDSIZE_EQ && dd->dsize == dsize)
+        return 1;
+    else if (dd->mode == DETECTDSIZE_LT && dsize < dd->dsize)
+        return 1;
+    else if (dd->mode == DETECTDSIZE_GT && dsize > dd->dsize)
+        return 1;
+    else if (dd->mode == DETECTDSIZE_RA && dsize > dd->dsize && dsize < dd->dsize2)
+        return 1;
+
+    return 0;
+}
+
 /**
  * \internal
  * \brief This function is used to match flags on a packet with those passed via dsize:
@@ -109,14 +132,7 @@ int DetectDsizeMatch (ThreadVars *t, DetectEngineThreadCtx *det_ctx, Packet *p,
 
     SCLogDebug("p->payload_len %"PRIu16"", p->payload_len);
 
-    if (dd->mode == DETECTDSIZE_EQ && dd->dsize == p->payload_len)
-        ret = 1;
-    else if (dd->mode == DETECTDSIZE_LT && p->payload_len < dd->dsize)
-        ret = 1;
-    else if (dd->mode == DETECTDSIZE_GT && p->payload_len > dd->dsize)
-        ret = 1;
-    else if (dd->mode == DETECTDSIZE_RA && p->payload_len > dd->dsize && p->payload_len < dd->dsize2)
-        ret = 1;
+    ret = DetectDsizeMatchValue(dd, p->payload_len);
 
     SCReturnInt(ret);
 }
@@ -37,6 +37,7 @@ typedef struct DetectDsizeData_ {
 
 /* prototypes */
 void DetectDsizeRegister (void);
+int DetectDsizeMatchValue(const DetectDsizeData *, uint16_t);
 
 #endif /* __DETECT_DSIZE_H__ */
 
@@ -34,6 +34,7 @@
 #include "util-cidr.h"
 #include "util-unittest.h"
 #include "util-rule-vars.h"
+#include "util-clock.h"
 
 #include "detect-engine-siggroup.h"
 #include "detect-engine-address.h"
@@ -1295,6 +1296,16 @@ void DetectAddressHeadCleanup(DetectAddressHead *gh)
             DetectAddressCleanupList(gh->ipv6_head);
             gh->ipv6_head = NULL;
         }
+        if (gh->ipv4_lookup != NULL) {
+            SCFree(gh->ipv4_lookup);
+            gh->ipv4_lookup = NULL;
+        }
+        gh->ipv4_lookup_cnt = 0;
+        if (gh->ipv6_lookup != NULL) {
+            SCFree(gh->ipv6_lookup);
+            gh->ipv6_lookup = NULL;
+        }
+        gh->ipv6_lookup_cnt = 0;
     }
 
     return;
@@ -1580,9 +1591,189 @@ void DetectAddressPrint(DetectAddress *gr)
     return;
 }
 
+/**
+ * \brief Compare 2 ipv6 addresses in host order.
+ *
+ * \retval -1 a < b
+ * \retval  0 a == b
+ * \retval  1 a > b
+ */
+static inline int DetectAddressLookupCmpIPv6(const uint32_t *a, const uint32_t *b)
+{
+    int i;
+
+    for (i = 0; i < 4; i++) {
+        if (a[i] < b[i])
+            return -1;
+        if (a[i] > b[i])
+            return 1;
+    }
+
+    return 0;
+}
+
+/**
+ * \brief Build the sorted lookup arrays of a final DetectAddressHead, so
+ *        that DetectAddressLookupInHead can do a binary search instead of
+ *        walking the lists.
+ *
+ *        The arrays are only built if the lists are ordered and have no
+ *        internal overlap, in which case the binary search returns the
+ *        same group the list walk would. Entries of another family never
+ *        match in the walk, so they are left out. If the lists can't be
+ *        searched this way, or on alloc failure, the walk is used.
+ *
+ * \param gh Pointer to the address group head.
+ *
+ * \retval size memory used by the arrays, 0 if none were built.
+ */
+uint32_t DetectAddressHeadBuildLookup(DetectAddressHead *gh)
+{
+    DetectAddress *ag;
+    uint32_t cnt, size = 0;
+
+    if (gh == NULL)
+        return 0;
+
+    if (gh->ipv4_lookup == NULL && gh->ipv4_head != NULL) {
+        for (cnt = 0, ag = gh->ipv4_head; ag != NULL; ag = ag->next) {
+            if (ag->ip.family == AF_INET)
+                cnt++;
+        }
+
+        DetectAddressLookupIPv4 *array = NULL;
+        if (cnt > 0)
+            array = SCMalloc(cnt * sizeof(DetectAddressLookupIPv4));
+        if (array != NULL) {
+            uint32_t i = 0;
+            for (ag = gh->ipv4_head; ag != NULL; ag = ag->next) {
+                if (ag->ip.family != AF_INET)
+                    continue;
+
+                array[i].ip = ntohl(ag->ip.addr_data32[0]);
+                array[i].ip2 = ntohl(ag->ip2.addr_data32[0]);
+                array[i].ag = ag;
+
+                if (array[i].ip > array[i].ip2 ||
+                    (i > 0 && array[i].ip <= array[i - 1].ip2))
+                {
+                    SCLogDebug("ipv4 list not ordered, using the list walk");
+                    SCFree(array);
+                    array = NULL;
+                    break;
+                }
+                i++;
+            }
+        }
+        if (array != NULL) {
+            gh->ipv4_lookup = array;
+            gh->ipv4_lookup_cnt = cnt;
+            size += cnt * sizeof(DetectAddressLookupIPv4);
+        }
+    }
+
+    if (gh->ipv6_lookup == NULL && gh->ipv6_head != NULL) {
+        for (cnt = 0, ag = gh->ipv6_head; ag != NULL; ag = ag->next) {
+            if (ag->ip.family == AF_INET6)
+                cnt++;
+        }
+
+        DetectAddressLookupIPv6 *array = NULL;
+        if (cnt > 0)
+            array = SCMalloc(cnt * sizeof(DetectAddressLookupIPv6));
+        if (array != NULL) {
+            uint32_t i = 0;
+            for (ag = gh->ipv6_head; ag != NULL; ag = ag->next) {
+                if (ag->ip.family != AF_INET6)
+                    continue;
+
+                int w;
+                for (w = 0; w < 4; w++) {
+                    array[i].ip[w] = ntohl(ag->ip.addr_data32[w]);
+                    array[i].ip2[w] = ntohl(ag->ip2.addr_data32[w]);
+                }
+                array[i].ag = ag;
+
+                if (DetectAddressLookupCmpIPv6(array[i].ip, array[i].ip2) > 0 ||
+                    (i > 0 && DetectAddressLookupCmpIPv6(array[i].ip,
+                                                         array[i - 1].ip2) <= 0))
+                {
+                    SCLogDebug("ipv6 list not ordered, using the list walk");
+                    SCFree(array);
+                    array = NULL;
+                    break;
+                }
+                i++;
+            }
+        }
+        if (array != NULL) {
+            gh->ipv6_lookup = array;
+            gh->ipv6_lookup_cnt = cnt;
+            size += cnt * sizeof(DetectAddressLookupIPv6);
+        }
+    }
+
+    return size;
+}
+
+/**
+ * \brief Binary search for the ipv4 group holding an address.
+ *
+ * \param ip address in host order
+ */
+static inline DetectAddress *DetectAddressLookupIPv4InArray(DetectAddressHead *gh,
+                                                           uint32_t ip)
+{
+    DetectAddressLookupIPv4 *array = gh->ipv4_lookup;
+    uint32_t lo = 0, hi = gh->ipv4_lookup_cnt;
+
+    /* find the first group that doesn't end before the address */
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (array[mid].ip2 < ip)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if (lo < gh->ipv4_lookup_cnt && array[lo].ip <= ip)
+        return array[lo].ag;
+
+    return NULL;
+}
+
+/**
+ * \brief Binary search for the ipv6 group holding an address.
+ *
+ * \param ip address in host order
+ */
+static inline DetectAddress *DetectAddressLookupIPv6InArray(DetectAddressHead *gh,
+                                                           uint32_t *ip)
+{
+    DetectAddressLookupIPv6 *array = gh->ipv6_lookup;
+    uint32_t lo = 0, hi = gh->ipv6_lookup_cnt;
+
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (DetectAddressLookupCmpIPv6(array[mid].ip2, ip) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if (lo < gh->ipv6_lookup_cnt &&
+        DetectAddressLookupCmpIPv6(array[lo].ip, ip) <= 0)
+        return array[lo].ag;
+
+    return NULL;
+}
+
 /**
  * \brief Find the group matching address in a group head.
  *
+ *        Uses the sorted lookup arrays if DetectAddressHeadBuildLookup
+ *        set them up, otherwise walks the lists.
+ *
  * \param gh Pointer to the address group head(DetectAddressHead instance).
  * \param a  Pointer to an Address instance.
  *
@@ -1602,9 +1793,19 @@ DetectAddress *DetectAddressLookupInHead(DetectAddressHead *gh, Address *a)
     /* XXX should we really do this check every time we run this function? */
     if (a->family == AF_INET) {
         SCLogDebug("IPv4");
+        if (gh->ipv4_lookup != NULL) {
+            g = DetectAddressLookupIPv4InArray(gh, ntohl(a->addr_data32[0]));
+            SCReturnPtr(g, "DetectAddress");
+        }
         g = gh->ipv4_head;
     } else if (a->family == AF_INET6) {
         SCLogDebug("IPv6");
+        if (gh->ipv6_lookup != NULL) {
+            uint32_t ip[4] = { ntohl(a->addr_data32[0]), ntohl(a->addr_data32[1]),
+                               ntohl(a->addr_data32[2]), ntohl(a->addr_data32[3]) };
+            g = DetectAddressLookupIPv6InArray(gh, ip);
+            SCReturnPtr(g, "DetectAddress");
+        }
         g = gh->ipv6_head;
     } else {
         SCLogDebug("ANY");
@@ -4078,6 +4279,164 @@ int AddressTestParseInvalidMask03(void)
     return result;
 }
 
+/**
+ * \test Check that the sorted array lookup returns the same groups as the
+ *       list walk.
+ */
+static int AddressTestLookupInHead01(void)
+{
+    int result = 0;
+    char *addrs[] = { "0.0.0.0", "1.2.3.3", "1.2.3.4", "1.2.3.5", "2.3.4.5",
+                      "4.3.2.1", "9.255.255.255", "10.0.0.0", "10.10.10.10",
+                      "10.255.255.255", "11.0.0.0", "192.168.1.1",
+                      "255.255.255.255", "::", "2001::1", "2001:db8::",
+                      "2001:db8::ffff", "2001:db9::", "fe80::1",
+                      "ffff:ffff:ffff:ffff:ffff:ffff:ffff:ffff", NULL };
+    DetectAddress *walk[32];
+    Address a;
+    int i;
+
+    DetectAddressHead *gh = DetectAddressHeadInit();
+    if (gh == NULL)
+        return 0;
+
+    if (DetectAddressParse(gh, "[1.2.3.4,2.3.4.5,4.3.2.1,10.0.0.0/8,"
+                "192.168.0.0/16,2001:db8::/32,fe80::/64]") != 0)
+        goto end;
+
+    for (i = 0; addrs[i] != NULL; i++) {
+        memset(&a, 0, sizeof(a));
+        if (inet_pton(AF_INET, addrs[i], &a.addr_data32[0]) == 1) {
+            a.family = AF_INET;
+        } else if (inet_pton(AF_INET6, addrs[i], &a.addr_data32[0]) == 1) {
+            a.family = AF_INET6;
+        } else {
+            goto end;
+        }
+        walk[i] = DetectAddressLookupInHead(gh, &a);
+    }
+
+    if (DetectAddressHeadBuildLookup(gh) == 0 ||
+        gh->ipv4_lookup == NULL || gh->ipv6_lookup == NULL)
+        goto end;
+
+    for (i = 0; addrs[i] != NULL; i++) {
+        memset(&a, 0, sizeof(a));
+        if (inet_pton(AF_INET, addrs[i], &a.addr_data32[0]) == 1) {
+            a.family = AF_INET;
+        } else {
+            inet_pton(AF_INET6, addrs[i], &a.addr_data32[0]);
+            a.family = AF_INET6;
+        }
+        if (DetectAddressLookupInHead(gh, &a) != walk[i]) {
+            printf("lookup of %s differs from the list walk: ", addrs[i]);
+            goto end;
+        }
+    }
+
+    /* sanity check a few of the walk results themselves */
+    if (walk[2] == NULL || walk[1] != NULL || walk[6] != NULL ||
+        walk[8] == NULL || walk[15] == NULL || walk[17] != NULL)
+        goto end;
+
+    result = 1;
+end:
+    DetectAddressHeadFree(gh);
+    return result;
+}
+
+/** Uncomment this if you want stats
+ *  #define ENABLE_ADDRESS_LOOKUP_STATS 1
+ */
+
+#ifdef ENABLE_ADDRESS_LOOKUP_STATS
+
+/* Number of times to repeat the lookups (for stats) */
+#define ADDRESS_LOOKUP_STATS_TIMES 10000
+
+/**
+ * \test Stats: DetectAddressLookupInHead over a head of 128 ipv4 and 64
+ *       ipv6 groups, walking the lists versus the sorted lookup arrays.
+ */
+static int AddressTestLookupInHeadStats01(void)
+{
+    int result = 0;
+    char str[32];
+    Address addrs[512];
+    uint32_t cnt_walk = 0, cnt_array = 0;
+    int i, j;
+
+    DetectAddressHead *gh = DetectAddressHeadInit();
+    if (gh == NULL)
+        return 0;
+
+    /* every other network, so that none of the groups are adjacent */
+    for (i = 0; i < 128; i++) {
+        snprintf(str, sizeof(str), "10.0.%d.0/24", i * 2);
+        if (DetectAddressParse(gh, str) != 0)
+            goto end;
+    }
+    for (i = 0; i < 64; i++) {
+        snprintf(str, sizeof(str), "2001:db8:%x::/48", i * 2);
+        if (DetectAddressParse(gh, str) != 0)
+            goto end;
+    }
+
+    /* half of the addresses are in one of the groups */
+    memset(addrs, 0, sizeof(addrs));
+    for (i = 0; i < 256; i++) {
+        addrs[i].family = AF_INET;
+        addrs[i].addr_data32[0] = htonl(0x0A000001 | (i << 8));
+    }
+    for (i = 0; i < 256; i++) {
+        addrs[256 + i].family = AF_INET6;
+        addrs[256 + i].addr_data32[0] = htonl(0x20010db8);
+        addrs[256 + i].addr_data32[1] = htonl((i >> 1) << 16);
+        addrs[256 + i].addr_data32[3] = htonl(1);
+    }
+
+    printf("Address lookup, list walk: ");
+    CLOCK_INIT;
+    CLOCK_START;
+    for (j = 0; j < ADDRESS_LOOKUP_STATS_TIMES; j++) {
+        cnt_walk = 0;
+        for (i = 0; i < 512; i++) {
+            if (DetectAddressLookupInHead(gh, &addrs[i]) != NULL)
+                cnt_walk++;
+        }
+    }
+    CLOCK_END;
+    CLOCK_PRINT_SEC;
+
+    if (DetectAddressHeadBuildLookup(gh) == 0 ||
+        gh->ipv4_lookup == NULL || gh->ipv6_lookup == NULL)
+        goto end;
+
+    printf("Address lookup, sorted arrays: ");
+    CLOCK_START;
+    for (j = 0; j < ADDRESS_LOOKUP_STATS_TIMES; j++) {
+        cnt_array = 0;
+        for (i = 0; i < 512; i++) {
+            if (DetectAddressLookupInHead(gh, &addrs[i]) != NULL)
+                cnt_array++;
+        }
+    }
+    CLOCK_END;
+    CLOCK_PRINT_SEC;
+
+    if (cnt_walk != 256 || cnt_array != cnt_walk) {
+        printf("walk found %"PRIu32", arrays %"PRIu32": ", cnt_walk, cnt_array);
+        goto end;
+    }
+
+    result = 1;
+end:
+    DetectAddressHeadFree(gh);
+    return result;
+}
+
+#endif /* ENABLE_ADDRESS_LOOKUP_STATS */
+
 #endif /* UNITTESTS */
 
 void DetectAddressTests(void)
@@ -4250,5 +4609,10 @@ void DetectAddressTests(void)
                    AddressTestParseInvalidMask02, 1);
     UtRegisterTest("AddressTestParseInvalidMask03",
                    AddressTestParseInvalidMask03, 1);
+
+    UtRegisterTest("AddressTestLookupInHead01", AddressTestLookupInHead01, 1);
+#ifdef ENABLE_ADDRESS_LOOKUP_STATS
+    UtRegisterTest("AddressTestLookupInHeadStats01", AddressTestLookupInHeadStats01, 1);
+#endif
 #endif /* UNITTESTS */
 }
@@ -45,6 +45,7 @@ int DetectAddressInsert(DetectEngineCtx *, DetectAddressHead *, DetectAddress *)
 int DetectAddressJoin(DetectEngineCtx *, DetectAddress *, DetectAddress *);
 
 DetectAddress *DetectAddressLookupInHead(DetectAddressHead *, Address *);
+uint32_t DetectAddressHeadBuildLookup(DetectAddressHead *);
 DetectAddress *DetectAddressLookupInList(DetectAddress *, DetectAddress *);
 
 DetectAddress *DetectAddressCopy(DetectAddress *);
@@ -0,0 +1,837 @@
+/* Copyright (C) 2007-2010 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * \author Victor Julien <victor@inliniac.net>
+ *
+ * Performs the content inspection of a sigmatch list against a buffer:
+ * the packet payload, stream chunks, the http buffers and the dce stub.
+ *
+ * Relative keywords are matched by walking the list and keeping a frame
+ * per sigmatch. If a later sigmatch fails, the last content or pcre with
+ * a relative keyword after it is retried from its next occurence. This is
+ * done iteratively instead of by recursion, so the stack use doesn't grow
+ * with the list.
+ *
+ * The result of the rest of the list only depends on the sigmatch and the
+ * payload_offset it is entered with. As the list is walked from its start,
+ * the depth of a frame identifies its sigmatch. Pairs that failed are
+ * stored in a small memo, so retrying a content doesn't inspect the same
+ * tail again.
+ *
+ * The number of sigmatches inspected per buffer is bounded by the
+ * detect-engine inspection-recursion-limit setting.
+ */
+
+#include "suricata-common.h"
+#include "suricata.h"
+
+#include "decode.h"
+
+#include "detect.h"
+#include "detect-engine.h"
+#include "detect-parse.h"
+#include "detect-content.h"
+#include "detect-pcre.h"
+#include "detect-isdataat.h"
+#include "detect-bytetest.h"
+#include "detect-bytejump.h"
+#include "detect-urilen.h"
+
+#include "detect-engine-content-inspection.h"
+
+#include "app-layer-dcerpc.h"
+
+#include "util-spm.h"
+#include "util-debug.h"
+#include "counters.h"
+
+/** sigmatch didn't match */
+#define INSPECT_NOMATCH         0
+/** sigmatch matched, continue with the next one */
+#define INSPECT_MATCH           1
+/** sigmatch matched and may be retried if the next ones don't match */
+#define INSPECT_MATCH_RETRY     2
+
+/**
+ * \brief Grow the inspection path of the thread to size frames.
+ *
+ * \retval 0 ok
+ * \retval -1 out of memory
+ */
+static int ContentInspectionFramesGrow(DetectEngineThreadCtx *det_ctx,
+                                       uint32_t size)
+{
+    if (size > UINT16_MAX)
+        size = UINT16_MAX;
+    if (size <= det_ctx->inspection_frames_size)
+        return -1;
+
+    DetectEngineInspectionFrame *frames = SCRealloc(det_ctx->inspection_frames,
+            size * sizeof(DetectEngineInspectionFrame));
+    if (frames == NULL)
+        return -1;
+
+    memset(frames + det_ctx->inspection_frames_size, 0,
+           (size - det_ctx->inspection_frames_size) *
+           sizeof(DetectEngineInspectionFrame));
+    det_ctx->inspection_frames = frames;
+    det_ctx->inspection_frames_size = (uint16_t)size;
+    return 0;
+}
+
+/**
+ * \brief Make sure the thread has room for the inspection path of a
+ *        signature and has its fail memo set up.
+ *
+ *  Every failure stored in the memo took a sigmatch inspection, so with
+ *  the memo at twice the budget it won't fill up.
+ *
+ * \retval 0 ok
+ * \retval -1 out of memory
+ */
+static int ContentInspectionThreadSetup(DetectEngineCtx *de_ctx,
+                                        DetectEngineThreadCtx *det_ctx,
+                                        uint16_t sm_cnt)
+{
+    if (det_ctx->inspection_memo == NULL) {
+        uint32_t size = DETECT_ENGINE_INSPECTION_MEMO_MIN;
+
+        if (de_ctx->inspection_recursion_limit < 0) {
+            size = DETECT_ENGINE_INSPECTION_MEMO_MAX;
+        } else {
+            while (size < DETECT_ENGINE_INSPECTION_MEMO_MAX &&
+                   size < 2 * (uint32_t)de_ctx->inspection_recursion_limit)
+                size <<= 1;
+        }
+
+        det_ctx->inspection_memo = SCMalloc(size * sizeof(DetectEngineInspectionMemo));
+        if (det_ctx->inspection_memo == NULL)
+            return -1;
+        memset(det_ctx->inspection_memo, 0, size * sizeof(DetectEngineInspectionMemo));
+        det_ctx->inspection_memo_size = size;
+        det_ctx->inspection_memo_gen = 0;
+    }
+
+    if (sm_cnt > det_ctx->inspection_frames_size) {
+        if (ContentInspectionFramesGrow(det_ctx, sm_cnt) < 0)
+            return -1;
+    }
+
+    /* start a new generation, forgetting the memo of the last inspection */
+    det_ctx->inspection_memo_gen++;
+    if (det_ctx->inspection_memo_gen == 0) {
+        memset(det_ctx->inspection_memo, 0, det_ctx->inspection_memo_size *
+               sizeof(DetectEngineInspectionMemo));
+        memset(det_ctx->inspection_frames, 0, det_ctx->inspection_frames_size *
+               sizeof(DetectEngineInspectionFrame));
+        det_ctx->inspection_memo_gen = 1;
+    }
+
+    return 0;
+}
+
+/**
+ * \brief Free the content inspection data of a thread.
+ */
+void DetectEngineContentInspectionThreadFree(DetectEngineThreadCtx *det_ctx)
+{
+    if (det_ctx->inspection_frames != NULL) {
+        SCFree(det_ctx->inspection_frames);
+        det_ctx->inspection_frames = NULL;
+    }
+    det_ctx->inspection_frames_size = 0;
+
+    if (det_ctx->inspection_memo != NULL) {
+        SCFree(det_ctx->inspection_memo);
+        det_ctx->inspection_memo = NULL;
+    }
+    det_ctx->inspection_memo_size = 0;
+}
+
+/**
+ * \brief Get the content keyword type that is inspected in a mode.
+ */
+static inline uint8_t ContentInspectionContentType(uint8_t mode)
+{
+    switch (mode) {
+        case DETECT_ENGINE_CONTENT_INSPECTION_MODE_URI:
+            return DETECT_URICONTENT;
+        case DETECT_ENGINE_CONTENT_INSPECTION_MODE_HCBD:
+            return DETECT_AL_HTTP_CLIENT_BODY;
+        case DETECT_ENGINE_CONTENT_INSPECTION_MODE_HCD:
+            return DETECT_AL_HTTP_COOKIE;
+        case DETECT_ENGINE_CONTENT_INSPECTION_MODE_HHD:
+            return DETECT_AL_HTTP_HEADER;
+        case DETECT_ENGINE_CONTENT_INSPECTION_MODE_HMD:
+            return DETECT_AL_HTTP_METHOD;
+        case DETECT_ENGINE_CONTENT_INSPECTION_MODE_HRHD:
+            return DETECT_AL_HTTP_RAW_HEADER;
+        default:
+            return DETECT_CONTENT;
+    }
+}
+
+/**
+ * \brief Get the flag of a content that tells us the mpm already matched
+ *        it for the buffer inspected in a mode, 0 if there is none.
+ */
+static inline uint32_t ContentInspectionMpmFlag(uint8_t mode)
+{
+    switch (mode) {
+        case DETECT_ENGINE_CONTENT_INSPECTION_MODE_STREAM:
+            return DETECT_CONTENT_STREAM_MPM;
+        case DETECT_ENGINE_CONTENT_INSPECTION_MODE_URI:
+            return DETECT_CONTENT_URI_MPM;
+        case DETECT_ENGINE_CONTENT_INSPECTION_MODE_HCBD:
+            return DETECT_CONTENT_HCBD_MPM;
+        case DETECT_ENGINE_CONTENT_INSPECTION_MODE_HCD:
+            return DETECT_CONTENT_HCD_MPM;
+        case DETECT_ENGINE_CONTENT_INSPECTION_MODE_HHD:
+            return DETECT_CONTENT_HHD_MPM;
+        case DETECT_ENGINE_CONTENT_INSPECTION_MODE_HMD:
+            return DETECT_CONTENT_HMD_MPM;
+        case DETECT_ENGINE_CONTENT_INSPECTION_MODE_HRHD:
+            return DETECT_CONTENT_HRHD_MPM;
+        default:
+            return 0;
+    }
+}
+
+/**
+ * \brief Check if a sigmatch that fails when entered at an offset also
+ *        fails when entered at any offset after it.
+ *
+ *  This holds for a content that is only relative by distance and has all
+ *  its occurences tried: the part of the buffer it is searched in shrinks
+ *  as the offset grows, and the next sigmatch is entered at the end of
+ *  the occurence in both cases.
+ */
+static inline int ContentInspectionFailsOnwards(SigMatch *sm, uint8_t mode)
+{
+    if (sm->type != ContentInspectionContentType(mode))
+        return 0;
+
+    DetectContentData *cd = (DetectContentData *)sm->ctx;
+    return ((cd->flags & DETECT_CONTENT_DISTANCE) &&
+            (cd->flags & DETECT_CONTENT_RELATIVE_NEXT) &&
+            !(cd->flags & (DETECT_CONTENT_WITHIN | DETECT_CONTENT_NEGATED |
+                           ContentInspectionMpmFlag(mode))) &&
+            cd->depth == 0);
+}
+
+static inline uint32_t ContentInspectionMemoHash(uint16_t pos, uint32_t offset)
+{
+    uint32_t hash = ((uint32_t)pos * 0x9e3779b1U) ^ offset;
+    hash ^= hash >> 16;
+    return hash;
+}
+
+/**
+ * \brief Check if the sigmatch at pos in the list is known to fail when
+ *        entered at offset.
+ *
+ * \retval 1 known to fail
+ * \retval 0 unknown
+ */
+static inline int ContentInspectionMemoLookup(DetectEngineThreadCtx *det_ctx,
+                                              uint16_t pos, uint32_t offset)
+{
+    DetectEngineInspectionFrame *frame = &det_ctx->inspection_frames[pos];
+    uint32_t hash = ContentInspectionMemoHash(pos, offset);
+    int i;
+
+    if (frame->fail_gen == det_ctx->inspection_memo_gen &&
+        offset >= frame->fail_offset)
+        return 1;
+
+    for (i = 0; i < DETECT_ENGINE_INSPECTION_MEMO_PROBE; i++) {
+        DetectEngineInspectionMemo *m = &det_ctx->inspection_memo[(hash + i) &
+            (det_ctx->inspection_memo_size - 1)];
+
+        /* slots are filled in probe order, so a free slot ends the search */
+        if (m->gen != det_ctx->inspection_memo_gen)
+            return 0;
+        if (m->pos == pos && m->offset == offset)
+            return 1;
+    }
+
+    return 0;
+}
+
+/**
+ * \brief Remember that the sigmatch at pos fails when entered at offset.
+ *        If the slots for it are all taken the pair is not stored, which
+ *        only costs us a repeated inspection.
+ */
+static inline void ContentInspectionMemoStore(DetectEngineThreadCtx *det_ctx,
+                                              uint16_t pos, uint32_t offset,
+                                              uint8_t mode)
+{
+    DetectEngineInspectionFrame *frame = &det_ctx->inspection_frames[pos];
+    uint32_t hash = ContentInspectionMemoHash(pos, offset);
+    int i;
+
+    /* one offset covers all the ones after it */
+    if (ContentInspectionFailsOnwards(frame->sm, mode)) {
+        if (frame->fail_gen != det_ctx->inspection_memo_gen ||
+            offset < frame->fail_offset) {
+            frame->fail_gen = det_ctx->inspection_memo_gen;
+            frame->fail_offset = offset;
+        }
+        return;
+    }
+
+    for (i = 0; i < DETECT_ENGINE_INSPECTION_MEMO_PROBE; i++) {
+        DetectEngineInspectionMemo *m = &det_ctx->inspection_memo[(hash + i) &
+            (det_ctx->inspection_memo_size - 1)];
+
+        if (m->gen != det_ctx->inspection_memo_gen) {
+            m->gen = det_ctx->inspection_memo_gen;
+            m->pos = pos;
+            m->offset = offset;
+            return;
+        }
+        if (m->pos == pos && m->offset == offset)
+            return;
+    }
+}
+
+
+/**
+ * \brief Inspect a content. On a retry the search continues after the
+ *        occurence found the last time.
+ *
+ * \retval INSPECT_NOMATCH, INSPECT_MATCH or INSPECT_MATCH_RETRY
+ */
+static int ContentInspectionContent(DetectEngineThreadCtx *det_ctx,
+        DetectEngineInspectionFrame *frame, uint8_t *buffer,
+        uint32_t buffer_len, uint8_t mode, int retry)
+{
+    SigMatch *sm = frame->sm;
+    DetectContentData *cd = (DetectContentData *)sm->ctx;
+    uint32_t prev_payload_offset;
+    uint32_t prev_offset;
+
+    SCLogDebug("inspecting content %"PRIu32" buffer_len %"PRIu32, cd->id, buffer_len);
+
+    if (retry) {
+        prev_payload_offset = frame->prev_payload_offset;
+        prev_offset = frame->prev_offset;
+        SCLogDebug("trying to see if there is another match after prev_offset %"PRIu32, prev_offset);
+    } else {
+        if (buffer_len == 0)
+            return INSPECT_NOMATCH;
+
+        /* we might have already have this content matched by the mpm */
+        if (cd->flags & ContentInspectionMpmFlag(mode) &&
+            !(cd->flags & DETECT_CONTENT_NEGATED))
+            return INSPECT_MATCH;
+
+        prev_payload_offset = det_ctx->payload_offset;
+        prev_offset = 0;
+    }
+
+    /* rule parsers should take care of this */
+#ifdef DEBUG
+    BUG_ON(cd->depth != 0 && cd->depth <= cd->offset);
+#endif
+
+    uint8_t *found = NULL;
+    uint32_t offset = 0;
+    uint32_t depth = buffer_len;
+
+    if (cd->flags & DETECT_CONTENT_DISTANCE ||
+        cd->flags & DETECT_CONTENT_WITHIN) {
+        SCLogDebug("prev_payload_offset %"PRIu32, prev_payload_offset);
+
+        offset = prev_payload_offset;
+        depth = buffer_len;
+
+        if (cd->flags & DETECT_CONTENT_DISTANCE) {
+            if (cd->distance < 0 && (uint32_t)(abs(cd->distance)) > offset)
+                offset = 0;
+            else
+                offset += cd->distance;
+
+            SCLogDebug("cd->distance %"PRIi32", offset %"PRIu32", depth %"PRIu32,
+                cd->distance, offset, depth);
+        }
+
+        if (cd->flags & DETECT_CONTENT_WITHIN) {
+            if ((int32_t)depth > (int32_t)(prev_payload_offset + cd->within)) {
+                depth = prev_payload_offset + cd->within;
+            }
+
+            SCLogDebug("cd->within %"PRIi32", prev_payload_offset %"PRIu32", depth %"PRIu32,
+                cd->within, prev_payload_offset, depth);
+        }
+
+        if (cd->depth != 0) {
+            if ((cd->depth + prev_payload_offset) < depth) {
+                depth = prev_payload_offset + cd->depth;
+            }
+
+            SCLogDebug("cd->depth %"PRIu32", depth %"PRIu32, cd->depth, depth);
+        }
+
+        if (cd->offset > offset) {
+            offset = cd->offset;
+            SCLogDebug("setting offset %"PRIu32, offset);
+        }
+    } else { /* implied no relative matches */
+        /* set depth */
+        if (cd->depth != 0) {
+            depth = cd->depth;
+        }
+
+        /* set offset */
+        offset = cd->offset;
+        prev_payload_offset = 0;
+    }
+
+    /* update offset with prev_offset if we're searching for
+     * matches after the first occurence. */
+    SCLogDebug("offset %"PRIu32", prev_offset %"PRIu32, offset, prev_offset);
+    if (prev_offset != 0)
+        offset = prev_offset;
+
+    SCLogDebug("offset %"PRIu32", depth %"PRIu32, offset, depth);
+
+    if (depth > buffer_len)
+        depth = buffer_len;
+
+    /* if offset is bigger than depth we can never match on a pattern.
+     * We can however, "match" on a negated pattern. */
+    if (offset > depth || depth == 0) {
+        if (cd->flags & DETECT_CONTENT_NEGATED) {
+            return INSPECT_MATCH;
+        } else {
+            return INSPECT_NOMATCH;
+        }
+    }
+
+    uint8_t *sbuffer = buffer + offset;
+    uint32_t sbuffer_len = depth - offset;
+    uint32_t match_offset = 0;
+    SCLogDebug("sbuffer_len %"PRIu32, sbuffer_len);
+#ifdef DEBUG
+    BUG_ON(sbuffer_len > buffer_len);
+#endif
+
+    /* do the actual search */
+    if (cd->flags & DETECT_CONTENT_NOCASE)
+        found = SpmCtxNocaseSearch(cd->content, cd->content_len, sbuffer, sbuffer_len, cd->bm_ctx);
+    else
+        found = SpmCtxSearch(cd->content, cd->content_len, sbuffer, sbuffer_len, cd->bm_ctx);
+
+    /* next we evaluate the result in combination with the
+     * negation flag. */
+    SCLogDebug("found %p cd negated %s", found, cd->flags & DETECT_CONTENT_NEGATED ? "true" : "false");
+
+    if (found == NULL && !(cd->flags & DETECT_CONTENT_NEGATED)) {
+        return INSPECT_NOMATCH;
+    } else if (found == NULL && cd->flags & DETECT_CONTENT_NEGATED) {
+        return INSPECT_MATCH;
+    } else if (found != NULL && cd->flags & DETECT_CONTENT_NEGATED) {
+        SCLogDebug("content %"PRIu32" matched, but negated so no match", cd->id);
+        /* don't bother carrying recursive matches now, for preceding
+         * relative keywords */
+        det_ctx->discontinue_matching = 1;
+        return INSPECT_NOMATCH;
+    }
+
+    match_offset = (uint32_t)((found - buffer) + cd->content_len);
+    SCLogDebug("content %"PRIu32" matched at offset %"PRIu32"", cd->id, match_offset);
+    det_ctx->payload_offset = match_offset;
+
+    if (!(cd->flags & DETECT_CONTENT_RELATIVE_NEXT)) {
+        SCLogDebug("no relative match coming up, so this is a match");
+        return INSPECT_MATCH;
+    }
+
+    /* bail out if we have no next match. Technically this is an
+     * error, as the current cd has the DETECT_CONTENT_RELATIVE_NEXT
+     * flag set. */
+    if (sm->next == NULL) {
+        return INSPECT_NOMATCH;
+    }
+
+    /* if the next content doesn't match at the end of this occurence, it
+     * won't at the end of a later one either */
+    if (ContentInspectionFailsOnwards(sm->next, mode)) {
+        return INSPECT_MATCH;
+    }
+
+    /* if the next keywords don't match, we search for another occurence
+     * of this content starting at the start of this match + 1 */
+    frame->prev_payload_offset = prev_payload_offset;
+    frame->prev_offset = (match_offset - (cd->content_len - 1));
+    return INSPECT_MATCH_RETRY;
+}
+
+/**
+ * \brief Inspect a pcre. On a retry the regex is run again after the
+ *        start of the match found the last time.
+ *
+ * \retval INSPECT_NOMATCH, INSPECT_MATCH or INSPECT_MATCH_RETRY
+ */
+static int ContentInspectionPcre(DetectEngineThreadCtx *det_ctx, Signature *s,
+        DetectEngineInspectionFrame *frame, Flow *f, Packet *p,
+        uint8_t *buffer, uint32_t buffer_len, uint8_t mode, int retry)
+{
+    SigMatch *sm = frame->sm;
+    DetectPcreData *pe = (DetectPcreData *)sm->ctx;
+
+    SCLogDebug("inspecting pcre");
+
+    if (retry) {
+        det_ctx->payload_offset = frame->prev_payload_offset;
+        det_ctx->pcre_match_start_offset = frame->prev_offset;
+    } else {
+        frame->prev_payload_offset = det_ctx->payload_offset;
+        det_ctx->pcre_match_start_offset = 0;
+    }
+
+    /* pktvars only for the packet payload, flowvars not for the http
+     * buffers */
+    if (mode != DETECT_ENGINE_CONTENT_INSPECTION_MODE_PAYLOAD)
+        p = NULL;
+    if (mode != DETECT_ENGINE_CONTENT_INSPECTION_MODE_PAYLOAD &&
+        mode != DETECT_ENGINE_CONTENT_INSPECTION_MODE_STREAM &&
+        mode != DETECT_ENGINE_CONTENT_INSPECTION_MODE_DCE)
+        f = NULL;
+
+    if (DetectPcrePayloadMatch(det_ctx, s, sm, p, f, buffer, buffer_len) == 0) {
+        det_ctx->discontinue_matching = 1;
+        return INSPECT_NOMATCH;
+    }
+
+    if (!(pe->flags & DETECT_PCRE_RELATIVE_NEXT)) {
+        SCLogDebug("no relative match coming up, so this is a match");
+        return INSPECT_MATCH;
+    }
+
+    /* save it, in case we need to do a pcre match once again */
+    frame->prev_offset = det_ctx->pcre_match_start_offset;
+    return INSPECT_MATCH_RETRY;
+}
+
+/**
+ * \brief Inspect an isdataat.
+ *
+ * \retval INSPECT_NOMATCH or INSPECT_MATCH
+ */
+static int ContentInspectionIsdataat(DetectEngineThreadCtx *det_ctx,
+        SigMatch *sm, uint32_t buffer_len, uint8_t mode)
+{
+    DetectIsdataatData *id = (DetectIsdataatData *)sm->ctx;
+    /* the dce stub inspection ignores the negation */
+    int negated = (mode != DETECT_ENGINE_CONTENT_INSPECTION_MODE_DCE &&
+                   (id->flags & ISDATAAT_NEGATED));
+    int r;
+
+    SCLogDebug("inspecting isdataat");
+
+    if (id->flags & ISDATAAT_RELATIVE) {
+        SCLogDebug("det_ctx->payload_offset + id->dataat %"PRIu32", buffer_len %"PRIu32,
+                   det_ctx->payload_offset + id->dataat, buffer_len);
+        r = !(det_ctx->payload_offset + id->dataat > buffer_len);
+    } else {
+        SCLogDebug("id->isdataat %"PRIu32", buffer_len %"PRIu32, id->dataat, buffer_len);
+        r = (id->dataat < buffer_len);
+    }
+
+    if (negated)
+        r = !r;
+
+    return r ? INSPECT_MATCH : INSPECT_NOMATCH;
+}
+
+/**
+ * \brief Inspect an urilen.
+ *
+ * \retval INSPECT_NOMATCH or INSPECT_MATCH
+ */
+static int ContentInspectionUrilen(SigMatch *sm, uint32_t buffer_len)
+{
+    DetectUrilenData *urilend = (DetectUrilenData *)sm->ctx;
+
+    SCLogDebug("inspecting uri len");
+
+    switch (urilend->mode) {
+        case DETECT_URILEN_EQ:
+            if (buffer_len == urilend->urilen1)
+                return INSPECT_MATCH;
+            break;
+        case DETECT_URILEN_LT:
+            if (buffer_len < urilend->urilen1)
+                return INSPECT_MATCH;
+            break;
+        case DETECT_URILEN_GT:
+            if (buffer_len > urilend->urilen1)
+                return INSPECT_MATCH;
+            break;
+        case DETECT_URILEN_RA:
+            if (buffer_len > urilend->urilen1 &&
+                    buffer_len < urilend->urilen2)
+                return INSPECT_MATCH;
+            break;
+    }
+
+    return INSPECT_NOMATCH;
+}
+
+/**
+ * \brief Inspect a byte_test or byte_jump. For the dce stub the
+ *        endianness comes from the dce header if the dce option is set.
+ *
+ * \retval INSPECT_NOMATCH or INSPECT_MATCH
+ */
+static int ContentInspectionByte(DetectEngineThreadCtx *det_ctx, Signature *s,
+        SigMatch *sm, uint8_t *buffer, uint32_t buffer_len, uint8_t mode,
+        void *data)
+{
+    DCERPCState *dcerpc_state = (DCERPCState *)data;
+    int little = (mode == DETECT_ENGINE_CONTENT_INSPECTION_MODE_DCE &&
+                  dcerpc_state != NULL &&
+                  dcerpc_state->dcerpc.dcerpchdr.packed_drep[0] == 0x10);
+    int r;
+
+    if (sm->type == DETECT_BYTETEST) {
+        DetectBytetestData *btd = (DetectBytetestData *)sm->ctx;
+        uint32_t temp_flags = btd->flags;
+
+        /* enable the endianness flag temporarily */
+        if (little && (btd->flags & DETECT_BYTETEST_DCE))
+            btd->flags |= DETECT_BYTETEST_LITTLE;
+
+        r = DetectBytetestDoMatch(det_ctx, s, sm, buffer, buffer_len);
+        btd->flags = temp_flags;
+    } else {
+        DetectBytejumpData *bjd = (DetectBytejumpData *)sm->ctx;
+        uint32_t temp_flags = bjd->flags;
+
+        /* enable the endianness flag temporarily */
+        if (little && (bjd->flags & DETECT_BYTEJUMP_DCE))
+            bjd->flags |= DETECT_BYTEJUMP_LITTLE;
+
+        r = DetectBytejumpDoMatch(det_ctx, s, sm, buffer, buffer_len);
+        bjd->flags = temp_flags;
+    }
+
+    return (r == 1) ? INSPECT_MATCH : INSPECT_NOMATCH;
+}
+
+/**
+ * \brief Inspect the sigmatch of a frame.
+ *
+ * \retval INSPECT_NOMATCH, INSPECT_MATCH or INSPECT_MATCH_RETRY
+ */
+static int ContentInspectionSigMatch(DetectEngineThreadCtx *det_ctx,
+        Signature *s, DetectEngineInspectionFrame *frame, Flow *f, Packet *p,
+        uint8_t *buffer, uint32_t buffer_len, uint8_t mode, void *data,
+        int retry)
+{
+    SigMatch *sm = frame->sm;
+
+    if (sm->type == ContentInspectionContentType(mode)) {
+        return ContentInspectionContent(det_ctx, frame, buffer, buffer_len,
+                                        mode, retry);
+    }
+
+    switch (sm->type) {
+        case DETECT_PCRE:
+            return ContentInspectionPcre(det_ctx, s, frame, f, p, buffer,
+                                         buffer_len, mode, retry);
+
+        case DETECT_ISDATAAT:
+            /* not inspected in the http buffers */
+            if (mode == DETECT_ENGINE_CONTENT_INSPECTION_MODE_HCBD ||
+                mode == DETECT_ENGINE_CONTENT_INSPECTION_MODE_HCD ||
+                mode == DETECT_ENGINE_CONTENT_INSPECTION_MODE_HHD ||
+                mode == DETECT_ENGINE_CONTENT_INSPECTION_MODE_HMD ||
+                mode == DETECT_ENGINE_CONTENT_INSPECTION_MODE_HRHD)
+                break;
+            return ContentInspectionIsdataat(det_ctx, sm, buffer_len, mode);
+
+        case DETECT_AL_URILEN:
+            if (mode != DETECT_ENGINE_CONTENT_INSPECTION_MODE_URI)
+                break;
+            return ContentInspectionUrilen(sm, buffer_len);
+
+        case DETECT_BYTETEST:
+        case DETECT_BYTEJUMP:
+            if (mode != DETECT_ENGINE_CONTENT_INSPECTION_MODE_PAYLOAD &&
+                mode != DETECT_ENGINE_CONTENT_INSPECTION_MODE_STREAM &&
+                mode != DETECT_ENGINE_CONTENT_INSPECTION_MODE_DCE)
+                break;
+            return ContentInspectionByte(det_ctx, s, sm, buffer, buffer_len,
+                                         mode, data);
+    }
+
+    /* we should never get here, but bail out just in case */
+    SCLogDebug("sm->type %u", sm->type);
+#ifdef DEBUG
+    BUG_ON(1);
+#endif
+    return INSPECT_NOMATCH;
+}
+
+/**
+ * \brief Run the content inspection of a sigmatch list against a buffer.
+ *
+ *  The following keywords are inspected:
+ *  - content (or the http/uri variant of the mode)
+ *  - isdataat
+ *  - pcre
+ *  - bytejump
+ *  - bytetest
+ *  - urilen
+ *
+ *  For accounting the last match in relative matching the
+ *  det_ctx->payload_offset int is used. The caller resets payload_offset,
+ *  discontinue_matching and inspection_recursion_counter before inspecting
+ *  a buffer.
+ *
+ *  \param de_ctx Detection engine context
+ *  \param det_ctx Detection engine thread context
+ *  \param s Signature to inspect
+ *  \param sm first SigMatch of the list to inspect
+ *  \param f flow (for pcre flowvar storage)
+ *  \param p packet (for pcre pktvar storage), NULL if not a packet payload
+ *  \param buffer ptr to the buffer to inspect
+ *  \param buffer_len length of the buffer
+ *  \param mode DETECT_ENGINE_CONTENT_INSPECTION_MODE_* of the buffer
+ *  \param data mode specific data, the DCERPCState for the dce stub
+ *
+ *  \retval 0 no match
+ *  \retval 1 match
+ */
+int DetectEngineContentInspection(DetectEngineCtx *de_ctx,
+        DetectEngineThreadCtx *det_ctx, Signature *s, SigMatch *sm,
+        Flow *f, Packet *p, uint8_t *buffer, uint32_t buffer_len,
+        uint8_t mode, void *data)
+{
+    SCEnter();
+
+    DetectEngineInspectionFrame *frame = NULL;
+    int depth = -1;
+    /* number of frames on the path that can be retried */
+    int retries = 0;
+    int retry = 0;
+    int r;
+
+    /* an empty buffer fails any list, except for the uri and http
+     * buffers where only the contents need data */
+    int empty_fails = (mode == DETECT_ENGINE_CONTENT_INSPECTION_MODE_PAYLOAD ||
+                       mode == DETECT_ENGINE_CONTENT_INSPECTION_MODE_STREAM ||
+                       mode == DETECT_ENGINE_CONTENT_INSPECTION_MODE_DCE);
+
+    if (ContentInspectionThreadSetup(de_ctx, det_ctx, s->sm_cnt) < 0) {
+        SCLogError(SC_ERR_MEM_ALLOC, "Error allocating memory for the "
+                   "content inspection");
+        SCReturnInt(0);
+    }
+
+    while (1) {
+        det_ctx->inspection_recursion_counter++;
+
+        if (det_ctx->inspection_recursion_counter == de_ctx->inspection_recursion_limit) {
+            SCLogDebug("sig %"PRIu32" ran out of inspection budget", s->id);
+            det_ctx->discontinue_matching = 1;
+            if (det_ctx->tv != NULL) {
+                SCPerfCounterIncr(det_ctx->counter_inspection_budget,
+                                  det_ctx->tv->sc_perf_pca);
+            }
+            SCReturnInt(0);
+        }
+
+        if (sm == NULL || (empty_fails && buffer_len == 0))
+            goto nomatch;
+
+        /* sm_cnt should cover the list, but don't trust it blindly */
+        if (depth + 1 >= det_ctx->inspection_frames_size) {
+            if (ContentInspectionFramesGrow(det_ctx,
+                        2 * (uint32_t)det_ctx->inspection_frames_size + 1) < 0) {
+                SCLogError(SC_ERR_MEM_ALLOC, "Error allocating memory for the "
+                           "content inspection");
+                SCReturnInt(0);
+            }
+        }
+
+        /* no use looking it up if there is nothing to retry */
+        if (retries > 0 &&
+            ContentInspectionMemoLookup(det_ctx, (uint16_t)(depth + 1),
+                                        det_ctx->payload_offset)) {
+            SCLogDebug("sm %d at offset %"PRIu32" is known not to match",
+                       depth + 1, det_ctx->payload_offset);
+            goto nomatch;
+        }
+
+        depth++;
+        frame = &det_ctx->inspection_frames[depth];
+        frame->sm = sm;
+        frame->entry_offset = det_ctx->payload_offset;
+        frame->retry = 0;
+        retry = 0;
+
+    inspect:
+        r = ContentInspectionSigMatch(det_ctx, s, frame, f, p, buffer,
+                                      buffer_len, mode, data, retry);
+        if (r == INSPECT_MATCH) {
+            /* this sigmatch matched, inspect the next one. If it was the
+             * last, the list matched. */
+            if (sm->next == NULL)
+                SCReturnInt(1);
+
+            sm = sm->next;
+            continue;
+        } else if (r == INSPECT_MATCH_RETRY) {
+            frame->retry = 1;
+            retries++;
+
+            sm = sm->next;
+            continue;
+        }
+
+    nomatch:
+        if (det_ctx->discontinue_matching)
+            SCReturnInt(0);
+
+        /* unwind to the last sigmatch we can retry, remembering that the
+         * ones on the way failed at the offset they were entered with */
+        while (depth >= 0 && !det_ctx->inspection_frames[depth].retry) {
+            if (retries > 0) {
+                ContentInspectionMemoStore(det_ctx, (uint16_t)depth,
+                        det_ctx->inspection_frames[depth].entry_offset, mode);
+            }
+            depth--;
+        }
+        if (depth < 0)
+            SCReturnInt(0);
+
+        frame = &det_ctx->inspection_frames[depth];
+        frame->retry = 0;
+        retries--;
+        sm = frame->sm;
+        retry = 1;
+        goto inspect;
+    }
+}
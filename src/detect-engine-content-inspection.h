@@ -0,0 +1,46 @@
+/* Copyright (C) 2007-2010 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/** \file
+ *
+ * \author Victor Julien <victor@inliniac.net>
+ */
+
+#ifndef __DETECT_ENGINE_CONTENT_INSPECTION_H__
+#define __DETECT_ENGINE_CONTENT_INSPECTION_H__
+
+/** buffer the sigmatch list is inspected against, selects the content
+ *  keyword type and the mpm flags of the list */
+enum {
+    DETECT_ENGINE_CONTENT_INSPECTION_MODE_PAYLOAD = 0,
+    DETECT_ENGINE_CONTENT_INSPECTION_MODE_STREAM,
+    DETECT_ENGINE_CONTENT_INSPECTION_MODE_URI,
+    DETECT_ENGINE_CONTENT_INSPECTION_MODE_HCBD,
+    DETECT_ENGINE_CONTENT_INSPECTION_MODE_HCD,
+    DETECT_ENGINE_CONTENT_INSPECTION_MODE_HHD,
+    DETECT_ENGINE_CONTENT_INSPECTION_MODE_HMD,
+    DETECT_ENGINE_CONTENT_INSPECTION_MODE_HRHD,
+    DETECT_ENGINE_CONTENT_INSPECTION_MODE_DCE,
+};
+
+int DetectEngineContentInspection(DetectEngineCtx *, DetectEngineThreadCtx *,
+        Signature *, SigMatch *, Flow *, Packet *, uint8_t *, uint32_t,
+        uint8_t, void *);
+
+void DetectEngineContentInspectionThreadFree(DetectEngineThreadCtx *);
+
+#endif /* __DETECT_ENGINE_CONTENT_INSPECTION_H__ */
@@ -26,6 +26,7 @@
 
 #include "detect.h"
 #include "detect-engine.h"
+#include "detect-engine-content-inspection.h"
 #include "detect-engine-mpm.h"
 #include "detect-parse.h"
 #include "detect-engine-state.h"
@@ -55,245 +56,40 @@
 #include "app-layer-protos.h"
 
 /**
- * \brief Run the actual payload match function for http request body.
+ * \brief Check if we have seen the entire request body of a transaction.
  *
- *        For accounting the last match in relative matching the
- *        det_ctx->payload_offset int is used.
+ * \param htud Transaction user data holding the body.
+ * \param tx   The transaction.
  *
- * \param de_ctx      Detection engine context.
- * \param det_ctx     Detection engine thread context.
- * \param s           Signature to inspect.
- * \param sm          SigMatch to inspect.
- * \param payload     Ptr to the request body to inspect.
- * \param payload_len Length of the request body.
+ * \retval 1 Body is complete, or we hit the body size limit.
+ * \retval 0 Body not yet complete.
  *
- * \retval 0 no match.
- * \retval 1 match.
+ * \warning Make sure flow is locked.
  */
-static int DoInspectHttpClientBody(DetectEngineCtx *de_ctx,
-                                   DetectEngineThreadCtx *det_ctx,
-                                   Signature *s, SigMatch *sm,
-                                   uint8_t *payload, uint32_t payload_len)
+static int HttpClientBodyIsComplete(SCHtpTxUserData *htud, htp_tx_t *tx)
 {
-    SCEnter();
-
-    det_ctx->inspection_recursion_counter++;
-
-    if (det_ctx->inspection_recursion_counter == de_ctx->inspection_recursion_limit) {
-        det_ctx->discontinue_matching = 1;
-        SCReturnInt(0);
-    }
-
-    if (sm == NULL) {
-        SCReturnInt(0);
-    }
-
-    if (sm->type == DETECT_AL_HTTP_CLIENT_BODY) {
-        if (payload_len == 0) {
-            SCReturnInt(0);
+    /* in case of chunked transfer encoding, we don't have the length
+     * of the request body until we see a chunk with length 0.  This
+     * doesn't let us use the request body callback function to
+     * figure out the end of request body.  Instead we do it here.  If
+     * the length is 0, and we have already seen content, it indicates
+     * chunked transfer.  We also check if the parser has truly seen
+     * the last chunk by checking the progress state for the
+     * transaction.  If we are done parsing all the chunks, we would
+     * have it set to something other than TX_PROGRESS_REQ_BODY.
+     * Either ways we should be moving away from buffering in the end
+     * and running content validation on this buffer type of architecture
+     * to a stateful inspection, where we can inspect body chunks as and
+     * when they come */
+    if (htud->content_len == 0) {
+        if ((htud->content_len_so_far > 0) &&
+            tx->progress != TX_PROGRESS_REQ_BODY) {
+            /* final length of the body */
+            htud->flags |= HTP_BODY_COMPLETE;
         }
-
-        DetectContentData *cd = (DetectContentData *)sm->ctx;
-        SCLogDebug("inspecting content %"PRIu32" payload_len %"PRIu32, cd->id, payload_len);
-
-        if (cd->flags & DETECT_CONTENT_HCBD_MPM && !(cd->flags & DETECT_CONTENT_NEGATED))
-            goto match;
-
-        /* rule parsers should take care of this */
-#ifdef DEBUG
-        BUG_ON(cd->depth != 0 && cd->depth <= cd->offset);
-#endif
-
-        /* search for our pattern, checking the matches recursively.
-         * if we match we look for the next SigMatch as well */
-        uint8_t *found = NULL;
-        uint32_t offset = 0;
-        uint32_t depth = payload_len;
-        uint32_t prev_offset = 0; /**< used in recursive searching */
-        uint32_t prev_payload_offset = det_ctx->payload_offset;
-
-        do {
-            if (cd->flags & DETECT_CONTENT_DISTANCE ||
-                cd->flags & DETECT_CONTENT_WITHIN) {
-                SCLogDebug("prev_payload_offset %"PRIu32, prev_payload_offset);
-
-                offset = prev_payload_offset;
-                depth = payload_len;
-
-                if (cd->flags & DETECT_CONTENT_DISTANCE) {
-                    if (cd->distance < 0 && (uint32_t)(abs(cd->distance)) > offset)
-                        offset = 0;
-                    else
-                        offset += cd->distance;
-                }
-
-                if (cd->flags & DETECT_CONTENT_WITHIN) {
-                    if ((int32_t)depth > (int32_t)(prev_payload_offset + cd->within)) {
-                        depth = prev_payload_offset + cd->within;
-                    }
-                }
-
-                if (cd->depth != 0) {
-                    if ((cd->depth + prev_payload_offset) < depth) {
-                        depth = prev_payload_offset + cd->depth;
-                    }
-                }
-
-                if (cd->offset > offset) {
-                    offset = cd->offset;
-                }
-            } else { /* implied no relative matches */
-                /* set depth */
-                if (cd->depth != 0) {
-                    depth = cd->depth;
-                }
-
-                /* set offset */
-                offset = cd->offset;
-                prev_payload_offset = 0;
-            }
-
-            /* update offset with prev_offset if we're searching for
-             * matches after the first occurence. */
-            if (prev_offset != 0)
-                offset = prev_offset;
-
-            if (depth > payload_len)
-                depth = payload_len;
-
-            /* if offset is bigger than depth we can never match on a pattern.
-             * We can however, "match" on a negated pattern. */
-            if (offset > depth || depth == 0) {
-                if (cd->flags & DETECT_CONTENT_NEGATED) {
-                    goto match;
-                } else {
-                    SCReturnInt(0);
-                }
-            }
-
-            uint8_t *spayload = payload + offset;
-            uint32_t spayload_len = depth - offset;
-            uint32_t match_offset = 0;
-#ifdef DEBUG
-            BUG_ON(spayload_len > payload_len);
-#endif
-
-            /* do the actual search with boyer moore precooked ctx */
-            if (cd->flags & DETECT_CONTENT_NOCASE) {
-                found = BoyerMooreNocase(cd->content, cd->content_len,
-                                         spayload, spayload_len,
-                                         cd->bm_ctx->bmGs, cd->bm_ctx->bmBc);
-            } else {
-                found = BoyerMoore(cd->content, cd->content_len,
-                                   spayload, spayload_len,
-                                   cd->bm_ctx->bmGs, cd->bm_ctx->bmBc);
-            }
-
-            /* next we evaluate the result in combination with the
-             * negation flag. */
-            if (found == NULL && !(cd->flags & DETECT_CONTENT_NEGATED)) {
-                SCReturnInt(0);
-            } else if (found == NULL && cd->flags & DETECT_CONTENT_NEGATED) {
-                goto match;
-            } else if (found != NULL && cd->flags & DETECT_CONTENT_NEGATED) {
-                det_ctx->discontinue_matching = 1;
-                SCReturnInt(0);
-            } else {
-                match_offset = (uint32_t)((found - payload) + cd->content_len);
-                det_ctx->payload_offset = match_offset;
-
-                if (!(cd->flags & DETECT_CONTENT_RELATIVE_NEXT)) {
-                    SCLogDebug("no relative match coming up, so this is a match");
-                    goto match;
-                }
-
-                /* bail out if we have no next match. Technically this is an
-                 * error, as the current cd has the DETECT_CONTENT_RELATIVE_NEXT
-                 * flag set. */
-                if (sm->next == NULL) {
-                    SCReturnInt(0);
-                }
-
-                /* see if the next payload keywords match. If not, we will
-                 * search for another occurence of this http client body content
-                 * and see if the others match then until we run out of matches */
-                int r = DoInspectHttpClientBody(de_ctx, det_ctx, s, sm->next,
-                                                payload, payload_len);
-                if (r == 1) {
-                    SCReturnInt(1);
-                }
-
-                if (det_ctx->discontinue_matching)
-                    SCReturnInt(0);
-
-                /* set the previous match offset to the start of this match + 1 */
-                prev_offset = (match_offset - (cd->content_len - 1));
-                SCLogDebug("trying to see if there is another match after "
-                           "prev_offset %"PRIu32, prev_offset);
-            }
-
-        } while(1);
-
-    } else if (sm->type == DETECT_PCRE) {
-        SCLogDebug("inspecting pcre");
-        DetectPcreData *pe = (DetectPcreData *)sm->ctx;
-        uint32_t prev_payload_offset = det_ctx->payload_offset;
-        uint32_t prev_offset = 0;
-        int r = 0;
-
-        det_ctx->pcre_match_start_offset = 0;
-        do {
-            r = DetectPcrePayloadMatch(det_ctx, s, sm, NULL, NULL,
-                                       payload, payload_len);
-
-            if (r == 0) {
-                det_ctx->discontinue_matching = 1;
-                SCReturnInt(0);
-            }
-
-            if (!(pe->flags & DETECT_PCRE_RELATIVE_NEXT)) {
-                SCLogDebug("no relative match coming up, so this is a match");
-                goto match;
-            }
-
-            /* save it, in case we need to do a pcre match once again */
-            prev_offset = det_ctx->pcre_match_start_offset;
-
-            /* see if the next payload keywords match. If not, we will
-             * search for another occurence of this pcre and see
-             * if the others match, until we run out of matches */
-            int r = DoInspectHttpClientBody(de_ctx, det_ctx, s, sm->next,
-                                            payload, payload_len);
-            if (r == 1) {
-                SCReturnInt(1);
-            }
-
-            if (det_ctx->discontinue_matching)
-                SCReturnInt(0);
-
-            det_ctx->payload_offset = prev_payload_offset;
-            det_ctx->pcre_match_start_offset = prev_offset;
-        } while (1);
-    } else {
-        /* we should never get here, but bail out just in case */
-        SCLogDebug("sm->type %u", sm->type);
-#ifdef DEBUG
-        BUG_ON(1);
-#endif
     }
 
-    SCReturnInt(0);
-
-match:
-    /* this sigmatch matched, inspect the next one. If it was the last,
-     * the payload portion of the signature matched. */
-    if (sm->next != NULL) {
-        int r = DoInspectHttpClientBody(de_ctx, det_ctx, s, sm->next, payload,
-                                        payload_len);
-        SCReturnInt(r);
-    } else {
-        SCReturnInt(1);
-    }
+    return (htud->flags & HTP_BODY_COMPLETE) ? 1 : 0;
 }
 
 /**
@@ -307,7 +103,7 @@ match:
  *
  * \warning Make sure flow is locked.
  */
-static void DetectEngineBufferHttpClientBodies(DetectEngineCtx *de_ctx,
+void DetectEngineBufferHttpClientBodies(DetectEngineCtx *de_ctx,
         DetectEngineThreadCtx *det_ctx, Flow *f, HtpState *htp_state)
 {
     size_t idx = 0;
@@ -383,30 +179,9 @@ static void DetectEngineBufferHttpClientBodies(DetectEngineCtx *de_ctx,
                 continue;
             }
 
-            /* in case of chunked transfer encoding, we don't have the length
-             * of the request body until we see a chunk with length 0.  This
-             * doesn't let us use the request body callback function to
-             * figure out the end of request body.  Instead we do it here.  If
-             * the length is 0, and we have already seen content, it indicates
-             * chunked transfer.  We also check if the parser has truly seen
-             * the last chunk by checking the progress state for the
-             * transaction.  If we are done parsing all the chunks, we would
-             * have it set to something other than TX_PROGRESS_REQ_BODY.
-             * Either ways we should be moving away from buffering in the end
-             * and running content validation on this buffer type of architecture
-             * to a stateful inspection, where we can inspect body chunks as and
-             * when they come */
-            if (htud->content_len == 0) {
-                if ((htud->content_len_so_far > 0) &&
-                    tx->progress != TX_PROGRESS_REQ_BODY) {
-                    /* final length of the body */
-                    htud->flags |= HTP_BODY_COMPLETE;
-                }
-            }
-
             /* inspect the body if the transfer is complete or we have hit
              * our body size limit */
-            if (!(htud->flags & HTP_BODY_COMPLETE)) {
+            if (!HttpClientBodyIsComplete(htud, tx)) {
                 SCLogDebug("we still haven't seen the entire request body.  "
                         "Let's defer body inspection till we see the "
                         "entire body.");
@@ -435,12 +210,129 @@ end:
     return;
 }
 
+/**
+ * \brief Run the mpm over the body chunks of a transaction that weren't
+ *        scanned before, continuing in the state the previous chunk left
+ *        the matcher in. The pattern ids found are kept with the
+ *        transaction, so once the body is complete all of them are added
+ *        to the pmq without rescanning the body.
+ *
+ * \param det_ctx Detection engine thread ctx.
+ * \param htud    Transaction user data holding the body.
+ * \param tx      The transaction.
+ *
+ * \retval cnt Number of pattern ids added to the pmq.
+ *
+ * \warning Make sure flow is locked.
+ */
+static uint32_t HttpClientBodyPatternSearchResume(DetectEngineThreadCtx *det_ctx,
+        SCHtpTxUserData *htud, htp_tx_t *tx)
+{
+    MpmCtx *mpm_ctx = det_ctx->sgh->mpm_hcbd_ctx;
+    PatternMatcherQueue *pmq = &det_ctx->hcbd_pmq;
+    HtpBodyChunk *cur = htud->body.first;
+    uint32_t cnt = 0;
+    uint32_t u;
+
+    /* pattern ids found with another mpm ctx are of no use to us. Check
+     * the engine version too, the ctx of a reloaded engine can have the
+     * address of a freed one. */
+    if (htud->body_mpm_state.mpm_ctx != mpm_ctx ||
+        htud->body_mpm_state.version != det_ctx->de_ctx->version) {
+        MpmStreamStateReset(&htud->body_mpm_state);
+        htud->body_mpm_state.version = det_ctx->de_ctx->version;
+        htud->body_mpm_pids_cnt = 0;
+    }
+
+    PmqReset(pmq);
+    for ( ; cur != NULL; cur = cur->next) {
+        if (cur->id <= htud->body_mpm_state.offset)
+            continue;
+
+        mpm_table[mpm_ctx->mpm_type].SearchResume(mpm_ctx, &det_ctx->mtcu,
+                pmq, &htud->body_mpm_state, cur->data, cur->len);
+        htud->body_mpm_state.offset = cur->id;
+    }
+
+    /* remember the new pattern ids, the pmq only holds unique ones */
+    for (u = 0; u < pmq->pattern_id_array_cnt; u++) {
+        uint32_t pid = pmq->pattern_id_array[u];
+        uint16_t p;
+
+        for (p = 0; p < htud->body_mpm_pids_cnt; p++) {
+            if (htud->body_mpm_pids[p] == pid)
+                break;
+        }
+        if (p < htud->body_mpm_pids_cnt)
+            continue;
+
+        if (htud->body_mpm_pids_cnt == htud->body_mpm_pids_size) {
+            if (htud->body_mpm_pids_size == 0xFFFF)
+                break;
+            uint16_t size = htud->body_mpm_pids_size ?
+                (htud->body_mpm_pids_size * 2 > 0xFFFF ? 0xFFFF :
+                 htud->body_mpm_pids_size * 2) : 8;
+            uint32_t *ptr = SCRealloc(htud->body_mpm_pids, size * sizeof(uint32_t));
+            if (ptr == NULL)
+                break;
+            htud->body_mpm_pids = ptr;
+            htud->body_mpm_pids_size = size;
+        }
+        htud->body_mpm_pids[htud->body_mpm_pids_cnt++] = pid;
+    }
+    PmqReset(pmq);
+
+    /* the body is only inspected once it's complete, so only then
+     * should its patterns enable signatures */
+    if (!HttpClientBodyIsComplete(htud, tx))
+        return 0;
+
+    for (u = 0; u < htud->body_mpm_pids_cnt; u++) {
+        cnt += MpmVerifyMatch(&det_ctx->mtcu, &det_ctx->pmq,
+                              htud->body_mpm_pids[u]);
+    }
+
+    return cnt;
+}
+
 int DetectEngineRunHttpClientBodyMpm(DetectEngineCtx *de_ctx,
         DetectEngineThreadCtx *det_ctx, Flow *f, HtpState *htp_state)
 {
     int i;
     uint32_t cnt = 0;
 
+    if (det_ctx->sgh->mpm_hcbd_ctx != NULL &&
+        mpm_table[det_ctx->sgh->mpm_hcbd_ctx->mpm_type].SearchResume != NULL)
+    {
+        SCMutexLock(&f->m);
+
+        if (htp_state == NULL || htp_state->connp == NULL ||
+            htp_state->connp->conn == NULL)
+            goto unlock;
+
+        int tmp_idx = AppLayerTransactionGetInspectId(f);
+        if (tmp_idx == -1)
+            goto unlock;
+
+        size_t idx;
+        for (idx = (size_t)tmp_idx;
+             idx < list_size(htp_state->connp->conn->transactions); idx++) {
+            htp_tx_t *tx = list_get(htp_state->connp->conn->transactions, idx);
+            if (tx == NULL)
+                continue;
+
+            SCHtpTxUserData *htud = (SCHtpTxUserData *)htp_tx_get_user_data(tx);
+            if (htud == NULL || htud->body.nchunks == 0 ||
+                htud->body.operation != HTP_BODY_REQUEST)
+                continue;
+
+            cnt += HttpClientBodyPatternSearchResume(det_ctx, htud, tx);
+        }
+    unlock:
+        SCMutexUnlock(&f->m);
+        return cnt;
+    }
+
     /* bail before locking if we have nothing to do */
     if (det_ctx->hcbd_buffers_list_len == 0) {
         SCMutexLock(&f->m);
@@ -493,8 +385,13 @@ int DetectEngineInspectHttpClientBody(DetectEngineCtx *de_ctx,
         if (hcbd_buffer == NULL)
             continue;
 
-        r = DoInspectHttpClientBody(de_ctx, det_ctx, s, s->sm_lists[DETECT_SM_LIST_HCBDMATCH],
-                                    hcbd_buffer, hcbd_buffer_len);
+        det_ctx->payload_offset = 0;
+        det_ctx->discontinue_matching = 0;
+        det_ctx->inspection_recursion_counter = 0;
+
+        r = DetectEngineContentInspection(de_ctx, det_ctx, s, s->sm_lists[DETECT_SM_LIST_HCBDMATCH],
+                                          f, NULL, hcbd_buffer, hcbd_buffer_len,
+                                          DETECT_ENGINE_CONTENT_INSPECTION_MODE_HCBD, NULL);
         if (r == 1) {
             break;
         }
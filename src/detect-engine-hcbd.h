@@ -27,6 +27,8 @@
 
 #include "app-layer-htp.h"
 
+void DetectEngineBufferHttpClientBodies(DetectEngineCtx *,
+        DetectEngineThreadCtx *, Flow *, HtpState *);
 int DetectEngineRunHttpClientBodyMpm(DetectEngineCtx *,
         DetectEngineThreadCtx *, Flow *f, HtpState *);
 int DetectEngineInspectHttpClientBody(DetectEngineCtx *,
@@ -51,6 +51,15 @@
 #include "util-debug.h"
 #include "util-unittest.h"
 #include "util-unittest-helper.h"
+#include "util-cpu.h"
+
+#if defined(SC_CPU_DISPATCH)
+#include <immintrin.h>
+#elif defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #ifdef OS_WIN32
 #include <winsock.h>
@@ -248,15 +257,14 @@ void SigNumArrayPrint(void *tmp) {
     SigNumArray *sna = (SigNumArray *)tmp;
     uint32_t u;
 
-    for (u = 0; u < sna->size; u++) {
-        uint8_t bitarray = sna->array[u];
+    for (u = 0; u < sna->cnt; u++) {
+        uint32_t w = sna->dense ? sna->base + u : sna->idx[u];
+        uint64_t bitarray = sna->words[u];
         uint8_t i = 0;
 
-        for (; i < 8; i++) {
+        for (; i < 64; i++) {
             if (bitarray & 0x01)
-                printf(", %"PRIu16"", u * 8 + i);
-            else
-                printf(", ");
+                printf(", %"PRIu32"", w * 64 + i);
 
             bitarray = bitarray >> 1;
         }
@@ -264,8 +272,7 @@ void SigNumArrayPrint(void *tmp) {
 }
 
 /**
- * \brief This function creates a new SigNumArray with the
- *        size fixed to the io_ctx->max_idx
+ * \brief This function creates a new, empty, SigNumArray
  * \param de_ctx Pointer to the current detection context
  * \param io_ctx Pointer to the current ip only context
  *
@@ -282,19 +289,37 @@ SigNumArray *SigNumArrayNew(DetectEngineCtx *de_ctx,
     }
     memset(new, 0, sizeof(SigNumArray));
 
-    new->array = SCMalloc(io_ctx->max_idx / 8 + 1);
-    if (new->array == NULL) {
-       exit(EXIT_FAILURE);
-    }
-
-    memset(new->array, 0, io_ctx->max_idx / 8 + 1);
-    new->size = io_ctx->max_idx / 8 + 1;
-
     SCLogDebug("max idx= %u", io_ctx->max_idx);
 
     return new;
 }
 
+/**
+ * \brief Make room for at least 'size' words in a SigNumArray
+ */
+static void SigNumArrayGrow(SigNumArray *sna, uint32_t size) {
+    if (size <= sna->size)
+        return;
+
+    if (size < sna->size * 2)
+        size = sna->size * 2;
+    if (size < 4)
+        size = 4;
+
+    uint64_t *words = SCRealloc(sna->words, size * sizeof(uint64_t));
+    uint32_t *idx = NULL;
+    if (words != NULL) {
+        sna->words = words;
+        idx = SCRealloc(sna->idx, size * sizeof(uint32_t));
+    }
+    if (words == NULL || idx == NULL) {
+        SCLogError(SC_ERR_FATAL, "Fatal error encountered in SigNumArrayGrow. Exiting...");
+        exit(EXIT_FAILURE);
+    }
+    sna->idx = idx;
+    sna->size = size;
+}
+
 /**
  * \brief This function creates a new SigNumArray with the
  *        same data as the argument
@@ -312,14 +337,26 @@ SigNumArray *SigNumArrayCopy(SigNumArray *orig) {
     }
 
     memset(new, 0, sizeof(SigNumArray));
-    new->size = orig->size;
+    new->dense = orig->dense;
+    new->base = orig->base;
 
-    new->array = SCMalloc(orig->size);
-    if (new->array == NULL) {
-        exit(EXIT_FAILURE);
+    if (orig->cnt > 0) {
+        new->words = SCMalloc(orig->cnt * sizeof(uint64_t));
+        if (new->words == NULL) {
+            exit(EXIT_FAILURE);
+        }
+        memcpy(new->words, orig->words, orig->cnt * sizeof(uint64_t));
+
+        if (!orig->dense) {
+            new->idx = SCMalloc(orig->cnt * sizeof(uint32_t));
+            if (new->idx == NULL) {
+                exit(EXIT_FAILURE);
+            }
+            memcpy(new->idx, orig->idx, orig->cnt * sizeof(uint32_t));
+        }
+        new->cnt = new->size = orig->cnt;
     }
 
-    memcpy(new->array, orig->array, orig->size);
     return new;
 }
 
@@ -333,12 +370,370 @@ void SigNumArrayFree(void *tmp) {
     if (sna == NULL)
         return;
 
-    if (sna->array != NULL)
-        SCFree(sna->array);
+    if (sna->words != NULL)
+        SCFree(sna->words);
+    if (sna->idx != NULL)
+        SCFree(sna->idx);
 
     SCFree(sna);
 }
 
+/**
+ * \brief Find the position of a word in a sparse SigNumArray
+ *
+ * \param w word index to look for
+ * \param pos set to the position of the word, or to the position where
+ *            it would have to be inserted
+ *
+ * \retval 1 if the word is present, 0 if not
+ */
+static inline int SigNumArrayFind(const uint32_t *idx, uint32_t cnt, uint32_t w,
+                                  uint32_t *pos)
+{
+    uint32_t lo = 0, hi = cnt;
+
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (idx[mid] < w)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    *pos = lo;
+    return (lo < cnt && idx[lo] == w);
+}
+
+/**
+ * \brief Set the bit of a signature in a SigNumArray that is still being
+ *        built, i.e. not compacted yet.
+ */
+void SigNumArraySet(SigNumArray *sna, SigIntId num) {
+    uint32_t w = SIGNUM_ARRAY_WORD(num);
+    uint32_t pos;
+
+    BUG_ON(sna->dense);
+
+    if (SigNumArrayFind(sna->idx, sna->cnt, w, &pos)) {
+        sna->words[pos] |= SIGNUM_ARRAY_BIT(num);
+        return;
+    }
+
+    SigNumArrayGrow(sna, sna->cnt + 1);
+    memmove(&sna->words[pos + 1], &sna->words[pos],
+            (sna->cnt - pos) * sizeof(uint64_t));
+    memmove(&sna->idx[pos + 1], &sna->idx[pos],
+            (sna->cnt - pos) * sizeof(uint32_t));
+    sna->words[pos] = SIGNUM_ARRAY_BIT(num);
+    sna->idx[pos] = w;
+    sna->cnt++;
+}
+
+/**
+ * \brief Unset the bit of a signature in a SigNumArray that is still being
+ *        built. Words that become 0 are removed.
+ */
+void SigNumArrayUnset(SigNumArray *sna, SigIntId num) {
+    uint32_t pos;
+
+    BUG_ON(sna->dense);
+
+    if (!SigNumArrayFind(sna->idx, sna->cnt, SIGNUM_ARRAY_WORD(num), &pos))
+        return;
+
+    sna->words[pos] &= ~SIGNUM_ARRAY_BIT(num);
+    if (sna->words[pos] != 0)
+        return;
+
+    memmove(&sna->words[pos], &sna->words[pos + 1],
+            (sna->cnt - pos - 1) * sizeof(uint64_t));
+    memmove(&sna->idx[pos], &sna->idx[pos + 1],
+            (sna->cnt - pos - 1) * sizeof(uint32_t));
+    sna->cnt--;
+}
+
+/**
+ * \brief Check if the bit of a signature is set in a SigNumArray
+ *
+ * \retval 1 set
+ * \retval 0 not set
+ */
+int SigNumArrayIsSet(SigNumArray *sna, SigIntId num) {
+    uint32_t w = SIGNUM_ARRAY_WORD(num);
+    uint32_t pos;
+
+    if (sna->dense) {
+        if (w < sna->base || w - sna->base >= sna->cnt)
+            return 0;
+        return (sna->words[w - sna->base] & SIGNUM_ARRAY_BIT(num)) ? 1 : 0;
+    }
+
+    if (!SigNumArrayFind(sna->idx, sna->cnt, w, &pos))
+        return 0;
+    return (sna->words[pos] & SIGNUM_ARRAY_BIT(num)) ? 1 : 0;
+}
+
+/**
+ * \brief Compact a SigNumArray once it's final. The allocation is trimmed
+ *        and if the words span a range small enough to take less memory
+ *        as a dense run of words than as a sparse list, it's converted.
+ */
+void SigNumArrayCompact(SigNumArray *sna) {
+    if (sna->dense || sna->cnt == 0)
+        return;
+
+    uint32_t range = sna->idx[sna->cnt - 1] - sna->idx[0] + 1;
+
+    if ((uint64_t)range * sizeof(uint64_t) <
+            (uint64_t)sna->cnt * (sizeof(uint64_t) + sizeof(uint32_t)))
+    {
+        uint64_t *words = SCMalloc(range * sizeof(uint64_t));
+        if (words == NULL)
+            return;
+        memset(words, 0, range * sizeof(uint64_t));
+
+        uint32_t u;
+        for (u = 0; u < sna->cnt; u++) {
+            words[sna->idx[u] - sna->idx[0]] = sna->words[u];
+        }
+
+        sna->base = sna->idx[0];
+        SCFree(sna->words);
+        SCFree(sna->idx);
+        sna->words = words;
+        sna->idx = NULL;
+        sna->cnt = sna->size = range;
+        sna->dense = 1;
+        return;
+    }
+
+    if (sna->size > sna->cnt) {
+        uint64_t *words = SCRealloc(sna->words, sna->cnt * sizeof(uint64_t));
+        if (words != NULL)
+            sna->words = words;
+        uint32_t *idx = SCRealloc(sna->idx, sna->cnt * sizeof(uint32_t));
+        if (idx != NULL)
+            sna->idx = idx;
+        if (words != NULL && idx != NULL)
+            sna->size = sna->cnt;
+    }
+}
+
+/**
+ * \brief Memory used by a SigNumArray
+ */
+static uint32_t SigNumArrayMemory(SigNumArray *sna) {
+    return sizeof(SigNumArray) + sna->size *
+        (sizeof(uint64_t) + (sna->dense ? 0 : sizeof(uint32_t)));
+}
+
+/**
+ * \internal
+ * \brief AND two runs of words, storing the non zero results with their
+ *        word index. Used for all of it without SIMD and for what is left
+ *        after the vector blocks otherwise.
+ *
+ * \retval cnt number of words stored
+ */
+static inline uint32_t SigNumArrayAndWordsTail(const uint64_t *a, const uint64_t *b,
+        uint32_t n, uint32_t base, uint32_t *out_idx, uint64_t *out_words)
+{
+    uint32_t u, cnt = 0;
+
+    for (u = 0; u < n; u++) {
+        uint64_t w = a[u] & b[u];
+        if (w != 0) {
+            out_idx[cnt] = base + u;
+            out_words[cnt] = w;
+            cnt++;
+        }
+    }
+
+    return cnt;
+}
+
+static uint32_t SigNumArrayAndWordsPlain(const uint64_t *a, const uint64_t *b,
+        uint32_t n, uint32_t base, uint32_t *out_idx, uint64_t *out_words)
+{
+    return SigNumArrayAndWordsTail(a, b, n, base, out_idx, out_words);
+}
+
+#if defined(SC_CPU_DISPATCH) || defined(__SSE2__)
+static SC_CPU_TARGET("sse2") uint32_t SigNumArrayAndWordsSSE2(const uint64_t *a,
+        const uint64_t *b, uint32_t n, uint32_t base, uint32_t *out_idx,
+        uint64_t *out_words)
+{
+    const __m128i zero = _mm_setzero_si128();
+    uint32_t u, cnt = 0;
+
+    for (u = 0; u + 2 <= n; u += 2) {
+        __m128i v = _mm_and_si128(_mm_loadu_si128((const __m128i *)&a[u]),
+                                  _mm_loadu_si128((const __m128i *)&b[u]));
+
+        /* skip the all zero blocks, which is most of them */
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero)) == 0xffff)
+            continue;
+
+        cnt += SigNumArrayAndWordsTail(&a[u], &b[u], 2, base + u,
+                                       &out_idx[cnt], &out_words[cnt]);
+    }
+
+    return cnt + SigNumArrayAndWordsTail(&a[u], &b[u], n - u, base + u,
+                                         &out_idx[cnt], &out_words[cnt]);
+}
+#endif /* SSE2 */
+
+#if defined(SC_CPU_DISPATCH) || defined(__AVX2__)
+static SC_CPU_TARGET("avx2") uint32_t SigNumArrayAndWordsAVX2(const uint64_t *a,
+        const uint64_t *b, uint32_t n, uint32_t base, uint32_t *out_idx,
+        uint64_t *out_words)
+{
+    uint32_t u, cnt = 0;
+
+    for (u = 0; u + 4 <= n; u += 4) {
+        __m256i v = _mm256_and_si256(_mm256_loadu_si256((const __m256i *)&a[u]),
+                                     _mm256_loadu_si256((const __m256i *)&b[u]));
+
+        if (_mm256_testz_si256(v, v))
+            continue;
+
+        cnt += SigNumArrayAndWordsTail(&a[u], &b[u], 4, base + u,
+                                       &out_idx[cnt], &out_words[cnt]);
+    }
+
+    return cnt + SigNumArrayAndWordsTail(&a[u], &b[u], n - u, base + u,
+                                         &out_idx[cnt], &out_words[cnt]);
+}
+#endif /* AVX2 */
+
+/** bound to the best variant by IPOnlySetup, plain until then */
+static uint32_t (*SigNumArrayAndWordsFunc)(const uint64_t *, const uint64_t *,
+        uint32_t, uint32_t, uint32_t *, uint64_t *) = SigNumArrayAndWordsPlain;
+
+/**
+ * \brief Bind the SigNumArray intersection kernel to the best variant for
+ *        a SIMD level
+ *
+ * \param level max SIMD level to use, UTIL_CPU_SIMD_*
+ */
+void IPOnlySetup(int level)
+{
+    int used = UTIL_CPU_SIMD_NONE;
+
+    SigNumArrayAndWordsFunc = SigNumArrayAndWordsPlain;
+
+#if defined(SC_CPU_DISPATCH) || defined(__SSE2__)
+    if (level >= UTIL_CPU_SIMD_SSE2) {
+        SigNumArrayAndWordsFunc = SigNumArrayAndWordsSSE2;
+        used = UTIL_CPU_SIMD_SSE2;
+    }
+#endif
+#if defined(SC_CPU_DISPATCH) || defined(__AVX2__)
+    if (level >= UTIL_CPU_SIMD_AVX2) {
+        SigNumArrayAndWordsFunc = SigNumArrayAndWordsAVX2;
+        used = UTIL_CPU_SIMD_AVX2;
+    }
+#endif
+
+    SCLogInfo("ip only: using the %s variant", UtilCpuSimdLevelToString(used));
+}
+
+/**
+ * \brief Intersect a sparse SigNumArray with another one, walking the
+ *        sparse one
+ */
+static uint32_t SigNumArrayIntersectSparse(SigNumArray *sparse, SigNumArray *other,
+        uint32_t *out_idx, uint64_t *out_words)
+{
+    uint32_t u, cnt = 0;
+
+    if (other->dense) {
+        for (u = 0; u < sparse->cnt; u++) {
+            uint32_t w = sparse->idx[u];
+            if (w < other->base)
+                continue;
+            if (w - other->base >= other->cnt)
+                break;
+
+            uint64_t r = sparse->words[u] & other->words[w - other->base];
+            if (r != 0) {
+                out_idx[cnt] = w;
+                out_words[cnt] = r;
+                cnt++;
+            }
+        }
+    } else if (sparse->cnt * 8 < other->cnt) {
+        /* much smaller, binary search each word in the other */
+        for (u = 0; u < sparse->cnt; u++) {
+            uint32_t pos;
+            if (!SigNumArrayFind(other->idx, other->cnt, sparse->idx[u], &pos))
+                continue;
+
+            uint64_t r = sparse->words[u] & other->words[pos];
+            if (r != 0) {
+                out_idx[cnt] = sparse->idx[u];
+                out_words[cnt] = r;
+                cnt++;
+            }
+        }
+    } else {
+        uint32_t v = 0;
+        for (u = 0; u < sparse->cnt && v < other->cnt; ) {
+            if (sparse->idx[u] < other->idx[v]) {
+                u++;
+            } else if (sparse->idx[u] > other->idx[v]) {
+                v++;
+            } else {
+                uint64_t r = sparse->words[u] & other->words[v];
+                if (r != 0) {
+                    out_idx[cnt] = sparse->idx[u];
+                    out_words[cnt] = r;
+                    cnt++;
+                }
+                u++;
+                v++;
+            }
+        }
+    }
+
+    return cnt;
+}
+
+/**
+ * \brief Intersect two SigNumArrays
+ *
+ * \param a first array
+ * \param b second array
+ * \param out_idx word index of each of the resulting words
+ * \param out_words the non zero words of the intersection, in ascending
+ *        order. Both out arrays need room for the smaller of the arrays.
+ *
+ * \retval cnt number of words in the result
+ */
+uint32_t SigNumArrayIntersect(SigNumArray *a, SigNumArray *b,
+                              uint32_t *out_idx, uint64_t *out_words)
+{
+    if (a->cnt == 0 || b->cnt == 0)
+        return 0;
+
+    if (a->dense && b->dense) {
+        uint32_t start = a->base > b->base ? a->base : b->base;
+        uint32_t end = a->base + a->cnt < b->base + b->cnt ?
+                       a->base + a->cnt : b->base + b->cnt;
+        if (start >= end)
+            return 0;
+
+        return SigNumArrayAndWordsFunc(&a->words[start - a->base],
+                &b->words[start - b->base], end - start, start,
+                out_idx, out_words);
+    }
+
+    if (!a->dense && (b->dense || a->cnt <= b->cnt))
+        return SigNumArrayIntersectSparse(a, b, out_idx, out_words);
+
+    return SigNumArrayIntersectSparse(b, a, out_idx, out_words);
+}
+
 /**
  * \brief This function parses and return a list of IPOnlyCIDRItem
  *
@@ -857,14 +1252,59 @@ void IPOnlyInit(DetectEngineCtx *de_ctx, DetectEngineIPOnlyCtx *io_ctx) {
  */
 void DetectEngineIPOnlyThreadInit(DetectEngineCtx *de_ctx,
                                   DetectEngineIPOnlyThreadCtx *io_tctx) {
-    /* initialize the signature bitarray */
-    io_tctx->sig_match_size = de_ctx->io_ctx.max_idx / 8 + 1;
-    io_tctx->sig_match_array = SCMalloc(io_tctx->sig_match_size);
-    if (io_tctx->sig_match_array == NULL) {
+    /* initialize the arrays for the intersection result, which can't
+     * have more words than the bit array of all sigs would */
+    io_tctx->match_size = SIGNUM_ARRAY_WORD(de_ctx->io_ctx.max_idx) + 1;
+    io_tctx->match_words = SCMalloc(io_tctx->match_size * sizeof(uint64_t));
+    io_tctx->match_idx = SCMalloc(io_tctx->match_size * sizeof(uint32_t));
+    if (io_tctx->match_words == NULL || io_tctx->match_idx == NULL) {
         exit(EXIT_FAILURE);
     }
+}
+
+/**
+ * \brief Call a function for each SigNumArray held by a radix (sub)tree
+ *
+ * \param node Pointer to the root of the (sub)tree
+ * \param Func function to call
+ * \param data passed to Func
+ */
+static void IPOnlyRadixWalk(SCRadixNode *node,
+                            void (*Func)(SigNumArray *, void *), void *data)
+{
+    if (node == NULL)
+        return;
+
+    if (node->prefix != NULL) {
+        SCRadixUserData *ud = node->prefix->user_data;
+        for ( ; ud != NULL; ud = ud->next) {
+            if (ud->user != NULL)
+                Func((SigNumArray *)ud->user, data);
+        }
+    }
+
+    IPOnlyRadixWalk(node->left, Func, data);
+    IPOnlyRadixWalk(node->right, Func, data);
+}
+
+static void IPOnlyCompactFunc(SigNumArray *sna, void *data) {
+    SigNumArrayCompact(sna);
+}
+
+/** stats of the SigNumArrays of the IP Only engine */
+typedef struct IPOnlyMemoryStats_ {
+    uint32_t sets;          /**< number of SigNumArrays */
+    uint32_t dense;         /**< those of them that are dense */
+    uint64_t memory;        /**< memory used by them */
+} IPOnlyMemoryStats;
 
-    memset(io_tctx->sig_match_array, 0, io_tctx->sig_match_size);
+static void IPOnlyMemoryFunc(SigNumArray *sna, void *data) {
+    IPOnlyMemoryStats *stats = (IPOnlyMemoryStats *)data;
+
+    stats->sets++;
+    if (sna->dense)
+        stats->dense++;
+    stats->memory += SigNumArrayMemory(sna);
 }
 
 /**
@@ -874,7 +1314,25 @@ void DetectEngineIPOnlyThreadInit(DetectEngineCtx *de_ctx,
  * \param io_ctx Pointer to the current ip only detection engine
  */
 void IPOnlyPrint(DetectEngineCtx *de_ctx, DetectEngineIPOnlyCtx *io_ctx) {
-    /* XXX: how are we going to print the stats now? */
+    IPOnlyMemoryStats stats;
+
+    if (de_ctx->flags & DE_QUIET)
+        return;
+
+    memset(&stats, 0, sizeof(stats));
+    if (io_ctx->tree_ipv4src != NULL)
+        IPOnlyRadixWalk(io_ctx->tree_ipv4src->head, IPOnlyMemoryFunc, &stats);
+    if (io_ctx->tree_ipv4dst != NULL)
+        IPOnlyRadixWalk(io_ctx->tree_ipv4dst->head, IPOnlyMemoryFunc, &stats);
+    if (io_ctx->tree_ipv6src != NULL)
+        IPOnlyRadixWalk(io_ctx->tree_ipv6src->head, IPOnlyMemoryFunc, &stats);
+    if (io_ctx->tree_ipv6dst != NULL)
+        IPOnlyRadixWalk(io_ctx->tree_ipv6dst->head, IPOnlyMemoryFunc, &stats);
+
+    SCLogInfo("IP only engine: %"PRIu32" signature sets (%"PRIu32" dense) "
+              "using %"PRIu64" bytes, %"PRIu64" as plain bit arrays",
+              stats.sets, stats.dense, stats.memory,
+              (uint64_t)stats.sets * (io_ctx->max_idx / 8 + 1));
 }
 
 /**
@@ -913,7 +1371,8 @@ void IPOnlyDeinit(DetectEngineCtx *de_ctx, DetectEngineIPOnlyCtx *io_ctx) {
  * \param io_ctx Pointer to the current ip only detection engine
  */
 void DetectEngineIPOnlyThreadDeinit(DetectEngineIPOnlyThreadCtx *io_tctx) {
-    SCFree(io_tctx->sig_match_array);
+    SCFree(io_tctx->match_words);
+    SCFree(io_tctx->match_idx);
 }
 
 /**
@@ -976,39 +1435,34 @@ void IPOnlyMatchPacket(DetectEngineCtx *de_ctx,
         return;
     }
 
-    uint32_t u;
-    for (u = 0; u < src->size; u++) {
-        SCLogDebug("And %"PRIu8" & %"PRIu8, src->array[u], dst->array[u]);
-
-        /* The final results will be at io_tctx */
-        io_tctx->sig_match_array[u] = dst->array[u] & src->array[u];
+    /* The final results will be at io_tctx, only the non zero words */
+    uint32_t cnt = SigNumArrayIntersect(src, dst, io_tctx->match_idx,
+                                        io_tctx->match_words);
 
+    uint32_t u;
+    for (u = 0; u < cnt; u++) {
         /* We have to move the logic of the signature checking
          * to the main detect loop, in order to apply the
          * priority of actions (pass, drop, reject, alert) */
-        if (io_tctx->sig_match_array[u] != 0) {
-            /* We have a match :) Let's see from which signum's */
-            uint8_t bitarray = io_tctx->sig_match_array[u];
-            uint8_t i = 0;
+        uint64_t bitarray = io_tctx->match_words[u];
 
-            for (; i < 8; i++, bitarray = bitarray >> 1) {
-                if (bitarray & 0x01) {
-                    Signature *s = de_ctx->sig_array[u * 8 + i];
+        /* We have a match :) Let's see from which signum's */
+        for ( ; bitarray != 0; bitarray &= bitarray - 1) {
+            uint32_t num = io_tctx->match_idx[u] * 64 + __builtin_ctzll(bitarray);
+            Signature *s = de_ctx->sig_array[num];
 
-                    /* Need to check the protocol first */
-                    if (!(s->proto.proto[(IP_GET_IPPROTO(p)/8)] & (1 << (IP_GET_IPPROTO(p) % 8))))
-                        continue;
+            /* Need to check the protocol first */
+            if (!(s->proto.proto[(IP_GET_IPPROTO(p)/8)] & (1 << (IP_GET_IPPROTO(p) % 8))))
+                continue;
 
-                    SCLogDebug("Signum %"PRIu16" match (sid: %"PRIu16", msg: %s)",
-                               u * 8 + i, s->id, s->msg);
+            SCLogDebug("Signum %"PRIu32" match (sid: %"PRIu32", msg: %s)",
+                       num, s->id, s->msg);
 
-                    if ( !(s->flags & SIG_FLAG_NOALERT)) {
-                        if (s->action & ACTION_DROP)
-                            PacketAlertAppend(det_ctx, s, p, PACKET_ALERT_FLAG_DROP_FLOW);
-                        else
-                            PacketAlertAppend(det_ctx, s, p, 0);
-                    }
-                }
+            if ( !(s->flags & SIG_FLAG_NOALERT)) {
+                if (s->action & ACTION_DROP)
+                    PacketAlertAppend(det_ctx, s, p, PACKET_ALERT_FLAG_DROP_FLOW);
+                else
+                    PacketAlertAppend(det_ctx, s, p, 0);
             }
         }
     }
@@ -1068,14 +1522,12 @@ void IPOnlyPrepare(DetectEngineCtx *de_ctx) {
                     SigNumArray *sna = SigNumArrayNew(de_ctx, &de_ctx->io_ctx);
 
                     /* Update the sig */
-                    uint8_t tmp = 1 << (src->signum % 8);
-
                     if (src->negated > 0)
                         /* Unset it */
-                        sna->array[src->signum / 8] &= ~tmp;
+                        SigNumArrayUnset(sna, src->signum);
                     else
                         /* Set it */
-                        sna->array[src->signum / 8] |= tmp;
+                        SigNumArraySet(sna, src->signum);
 
                     if (src->netmask == 32)
                         node = SCRadixAddKeyIPV4((uint8_t *)&src->ip[0],
@@ -1096,14 +1548,12 @@ void IPOnlyPrepare(DetectEngineCtx *de_ctx) {
                     sna = SigNumArrayCopy((SigNumArray *) node->prefix->user_data_result);
 
                     /* Update the sig */
-                    uint8_t tmp = 1 << (src->signum % 8);
-
                     if (src->negated > 0)
                         /* Unset it */
-                        sna->array[src->signum / 8] &= ~tmp;
+                        SigNumArrayUnset(sna, src->signum);
                     else
                         /* Set it */
-                        sna->array[src->signum / 8] |= tmp;
+                        SigNumArraySet(sna, src->signum);
 
                     if (src->netmask == 32)
                         node = SCRadixAddKeyIPV4((uint8_t *)&src->ip[0],
@@ -1129,14 +1579,12 @@ void IPOnlyPrepare(DetectEngineCtx *de_ctx) {
                 SigNumArray *sna = (SigNumArray *)node->prefix->user_data_result;
 
                 /* Update the sig */
-                uint8_t tmp = 1 << (src->signum % 8);
-
                 if (src->negated > 0)
                     /* Unset it */
-                    sna->array[src->signum / 8] &= ~tmp;
+                    SigNumArrayUnset(sna, src->signum);
                 else
                     /* Set it */
-                    sna->array[src->signum / 8] |= tmp;
+                    SigNumArraySet(sna, src->signum);
             }
         } else if (src->family == AF_INET6) {
             SCLogDebug("To IPv6");
@@ -1159,14 +1607,12 @@ void IPOnlyPrepare(DetectEngineCtx *de_ctx) {
                     SigNumArray *sna = SigNumArrayNew(de_ctx, &de_ctx->io_ctx);
 
                     /* Update the sig */
-                    uint8_t tmp = 1 << (src->signum % 8);
-
                     if (src->negated > 0)
                         /* Unset it */
-                        sna->array[src->signum / 8] &= ~tmp;
+                        SigNumArrayUnset(sna, src->signum);
                     else
                         /* Set it */
-                        sna->array[src->signum / 8] |= tmp;
+                        SigNumArraySet(sna, src->signum);
 
                     if (src->netmask == 128)
                         node = SCRadixAddKeyIPV6((uint8_t *)&src->ip[0],
@@ -1184,13 +1630,12 @@ void IPOnlyPrepare(DetectEngineCtx *de_ctx) {
                     sna = SigNumArrayCopy((SigNumArray *)node->prefix->user_data_result);
 
                     /* Update the sig */
-                    uint8_t tmp = 1 << (src->signum % 8);
                     if (src->negated > 0)
                         /* Unset it */
-                        sna->array[src->signum / 8] &= ~tmp;
+                        SigNumArrayUnset(sna, src->signum);
                     else
                         /* Set it */
-                        sna->array[src->signum / 8] |= tmp;
+                        SigNumArraySet(sna, src->signum);
 
                     if (src->netmask == 128)
                         node = SCRadixAddKeyIPV6((uint8_t *)&src->ip[0],
@@ -1208,13 +1653,12 @@ void IPOnlyPrepare(DetectEngineCtx *de_ctx) {
                 SigNumArray *sna = (SigNumArray *)node->prefix->user_data_result;
 
                 /* Update the sig */
-                uint8_t tmp = 1 << (src->signum % 8);
                 if (src->negated > 0)
                     /* Unset it */
-                    sna->array[src->signum / 8] &= ~tmp;
+                    SigNumArrayUnset(sna, src->signum);
                 else
                     /* Set it */
-                    sna->array[src->signum / 8] |= tmp;
+                    SigNumArraySet(sna, src->signum);
             }
         }
         IPOnlyCIDRItem *tmpaux = src;
@@ -1257,13 +1701,12 @@ void IPOnlyPrepare(DetectEngineCtx *de_ctx) {
                     SigNumArray *sna = SigNumArrayNew(de_ctx, &de_ctx->io_ctx);
 
                     /** Update the sig */
-                    uint8_t tmp = 1 << (dst->signum % 8);
                     if (dst->negated > 0)
                         /** Unset it */
-                        sna->array[dst->signum / 8] &= ~tmp;
+                        SigNumArrayUnset(sna, dst->signum);
                     else
                         /** Set it */
-                        sna->array[dst->signum / 8] |= tmp;
+                        SigNumArraySet(sna, dst->signum);
 
                     if (dst->netmask == 32)
                         node = SCRadixAddKeyIPV4((uint8_t *)&dst->ip[0],
@@ -1284,13 +1727,12 @@ void IPOnlyPrepare(DetectEngineCtx *de_ctx) {
                     sna = SigNumArrayCopy((SigNumArray *)node->prefix->user_data_result);
 
                     /* Update the sig */
-                    uint8_t tmp = 1 << (dst->signum % 8);
                     if (dst->negated > 0)
                         /* Unset it */
-                        sna->array[dst->signum / 8] &= ~tmp;
+                        SigNumArrayUnset(sna, dst->signum);
                     else
                         /* Set it */
-                        sna->array[dst->signum / 8] |= tmp;
+                        SigNumArraySet(sna, dst->signum);
 
                     if (dst->netmask == 32)
                         node = SCRadixAddKeyIPV4((uint8_t *)&dst->ip[0],
@@ -1311,13 +1753,12 @@ void IPOnlyPrepare(DetectEngineCtx *de_ctx) {
                 SigNumArray *sna = (SigNumArray *)node->prefix->user_data_result;
 
                 /* Update the sig */
-                uint8_t tmp = 1 << (dst->signum % 8);
                 if (dst->negated > 0)
                     /* Unset it */
-                    sna->array[dst->signum / 8] &= ~tmp;
+                    SigNumArrayUnset(sna, dst->signum);
                 else
                     /* Set it */
-                    sna->array[dst->signum / 8] |= tmp;
+                    SigNumArraySet(sna, dst->signum);
             }
         } else if (dst->family == AF_INET6) {
             SCLogDebug("To IPv6");
@@ -1342,13 +1783,12 @@ void IPOnlyPrepare(DetectEngineCtx *de_ctx) {
                     SigNumArray *sna = SigNumArrayNew(de_ctx, &de_ctx->io_ctx);
 
                     /* Update the sig */
-                    uint8_t tmp = 1 << (dst->signum % 8);
                     if (dst->negated > 0)
                         /* Unset it */
-                        sna->array[dst->signum / 8] &= ~tmp;
+                        SigNumArrayUnset(sna, dst->signum);
                     else
                         /* Set it */
-                        sna->array[dst->signum / 8] |= tmp;
+                        SigNumArraySet(sna, dst->signum);
 
                     if (dst->netmask == 128)
                         node = SCRadixAddKeyIPV6((uint8_t *)&dst->ip[0],
@@ -1367,13 +1807,12 @@ void IPOnlyPrepare(DetectEngineCtx *de_ctx) {
                     sna = SigNumArrayCopy((SigNumArray *)node->prefix->user_data_result);
 
                     /* Update the sig */
-                    uint8_t tmp = 1 << (dst->signum % 8);
                     if (dst->negated > 0)
                         /* Unset it */
-                        sna->array[dst->signum / 8] &= ~tmp;
+                        SigNumArrayUnset(sna, dst->signum);
                     else
                         /* Set it */
-                        sna->array[dst->signum / 8] |= tmp;
+                        SigNumArraySet(sna, dst->signum);
 
                     if (dst->netmask == 128)
                         node = SCRadixAddKeyIPV6((uint8_t *)&dst->ip[0],
@@ -1392,13 +1831,12 @@ void IPOnlyPrepare(DetectEngineCtx *de_ctx) {
                 SigNumArray *sna = (SigNumArray *)node->prefix->user_data_result;
 
                 /* Update the sig */
-                uint8_t tmp = 1 << (dst->signum % 8);
                 if (dst->negated > 0)
                     /* Unset it */
-                    sna->array[dst->signum / 8] &= ~tmp;
+                    SigNumArrayUnset(sna, dst->signum);
                 else
                     /* Set it */
-                    sna->array[dst->signum / 8] |= tmp;
+                    SigNumArraySet(sna, dst->signum);
             }
         }
         IPOnlyCIDRItem *tmpaux = dst;
@@ -1406,6 +1844,12 @@ void IPOnlyPrepare(DetectEngineCtx *de_ctx) {
         SCFree(tmpaux);
     }
 
+    /* the sets are final now, compact them */
+    IPOnlyRadixWalk((de_ctx->io_ctx).tree_ipv4src->head, IPOnlyCompactFunc, NULL);
+    IPOnlyRadixWalk((de_ctx->io_ctx).tree_ipv4dst->head, IPOnlyCompactFunc, NULL);
+    IPOnlyRadixWalk((de_ctx->io_ctx).tree_ipv6src->head, IPOnlyCompactFunc, NULL);
+    IPOnlyRadixWalk((de_ctx->io_ctx).tree_ipv6dst->head, IPOnlyCompactFunc, NULL);
+
     /* print all the trees: for debuggin it might print too much info
     SCLogDebug("Radix tree src ipv4:");
     SCRadixPrintTree((de_ctx->io_ctx).tree_ipv4src);
@@ -1995,6 +2439,111 @@ int IPOnlyTestSig12(void) {
     return result;
 }
 
+/**
+ * \test Build SigNumArrays of different densities with set and unset,
+ *       compact them and check them and all their intersections, for
+ *       every variant the cpu supports, against plain bit arrays.
+ */
+static int SigNumArrayTest01(void) {
+#define SNA_TEST_SIGS 2000
+#define SNA_TEST_SETS 8
+    DetectEngineIPOnlyCtx io_ctx;
+    SigNumArray *sna[SNA_TEST_SETS];
+    uint8_t ref[SNA_TEST_SETS][SNA_TEST_SIGS / 8];
+    uint32_t out_idx[SNA_TEST_SIGS / 64 + 1];
+    uint64_t out_words[SNA_TEST_SIGS / 64 + 1];
+    uint32_t seed = 7;
+    int result = 0;
+    int i, j, level;
+    uint32_t num, u;
+
+    memset(&io_ctx, 0, sizeof(io_ctx));
+    io_ctx.max_idx = SNA_TEST_SIGS - 1;
+    memset(ref, 0, sizeof(ref));
+
+    for (i = 0; i < SNA_TEST_SETS; i++) {
+        /* from a few sigs to most of them, in part or all of the range */
+        uint32_t range = (i % 2) ? SNA_TEST_SIGS : SNA_TEST_SIGS / 4;
+        uint32_t start = (i % 4 == 3) ? SNA_TEST_SIGS / 2 : 0;
+        uint32_t ops = 4 << i;
+
+        sna[i] = SigNumArrayNew(NULL, &io_ctx);
+        for (u = 0; u < ops; u++) {
+            seed = seed * 1103515245 + 12345;
+            num = start + (seed >> 8) % (range - start);
+
+            if ((seed >> 4) % 4 == 0) {
+                SigNumArrayUnset(sna[i], num);
+                ref[i][num / 8] &= ~(1 << (num % 8));
+            } else {
+                SigNumArraySet(sna[i], num);
+                ref[i][num / 8] |= 1 << (num % 8);
+            }
+        }
+    }
+
+    for (i = 0; i < SNA_TEST_SETS; i++) {
+        /* check before and after compacting, the copy as well */
+        SigNumArray *copy = SigNumArrayCopy(sna[i]);
+        SigNumArrayCompact(sna[i]);
+
+        for (num = 0; num < SNA_TEST_SIGS; num++) {
+            int set = (ref[i][num / 8] & (1 << (num % 8))) ? 1 : 0;
+            if (SigNumArrayIsSet(sna[i], num) != set ||
+                SigNumArrayIsSet(copy, num) != set) {
+                printf("set %d sig %u: expected %d: ", i, num, set);
+                SigNumArrayFree(copy);
+                goto end;
+            }
+        }
+        SigNumArrayFree(copy);
+    }
+
+    for (level = 0; level <= UtilCpuSimdDetect(); level++) {
+        IPOnlySetup(level);
+
+        for (i = 0; i < SNA_TEST_SETS; i++) {
+            for (j = 0; j < SNA_TEST_SETS; j++) {
+                uint32_t cnt = SigNumArrayIntersect(sna[i], sna[j], out_idx, out_words);
+                uint32_t w = 0;
+
+                for (num = 0; num < SNA_TEST_SIGS; num += 64) {
+                    uint64_t expect = 0;
+                    for (u = 0; u < 64 && num + u < SNA_TEST_SIGS; u++) {
+                        if (ref[i][(num + u) / 8] & ref[j][(num + u) / 8] &
+                            (1 << ((num + u) % 8)))
+                            expect |= (uint64_t)1 << u;
+                    }
+                    if (expect == 0)
+                        continue;
+
+                    if (w >= cnt || out_idx[w] != num / 64 || out_words[w] != expect) {
+                        printf("level %s sets %d %d word %u: ",
+                               UtilCpuSimdLevelToString(level), i, j, num / 64);
+                        goto end;
+                    }
+                    w++;
+                }
+                if (w != cnt) {
+                    printf("level %s sets %d %d: %u words, expected %u: ",
+                           UtilCpuSimdLevelToString(level), i, j, cnt, w);
+                    goto end;
+                }
+            }
+        }
+    }
+
+    result = 1;
+end:
+    for (i = 0; i < SNA_TEST_SETS; i++) {
+        SigNumArrayFree(sna[i]);
+    }
+    IPOnlySetup(UtilCpuSimdLevel());
+    return result;
+#undef SNA_TEST_SIGS
+#undef SNA_TEST_SETS
+}
+
 #endif /* UNITTESTS */
 
 void IPOnlyRegisterTests(void) {
@@ -2013,6 +2562,8 @@ void IPOnlyRegisterTests(void) {
     UtRegisterTest("IPOnlyTestSig10", IPOnlyTestSig10, 1);
     UtRegisterTest("IPOnlyTestSig11", IPOnlyTestSig11, 1);
     UtRegisterTest("IPOnlyTestSig12", IPOnlyTestSig12, 1);
+
+    UtRegisterTest("SigNumArrayTest01", SigNumArrayTest01, 1);
 #endif
 }
 
@@ -29,12 +29,34 @@
  * it can be used linked to src/dst address to indicate
  * which signatures apply to this addres
  * at IP Only we store SigNumArrays at the radix trees
+ *
+ * Only the non zero 64 bit words of the bit array are stored. While
+ * building they are kept sparse, as a sorted list of word index and word.
+ * SigNumArrayCompact turns the arrays that are mostly full into a dense
+ * run of words starting at 'base', which is smaller for those.
  */
 typedef struct SigNumArray_ {
-    uint8_t *array; /* bit array of sig nums */
-    uint32_t size;  /* size in bytes of the array */
+    uint64_t *words;    /* non zero words of the bit array, ascending */
+    uint32_t *idx;      /* sparse: word index of each word, NULL if dense */
+    uint32_t cnt;       /* number of words in use */
+    uint32_t size;      /* number of words allocated */
+    uint32_t base;      /* dense: word index of words[0] */
+    uint8_t dense;
 }SigNumArray;
 
+#define SIGNUM_ARRAY_WORD(num) ((num) / 64)
+#define SIGNUM_ARRAY_BIT(num)  ((uint64_t)1 << ((num) % 64))
+
+SigNumArray *SigNumArrayNew(DetectEngineCtx *, DetectEngineIPOnlyCtx *);
+SigNumArray *SigNumArrayCopy(SigNumArray *);
+void SigNumArrayFree(void *);
+void SigNumArraySet(SigNumArray *, SigIntId);
+void SigNumArrayUnset(SigNumArray *, SigIntId);
+int SigNumArrayIsSet(SigNumArray *, SigIntId);
+void SigNumArrayCompact(SigNumArray *);
+uint32_t SigNumArrayIntersect(SigNumArray *, SigNumArray *, uint32_t *, uint64_t *);
+void IPOnlySetup(int);
+
 IPOnlyCIDRItem *IPOnlyCIDRItemNew();
 
 IPOnlyCIDRItem *IPOnlyCIDRItemInsertReal(IPOnlyCIDRItem *head, IPOnlyCIDRItem *item);
@@ -45,8 +45,14 @@
 
 #include "detect-content.h"
 #include "detect-uricontent.h"
+#include "detect-engine-hcbd.h"
+#include "detect-engine-hhd.h"
 
 #include "stream.h"
+#include "stream-tcp-private.h"
+
+#include "app-layer-parser.h"
+#include "app-layer-htp.h"
 
 #include "util-cuda-handlers.h"
 #include "util-mpm-b2g-cuda.h"
@@ -381,7 +387,168 @@ uint32_t HttpCookiePatternSearch(DetectEngineThreadCtx *det_ctx,
     SCReturnUInt(ret);
 }
 
+/**
+ * \brief Combined http match -- searches all http buffers in the list in a
+ *        single pass of the combined http mpm ctx.
+ *
+ * \param det_ctx  Detection engine thread ctx.
+ * \param segs     Tagged http buffers to inspect.
+ * \param segs_cnt Number of buffers in segs.
+ *
+ *  \retval ret Number of matches.
+ */
+uint32_t HttpPatternSearch(DetectEngineThreadCtx *det_ctx,
+                           MpmBufferSegment *segs, uint16_t segs_cnt)
+{
+    SCEnter();
+
+    if (det_ctx->sgh->mpm_http_ctx == NULL || segs_cnt == 0)
+        SCReturnUInt(0);
+
+    uint32_t ret;
+    ret = mpm_table[det_ctx->sgh->mpm_http_ctx->mpm_type].
+        SearchSegments(det_ctx->sgh->mpm_http_ctx, &det_ctx->mtcu,
+                       &det_ctx->pmq, segs, segs_cnt,
+                       det_ctx->de_ctx->mpm_http_pid_tags);
+
+    SCReturnUInt(ret);
+}
+
+/**
+ * \internal
+ * \brief Add a buffer to the combined http mpm buffer list. Runs the search
+ *        and empties the list if it is full.
+ */
+static inline uint32_t HttpMpmAddSegment(DetectEngineThreadCtx *det_ctx,
+        uint16_t *segs_cnt, uint8_t *buf, uint32_t buflen, uint8_t tag)
+{
+    uint32_t cnt = 0;
+
+    if (buf == NULL || buflen == 0)
+        return 0;
+
+    if (*segs_cnt == DETECT_HTTP_MPM_SEGS_MAX) {
+        cnt = HttpPatternSearch(det_ctx, det_ctx->http_mpm_segs, *segs_cnt);
+        *segs_cnt = 0;
+    }
+
+    det_ctx->http_mpm_segs[*segs_cnt].buf = buf;
+    det_ctx->http_mpm_segs[*segs_cnt].buflen = buflen;
+    det_ctx->http_mpm_segs[*segs_cnt].tag = tag;
+    (*segs_cnt)++;
+
+    return cnt;
+}
+
+/**
+ * \brief Run the combined http mpm against the http buffers of all
+ *        transactions we still have to inspect.
+ *
+ *        Per transaction the uri, method, cookie, raw header, header and
+ *        client body buffers are added to a single buffer list that is then
+ *        handed to the matcher in one call.  Only buffers for which the sgh
+ *        has mpm patterns are added.  The header and client body buffers
+ *        are assembled by their own modules, as the inspection code reuses
+ *        them.
+ *
+ * \param de_ctx    Detection engine ctx.
+ * \param det_ctx   Detection engine thread ctx.
+ * \param f         Flow, we lock it here.
+ * \param htp_state http state.
+ *
+ * \retval cnt Number of matches reported by the mpm algo.
+ */
+uint32_t DetectEngineRunHttpMpm(DetectEngineCtx *de_ctx,
+        DetectEngineThreadCtx *det_ctx, Flow *f, HtpState *htp_state)
+{
+    SigGroupHead *sgh = det_ctx->sgh;
+    htp_tx_t *tx = NULL;
+    uint32_t cnt = 0;
+    uint16_t segs_cnt = 0;
+    size_t idx;
+    int i;
+
+    /* we need to lock because most of the buffers are not true buffers
+     * but point to buffers owned by libhtp */
+    SCMutexLock(&f->m);
+
+    if (htp_state == NULL) {
+        SCLogDebug("no HTTP state");
+        goto end;
+    }
+
+    if (htp_state->connp == NULL || htp_state->connp->conn == NULL) {
+        SCLogDebug("HTP state has no conn(p)");
+        goto end;
+    }
+
+    int tmp_idx = AppLayerTransactionGetInspectId(f);
+    if (tmp_idx == -1)
+        goto end;
+
+    if ((sgh->flags & SIG_GROUP_HEAD_MPM_HHD) && det_ctx->hhd_buffers_list_len == 0)
+        DetectEngineBufferHttpHeaders(det_ctx, f, htp_state);
+    if ((sgh->flags & SIG_GROUP_HEAD_MPM_HCBD) && det_ctx->hcbd_buffers_list_len == 0)
+        DetectEngineBufferHttpClientBodies(de_ctx, det_ctx, f, htp_state);
+
+    idx = tmp_idx;
+    int list_size = list_size(htp_state->connp->conn->transactions) - tmp_idx;
+    for (i = 0; i < list_size; idx++, i++) {
+        tx = list_get(htp_state->connp->conn->transactions, idx);
+        if (tx == NULL)
+            continue;
+
+        if ((sgh->flags & SIG_GROUP_HEAD_MPM_URI) &&
+            tx->request_uri_normalized != NULL)
+        {
+            cnt += HttpMpmAddSegment(det_ctx, &segs_cnt,
+                    (uint8_t *)bstr_ptr(tx->request_uri_normalized),
+                    bstr_len(tx->request_uri_normalized), MPM_HTTP_BUF_URI);
+        }
+        if ((sgh->flags & SIG_GROUP_HEAD_MPM_HMD) && tx->request_method != NULL) {
+            cnt += HttpMpmAddSegment(det_ctx, &segs_cnt,
+                    (uint8_t *)bstr_ptr(tx->request_method),
+                    bstr_len(tx->request_method), MPM_HTTP_BUF_HMD);
+        }
+        if (sgh->flags & SIG_GROUP_HEAD_MPM_HCD) {
+            htp_header_t *h = (htp_header_t *)table_getc(tx->request_headers,
+                                                         "Cookie");
+            if (h != NULL) {
+                cnt += HttpMpmAddSegment(det_ctx, &segs_cnt,
+                        (uint8_t *)bstr_ptr(h->value), bstr_len(h->value),
+                        MPM_HTTP_BUF_HCD);
+            }
+        }
+        if (sgh->flags & SIG_GROUP_HEAD_MPM_HRHD) {
+            bstr *raw_headers = htp_tx_get_request_headers_raw(tx);
+            if (raw_headers != NULL) {
+                cnt += HttpMpmAddSegment(det_ctx, &segs_cnt,
+                        (uint8_t *)bstr_ptr(raw_headers), bstr_len(raw_headers),
+                        MPM_HTTP_BUF_HRHD);
+            }
+        }
+        if ((sgh->flags & SIG_GROUP_HEAD_MPM_HHD) && i < det_ctx->hhd_buffers_list_len) {
+            cnt += HttpMpmAddSegment(det_ctx, &segs_cnt, det_ctx->hhd_buffers[i],
+                    det_ctx->hhd_buffers_len[i], MPM_HTTP_BUF_HHD);
+        }
+        if ((sgh->flags & SIG_GROUP_HEAD_MPM_HCBD) && i < det_ctx->hcbd_buffers_list_len) {
+            cnt += HttpMpmAddSegment(det_ctx, &segs_cnt, det_ctx->hcbd_buffers[i],
+                    det_ctx->hcbd_buffers_len[i], MPM_HTTP_BUF_HCBD);
+        }
+    }
+
+    cnt += HttpPatternSearch(det_ctx, det_ctx->http_mpm_segs, segs_cnt);
+
+ end:
+    SCMutexUnlock(&f->m);
+    return cnt;
+}
+
 /** \brief Pattern match -- searches for only one pattern per signature.
+ *
+ *  If the matcher supports it, the search continues in the state the
+ *  previous stream msg of this flow and direction left it in. Each byte is
+ *  then scanned once and patterns spanning 2 msgs are found as well.
  *
  *  \param det_ctx detection engine thread ctx
  *  \param p packet
@@ -397,6 +564,50 @@ uint32_t StreamPatternSearch(DetectEngineThreadCtx *det_ctx, Packet *p,
 
     uint32_t ret = 0;
     uint8_t cnt = 0;
+    MpmCtx *mpm_ctx = det_ctx->sgh->mpm_stream_ctx;
+
+    if (mpm_table[mpm_ctx->mpm_type].SearchResume != NULL &&
+        p->flow != NULL && p->flow->protoctx != NULL &&
+        IP_GET_IPPROTO(p) == IPPROTO_TCP)
+    {
+        TcpSession *ssn = (TcpSession *)p->flow->protoctx;
+        MpmStreamState *flow_ss = (p->flowflags & FLOW_PKT_TOSERVER) ?
+            &ssn->toserver_mpm_state : &ssn->toclient_mpm_state;
+        MpmStreamState ss;
+
+        /* work on a copy, the flow is not locked during the search */
+        SCMutexLock(&p->flow->m);
+        ss = *flow_ss;
+        SCMutexUnlock(&p->flow->m);
+
+        for ( ; smsg != NULL; smsg = smsg->next, cnt++) {
+            /* not the continuation of what we scanned last, or scanned by
+             * the engine from before a rule reload: start over */
+            if (ss.mpm_ctx != NULL && (ss.offset != smsg->data.seq ||
+                        ss.version != det_ctx->de_ctx->version))
+                MpmStreamStateReset(&ss);
+
+            uint32_t r = mpm_table[mpm_ctx->mpm_type].SearchResume(mpm_ctx,
+                    &det_ctx->mtcs, &det_ctx->smsg_pmq[cnt], &ss,
+                    smsg->data.data, smsg->data.data_len);
+            ss.offset = smsg->data.seq + smsg->data.data_len;
+            ss.version = det_ctx->de_ctx->version;
+            if (r > 0) {
+                ret += r;
+
+                SCLogDebug("smsg match stored in det_ctx->smsg_pmq[%u]", cnt);
+
+                /* merge results with overall pmq */
+                PmqMerge(&det_ctx->smsg_pmq[cnt], &det_ctx->pmq);
+            }
+        }
+
+        SCMutexLock(&p->flow->m);
+        *flow_ss = ss;
+        SCMutexUnlock(&p->flow->m);
+
+        SCReturnInt(ret);
+    }
 
     for ( ; smsg != NULL; smsg = smsg->next) {
         if (smsg->data.data_len < det_ctx->sgh->mpm_streamcontent_maxlen)
@@ -479,6 +690,12 @@ void PatternMatchThreadPrepare(MpmThreadCtx *mpm_thread_ctx, uint16_t mpm_matche
 
 /* free the pattern matcher part of a SigGroupHead */
 void PatternMatchDestroyGroup(SigGroupHead *sh) {
+    if (sh->mpm_pid_filter != NULL) {
+        SCFree(sh->mpm_pid_filter);
+        sh->mpm_pid_filter = NULL;
+        sh->mpm_pid_filter_size = 0;
+    }
+
     /* content */
     if (sh->flags & SIG_GROUP_HAVECONTENT && sh->mpm_ctx != NULL &&
         !(sh->flags & SIG_GROUP_HEAD_MPM_COPY)) {
@@ -507,6 +724,19 @@ void PatternMatchDestroyGroup(SigGroupHead *sh) {
         sh->flags &= ~SIG_GROUP_HAVEURICONTENT;
     }
 
+    /* combined http */
+    if (sh->mpm_http_ctx != NULL) {
+        SCLogDebug("destroying mpm_http_ctx %p (sh %p)", sh->mpm_http_ctx, sh);
+        if (!MpmFactoryIsMpmCtxAvailable(sh->mpm_http_ctx)) {
+            mpm_table[sh->mpm_http_ctx->mpm_type].DestroyCtx(sh->mpm_http_ctx);
+            SCFree(sh->mpm_http_ctx);
+        }
+
+        /* ready for reuse */
+        sh->mpm_http_ctx = NULL;
+        sh->flags &= ~SIG_GROUP_HEAD_MPM_HTTP;
+    }
+
     /* stream content */
     if (sh->flags & SIG_GROUP_HAVESTREAMCONTENT) {
         if (sh->mpm_stream_ctx != NULL) {
@@ -1413,6 +1643,180 @@ static int PatternMatchPreparePopulateMpm(DetectEngineCtx *de_ctx,
     return 0;
 }
 
+/**
+ * \internal
+ * \brief Finish setting up the combined http mpm of a sgh after its patterns
+ *        have been added.
+ *
+ *        Records for each http fast pattern the buffer it belongs to in the
+ *        de_ctx wide pattern id -> tag table, so the combined search only
+ *        reports a pattern for the buffer it was registered for.  The per
+ *        buffer ctx pointers were only aliases of mpm_http_ctx, so they're
+ *        cleared again.
+ *
+ * \param de_ctx Pointer to the detection engine context.
+ * \param sh     Pointer to the sgh.
+ */
+static void PatternMatchPrepareHttpGroup(DetectEngineCtx *de_ctx,
+                                         SigGroupHead *sh)
+{
+    uint32_t max_id = MpmPatternIdStoreGetMaxId(de_ctx->mpm_pattern_id_store);
+    uint32_t sig;
+
+    if (de_ctx->mpm_http_pid_tags_size < max_id + 1) {
+        uint8_t *tags = SCRealloc(de_ctx->mpm_http_pid_tags, max_id + 1);
+        if (tags == NULL) {
+            SCLogError(SC_ERR_MEM_ALLOC, "Error allocating memory");
+            exit(EXIT_FAILURE);
+        }
+        memset(tags + de_ctx->mpm_http_pid_tags_size, 0,
+               max_id + 1 - de_ctx->mpm_http_pid_tags_size);
+        de_ctx->mpm_http_pid_tags = tags;
+        de_ctx->mpm_http_pid_tags_size = max_id + 1;
+    }
+
+    for (sig = 0; sig < sh->sig_cnt; sig++) {
+        Signature *s = sh->match_array[sig];
+        if (s == NULL || s->mpm_sm == NULL)
+            continue;
+
+        DetectContentData *cd = (DetectContentData *)s->mpm_sm->ctx;
+        uint8_t tag = 0;
+
+        switch (s->mpm_sm->type) {
+            case DETECT_URICONTENT:
+                tag = MPM_HTTP_BUF_URI;
+                break;
+            case DETECT_AL_HTTP_CLIENT_BODY:
+                tag = MPM_HTTP_BUF_HCBD;
+                break;
+            case DETECT_AL_HTTP_HEADER:
+                tag = MPM_HTTP_BUF_HHD;
+                break;
+            case DETECT_AL_HTTP_RAW_HEADER:
+                tag = MPM_HTTP_BUF_HRHD;
+                break;
+            case DETECT_AL_HTTP_METHOD:
+                tag = MPM_HTTP_BUF_HMD;
+                break;
+            case DETECT_AL_HTTP_COOKIE:
+                tag = MPM_HTTP_BUF_HCD;
+                break;
+            default:
+                continue;
+        }
+
+        BUG_ON(cd->id >= de_ctx->mpm_http_pid_tags_size);
+        de_ctx->mpm_http_pid_tags[cd->id] |= tag;
+    }
+
+    sh->mpm_uri_ctx = NULL;
+    sh->mpm_hcbd_ctx = NULL;
+    sh->mpm_hhd_ctx = NULL;
+    sh->mpm_hrhd_ctx = NULL;
+    sh->mpm_hmd_ctx = NULL;
+    sh->mpm_hcd_ctx = NULL;
+
+    if (sh->flags & (SIG_GROUP_HEAD_MPM_URI|SIG_GROUP_HEAD_MPM_HCBD|
+                     SIG_GROUP_HEAD_MPM_HHD|SIG_GROUP_HEAD_MPM_HRHD|
+                     SIG_GROUP_HEAD_MPM_HMD|SIG_GROUP_HEAD_MPM_HCD))
+    {
+        sh->flags |= SIG_GROUP_HEAD_MPM_HTTP;
+    }
+
+    return;
+}
+
+/**
+ * \internal
+ * \brief Prepare a mpm ctx of a sgh, or queue it for
+ *        PatternMatchPrepareDeferred while de_ctx->mpm_prepare_defer is set.
+ */
+static void PatternMatchPrepareMpmCtx(DetectEngineCtx *de_ctx, MpmCtx *mpm_ctx)
+{
+    if (!de_ctx->mpm_prepare_defer) {
+        if (mpm_table[mpm_ctx->mpm_type].Prepare != NULL)
+            mpm_table[mpm_ctx->mpm_type].Prepare(mpm_ctx);
+        return;
+    }
+
+    if (de_ctx->mpm_prepare_cnt == de_ctx->mpm_prepare_size) {
+        uint32_t size = de_ctx->mpm_prepare_size ? de_ctx->mpm_prepare_size * 2 : 64;
+        MpmCtx **list = SCRealloc(de_ctx->mpm_prepare_list, size * sizeof(MpmCtx *));
+        if (list == NULL) {
+            SCLogError(SC_ERR_MEM_ALLOC, "Error allocating memory");
+            exit(EXIT_FAILURE);
+        }
+        de_ctx->mpm_prepare_list = list;
+        de_ctx->mpm_prepare_size = size;
+    }
+    de_ctx->mpm_prepare_list[de_ctx->mpm_prepare_cnt++] = mpm_ctx;
+}
+
+/**
+ * \brief Prepare the sgh mpm ctxs queued by PatternMatchPrepareGroup, using
+ *        up to de_ctx->build_threads threads, and stop queueing.
+ *
+ *        The ctxs don't depend on each other and each is prepared by a
+ *        single thread, so the result is the same for any thread count.
+ *
+ * \param de_ctx Pointer to the detection engine context.
+ */
+void PatternMatchPrepareDeferred(DetectEngineCtx *de_ctx)
+{
+    de_ctx->mpm_prepare_defer = 0;
+
+    if (de_ctx->mpm_prepare_list == NULL)
+        return;
+
+    MpmPrepareCtxs(de_ctx->mpm_prepare_list, de_ctx->mpm_prepare_cnt,
+                   de_ctx->build_threads);
+
+    SCFree(de_ctx->mpm_prepare_list);
+    de_ctx->mpm_prepare_list = NULL;
+    de_ctx->mpm_prepare_cnt = 0;
+    de_ctx->mpm_prepare_size = 0;
+}
+
+/**
+ * \internal
+ * \brief Setup the pattern id filter of a sgh for sgh-mpm-context shared.
+ *
+ *        The shared ctxs report the patterns of all sghs. The filter has
+ *        the bits of the fast patterns of our sigs set, so the pmq can be
+ *        trimmed back to what a private ctx would have reported.
+ *
+ * \param de_ctx Pointer to the detection engine context.
+ * \param sh     Pointer to the sgh.
+ */
+static void PatternMatchPreparePidFilter(DetectEngineCtx *de_ctx,
+                                         SigGroupHead *sh)
+{
+    uint32_t max_id = MpmPatternIdStoreGetMaxId(de_ctx->mpm_pattern_id_store);
+    uint32_t sig;
+
+    sh->mpm_pid_filter_size = max_id / 8 + 1;
+    sh->mpm_pid_filter = SCMalloc(sh->mpm_pid_filter_size);
+    if (sh->mpm_pid_filter == NULL) {
+        SCLogError(SC_ERR_MEM_ALLOC, "Error allocating memory");
+        exit(EXIT_FAILURE);
+    }
+    memset(sh->mpm_pid_filter, 0, sh->mpm_pid_filter_size);
+    de_ctx->mpm_filter_memory_size += sh->mpm_pid_filter_size;
+
+    for (sig = 0; sig < sh->sig_cnt; sig++) {
+        Signature *s = sh->match_array[sig];
+        if (s == NULL || s->mpm_sm == NULL)
+            continue;
+
+        DetectContentData *cd = (DetectContentData *)s->mpm_sm->ctx;
+        BUG_ON(cd->id / 8 >= sh->mpm_pid_filter_size);
+        sh->mpm_pid_filter[cd->id / 8] |= 1 << (cd->id % 8);
+    }
+
+    return;
+}
+
 /** \brief Prepare the pattern matcher ctx in a sig group head.
  *
  *  \todo determine if a content match can set the 'single' flag
@@ -1504,12 +1908,35 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
         sh->flags |= SIG_GROUP_HAVEHCDCONTENT;
     }
 
+    /* with the combined http mpm all http buffers share a single ctx */
+    if (de_ctx->http_mpm_combined &&
+        (sh->flags & (SIG_GROUP_HAVEURICONTENT|SIG_GROUP_HAVEHCBDCONTENT|
+                      SIG_GROUP_HAVEHHDCONTENT|SIG_GROUP_HAVEHRHDCONTENT|
+                      SIG_GROUP_HAVEHMDCONTENT|SIG_GROUP_HAVEHCDCONTENT)))
+    {
+        if (de_ctx->sgh_mpm_context != ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
+            sh->mpm_http_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_http);
+        } else {
+            sh->mpm_http_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, MPM_CTX_FACTORY_UNIQUE_CONTEXT);
+        }
+        if (sh->mpm_http_ctx == NULL) {
+            SCLogDebug("sh->mpm_http_ctx == NULL. This should never happen");
+            exit(EXIT_FAILURE);
+        }
+
+#ifndef __SC_CUDA_SUPPORT__
+        MpmInitCtx(sh->mpm_http_ctx, de_ctx->mpm_matcher, -1);
+#else
+        MpmInitCtx(sh->mpm_http_ctx, de_ctx->mpm_matcher, de_ctx->cuda_rc_mod_handle);
+#endif
+    }
+
     /* intialize contexes */
     if (sh->flags & SIG_GROUP_HAVECONTENT) {
-        if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_SINGLE) {
-            sh->mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx->sgh_mpm_context_packet);
+        if (de_ctx->sgh_mpm_context != ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
+            sh->mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_packet);
         } else {
-            sh->mpm_ctx = MpmFactoryGetMpmCtxForProfile(MPM_CTX_FACTORY_UNIQUE_CONTEXT);
+            sh->mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, MPM_CTX_FACTORY_UNIQUE_CONTEXT);
         }
         if (sh->mpm_ctx == NULL) {
             SCLogDebug("sh->mpm_stream_ctx == NULL. This should never happen");
@@ -1524,10 +1951,10 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
     }
 
     if (sh->flags & SIG_GROUP_HAVESTREAMCONTENT) {
-        if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_SINGLE) {
-            sh->mpm_stream_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx->sgh_mpm_context_stream);
+        if (de_ctx->sgh_mpm_context != ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
+            sh->mpm_stream_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_stream);
         } else {
-            sh->mpm_stream_ctx = MpmFactoryGetMpmCtxForProfile(MPM_CTX_FACTORY_UNIQUE_CONTEXT);
+            sh->mpm_stream_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, MPM_CTX_FACTORY_UNIQUE_CONTEXT);
         }
         if (sh->mpm_stream_ctx == NULL) {
             SCLogDebug("sh->mpm_stream_ctx == NULL. This should never happen");
@@ -1541,11 +1968,13 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
 #endif
     }
 
-    if (sh->flags & SIG_GROUP_HAVEURICONTENT) {
-        if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_SINGLE) {
-            sh->mpm_uri_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx->sgh_mpm_context_uri);
+    if (sh->flags & SIG_GROUP_HAVEURICONTENT && sh->mpm_http_ctx != NULL) {
+        sh->mpm_uri_ctx = sh->mpm_http_ctx;
+    } else if (sh->flags & SIG_GROUP_HAVEURICONTENT) {
+        if (de_ctx->sgh_mpm_context != ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
+            sh->mpm_uri_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_uri);
         } else {
-            sh->mpm_uri_ctx = MpmFactoryGetMpmCtxForProfile(MPM_CTX_FACTORY_UNIQUE_CONTEXT);
+            sh->mpm_uri_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, MPM_CTX_FACTORY_UNIQUE_CONTEXT);
         }
         if (sh->mpm_uri_ctx == NULL) {
             SCLogDebug("sh->mpm_uri_ctx == NULL. This should never happen");
@@ -1559,11 +1988,13 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
 #endif
     }
 
-    if (sh->flags & SIG_GROUP_HAVEHCBDCONTENT) {
-        if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_SINGLE) {
-            sh->mpm_hcbd_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx->sgh_mpm_context_hcbd);
+    if (sh->flags & SIG_GROUP_HAVEHCBDCONTENT && sh->mpm_http_ctx != NULL) {
+        sh->mpm_hcbd_ctx = sh->mpm_http_ctx;
+    } else if (sh->flags & SIG_GROUP_HAVEHCBDCONTENT) {
+        if (de_ctx->sgh_mpm_context != ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
+            sh->mpm_hcbd_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_hcbd);
         } else {
-            sh->mpm_hcbd_ctx = MpmFactoryGetMpmCtxForProfile(MPM_CTX_FACTORY_UNIQUE_CONTEXT);
+            sh->mpm_hcbd_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, MPM_CTX_FACTORY_UNIQUE_CONTEXT);
         }
         if (sh->mpm_hcbd_ctx == NULL) {
             SCLogDebug("sh->mpm_hcbd_ctx == NULL. This should never happen");
@@ -1577,11 +2008,13 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
 #endif
     }
 
-    if (sh->flags & SIG_GROUP_HAVEHHDCONTENT) {
-        if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_SINGLE) {
-            sh->mpm_hhd_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx->sgh_mpm_context_hhd);
+    if (sh->flags & SIG_GROUP_HAVEHHDCONTENT && sh->mpm_http_ctx != NULL) {
+        sh->mpm_hhd_ctx = sh->mpm_http_ctx;
+    } else if (sh->flags & SIG_GROUP_HAVEHHDCONTENT) {
+        if (de_ctx->sgh_mpm_context != ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
+            sh->mpm_hhd_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_hhd);
         } else {
-            sh->mpm_hhd_ctx = MpmFactoryGetMpmCtxForProfile(MPM_CTX_FACTORY_UNIQUE_CONTEXT);
+            sh->mpm_hhd_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, MPM_CTX_FACTORY_UNIQUE_CONTEXT);
         }
         if (sh->mpm_hhd_ctx == NULL) {
             SCLogDebug("sh->mpm_hhd_ctx == NULL. This should never happen");
@@ -1595,11 +2028,13 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
 #endif
     }
 
-    if (sh->flags & SIG_GROUP_HAVEHRHDCONTENT) {
-        if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_SINGLE) {
-            sh->mpm_hrhd_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx->sgh_mpm_context_hrhd);
+    if (sh->flags & SIG_GROUP_HAVEHRHDCONTENT && sh->mpm_http_ctx != NULL) {
+        sh->mpm_hrhd_ctx = sh->mpm_http_ctx;
+    } else if (sh->flags & SIG_GROUP_HAVEHRHDCONTENT) {
+        if (de_ctx->sgh_mpm_context != ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
+            sh->mpm_hrhd_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_hrhd);
         } else {
-            sh->mpm_hrhd_ctx = MpmFactoryGetMpmCtxForProfile(MPM_CTX_FACTORY_UNIQUE_CONTEXT);
+            sh->mpm_hrhd_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, MPM_CTX_FACTORY_UNIQUE_CONTEXT);
         }
         if (sh->mpm_hrhd_ctx == NULL) {
             SCLogDebug("sh->mpm_hrhd_ctx == NULL. This should never happen");
@@ -1613,11 +2048,13 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
 #endif
     }
 
-    if (sh->flags & SIG_GROUP_HAVEHMDCONTENT) {
-        if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_SINGLE) {
-            sh->mpm_hmd_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx->sgh_mpm_context_hmd);
+    if (sh->flags & SIG_GROUP_HAVEHMDCONTENT && sh->mpm_http_ctx != NULL) {
+        sh->mpm_hmd_ctx = sh->mpm_http_ctx;
+    } else if (sh->flags & SIG_GROUP_HAVEHMDCONTENT) {
+        if (de_ctx->sgh_mpm_context != ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
+            sh->mpm_hmd_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_hmd);
         } else {
-            sh->mpm_hmd_ctx = MpmFactoryGetMpmCtxForProfile(MPM_CTX_FACTORY_UNIQUE_CONTEXT);
+            sh->mpm_hmd_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, MPM_CTX_FACTORY_UNIQUE_CONTEXT);
         }
         if (sh->mpm_hmd_ctx == NULL) {
             SCLogDebug("sh->mpm_hmd_ctx == NULL. This should never happen");
@@ -1631,11 +2068,13 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
 #endif
     }
 
-    if (sh->flags & SIG_GROUP_HAVEHCDCONTENT) {
-        if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_SINGLE) {
-            sh->mpm_hcd_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx->sgh_mpm_context_hcd);
+    if (sh->flags & SIG_GROUP_HAVEHCDCONTENT && sh->mpm_http_ctx != NULL) {
+        sh->mpm_hcd_ctx = sh->mpm_http_ctx;
+    } else if (sh->flags & SIG_GROUP_HAVEHCDCONTENT) {
+        if (de_ctx->sgh_mpm_context != ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
+            sh->mpm_hcd_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_hcd);
         } else {
-            sh->mpm_hcd_ctx = MpmFactoryGetMpmCtxForProfile(MPM_CTX_FACTORY_UNIQUE_CONTEXT);
+            sh->mpm_hcd_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, MPM_CTX_FACTORY_UNIQUE_CONTEXT);
         }
         if (sh->mpm_hcd_ctx == NULL) {
             SCLogDebug("sh->mpm_hcd_ctx == NULL. This should never happen");
@@ -1660,6 +2099,12 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
 
         PatternMatchPreparePopulateMpm(de_ctx, sh);
 
+        if (sh->mpm_http_ctx != NULL)
+            PatternMatchPrepareHttpGroup(de_ctx, sh);
+
+        if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_SHARED)
+            PatternMatchPreparePidFilter(de_ctx, sh);
+
         if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
             if (sh->mpm_ctx != NULL) {
                 if (sh->mpm_ctx->pattern_cnt == 0) {
@@ -1667,8 +2112,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
                     sh->mpm_ctx = NULL;
                 } else {
                     if (sh->flags & SIG_GROUP_HAVECONTENT) {
-                        if (mpm_table[sh->mpm_ctx->mpm_type].Prepare != NULL)
-                            mpm_table[sh->mpm_ctx->mpm_type].Prepare(sh->mpm_ctx);
+                        PatternMatchPrepareMpmCtx(de_ctx, sh->mpm_ctx);
                         }
                 }
             }
@@ -1678,8 +2122,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
                     sh->mpm_stream_ctx = NULL;
                 } else {
                     if (sh->flags & SIG_GROUP_HAVESTREAMCONTENT) {
-                        if (mpm_table[sh->mpm_stream_ctx->mpm_type].Prepare != NULL)
-                            mpm_table[sh->mpm_stream_ctx->mpm_type].Prepare(sh->mpm_stream_ctx);
+                        PatternMatchPrepareMpmCtx(de_ctx, sh->mpm_stream_ctx);
                     }
                 }
             }
@@ -1689,8 +2132,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
                     sh->mpm_uri_ctx = NULL;
                 } else {
                     if (sh->flags & SIG_GROUP_HAVEURICONTENT) {
-                        if (mpm_table[sh->mpm_uri_ctx->mpm_type].Prepare != NULL)
-                            mpm_table[sh->mpm_uri_ctx->mpm_type].Prepare(sh->mpm_uri_ctx);
+                        PatternMatchPrepareMpmCtx(de_ctx, sh->mpm_uri_ctx);
                     }
                 }
             }
@@ -1700,8 +2142,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
                     sh->mpm_hcbd_ctx = NULL;
                 } else {
                     if (sh->flags & SIG_GROUP_HAVEHCBDCONTENT) {
-                        if (mpm_table[sh->mpm_hcbd_ctx->mpm_type].Prepare != NULL)
-                            mpm_table[sh->mpm_hcbd_ctx->mpm_type].Prepare(sh->mpm_hcbd_ctx);
+                        PatternMatchPrepareMpmCtx(de_ctx, sh->mpm_hcbd_ctx);
                     }
                 }
             }
@@ -1711,8 +2152,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
                     sh->mpm_hhd_ctx = NULL;
                 } else {
                     if (sh->flags & SIG_GROUP_HAVEHHDCONTENT) {
-                        if (mpm_table[sh->mpm_hhd_ctx->mpm_type].Prepare != NULL)
-                            mpm_table[sh->mpm_hhd_ctx->mpm_type].Prepare(sh->mpm_hhd_ctx);
+                        PatternMatchPrepareMpmCtx(de_ctx, sh->mpm_hhd_ctx);
                     }
                 }
             }
@@ -1722,8 +2162,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
                     sh->mpm_hrhd_ctx = NULL;
                 } else {
                     if (sh->flags & SIG_GROUP_HAVEHRHDCONTENT) {
-                        if (mpm_table[sh->mpm_hrhd_ctx->mpm_type].Prepare != NULL)
-                            mpm_table[sh->mpm_hrhd_ctx->mpm_type].Prepare(sh->mpm_hrhd_ctx);
+                        PatternMatchPrepareMpmCtx(de_ctx, sh->mpm_hrhd_ctx);
                     }
                 }
             }
@@ -1733,8 +2172,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
                     sh->mpm_hmd_ctx = NULL;
                 } else {
                     if (sh->flags & SIG_GROUP_HAVEHMDCONTENT) {
-                        if (mpm_table[sh->mpm_hmd_ctx->mpm_type].Prepare != NULL)
-                            mpm_table[sh->mpm_hmd_ctx->mpm_type].Prepare(sh->mpm_hmd_ctx);
+                        PatternMatchPrepareMpmCtx(de_ctx, sh->mpm_hmd_ctx);
                     }
                 }
             }
@@ -1744,11 +2182,19 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
                     sh->mpm_hcd_ctx = NULL;
                 } else {
                     if (sh->flags & SIG_GROUP_HAVEHCDCONTENT) {
-                        if (mpm_table[sh->mpm_hcd_ctx->mpm_type].Prepare != NULL)
-                            mpm_table[sh->mpm_hcd_ctx->mpm_type].Prepare(sh->mpm_hcd_ctx);
+                        PatternMatchPrepareMpmCtx(de_ctx, sh->mpm_hcd_ctx);
                     }
                 }
             }
+            if (sh->mpm_http_ctx != NULL) {
+                if (sh->mpm_http_ctx->pattern_cnt == 0) {
+                    MpmFactoryReClaimMpmCtx(sh->mpm_http_ctx);
+                    sh->mpm_http_ctx = NULL;
+                    sh->flags &= ~SIG_GROUP_HEAD_MPM_HTTP;
+                } else {
+                    PatternMatchPrepareMpmCtx(de_ctx, sh->mpm_http_ctx);
+                }
+            }
 
         } /* if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) */
     } else {
@@ -1768,6 +2214,8 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
         sh->mpm_hmd_ctx = NULL;
         MpmFactoryReClaimMpmCtx(sh->mpm_hcd_ctx);
         sh->mpm_hcd_ctx = NULL;
+        MpmFactoryReClaimMpmCtx(sh->mpm_http_ctx);
+        sh->mpm_http_ctx = NULL;
     }
 
 
@@ -30,6 +30,15 @@
 #include "detect-uricontent.h"
 
 #include "stream.h"
+#include "app-layer-htp.h"
+
+/* buffer tags for the combined http mpm */
+#define MPM_HTTP_BUF_URI    0x01
+#define MPM_HTTP_BUF_HCBD   0x02
+#define MPM_HTTP_BUF_HHD    0x04
+#define MPM_HTTP_BUF_HRHD   0x08
+#define MPM_HTTP_BUF_HMD    0x10
+#define MPM_HTTP_BUF_HCD    0x20
 
 uint16_t PatternMatchDefaultMatcher(void);
 
@@ -42,6 +51,9 @@ uint32_t HttpHeaderPatternSearch(DetectEngineThreadCtx *, uint8_t *, uint32_t);
 uint32_t HttpRawHeaderPatternSearch(DetectEngineThreadCtx *, uint8_t *, uint32_t);
 uint32_t HttpMethodPatternSearch(DetectEngineThreadCtx *, uint8_t *, uint32_t);
 uint32_t HttpCookiePatternSearch(DetectEngineThreadCtx *, uint8_t *, uint32_t);
+uint32_t HttpPatternSearch(DetectEngineThreadCtx *, MpmBufferSegment *, uint16_t);
+uint32_t DetectEngineRunHttpMpm(DetectEngineCtx *, DetectEngineThreadCtx *,
+                                Flow *, HtpState *);
 
 void PacketPatternCleanup(ThreadVars *, DetectEngineThreadCtx *);
 void StreamPatternCleanup(ThreadVars *t, DetectEngineThreadCtx *det_ctx, StreamMsg *smsg);
@@ -54,6 +66,7 @@ void PatternMatchThreadDestroy(MpmThreadCtx *mpm_thread_ctx, uint16_t);
 void PatternMatchThreadPrint(MpmThreadCtx *, uint16_t);
 
 int PatternMatchPrepareGroup(DetectEngineCtx *, SigGroupHead *);
+void PatternMatchPrepareDeferred(DetectEngineCtx *);
 void DetectEngineThreadCtxInfo(ThreadVars *, DetectEngineThreadCtx *);
 void PatternMatchDestroyGroup(SigGroupHead *);
 
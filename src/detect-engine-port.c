@@ -36,6 +36,7 @@
 #include "util-unittest.h"
 #include "util-unittest-helper.h"
 #include "util-rule-vars.h"
+#include "util-clock.h"
 
 #include "detect-parse.h"
 #include "detect-engine.h"
@@ -107,6 +108,11 @@ void DetectPortFree(DetectPort *dp) {
     }
     dp->dst_ph = NULL;
 
+    if (dp->lookup != NULL) {
+        DetectPortGroupLookupFree(dp->lookup);
+        dp->lookup = NULL;
+    }
+
     //BUG_ON(dp->next != NULL);
 
     detect_port_memory -= sizeof(DetectPort);
@@ -835,9 +841,93 @@ void DetectPortPrint(DetectPort *dp) {
     }
 }
 
+/**
+ * \brief Free a DetectPortGroupLookup
+ */
+void DetectPortGroupLookupFree(DetectPortGroupLookup *lookup) {
+    if (lookup == NULL)
+        return;
+
+    if (lookup->array != NULL)
+        SCFree(lookup->array);
+    if (lookup->table != NULL)
+        SCFree(lookup->table);
+    SCFree(lookup);
+}
+
+/**
+ * \brief Build the lookup structure for a final port group list, so that
+ *        DetectPortLookupGroup doesn't have to walk the list.
+ *
+ *        The groups are put in a sorted array for a binary search. Lists
+ *        of DETECT_PORT_LOOKUP_TABLE_MIN_GROUPS groups or more also get a
+ *        direct table covering the full port space. The lookup is only
+ *        built if the list is ordered and has no internal overlap, so the
+ *        result is the same as that of the walk. Lists shared between
+ *        groups are only built once.
+ *
+ * \param head Pointer to the DetectPort list head
+ *
+ * \retval size memory used by the lookup, 0 if none was built.
+ */
+uint32_t DetectPortBuildLookup(DetectPort *head) {
+    DetectPort *p, *prev = NULL;
+    uint32_t cnt = 0, i = 0;
+
+    if (head == NULL || head->lookup != NULL)
+        return 0;
+
+    for (p = head; p != NULL; prev = p, p = p->next) {
+        if (p->port > p->port2 || (prev != NULL && p->port <= prev->port2)) {
+            SCLogDebug("port list not ordered, using the list walk");
+            return 0;
+        }
+        cnt++;
+    }
+
+    DetectPortGroupLookup *lookup = SCMalloc(sizeof(DetectPortGroupLookup));
+    if (lookup == NULL)
+        return 0;
+    memset(lookup, 0, sizeof(DetectPortGroupLookup));
+
+    lookup->array = SCMalloc(cnt * sizeof(DetectPort *));
+    if (lookup->array == NULL) {
+        SCFree(lookup);
+        return 0;
+    }
+    for (p = head; p != NULL; p = p->next) {
+        lookup->array[i++] = p;
+    }
+    lookup->cnt = cnt;
+    uint32_t size = sizeof(DetectPortGroupLookup) + cnt * sizeof(DetectPort *);
+
+    /* the idx + 1 has to fit in the table */
+    if (cnt >= DETECT_PORT_LOOKUP_TABLE_MIN_GROUPS && cnt < 65536) {
+        lookup->table = SCMalloc(65536 * sizeof(uint16_t));
+        if (lookup->table != NULL) {
+            memset(lookup->table, 0, 65536 * sizeof(uint16_t));
+
+            for (i = 0; i < cnt; i++) {
+                uint32_t port;
+                for (port = lookup->array[i]->port;
+                     port <= lookup->array[i]->port2; port++) {
+                    lookup->table[port] = (uint16_t)(i + 1);
+                }
+            }
+            size += 65536 * sizeof(uint16_t);
+        }
+    }
+
+    head->lookup = lookup;
+    return size;
+}
+
 /**
  * \brief Function that find the group matching address in a group head
  *
+ *        Uses the lookup structure if DetectPortBuildLookup set it up,
+ *        otherwise walks the list.
+ *
  * \param dp Pointer to DetectPort group where we try to find the group
  * \param port port to search/lookup
  *
@@ -851,6 +941,29 @@ DetectPortLookupGroup(DetectPort *dp, uint16_t port) {
     if (dp == NULL)
         return NULL;
 
+    if (dp->lookup != NULL) {
+        DetectPortGroupLookup *lookup = dp->lookup;
+
+        if (lookup->table != NULL) {
+            uint16_t idx = lookup->table[port];
+            return idx ? lookup->array[idx - 1] : NULL;
+        }
+
+        /* find the first group that doesn't end before the port */
+        uint32_t lo = 0, hi = lookup->cnt;
+        while (lo < hi) {
+            uint32_t mid = lo + (hi - lo) / 2;
+            if (lookup->array[mid]->port2 < port)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        if (lo < lookup->cnt && lookup->array[lo]->port <= port)
+            return lookup->array[lo];
+
+        return NULL;
+    }
+
     for ( ; p != NULL; p = p->next) {
         if (DetectPortMatch(p,port) == 1) {
             //SCLogDebug("match, port %" PRIu32 ", dp ", port);
@@ -2458,6 +2571,155 @@ static int PortTestMatchDoubleNegation(void)
     return result;
 }
 
+/**
+ * \brief Helper checking DetectPortLookupGroup against the list walk for
+ *        the full port space, with and without the lookup structure.
+ */
+static int PortTestLookupGroupWrp(char *str, int expect_table)
+{
+    DetectPort *head = NULL;
+    DetectPort **walk = NULL;
+    int result = 0;
+    uint32_t port;
+
+    if (DetectPortParse(&head, str) != 0)
+        goto end;
+
+    walk = SCMalloc(65536 * sizeof(DetectPort *));
+    if (walk == NULL)
+        goto end;
+
+    for (port = 0; port < 65536; port++) {
+        walk[port] = DetectPortLookupGroup(head, (uint16_t)port);
+    }
+
+    if (DetectPortBuildLookup(head) == 0 || head->lookup == NULL)
+        goto end;
+    if ((head->lookup->table != NULL) != expect_table)
+        goto end;
+
+    for (port = 0; port < 65536; port++) {
+        if (DetectPortLookupGroup(head, (uint16_t)port) != walk[port]) {
+            printf("lookup of port %u differs from the list walk: ", port);
+            goto end;
+        }
+    }
+
+    result = 1;
+end:
+    if (walk != NULL)
+        SCFree(walk);
+    DetectPortCleanupList(head);
+    return result;
+}
+
+/**
+ * \test Check the binary search port lookup of a small list.
+ */
+static int PortTestLookupGroup01(void)
+{
+    return PortTestLookupGroupWrp("[21:23,80,443,1024:2048]", 0);
+}
+
+/**
+ * \test Check the direct table port lookup of a larger list.
+ */
+static int PortTestLookupGroup02(void)
+{
+    return PortTestLookupGroupWrp("[0,21:23,25,53,80,110,139,143,443,445,"
+                                  "1024:1499,1501:2048,8080,65535]", 1);
+}
+
+/** Uncomment this if you want stats
+ *  #define ENABLE_PORT_LOOKUP_STATS 1
+ */
+
+#ifdef ENABLE_PORT_LOOKUP_STATS
+
+/* Number of times to repeat the lookups (for stats) */
+#define PORT_LOOKUP_STATS_TIMES 1000
+
+/**
+ * \test Stats: DetectPortLookupGroup over a list of 64 port groups, walking
+ *       the list versus the binary search and the direct table.
+ */
+static int PortTestLookupGroupStats01(void)
+{
+    DetectPort *head = NULL;
+    char str[16];
+    uint32_t cnt_walk = 0, cnt_bsearch = 0, cnt_table = 0;
+    uint32_t port;
+    int i, j;
+    int result = 0;
+
+    /* every other port from 1000, so that none of the groups are adjacent */
+    for (i = 0; i < 64; i++) {
+        snprintf(str, sizeof(str), "%d", 1000 + i * 2);
+        if (DetectPortParse(&head, str) != 0)
+            goto end;
+    }
+
+    printf("Port lookup, list walk: ");
+    CLOCK_INIT;
+    CLOCK_START;
+    for (j = 0; j < PORT_LOOKUP_STATS_TIMES; j++) {
+        cnt_walk = 0;
+        for (port = 0; port < 4096; port++) {
+            if (DetectPortLookupGroup(head, (uint16_t)port) != NULL)
+                cnt_walk++;
+        }
+    }
+    CLOCK_END;
+    CLOCK_PRINT_SEC;
+
+    if (DetectPortBuildLookup(head) == 0 || head->lookup == NULL ||
+        head->lookup->table == NULL)
+        goto end;
+
+    /* without the table the lookup falls back to the binary search */
+    uint16_t *table = head->lookup->table;
+    head->lookup->table = NULL;
+
+    printf("Port lookup, binary search: ");
+    CLOCK_START;
+    for (j = 0; j < PORT_LOOKUP_STATS_TIMES; j++) {
+        cnt_bsearch = 0;
+        for (port = 0; port < 4096; port++) {
+            if (DetectPortLookupGroup(head, (uint16_t)port) != NULL)
+                cnt_bsearch++;
+        }
+    }
+    CLOCK_END;
+    CLOCK_PRINT_SEC;
+
+    head->lookup->table = table;
+
+    printf("Port lookup, direct table: ");
+    CLOCK_START;
+    for (j = 0; j < PORT_LOOKUP_STATS_TIMES; j++) {
+        cnt_table = 0;
+        for (port = 0; port < 4096; port++) {
+            if (DetectPortLookupGroup(head, (uint16_t)port) != NULL)
+                cnt_table++;
+        }
+    }
+    CLOCK_END;
+    CLOCK_PRINT_SEC;
+
+    if (cnt_walk != 64 || cnt_bsearch != cnt_walk || cnt_table != cnt_walk) {
+        printf("walk found %"PRIu32", binary search %"PRIu32", table %"PRIu32": ",
+               cnt_walk, cnt_bsearch, cnt_table);
+        goto end;
+    }
+
+    result = 1;
+end:
+    DetectPortCleanupList(head);
+    return result;
+}
+
+#endif /* ENABLE_PORT_LOOKUP_STATS */
+
 #endif /* UNITTESTS */
 
 void DetectPortTests(void) {
@@ -2503,6 +2765,11 @@ void DetectPortTests(void) {
     UtRegisterTest("PortTestMatchReal19",
                    PortTestMatchReal19, 1);
     UtRegisterTest("PortTestMatchDoubleNegation", PortTestMatchDoubleNegation, 1);
+    UtRegisterTest("PortTestLookupGroup01", PortTestLookupGroup01, 1);
+    UtRegisterTest("PortTestLookupGroup02", PortTestLookupGroup02, 1);
+#ifdef ENABLE_PORT_LOOKUP_STATS
+    UtRegisterTest("PortTestLookupGroupStats01", PortTestLookupGroupStats01, 1);
+#endif
 
 
 #endif /* UNITTESTS */
@@ -39,6 +39,8 @@ DetectPort *DetectPortLookup(DetectPort *head, DetectPort *dp);
 int DetectPortAdd(DetectPort **head, DetectPort *dp);
 
 DetectPort *DetectPortLookupGroup(DetectPort *dp, uint16_t port);
+uint32_t DetectPortBuildLookup(DetectPort *head);
+void DetectPortGroupLookupFree(DetectPortGroupLookup *lookup);
 
 void DetectPortPrintMemory(void);
 
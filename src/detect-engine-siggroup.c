@@ -39,6 +39,16 @@
 
 #include "detect-content.h"
 #include "detect-uricontent.h"
+#include "detect-pcre.h"
+#include "detect-flags.h"
+#include "detect-dsize.h"
+#include "detect-ttl.h"
+#include "detect-itype.h"
+#include "detect-icode.h"
+#include "detect-window.h"
+#include "detect-icmp-id.h"
+#include "detect-ack.h"
+#include "detect-seq.h"
 
 #include "util-hash.h"
 #include "util-hashlist.h"
@@ -161,6 +171,53 @@ error:
     return NULL;
 }
 
+/**
+ * \brief Free the prefilter arrays of a SigGroupHead
+ */
+void SigGroupHeadFreePrefilter(SigGroupHead *sgh)
+{
+    SigGroupHeadPrefilter *pf = &sgh->prefilter;
+
+    if (pf->mask != NULL)
+        SCFree(pf->mask);
+    if (pf->alproto != NULL)
+        SCFree(pf->alproto);
+    if (pf->mpm_packet_byte != NULL)
+        SCFree(pf->mpm_packet_byte);
+    if (pf->mpm_packet_bit != NULL)
+        SCFree(pf->mpm_packet_bit);
+    if (pf->mpm_stream_byte != NULL)
+        SCFree(pf->mpm_stream_byte);
+    if (pf->mpm_stream_bit != NULL)
+        SCFree(pf->mpm_stream_bit);
+    if (pf->mpm_http_byte != NULL)
+        SCFree(pf->mpm_http_byte);
+    if (pf->mpm_http_bit != NULL)
+        SCFree(pf->mpm_http_bit);
+    if (pf->pid != NULL)
+        SCFree(pf->pid);
+    if (pf->pid_offset != NULL)
+        SCFree(pf->pid_offset);
+    if (pf->pid_sigs != NULL)
+        SCFree(pf->pid_sigs);
+    if (pf->always != NULL)
+        SCFree(pf->always);
+
+    int e;
+    for (e = 0; e < SIG_PREFILTER_ENGINE_MAX; e++) {
+        SigGroupHeadPrefilterEngine *engine = &pf->engine[e];
+
+        if (engine->start != NULL)
+            SCFree(engine->start);
+        if (engine->offset != NULL)
+            SCFree(engine->offset);
+        if (engine->sigs != NULL)
+            SCFree(engine->sigs);
+    }
+
+    memset(pf, 0, sizeof(SigGroupHeadPrefilter));
+}
+
 /**
  * \brief Free a SigGroupHead and its members.
  *
@@ -175,6 +232,12 @@ void SigGroupHeadFree(SigGroupHead *sgh)
 
     PatternMatchDestroyGroup(sgh);
 
+    if (sgh->head_array != NULL) {
+        SCFree(sgh->head_array);
+        sgh->head_array = NULL;
+    }
+    SigGroupHeadFreePrefilter(sgh);
+
     if (sgh->match_array != NULL) {
         detect_siggroup_matcharray_free_cnt++;
         detect_siggroup_matcharray_memory -= (sgh->sig_cnt * sizeof(Signature *));
@@ -1569,6 +1632,630 @@ int SigGroupHeadBuildMatchArray(DetectEngineCtx *de_ctx, SigGroupHead *sgh,
     return 0;
 }
 
+/** pattern id and sig index pair, used to build the inverted index */
+typedef struct SigGroupHeadPidSig_ {
+    uint32_t pid;
+    uint32_t idx;
+} SigGroupHeadPidSig;
+
+static int SigGroupHeadPidSigCompare(const void *a, const void *b)
+{
+    const SigGroupHeadPidSig *pa = a;
+    const SigGroupHeadPidSig *pb = b;
+
+    if (pa->pid != pb->pid)
+        return (pa->pid < pb->pid) ? -1 : 1;
+    if (pa->idx != pb->idx)
+        return (pa->idx < pb->idx) ? -1 : 1;
+    return 0;
+}
+
+/** range of values of a header field, both ends included */
+typedef struct SigGroupHeadRange_ {
+    uint32_t lo;
+    uint32_t hi;
+} SigGroupHeadRange;
+
+/** max number of value ranges of a keyword in a header prefilter engine,
+ *  a keyword matching more scattered values isn't worth it */
+#define SIG_PREFILTER_ENGINE_RANGES 32
+
+/**
+ * \brief Get the header prefilter engine of a sigmatch
+ *
+ * \param sm the sigmatch
+ * \param max set to the highest value of the header field
+ *
+ * \retval engine SIG_PREFILTER_ENGINE_* of the keyword, -1 if it has none
+ */
+static int SigGroupHeadPrefilterEngineType(const SigMatch *sm, uint32_t *max)
+{
+    switch (sm->type) {
+        case DETECT_FLAGS:
+            *max = UINT8_MAX;
+            return SIG_PREFILTER_ENGINE_FLAGS;
+        case DETECT_TTL:
+            *max = UINT8_MAX;
+            return SIG_PREFILTER_ENGINE_TTL;
+        case DETECT_ITYPE:
+            *max = UINT8_MAX;
+            return SIG_PREFILTER_ENGINE_ITYPE;
+        case DETECT_ICODE:
+            *max = UINT8_MAX;
+            return SIG_PREFILTER_ENGINE_ICODE;
+        case DETECT_DSIZE:
+            *max = UINT16_MAX;
+            return SIG_PREFILTER_ENGINE_DSIZE;
+        case DETECT_WINDOW:
+            *max = UINT16_MAX;
+            return SIG_PREFILTER_ENGINE_WINDOW;
+        case DETECT_ICMP_ID:
+            *max = UINT16_MAX;
+            return SIG_PREFILTER_ENGINE_ICMP_ID;
+        case DETECT_ACK:
+            *max = UINT32_MAX;
+            return SIG_PREFILTER_ENGINE_ACK;
+        case DETECT_SEQ:
+            *max = UINT32_MAX;
+            return SIG_PREFILTER_ENGINE_SEQ;
+    }
+
+    return -1;
+}
+
+/**
+ * \brief Check a value of the header field against a sigmatch of an 8 or
+ *        16 bit header prefilter engine
+ *
+ * \retval 1 the keyword matches the value
+ * \retval 0 no match
+ */
+static int SigGroupHeadPrefilterMatchValue(const SigMatch *sm, uint32_t v)
+{
+    switch (sm->type) {
+        case DETECT_FLAGS:
+            return DetectFlagsMatchValue(sm->ctx, (uint8_t)v);
+        case DETECT_TTL:
+            return DetectTtlMatchValue(sm->ctx, (uint8_t)v);
+        case DETECT_ITYPE:
+            return DetectITypeMatchValue(sm->ctx, (uint8_t)v);
+        case DETECT_ICODE:
+            return DetectICodeMatchValue(sm->ctx, (uint8_t)v);
+        case DETECT_DSIZE:
+            return DetectDsizeMatchValue(sm->ctx, (uint16_t)v);
+        case DETECT_WINDOW:
+            return DetectWindowMatchValue(sm->ctx, (uint16_t)v);
+        case DETECT_ICMP_ID:
+            return (((DetectIcmpIdData *)sm->ctx)->id == v);
+    }
+
+    return 0;
+}
+
+/**
+ * \brief Get the values of the header field a sigmatch matches, as sorted
+ *        ranges
+ *
+ * \param sm the sigmatch
+ * \param max highest value of the header field
+ * \param r array of SIG_PREFILTER_ENGINE_RANGES ranges to fill
+ * \param values set to the number of values matched
+ *
+ * \retval cnt number of ranges, 0 if the keyword can't match at all
+ * \retval -1 too many ranges
+ */
+static int SigGroupHeadPrefilterRanges(const SigMatch *sm, uint32_t max,
+        SigGroupHeadRange *r, uint64_t *values)
+{
+    int cnt = 0;
+    uint32_t v;
+
+    *values = 0;
+
+    if (sm->type == DETECT_ACK || sm->type == DETECT_SEQ) {
+        if (sm->type == DETECT_ACK)
+            r[0].lo = ((DetectAckData *)sm->ctx)->ack;
+        else
+            r[0].lo = ((DetectSeqData *)sm->ctx)->seq;
+        r[0].hi = r[0].lo;
+        *values = 1;
+        return 1;
+    }
+
+    for (v = 0; v <= max; v++) {
+        if (SigGroupHeadPrefilterMatchValue(sm, v) == 0)
+            continue;
+
+        (*values)++;
+        if (cnt > 0 && r[cnt - 1].hi == v - 1) {
+            r[cnt - 1].hi = v;
+            continue;
+        }
+        if (cnt == SIG_PREFILTER_ENGINE_RANGES)
+            return -1;
+
+        r[cnt].lo = r[cnt].hi = v;
+        cnt++;
+    }
+
+    return cnt;
+}
+
+/**
+ * \brief Pick the header prefilter engine keyword of a sig: the one matching
+ *        the smallest part of its header field.
+ *
+ * Only the header keywords at the start of the packet match list are
+ * considered: a keyword in front of it, like flowbits:set, has to run also
+ * if the header keyword then doesn't match. For the same reason sigs with a
+ * pcre capture or stateful app layer inspection are left alone, those run
+ * before the packet match list.
+ *
+ * \retval sm the keyword, NULL if the sig has none
+ */
+static SigMatch *SigGroupHeadPrefilterEngineSm(const Signature *s, int *engine)
+{
+    SigGroupHeadRange r[SIG_PREFILTER_ENGINE_RANGES];
+    SigMatch *sm, *best = NULL;
+    uint64_t best_cov = 0;
+    int list;
+
+    if (s->flags & SIG_FLAG_STATE_MATCH)
+        return NULL;
+
+    for (list = 0; list < DETECT_SM_LIST_MAX; list++) {
+        for (sm = s->sm_lists[list]; sm != NULL; sm = sm->next) {
+            if (sm->type == DETECT_PCRE &&
+                (((DetectPcreData *)sm->ctx)->flags &
+                 (DETECT_PCRE_CAPTURE_PKT|DETECT_PCRE_CAPTURE_FLOW)))
+                return NULL;
+        }
+    }
+
+    for (sm = s->sm_lists[DETECT_SM_LIST_MATCH]; sm != NULL; sm = sm->next) {
+        uint32_t max;
+        uint64_t values;
+        int e = SigGroupHeadPrefilterEngineType(sm, &max);
+        if (e < 0)
+            break;
+
+        if (SigGroupHeadPrefilterRanges(sm, max, r, &values) < 0)
+            continue;
+
+        /* part of the field matched, scaled to a 32 bit field */
+        uint64_t cov = values * ((UINT32_MAX + 1ULL) / (max + 1ULL));
+        if (best == NULL || cov < best_cov) {
+            best = sm;
+            best_cov = cov;
+            *engine = e;
+        }
+    }
+
+    return best;
+}
+
+static int SigGroupHeadUint32Compare(const void *a, const void *b)
+{
+    uint32_t ua = *(const uint32_t *)a;
+    uint32_t ub = *(const uint32_t *)b;
+
+    return (ua < ub) ? -1 : (ua > ub);
+}
+
+/**
+ * \brief Build a header prefilter engine from the sigs that use it
+ *
+ * \param sgh sgh the engine is built for
+ * \param e SIG_PREFILTER_ENGINE_* to build
+ * \param idxs sig indexes of the sigs using the engine, ascending
+ * \param sms keyword of each sig
+ * \param n number of sigs
+ *
+ * \retval 0 on success
+ * \retval -1 on error
+ */
+static int SigGroupHeadBuildPrefilterEngine(SigGroupHead *sgh, int e,
+        const uint32_t *idxs, SigMatch **sms, uint32_t n)
+{
+    SigGroupHeadPrefilterEngine *engine = &sgh->prefilter.engine[e];
+    SigGroupHeadRange *r = NULL;
+    int *r_cnt = NULL;
+    SigGroupHeadPidSig *pairs = NULL;
+    uint32_t pairs_cnt = 0;
+    uint32_t max = 0;
+    uint32_t u, i;
+    int j;
+
+    (void)SigGroupHeadPrefilterEngineType(sms[0], &max);
+
+    r = SCMalloc(n * SIG_PREFILTER_ENGINE_RANGES * sizeof(SigGroupHeadRange));
+    r_cnt = SCMalloc(n * sizeof(int));
+    if (r == NULL || r_cnt == NULL)
+        goto error;
+
+    for (u = 0; u < n; u++) {
+        uint64_t values;
+        r_cnt[u] = SigGroupHeadPrefilterRanges(sms[u], max,
+                r + u * SIG_PREFILTER_ENGINE_RANGES, &values);
+    }
+
+    /* the 8 bit fields get an interval per value, the others an interval
+     * per distinct range boundary */
+    if (max == UINT8_MAX) {
+        engine->cnt = UINT8_MAX + 1;
+    } else {
+        engine->start = SCMalloc((1 + n * 2 * SIG_PREFILTER_ENGINE_RANGES) * sizeof(uint32_t));
+        if (engine->start == NULL)
+            goto error;
+
+        engine->start[0] = 0;
+        engine->cnt = 1;
+        for (u = 0; u < n; u++) {
+            for (j = 0; j < r_cnt[u]; j++) {
+                SigGroupHeadRange *rr = &r[u * SIG_PREFILTER_ENGINE_RANGES + j];
+
+                engine->start[engine->cnt++] = rr->lo;
+                if (rr->hi < max)
+                    engine->start[engine->cnt++] = rr->hi + 1;
+            }
+        }
+
+        qsort(engine->start, engine->cnt, sizeof(uint32_t), SigGroupHeadUint32Compare);
+        for (u = 1, i = 1; u < engine->cnt; u++) {
+            if (engine->start[u] != engine->start[i - 1])
+                engine->start[i++] = engine->start[u];
+        }
+        engine->cnt = i;
+    }
+
+    /* (interval, sig index) pairs */
+    for (u = 0; u < n; u++) {
+        for (j = 0; j < r_cnt[u]; j++) {
+            SigGroupHeadRange *rr = &r[u * SIG_PREFILTER_ENGINE_RANGES + j];
+
+            if (engine->start == NULL) {
+                pairs_cnt += rr->hi - rr->lo + 1;
+                continue;
+            }
+            i = (uint32_t)((uint32_t *)bsearch(&rr->lo, engine->start, engine->cnt,
+                        sizeof(uint32_t), SigGroupHeadUint32Compare) - engine->start);
+            for ( ; i < engine->cnt && engine->start[i] <= rr->hi; i++)
+                pairs_cnt++;
+        }
+    }
+
+    pairs = SCMalloc((pairs_cnt ? pairs_cnt : 1) * sizeof(SigGroupHeadPidSig));
+    engine->offset = SCMalloc((engine->cnt + 1) * sizeof(uint32_t));
+    engine->sigs = SCMalloc((pairs_cnt ? pairs_cnt : 1) * sizeof(uint32_t));
+    if (pairs == NULL || engine->offset == NULL || engine->sigs == NULL)
+        goto error;
+
+    pairs_cnt = 0;
+    for (u = 0; u < n; u++) {
+        for (j = 0; j < r_cnt[u]; j++) {
+            SigGroupHeadRange *rr = &r[u * SIG_PREFILTER_ENGINE_RANGES + j];
+
+            if (engine->start == NULL) {
+                for (i = rr->lo; i <= rr->hi; i++) {
+                    pairs[pairs_cnt].pid = i;
+                    pairs[pairs_cnt].idx = idxs[u];
+                    pairs_cnt++;
+                }
+                continue;
+            }
+            i = (uint32_t)((uint32_t *)bsearch(&rr->lo, engine->start, engine->cnt,
+                        sizeof(uint32_t), SigGroupHeadUint32Compare) - engine->start);
+            for ( ; i < engine->cnt && engine->start[i] <= rr->hi; i++) {
+                pairs[pairs_cnt].pid = i;
+                pairs[pairs_cnt].idx = idxs[u];
+                pairs_cnt++;
+            }
+        }
+    }
+
+    qsort(pairs, pairs_cnt, sizeof(SigGroupHeadPidSig), SigGroupHeadPidSigCompare);
+
+    for (i = 0, u = 0; i < engine->cnt; i++) {
+        engine->offset[i] = u;
+        while (u < pairs_cnt && pairs[u].pid == i) {
+            engine->sigs[u] = pairs[u].idx;
+            u++;
+        }
+    }
+    engine->offset[engine->cnt] = u;
+
+    detect_siggroup_matcharray_memory += ((engine->start ? engine->cnt : 0) +
+            engine->cnt + 1 + pairs_cnt) * sizeof(uint32_t);
+
+    SCFree(pairs);
+    SCFree(r);
+    SCFree(r_cnt);
+    return 0;
+
+error:
+    if (pairs != NULL)
+        SCFree(pairs);
+    if (r != NULL)
+        SCFree(r);
+    if (r_cnt != NULL)
+        SCFree(r_cnt);
+    return -1;
+}
+
+/**
+ * \brief Move the always inspected sigs that need a header keyword to the
+ *        header prefilter engine of that keyword.
+ *
+ * \retval 0 on success
+ * \retval -1 on error
+ */
+static int SigGroupHeadBuildPrefilterEngines(SigGroupHead *sgh)
+{
+    SigGroupHeadPrefilter *pf = &sgh->prefilter;
+    uint32_t *idxs = NULL;
+    SigMatch **sms = NULL;
+    SigMatch **esms = NULL;
+    int8_t *engines = NULL;
+    uint32_t u, n, always_cnt = 0;
+    int e;
+
+    if (pf->always_cnt == 0)
+        return 0;
+
+    idxs = SCMalloc(pf->always_cnt * sizeof(uint32_t));
+    sms = SCMalloc(pf->always_cnt * sizeof(SigMatch *));
+    esms = SCMalloc(pf->always_cnt * sizeof(SigMatch *));
+    engines = SCMalloc(pf->always_cnt * sizeof(int8_t));
+    if (idxs == NULL || sms == NULL || esms == NULL || engines == NULL)
+        goto error;
+
+    for (u = 0; u < pf->always_cnt; u++) {
+        uint32_t idx = pf->always[u];
+        int engine = -1;
+
+        sms[u] = SigGroupHeadPrefilterEngineSm(sgh->head_array[idx].full_sig, &engine);
+        engines[u] = (int8_t)engine;
+    }
+
+    for (e = 0; e < SIG_PREFILTER_ENGINE_MAX; e++) {
+        for (u = 0, n = 0; u < pf->always_cnt; u++) {
+            if (sms[u] != NULL && engines[u] == e) {
+                idxs[n] = pf->always[u];
+                esms[n] = sms[u];
+                n++;
+            }
+        }
+        if (n == 0)
+            continue;
+
+        if (SigGroupHeadBuildPrefilterEngine(sgh, e, idxs, esms, n) < 0)
+            goto error;
+    }
+
+    for (u = 0; u < pf->always_cnt; u++) {
+        if (engines[u] < 0)
+            pf->always[always_cnt++] = pf->always[u];
+    }
+    pf->always_cnt = always_cnt;
+
+    SCFree(idxs);
+    SCFree(sms);
+    SCFree(esms);
+    SCFree(engines);
+    return 0;
+
+error:
+    if (idxs != NULL)
+        SCFree(idxs);
+    if (sms != NULL)
+        SCFree(sms);
+    if (esms != NULL)
+        SCFree(esms);
+    if (engines != NULL)
+        SCFree(engines);
+    return -1;
+}
+
+/**
+ * \brief Build the inverted fast pattern index of a SigGroupHead from its
+ *        prefilter arrays.
+ *
+ * Every sig ends up either in the always list, or in the list of each
+ * pattern id it needs. Sigs with dsize are always inspected, as they may
+ * be inspected on a stream added packet without a pattern match. The
+ * always inspected sigs that need a header keyword then move to a header
+ * prefilter engine.
+ *
+ * \retval 0 on success
+ * \retval -1 on error
+ */
+static int SigGroupHeadBuildPrefilterIndex(SigGroupHead *sgh)
+{
+    SigGroupHeadPrefilter *pf = &sgh->prefilter;
+    SigGroupHeadPidSig *pairs = NULL;
+    uint32_t pairs_cnt = 0;
+    uint32_t idx, u;
+
+    /* a sig needs at most a packet, a stream and a http pattern */
+    pairs = SCMalloc(sgh->sig_cnt * 3 * sizeof(SigGroupHeadPidSig));
+    pf->always = SCMalloc(sgh->sig_cnt * sizeof(uint32_t));
+    if (pairs == NULL || pf->always == NULL)
+        goto error;
+
+    for (idx = 0; idx < sgh->sig_cnt; idx++) {
+        uint32_t pids[3];
+        int pids_cnt = 0;
+        int i;
+
+        if (pf->mpm_packet_bit[idx] != 0) {
+            pids[pids_cnt++] = pf->mpm_packet_byte[idx] * 8 +
+                __builtin_ctz(pf->mpm_packet_bit[idx]);
+        }
+        if (pf->mpm_stream_bit[idx] != 0) {
+            pids[pids_cnt++] = pf->mpm_stream_byte[idx] * 8 +
+                __builtin_ctz(pf->mpm_stream_bit[idx]);
+        }
+
+        if (pids_cnt > 0 && (sgh->head_array[idx].flags & SIG_FLAG_DSIZE)) {
+            pf->always[pf->always_cnt++] = idx;
+            continue;
+        }
+
+        if (pf->mpm_http_bit[idx] != 0) {
+            pids[pids_cnt++] = pf->mpm_http_byte[idx] * 8 +
+                __builtin_ctz(pf->mpm_http_bit[idx]);
+        }
+
+        if (pids_cnt == 0) {
+            pf->always[pf->always_cnt++] = idx;
+            continue;
+        }
+
+        for (i = 0; i < pids_cnt; i++) {
+            pairs[pairs_cnt].pid = pids[i];
+            pairs[pairs_cnt].idx = idx;
+            pairs_cnt++;
+        }
+    }
+
+    qsort(pairs, pairs_cnt, sizeof(SigGroupHeadPidSig), SigGroupHeadPidSigCompare);
+
+    for (u = 0; u < pairs_cnt; u++) {
+        if (u == 0 || pairs[u].pid != pairs[u - 1].pid)
+            pf->pid_cnt++;
+    }
+
+    if (pairs_cnt > 0) {
+        pf->pid = SCMalloc(pf->pid_cnt * sizeof(uint32_t));
+        pf->pid_offset = SCMalloc((pf->pid_cnt + 1) * sizeof(uint32_t));
+        pf->pid_sigs = SCMalloc(pairs_cnt * sizeof(uint32_t));
+        if (pf->pid == NULL || pf->pid_offset == NULL || pf->pid_sigs == NULL)
+            goto error;
+
+        uint32_t p = 0, n = 0;
+        for (u = 0; u < pairs_cnt; u++) {
+            /* a sig often uses the same pattern for packet and stream */
+            if (u > 0 && pairs[u].pid == pairs[u - 1].pid &&
+                pairs[u].idx == pairs[u - 1].idx)
+                continue;
+
+            if (u == 0 || pairs[u].pid != pairs[u - 1].pid) {
+                pf->pid[p] = pairs[u].pid;
+                pf->pid_offset[p] = n;
+                p++;
+            }
+            pf->pid_sigs[n++] = pairs[u].idx;
+        }
+        pf->pid_offset[p] = n;
+    }
+
+    detect_siggroup_matcharray_memory += (sgh->sig_cnt + pairs_cnt +
+            2 * pf->pid_cnt + 1) * sizeof(uint32_t);
+
+    SCFree(pairs);
+    pairs = NULL;
+
+    if (SigGroupHeadBuildPrefilterEngines(sgh) < 0)
+        goto error;
+
+    return 0;
+
+error:
+    if (pairs != NULL)
+        SCFree(pairs);
+    return -1;
+}
+
+/**
+ * \brief Build the prefilter arrays from the head_array of a SigGroupHead
+ *
+ * \retval 0 on success
+ * \retval -1 on error
+ */
+static int SigGroupHeadBuildPrefilter(SigGroupHead *sgh)
+{
+    SigGroupHeadPrefilter *pf = &sgh->prefilter;
+    uint32_t idx = 0;
+
+    /* pad to whole blocks, so the prefilter can always load a full block.
+     * The padding is zeroed, the prefilter ignores it */
+    uint32_t cnt = ((sgh->sig_cnt + SIG_PREFILTER_BLOCK - 1) /
+            SIG_PREFILTER_BLOCK) * SIG_PREFILTER_BLOCK;
+    if (cnt == 0)
+        return 0;
+
+    pf->mask = SCMalloc(cnt * sizeof(SignatureMask));
+    pf->alproto = SCMalloc(cnt * sizeof(uint16_t));
+    pf->mpm_packet_byte = SCMalloc(cnt * sizeof(uint16_t));
+    pf->mpm_packet_bit = SCMalloc(cnt * sizeof(uint8_t));
+    pf->mpm_stream_byte = SCMalloc(cnt * sizeof(uint16_t));
+    pf->mpm_stream_bit = SCMalloc(cnt * sizeof(uint8_t));
+    pf->mpm_http_byte = SCMalloc(cnt * sizeof(uint16_t));
+    pf->mpm_http_bit = SCMalloc(cnt * sizeof(uint8_t));
+    if (pf->mask == NULL || pf->alproto == NULL ||
+        pf->mpm_packet_byte == NULL || pf->mpm_packet_bit == NULL ||
+        pf->mpm_stream_byte == NULL || pf->mpm_stream_bit == NULL ||
+        pf->mpm_http_byte == NULL || pf->mpm_http_bit == NULL)
+    {
+        SigGroupHeadFreePrefilter(sgh);
+        return -1;
+    }
+
+    memset(pf->mask, 0, cnt * sizeof(SignatureMask));
+    memset(pf->alproto, 0, cnt * sizeof(uint16_t));
+    memset(pf->mpm_packet_byte, 0, cnt * sizeof(uint16_t));
+    memset(pf->mpm_packet_bit, 0, cnt * sizeof(uint8_t));
+    memset(pf->mpm_stream_byte, 0, cnt * sizeof(uint16_t));
+    memset(pf->mpm_stream_bit, 0, cnt * sizeof(uint8_t));
+    memset(pf->mpm_http_byte, 0, cnt * sizeof(uint16_t));
+    memset(pf->mpm_http_bit, 0, cnt * sizeof(uint8_t));
+
+    detect_siggroup_matcharray_memory += cnt * (sizeof(SignatureMask) +
+            4 * sizeof(uint16_t) + 3 * sizeof(uint8_t));
+
+    for (idx = 0; idx < sgh->sig_cnt; idx++) {
+        SignatureHeader *s = &sgh->head_array[idx];
+
+        pf->mask[idx] = s->mask;
+
+        if (s->flags & SIG_FLAG_APPLAYER)
+            pf->alproto[idx] = s->alproto;
+
+        if ((s->flags & (SIG_FLAG_MPM_PACKET|SIG_FLAG_MPM_PACKET_NEG)) ==
+                SIG_FLAG_MPM_PACKET)
+        {
+            pf->mpm_packet_byte[idx] = s->mpm_pattern_id_div_8;
+            pf->mpm_packet_bit[idx] = s->mpm_pattern_id_mod_8;
+        }
+        if ((s->flags & (SIG_FLAG_MPM_STREAM|SIG_FLAG_MPM_STREAM_NEG)) ==
+                SIG_FLAG_MPM_STREAM)
+        {
+            pf->mpm_stream_byte[idx] = s->mpm_stream_pattern_id_div_8;
+            pf->mpm_stream_bit[idx] = s->mpm_stream_pattern_id_mod_8;
+        }
+
+        /* all http buffers share the http pattern id */
+        uint32_t f = s->flags;
+        if (((f & SIG_FLAG_MPM_URICONTENT) && !(f & SIG_FLAG_MPM_URICONTENT_NEG)) ||
+            ((f & SIG_FLAG_MPM_HCBDCONTENT) && !(f & SIG_FLAG_MPM_HCBDCONTENT_NEG)) ||
+            ((f & SIG_FLAG_MPM_HHDCONTENT) && !(f & SIG_FLAG_MPM_HHDCONTENT_NEG)) ||
+            ((f & SIG_FLAG_MPM_HRHDCONTENT) && !(f & SIG_FLAG_MPM_HRHDCONTENT_NEG)) ||
+            ((f & SIG_FLAG_MPM_HMDCONTENT) && !(f & SIG_FLAG_MPM_HMDCONTENT_NEG)) ||
+            ((f & SIG_FLAG_MPM_HCDCONTENT) && !(f & SIG_FLAG_MPM_HCDCONTENT_NEG)))
+        {
+            pf->mpm_http_byte[idx] = s->mpm_http_pattern_id / 8;
+            pf->mpm_http_bit[idx] = 1 << (s->mpm_http_pattern_id % 8);
+        }
+    }
+
+    if (SigGroupHeadBuildPrefilterIndex(sgh) < 0) {
+        SigGroupHeadFreePrefilter(sgh);
+        return -1;
+    }
+
+    return 0;
+}
+
 int SigGroupHeadBuildHeadArray(DetectEngineCtx *de_ctx, SigGroupHead *sgh)
 {
     Signature *s = NULL;
@@ -1602,7 +2289,7 @@ int SigGroupHeadBuildHeadArray(DetectEngineCtx *de_ctx, SigGroupHead *sgh)
         idx++;
     }
 
-    return 0;
+    return SigGroupHeadBuildPrefilter(sgh);
 }
 
 /**
@@ -85,4 +85,5 @@ void SigGroupHeadPrintSigs(DetectEngineCtx *de_ctx, SigGroupHead *sgh);
 
 void SigGroupHeadStore(DetectEngineCtx *, SigGroupHead *);
 int SigGroupHeadBuildHeadArray(DetectEngineCtx *, SigGroupHead *);
+void SigGroupHeadFreePrefilter(SigGroupHead *);
 #endif /* __DETECT_ENGINE_SIGGROUP_H__ */
@@ -482,6 +482,12 @@ int DeStateDetectStartDetection(ThreadVars *tv, DetectEngineCtx *de_ctx,
      * the last SigMatch that didn't match */
     if (f->de_state == NULL) {
         f->de_state = DetectEngineStateAlloc();
+        if (f->de_state != NULL)
+            f->de_state->de_ctx_version = de_ctx->version;
+    } else if (f->de_state->de_ctx_version != de_ctx->version) {
+        /* stored by another engine version, its sig ids don't apply */
+        DetectEngineStateReset(f->de_state);
+        f->de_state->de_ctx_version = de_ctx->version;
     }
     if (f->de_state != NULL) {
         /* \todo shift to an array to transfer these match values*/
@@ -531,6 +537,14 @@ int DeStateDetectContinueDetection(ThreadVars *tv, DetectEngineCtx *de_ctx, Dete
     if (f->de_state == NULL || f->de_state->cnt == 0)
         goto end;
 
+    /* the state was stored by the engine before a rule reload, its sig ids
+     * and sigmatches don't apply to this engine */
+    if (f->de_state->de_ctx_version != de_ctx->version) {
+        DetectEngineStateReset(f->de_state);
+        f->de_state->de_ctx_version = de_ctx->version;
+        goto end;
+    }
+
     /* loop through the stores */
     for (store = f->de_state->head; store != NULL; store = store->next)
     {
@@ -81,6 +81,8 @@ typedef struct DetectEngineState_ {
     DeStateStore *head; /**< signature state storage */
     DeStateStore *tail; /**< tail item of the storage list */
     SigIntId cnt;       /**< number of sigs in the storage */
+    uint32_t de_ctx_version; /**< version of the detection engine the
+                              *   stored sigs belong to */
 } DetectEngineState;
 
 void DeStateRegisterTests(void);
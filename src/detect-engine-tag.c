@@ -25,10 +25,8 @@
  */
 
 #include "suricata-common.h"
-#include "util-hash.h"
 #include "util-atomic.h"
 #include "util-time.h"
-#include "util-hashlist.h"
 #include "detect-engine-tag.h"
 #include "detect-tag.h"
 
@@ -37,69 +35,39 @@ static void TagTimeoutRemove(DetectTagHostCtx *tag_ctx, struct timeval *tv);
 SC_ATOMIC_DECLARE(unsigned int, num_tags);  /**< Atomic counter, to know if we
                                                 have tagged hosts/sessions,
                                                 to avoid locking */
+SC_ATOMIC_DECLARE(unsigned int, num_host_tags); /**< Part of num_tags that is
+                                                     installed on hosts */
 
 /* Global Ctx for tagging hosts */
 DetectTagHostCtx *tag_ctx = NULL;
 
-void TagFreeFunc(void *data)
-{
-    DetectTagDataListFree(data);
-    return;
-}
-
 /**
- * \brief Compare elements into the hash table
+ * \brief Create the hash row of a host
  *
- * \param data1 First element to compare
- * \param len1 length of first element
- * \param data2 Second element to compare
- * \param len2 length of second element
+ * \param addr Address of the host
+ * \param ipv Ip version of the address
  *
- * \retval 1 Match or 0 No Match
+ * \retval row the row in DetectTagHostCtx::rows
  */
-char TagCompareFunc(void *data1, uint16_t len1, void *data2,uint16_t len2)
+static inline uint32_t TagHashRow(Address *addr, uint8_t ipv)
 {
-    SCEnter();
-
-    DetectTagDataEntryList *a = (DetectTagDataEntryList *)data1;
-    DetectTagDataEntryList *b = (DetectTagDataEntryList *)data2;
+    uint32_t hash = 0;
 
-    if (CMP_ADDR(&a->addr,&b->addr)) {
-        SCReturnInt(1);
-    }
+    if (ipv == 4)
+        hash = addr->addr_data32[0];
+    else if (ipv == 6)
+        hash = (addr->addr_data32[0] +
+                addr->addr_data32[1] +
+                addr->addr_data32[2] +
+                addr->addr_data32[3]);
 
-    SCReturnInt(0);
+    hash ^= hash >> 16;
+    return hash % TAG_HASH_SIZE;
 }
 
-/**
- * \brief Create the hash for tag tables
- *
- * \param ht Hash Table
- * \param data DataEntry that will be used to create the hash
- * \param datalen DataEntry length
- *
- * \retval hash the hash
- */
-uint32_t TagHashFunc(HashListTable *ht, void *data, uint16_t datalen)
+static inline SCMutex *TagHashRowLock(DetectTagHostCtx *tag_ctx, uint32_t row)
 {
-    SCEnter();
-
-    if (data == NULL) return 0;
-    DetectTagDataEntryList *dt = (DetectTagDataEntryList *)data;
-    uint32_t hash = 0;
-
-    if (dt->ipv == 4)
-        hash = (dt->addr.addr_data32[0]);
-    else if (dt->ipv == 6)
-        hash = (dt->addr.addr_data32[0] +
-                dt->addr.addr_data32[1] +
-                dt->addr.addr_data32[2] +
-                dt->addr.addr_data32[3]);
-    else {
-        SCLogDebug("no dt->ipv");
-    }
-
-    SCReturnInt(hash % TAG_HASH_SIZE);
+    return &tag_ctx->locks[row & (TAG_HASH_LOCKS - 1)];
 }
 
 void TagInitCtx(void) {
@@ -111,7 +79,7 @@ void TagInitCtx(void) {
 
     TimeGet(&tag_ctx->last_ts);
 
-    if (SCMutexInit(&tag_ctx->lock, NULL) != 0) {
+    if (SCMutexInit(&tag_ctx->prune_lock, NULL) != 0) {
         SCLogError(SC_ERR_MEM_ALLOC,
                 "Tag: Failed to initialize hash table mutex.");
         exit(EXIT_FAILURE);
@@ -119,6 +87,7 @@ void TagInitCtx(void) {
 
     TagHashInit(tag_ctx);
     SC_ATOMIC_INIT(num_tags);
+    SC_ATOMIC_INIT(num_host_tags);
 }
 
 /**
@@ -129,14 +98,28 @@ void TagInitCtx(void) {
  */
 void TagDestroyCtx(void)
 {
-    HashListTableFree(tag_ctx->tag_hash_table_ipv4);
-    tag_ctx->tag_hash_table_ipv4 = NULL;
+    uint32_t u;
+
+    for (u = 0; u < TAG_HASH_SIZE; u++) {
+        DetectTagDataEntryList *tdl = tag_ctx->rows[u];
+        while (tdl != NULL) {
+            DetectTagDataEntryList *next = tdl->next;
+            DetectTagDataListFree(tdl);
+            tdl = next;
+        }
+    }
+    SCFree(tag_ctx->rows);
+    tag_ctx->rows = NULL;
 
-    HashListTableFree(tag_ctx->tag_hash_table_ipv6);
-    tag_ctx->tag_hash_table_ipv6 = NULL;
+    for (u = 0; u < TAG_HASH_LOCKS; u++) {
+        SCMutexDestroy(&tag_ctx->locks[u]);
+    }
+    SCFree(tag_ctx->locks);
+    tag_ctx->locks = NULL;
 
-    SCMutexDestroy(&tag_ctx->lock);
+    SCMutexDestroy(&tag_ctx->prune_lock);
     SC_ATOMIC_DESTROY(num_tags);
+    SC_ATOMIC_DESTROY(num_host_tags);
 
     SCFree(tag_ctx);
     tag_ctx = NULL;
@@ -157,73 +140,71 @@ void TagRestartCtx() {
  */
 void TagHashInit(DetectTagHostCtx *tag_ctx)
 {
-    tag_ctx->tag_hash_table_ipv4 = HashListTableInit(TAG_HASH_SIZE, TagHashFunc, TagCompareFunc, TagFreeFunc);
-    if(tag_ctx->tag_hash_table_ipv4 == NULL)    {
+    int i;
+
+    tag_ctx->rows = SCMalloc(TAG_HASH_SIZE * sizeof(DetectTagDataEntryList *));
+    if (tag_ctx->rows == NULL) {
         SCLogError(SC_ERR_MEM_ALLOC,
-                "Tag: Failed to initialize ipv4 dst hash table.");
+                "Tag: Failed to initialize host hash table.");
         exit(EXIT_FAILURE);
     }
+    memset(tag_ctx->rows, 0, TAG_HASH_SIZE * sizeof(DetectTagDataEntryList *));
 
-    tag_ctx->tag_hash_table_ipv6 = HashListTableInit(TAG_HASH_SIZE, TagHashFunc, TagCompareFunc, TagFreeFunc);
-    if(tag_ctx->tag_hash_table_ipv6 == NULL)    {
+    tag_ctx->locks = SCMalloc(TAG_HASH_LOCKS * sizeof(SCMutex));
+    if (tag_ctx->locks == NULL) {
         SCLogError(SC_ERR_MEM_ALLOC,
-                "Tag: Failed to initialize ipv4 src hash table.");
+                "Tag: Failed to initialize host hash table locks.");
         exit(EXIT_FAILURE);
     }
+
+    for (i = 0; i < TAG_HASH_LOCKS; i++) {
+        if (SCMutexInit(&tag_ctx->locks[i], NULL) != 0) {
+            SCLogError(SC_ERR_MEM_ALLOC,
+                    "Tag: Failed to initialize hash table mutex.");
+            exit(EXIT_FAILURE);
+        }
+    }
 }
 
 /**
- * \brief Search for a tag data into tag hash table
+ * \brief Search for the tags of a host. Row lock needs to be held.
  *
- * \param de_ctx Dectection Context
- * \param dtde Tag element
- * \param p Packet structure
+ * \param tag_ctx Tag context for hosts
+ * \param row Row of the host, from TagHashRow
+ * \param dtde Tag list holding the address and ip version to search for
  *
- * \retval lookup_tde Return the tag element
+ * \retval lookup_tde Return the tag list of the host or NULL
  */
-DetectTagDataEntryList *TagHashSearch(DetectTagHostCtx *tag_ctx, DetectTagDataEntryList *dtde,
-                                  Packet *p)
+static DetectTagDataEntryList *TagHashSearch(DetectTagHostCtx *tag_ctx, uint32_t row,
+                                             DetectTagDataEntryList *dtde)
 {
     SCEnter();
 
-    DetectTagDataEntryList *lookup_tde = NULL;
+    DetectTagDataEntryList *lookup_tde = tag_ctx->rows[row];
 
-    if (PKT_IS_IPV4(p)) {
-        SCLogDebug("ipv4 search");
-        lookup_tde = HashListTableLookup(tag_ctx->tag_hash_table_ipv4, dtde, sizeof(DetectTagDataEntryList));
-    } else if (PKT_IS_IPV6(p)) {
-        SCLogDebug("ipv6 search");
-        lookup_tde = HashListTableLookup(tag_ctx->tag_hash_table_ipv6, dtde, sizeof(DetectTagDataEntryList));
+    for ( ; lookup_tde != NULL; lookup_tde = lookup_tde->next) {
+        if (lookup_tde->ipv == dtde->ipv && CMP_ADDR(&lookup_tde->addr, &dtde->addr))
+            break;
     }
 
     SCReturnPtr(lookup_tde, "DetectTagDataEntryList");
 }
 
 /**
- * \brief Add tag element into hash table
- *
- * \param de_ctx Dectection Context
- * \param dtde Tag element
- * \param p Packet structure
- *
+ * \brief Unlink a host from its row and free it. Row lock needs to be held.
  */
-void TagHashAdd(DetectTagHostCtx *tag_ctx, DetectTagDataEntryList *dtde, Packet *p)
+static void TagHashRemove(DetectTagHostCtx *tag_ctx, uint32_t row,
+                          DetectTagDataEntryList *dtde)
 {
-    SCEnter();
-
-    int ret = 0;
+    DetectTagDataEntryList **pl = &tag_ctx->rows[row];
 
-    if (PKT_IS_IPV4(p)) {
-        dtde->ipv = 4;
-        ret = HashListTableAdd(tag_ctx->tag_hash_table_ipv4,
-                               dtde, sizeof(DetectTagDataEntry));
-    } else if (PKT_IS_IPV6(p)) {
-        dtde->ipv = 6;
-        ret = HashListTableAdd(tag_ctx->tag_hash_table_ipv6,
-                               dtde, sizeof(DetectTagDataEntry));
+    for ( ; *pl != NULL; pl = &(*pl)->next) {
+        if (*pl == dtde) {
+            *pl = dtde->next;
+            SCFree(dtde);
+            return;
+        }
     }
-
-    SCReturn;
 }
 
 /**
@@ -233,7 +214,9 @@ void TagHashAdd(DetectTagHostCtx *tag_ctx, DetectTagDataEntryList *dtde, Packet
  * \param tde Tag data
  * \param p packet
  *
- * \retval 0 if it was added, 1 if it was updated
+ * \retval 0 if it was added, 1 if it was updated or not added as the
+ *         host reached DETECT_TAG_MAX_TAGS. In the last case the caller
+ *         still owns tde.
  */
 int TagHashAddTag(DetectTagHostCtx *tag_ctx, DetectTagDataEntry *tde, Packet *p)
 {
@@ -243,14 +226,10 @@ int TagHashAddTag(DetectTagHostCtx *tag_ctx, DetectTagDataEntry *tde, Packet *p)
     /* local, just for searching */
     DetectTagDataEntryList tdl;
 
-    tdl.header_entry = NULL;
-    tdl.header_entry = tde;
-
     SCEnter();
-    SCMutexLock(&tag_ctx->lock);
 
-    /* first search if we already have an entry of this host */
-    DetectTagDataEntryList *entry = NULL;
+    memset(&tdl, 0, sizeof(tdl));
+
     if (PKT_IS_IPV4(p)) {
         tdl.ipv = 4;
         if (tde->td->direction == DETECT_TAG_DIR_SRC) {
@@ -265,16 +244,29 @@ int TagHashAddTag(DetectTagHostCtx *tag_ctx, DetectTagDataEntry *tde, Packet *p)
         } else if (tde->td->direction == DETECT_TAG_DIR_DST) {
             SET_IPV6_DST_ADDR(p, &tdl.addr);
         }
+    } else {
+        SCReturnInt(1);
     }
 
-    entry = TagHashSearch(tag_ctx, &tdl, p);
+    uint32_t row = TagHashRow(&tdl.addr, tdl.ipv);
+    SCMutex *lock = TagHashRowLock(tag_ctx, row);
+
+    SCMutexLock(lock);
+
+    /* first search if we already have an entry of this host */
+    DetectTagDataEntryList *entry = TagHashSearch(tag_ctx, row, &tdl);
     if (entry == NULL) {
         DetectTagDataEntryList *new = SCMalloc(sizeof(DetectTagDataEntryList));
         if (new == NULL) {
             SCLogError(SC_ERR_MEM_ALLOC, "Failed to allocate a new session");
+            SCMutexUnlock(lock);
+            SCReturnInt(1);
         }
         memcpy(new, &tdl, sizeof(DetectTagDataEntryList));
-        TagHashAdd(tag_ctx, new, p);
+        tde->next = NULL;
+        new->header_entry = tde;
+        new->next = tag_ctx->rows[row];
+        tag_ctx->rows[row] = new;
     } else {
         /* Append the tag to the list of this host */
 
@@ -302,19 +294,144 @@ int TagHashAddTag(DetectTagHostCtx *tag_ctx, DetectTagDataEntry *tde, Packet *p)
         if (updated == 0 && num_tags < DETECT_TAG_MAX_TAGS) {
             tde->next = entry->header_entry;
             entry->header_entry = tde;
-        } else if (num_tags == DETECT_TAG_MAX_TAGS) {
+        } else if (updated == 0) {
             SCLogDebug("Max tags for sessions reached (%"PRIu16")", num_tags);
+            updated = 1;
         }
-
     }
 
-    SCMutexUnlock(&tag_ctx->lock);
+    SCMutexUnlock(lock);
+
+    if (updated == 0) {
+        SC_ATOMIC_ADD(num_host_tags, 1);
+        SC_ATOMIC_ADD(num_tags, 1);
+    }
     SCReturnInt(updated);
 }
 
+/**
+ * \brief Update the counters of a list of tags for this packet and
+ *        remove the tags that expired.
+ *
+ * \param head Pointer to the head of the list, updated on removal
+ * \param p packet
+ * \param ts current time
+ * \param removed incremented for each removed tag
+ *
+ * \retval 1 if the packet is part of one of the tags, 0 otherwise
+ */
+static int TagHandleEntries(DetectTagDataEntry **head, Packet *p,
+                            struct timeval *ts, uint32_t *removed)
+{
+    DetectTagDataEntry **piter = head;
+    int tagged = 0;
+
+    while (*piter != NULL) {
+        DetectTagDataEntry *iter = *piter;
+
+        /* update counters */
+        iter->last_ts.tv_sec = ts->tv_sec;
+        iter->packets++;
+        iter->bytes += GET_PKT_LEN(p);
+
+        /* If this packet triggered the rule with tag, we dont need
+         * to log it (the alert will log it) */
+        if (iter->first_time++ > 0 && iter->td != NULL) {
+            int expired = 0;
+
+            /* Update metrics; remove if tag expired; and set alerts */
+            switch (iter->td->metric) {
+                case DETECT_TAG_METRIC_PACKET:
+                    expired = (iter->packets > iter->td->count);
+                    break;
+                case DETECT_TAG_METRIC_BYTES:
+                    expired = (iter->bytes > iter->td->count);
+                    break;
+                case DETECT_TAG_METRIC_SECONDS:
+                    /* last_ts handles this metric, but also a generic time based
+                     * expiration to prevent dead sessions/hosts */
+                    expired = (iter->last_ts.tv_sec - iter->first_ts.tv_sec > (int)iter->td->count);
+                    break;
+            }
+
+            if (expired) {
+                *piter = iter->next;
+                SCFree(iter);
+                (*removed)++;
+                continue;
+            }
+
+            /* It's matching the tag. Add it to be logged */
+            tagged = 1;
+        }
+
+        piter = &iter->next;
+    }
+
+    return tagged;
+}
+
+/**
+ * \brief Handle the session tags of a flow for this packet
+ *
+ * The flow lock needs to be held by the caller, SigMatchSignatures
+ * calls this from the block where it stores the sgh in the flow.
+ *
+ * \param f flow, locked
+ * \param p packet
+ */
+void TagHandlePacketFlow(Flow *f, Packet *p)
+{
+    uint32_t removed = 0;
+
+    if (f->tag_list == NULL || f->tag_list->header_entry == NULL)
+        return;
+
+    struct timeval ts = { 0, 0 };
+    TimeGet(&ts);
+
+    if (TagHandleEntries(&f->tag_list->header_entry, p, &ts, &removed) == 1)
+        p->flags |= PKT_HAS_TAG;
+
+    if (removed > 0)
+        SC_ATOMIC_SUB(num_tags, removed);
+}
+
+/**
+ * \brief Handle the tags of one host of the packet
+ *
+ * \retval 1 if the packet is part of one of the tags, 0 otherwise
+ */
+static int TagHandlePacketHost(DetectTagHostCtx *tag_ctx, DetectTagDataEntryList *tdl,
+                               Packet *p, struct timeval *ts)
+{
+    uint32_t removed = 0;
+    int tagged = 0;
+    uint32_t row = TagHashRow(&tdl->addr, tdl->ipv);
+    SCMutex *lock = TagHashRowLock(tag_ctx, row);
+
+    SCMutexLock(lock);
+    DetectTagDataEntryList *entry = TagHashSearch(tag_ctx, row, tdl);
+    if (entry != NULL) {
+        tagged = TagHandleEntries(&entry->header_entry, p, ts, &removed);
+        if (entry->header_entry == NULL)
+            TagHashRemove(tag_ctx, row, entry);
+    }
+    SCMutexUnlock(lock);
+
+    if (removed > 0) {
+        SC_ATOMIC_SUB(num_host_tags, removed);
+        SC_ATOMIC_SUB(num_tags, removed);
+    }
+    return tagged;
+}
+
 /**
  * \brief Search tags for src and dst. Update entries of the tag, remove if necessary
  *
+ * Session tags of packets with PKT_HAS_FLOW are handled by
+ * TagHandlePacketFlow, under the flow lock SigMatchSignatures holds.
+ *
  * \param de_ctx Detect context
  * \param det_ctx Detect thread context
  * \param p packet
@@ -323,448 +440,117 @@ int TagHashAddTag(DetectTagHostCtx *tag_ctx, DetectTagDataEntry *tde, Packet *p)
 void TagHandlePacket(DetectEngineCtx *de_ctx, DetectEngineThreadCtx *det_ctx,
                      Packet *p) {
 
-    DetectTagDataEntry *tde = NULL;
-    DetectTagDataEntry *prev = NULL;
-    DetectTagDataEntry *iter = NULL;
     DetectTagDataEntryList tdl;
 
-    unsigned int current_tags = SC_ATOMIC_GET(num_tags);
     /* If there's no tag, get out of here */
-    if (current_tags == 0)
+    if (SC_ATOMIC_GET(num_tags) == 0)
         return;
 
-    uint8_t flag_added = 0;
-    struct timeval ts = { 0, 0 };
-    TimeGet(&ts);
-
-    /* First update and get session tags */
-    if (p->flow != NULL) {
+    /* a flow we don't get to see locked later on */
+    if (p->flow != NULL && !(p->flags & PKT_HAS_FLOW)) {
         SCMutexLock(&p->flow->m);
-        if (p->flow->tag_list != NULL) {
-            iter = p->flow->tag_list->header_entry;
-            prev = NULL;
-            while (iter != NULL) {
-                /* update counters */
-                iter->last_ts.tv_sec = ts.tv_sec;
-                iter->packets++;
-                iter->bytes += GET_PKT_LEN(p);
-
-                /* If this packet triggered the rule with tag, we dont need
-                 * to log it (the alert will log it) */
-                if (iter->first_time++ > 0) {
-                    /* Update metrics; remove if tag expired; and set alerts */
-                    switch (iter->td->metric) {
-                        case DETECT_TAG_METRIC_PACKET:
-                            if (iter->packets > iter->td->count) {
-                                /* tag expired */
-                                if (prev != NULL) {
-                                    tde = iter;
-                                    prev->next = iter->next;
-                                    iter = iter->next;
-                                    SCFree(tde);
-                                    SC_ATOMIC_SUB(num_tags, 1);
-                                    continue;
-                                } else {
-                                    p->flow->tag_list->header_entry = iter->next;
-                                    tde = iter;
-                                    iter = iter->next;
-                                    SCFree(tde);
-                                    SC_ATOMIC_SUB(num_tags, 1);
-                                    continue;
-                                }
-                            } else if (flag_added == 0) {
-                                /* It's matching the tag. Add it to be logged and
-                                 * update "flag_added" to add the packet once. */
-                                p->flags |= PKT_HAS_TAG;
-                                flag_added++;
-                            }
-                        break;
-                        case DETECT_TAG_METRIC_BYTES:
-                            if (iter->bytes > iter->td->count) {
-                                /* tag expired */
-                                if (prev != NULL) {
-                                    tde = iter;
-                                    prev->next = iter->next;
-                                    iter = iter->next;
-                                    SCFree(tde);
-                                    SC_ATOMIC_SUB(num_tags, 1);
-                                    continue;
-                                } else {
-                                    p->flow->tag_list->header_entry = iter->next;
-                                    tde = iter;
-                                    iter = iter->next;
-                                    SCFree(tde);
-                                    SC_ATOMIC_SUB(num_tags, 1);
-                                    continue;
-                                }
-                            } else if (flag_added == 0) {
-                                /* It's matching the tag. Add it to be logged and
-                                 * update "flag_added" to add the packet once. */
-                                p->flags |= PKT_HAS_TAG;
-                                flag_added++;
-                            }
-                        break;
-                        case DETECT_TAG_METRIC_SECONDS:
-                            /* last_ts handles this metric, but also a generic time based
-                             * expiration to prevent dead sessions/hosts */
-                            if (iter->last_ts.tv_sec - iter->first_ts.tv_sec > (int)iter->td->count) {
-                                /* tag expired */
-                                if (prev != NULL) {
-                                    tde = iter;
-                                    prev->next = iter->next;
-                                    iter = iter->next;
-                                    SCFree(tde);
-                                    SC_ATOMIC_SUB(num_tags, 1);
-                                    continue;
-                                } else {
-                                    p->flow->tag_list->header_entry = iter->next;
-                                    tde = iter;
-                                    iter = iter->next;
-                                    SCFree(tde);
-                                    SC_ATOMIC_SUB(num_tags, 1);
-                                    continue;
-                                }
-                            } else if (flag_added == 0) {
-                                /* It's matching the tag. Add it to be logged and
-                                 * update "flag_added" to add the packet once. */
-                                p->flags |= PKT_HAS_TAG;
-                                flag_added++;
-                            }
-                        break;
-                    }
-
-                }
-
-                prev = iter;
-                iter = iter->next;
-            }
-        }
+        TagHandlePacketFlow(p->flow, p);
         SCMutexUnlock(&p->flow->m);
     }
 
-    /* Then search the src and dst hosts at the ctx */
-    SCMutexLock(&tag_ctx->lock);
+    if (SC_ATOMIC_GET(num_host_tags) == 0)
+        return;
+
+    struct timeval ts = { 0, 0 };
+    TimeGet(&ts);
 
-    /* Check for timeout tags if we reached the interval for checking it */
-    if (ts.tv_sec - tag_ctx->last_ts.tv_sec > TAG_TIMEOUT_CHECK_INTERVAL) {
-        TagTimeoutRemove(tag_ctx, &ts);
-        tag_ctx->last_ts.tv_sec = ts.tv_sec;
+    /* Check for timeout tags if we reached the interval for checking it.
+     * Only one thread does the pass, the others move on. */
+    if (ts.tv_sec - tag_ctx->last_ts.tv_sec > TAG_TIMEOUT_CHECK_INTERVAL &&
+        SCMutexTrylock(&tag_ctx->prune_lock) == 0)
+    {
+        if (ts.tv_sec - tag_ctx->last_ts.tv_sec > TAG_TIMEOUT_CHECK_INTERVAL) {
+            TagTimeoutRemove(tag_ctx, &ts);
+            tag_ctx->last_ts.tv_sec = ts.tv_sec;
+        }
+        SCMutexUnlock(&tag_ctx->prune_lock);
     }
 
-    DetectTagDataEntryList *tde_src = NULL;
-    DetectTagDataEntryList *tde_dst = NULL;
+    memset(&tdl, 0, sizeof(tdl));
 
+    int tagged = 0;
     if (PKT_IS_IPV4(p)) {
         tdl.ipv = 4;
         /* search tags for source */
         SET_IPV4_SRC_ADDR(p, &tdl.addr);
-        tde_src = TagHashSearch(tag_ctx, &tdl, p);
+        tagged |= TagHandlePacketHost(tag_ctx, &tdl, p, &ts);
 
         /* search tags for dest */
         SET_IPV4_DST_ADDR(p, &tdl.addr);
-        tde_dst = TagHashSearch(tag_ctx, &tdl, p);
+        tagged |= TagHandlePacketHost(tag_ctx, &tdl, p, &ts);
     } else if (PKT_IS_IPV6(p)) {
         tdl.ipv = 6;
         /* search tags for source */
         SET_IPV6_SRC_ADDR(p, &tdl.addr);
-        tde_src = TagHashSearch(tag_ctx, &tdl, p);
+        tagged |= TagHandlePacketHost(tag_ctx, &tdl, p, &ts);
 
         /* search tags for dest */
         SET_IPV6_DST_ADDR(p, &tdl.addr);
-        tde_dst = TagHashSearch(tag_ctx, &tdl, p);
+        tagged |= TagHandlePacketHost(tag_ctx, &tdl, p, &ts);
     }
 
-    if (tde_src != NULL)
-        iter = tde_src->header_entry;
-    prev = NULL;
-    while (iter != NULL) {
-        /* update counters */
-        iter->last_ts.tv_sec = ts.tv_sec;
-        iter->packets++;
-        iter->bytes += GET_PKT_LEN(p);
-
-        /* If this packet triggered the rule with tag, we dont need
-         * to log it (the alert will log it) */
-        if (iter->first_time++ > 0 && iter->td != NULL) {
-            /* Update metrics; remove if tag expired; and set alerts */
-            switch (iter->td->metric) {
-                case DETECT_TAG_METRIC_PACKET:
-                    if (iter->packets > iter->td->count) {
-                        /* tag expired */
-                        if (prev != NULL) {
-                            tde = iter;
-                            prev->next = iter->next;
-                            iter = iter->next;
-                            DetectTagDataEntryFree(tde);
-                            continue;
-                        } else {
-                            tde = iter;
-                            iter = iter->next;
-                            SCFree(tde);
-                            SC_ATOMIC_SUB(num_tags, 1);
-                            tde_src->header_entry = NULL;
-                            continue;
-                        }
-                    } else if (flag_added == 0) {
-                            /* It's matching the tag. Add it to be logged and
-                             * update "flag_added" to add the packet once. */
-                            p->flags |= PKT_HAS_TAG;
-                            flag_added++;
-                    }
-                break;
-                case DETECT_TAG_METRIC_BYTES:
-                    if (iter->bytes > iter->td->count) {
-                        /* tag expired */
-                        if (prev != NULL) {
-                            tde = iter;
-                            prev->next = iter->next;
-                            iter = iter->next;
-                            DetectTagDataEntryFree(tde);
-                            continue;
-                        } else {
-                            tde = iter;
-                            iter = iter->next;
-                            SCFree(tde);
-                            SC_ATOMIC_SUB(num_tags, 1);
-                            tde_src->header_entry = NULL;
-                            continue;
-                        }
-                    } else if (flag_added == 0) {
-                            /* It's matching the tag. Add it to be logged and
-                             * update "flag_added" to add the packet once. */
-                            p->flags |= PKT_HAS_TAG;
-                            flag_added++;
-                    }
-                break;
-                case DETECT_TAG_METRIC_SECONDS:
-                    /* last_ts handles this metric, but also a generic time based
-                     * expiration to prevent dead sessions/hosts */
-                    if (iter->last_ts.tv_sec - iter->first_ts.tv_sec > (int)iter->td->count) {
-                        /* tag expired */
-                        if (prev != NULL) {
-                            tde = iter;
-                            prev->next = iter->next;
-                            iter = iter->next;
-                            DetectTagDataEntryFree(tde);
-                            continue;
-                        } else {
-                            tde = iter;
-                            iter = iter->next;
-                            SCFree(tde);
-                            SC_ATOMIC_SUB(num_tags, 1);
-                            tde_src->header_entry = NULL;
-                            continue;
-                        }
-                    } else if (flag_added == 0) {
-                            /* It's matching the tag. Add it to be logged and
-                             * update "flag_added" to add the packet once. */
-                            p->flags |= PKT_HAS_TAG;
-                            flag_added++;
-                    }
-                break;
-            }
-
-        }
-        prev = iter;
-        iter = iter->next;
-    }
-
-    if (tde_dst != NULL)
-        iter = tde_dst->header_entry;
-    prev = NULL;
-    while (iter != NULL) {
-        /* update counters */
-        iter->last_ts.tv_sec = ts.tv_sec;
-        iter->packets++;
-        iter->bytes += GET_PKT_LEN(p);
-
-        /* If this packet triggered the rule with tag, we dont need
-         * to log it (the alert will log it) */
-        if (iter->first_time++ > 0 && iter->td != NULL) {
-            /* Update metrics; remove if tag expired; and set alerts */
-            switch (iter->td->metric) {
-                case DETECT_TAG_METRIC_PACKET:
-                    if (iter->packets > iter->td->count) {
-                        /* tag expired */
-                        if (prev != NULL) {
-                            tde = iter;
-                            prev->next = iter->next;
-                            iter = iter->next;
-                            DetectTagDataEntryFree(tde);
-                            continue;
-                        } else {
-                            tde = iter;
-                            iter = iter->next;
-                            SCFree(tde);
-                            SC_ATOMIC_SUB(num_tags, 1);
-                            tde_dst->header_entry = NULL;
-                            continue;
-                        }
-                    } else if (flag_added == 0) {
-                        /* It's matching the tag. Add it to be logged and
-                         * update "flag_added" to add the packet once. */
-                        p->flags |= PKT_HAS_TAG;
-                        flag_added++;
-                    }
-                break;
-                case DETECT_TAG_METRIC_BYTES:
-                    if (iter->bytes > iter->td->count) {
-                        /* tag expired */
-                        if (prev != NULL) {
-                            tde = iter;
-                            prev->next = iter->next;
-                            iter = iter->next;
-                            DetectTagDataEntryFree(tde);
-                            continue;
-                        } else {
-                            tde = iter;
-                            iter = iter->next;
-                            SCFree(tde);
-                            SC_ATOMIC_SUB(num_tags, 1);
-                            tde_dst->header_entry = NULL;
-                            continue;
-                        }
-                    }  else if (flag_added == 0) {
-                        /* It's matching the tag. Add it to be logged and
-                         * update "flag_added" to add the packet once. */
-                        p->flags |= PKT_HAS_TAG;
-                        flag_added++;
-                    }
-                break;
-                case DETECT_TAG_METRIC_SECONDS:
-                    /* last_ts handles this metric, but also a generic time based
-                     * expiration to prevent dead sessions/hosts */
-                    if (iter->last_ts.tv_sec - iter->first_ts.tv_sec > (int)iter->td->count) {
-                        /* tag expired */
-                        if (prev != NULL) {
-                            tde = iter;
-                            prev->next = iter->next;
-                            iter = iter->next;
-                            DetectTagDataEntryFree(tde);
-                            continue;
-                        } else {
-                            tde = iter;
-                            iter = iter->next;
-                            SCFree(tde);
-                            SC_ATOMIC_SUB(num_tags, 1);
-                            tde_dst->header_entry = NULL;
-                            continue;
-                        }
-                    } else if (flag_added == 0) {
-                        /* It's matching the tag. Add it to be logged and
-                         * update "flag_added" to add the packet once. */
-                        p->flags |= PKT_HAS_TAG;
-                        flag_added++;
-                    }
-                break;
-            }
-        }
-
-        prev = iter;
-        iter = iter->next;
-    }
-
-    SCMutexUnlock(&tag_ctx->lock);
+    if (tagged)
+        p->flags |= PKT_HAS_TAG;
 }
 
 /**
  * \brief Removes the entries exceding the max timeout value
  *
+ * Rows are locked one at a time, so the detect threads are only held
+ * up for the row that is being pruned.
+ *
  * \param tag_ctx Tag context
  * \param ts the current time
  *
  */
 static void TagTimeoutRemove(DetectTagHostCtx *tag_ctx, struct timeval *tv)
 {
-    HashListTableBucket *next = NULL;
-    HashListTableBucket *buck = NULL;
-
-    DetectTagDataEntry *tde= NULL;
-    DetectTagDataEntry *tmp = NULL;
-    DetectTagDataEntry *prev= NULL;
+    uint32_t row;
+    uint32_t removed = 0;
 
-    DetectTagDataEntryList *tdl = NULL;
+    for (row = 0; row < TAG_HASH_SIZE; row++) {
+        if (tag_ctx->rows[row] == NULL)
+            continue;
 
-    buck = HashListTableGetListHead(tag_ctx->tag_hash_table_ipv4);
+        SCMutex *lock = TagHashRowLock(tag_ctx, row);
+        SCMutexLock(lock);
 
-    while (buck != NULL) {
-        /* get the next before we free "buck" */
-        next = HashListTableGetListNext(buck);
-        tdl = HashListTableGetListData(buck);
+        DetectTagDataEntryList **pl = &tag_ctx->rows[row];
+        while (*pl != NULL) {
+            DetectTagDataEntryList *tdl = *pl;
+            DetectTagDataEntry **ptde = &tdl->header_entry;
 
-        if (tdl != NULL && tdl->header_entry != NULL) {
-            tmp = tdl->header_entry;
+            while (*ptde != NULL) {
+                DetectTagDataEntry *tde = *ptde;
 
-            prev = NULL;
-            while (tmp != NULL) {
-
-                if ((tv->tv_sec - tmp->last_ts.tv_sec) <= TAG_MAX_LAST_TIME_SEEN) {
-                    tmp = tmp->next;
+                if ((tv->tv_sec - tde->last_ts.tv_sec) <= TAG_MAX_LAST_TIME_SEEN) {
+                    ptde = &tde->next;
                     continue;
                 }
 
-                if (prev != NULL) {
-                    prev->next = tmp->next;
-
-                    tde = tmp;
-                    tmp = tmp->next;
-
-                    SCFree(tde);
-                    SC_ATOMIC_SUB(num_tags, 1);
-                } else {
-                    tdl->header_entry = tmp->next;
-
-                    tde = tmp;
-                    tmp = tmp->next;
-
-                    SCFree(tde);
-                    SC_ATOMIC_SUB(num_tags, 1);
-                }
+                *ptde = tde->next;
+                SCFree(tde);
+                removed++;
             }
-        }
-        buck = next;
-    }
-
-    buck = HashListTableGetListHead(tag_ctx->tag_hash_table_ipv6);
-
-    while (buck != NULL) {
-        /* get the next before we free "buck" */
-        next = HashListTableGetListNext(buck);
-        tdl = HashListTableGetListData(buck);
-
-        if (tdl != NULL && tdl->header_entry != NULL) {
-            tmp = tdl->header_entry;
-
-            prev = NULL;
-            while (tmp != NULL) {
 
-                if ((tv->tv_sec - tmp->last_ts.tv_sec) <= TAG_MAX_LAST_TIME_SEEN) {
-                    tmp = tmp->next;
-                    continue;
-                }
-
-                if (prev != NULL) {
-                    prev->next = tmp->next;
-
-                    tde = tmp;
-                    tmp = tmp->next;
-
-                    SCFree(tde);
-                    SC_ATOMIC_SUB(num_tags, 1);
-                } else {
-                    tdl->header_entry = tmp->next;
-
-                    tde = tmp;
-                    tmp = tmp->next;
-
-                    SCFree(tde);
-                    SC_ATOMIC_SUB(num_tags, 1);
-                }
+            if (tdl->header_entry == NULL) {
+                *pl = tdl->next;
+                SCFree(tdl);
+                continue;
             }
+            pl = &tdl->next;
         }
-        buck = next;
+
+        SCMutexUnlock(lock);
     }
 
-    return;
+    if (removed > 0) {
+        SC_ATOMIC_SUB(num_host_tags, removed);
+        SC_ATOMIC_SUB(num_tags, removed);
+    }
 }
-
@@ -30,6 +30,8 @@
 #include "detect.h"
 
 #define TAG_HASH_SIZE 0xffff
+/** number of host row locks, must be a power of 2 */
+#define TAG_HASH_LOCKS 1024
 
 /* This limit should be overwriten/predefined at the config file
  * to limit the options to prevent possible DOS situations. We should also
@@ -45,9 +47,9 @@
 
 void TagHashInit(DetectTagHostCtx *);
 int TagHashAddTag(DetectTagHostCtx *, DetectTagDataEntry *, Packet *);
-void TagContextDestroy(DetectTagHostCtx *);
 void TagHandlePacket(DetectEngineCtx *, DetectEngineThreadCtx *,
                      Packet *);
+void TagHandlePacketFlow(Flow *, Packet *);
 
 void TagInitCtx(void);
 void TagDestroyCtx(void);
@@ -81,135 +81,185 @@ DetectThresholdData *SigGetThresholdType(Signature *sig, Packet *p)
 }
 
 /**
- * \brief Search for a threshold data into threshold hash table
+ * \brief Hash an entry into its threshold hash row
  *
- * \param de_ctx Dectection Context
- * \param tsh_ptr Threshold element
- * \param p Packet structure
+ * \param e Threshold entry, sid, gid, ipv and addr need to be set
  *
- * \retval lookup_tsh Return the threshold element
+ * \retval row the row in ThresholdCtx::rows
  */
-DetectThresholdEntry *ThresholdHashSearch(DetectEngineCtx *de_ctx, DetectThresholdEntry *tsh_ptr, Packet *p)
+static inline uint32_t ThresholdHashRow(DetectThresholdEntry *e)
 {
-    SCEnter();
+    uint32_t hash = e->sid + e->gid + e->track;
 
-    DetectThresholdEntry *lookup_tsh = NULL;
+    if (e->ipv == 4) {
+        hash += e->addr.addr_data32[0];
+    } else if (e->ipv == 6) {
+        hash += e->addr.addr_data32[0] + e->addr.addr_data32[1] +
+                e->addr.addr_data32[2] + e->addr.addr_data32[3];
+    }
 
-    SCLogDebug("tsh_ptr->track %u", tsh_ptr->track);
+    /* fold the address bits down, the low bits of a network
+     * address are often the same for a lot of hosts */
+    hash ^= hash >> 16;
+    return hash % THRESHOLD_HASH_SIZE;
+}
 
-    if (tsh_ptr->track == TRACK_DST) {
-        if (PKT_IS_IPV4(p)) {
-            SCLogDebug("ipv4 dst");
-            lookup_tsh = HashListTableLookup(de_ctx->ths_ctx.threshold_hash_table_dst, tsh_ptr, sizeof(DetectThresholdEntry));
-        } else if (PKT_IS_IPV6(p)) {
-            lookup_tsh = HashListTableLookup(de_ctx->ths_ctx.threshold_hash_table_dst_ipv6, tsh_ptr, sizeof(DetectThresholdEntry));
-        }
-    } else if (tsh_ptr->track == TRACK_SRC) {
-        if (PKT_IS_IPV4(p)) {
-            SCLogDebug("ipv4 src");
-            lookup_tsh = HashListTableLookup(de_ctx->ths_ctx.threshold_hash_table_src, tsh_ptr, sizeof(DetectThresholdEntry));
-        } else if (PKT_IS_IPV6(p))
-            lookup_tsh = HashListTableLookup(de_ctx->ths_ctx.threshold_hash_table_src_ipv6, tsh_ptr, sizeof(DetectThresholdEntry));
-    } else {
-        SCLogDebug("no track, weird");
-    }
+static inline SCMutex *ThresholdHashRowLock(ThresholdCtx *ths_ctx, uint32_t row)
+{
+    return &ths_ctx->locks[row & (THRESHOLD_HASH_LOCKS - 1)];
+}
 
-    SCReturnPtr(lookup_tsh, "DetectThresholdEntry");
+/**
+ * \brief Compare the key parts of two threshold entries
+ *
+ * \retval 1 Match or 0 No Match
+ */
+static inline int ThresholdEntryCompare(DetectThresholdEntry *a, DetectThresholdEntry *b)
+{
+    if (a->sid == b->sid && a->gid == b->gid && a->ipv == b->ipv &&
+            a->track == b->track && CMP_ADDR(&a->addr, &b->addr))
+        return 1;
+
+    return 0;
+}
+
+/**
+ * \brief Check if an entry is no longer needed: its seconds interval
+ *        passed and, for a rate_filter, its new_action timeout did too.
+ */
+static inline int ThresholdEntryTimedOut(DetectThresholdEntry *e, time_t tv_sec)
+{
+    if ((tv_sec - e->tv_sec1) <= e->seconds)
+        return 0;
+    if (e->tv_timeout != 0 && (tv_sec - e->tv_timeout) <= e->timeout)
+        return 0;
+    return 1;
 }
 
 /**
- * \brief Remove timeout threshold hash elements
+ * \brief Search a hash row for an entry, removing the timed out
+ *        entries we pass on the way. Row lock needs to be held.
  *
- * \param de_ctx Dectection Context
+ * \param ths_ctx Threshold context
+ * \param row Row of the entry, from ThresholdHashRow
+ * \param key Entry to search for
+ * \param tv_sec Current time
  *
+ * \retval lookup_tsh The entry or NULL if not found
  */
+static DetectThresholdEntry *ThresholdHashRowSearch(ThresholdCtx *ths_ctx, uint32_t row,
+        DetectThresholdEntry *key, time_t tv_sec)
+{
+    DetectThresholdEntry **pe = &ths_ctx->rows[row];
+    DetectThresholdEntry *lookup_tsh = NULL;
 
-/** \todo In some conditions HashListtableRemove returns at dt->array = NULL
- *  Must need to check it
- **/
+    while (*pe != NULL) {
+        DetectThresholdEntry *e = *pe;
 
-static inline void ThresholdTimeoutRemove(DetectEngineCtx *de_ctx, struct timeval *tv)
-{
-    HashListTableBucket *next = NULL;
-    HashListTableBucket *buck = HashListTableGetListHead(de_ctx->ths_ctx.threshold_hash_table_src);
-    while (buck != NULL) {
-        /* get the next before we free "buck" */
-        next = HashListTableGetListNext(buck);
-
-        DetectThresholdEntry *tsh = HashListTableGetListData(buck);
-        if (tsh == NULL)
-            goto next;
-
-        if ((tv->tv_sec - tsh->tv_sec1) <= tsh->seconds)
-            goto next;
-
-        switch(tsh->ipv) {
-            case 4:
-                if (tsh->track == TRACK_SRC) {
-                    HashListTableRemove(de_ctx->ths_ctx.threshold_hash_table_src,
-                            tsh, sizeof(DetectThresholdEntry));
-                } else if (tsh->track == TRACK_DST) {
-                    HashListTableRemove(de_ctx->ths_ctx.threshold_hash_table_dst,
-                            tsh, sizeof(DetectThresholdEntry));
-                }
-                break;
-            case 6:
-                if (tsh->track == TRACK_SRC) {
-                    HashListTableRemove(de_ctx->ths_ctx.threshold_hash_table_src_ipv6,
-                            tsh, sizeof(DetectThresholdEntry));
-                } else if (tsh->track == TRACK_DST) {
-                    HashListTableRemove(de_ctx->ths_ctx.threshold_hash_table_dst_ipv6,
-                            tsh, sizeof(DetectThresholdEntry));
-                }
-                break;
+        if (lookup_tsh == NULL && ThresholdEntryCompare(e, key)) {
+            /* the caller resets a matching entry itself */
+            lookup_tsh = e;
+        } else if (ThresholdEntryTimedOut(e, tv_sec)) {
+            *pe = e->next;
+            SCFree(e);
+            continue;
         }
-    next:
-        buck = next;
+
+        pe = &e->next;
     }
 
-    return;
+    return lookup_tsh;
 }
 
 /**
- * \brief Add threshold element into hash table
+ * \brief Search for a threshold data into threshold hash table
  *
  * \param de_ctx Dectection Context
- * \param tsh_ptr Threshold element
+ * \param tsh_ptr Threshold element, the ip version is taken from p
  * \param p Packet structure
  *
+ * \retval lookup_tsh Return the threshold element
  */
-void ThresholdHashAdd(DetectEngineCtx *de_ctx, DetectThresholdEntry *tsh_ptr, Packet *p)
+DetectThresholdEntry *ThresholdHashSearch(DetectEngineCtx *de_ctx, DetectThresholdEntry *tsh_ptr, Packet *p)
 {
     SCEnter();
 
-    int ret = 0;
+    DetectThresholdEntry *lookup_tsh = NULL;
 
-    switch(tsh_ptr->ipv) {
-        case 4:
-            if (tsh_ptr->track == TRACK_DST) {
-                ret = HashListTableAdd(de_ctx->ths_ctx.threshold_hash_table_dst,
-                        tsh_ptr, sizeof(DetectThresholdEntry));
-            } else if (tsh_ptr->track == TRACK_SRC) {
-                ret = HashListTableAdd(de_ctx->ths_ctx.threshold_hash_table_src,
-                        tsh_ptr, sizeof(DetectThresholdEntry));
-            }
-            break;
-        case 6:
-            if (tsh_ptr->track == TRACK_DST)
-                ret = HashListTableAdd(de_ctx->ths_ctx.threshold_hash_table_dst_ipv6,
-                        tsh_ptr, sizeof(DetectThresholdEntry));
-            else if (tsh_ptr->track == TRACK_SRC)
-                ret =  HashListTableAdd(de_ctx->ths_ctx.threshold_hash_table_src_ipv6,
-                        tsh_ptr, sizeof(DetectThresholdEntry));
+    if (PKT_IS_IPV4(p))
+        tsh_ptr->ipv = 4;
+    else if (PKT_IS_IPV6(p))
+        tsh_ptr->ipv = 6;
+    else
+        SCReturnPtr(NULL, "DetectThresholdEntry");
+
+    uint32_t row = ThresholdHashRow(tsh_ptr);
+    SCMutex *lock = ThresholdHashRowLock(&de_ctx->ths_ctx, row);
+
+    SCMutexLock(lock);
+    for (lookup_tsh = de_ctx->ths_ctx.rows[row]; lookup_tsh != NULL;
+            lookup_tsh = lookup_tsh->next)
+    {
+        if (ThresholdEntryCompare(lookup_tsh, tsh_ptr))
             break;
     }
+    SCMutexUnlock(lock);
+
+    SCReturnPtr(lookup_tsh, "DetectThresholdEntry");
+}
+
+/**
+ * \brief Remove timed out threshold hash elements
+ *
+ * Instead of sweeping the whole table, each call looks at the next
+ * THRESHOLD_PRUNE_ROWS rows. Rows that are locked by another thread
+ * are skipped, they are pruned by that thread's search anyway.
+ *
+ * \param de_ctx Dectection Context
+ * \param tv Current time
+ */
+static void ThresholdTimeoutRemove(DetectEngineCtx *de_ctx, struct timeval *tv)
+{
+    ThresholdCtx *ths_ctx = &de_ctx->ths_ctx;
+    int i;
 
-    if(ret == -1)   {
-        SCLogError(SC_ERR_THRESHOLD_HASH_ADD,
-                "failed to add element into the hash table");
+    for (i = 0; i < THRESHOLD_PRUNE_ROWS; i++) {
+        uint32_t row = SC_ATOMIC_ADD(ths_ctx->prune_row, 1) % THRESHOLD_HASH_SIZE;
+
+        if (ths_ctx->rows[row] == NULL)
+            continue;
+
+        SCMutex *lock = ThresholdHashRowLock(ths_ctx, row);
+        if (SCMutexTrylock(lock) != 0)
+            continue;
+
+        DetectThresholdEntry **pe = &ths_ctx->rows[row];
+        while (*pe != NULL) {
+            DetectThresholdEntry *e = *pe;
+
+            if (ThresholdEntryTimedOut(e, tv->tv_sec)) {
+                *pe = e->next;
+                SCFree(e);
+                continue;
+            }
+            pe = &e->next;
+        }
+
+        SCMutexUnlock(lock);
     }
+}
 
-    SCReturn;
+/**
+ * \brief Add threshold element into hash table. Row lock needs to be held.
+ *
+ * \param ths_ctx Threshold context
+ * \param row Row of the element, from ThresholdHashRow
+ * \param tsh_ptr Threshold element
+ */
+static inline void ThresholdHashAdd(ThresholdCtx *ths_ctx, uint32_t row, DetectThresholdEntry *tsh_ptr)
+{
+    tsh_ptr->next = ths_ctx->rows[row];
+    ths_ctx->rows[row] = tsh_ptr;
 }
 
 static inline DetectThresholdEntry *DetectThresholdEntryAlloc(DetectThresholdData *td, Packet *p, Signature *s) {
@@ -236,7 +286,9 @@ static inline DetectThresholdEntry *DetectThresholdEntryAlloc(DetectThresholdDat
 
     ste->track = td->track;
     ste->seconds = td->seconds;
+    ste->timeout = td->timeout;
     ste->tv_timeout = 0;
+    ste->next = NULL;
 
     SCReturnPtr(ste, "DetectThresholdEntry");
 }
@@ -260,11 +312,16 @@ int PacketAlertThreshold(DetectEngineCtx *de_ctx, DetectEngineThreadCtx *det_ctx
     int ret = 0;
     DetectThresholdEntry *lookup_tsh = NULL;
     DetectThresholdEntry ste;
+    ThresholdCtx *ths_ctx = &de_ctx->ths_ctx;
+    uint32_t row;
+    SCMutex *lock;
 
     if (td == NULL) {
         SCReturnInt(0);
     }
 
+    memset(&ste, 0, sizeof(ste));
+
     /* setup the Entry we use to search our hash with */
     if (PKT_IS_IPV4(p))
         ste.ipv = 4;
@@ -286,13 +343,20 @@ int PacketAlertThreshold(DetectEngineCtx *de_ctx, DetectEngineThreadCtx *det_ctx
     ste.track = td->track;
     ste.seconds = td->seconds;
 
-    SCMutexLock(&de_ctx->ths_ctx.threshold_table_lock);
+    /* by_rule entries are not in the hash, but use its locks all the same */
+    if (td->track == TRACK_RULE)
+        row = s->num % THRESHOLD_HASH_SIZE;
+    else
+        row = ThresholdHashRow(&ste);
+    lock = ThresholdHashRowLock(ths_ctx, row);
+
+    SCMutexLock(lock);
     switch(td->type)   {
         case TYPE_LIMIT:
         {
             SCLogDebug("limit");
 
-            lookup_tsh = ThresholdHashSearch(de_ctx, &ste, p);
+            lookup_tsh = ThresholdHashRowSearch(ths_ctx, row, &ste, p->ts.tv_sec);
             SCLogDebug("lookup_tsh %p", lookup_tsh);
 
             if (lookup_tsh != NULL)  {
@@ -319,7 +383,7 @@ int PacketAlertThreshold(DetectEngineCtx *de_ctx, DetectEngineThreadCtx *det_ctx
 
                 ret = 1;
 
-                ThresholdHashAdd(de_ctx, e, p);
+                ThresholdHashAdd(ths_ctx, row, e);
             }
             break;
         }
@@ -327,7 +391,7 @@ int PacketAlertThreshold(DetectEngineCtx *de_ctx, DetectEngineThreadCtx *det_ctx
         {
             SCLogDebug("threshold");
 
-            lookup_tsh = ThresholdHashSearch(de_ctx, &ste, p);
+            lookup_tsh = ThresholdHashRowSearch(ths_ctx, row, &ste, p->ts.tv_sec);
             if (lookup_tsh != NULL)  {
                 if ((p->ts.tv_sec - lookup_tsh->tv_sec1) < td->seconds) {
                     lookup_tsh->current_count++;
@@ -353,7 +417,7 @@ int PacketAlertThreshold(DetectEngineCtx *de_ctx, DetectEngineThreadCtx *det_ctx
                     e->tv_sec1 = p->ts.tv_sec;
                     e->ipv = ste.ipv;
 
-                    ThresholdHashAdd(de_ctx, e, p);
+                    ThresholdHashAdd(ths_ctx, row, e);
                 }
             }
             break;
@@ -362,7 +426,7 @@ int PacketAlertThreshold(DetectEngineCtx *de_ctx, DetectEngineThreadCtx *det_ctx
         {
             SCLogDebug("both");
 
-            lookup_tsh = ThresholdHashSearch(de_ctx, &ste, p);
+            lookup_tsh = ThresholdHashRowSearch(ths_ctx, row, &ste, p->ts.tv_sec);
             if (lookup_tsh != NULL) {
                 if ((p->ts.tv_sec - lookup_tsh->tv_sec1) < td->seconds) {
                     lookup_tsh->current_count++;
@@ -383,7 +447,7 @@ int PacketAlertThreshold(DetectEngineCtx *de_ctx, DetectEngineThreadCtx *det_ctx
                 e->tv_sec1 = p->ts.tv_sec;
                 e->ipv = ste.ipv;
 
-                ThresholdHashAdd(de_ctx, e, p);
+                ThresholdHashAdd(ths_ctx, row, e);
 
                 /* for the first match we return 1 to
                  * indicate we should alert */
@@ -398,7 +462,7 @@ int PacketAlertThreshold(DetectEngineCtx *de_ctx, DetectEngineThreadCtx *det_ctx
         {
             SCLogDebug("detection_filter");
 
-            lookup_tsh = ThresholdHashSearch(de_ctx, &ste, p);
+            lookup_tsh = ThresholdHashRowSearch(ths_ctx, row, &ste, p->ts.tv_sec);
             if (lookup_tsh != NULL) {
                 if ((p->ts.tv_sec - lookup_tsh->tv_sec1) < td->seconds) {
                     lookup_tsh->current_count++;
@@ -423,7 +487,7 @@ int PacketAlertThreshold(DetectEngineCtx *de_ctx, DetectEngineThreadCtx *det_ctx
                 e->tv_sec1 = p->ts.tv_sec;
                 e->ipv = ste.ipv;
 
-                ThresholdHashAdd(de_ctx, e, p);
+                ThresholdHashAdd(ths_ctx, row, e);
             }
             break;
         }
@@ -434,9 +498,9 @@ int PacketAlertThreshold(DetectEngineCtx *de_ctx, DetectEngineThreadCtx *det_ctx
 
             /* tracking by src/dst or by rule? */
             if (td->track != TRACK_RULE)
-                lookup_tsh = ThresholdHashSearch(de_ctx, &ste, p);
+                lookup_tsh = ThresholdHashRowSearch(ths_ctx, row, &ste, p->ts.tv_sec);
             else
-                lookup_tsh = (DetectThresholdEntry *)de_ctx->ths_ctx.th_entry[s->num];
+                lookup_tsh = (DetectThresholdEntry *)ths_ctx->th_entry[s->num];
 
             if (lookup_tsh != NULL) {
                 /* Check if we have a timeout enabled, if so,
@@ -515,84 +579,22 @@ int PacketAlertThreshold(DetectEngineCtx *de_ctx, DetectEngineThreadCtx *det_ctx
 
                 /** The track is by src/dst or by rule? */
                 if (td->track != TRACK_RULE)
-                    ThresholdHashAdd(de_ctx, e, p);
+                    ThresholdHashAdd(ths_ctx, row, e);
                 else
-                    de_ctx->ths_ctx.th_entry[s->num] = e;
+                    ths_ctx->th_entry[s->num] = e;
             }
             break;
         }
     }
 
+    SCMutexUnlock(lock);
+
     /* handle timing out entries */
     ThresholdTimeoutRemove(de_ctx, &p->ts);
 
-    SCMutexUnlock(&de_ctx->ths_ctx.threshold_table_lock);
     SCReturnInt(ret);
 }
 
-void ThresholdFreeFunc(void *data)
-{
-    if (data != NULL)
-        SCFree(data);
-    return;
-}
-
-/**
- * \brief Compare elements into the hash table
- *
- * \param data1 First element to compare
- * \param len1 length of first element
- * \param data2 Second element to compare
- * \param len2 length of second element
- *
- * \retval 1 Match or 0 No Match
- */
-char ThresholdCompareFunc(void *data1, uint16_t len1, void *data2,uint16_t len2)
-{
-    SCEnter();
-
-    DetectThresholdEntry *a = (DetectThresholdEntry *)data1;
-    DetectThresholdEntry *b = (DetectThresholdEntry *)data2;
-
-    if ((a->sid == b->sid) && (a->gid == b->gid) &&
-            (CMP_ADDR(&a->addr,&b->addr)))
-    {
-        SCReturnInt(1);
-    }
-
-    SCReturnInt(0);
-}
-
-/**
- * \brief Create the hash for threshold tables
- *
- * \param ht Hash Table
- * \param data Data that will be used to create the hash
- * \param datalen Data length
- *
- * \retval hash the hash
- */
-uint32_t ThresholdHashFunc(HashListTable *ht, void *data, uint16_t datalen)
-{
-    SCEnter();
-
-    DetectThresholdEntry *dt = (DetectThresholdEntry *)data;
-    uint32_t hash = 0;
-
-    if (dt->ipv == 4)
-        hash = (dt->sid + dt->gid + dt->addr.addr_data32[0]);
-    else if (dt->ipv == 6)
-        hash = (dt->sid + dt->gid + dt->addr.addr_data32[0] +
-                dt->addr.addr_data32[1] +
-                dt->addr.addr_data32[2] +
-                dt->addr.addr_data32[3]);
-    else {
-        SCLogDebug("no dt->ipv");
-    }
-
-    SCReturnInt(hash % THRESHOLD_HASH_SIZE);
-}
-
 /**
  * \brief Init threshold context hash tables
  *
@@ -601,45 +603,36 @@ uint32_t ThresholdHashFunc(HashListTable *ht, void *data, uint16_t datalen)
  */
 void ThresholdHashInit(DetectEngineCtx *de_ctx)
 {
-    if (de_ctx->ths_ctx.threshold_hash_table_dst == NULL ||
-        de_ctx->ths_ctx.threshold_hash_table_src == NULL ||
-        de_ctx->ths_ctx.threshold_hash_table_src_ipv6 == NULL ||
-        de_ctx->ths_ctx.threshold_hash_table_dst_ipv6 == NULL) {
-
-        de_ctx->ths_ctx.threshold_hash_table_dst = HashListTableInit(THRESHOLD_HASH_SIZE, ThresholdHashFunc, ThresholdCompareFunc, ThresholdFreeFunc);
-        if(de_ctx->ths_ctx.threshold_hash_table_dst == NULL)    {
-            SCLogError(SC_ERR_MEM_ALLOC,
-                    "Threshold: Failed to initialize ipv4 dst hash table.");
-            exit(EXIT_FAILURE);
-        }
+    ThresholdCtx *ths_ctx = &de_ctx->ths_ctx;
+    int i;
 
-        de_ctx->ths_ctx.threshold_hash_table_src = HashListTableInit(THRESHOLD_HASH_SIZE, ThresholdHashFunc, ThresholdCompareFunc, ThresholdFreeFunc);
-        if(de_ctx->ths_ctx.threshold_hash_table_dst == NULL)    {
-            SCLogError(SC_ERR_MEM_ALLOC,
-                    "Threshold: Failed to initialize ipv4 src hash table.");
-            exit(EXIT_FAILURE);
-        }
+    if (ths_ctx->rows != NULL)
+        return;
 
-        de_ctx->ths_ctx.threshold_hash_table_src_ipv6 = HashListTableInit(THRESHOLD_HASH_SIZE, ThresholdHashFunc, ThresholdCompareFunc, ThresholdFreeFunc);
-        if(de_ctx->ths_ctx.threshold_hash_table_dst == NULL)    {
-            SCLogError(SC_ERR_MEM_ALLOC,
-                    "Threshold: Failed to initialize ipv6 src hash table.");
-            exit(EXIT_FAILURE);
-        }
+    ths_ctx->rows = SCMalloc(THRESHOLD_HASH_SIZE * sizeof(DetectThresholdEntry *));
+    if (ths_ctx->rows == NULL) {
+        SCLogError(SC_ERR_MEM_ALLOC,
+                "Threshold: Failed to initialize hash table.");
+        exit(EXIT_FAILURE);
+    }
+    memset(ths_ctx->rows, 0, THRESHOLD_HASH_SIZE * sizeof(DetectThresholdEntry *));
 
-        de_ctx->ths_ctx.threshold_hash_table_dst_ipv6 = HashListTableInit(THRESHOLD_HASH_SIZE, ThresholdHashFunc, ThresholdCompareFunc, ThresholdFreeFunc);
-        if(de_ctx->ths_ctx.threshold_hash_table_dst == NULL)    {
-            SCLogError(SC_ERR_MEM_ALLOC,
-                    "Threshold: Failed to initialize ipv6 dst hash table.");
-            exit(EXIT_FAILURE);
-        }
+    ths_ctx->locks = SCMalloc(THRESHOLD_HASH_LOCKS * sizeof(SCMutex));
+    if (ths_ctx->locks == NULL) {
+        SCLogError(SC_ERR_MEM_ALLOC,
+                "Threshold: Failed to initialize hash table locks.");
+        exit(EXIT_FAILURE);
+    }
 
-        if (SCMutexInit(&de_ctx->ths_ctx.threshold_table_lock, NULL) != 0) {
+    for (i = 0; i < THRESHOLD_HASH_LOCKS; i++) {
+        if (SCMutexInit(&ths_ctx->locks[i], NULL) != 0) {
             SCLogError(SC_ERR_MEM_ALLOC,
                     "Threshold: Failed to initialize hash table mutex.");
             exit(EXIT_FAILURE);
         }
     }
+
+    SC_ATOMIC_INIT(ths_ctx->prune_row);
 }
 
 /**
@@ -650,11 +643,37 @@ void ThresholdHashInit(DetectEngineCtx *de_ctx)
  */
 void ThresholdContextDestroy(DetectEngineCtx *de_ctx)
 {
-    HashListTableFree(de_ctx->ths_ctx.threshold_hash_table_dst);
-    HashListTableFree(de_ctx->ths_ctx.threshold_hash_table_src);
-    HashListTableFree(de_ctx->ths_ctx.threshold_hash_table_dst_ipv6);
-    HashListTableFree(de_ctx->ths_ctx.threshold_hash_table_src_ipv6);
-    if (de_ctx->ths_ctx.th_entry != NULL)
-        SCFree(de_ctx->ths_ctx.th_entry);
-}
+    ThresholdCtx *ths_ctx = &de_ctx->ths_ctx;
+    uint32_t u;
+
+    if (ths_ctx->rows != NULL) {
+        for (u = 0; u < THRESHOLD_HASH_SIZE; u++) {
+            DetectThresholdEntry *e = ths_ctx->rows[u];
+            while (e != NULL) {
+                DetectThresholdEntry *next = e->next;
+                SCFree(e);
+                e = next;
+            }
+        }
+        SCFree(ths_ctx->rows);
+        ths_ctx->rows = NULL;
+    }
+
+    if (ths_ctx->locks != NULL) {
+        for (u = 0; u < THRESHOLD_HASH_LOCKS; u++) {
+            SCMutexDestroy(&ths_ctx->locks[u]);
+        }
+        SCFree(ths_ctx->locks);
+        ths_ctx->locks = NULL;
+    }
+    SC_ATOMIC_DESTROY(ths_ctx->prune_row);
 
+    if (ths_ctx->th_entry != NULL) {
+        for (u = 0; u < ths_ctx->th_size; u++) {
+            if (ths_ctx->th_entry[u] != NULL)
+                SCFree(ths_ctx->th_entry[u]);
+        }
+        SCFree(ths_ctx->th_entry);
+        ths_ctx->th_entry = NULL;
+    }
+}
@@ -28,15 +28,17 @@
 #include "detect.h"
 
 #define THRESHOLD_HASH_SIZE 0xffff
+/** number of row locks, must be a power of 2 */
+#define THRESHOLD_HASH_LOCKS 1024
+/** rows checked for timed out entries per PacketAlertThreshold call */
+#define THRESHOLD_PRUNE_ROWS 4
 
 int PacketAlertHandle(DetectEngineCtx *de_ctx, DetectEngineThreadCtx *,
                        Signature *sig, Packet *p, uint16_t);
 DetectThresholdData *SigGetThresholdType(Signature *, Packet *);
 int PacketAlertThreshold(DetectEngineCtx *, DetectEngineThreadCtx *,
                           DetectThresholdData *, Packet *, Signature *);
-void ThresholdFreeFunc(void *data);
-char ThresholdCompareFunc(void *data1, uint16_t len1, void *data2,uint16_t len2);
-uint32_t ThresholdHashFunc(HashListTable *ht, void *data, uint16_t datalen);
+DetectThresholdEntry *ThresholdHashSearch(DetectEngineCtx *, DetectThresholdEntry *, Packet *);
 void ThresholdHashInit(DetectEngineCtx *de_ctx);
 void ThresholdContextDestroy(DetectEngineCtx *de_ctx);
 
@@ -29,6 +29,7 @@
 
 #include "detect.h"
 #include "detect-engine.h"
+#include "detect-engine-content-inspection.h"
 #include "detect-parse.h"
 #include "detect-engine-state.h"
 #include "detect-uricontent.h"
@@ -58,325 +59,6 @@
 #include "app-layer-htp.h"
 #include "app-layer-protos.h"
 
-/**
- * \brief Run the actual payload match function for uricontent.
- *
- *        For accounting the last match in relative matching the
- *        det_ctx->payload_offset int is used.
- *
- * \param de_ctx      Detection engine context.
- * \param det_ctx     Detection engine thread context.
- * \param s           Signature to inspect.
- * \param sm          SigMatch to inspect.
- * \param payload     Ptr to the uricontent payload to inspect.
- * \param payload_len Length of the uricontent payload.
- *
- * \retval 0 no match.
- * \retval 1 match.
- */
-static int DoInspectPacketUri(DetectEngineCtx *de_ctx,
-                              DetectEngineThreadCtx *det_ctx,
-                              Signature *s, SigMatch *sm,
-                              uint8_t *payload, uint32_t payload_len)
-{
-    SCEnter();
-
-    det_ctx->inspection_recursion_counter++;
-
-    if (det_ctx->inspection_recursion_counter == de_ctx->inspection_recursion_limit) {
-        det_ctx->discontinue_matching = 1;
-        SCReturnInt(0);
-    }
-
-    if (sm == NULL) {
-        SCReturnInt(0);
-    }
-
-    if (sm->type == DETECT_URICONTENT) {
-        if (payload_len == 0) {
-            SCReturnInt(0);
-        }
-
-        DetectContentData *ud = NULL;
-        ud = (DetectContentData *)sm->ctx;
-        SCLogDebug("inspecting content %"PRIu32" payload_len %"PRIu32, ud->id, payload_len);
-
-        if (ud->flags & DETECT_CONTENT_URI_MPM && !(ud->flags & DETECT_CONTENT_NEGATED))
-            goto match;
-
-        /* rule parsers should take care of this */
-#ifdef DEBUG
-        BUG_ON(ud->depth != 0 && ud->depth <= ud->offset);
-#endif
-
-        /* search for our pattern, checking the matches recursively.
-         * if we match we look for the next SigMatch as well */
-        uint8_t *found = NULL;
-        uint32_t offset = 0;
-        uint32_t depth = payload_len;
-        uint32_t prev_offset = 0; /**< used in recursive searching */
-        uint32_t prev_payload_offset = det_ctx->payload_offset;
-
-        do {
-            if (ud->flags & DETECT_CONTENT_DISTANCE ||
-                ud->flags & DETECT_CONTENT_WITHIN) {
-                SCLogDebug("prev_payload_offset %"PRIu32, prev_payload_offset);
-
-                offset = prev_payload_offset;
-                depth = payload_len;
-
-                if (ud->flags & DETECT_CONTENT_DISTANCE) {
-                    if (ud->distance < 0 && (uint32_t)(abs(ud->distance)) > offset)
-                        offset = 0;
-                    else
-                        offset += ud->distance;
-
-                    SCLogDebug("ud->distance %"PRIi32", offset %"PRIu32", depth %"PRIu32,
-                        ud->distance, offset, depth);
-                }
-
-                if (ud->flags & DETECT_CONTENT_WITHIN) {
-                    if ((int32_t)depth > (int32_t)(prev_payload_offset + ud->within)) {
-                        depth = prev_payload_offset + ud->within;
-                    }
-
-                    SCLogDebug("ud->within %"PRIi32", prev_payload_offset %"PRIu32", depth %"PRIu32,
-                        ud->within, prev_payload_offset, depth);
-                }
-
-                if (ud->depth != 0) {
-                    if ((ud->depth + prev_payload_offset) < depth) {
-                        depth = prev_payload_offset + ud->depth;
-                    }
-
-                    SCLogDebug("ud->depth %"PRIu32", depth %"PRIu32, ud->depth, depth);
-                }
-
-                if (ud->offset > offset) {
-                    offset = ud->offset;
-                    SCLogDebug("setting offset %"PRIu32, offset);
-                }
-            } else { /* implied no relative matches */
-                /* set depth */
-                if (ud->depth != 0) {
-                    depth = ud->depth;
-                }
-
-                /* set offset */
-                offset = ud->offset;
-                prev_payload_offset = 0;
-            }
-
-            /* update offset with prev_offset if we're searching for
-             * matches after the first occurence. */
-            SCLogDebug("offset %"PRIu32", prev_offset %"PRIu32, prev_offset, depth);
-            if (prev_offset != 0)
-                offset = prev_offset;
-
-            SCLogDebug("offset %"PRIu32", depth %"PRIu32, offset, depth);
-
-            if (depth > payload_len)
-                depth = payload_len;
-
-            /* if offset is bigger than depth we can never match on a pattern.
-             * We can however, "match" on a negated pattern. */
-            if (offset > depth || depth == 0) {
-                if (ud->flags & DETECT_CONTENT_NEGATED) {
-                    goto match;
-                } else {
-                    SCReturnInt(0);
-                }
-            }
-
-            uint8_t *spayload = payload + offset;
-            uint32_t spayload_len = depth - offset;
-            uint32_t match_offset = 0;
-            SCLogDebug("spayload_len %"PRIu32, spayload_len);
-#ifdef DEBUG
-            BUG_ON(spayload_len > payload_len);
-#endif
-
-            //PrintRawDataFp(stdout,ud->content,ud->content_len);
-
-            /* If we got no matches from the mpm, avoid searching (just check if negated) */
-            //if (det_ctx->de_have_httpuri == TRUE) {
-                /* do the actual search with boyer moore precooked ctx */
-                if (ud->flags & DETECT_CONTENT_NOCASE)
-                    found = BoyerMooreNocase(ud->content, ud->content_len, spayload, spayload_len, ud->bm_ctx->bmGs, ud->bm_ctx->bmBc);
-                else
-                    found = BoyerMoore(ud->content, ud->content_len, spayload, spayload_len, ud->bm_ctx->bmGs, ud->bm_ctx->bmBc);
-            //} else {
-            //    found = NULL;
-            //}
-
-            /* next we evaluate the result in combination with the
-             * negation flag. */
-            SCLogDebug("found %p ud negated %s", found, ud->flags & DETECT_CONTENT_NEGATED ? "true" : "false");
-
-            if (found == NULL && !(ud->flags & DETECT_CONTENT_NEGATED)) {
-                SCReturnInt(0);
-            } else if (found == NULL && ud->flags & DETECT_CONTENT_NEGATED) {
-                goto match;
-            } else if (found != NULL && ud->flags & DETECT_CONTENT_NEGATED) {
-                SCLogDebug("uricontent %"PRIu32" matched at offset %"PRIu32", but negated so no match", ud->id, match_offset);
-                det_ctx->discontinue_matching = 1;
-                SCReturnInt(0);
-            } else {
-                match_offset = (uint32_t)((found - payload) + ud->content_len);
-                SCLogDebug("uricontent %"PRIu32" matched at offset %"PRIu32"", ud->id, match_offset);
-                det_ctx->payload_offset = match_offset;
-
-                if (!(ud->flags & DETECT_CONTENT_RELATIVE_NEXT)) {
-                    SCLogDebug("no relative match coming up, so this is a match");
-                    goto match;
-                }
-
-                /* bail out if we have no next match. Technically this is an
-                 * error, as the current cd has the DETECT_CONTENT_RELATIVE_NEXT
-                 * flag set. */
-                if (sm->next == NULL) {
-                    SCReturnInt(0);
-                }
-
-                SCLogDebug("uricontent %"PRIu32, ud->id);
-
-                /* see if the next payload keywords match. If not, we will
-                 * search for another occurence of this uricontent and see
-                 * if the others match then until we run out of matches */
-                int r = DoInspectPacketUri(de_ctx,det_ctx,s,sm->next, payload, payload_len);
-                if (r == 1) {
-                    SCReturnInt(1);
-                }
-
-                if (det_ctx->discontinue_matching)
-                    SCReturnInt(0);
-
-                /* set the previous match offset to the start of this match + 1 */
-                prev_offset = (match_offset - (ud->content_len - 1));
-                SCLogDebug("trying to see if there is another match after prev_offset %"PRIu32, prev_offset);
-            }
-
-        } while(1);
-    } else if (sm->type == DETECT_PCRE) {
-        SCLogDebug("inspecting pcre");
-        DetectPcreData *pe = (DetectPcreData *)sm->ctx;
-        uint32_t prev_payload_offset = det_ctx->payload_offset;
-        uint32_t prev_offset = 0;
-        int r = 0;
-
-        det_ctx->pcre_match_start_offset = 0;
-        do {
-            r = DetectPcrePayloadMatch(det_ctx, s, sm, NULL, NULL,
-                                       payload, payload_len);
-            if (r == 0) {
-                det_ctx->discontinue_matching = 1;
-                SCReturnInt(0);
-            }
-
-            if (!(pe->flags & DETECT_PCRE_RELATIVE_NEXT)) {
-                SCLogDebug("no relative match coming up, so this is a match");
-                goto match;
-            }
-
-            /* save it, in case we need to do a pcre match once again */
-            prev_offset = det_ctx->pcre_match_start_offset;
-
-            /* see if the next payload keywords match. If not, we will
-             * search for another occurence of this pcre and see
-             * if the others match, until we run out of matches */
-            r = DoInspectPacketUri(de_ctx, det_ctx, s, sm->next,
-                                   payload, payload_len);
-            if (r == 1) {
-                SCReturnInt(1);
-            }
-
-            if (det_ctx->discontinue_matching)
-                SCReturnInt(0);
-
-            det_ctx->payload_offset = prev_payload_offset;
-            det_ctx->pcre_match_start_offset = prev_offset;
-        } while (1);
-    } else if (sm->type == DETECT_ISDATAAT) {
-        SCLogDebug("inspecting isdataat");
-
-        DetectIsdataatData *id = (DetectIsdataatData *)sm->ctx;
-        if (id->flags & ISDATAAT_RELATIVE) {
-            if (det_ctx->payload_offset + id->dataat > payload_len) {
-                SCLogDebug("det_ctx->payload_offset + id->dataat %"PRIu32" > %"PRIu32, det_ctx->payload_offset + id->dataat, payload_len);
-                if (id->flags & ISDATAAT_NEGATED)
-                    goto match;
-                SCReturnInt(0);
-            } else {
-                SCLogDebug("relative isdataat match");
-                if (id->flags & ISDATAAT_NEGATED)
-                    SCReturnInt(0);
-                goto match;
-            }
-        } else {
-            if (id->dataat < payload_len) {
-                SCLogDebug("absolute isdataat match");
-                if (id->flags & ISDATAAT_NEGATED)
-                    SCReturnInt(0);
-                goto match;
-            } else {
-                SCLogDebug("absolute isdataat mismatch, id->isdataat %"PRIu32", payload_len %"PRIu32"", id->dataat,payload_len);
-                if (id->flags & ISDATAAT_NEGATED)
-                    goto match;
-                SCReturnInt(0);
-            }
-        }
-    } else if (sm->type == DETECT_AL_URILEN) {
-        SCLogDebug("inspecting uri len");
-
-        int r = 0;
-        DetectUrilenData *urilend = (DetectUrilenData *) sm->ctx;
-
-        switch (urilend->mode) {
-            case DETECT_URILEN_EQ:
-                if (payload_len == urilend->urilen1)
-                    r = 1;
-                break;
-            case DETECT_URILEN_LT:
-                if (payload_len < urilend->urilen1)
-                    r = 1;
-                break;
-            case DETECT_URILEN_GT:
-                if (payload_len > urilend->urilen1)
-                    r = 1;
-                break;
-            case DETECT_URILEN_RA:
-                if (payload_len > urilend->urilen1 &&
-                        payload_len < urilend->urilen2)
-                    r = 1;
-                break;
-        }
-
-        if (r == 1) {
-            goto match;
-        }
-
-        SCReturnInt(0);
-    } else {
-        /* we should never get here, but bail out just in case */
-        SCLogDebug("sm->type %u", sm->type);
-#ifdef DEBUG
-        BUG_ON(1);
-#endif
-    }
-    SCReturnInt(0);
-
-match:
-    /* this sigmatch matched, inspect the next one. If it was the last,
-     * the payload portion of the signature matched. */
-    if (sm->next != NULL) {
-        int r = DoInspectPacketUri(de_ctx, det_ctx, s, sm->next, payload,
-                                   payload_len);
-        SCReturnInt(r);
-    } else {
-        SCReturnInt(1);
-    }
-}
-
 /** \brief Do the content inspection & validation for a signature
  *
  *  \param de_ctx Detection engine context
@@ -438,9 +120,10 @@ int DetectEngineInspectPacketUris(DetectEngineCtx *de_ctx,
 
         /* Inspect all the uricontents fetched on each
          * transaction at the app layer */
-        r = DoInspectPacketUri(de_ctx, det_ctx, s, s->sm_lists[DETECT_SM_LIST_UMATCH],
-                (uint8_t *) bstr_ptr(tx->request_uri_normalized),
-                bstr_len(tx->request_uri_normalized));
+        r = DetectEngineContentInspection(de_ctx, det_ctx, s, s->sm_lists[DETECT_SM_LIST_UMATCH],
+                f, NULL, (uint8_t *) bstr_ptr(tx->request_uri_normalized),
+                bstr_len(tx->request_uri_normalized),
+                DETECT_ENGINE_CONTENT_INSPECTION_MODE_URI, NULL);
 
         if (r == 1) {
             break;
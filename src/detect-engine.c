@@ -38,11 +38,13 @@
 #include "detect-engine-hcbd.h"
 #include "detect-engine-iponly.h"
 #include "detect-engine-tag.h"
+#include "detect-engine-content-inspection.h"
 
 #include "detect-engine.h"
 
 #include "detect-content.h"
 #include "detect-uricontent.h"
+#include "detect-pcre.h"
 #include "detect-engine-threshold.h"
 
 //#include "util-mpm.h"
@@ -53,11 +55,38 @@
 #include "util-unittest.h"
 
 #include "util-var-name.h"
+#include "util-classification-config.h"
+#include "util-reference-config.h"
+#include "util-threshold-config.h"
 #include "tm-modules.h"
 
 #define DETECT_ENGINE_DEFAULT_INSPECTION_RECURSION_LIMIT 3000
 
+/** seconds a replaced detection engine is kept after the last detect thread
+ *  released it, see DetectEnginePruneFreeList */
+#define DETECT_ENGINE_FREE_GRACE 5
+
+enum {
+    DETECT_ENGINE_RELOAD_IDLE = 0,
+    DETECT_ENGINE_RELOAD_RUNNING,
+    DETECT_ENGINE_RELOAD_DONE,
+};
+
+/** the engine detect threads run, and the engines replaced by a rule reload
+ *  that still have to be freed. Protected by detect_engine_master_lock, as
+ *  are the engine reference counts and the reload state */
+static DetectEngineCtx *detect_engine_current = NULL;
+static DetectEngineCtx *detect_engine_free_list = NULL;
+static int detect_engine_reload_state = DETECT_ENGINE_RELOAD_IDLE;
+static pthread_t detect_engine_reload_tid;
+static SCMutex detect_engine_master_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** version of the current engine, checked by the detect threads for each
+ *  packet */
+SC_ATOMIC_DECLARE(unsigned int, detect_engine_version);
+
 static uint8_t DetectEngineCtxLoadConf(DetectEngineCtx *);
+static void DetectEngineThreadCtxFree(DetectEngineThreadCtx *);
 
 DetectEngineCtx *DetectEngineCtxInit(void) {
     DetectEngineCtx *de_ctx;
@@ -144,6 +173,7 @@ void DetectEngineCtxFree(DetectEngineCtx *de_ctx) {
      * to be sure look at them again here.
      */
     MpmPatternIdTableFreeHash(de_ctx->mpm_pattern_id_store); /* normally cleaned up in SigGroupBuild */
+    MpmFactoryDeRegisterAllMpmCtxProfiles(de_ctx);
 
     SigGroupHeadHashFree(de_ctx);
     SigGroupHeadMpmHashFree(de_ctx);
@@ -161,6 +191,11 @@ void DetectEngineCtxFree(DetectEngineCtx *de_ctx) {
     if (de_ctx->sig_array)
         SCFree(de_ctx->sig_array);
 
+    if (de_ctx->mpm_http_pid_tags != NULL)
+        SCFree(de_ctx->mpm_http_pid_tags);
+    if (de_ctx->mpm_prepare_list != NULL)
+        SCFree(de_ctx->mpm_prepare_list);
+
     if (de_ctx->class_conf_ht != NULL)
         HashTableFree(de_ctx->class_conf_ht);
     SCFree(de_ctx);
@@ -189,6 +224,8 @@ static uint8_t DetectEngineCtxLoadConf(DetectEngineCtx *de_ctx) {
     const char *max_uniq_toserver_dp_groups_str = NULL;
 
     char *sgh_mpm_context = NULL;
+    char *http_mpm = NULL;
+    char *build_threads = NULL;
 
     ConfNode *de_ctx_custom = ConfGetNode("detect-engine");
     ConfNode *opt = NULL;
@@ -199,6 +236,10 @@ static uint8_t DetectEngineCtxLoadConf(DetectEngineCtx *de_ctx) {
                 de_ctx_profile = opt->head.tqh_first->val;
             } else if (strcmp(opt->val, "sgh-mpm-context") == 0) {
                 sgh_mpm_context = opt->head.tqh_first->val;
+            } else if (strcmp(opt->val, "http-mpm") == 0) {
+                http_mpm = opt->head.tqh_first->val;
+            } else if (strcmp(opt->val, "build-threads") == 0) {
+                build_threads = opt->head.tqh_first->val;
             }
         }
     }
@@ -233,6 +274,8 @@ static uint8_t DetectEngineCtxLoadConf(DetectEngineCtx *de_ctx) {
             de_ctx->sgh_mpm_context = ENGINE_SGH_MPM_FACTORY_CONTEXT_SINGLE;
         } else if (strcmp(sgh_mpm_context, "full") == 0) {
             de_ctx->sgh_mpm_context = ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL;
+        } else if (strcmp(sgh_mpm_context, "shared") == 0) {
+            de_ctx->sgh_mpm_context = ENGINE_SGH_MPM_FACTORY_CONTEXT_SHARED;
         } else {
            SCLogWarning(SC_ERR_INVALID_YAML_CONF_ENTRY, "You have supplied an "
                         "invalid conf value for detect-engine.sgh-mpm-context-"
@@ -240,6 +283,35 @@ static uint8_t DetectEngineCtxLoadConf(DetectEngineCtx *de_ctx) {
         }
     }
 
+    /* detect-engine.http-mpm option parsing */
+    if (http_mpm != NULL) {
+        if (strcmp(http_mpm, "combined") == 0) {
+            if (mpm_table[de_ctx->mpm_matcher].SearchSegments != NULL) {
+                de_ctx->http_mpm_combined = 1;
+            } else {
+                SCLogWarning(SC_ERR_INVALID_YAML_CONF_ENTRY, "mpm-algo \"%s\" "
+                             "doesn't support detect-engine.http-mpm \"combined\", "
+                             "using \"separate\"", mpm_table[de_ctx->mpm_matcher].name);
+            }
+        } else if (strcmp(http_mpm, "separate") != 0) {
+            SCLogWarning(SC_ERR_INVALID_YAML_CONF_ENTRY, "You have supplied an "
+                         "invalid conf value for detect-engine.http-mpm-"
+                         "%s", http_mpm);
+        }
+    }
+
+    /* detect-engine.build-threads option parsing, 0 or auto is a thread
+     * per cpu */
+    if (build_threads != NULL && strcmp(build_threads, "auto") != 0) {
+        if (ByteExtractStringUint16(&de_ctx->build_threads, 10,
+                strlen(build_threads), (const char *)build_threads) <= 0) {
+            SCLogWarning(SC_ERR_INVALID_YAML_CONF_ENTRY, "You have supplied an "
+                         "invalid conf value for detect-engine.build-threads-"
+                         "%s", build_threads);
+            de_ctx->build_threads = 0;
+        }
+    }
+
     opt = NULL;
     switch (profile) {
         case ENGINE_PROFILE_LOW:
@@ -384,17 +456,291 @@ void DetectEngineResetMaxSigId(DetectEngineCtx *de_ctx) {
     de_ctx->signum = 0;
 }
 
-TmEcode DetectEngineThreadCtxInit(ThreadVars *tv, void *initdata, void **data) {
-    DetectEngineCtx *de_ctx = (DetectEngineCtx *)initdata;
+/**
+ * \brief Set up the detection engine as the current one, the one detect
+ *        threads swap to at their next packet. Called for the engine built
+ *        at startup, see DetectEngineReload for the ones that replace it.
+ */
+void DetectEngineSetCurrent(DetectEngineCtx *de_ctx)
+{
+    SCMutexLock(&detect_engine_master_lock);
+    SC_ATOMIC_INIT(detect_engine_version);
+    de_ctx->version = 0;
+    de_ctx->ref_cnt++;
+    detect_engine_current = de_ctx;
+    SCMutexUnlock(&detect_engine_master_lock);
+}
+
+/**
+ * \brief Get a reference to the current detection engine.
+ *
+ * \retval de_ctx the engine, to be released with DetectEngineDeReference,
+ *                or NULL if there is none
+ */
+DetectEngineCtx *DetectEngineGetCurrent(void)
+{
+    SCMutexLock(&detect_engine_master_lock);
+    DetectEngineCtx *de_ctx = detect_engine_current;
+    if (de_ctx != NULL)
+        de_ctx->ref_cnt++;
+    SCMutexUnlock(&detect_engine_master_lock);
+
+    return de_ctx;
+}
+
+/**
+ * \brief Take a reference to a detection engine.
+ */
+static void DetectEngineReference(DetectEngineCtx *de_ctx)
+{
+    SCMutexLock(&detect_engine_master_lock);
+    de_ctx->ref_cnt++;
+    SCMutexUnlock(&detect_engine_master_lock);
+}
+
+/**
+ * \brief Release a reference to a detection engine. Replaced engines are
+ *        freed by DetectEnginePruneFreeList once they have no users left.
+ */
+void DetectEngineDeReference(DetectEngineCtx *de_ctx)
+{
     if (de_ctx == NULL)
-        return TM_ECODE_FAILED;
+        return;
+
+    SCMutexLock(&detect_engine_master_lock);
+    if (de_ctx->ref_cnt > 0) {
+        de_ctx->ref_cnt--;
+        /* the grace period of a replaced engine starts now */
+        if (de_ctx->ref_cnt == 0)
+            gettimeofday(&de_ctx->released_ts, NULL);
+    }
+    SCMutexUnlock(&detect_engine_master_lock);
+}
+
+/**
+ * \brief Clear the current detection engine at shutdown.
+ *
+ * \retval de_ctx the engine that was current, for the caller to free
+ */
+DetectEngineCtx *DetectEngineClearCurrent(void)
+{
+    SCMutexLock(&detect_engine_master_lock);
+    DetectEngineCtx *de_ctx = detect_engine_current;
+    if (de_ctx != NULL && de_ctx->ref_cnt > 0)
+        de_ctx->ref_cnt--;
+    detect_engine_current = NULL;
+    SC_ATOMIC_RESET(detect_engine_version);
+    SCMutexUnlock(&detect_engine_master_lock);
+
+    return de_ctx;
+}
+
+/**
+ * \brief Free a detection engine and everything built for it.
+ */
+static void DetectEngineFree(DetectEngineCtx *de_ctx)
+{
+    SigGroupCleanup(de_ctx);
+    SigCleanSignatures(de_ctx);
+    DetectEngineCtxFree(de_ctx);
+}
+
+/**
+ * \brief Free the replaced detection engines that no detect thread uses
+ *        anymore. Packets inspected with an engine can still be on their
+ *        way to the output modules after the last thread swapped away from
+ *        it, and their alerts point to its signatures, so an engine is
+ *        only freed DETECT_ENGINE_FREE_GRACE seconds after the last thread
+ *        released it.
+ *
+ * \param force free engines without users right away, used at shutdown
+ *              when the packet threads are gone
+ */
+void DetectEnginePruneFreeList(int force)
+{
+    DetectEngineCtx *prune = NULL;
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+
+    SCMutexLock(&detect_engine_master_lock);
+    DetectEngineCtx **pde_ctx = &detect_engine_free_list;
+    while (*pde_ctx != NULL) {
+        DetectEngineCtx *de_ctx = *pde_ctx;
+
+        if (de_ctx->ref_cnt == 0 && (force ||
+            now.tv_sec - de_ctx->released_ts.tv_sec >= DETECT_ENGINE_FREE_GRACE)) {
+            *pde_ctx = de_ctx->replaced_next;
+            de_ctx->replaced_next = prune;
+            prune = de_ctx;
+        } else {
+            pde_ctx = &de_ctx->replaced_next;
+        }
+    }
+    SCMutexUnlock(&detect_engine_master_lock);
+
+    while (prune != NULL) {
+        DetectEngineCtx *next = prune->replaced_next;
+        SCLogInfo("freeing detection engine version %" PRIu32, prune->version);
+        DetectEngineFree(prune);
+        prune = next;
+    }
+}
+
+/**
+ * \brief Make a new detection engine the current one and queue the one it
+ *        replaces for freeing.
+ */
+static void DetectEngineReplaceCurrent(DetectEngineCtx *de_ctx, struct timeval *ts)
+{
+    SCMutexLock(&detect_engine_master_lock);
+    DetectEngineCtx *old = detect_engine_current;
+    de_ctx->version = SC_ATOMIC_GET(detect_engine_version) + 1;
+    de_ctx->ref_cnt++;
+    detect_engine_current = de_ctx;
+    if (old != NULL) {
+        /* no detect thread uses it, so it's released right away */
+        if (--old->ref_cnt == 0)
+            old->released_ts = *ts;
+        old->replaced_next = detect_engine_free_list;
+        detect_engine_free_list = old;
+    }
+    /* the detect threads pick the new engine up from here on */
+    SC_ATOMIC_ADD(detect_engine_version, 1);
+    SCMutexUnlock(&detect_engine_master_lock);
+}
+
+/**
+ * \brief Load the rules into a new detection engine and make it the current
+ *        one. The current engine keeps running meanwhile, each detect
+ *        thread swaps to the new engine at its next packet (see
+ *        DetectEngineThreadCtxUpdate).
+ *
+ * \param sig_file rule file from the command line, or NULL
+ *
+ * \retval 0 on success, -1 if the engine could not be built, the current
+ *         engine is kept then
+ */
+int DetectEngineReload(char *sig_file)
+{
+    struct timeval start, end;
+
+    gettimeofday(&start, NULL);
+
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    if (de_ctx == NULL)
+        return -1;
+
+    SCClassConfLoadClassficationConfigFile(de_ctx);
+    SCRConfLoadReferenceConfigFile(de_ctx);
+
+    if (SigLoadSignatures(de_ctx, sig_file) < 0) {
+        SCLogError(SC_ERR_NO_RULES_LOADED, "loading the rules failed, "
+                   "keeping the current detection engine");
+        DetectEngineFree(de_ctx);
+        return -1;
+    }
+    SCThresholdConfInitContext(de_ctx, NULL);
+
+    gettimeofday(&end, NULL);
+    de_ctx->build_time_ms = (uint64_t)(end.tv_sec - start.tv_sec) * 1000 +
+                            (end.tv_usec - start.tv_usec) / 1000;
+
+    DetectEngineReplaceCurrent(de_ctx, &end);
+
+    SCLogInfo("rule reload done: detection engine version %" PRIu32 " built in "
+              "%" PRIu64 " ms", de_ctx->version, de_ctx->build_time_ms);
+    return 0;
+}
+
+static void *DetectEngineReloadThread(void *arg)
+{
+    DetectEngineReload((char *)arg);
+
+    SCMutexLock(&detect_engine_master_lock);
+    detect_engine_reload_state = DETECT_ENGINE_RELOAD_DONE;
+    SCMutexUnlock(&detect_engine_master_lock);
+    return NULL;
+}
+
+/**
+ * \brief Start a rule reload in the background, unless one is running.
+ *
+ * \param sig_file rule file from the command line, or NULL
+ */
+void DetectEngineReloadStart(char *sig_file)
+{
+    SCMutexLock(&detect_engine_master_lock);
+    if (detect_engine_reload_state == DETECT_ENGINE_RELOAD_RUNNING) {
+        SCMutexUnlock(&detect_engine_master_lock);
+        SCLogInfo("rule reload already in progress");
+        return;
+    }
+    SCMutexUnlock(&detect_engine_master_lock);
+
+    /* reap the previous reload thread */
+    DetectEngineReloadWait();
+
+#ifdef PROFILING
+    SCLogWarning(SC_ERR_INVALID_ARGUMENTS, "rule reload is not supported with "
+                 "rule profiling");
+    return;
+#endif
+#ifdef __SC_CUDA_SUPPORT__
+    if (PatternMatchDefaultMatcher() == MPM_B2G_CUDA) {
+        SCLogWarning(SC_ERR_INVALID_ARGUMENTS, "rule reload is not supported "
+                     "with the b2g_cuda matcher");
+        return;
+    }
+#endif
+
+    SCLogInfo("rule reload started");
+
+    SCMutexLock(&detect_engine_master_lock);
+    detect_engine_reload_state = DETECT_ENGINE_RELOAD_RUNNING;
+    if (pthread_create(&detect_engine_reload_tid, NULL,
+                       DetectEngineReloadThread, sig_file) != 0) {
+        SCLogError(SC_ERR_THREAD_CREATE, "failed to start the rule reload "
+                   "thread: %s", strerror(errno));
+        detect_engine_reload_state = DETECT_ENGINE_RELOAD_IDLE;
+    }
+    SCMutexUnlock(&detect_engine_master_lock);
+}
+
+/**
+ * \brief Wait for a running rule reload to finish.
+ */
+void DetectEngineReloadWait(void)
+{
+    SCMutexLock(&detect_engine_master_lock);
+    int state = detect_engine_reload_state;
+    SCMutexUnlock(&detect_engine_master_lock);
+
+    if (state == DETECT_ENGINE_RELOAD_IDLE)
+        return;
 
+    pthread_join(detect_engine_reload_tid, NULL);
+
+    SCMutexLock(&detect_engine_master_lock);
+    detect_engine_reload_state = DETECT_ENGINE_RELOAD_IDLE;
+    SCMutexUnlock(&detect_engine_master_lock);
+}
+
+/**
+ * \brief Set up a thread ctx for a detection engine, without the thread
+ *        specific parts like the counters.
+ *
+ * \retval det_ctx the thread ctx, holding a reference to de_ctx, or NULL
+ */
+static DetectEngineThreadCtx *DetectEngineThreadCtxAlloc(DetectEngineCtx *de_ctx)
+{
     DetectEngineThreadCtx *det_ctx = SCMalloc(sizeof(DetectEngineThreadCtx));
     if (det_ctx == NULL)
-        return TM_ECODE_FAILED;
+        return NULL;
     memset(det_ctx, 0, sizeof(DetectEngineThreadCtx));
 
     det_ctx->de_ctx = de_ctx;
+    DetectEngineReference(de_ctx);
 
     /** \todo we still depend on the global mpm_ctx here
      *
@@ -408,6 +754,7 @@ TmEcode DetectEngineThreadCtxInit(ThreadVars *tv, void *initdata, void **data) {
 
     //PmqSetup(&det_ctx->pmq, DetectEngineGetMaxSigId(de_ctx), DetectContentMaxId(de_ctx));
     PmqSetup(&det_ctx->pmq, 0, DetectContentMaxId(de_ctx));
+    PmqSetup(&det_ctx->hcbd_pmq, 0, DetectContentMaxId(de_ctx));
     int i;
     for (i = 0; i < 256; i++) {
         PmqSetup(&det_ctx->smsg_pmq[i], 0, DetectContentMaxId(de_ctx));
@@ -416,24 +763,104 @@ TmEcode DetectEngineThreadCtxInit(ThreadVars *tv, void *initdata, void **data) {
     /* IP-ONLY */
     DetectEngineIPOnlyThreadInit(de_ctx,&det_ctx->io_ctx);
 
+    DetectPcreThreadInit(det_ctx);
+
     /* DeState */
     if (de_ctx->sig_array_len > 0) {
         det_ctx->de_state_sig_array_len = de_ctx->sig_array_len;
         det_ctx->de_state_sig_array = SCMalloc(det_ctx->de_state_sig_array_len * sizeof(uint8_t));
         if (det_ctx->de_state_sig_array == NULL) {
-            return TM_ECODE_FAILED;
+            goto error;
         }
 
         det_ctx->match_array_len = de_ctx->sig_array_len;
         det_ctx->match_array = SCMalloc(det_ctx->match_array_len * sizeof(Signature *));
         if (det_ctx->match_array == NULL) {
-            return TM_ECODE_FAILED;
+            goto error;
+        }
+
+        det_ctx->prefilter_cand = SCMalloc(det_ctx->match_array_len * sizeof(uint32_t));
+        if (det_ctx->prefilter_cand == NULL) {
+            goto error;
         }
     }
 
+    return det_ctx;
+
+error:
+    DetectEngineThreadCtxFree(det_ctx);
+    return NULL;
+}
+
+/**
+ * \brief Free a thread ctx and release its detection engine.
+ */
+static void DetectEngineThreadCtxFree(DetectEngineThreadCtx *det_ctx)
+{
+    DetectEngineIPOnlyThreadDeinit(&det_ctx->io_ctx);
+    DetectPcreThreadDeinit(det_ctx);
+    DetectEngineContentInspectionThreadFree(det_ctx);
+
+    /** \todo get rid of this static */
+    PatternMatchThreadDestroy(&det_ctx->mtc, det_ctx->de_ctx->mpm_matcher);
+    PatternMatchThreadDestroy(&det_ctx->mtcu, det_ctx->de_ctx->mpm_matcher);
+
+    PmqFree(&det_ctx->pmq);
+    PmqFree(&det_ctx->hcbd_pmq);
+    int i;
+    for (i = 0; i < 256; i++) {
+        PmqFree(&det_ctx->smsg_pmq[i]);
+    }
+
+    if (det_ctx->de_state_sig_array != NULL)
+        SCFree(det_ctx->de_state_sig_array);
+    if (det_ctx->match_array != NULL)
+        SCFree(det_ctx->match_array);
+    if (det_ctx->prefilter_cand != NULL)
+        SCFree(det_ctx->prefilter_cand);
+
+    DetectEngineDeReference(det_ctx->de_ctx);
+    SCFree(det_ctx);
+}
+
+/**
+ * \brief Set the engine counters of a thread to the engine it uses.
+ */
+static void DetectEngineThreadCtxSetCounters(DetectEngineThreadCtx *det_ctx)
+{
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+
+    SCPerfCounterSetUI64(det_ctx->counter_engine_version, det_ctx->tv->sc_perf_pca,
+                         det_ctx->de_ctx->version);
+    SCPerfCounterSetUI64(det_ctx->counter_engine_build_time, det_ctx->tv->sc_perf_pca,
+                         det_ctx->de_ctx->build_time_ms);
+    SCPerfCounterSetUI64(det_ctx->counter_engine_swap_time, det_ctx->tv->sc_perf_pca,
+                         (uint64_t)now.tv_sec);
+}
+
+TmEcode DetectEngineThreadCtxInit(ThreadVars *tv, void *initdata, void **data) {
+    DetectEngineCtx *de_ctx = (DetectEngineCtx *)initdata;
+    if (de_ctx == NULL)
+        return TM_ECODE_FAILED;
+
+    DetectEngineThreadCtx *det_ctx = DetectEngineThreadCtxAlloc(de_ctx);
+    if (det_ctx == NULL)
+        return TM_ECODE_FAILED;
+
     /** alert counter setup */
     det_ctx->counter_alerts = SCPerfTVRegisterCounter("detect.alert", tv,
                                                       SC_PERF_TYPE_UINT64, "NULL");
+    det_ctx->counter_engine_version = SCPerfTVRegisterCounter("detect.engine_version", tv,
+                                                      SC_PERF_TYPE_UINT64, "NULL");
+    det_ctx->counter_engine_build_time = SCPerfTVRegisterCounter("detect.engine_build_ms", tv,
+                                                      SC_PERF_TYPE_UINT64, "NULL");
+    det_ctx->counter_engine_swap_time = SCPerfTVRegisterCounter("detect.engine_swap_time", tv,
+                                                      SC_PERF_TYPE_UINT64, "NULL");
+    /** content inspections that ran out of budget */
+    det_ctx->counter_inspection_budget = SCPerfTVRegisterCounter("detect.inspection_budget_exceeded", tv,
+                                                      SC_PERF_TYPE_UINT64, "NULL");
     tv->sc_perf_pca = SCPerfGetAllCountersArray(&tv->sc_perf_pctx);
     SCPerfAddToClubbedTMTable((tv->thread_group_name != NULL) ? tv->thread_group_name : tv->name,
                               &tv->sc_perf_pctx);
@@ -441,11 +868,74 @@ TmEcode DetectEngineThreadCtxInit(ThreadVars *tv, void *initdata, void **data) {
     /* this detection engine context belongs to this thread instance */
     det_ctx->tv = tv;
 
+    DetectEngineThreadCtxSetCounters(det_ctx);
+
     *data = (void *)det_ctx;
 
     return TM_ECODE_OK;
 }
 
+/**
+ * \brief Swap a detect thread over to the current detection engine, after
+ *        a rule reload. Called between packets, the thread ctx is rebuilt
+ *        for the new engine in place, so the slot keeps its data pointer,
+ *        and the old engine is released.
+ *
+ * \retval TM_ECODE_OK, also if there was nothing to swap
+ * \retval TM_ECODE_FAILED if the thread ctx couldn't be set up, the thread
+ *         stays on its engine
+ */
+TmEcode DetectEngineThreadCtxUpdate(DetectEngineThreadCtx *det_ctx)
+{
+    DetectEngineCtx *de_ctx = DetectEngineGetCurrent();
+    if (de_ctx == NULL || de_ctx == det_ctx->de_ctx) {
+        DetectEngineDeReference(de_ctx);
+        return TM_ECODE_OK;
+    }
+
+    DetectEngineThreadCtx *new_det_ctx = DetectEngineThreadCtxAlloc(de_ctx);
+    /* the new thread ctx holds its own reference */
+    DetectEngineDeReference(de_ctx);
+    if (new_det_ctx == NULL)
+        return TM_ECODE_FAILED;
+
+    DetectEngineThreadCtx *old_det_ctx = SCMalloc(sizeof(DetectEngineThreadCtx));
+    if (old_det_ctx == NULL) {
+        DetectEngineThreadCtxFree(new_det_ctx);
+        return TM_ECODE_FAILED;
+    }
+    memcpy(old_det_ctx, det_ctx, sizeof(DetectEngineThreadCtx));
+    memcpy(det_ctx, new_det_ctx, sizeof(DetectEngineThreadCtx));
+    SCFree(new_det_ctx);
+
+    /* carry over what belongs to the thread rather than to the engine */
+    det_ctx->tv = old_det_ctx->tv;
+    det_ctx->counter_alerts = old_det_ctx->counter_alerts;
+    det_ctx->counter_engine_version = old_det_ctx->counter_engine_version;
+    det_ctx->counter_engine_build_time = old_det_ctx->counter_engine_build_time;
+    det_ctx->counter_engine_swap_time = old_det_ctx->counter_engine_swap_time;
+    det_ctx->counter_inspection_budget = old_det_ctx->counter_inspection_budget;
+    det_ctx->hcbd_buffers = old_det_ctx->hcbd_buffers;
+    det_ctx->hcbd_buffers_len = old_det_ctx->hcbd_buffers_len;
+    det_ctx->hcbd_buffers_list_len = old_det_ctx->hcbd_buffers_list_len;
+    det_ctx->hhd_buffers = old_det_ctx->hhd_buffers;
+    det_ctx->hhd_buffers_len = old_det_ctx->hhd_buffers_len;
+    det_ctx->hhd_buffers_list_len = old_det_ctx->hhd_buffers_list_len;
+    det_ctx->pkts = old_det_ctx->pkts;
+    det_ctx->uris = old_det_ctx->uris;
+#ifdef __SC_CUDA_SUPPORT__
+    det_ctx->cuda_mpm_rc_disp_outq = old_det_ctx->cuda_mpm_rc_disp_outq;
+#endif
+
+    SCLogDebug("detect thread %s swapped from engine version %" PRIu32 " to %"
+               PRIu32, det_ctx->tv->name, old_det_ctx->de_ctx->version,
+               det_ctx->de_ctx->version);
+    DetectEngineThreadCtxFree(old_det_ctx);
+
+    DetectEngineThreadCtxSetCounters(det_ctx);
+    return TM_ECODE_OK;
+}
+
 TmEcode DetectEngineThreadCtxDeinit(ThreadVars *tv, void *data) {
     DetectEngineThreadCtx *det_ctx = (DetectEngineThreadCtx *)data;
 
@@ -454,22 +944,7 @@ TmEcode DetectEngineThreadCtxDeinit(ThreadVars *tv, void *data) {
         return TM_ECODE_OK;
     }
 
-    DetectEngineIPOnlyThreadDeinit(&det_ctx->io_ctx);
-
-    /** \todo get rid of this static */
-    PatternMatchThreadDestroy(&det_ctx->mtc, det_ctx->de_ctx->mpm_matcher);
-    PatternMatchThreadDestroy(&det_ctx->mtcu, det_ctx->de_ctx->mpm_matcher);
-
-    PmqFree(&det_ctx->pmq);
-    int i;
-    for (i = 0; i < 256; i++) {
-        PmqFree(&det_ctx->smsg_pmq[i]);
-    }
-
-    if (det_ctx->de_state_sig_array != NULL)
-        SCFree(det_ctx->de_state_sig_array);
-
-    SCFree(det_ctx);
+    DetectEngineThreadCtxFree(det_ctx);
 
     return TM_ECODE_OK;
 }
@@ -651,6 +1126,85 @@ static int DetectEngineTest04(void)
     return result;
 }
 
+/**
+ * \test swap a detect thread over to a new detection engine and free the
+ *       replaced one once the thread released it.
+ */
+static int DetectEngineTest05(void)
+{
+    DetectEngineCtx *de_ctx1 = NULL, *de_ctx2 = NULL;
+    DetectEngineThreadCtx *det_ctx = NULL;
+    ThreadVars th_v;
+    struct timeval ts;
+    int result = 0;
+
+    memset(&th_v, 0, sizeof(th_v));
+    memset(&ts, 0, sizeof(ts));
+
+    de_ctx1 = DetectEngineCtxInit();
+    if (de_ctx1 == NULL)
+        goto end;
+    de_ctx1->sig_list = SigInit(de_ctx1, "alert tcp any any -> any any "
+                                "(content:\"one\"; sid:1;)");
+    if (de_ctx1->sig_list == NULL)
+        goto end;
+    SigGroupBuild(de_ctx1);
+
+    de_ctx2 = DetectEngineCtxInit();
+    if (de_ctx2 == NULL)
+        goto end;
+    de_ctx2->sig_list = SigInit(de_ctx2, "alert tcp any any -> any any "
+                                "(content:\"two\"; sid:2;)");
+    if (de_ctx2->sig_list == NULL)
+        goto end;
+    SigGroupBuild(de_ctx2);
+
+    DetectEngineSetCurrent(de_ctx1);
+    DetectEngineThreadCtxInit(&th_v, (void *)de_ctx1, (void *)&det_ctx);
+    if (det_ctx == NULL || de_ctx1->ref_cnt != 2)
+        goto end;
+
+    DetectEngineReplaceCurrent(de_ctx2, &ts);
+    if (de_ctx2->version != 1 ||
+        SC_ATOMIC_GET(detect_engine_version) != de_ctx2->version)
+        goto end;
+
+    /* the thread still holds the old engine */
+    DetectEnginePruneFreeList(1);
+    if (de_ctx1->ref_cnt != 1)
+        goto end;
+
+    if (DetectEngineThreadCtxUpdate(det_ctx) != TM_ECODE_OK)
+        goto end;
+    if (det_ctx->de_ctx != de_ctx2 || det_ctx->tv != &th_v ||
+        de_ctx1->ref_cnt != 0 || de_ctx2->ref_cnt != 2)
+        goto end;
+
+    /* replaced long ago, but the grace period runs from the release */
+    DetectEnginePruneFreeList(0);
+    if (detect_engine_free_list != de_ctx1)
+        goto end;
+
+    /* frees de_ctx1 */
+    DetectEnginePruneFreeList(1);
+    de_ctx1 = NULL;
+
+    result = 1;
+end:
+    if (det_ctx != NULL)
+        DetectEngineThreadCtxDeinit(&th_v, (void *)det_ctx);
+    if (DetectEngineClearCurrent() == de_ctx2 && de_ctx1 != NULL) {
+        /* de_ctx1 is still on the free list */
+        DetectEnginePruneFreeList(1);
+        de_ctx1 = NULL;
+    }
+    if (de_ctx1 != NULL)
+        DetectEngineFree(de_ctx1);
+    if (de_ctx2 != NULL)
+        DetectEngineFree(de_ctx2);
+    return result;
+}
+
 #endif
 
 void DetectEngineRegisterTests()
@@ -661,6 +1215,7 @@ void DetectEngineRegisterTests()
     UtRegisterTest("DetectEngineTest02", DetectEngineTest02, 1);
     UtRegisterTest("DetectEngineTest03", DetectEngineTest03, 1);
     UtRegisterTest("DetectEngineTest04", DetectEngineTest04, 1);
+    UtRegisterTest("DetectEngineTest05", DetectEngineTest05, 1);
 #endif
 
     return;
@@ -26,6 +26,7 @@
 
 #include "detect.h"
 #include "tm-modules.h"
+#include "util-atomic.h"
 
 /* prototypes */
 DetectEngineCtx *DetectEngineCtxInit(void);
@@ -33,6 +34,19 @@ void DetectEngineCtxFree(DetectEngineCtx *);
 
 TmEcode DetectEngineThreadCtxInit(ThreadVars *, void *, void **);
 TmEcode DetectEngineThreadCtxDeinit(ThreadVars *, void *);
+TmEcode DetectEngineThreadCtxUpdate(DetectEngineThreadCtx *);
+
+/* rule reload */
+SC_ATOMIC_EXTERN(unsigned int, detect_engine_version);
+
+void DetectEngineSetCurrent(DetectEngineCtx *);
+DetectEngineCtx *DetectEngineGetCurrent(void);
+void DetectEngineDeReference(DetectEngineCtx *);
+DetectEngineCtx *DetectEngineClearCurrent(void);
+int DetectEngineReload(char *);
+void DetectEngineReloadStart(char *);
+void DetectEngineReloadWait(void);
+void DetectEnginePruneFreeList(int);
 //inline uint32_t DetectEngineGetMaxSigId(DetectEngineCtx *);
 /* faster as a macro than a inline function on my box -- VJ */
 #define DetectEngineGetMaxSigId(de_ctx) ((de_ctx)->signum)
@@ -95,37 +95,22 @@ error:
 }
 
 /**
- * \internal
- * \brief This function is used to match flags on a packet with those passed via flags:
+ * \brief Match a TCP flags value against the flags: options of a sig
  *
- * \param t pointer to thread vars
- * \param det_ctx pointer to the pattern matcher thread
- * \param p pointer to the current packet
- * \param s pointer to the Signature
- * \param m pointer to the sigmatch
+ * \param de pointer to the flags data
+ * \param flags TCP flags of the packet
  *
  * \retval 0 no match
  * \retval 1 match
  */
-static int DetectFlagsMatch (ThreadVars *t, DetectEngineThreadCtx *det_ctx, Packet *p, Signature *s, SigMatch *m)
+int DetectFlagsMatchValue(const DetectFlagsData *de, uint8_t flags)
 {
-    SCEnter();
-
-    uint8_t flags = 0;
-    DetectFlagsData *de = (DetectFlagsData *)m->ctx;
-
-    if(!(PKT_IS_TCP(p))) {
-        SCReturnInt(0);
-    }
-
-    flags = p->tcph->th_flags;
-
     if (!de->flags && flags) {
         if(de->modifier == MODIFIER_NOT) {
-            SCReturnInt(1);
+            return 1;
         }
 
-        SCReturnInt(0);
+        return 0;
     }
 
     flags &= de->ignored_flags;
@@ -133,30 +118,56 @@ static int DetectFlagsMatch (ThreadVars *t, DetectEngineThreadCtx *det_ctx, Pack
     switch (de->modifier) {
         case MODIFIER_ANY:
             if ((flags & de->flags) > 0) {
-                SCReturnInt(1);
+                return 1;
             }
-            SCReturnInt(0);
+            return 0;
 
         case MODIFIER_PLUS:
             if (((flags & de->flags) == de->flags)) {
-                SCReturnInt(1);
+                return 1;
             }
-            SCReturnInt(0);
+            return 0;
 
         case MODIFIER_NOT:
             if ((flags & de->flags) != de->flags) {
-                SCReturnInt(1);
+                return 1;
             }
-            SCReturnInt(0);
+            return 0;
 
         default:
             SCLogDebug("flags %"PRIu8" and de->flags %"PRIu8"",flags,de->flags);
             if (flags == de->flags) {
-                SCReturnInt(1);
+                return 1;
             }
     }
 
-    SCReturnInt(0);
+    return 0;
+}
+
+/**
+ * \internal
+ * \brief This function is used to match flags on a packet with those passed via flags:
+ *
+ * \param t pointer to thread vars
+ * \param det_ctx pointer to the pattern matcher thread
+ * \param p pointer to the current packet
+ * \param s pointer to the Signature
+ * \param m pointer to the sigmatch
+ *
+ * \retval 0 no match
+ * \retval 1 match
+ */
+static int DetectFlagsMatch (ThreadVars *t, DetectEngineThreadCtx *det_ctx, Packet *p, Signature *s, SigMatch *m)
+{
+    SCEnter();
+
+    DetectFlagsData *de = (DetectFlagsData *)m->ctx;
+
+    if(!(PKT_IS_TCP(p))) {
+        SCReturnInt(0);
+    }
+
+    SCReturnInt(DetectFlagsMatchValue(de, p->tcph->th_flags));
 }
 
 /**
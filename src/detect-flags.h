@@ -49,6 +49,7 @@ typedef struct DetectFlagsData_ {
  */
 
 void DetectFlagsRegister (void);
+int DetectFlagsMatchValue(const DetectFlagsData *, uint8_t);
 
 /**
  * This function registers unit tests for Flags
@@ -733,7 +733,6 @@ static int FlowBitsTestSig06(void) {
     DetectEngineThreadCtx *det_ctx = NULL;
     DetectEngineCtx *de_ctx = NULL;
     Flow f;
-    GenericVar flowvar, *gv = NULL;
     int result = 0;
     int idx = 0;
 
@@ -741,11 +740,9 @@ static int FlowBitsTestSig06(void) {
     p->pkt = (uint8_t *)(p + 1);
     memset(&th_v, 0, sizeof(th_v));
     memset(&f, 0, sizeof(Flow));
-    memset(&flowvar, 0, sizeof(GenericVar));
 
     FLOW_INITIALIZE(&f);
     p->flow = &f;
-    p->flow->flowvar = &flowvar;
 
     p->src.family = AF_INET;
     p->dst.family = AF_INET;
@@ -775,13 +772,7 @@ static int FlowBitsTestSig06(void) {
 
     idx = VariableNameGetIdx("myflow",DETECT_FLOWBITS);
 
-    gv = p->flow->flowvar;
-
-    for ( ; gv != NULL; gv = gv->next) {
-        if (gv->type == DETECT_FLOWBITS && gv->idx == idx) {
-                result = 1;
-        }
-    }
+    result = FlowBitIsset(p->flow, idx);
 
     SigGroupCleanup(de_ctx);
     SigCleanSignatures(de_ctx);
@@ -789,7 +780,6 @@ static int FlowBitsTestSig06(void) {
     DetectEngineThreadCtxDeinit(&th_v, (void *)det_ctx);
     DetectEngineCtxFree(de_ctx);
 
-    if(gv) GenericVarFree(gv);
     FLOW_DESTROY(&f);
 
     SCFree(p);
@@ -809,7 +799,6 @@ end:
         DetectEngineCtxFree(de_ctx);
     }
 
-    if(gv) GenericVarFree(gv);
     FLOW_DESTROY(&f);
     SCFree(p);
     return result;
@@ -836,7 +825,6 @@ static int FlowBitsTestSig07(void) {
     DetectEngineThreadCtx *det_ctx = NULL;
     DetectEngineCtx *de_ctx = NULL;
     Flow f;
-    GenericVar flowvar, *gv = NULL;
     int result = 0;
     int idx = 0;
 
@@ -844,11 +832,9 @@ static int FlowBitsTestSig07(void) {
     p->pkt = (uint8_t *)(p + 1);
     memset(&th_v, 0, sizeof(th_v));
     memset(&f, 0, sizeof(Flow));
-    memset(&flowvar, 0, sizeof(GenericVar));
 
     FLOW_INITIALIZE(&f);
     p->flow = &f;
-    p->flow->flowvar = &flowvar;
 
     p->src.family = AF_INET;
     p->dst.family = AF_INET;
@@ -881,13 +867,7 @@ static int FlowBitsTestSig07(void) {
 
     idx = VariableNameGetIdx("myflow",DETECT_FLOWBITS);
 
-    gv = p->flow->flowvar;
-
-    for ( ; gv != NULL; gv = gv->next) {
-        if (gv->type == DETECT_FLOWBITS && gv->idx == idx) {
-                result = 1;
-        }
-    }
+    result = FlowBitIsset(p->flow, idx);
 
     SigGroupCleanup(de_ctx);
     SigCleanSignatures(de_ctx);
@@ -895,7 +875,6 @@ static int FlowBitsTestSig07(void) {
     DetectEngineThreadCtxDeinit(&th_v, (void *)det_ctx);
     DetectEngineCtxFree(de_ctx);
 
-    if(gv) GenericVarFree(gv);
     FLOW_DESTROY(&f);
 
     SCFree(p);
@@ -915,7 +894,6 @@ end:
         DetectEngineCtxFree(de_ctx);
     }
 
-    if(gv) GenericVarFree(gv);
     FLOW_DESTROY(&f);
 
     SCFree(p);
@@ -943,7 +921,6 @@ static int FlowBitsTestSig08(void) {
     DetectEngineThreadCtx *det_ctx = NULL;
     DetectEngineCtx *de_ctx = NULL;
     Flow f;
-    GenericVar flowvar, *gv = NULL;
     int result = 0;
     int idx = 0;
 
@@ -951,11 +928,9 @@ static int FlowBitsTestSig08(void) {
     p->pkt = (uint8_t *)(p + 1);
     memset(&th_v, 0, sizeof(th_v));
     memset(&f, 0, sizeof(Flow));
-    memset(&flowvar, 0, sizeof(GenericVar));
 
     FLOW_INITIALIZE(&f);
     p->flow = &f;
-    p->flow->flowvar = &flowvar;
 
     p->src.family = AF_INET;
     p->dst.family = AF_INET;
@@ -990,13 +965,7 @@ static int FlowBitsTestSig08(void) {
 
     idx = VariableNameGetIdx("myflow",DETECT_FLOWBITS);
 
-    gv = p->flow->flowvar;
-
-    for ( ; gv != NULL; gv = gv->next) {
-        if (gv->type == DETECT_FLOWBITS && gv->idx == idx) {
-                result = 1;
-        }
-    }
+    result = FlowBitIsset(p->flow, idx);
 
     SigGroupCleanup(de_ctx);
     SigCleanSignatures(de_ctx);
@@ -1004,7 +973,6 @@ static int FlowBitsTestSig08(void) {
     DetectEngineThreadCtxDeinit(&th_v, (void *)det_ctx);
     DetectEngineCtxFree(de_ctx);
 
-    if(gv) GenericVarFree(gv);
     FLOW_DESTROY(&f);
 
     SCFree(p);
@@ -1024,7 +992,6 @@ end:
         DetectEngineCtxFree(de_ctx);
     }
 
-    if(gv) GenericVarFree(gv);
     FLOW_DESTROY(&f);
 
     SCFree(p);
@@ -102,9 +102,9 @@ int DetectFlowintMatch(ThreadVars *t, DetectEngineThreadCtx *det_ctx,
                         Packet *p, Signature *s, SigMatch *m)
 {
     DetectFlowintData *sfd =(DetectFlowintData *) m->ctx;
-    FlowVar *fv;
-    FlowVar *fvt;
+    uint32_t value;
     uint32_t targetval;
+    int isset;
 
     /** ATM If we are going to compare the current var with another
      * that doesn't exist, the default value will be zero;
@@ -115,14 +115,9 @@ int DetectFlowintMatch(ThreadVars *t, DetectEngineThreadCtx *det_ctx,
      * return zero(not match).
      */
     if (sfd->targettype == FLOWINT_TARGET_VAR) {
-        sfd->target.tvar.idx = VariableNameGetIdx(sfd->target.tvar.name, DETECT_FLOWINT);
-
-        fvt = FlowVarGet(p->flow, sfd->target.tvar.idx);
-            /* We don't have that variable initialized yet */
-        if (fvt == NULL)
+        /* We don't have that variable initialized yet */
+        if (FlowIntGet(p->flow, sfd->target.tvar.idx, &targetval) == 0)
             targetval = 0;
-        else
-            targetval = fvt->data.fv_int.value;
     } else {
         targetval = sfd->target.value;
     }
@@ -130,68 +125,57 @@ int DetectFlowintMatch(ThreadVars *t, DetectEngineThreadCtx *det_ctx,
     SCLogDebug("Our var %s is at idx: %"PRIu16"", sfd->name, sfd->idx);
 
     if (sfd->modifier == FLOWINT_MODIFIER_SET) {
-        FlowVarAddInt(p->flow, sfd->idx, targetval);
+        FlowIntSet(p->flow, sfd->idx, targetval);
         SCLogDebug("Setting %s = %u", sfd->name, targetval);
         return 1;
     }
 
-    fv = FlowVarGet(p->flow, sfd->idx);
+    if (sfd->modifier == FLOWINT_MODIFIER_ADD) {
+        SCLogDebug("Adding %u to %s", targetval, sfd->name);
+        return FlowIntAdd(p->flow, sfd->idx, targetval);
+    }
+    if (sfd->modifier == FLOWINT_MODIFIER_SUB) {
+        SCLogDebug("Substracting %u to %s", targetval, sfd->name);
+        return FlowIntAdd(p->flow, sfd->idx, -targetval);
+    }
+
+    isset = FlowIntGet(p->flow, sfd->idx, &value);
 
     if (sfd->modifier == FLOWINT_MODIFIER_ISSET) {
-        SCLogDebug(" Isset %s? = %u", sfd->name,(fv) ? 1 : 0);
-        if (fv != NULL)
-            return 1;
-        else
-            return 0;
+        SCLogDebug(" Isset %s? = %u", sfd->name, isset);
+        return isset;
     }
 
     if (sfd->modifier == FLOWINT_MODIFIER_NOTSET) {
-        SCLogDebug(" Not set %s? = %u", sfd->name,(fv) ? 0 : 1);
-        if (fv != NULL)
-            return 0;
-        else
-            return 1;
+        SCLogDebug(" Not set %s? = %u", sfd->name, isset ? 0 : 1);
+        return isset ? 0 : 1;
     }
 
-    if (fv != NULL && fv->datatype == FLOWVAR_TYPE_INT) {
-
-        if (sfd->modifier == FLOWINT_MODIFIER_ADD) {
-            SCLogDebug("Adding %u to %s", targetval, sfd->name);
-            FlowVarAddInt(p->flow, sfd->idx, fv->data.fv_int.value +
-                           targetval);
-            return 1;
-        }
-        if (sfd->modifier == FLOWINT_MODIFIER_SUB) {
-            SCLogDebug("Substracting %u to %s", targetval, sfd->name);
-            FlowVarAddInt(p->flow, sfd->idx, fv->data.fv_int.value -
-                           targetval);
-            return 1;
-        }
-
+    if (isset) {
         switch(sfd->modifier) {
             case FLOWINT_MODIFIER_EQ:
-                SCLogDebug("( %u EQ %u )", fv->data.fv_int.value, targetval);
-                return fv->data.fv_int.value == targetval;
+                SCLogDebug("( %u EQ %u )", value, targetval);
+                return value == targetval;
                 break;
             case FLOWINT_MODIFIER_NE:
-                SCLogDebug("( %u NE %u )", fv->data.fv_int.value, targetval);
-                return fv->data.fv_int.value != targetval;
+                SCLogDebug("( %u NE %u )", value, targetval);
+                return value != targetval;
                 break;
             case FLOWINT_MODIFIER_LT:
-                SCLogDebug("( %u LT %u )", fv->data.fv_int.value, targetval);
-                return fv->data.fv_int.value < targetval;
+                SCLogDebug("( %u LT %u )", value, targetval);
+                return value < targetval;
                 break;
             case FLOWINT_MODIFIER_LE:
-                SCLogDebug("( %u LE %u )", fv->data.fv_int.value, targetval);
-                return fv->data.fv_int.value <= targetval;
+                SCLogDebug("( %u LE %u )", value, targetval);
+                return value <= targetval;
                 break;
             case FLOWINT_MODIFIER_GT:
-                SCLogDebug("( %u GT %u )", fv->data.fv_int.value, targetval);
-                return fv->data.fv_int.value > targetval;
+                SCLogDebug("( %u GT %u )", value, targetval);
+                return value > targetval;
                 break;
             case FLOWINT_MODIFIER_GE:
-                SCLogDebug("( %u GE %u )", fv->data.fv_int.value, targetval);
-                return fv->data.fv_int.value >= targetval;
+                SCLogDebug("( %u GE %u )", value, targetval);
+                return value >= targetval;
                 break;
             default:
                 SCLogDebug("Unknown Modifier!");
@@ -199,9 +183,7 @@ int DetectFlowintMatch(ThreadVars *t, DetectEngineThreadCtx *det_ctx,
         }
     } else {
         SCLogDebug("Var not found!");
-        /* It doesn't exist because it wasn't set
-        * or it is a string var, that we don't compare here
-        */
+        /* It doesn't exist because it wasn't set */
         return 0;
     }
 }
@@ -324,7 +306,15 @@ DetectFlowintData *DetectFlowintParse(DetectEngineCtx *de_ctx,
     sfd->name = SCStrdup(varname);
     if (de_ctx != NULL)
         sfd->idx = VariableNameGetIdx(varname, DETECT_FLOWINT);
-    sfd->target.value =(uint32_t) value_long;
+
+    /* target is a union, the value would overwrite the var idx */
+    if (sfd->targettype == FLOWINT_TARGET_VAR) {
+        if (de_ctx != NULL)
+            sfd->target.tvar.idx = VariableNameGetIdx(sfd->target.tvar.name,
+                                                      DETECT_FLOWINT);
+    } else {
+        sfd->target.value =(uint32_t) value_long;
+    }
 
     sfd->modifier = modifier;
 
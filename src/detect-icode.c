@@ -109,6 +109,24 @@ int DetectICodeMatch (ThreadVars *t, DetectEngineThreadCtx *det_ctx, Packet *p,
         return ret;
     }
 
+    ret = DetectICodeMatchValue(icd, picode);
+
+    return ret;
+}
+
+/**
+ * \brief Match an icmp code against the icode: options of a sig
+ *
+ * \param icd pointer to the icode data
+ * \param picode icmp code of the packet
+ *
+ * \retval 0 no match
+ * \retval 1 match
+ */
+int DetectICodeMatchValue(const DetectICodeData *icd, uint8_t picode)
+{
+    int ret = 0;
+
     switch(icd->mode) {
         case DETECT_ICODE_EQ:
             ret = (picode == icd->code1) ? 1 : 0;
@@ -40,5 +40,6 @@ typedef struct DetectICodeData_ {
 
 /* prototypes */
 void DetectICodeRegister(void);
+int DetectICodeMatchValue(const DetectICodeData *, uint8_t);
 
 #endif /* __DETECT_ICODE_H__ */
@@ -109,6 +109,24 @@ int DetectITypeMatch (ThreadVars *t, DetectEngineThreadCtx *det_ctx, Packet *p,
         return ret;
     }
 
+    ret = DetectITypeMatchValue(itd, pitype);
+
+    return ret;
+}
+
+/**
+ * \brief Match an icmp type against the itype: options of a sig
+ *
+ * \param itd pointer to the itype data
+ * \param pitype icmp type of the packet
+ *
+ * \retval 0 no match
+ * \retval 1 match
+ */
+int DetectITypeMatchValue(const DetectITypeData *itd, uint8_t pitype)
+{
+    int ret = 0;
+
     switch(itd->mode) {
         case DETECT_ITYPE_EQ:
             ret = (pitype == itd->type1) ? 1 : 0;
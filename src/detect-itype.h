@@ -38,5 +38,6 @@ typedef struct DetectITypeData_ {
 
 /* prototypes */
 void DetectITypeRegister(void);
+int DetectITypeMatchValue(const DetectITypeData *, uint8_t);
 
 #endif /* __DETECT_ITYPE_H__ */
@@ -34,6 +34,7 @@
 
 #include "detect-content.h"
 #include "detect-uricontent.h"
+#include "detect-pcre.h"
 #include "detect-reference.h"
 #include "detect-flow.h"
 
@@ -1351,6 +1352,9 @@ Signature *SigInit(DetectEngineCtx *de_ctx, char *sigstr) {
     sig->num = de_ctx->signum;
     de_ctx->signum++;
 
+    /* rules without content get a fast pattern from their pcre */
+    DetectPcreSetupImplicitFastPattern(de_ctx, sig);
+
     /* see if need to set the SIG_FLAG_MPM flag */
     SigMatch *sm;
     for (sm = sig->sm_lists[DETECT_SM_LIST_PMATCH]; sm != NULL; sm = sm->next) {
@@ -1500,6 +1504,9 @@ Signature *SigInitReal(DetectEngineCtx *de_ctx, char *sigstr) {
     sig->num = de_ctx->signum;
     de_ctx->signum++;
 
+    /* rules without content get a fast pattern from their pcre */
+    DetectPcreSetupImplicitFastPattern(de_ctx, sig);
+
     /* see if need to set the SIG_FLAG_MPM flag */
     SigMatch *sm;
     for (sm = sig->sm_lists[DETECT_SM_LIST_PMATCH]; sm != NULL; sm = sm->next) {
@@ -1568,6 +1575,8 @@ Signature *SigInitReal(DetectEngineCtx *de_ctx, char *sigstr) {
         if (SigParse(de_ctx, sig->next, sigstr, SIG_DIREC_SWITCHED) < 0)
             goto error;
 
+        DetectPcreSetupImplicitFastPattern(de_ctx, sig->next);
+
         /* assign an unique id in this de_ctx */
         sig->next->num = de_ctx->signum;
         de_ctx->signum++;
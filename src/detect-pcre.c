@@ -34,6 +34,8 @@
 #include "flow-util.h"
 
 #include "detect-pcre.h"
+#include "detect-content.h"
+#include "detect-fast-pattern.h"
 
 #include "detect-parse.h"
 #include "detect-engine.h"
@@ -46,6 +48,7 @@
 #include "util-unittest.h"
 #include "util-print.h"
 #include "util-pool.h"
+#include "util-clock.h"
 
 #include "conf.h"
 #include "app-layer-htp.h"
@@ -69,8 +72,14 @@
 
 #define MATCH_LIMIT_DEFAULT 1500
 
+/* per thread JIT stack, grows from START up to MAX bytes */
+#define PCRE_JIT_STACK_START (32 * 1024)
+#define PCRE_JIT_STACK_MAX   (512 * 1024)
+
 static int pcre_match_limit = 0;
 static int pcre_match_limit_recursion = 0;
+/** JIT compile the regexes, "pcre.jit" in the config */
+static int pcre_use_jit = 1;
 
 static pcre *parse_regex;
 static pcre_extra *parse_regex_study;
@@ -84,6 +93,70 @@ static int DetectPcreSetup (DetectEngineCtx *, Signature *, char *);
 void DetectPcreFree(void *);
 void DetectPcreRegisterTests(void);
 
+/**
+ * \brief Set up the pcre JIT stack of a detect thread.
+ *
+ * \param det_ctx thread detection ctx
+ */
+void DetectPcreThreadInit(DetectEngineThreadCtx *det_ctx)
+{
+#ifdef PCRE_HAVE_JIT
+    if (pcre_use_jit == 0)
+        return;
+
+    det_ctx->jit_stack = pcre_jit_stack_alloc(PCRE_JIT_STACK_START, PCRE_JIT_STACK_MAX);
+    if (det_ctx->jit_stack == NULL) {
+        SCLogWarning(SC_ERR_MEM_ALLOC, "pcre JIT stack allocation failed, the "
+                     "JIT will run on its default 32k stack");
+    }
+#endif
+}
+
+/**
+ * \brief Free the pcre JIT stack of a detect thread.
+ *
+ * \param det_ctx thread detection ctx
+ */
+void DetectPcreThreadDeinit(DetectEngineThreadCtx *det_ctx)
+{
+#ifdef PCRE_HAVE_JIT
+    if (det_ctx->jit_stack != NULL) {
+        pcre_jit_stack_free(det_ctx->jit_stack);
+        det_ctx->jit_stack = NULL;
+    }
+#endif
+}
+
+/**
+ * \brief Run the regex of a pcre keyword. JIT compiled regexes run on the
+ *        JIT stack of the thread, the others on the interpreter.
+ *
+ * \retval pcre_exec return value
+ */
+static inline int DetectPcreExec(DetectEngineThreadCtx *det_ctx, DetectPcreData *pe,
+                                 const char *str, int len, int *ov, int ov_size)
+{
+#ifdef PCRE_HAVE_JIT
+    if ((pe->flags & DETECT_PCRE_JIT) && det_ctx != NULL && det_ctx->jit_stack != NULL) {
+        return pcre_jit_exec(pe->re, pe->sd, str, len, 0, 0, ov, ov_size,
+                             det_ctx->jit_stack);
+    }
+#endif
+    return pcre_exec(pe->re, pe->sd, str, len, 0, 0, ov, ov_size);
+}
+
+/**
+ * \brief Free the study data of a regex, including its JIT code.
+ */
+static void DetectPcreFreeStudy(pcre_extra *sd)
+{
+#ifdef PCRE_HAVE_JIT
+    pcre_free_study(sd);
+#else
+    pcre_free(sd);
+#endif
+}
+
 void DetectPcreRegister (void) {
     sigmatch_table[DETECT_PCRE].name = "pcre";
     sigmatch_table[DETECT_PCRE].Match = DetectPcreMatch;
@@ -134,6 +207,14 @@ void DetectPcreRegister (void) {
         pcre_match_limit_recursion = val;
     }
 
+    int jit = 1;
+    if (ConfGetBool("pcre.jit", &jit) == 1)
+        pcre_use_jit = jit;
+#ifndef PCRE_HAVE_JIT
+    pcre_use_jit = 0;
+#endif
+    SCLogDebug("pcre JIT %s", pcre_use_jit ? "enabled" : "disabled");
+
     parse_regex = pcre_compile(PARSE_REGEX, opts, &eb, &eo, NULL);
     if(parse_regex == NULL)
     {
@@ -240,7 +321,7 @@ int DetectPcreALDoMatchMethod(DetectEngineThreadCtx *det_ctx, Signature *s,
         //PrintRawUriFp(stdout, (uint8_t*)ptr, len);
 
         /* run the actual pcre detection */
-        ret = pcre_exec(pe->re, pe->sd, (char *)ptr, len, 0, 0, ov, MAX_SUBSTRINGS);
+        ret = DetectPcreExec(det_ctx, pe, (char *)ptr, len, ov, MAX_SUBSTRINGS);
         SCLogDebug("ret %d (negating %s)", ret, (pe->flags & DETECT_PCRE_NEGATE) ? "set" : "not set");
 
         if (ret == PCRE_ERROR_NOMATCH) {
@@ -359,7 +440,7 @@ int DetectPcreALDoMatchCookie(DetectEngineThreadCtx *det_ctx, Signature *s,
         SCLogDebug("we have a cookie header");
 
         /* run the actual pcre detection */
-        ret = pcre_exec(pe->re, pe->sd, (char *)ptr, len, 0, 0, ov, MAX_SUBSTRINGS);
+        ret = DetectPcreExec(det_ctx, pe, (char *)ptr, len, ov, MAX_SUBSTRINGS);
         SCLogDebug("ret %d (negating %s)", ret, (pe->flags & DETECT_PCRE_NEGATE) ? "set" : "not set");
 
         if (ret == PCRE_ERROR_NOMATCH) {
@@ -487,7 +568,7 @@ int DetectPcrePayloadMatch(DetectEngineThreadCtx *det_ctx, Signature *s,
     }
 
     /* run the actual pcre detection */
-    ret = pcre_exec(pe->re, pe->sd, (char *)ptr, len, 0, 0, ov, MAX_SUBSTRINGS);
+    ret = DetectPcreExec(det_ctx, pe, (char *)ptr, len, ov, MAX_SUBSTRINGS);
     SCLogDebug("ret %d (negating %s)", ret, (pe->flags & DETECT_PCRE_NEGATE) ? "set" : "not set");
 
     if (ret == PCRE_ERROR_NOMATCH) {
@@ -581,7 +662,7 @@ int DetectPcrePacketPayloadMatch(DetectEngineThreadCtx *det_ctx, Packet *p, Sign
     }
 
     /* run the actual pcre detection */
-    ret = pcre_exec(pe->re, pe->sd, (char *)ptr, len, 0, 0, ov, MAX_SUBSTRINGS);
+    ret = DetectPcreExec(det_ctx, pe, (char *)ptr, len, ov, MAX_SUBSTRINGS);
     SCLogDebug("ret %d (negating %s)", ret, (pe->flags & DETECT_PCRE_NEGATE) ? "set" : "not set");
 
     if (ret == PCRE_ERROR_NOMATCH) {
@@ -674,7 +755,7 @@ int DetectPcrePayloadDoMatch(DetectEngineThreadCtx *det_ctx, Signature *s,
     }
 
     /* run the actual pcre detection */
-    ret = pcre_exec(pe->re, pe->sd, (char *)ptr, len, 0, 0, ov, MAX_SUBSTRINGS);
+    ret = DetectPcreExec(det_ctx, pe, (char *)ptr, len, ov, MAX_SUBSTRINGS);
     SCLogDebug("ret %d (negating %s)", ret, (pe->flags & DETECT_PCRE_NEGATE) ? "set" : "not set");
 
     if (ret == PCRE_ERROR_NOMATCH) {
@@ -741,6 +822,350 @@ int DetectPcreMatch (ThreadVars *t, DetectEngineThreadCtx *det_ctx, Packet *p,
     SCReturnInt(r);
 }
 
+/** shortest literal worth an implicit fast pattern */
+#define DETECT_PCRE_LITERAL_MIN_LEN 3
+#define DETECT_PCRE_LITERAL_MAX_LEN 255
+
+/**
+ * \brief Keep the literal run in cur if it makes a better fast pattern than
+ *        the one in best: the strongest one, or the longest of equal
+ *        strength. Resets the run.
+ */
+static void DetectPcreLiteralFlush(uint8_t *cur, uint16_t *cur_len,
+                                   uint8_t *best, uint16_t *best_len)
+{
+    if (*cur_len >= DETECT_PCRE_LITERAL_MIN_LEN) {
+        uint32_t cs = PatternStrength(cur, *cur_len);
+        uint32_t bs = (*best_len > 0) ? PatternStrength(best, *best_len) : 0;
+
+        if (cs > bs || (cs == bs && *cur_len > *best_len)) {
+            memcpy(best, cur, *cur_len);
+            *best_len = *cur_len;
+        }
+    }
+    *cur_len = 0;
+}
+
+/**
+ * \brief Parse the quantifier at str, if any.
+ *
+ * \param str  position right after an atom
+ * \param min  set to the minimal number of repetitions of the atom
+ *
+ * \retval number of chars of the quantifier, 0 if there is none
+ */
+static int DetectPcreLiteralQuantifier(const char *str, int *min)
+{
+    const char *p = str;
+
+    switch (*p) {
+        case '?':
+        case '*':
+            *min = 0;
+            p++;
+            break;
+        case '+':
+            *min = 1;
+            p++;
+            break;
+        case '{':
+        {
+            /* {n}, {n,} or {n,m}, anything else is a literal '{' */
+            const char *q = p + 1;
+            int n = 0;
+
+            if (!isdigit((unsigned char)*q))
+                return 0;
+            while (isdigit((unsigned char)*q)) {
+                if (n < 65536)
+                    n = n * 10 + (*q - '0');
+                q++;
+            }
+            if (*q == ',') {
+                q++;
+                while (isdigit((unsigned char)*q))
+                    q++;
+            }
+            if (*q != '}')
+                return 0;
+
+            *min = n;
+            p = q + 1;
+            break;
+        }
+        default:
+            return 0;
+    }
+
+    /* lazy or possessive */
+    if (*p == '?' || *p == '+')
+        p++;
+
+    return (int)(p - str);
+}
+
+/**
+ * \brief Skip a group or character class starting at str.
+ *
+ * \retval number of chars up to and including the closing ')' or ']',
+ *         -1 if it isn't closed
+ */
+static int DetectPcreLiteralSkip(const char *str)
+{
+    const char *p = str;
+    int depth = 0;
+
+    while (*p != '\0') {
+        if (*p == '\\') {
+            if (*(p + 1) == '\0')
+                return -1;
+            p += 2;
+            continue;
+        }
+        if (*p == '[') {
+            /* a ']' right after the '[' or '[^' is part of the class */
+            p++;
+            if (*p == '^')
+                p++;
+            if (*p == ']')
+                p++;
+            while (*p != '\0' && *p != ']') {
+                if (*p == '\\' && *(p + 1) != '\0')
+                    p++;
+                else if (*p == '[' && *(p + 1) == ':') {
+                    /* posix class, [:alpha:] */
+                    const char *e = strstr(p, ":]");
+                    if (e == NULL)
+                        return -1;
+                    p = e + 1;
+                }
+                p++;
+            }
+            if (*p == '\0')
+                return -1;
+            if (depth == 0)
+                return (int)(p - str) + 1;
+            p++;
+            continue;
+        }
+        if (*p == '(')
+            depth++;
+        else if (*p == ')') {
+            depth--;
+            if (depth == 0)
+                return (int)(p - str) + 1;
+        }
+        p++;
+    }
+
+    return -1;
+}
+
+/**
+ * \brief Extract a literal that every match of a regex contains, to be used
+ *        as a fast pattern for rules that have no content.
+ *
+ *        Only the top level of the regex is looked at: runs of literal chars
+ *        between classes, groups, escapes like \d and optional atoms. A regex
+ *        with a top level alternation has no such literal. Anything this
+ *        parser isn't sure about ends the current run or, if it could make
+ *        the literal wrong, gives up.
+ *
+ * \param re      the regex, without delimiters and modifiers
+ * \param opts    pcre compile options of the regex
+ * \param lit     set to the literal, to be freed by the caller
+ * \param lit_len set to the length of the literal
+ * \param nocase  set to 1 if the literal has to be matched caseless
+ *
+ * \retval 1 if a literal was found, 0 if not
+ */
+static int DetectPcreExtractLiteral(const char *re, int opts, uint8_t **lit,
+                                    uint16_t *lit_len, uint8_t *nocase)
+{
+    uint8_t cur[DETECT_PCRE_LITERAL_MAX_LEN];
+    uint8_t best[DETECT_PCRE_LITERAL_MAX_LEN];
+    uint16_t cur_len = 0;
+    uint16_t best_len = 0;
+    const char *p = re;
+    int min = 0;
+    int r;
+
+    /* whitespace and comments are not literal in extended mode */
+    if (opts & PCRE_EXTENDED)
+        return 0;
+
+    *nocase = (opts & PCRE_CASELESS) ? 1 : 0;
+
+    /* look for inline options anywhere: (?i) turns caseless matching on,
+     * which we honour for the whole regex, (?x) is extended mode */
+    const char *o = re;
+    while ((o = strstr(o, "(?")) != NULL) {
+        o += 2;
+        while (isalpha((unsigned char)*o) || *o == '-') {
+            if (*o == 'x')
+                return 0;
+            if (*o == 'i')
+                *nocase = 1;
+            o++;
+        }
+    }
+
+    while (*p != '\0') {
+        int is_lit = 0;
+        uint8_t c = 0;
+
+        switch (*p) {
+            case '|':
+                /* top level alternation, no literal is required */
+                return 0;
+
+            case '(':
+            case '[':
+                r = DetectPcreLiteralSkip(p);
+                if (r < 0)
+                    return 0;
+                DetectPcreLiteralFlush(cur, &cur_len, best, &best_len);
+                p += r;
+                p += DetectPcreLiteralQuantifier(p, &min);
+                continue;
+
+            case ')':
+            case '*':
+            case '+':
+            case '?':
+                /* unbalanced or stray, leave it to pcre */
+                return 0;
+
+            case '.':
+            case '^':
+            case '$':
+                DetectPcreLiteralFlush(cur, &cur_len, best, &best_len);
+                p++;
+                p += DetectPcreLiteralQuantifier(p, &min);
+                continue;
+
+            case '\\':
+            {
+                char e = *(p + 1);
+                if (e == '\0')
+                    return 0;
+                p += 2;
+
+                if (!isalnum((unsigned char)e)) {
+                    is_lit = 1;
+                    c = (uint8_t)e;
+                    break;
+                }
+
+                switch (e) {
+                    case 'n': is_lit = 1; c = 0x0a; break;
+                    case 'r': is_lit = 1; c = 0x0d; break;
+                    case 't': is_lit = 1; c = 0x09; break;
+                    case 'f': is_lit = 1; c = 0x0c; break;
+                    case 'e': is_lit = 1; c = 0x1b; break;
+                    case 'a': is_lit = 1; c = 0x07; break;
+                    case 'x':
+                        if (*p == '{') {
+                            const char *b = strchr(p, '}');
+                            if (b == NULL)
+                                return 0;
+                            p = b + 1;
+                            break;
+                        }
+                        is_lit = 1;
+                        c = 0;
+                        for (r = 0; r < 2 && isxdigit((unsigned char)*p); r++, p++) {
+                            c = (uint8_t)(c << 4);
+                            c |= (uint8_t)(isdigit((unsigned char)*p) ? *p - '0' :
+                                           tolower((unsigned char)*p) - 'a' + 10);
+                        }
+                        break;
+                    case 'Q':
+                    case 'E':
+                        /* quoting, not worth the trouble */
+                        return 0;
+                    case 'c':
+                        /* control char, consumes the next char */
+                        if (*p == '\0')
+                            return 0;
+                        p++;
+                        break;
+                    case 'k':
+                    case 'g':
+                    case 'p':
+                    case 'P':
+                    case 'N':
+                    case 'o':
+                        /* skip the argument: {..}, <..>, '..' or a number */
+                        if (*p == '{' || *p == '<' || *p == '\'') {
+                            char close = (*p == '{') ? '}' : ((*p == '<') ? '>' : '\'');
+                            const char *b = strchr(p + 1, close);
+                            if (b == NULL)
+                                return 0;
+                            p = b + 1;
+                        } else if (e == 'p' || e == 'P') {
+                            /* single letter property, \pL */
+                            if (*p == '\0')
+                                return 0;
+                            p++;
+                        } else {
+                            if (*p == '-')
+                                p++;
+                            while (isdigit((unsigned char)*p))
+                                p++;
+                        }
+                        break;
+                    default:
+                        /* backreference, octal, \d, \w, \b, ... */
+                        if (isdigit((unsigned char)e)) {
+                            while (isdigit((unsigned char)*p))
+                                p++;
+                        }
+                        break;
+                }
+                break;
+            }
+
+            default:
+                is_lit = 1;
+                c = (uint8_t)*p;
+                p++;
+                break;
+        }
+
+        r = DetectPcreLiteralQuantifier(p, &min);
+        p += r;
+
+        if (!is_lit) {
+            DetectPcreLiteralFlush(cur, &cur_len, best, &best_len);
+            continue;
+        }
+
+        /* an optional atom isn't part of any literal, a repeated one only
+         * of the literal it ends */
+        if (r > 0 && min == 0) {
+            DetectPcreLiteralFlush(cur, &cur_len, best, &best_len);
+            continue;
+        }
+        if (cur_len == DETECT_PCRE_LITERAL_MAX_LEN)
+            DetectPcreLiteralFlush(cur, &cur_len, best, &best_len);
+        cur[cur_len++] = c;
+        if (r > 0)
+            DetectPcreLiteralFlush(cur, &cur_len, best, &best_len);
+    }
+    DetectPcreLiteralFlush(cur, &cur_len, best, &best_len);
+
+    if (best_len == 0)
+        return 0;
+
+    *lit = SCMalloc(best_len);
+    if (*lit == NULL)
+        return 0;
+    memcpy(*lit, best, best_len);
+    *lit_len = best_len;
+    return 1;
+}
+
 DetectPcreData *DetectPcreParse (char *regexstr)
 {
     const char *eb;
@@ -874,12 +1299,32 @@ DetectPcreData *DetectPcreParse (char *regexstr)
         goto error;
     }
 
-    pd->sd = pcre_study(pd->re, 0, &eb);
+    int study_opts = 0;
+#ifdef PCRE_HAVE_JIT
+    if (pcre_use_jit)
+        study_opts |= PCRE_STUDY_JIT_COMPILE;
+#endif
+    pd->sd = pcre_study(pd->re, study_opts, &eb);
     if(eb != NULL)  {
         SCLogError(SC_ERR_PCRE_STUDY, "pcre study failed : %s", eb);
         goto error;
     }
 
+#ifdef PCRE_HAVE_JIT
+    if (study_opts & PCRE_STUDY_JIT_COMPILE) {
+        int jit = 0;
+        if (pd->sd != NULL && pcre_fullinfo(pd->re, pd->sd, PCRE_INFO_JIT, &jit) == 0 &&
+            jit == 1)
+        {
+            pd->flags |= DETECT_PCRE_JIT;
+        } else {
+            /* not all regexes can be JIT compiled, this one runs on the
+             * interpreter */
+            SCLogDebug("pcre JIT compile of \"%s\" failed", regexstr);
+        }
+    }
+#endif
+
     if(pd->sd == NULL)
         pd->sd = (pcre_extra *) SCCalloc(1,sizeof(pcre_extra));
 
@@ -912,6 +1357,15 @@ DetectPcreData *DetectPcreParse (char *regexstr)
         goto error;
     }
 
+    /* a negated regex doesn't require anything to be present */
+    if (!(pd->flags & DETECT_PCRE_NEGATE)) {
+        if (DetectPcreExtractLiteral(re, opts, &pd->lit, &pd->lit_len,
+                                     &pd->lit_nocase) == 1) {
+            SCLogDebug("regex \"%s\" requires a %"PRIu16" byte literal", re,
+                       pd->lit_len);
+        }
+    }
+
     if (re != NULL) SCFree(re);
     if (op_ptr != NULL) SCFree(op_ptr);
     return pd;
@@ -920,7 +1374,8 @@ error:
     if (re != NULL) SCFree(re);
     if (op_ptr != NULL) SCFree(op_ptr);
     if (pd != NULL && pd->re != NULL) pcre_free(pd->re);
-    if (pd != NULL && pd->sd != NULL) pcre_free(pd->sd);
+    if (pd != NULL && pd->sd != NULL) DetectPcreFreeStudy(pd->sd);
+    if (pd != NULL && pd->lit != NULL) SCFree(pd->lit);
     if (pd) SCFree(pd);
     return NULL;
 }
@@ -1167,6 +1622,102 @@ error:
     SCReturnInt(-1);
 }
 
+/**
+ * \brief Give a rule without content a fast pattern: the best literal the
+ *        regexes of its payload pcre keywords require, added as a
+ *        fast_pattern:only content. The regexes then only run on the
+ *        payloads the mpm found the literal in.
+ *
+ *        Called once the rule is parsed.
+ *
+ * \param de_ctx detection engine ctx
+ * \param s      the rule
+ *
+ * \retval 1 if a content was added, 0 if not
+ */
+int DetectPcreSetupImplicitFastPattern(DetectEngineCtx *de_ctx, Signature *s)
+{
+    DetectPcreData *best = NULL;
+    DetectContentData *cd = NULL;
+    SigMatch *sm = NULL;
+    int list_id;
+
+    /* the packet and stream mpms only run for these */
+    if (s->alproto != ALPROTO_UNKNOWN)
+        return 0;
+
+    /* rules with a pattern already have their fast pattern */
+    for (list_id = 0; list_id < DETECT_SM_LIST_MAX; list_id++) {
+        if (!FastPatternSupportEnabledForSigMatchList(list_id))
+            continue;
+
+        for (sm = s->sm_lists[list_id]; sm != NULL; sm = sm->next) {
+            if (FastPatternSupportEnabledForSigMatchType(sm->type))
+                return 0;
+        }
+    }
+
+    for (sm = s->sm_lists[DETECT_SM_LIST_PMATCH]; sm != NULL; sm = sm->next) {
+        if (sm->type != DETECT_PCRE)
+            continue;
+
+        DetectPcreData *pd = (DetectPcreData *)sm->ctx;
+        if (pd->lit == NULL)
+            continue;
+
+        if (best == NULL) {
+            best = pd;
+        } else {
+            uint32_t ls = PatternStrength(pd->lit, pd->lit_len);
+            uint32_t bs = PatternStrength(best->lit, best->lit_len);
+            if (ls > bs || (ls == bs && pd->lit_len > best->lit_len))
+                best = pd;
+        }
+    }
+    if (best == NULL)
+        return 0;
+
+    cd = SCMalloc(sizeof(DetectContentData));
+    if (cd == NULL)
+        goto error;
+    memset(cd, 0, sizeof(DetectContentData));
+
+    cd->content = SCMalloc(best->lit_len);
+    if (cd->content == NULL)
+        goto error;
+    memcpy(cd->content, best->lit, best->lit_len);
+    cd->content_len = (uint8_t)best->lit_len;
+    cd->flags = DETECT_CONTENT_FAST_PATTERN | DETECT_CONTENT_FAST_PATTERN_ONLY |
+                DETECT_CONTENT_PCRE_LITERAL;
+
+    cd->bm_ctx = BoyerMooreCtxInit(cd->content, cd->content_len);
+    if (cd->bm_ctx == NULL)
+        goto error;
+    if (best->lit_nocase) {
+        cd->flags |= DETECT_CONTENT_NOCASE;
+        BoyerMooreCtxToNocase(cd->bm_ctx, cd->content, cd->content_len);
+    }
+
+    sm = SigMatchAlloc();
+    if (sm == NULL)
+        goto error;
+    sm->type = DETECT_CONTENT;
+    sm->ctx = (void *)cd;
+    cd->id = DetectPatternGetId(de_ctx->mpm_pattern_id_store, cd, DETECT_CONTENT);
+
+    SigMatchAppendPayload(s, sm);
+    s->flags |= SIG_FLAG_MPM;
+
+    SCLogDebug("sig %"PRIu32" gets a %"PRIu8" byte fast pattern from its pcre",
+               s->id, cd->content_len);
+    return 1;
+
+error:
+    if (cd != NULL)
+        DetectContentFree(cd);
+    return 0;
+}
+
 void DetectPcreFree(void *ptr) {
     DetectPcreData *pd = (DetectPcreData *)ptr;
 
@@ -1175,7 +1726,9 @@ void DetectPcreFree(void *ptr) {
     if (pd->re != NULL)
         pcre_free(pd->re);
     if (pd->sd != NULL)
-        pcre_free(pd->sd);
+        DetectPcreFreeStudy(pd->sd);
+    if (pd->lit != NULL)
+        SCFree(pd->lit);
 
     SCFree(pd);
     return;
@@ -3151,6 +3704,310 @@ end:
     return result;
 }
 
+/**
+ * \test the JIT, on the thread's JIT stack, and the interpreter agree on
+ *       the matches of a regex
+ */
+static int DetectPcreJitTest01(void)
+{
+    DetectEngineThreadCtx det_ctx;
+    DetectPcreData *pd = NULL;
+    pcre_extra interp;
+    pcre_extra *interp_sd = NULL;
+    int ov1[MAX_SUBSTRINGS];
+    int ov2[MAX_SUBSTRINGS];
+    char *inputs[] = { "GET /index.php?id=1234 HTTP/1.1", "GET /index.html HTTP/1.0",
+                       "POST /a.php?ID=99", "" };
+    int result = 0;
+    int i;
+
+    memset(&det_ctx, 0, sizeof(det_ctx));
+    DetectPcreThreadInit(&det_ctx);
+
+    pd = DetectPcreParse("/\\.php\\?id=([0-9]{2,})/i");
+    if (pd == NULL)
+        goto end;
+#ifdef PCRE_HAVE_JIT
+    if (pcre_use_jit && !(pd->flags & DETECT_PCRE_JIT)) {
+        printf("regex not JIT compiled: ");
+        goto end;
+    }
+#endif
+
+    /* the study data holds the JIT code, pcre_exec would run that too. A
+     * copy without the JIT flag makes pcre_exec use the interpreter. */
+    if (pd->sd != NULL) {
+        interp = *pd->sd;
+#ifdef PCRE_EXTRA_EXECUTABLE_JIT
+        interp.flags &= ~PCRE_EXTRA_EXECUTABLE_JIT;
+#endif
+        interp_sd = &interp;
+    }
+
+    for (i = 0; i < (int)(sizeof(inputs) / sizeof(inputs[0])); i++) {
+        int len = (int)strlen(inputs[i]);
+        int r1 = DetectPcreExec(&det_ctx, pd, inputs[i], len, ov1, MAX_SUBSTRINGS);
+        int r2 = pcre_exec(pd->re, interp_sd, inputs[i], len, 0, 0, ov2, MAX_SUBSTRINGS);
+        int expect = (i == 0 || i == 2);
+
+        if ((r1 >= 0) != expect || r1 != r2) {
+            printf("input %d: expected %d, got %d/%d: ", i, expect, r1, r2);
+            goto end;
+        }
+        if (r1 > 0 && memcmp(ov1, ov2, r1 * 2 * sizeof(int)) != 0) {
+            printf("input %d: JIT and interpreter offsets differ: ", i);
+            goto end;
+        }
+    }
+
+    result = 1;
+end:
+    if (pd != NULL)
+        DetectPcreFree(pd);
+    DetectPcreThreadDeinit(&det_ctx);
+    return result;
+}
+
+/**
+ * \test literals extracted from regexes for the implicit fast pattern
+ */
+static int DetectPcreLiteralTest01(void)
+{
+    struct {
+        char *regex;
+        char *lit;      /**< expected literal, NULL for none */
+        uint8_t nocase;
+    } tests[] = {
+        { "/^GET\\s+\\/index\\.php\\?id=/", "/index.php?id=", 0 },
+        { "/foo(bar|baz)quux/i", "quux", 1 },
+        { "/(?i)foo[0-9]+abcd/", "abcd", 1 },
+        { "/ab?cdef/", "cdef", 0 },
+        { "/\\x41\\x42CD*/", "ABC", 0 },
+        { "/xyz{2,}abc/", "xyz", 0 },
+        { "/a|bcdef/", NULL, 0 },
+        { "/\\d+\\w{3}/", NULL, 0 },
+        { "/(?x) abc def/", NULL, 0 },
+        { "/abc def/x", NULL, 0 },
+        { "/\\k<name>uvw/", "uvw", 0 },
+        { "/[a-z]]]]/", "]]]", 0 },
+    };
+    int result = 0;
+    size_t i;
+
+    for (i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+        DetectPcreData *pd = DetectPcreParse(tests[i].regex);
+        if (pd == NULL) {
+            printf("regex %s failed to parse: ", tests[i].regex);
+            goto end;
+        }
+
+        if (tests[i].lit == NULL) {
+            if (pd->lit != NULL) {
+                printf("regex %s: expected no literal, got %"PRIu16" bytes: ",
+                       tests[i].regex, pd->lit_len);
+                DetectPcreFree(pd);
+                goto end;
+            }
+        } else if (pd->lit == NULL || pd->lit_len != strlen(tests[i].lit) ||
+                   memcmp(pd->lit, tests[i].lit, pd->lit_len) != 0 ||
+                   pd->lit_nocase != tests[i].nocase) {
+            printf("regex %s: expected literal \"%s\": ", tests[i].regex,
+                   tests[i].lit);
+            DetectPcreFree(pd);
+            goto end;
+        }
+        DetectPcreFree(pd);
+    }
+
+    result = 1;
+end:
+    return result;
+}
+
+/**
+ * \test a rule with only a pcre gets its literal as fast pattern and still
+ *       alerts the same
+ */
+static int DetectPcreLiteralTest02(void)
+{
+    uint8_t *buf = (uint8_t *)"GET /index.php?id=1234 HTTP/1.1\r\n\r\n";
+    uint8_t *buf2 = (uint8_t *)"GET /index.php?id=abcd HTTP/1.1\r\n\r\n";
+    uint16_t buflen = strlen((char *)buf);
+    uint16_t buflen2 = strlen((char *)buf2);
+    Packet *p1 = NULL, *p2 = NULL;
+    ThreadVars th_v;
+    DetectEngineThreadCtx *det_ctx = NULL;
+    int result = 0;
+
+    memset(&th_v, 0, sizeof(th_v));
+
+    p1 = UTHBuildPacket(buf, buflen, IPPROTO_TCP);
+    p2 = UTHBuildPacket(buf2, buflen2, IPPROTO_TCP);
+    if (p1 == NULL || p2 == NULL)
+        goto end;
+
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    if (de_ctx == NULL)
+        goto end;
+    de_ctx->flags |= DE_QUIET;
+
+    de_ctx->sig_list = SigInit(de_ctx, "alert tcp any any -> any any "
+                               "(pcre:\"/\\/index\\.php\\?id=[0-9]+/\"; sid:1;)");
+    if (de_ctx->sig_list == NULL)
+        goto cleanup;
+
+    Signature *s = de_ctx->sig_list;
+    SigMatch *sm = s->sm_lists_tail[DETECT_SM_LIST_PMATCH];
+    if (sm == NULL || sm->type != DETECT_CONTENT || !(s->flags & SIG_FLAG_MPM)) {
+        printf("no implicit fast pattern: ");
+        goto cleanup;
+    }
+    DetectContentData *cd = (DetectContentData *)sm->ctx;
+    if (!(cd->flags & DETECT_CONTENT_PCRE_LITERAL) ||
+        !(cd->flags & DETECT_CONTENT_FAST_PATTERN_ONLY) ||
+        cd->content_len != 14 || memcmp(cd->content, "/index.php?id=", 14) != 0) {
+        printf("unexpected implicit fast pattern: ");
+        goto cleanup;
+    }
+
+    SigGroupBuild(de_ctx);
+    DetectEngineThreadCtxInit(&th_v, (void *)de_ctx, (void *)&det_ctx);
+
+    SigMatchSignatures(&th_v, de_ctx, det_ctx, p1);
+    SigMatchSignatures(&th_v, de_ctx, det_ctx, p2);
+    if (!PacketAlertCheck(p1, 1) || PacketAlertCheck(p2, 1)) {
+        printf("sid 1 should only alert on p1: ");
+        goto cleanup;
+    }
+
+    result = 1;
+cleanup:
+    if (det_ctx != NULL)
+        DetectEngineThreadCtxDeinit(&th_v, (void *)det_ctx);
+    SigGroupCleanup(de_ctx);
+    SigCleanSignatures(de_ctx);
+    DetectEngineCtxFree(de_ctx);
+end:
+    if (p1 != NULL)
+        UTHFreePacket(p1);
+    if (p2 != NULL)
+        UTHFreePacket(p2);
+    return result;
+}
+
+/** Uncomment this if you want stats
+ *  #define ENABLE_PCRE_JIT_STATS 1
+ */
+
+#ifdef ENABLE_PCRE_JIT_STATS
+
+/* Number of times to run each regex (for stats) */
+#define PCRE_JIT_STATS_TIMES 100000
+
+/* Regexes as typically found in rules */
+static char *pcre_jit_stats_regexes[] = {
+    "/^GET\\s+\\/[^\\s]*\\.php\\?id=\\d+/i",
+    "/User-Agent\\x3a[^\\r\\n]*(curl|wget)/i",
+    "/(\\d{1,3}\\.){3}\\d{1,3}/",
+    "/Content-Length\\x3a\\s*\\d{5,}/i",
+    "/[a-z0-9]{32}\\.exe/",
+    "/Cookie\\x3a\\s*[^\\r\\n]*session=[0-9a-f]{16,}/i",
+};
+#define PCRE_JIT_STATS_REGEXES \
+    (int)(sizeof(pcre_jit_stats_regexes) / sizeof(pcre_jit_stats_regexes[0]))
+
+/**
+ * \test Stats: a set of typical rule regexes over an http request, on the
+ *       JIT and on the interpreter.
+ */
+static int DetectPcreJitStatsTest01(void)
+{
+    DetectEngineThreadCtx det_ctx;
+    DetectPcreData *pds[PCRE_JIT_STATS_REGEXES];
+    pcre_extra interp[PCRE_JIT_STATS_REGEXES];
+    pcre_extra *interp_sd[PCRE_JIT_STATS_REGEXES];
+    char *buf = "GET /download/get.php?file=update HTTP/1.1\r\n"
+                "Host: www.example.org\r\n"
+                "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:24.0) "
+                "Gecko/20100101 Firefox/24.0\r\n"
+                "Accept: text/html,application/xhtml+xml,application/xml;q=0.9\r\n"
+                "Accept-Language: en-US,en;q=0.5\r\n"
+                "Referer: http://www.example.org/index.html\r\n"
+                "Cookie: session=0123456789abcdef0123; lang=en\r\n"
+                "X-Forwarded-For: 192.168.1.10\r\n"
+                "Content-Length: 1234\r\n"
+                "\r\n";
+    int len = (int)strlen(buf);
+    int ov[MAX_SUBSTRINGS];
+    uint32_t cnt_jit = 0, cnt_interp = 0;
+    int result = 0;
+    int i, j;
+
+    memset(&det_ctx, 0, sizeof(det_ctx));
+    memset(pds, 0, sizeof(pds));
+    DetectPcreThreadInit(&det_ctx);
+
+    for (i = 0; i < PCRE_JIT_STATS_REGEXES; i++) {
+        pds[i] = DetectPcreParse(pcre_jit_stats_regexes[i]);
+        if (pds[i] == NULL)
+            goto end;
+        if (!(pds[i]->flags & DETECT_PCRE_JIT))
+            printf("regex %d not JIT compiled, ", i);
+
+        /* a copy of the study data without the JIT flag, so pcre_exec uses
+         * the interpreter */
+        interp_sd[i] = NULL;
+        if (pds[i]->sd != NULL) {
+            interp[i] = *pds[i]->sd;
+#ifdef PCRE_EXTRA_EXECUTABLE_JIT
+            interp[i].flags &= ~PCRE_EXTRA_EXECUTABLE_JIT;
+#endif
+            interp_sd[i] = &interp[i];
+        }
+    }
+
+    printf("pcre JIT: ");
+    CLOCK_INIT;
+    CLOCK_START;
+    for (j = 0; j < PCRE_JIT_STATS_TIMES; j++) {
+        cnt_jit = 0;
+        for (i = 0; i < PCRE_JIT_STATS_REGEXES; i++) {
+            if (DetectPcreExec(&det_ctx, pds[i], buf, len, ov, MAX_SUBSTRINGS) >= 0)
+                cnt_jit++;
+        }
+    }
+    CLOCK_END;
+    CLOCK_PRINT_SEC;
+
+    printf("pcre interpreter: ");
+    CLOCK_START;
+    for (j = 0; j < PCRE_JIT_STATS_TIMES; j++) {
+        cnt_interp = 0;
+        for (i = 0; i < PCRE_JIT_STATS_REGEXES; i++) {
+            if (pcre_exec(pds[i]->re, interp_sd[i], buf, len, 0, 0, ov, MAX_SUBSTRINGS) >= 0)
+                cnt_interp++;
+        }
+    }
+    CLOCK_END;
+    CLOCK_PRINT_SEC;
+
+    if (cnt_jit != cnt_interp) {
+        printf("JIT matched %"PRIu32", interpreter %"PRIu32": ", cnt_jit, cnt_interp);
+        goto end;
+    }
+
+    result = 1;
+end:
+    for (i = 0; i < PCRE_JIT_STATS_REGEXES; i++) {
+        if (pds[i] != NULL)
+            DetectPcreFree(pds[i]);
+    }
+    DetectPcreThreadDeinit(&det_ctx);
+    return result;
+}
+
+#endif /* ENABLE_PCRE_JIT_STATS */
+
 #endif /* UNITTESTS */
 
 /**
@@ -3192,6 +4049,12 @@ void DetectPcreRegisterTests(void) {
     UtRegisterTest("DetectPcreTxBodyChunksTest01", DetectPcreTxBodyChunksTest01, 1);
     UtRegisterTest("DetectPcreTxBodyChunksTest02 -- modifier P, body chunks per tx", DetectPcreTxBodyChunksTest02, 1);
     UtRegisterTest("DetectPcreTxBodyChunksTest03 -- modifier P, body chunks per tx", DetectPcreTxBodyChunksTest03, 1);
+    UtRegisterTest("DetectPcreJitTest01", DetectPcreJitTest01, 1);
+    UtRegisterTest("DetectPcreLiteralTest01", DetectPcreLiteralTest01, 1);
+    UtRegisterTest("DetectPcreLiteralTest02", DetectPcreLiteralTest02, 1);
+#ifdef ENABLE_PCRE_JIT_STATS
+    UtRegisterTest("DetectPcreJitStatsTest01", DetectPcreJitStatsTest01, 1);
+#endif
 #endif /* UNITTESTS */
 }
 
@@ -42,6 +42,7 @@
 #define DETECT_PCRE_METHOD          0x0800
 
 #define DETECT_PCRE_NEGATE          0x1000
+#define DETECT_PCRE_JIT             0x2000 /**< regex is JIT compiled */
 
 typedef struct DetectPcreData_ {
     /* pcre options */
@@ -51,6 +52,11 @@ typedef struct DetectPcreData_ {
     uint16_t flags;
     uint16_t capidx;
     char *capname;
+    /* literal every match of the regex contains, NULL if there is none. Used
+     * as fast pattern for rules without content */
+    uint8_t *lit;
+    uint16_t lit_len;
+    uint8_t lit_nocase;
 } DetectPcreData;
 
 /* prototypes */
@@ -60,6 +66,9 @@ int DetectPcrePacketPayloadMatch(DetectEngineThreadCtx *, Packet *, Signature *,
 int DetectPcrePayloadDoMatch(DetectEngineThreadCtx *, Signature *, SigMatch *,
                              Packet *, uint8_t *, uint16_t);
 void DetectPcreRegister (void);
+void DetectPcreThreadInit(DetectEngineThreadCtx *);
+void DetectPcreThreadDeinit(DetectEngineThreadCtx *);
+int DetectPcreSetupImplicitFastPattern(DetectEngineCtx *, Signature *);
 
 #endif /* __DETECT_PCRE_H__ */
 
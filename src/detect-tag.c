@@ -49,8 +49,8 @@
 #include "util-debug.h"
 #include "threads.h"
 
-extern SCSpinlock num_tags_sc_lock__;
-extern unsigned int num_tags_sc_atomic__;
+SC_ATOMIC_EXTERN(unsigned int, num_tags);
+SC_ATOMIC_EXTERN(unsigned int, num_host_tags);
 
 extern DetectTagHostCtx *tag_ctx;
 
@@ -110,7 +110,8 @@ error:
  * \param tde pointer to the new DetectTagDataEntry
  *
  * \retval 0 if the tde was added succesfuly
- * \retval 1 if an entry of this sid/gid already exist and was updated
+ * \retval 1 if an entry of this sid/gid already exist and was updated, or
+ *           if the session has DETECT_TAG_MAX_TAGS tags already
  */
 int DetectTagFlowAdd(Packet *p, DetectTagDataEntry *tde) {
     uint8_t updated = 0;
@@ -151,8 +152,10 @@ int DetectTagFlowAdd(Packet *p, DetectTagDataEntry *tde) {
     if (updated == 0 && num_tags < DETECT_TAG_MAX_TAGS) {
         tde->next = p->flow->tag_list->header_entry;
         p->flow->tag_list->header_entry = tde;
-    } else if (num_tags == DETECT_TAG_MAX_TAGS) {
+        SC_ATOMIC_ADD(num_tags, 1);
+    } else if (updated == 0) {
         SCLogDebug("Max tags for sessions reached (%"PRIu16")", num_tags);
+        updated = 1;
     }
 
     SCMutexUnlock(&p->flow->m);
@@ -194,8 +197,6 @@ int DetectTagMatch (ThreadVars *t, DetectEngineThreadCtx *det_ctx, Packet *p, Si
                 SCLogDebug("Tagging Host with sid %"PRIu32":%"PRIu32"", s->id, s->gid);
                 if (TagHashAddTag(tag_ctx, tde, p) == 1)
                     SCFree(tde);
-                else
-                    SC_ATOMIC_ADD(num_tags, 1);
 
             } else {
                 SCLogError(SC_ERR_INVALID_VALUE, "Error on direction of a tag keyword (not src nor dst)");
@@ -206,8 +207,6 @@ int DetectTagMatch (ThreadVars *t, DetectEngineThreadCtx *det_ctx, Packet *p, Si
                 /* If it already exists it will be updated */
                 if (DetectTagFlowAdd(p, tde) == 1)
                     SCFree(tde);
-                else
-                    SC_ATOMIC_ADD(num_tags, 1);
             } else {
                 SCLogDebug("No flow to append the session tag");
             }
@@ -382,6 +381,16 @@ error:
 void DetectTagDataListFree(void *ptr) {
     if (ptr != NULL) {
         DetectTagDataEntryList *list = (DetectTagDataEntryList *)ptr;
+        DetectTagDataEntry *tde = NULL;
+        unsigned int cnt = 0;
+
+        for (tde = list->header_entry; tde != NULL; tde = tde->next)
+            cnt++;
+        /* keep the "any tags" counter in sync for flows that
+         * time out with tags installed */
+        if (cnt > 0)
+            SC_ATOMIC_SUB(num_tags, cnt);
+
         DetectTagDataEntryFree(list->header_entry);
         SCFree(ptr);
     }
@@ -885,6 +894,95 @@ end:
     return result;
 }
 
+/**
+ * \test DetectTagTestHost01 checks that host tags are removed from the
+ *       host table as they expire and that the "any tags" counters
+ *       drop back to zero, so packets take the fast path again.
+ */
+int DetectTagTestHost01 (void) {
+    int result = 0;
+    DetectTagData td;
+    DetectTagDataEntry *tde = NULL;
+    Packet *p[2] = { NULL, NULL };
+    int i, n;
+
+    TagRestartCtx();
+
+    memset(&td, 0, sizeof(td));
+    td.type = DETECT_TAG_TYPE_HOST;
+    td.count = 2;
+    td.metric = DETECT_TAG_METRIC_PACKET;
+    td.direction = DETECT_TAG_DIR_SRC;
+
+    p[0] = UTHBuildPacketReal((uint8_t *)"A", 1, IPPROTO_TCP,
+                              "192.168.1.5", "192.168.1.1", 41424, 80);
+    p[1] = UTHBuildPacketReal((uint8_t *)"A", 1, IPPROTO_TCP,
+                              "10.0.0.1", "10.0.0.2", 41424, 80);
+    if (p[0] == NULL || p[1] == NULL)
+        goto end;
+
+    for (i = 0; i < 3; i++) {
+        tde = SCMalloc(sizeof(DetectTagDataEntry));
+        if (tde == NULL)
+            goto end;
+        memset(tde, 0, sizeof(DetectTagDataEntry));
+        tde->sid = 1;
+        tde->gid = 1;
+        tde->td = &td;
+        TimeGet(&tde->first_ts);
+        tde->last_ts.tv_sec = tde->first_ts.tv_sec;
+
+        /* the second add for the first host only updates the tag */
+        if (TagHashAddTag(tag_ctx, tde, p[i == 2]) != (i == 1)) {
+            printf("add %d: ", i);
+            SCFree(tde);
+            goto end;
+        }
+        if (i == 1)
+            SCFree(tde);
+    }
+
+    if (SC_ATOMIC_GET(num_tags) != 2 || SC_ATOMIC_GET(num_host_tags) != 2) {
+        printf("tags %u/%u, expected 2/2: ", SC_ATOMIC_GET(num_tags),
+                SC_ATOMIC_GET(num_host_tags));
+        goto end;
+    }
+
+    for (n = 0; n < 2; n++) {
+        for (i = 0; i < 3; i++) {
+            p[n]->flags &= ~PKT_HAS_TAG;
+            TagHandlePacket(NULL, NULL, p[n]);
+
+            /* the first packet is the alert, the third expires the tag */
+            if (!!(p[n]->flags & PKT_HAS_TAG) != (i == 1)) {
+                printf("host %d packet %d tag flag: ", n, i);
+                goto end;
+            }
+        }
+
+        if (SC_ATOMIC_GET(num_host_tags) != (unsigned int)(1 - n)) {
+            printf("host %d: %u host tags left: ", n, SC_ATOMIC_GET(num_host_tags));
+            goto end;
+        }
+    }
+
+    if (SC_ATOMIC_GET(num_tags) != 0)
+        goto end;
+
+    for (i = 0; i < TAG_HASH_SIZE; i++) {
+        if (tag_ctx->rows[i] != NULL) {
+            printf("row %d not empty: ", i);
+            goto end;
+        }
+    }
+
+    result = 1;
+end:
+    UTHFreePackets(p, 2);
+    TagRestartCtx();
+    return result;
+}
+
 #endif /* UNITTESTS */
 
 /**
@@ -908,6 +1006,7 @@ void DetectTagRegisterTests(void) {
     UtRegisterTest("DetectTagTestPacket02", DetectTagTestPacket02, 1);
     UtRegisterTest("DetectTagTestPacket03", DetectTagTestPacket03, 1);
     UtRegisterTest("DetectTagTestPacket04", DetectTagTestPacket04, 1);
+    UtRegisterTest("DetectTagTestHost01", DetectTagTestHost01, 1);
 #endif
 #endif /* UNITTESTS */
 }
@@ -91,6 +91,7 @@ typedef struct DetectTagDataEntryList_ {
     Address addr;                       /**< Var used to store dst or src addr */
     uint8_t ipv;                        /**< IP Version */
     SCMutex lock;
+    struct DetectTagDataEntryList_ *next; /**< Next host in the hash row */
 }DetectTagDataEntryList;
 
 /* prototypes */
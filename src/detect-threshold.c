@@ -585,7 +585,7 @@ static int DetectThresholdTestSig3(void) {
     SigMatchSignatures(&th_v, de_ctx, det_ctx, p);
     SigMatchSignatures(&th_v, de_ctx, det_ctx, p);
 
-    lookup_tsh = (DetectThresholdEntry *)HashListTableLookup(de_ctx->ths_ctx.threshold_hash_table_dst, ste, sizeof(DetectThresholdEntry));
+    lookup_tsh = ThresholdHashSearch(de_ctx, ste, p);
     if (lookup_tsh == NULL) {
         printf("lookup_tsh is NULL: ");
         goto cleanup;
@@ -853,6 +853,214 @@ end:
     UTHFreePackets(&p, 1);
     return result;
 }
+#define THRESHOLD_TEST_THREADS  8
+#define THRESHOLD_TEST_HOSTS    64
+#define THRESHOLD_TEST_ROUNDS   2000
+
+typedef struct ThresholdTestThreadData_ {
+    DetectEngineCtx *de_ctx;
+    Signature *s;
+    DetectThresholdData *td;
+    Packet **p;
+    int hosts;
+    int rounds;
+    int alerts;
+} ThresholdTestThreadData;
+
+static void *ThresholdTestThread(void *arg)
+{
+    ThresholdTestThreadData *t = (ThresholdTestThreadData *)arg;
+    int r, h;
+
+    for (r = 0; r < t->rounds; r++) {
+        for (h = 0; h < t->hosts; h++) {
+            t->alerts += PacketAlertThreshold(t->de_ctx, NULL, t->td, t->p[h], t->s);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * \test DetectThresholdTestSig7Threads has a number of detect threads
+ *       hammer the threshold table for the same set of hosts, the limit
+ *       has to hold over all of them together.
+ */
+static int DetectThresholdTestSig7Threads(void) {
+    Packet *p[THRESHOLD_TEST_HOSTS];
+    pthread_t threads[THRESHOLD_TEST_THREADS];
+    ThresholdTestThreadData data[THRESHOLD_TEST_THREADS];
+    Signature *s = NULL;
+    DetectThresholdData *td = NULL;
+    int result = 0;
+    int alerts = 0;
+    int i;
+
+    memset(p, 0, sizeof(p));
+    memset(data, 0, sizeof(data));
+
+    for (i = 0; i < THRESHOLD_TEST_HOSTS; i++) {
+        char src[16];
+        snprintf(src, sizeof(src), "10.0.%d.%d", i / 8, i);
+        p[i] = UTHBuildPacketReal((uint8_t *)"A",1,IPPROTO_TCP, src, "2.2.2.2", 1024, 80);
+        if (p[i] == NULL)
+            goto end;
+        TimeGet(&p[i]->ts);
+    }
+
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    if (de_ctx == NULL) {
+        goto end;
+    }
+
+    de_ctx->flags |= DE_QUIET;
+
+    s = de_ctx->sig_list = SigInit(de_ctx,"alert tcp any any -> any 80 (msg:\"Threshold limit\"; threshold: type limit, track by_src, count 5, seconds 60; sid:10;)");
+    if (s == NULL) {
+        goto cleanup;
+    }
+
+    td = SigGetThresholdType(s, p[0]);
+    if (td == NULL) {
+        goto cleanup;
+    }
+
+    uint64_t ticks_start = UtilCpuGetTicks();
+    for (i = 0; i < THRESHOLD_TEST_THREADS; i++) {
+        data[i].de_ctx = de_ctx;
+        data[i].s = s;
+        data[i].td = td;
+        data[i].p = p;
+        data[i].hosts = THRESHOLD_TEST_HOSTS;
+        data[i].rounds = THRESHOLD_TEST_ROUNDS;
+        if (pthread_create(&threads[i], NULL, ThresholdTestThread, &data[i]) != 0)
+            goto cleanup;
+    }
+    for (i = 0; i < THRESHOLD_TEST_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+        alerts += data[i].alerts;
+    }
+    uint64_t ticks_end = UtilCpuGetTicks();
+    printf("test run %"PRIu64"\n", (ticks_end - ticks_start));
+
+    if (alerts == THRESHOLD_TEST_HOSTS * 5)
+        result = 1;
+    else
+        printf("alerts %d != %d: ", alerts, THRESHOLD_TEST_HOSTS * 5);
+
+cleanup:
+    SigCleanSignatures(de_ctx);
+    DetectEngineCtxFree(de_ctx);
+end:
+    for (i = 0; i < THRESHOLD_TEST_HOSTS; i++) {
+        if (p[i] != NULL)
+            UTHFreePackets(&p[i], 1);
+    }
+    return result;
+}
+/** Uncomment this if you want stats
+ *  #define ENABLE_THRESHOLD_STATS 1
+ */
+
+#ifdef ENABLE_THRESHOLD_STATS
+
+#define THRESHOLD_STATS_HOSTS   4096
+/* Total number of PacketAlertThreshold calls per run, spread over the threads */
+#define THRESHOLD_STATS_CALLS   (4 * 1024 * 1024)
+
+/**
+ * \test Stats: PacketAlertThreshold throughput of 1 to 8 detect threads on
+ *       a table of THRESHOLD_STATS_HOSTS tracked hosts. Wall clock time is
+ *       used, as the cpu time of clock() adds up the threads.
+ */
+static int DetectThresholdStatsTestThreads(void) {
+    Packet **p = NULL;
+    pthread_t threads[THRESHOLD_TEST_THREADS];
+    ThresholdTestThreadData data[THRESHOLD_TEST_THREADS];
+    int result = 0;
+    int nthreads, i;
+
+    p = SCMalloc(THRESHOLD_STATS_HOSTS * sizeof(Packet *));
+    if (p == NULL)
+        return 0;
+    memset(p, 0, THRESHOLD_STATS_HOSTS * sizeof(Packet *));
+
+    for (i = 0; i < THRESHOLD_STATS_HOSTS; i++) {
+        char src[16];
+        snprintf(src, sizeof(src), "10.%d.%d.%d", i / 65536, (i / 256) % 256, i % 256);
+        p[i] = UTHBuildPacketReal((uint8_t *)"A",1,IPPROTO_TCP, src, "2.2.2.2", 1024, 80);
+        if (p[i] == NULL)
+            goto end;
+        TimeGet(&p[i]->ts);
+    }
+
+    for (nthreads = 1; nthreads <= THRESHOLD_TEST_THREADS; nthreads *= 2) {
+        int rounds = THRESHOLD_STATS_CALLS / (nthreads * THRESHOLD_STATS_HOSTS);
+        int alerts = 0;
+        struct timeval tv_start, tv_end;
+
+        /* a new engine for every run, so each starts with an empty table */
+        DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+        if (de_ctx == NULL)
+            goto end;
+        de_ctx->flags |= DE_QUIET;
+
+        Signature *s = de_ctx->sig_list = SigInit(de_ctx,"alert tcp any any -> any 80 (msg:\"Threshold limit\"; threshold: type limit, track by_src, count 5, seconds 60; sid:10;)");
+        DetectThresholdData *td = (s != NULL) ? SigGetThresholdType(s, p[0]) : NULL;
+        if (td == NULL) {
+            SigCleanSignatures(de_ctx);
+            DetectEngineCtxFree(de_ctx);
+            goto end;
+        }
+
+        memset(data, 0, sizeof(data));
+        gettimeofday(&tv_start, NULL);
+        for (i = 0; i < nthreads; i++) {
+            data[i].de_ctx = de_ctx;
+            data[i].s = s;
+            data[i].td = td;
+            data[i].p = p;
+            data[i].hosts = THRESHOLD_STATS_HOSTS;
+            data[i].rounds = rounds;
+            if (pthread_create(&threads[i], NULL, ThresholdTestThread, &data[i]) != 0)
+                break;
+        }
+        int started = i;
+        for (i = 0; i < started; i++) {
+            pthread_join(threads[i], NULL);
+            alerts += data[i].alerts;
+        }
+        gettimeofday(&tv_end, NULL);
+
+        SigCleanSignatures(de_ctx);
+        DetectEngineCtxFree(de_ctx);
+
+        if (started != nthreads)
+            goto end;
+
+        double secs = (tv_end.tv_sec - tv_start.tv_sec) +
+                      (tv_end.tv_usec - tv_start.tv_usec) / 1000000.0;
+        uint64_t calls = (uint64_t)nthreads * rounds * THRESHOLD_STATS_HOSTS;
+        printf("Threshold %d thread(s), %d hosts: Seconds spent: %.4fs, "
+               "%.0f ns per call, %.2f Mcalls/s\n", nthreads, THRESHOLD_STATS_HOSTS,
+               secs, secs * 1000000000.0 / calls, calls / secs / 1000000.0);
+
+        if (alerts != THRESHOLD_STATS_HOSTS * 5) {
+            printf("alerts %d != %d: ", alerts, THRESHOLD_STATS_HOSTS * 5);
+            goto end;
+        }
+    }
+
+    result = 1;
+end:
+    for (i = 0; i < THRESHOLD_STATS_HOSTS; i++) {
+        if (p[i] != NULL)
+            UTHFreePackets(&p[i], 1);
+    }
+    SCFree(p);
+    return result;
+}
+
+#endif /* ENABLE_THRESHOLD_STATS */
 #endif /* UNITTESTS */
 
 void ThresholdRegisterTests(void) {
@@ -868,5 +1076,9 @@ void ThresholdRegisterTests(void) {
     UtRegisterTest("DetectThresholdTestSig4", DetectThresholdTestSig4, 1);
     UtRegisterTest("DetectThresholdTestSig5", DetectThresholdTestSig5, 1);
     UtRegisterTest("DetectThresholdTestSig6Ticks", DetectThresholdTestSig6Ticks, 1);
+    UtRegisterTest("DetectThresholdTestSig7Threads", DetectThresholdTestSig7Threads, 1);
+#ifdef ENABLE_THRESHOLD_STATS
+    UtRegisterTest("DetectThresholdStatsTestThreads", DetectThresholdStatsTestThreads, 1);
+#endif
 #endif /* UNITTESTS */
 }
@@ -65,6 +65,7 @@ typedef struct DetectThresholdData_ {
 typedef struct DetectThresholdEntry_ {
     uint32_t tv_timeout;    /**< Timeout for new_action (for rate_filter)
                                  its not "seconds", that define the time interval */
+    uint32_t timeout;       /**< new_action timeout of the rate_filter */
     uint32_t seconds;       /**< Event seconds */
     uint32_t sid;           /**< Signature id */
     uint32_t tv_sec1;       /**< Var for time control */
@@ -73,6 +74,8 @@ typedef struct DetectThresholdEntry_ {
     uint8_t gid;            /**< Signature group id */
     uint8_t ipv;            /**< Packet ip version */
     uint8_t track;          /**< Track type: by_src, by_src */
+
+    struct DetectThresholdEntry_ *next; /**< next entry in the hash row */
 } DetectThresholdEntry;
 
 
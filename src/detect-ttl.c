@@ -110,16 +110,32 @@ int DetectTtlMatch (ThreadVars *t, DetectEngineThreadCtx *det_ctx, Packet *p, Si
         return ret;
     }
 
+    ret = DetectTtlMatchValue(ttld, pttl);
+
+    return ret;
+}
+
+/**
+ * \brief Match a ttl value against the ttl: options of a sig
+ *
+ * \param ttld pointer to the ttl data
+ * \param pttl ttl of the packet
+ *
+ * \retval 0 no match
+ * \retval 1 match
+ */
+int DetectTtlMatchValue(const DetectTtlData *ttld, uint8_t pttl)
+{
     if (ttld->mode == DETECT_TTL_EQ && pttl == ttld->ttl1)
-        ret = 1;
+        return 1;
     else if (ttld->mode == DETECT_TTL_LT && pttl < ttld->ttl1)
-        ret = 1;
+        return 1;
     else if (ttld->mode == DETECT_TTL_GT && pttl > ttld->ttl1)
-        ret = 1;
+        return 1;
     else if (ttld->mode == DETECT_TTL_RA && (pttl > ttld->ttl1 && pttl < ttld->ttl2))
-        ret = 1;
+        return 1;
 
-    return ret;
+    return 0;
 }
 
 /**
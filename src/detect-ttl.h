@@ -37,6 +37,7 @@ typedef struct DetectTtlData_ {
 }DetectTtlData;
 
 void DetectTtlRegister(void);
+int DetectTtlMatchValue(const DetectTtlData *, uint8_t);
 
 #endif	/* _DETECT_TTL_H */
 
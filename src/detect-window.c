@@ -108,7 +108,21 @@ int DetectWindowMatch(ThreadVars *t, DetectEngineThreadCtx *det_ctx, Packet *p,
         return 0;
     }
 
-    if ( (!wd->negated && wd->size == TCP_GET_WINDOW(p)) || (wd->negated && wd->size != TCP_GET_WINDOW(p))) {
+    return DetectWindowMatchValue(wd, TCP_GET_WINDOW(p));
+}
+
+/**
+ * \brief Match a window size against the window: options of a sig
+ *
+ * \param wd pointer to the window data
+ * \param size window size of the packet
+ *
+ * \retval 0 no match
+ * \retval 1 match
+ */
+int DetectWindowMatchValue(const DetectWindowData *wd, uint16_t size)
+{
+    if ( (!wd->negated && wd->size == size) || (wd->negated && wd->size != size)) {
         return 1;
     }
 
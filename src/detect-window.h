@@ -28,6 +28,7 @@ typedef struct DetectWindowData_ {
 
 /* prototypes */
 void DetectWindowRegister (void);
+int DetectWindowMatchValue(const DetectWindowData *, uint16_t);
 
 #endif /* __DETECT_WINDOW_H__ */
 
@@ -41,6 +41,7 @@
 #include "detect-engine-mpm.h"
 #include "detect-engine-iponly.h"
 #include "detect-engine-threshold.h"
+#include "detect-engine-tag.h"
 
 #include "detect-engine-payload.h"
 #include "detect-engine-dcepayload.h"
@@ -158,6 +159,13 @@
 #include "util-profiling.h"
 #include "util-validate.h"
 #include "util-optimize.h"
+#include "util-clock.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 extern uint8_t engine_mode;
 
@@ -272,6 +280,8 @@ static inline void EngineAnalysisWriteFastPattern(Signature *s, SigMatch *mpm_sm
     }
     fprintf(fp_engine_analysis_FD, "    Content negated: %s\n",
             (fp_cd->flags & DETECT_CONTENT_NEGATED) ? "yes" : "no");
+    fprintf(fp_engine_analysis_FD, "    Fast pattern from pcre: %s\n",
+            (fp_cd->flags & DETECT_CONTENT_PCRE_LITERAL) ? "yes" : "no");
 
     uint16_t patlen = fp_cd->content_len;
     uint8_t *pat = SCMalloc(fp_cd->content_len + 1);
@@ -667,6 +677,413 @@ int SigLoadSignatures(DetectEngineCtx *de_ctx, char *sig_file)
     SCReturnInt(ret);
 }
 
+/**
+ *  \brief Check the mask and alproto of SIG_PREFILTER_BLOCK sigs at once
+ *
+ *  \param pf prefilter arrays of the sgh
+ *  \param base index of the first sig of the block
+ *  \param mask packet mask
+ *  \param alproto application layer protocol of the packet
+ *  \param alproto_alt other alproto the sigs may have (DCERPC for SMB)
+ *
+ *  \retval bits bit i is set if sig base + i passed both checks
+ */
+static inline uint32_t SigPrefilterBlock(const SigGroupHeadPrefilter *pf,
+        uint32_t base, SignatureMask mask, uint16_t alproto,
+        uint16_t alproto_alt)
+{
+#if defined(__AVX2__)
+    __m256i zero = _mm256_setzero_si256();
+    __m256i pmask = _mm256_set1_epi8((char)mask);
+    __m256i pa = _mm256_set1_epi16((short)alproto);
+    __m256i pb = _mm256_set1_epi16((short)alproto_alt);
+
+    /* (mask & s->mask) == s->mask */
+    __m256i smask = _mm256_loadu_si256((const __m256i *)&pf->mask[base]);
+    uint32_t mask_ok = (uint32_t)_mm256_movemask_epi8(
+            _mm256_cmpeq_epi8(_mm256_andnot_si256(pmask, smask), zero));
+
+    __m256i a0 = _mm256_loadu_si256((const __m256i *)&pf->alproto[base]);
+    __m256i a1 = _mm256_loadu_si256((const __m256i *)&pf->alproto[base + 16]);
+    __m256i r0 = _mm256_or_si256(_mm256_cmpeq_epi16(a0, zero),
+            _mm256_or_si256(_mm256_cmpeq_epi16(a0, pa), _mm256_cmpeq_epi16(a0, pb)));
+    __m256i r1 = _mm256_or_si256(_mm256_cmpeq_epi16(a1, zero),
+            _mm256_or_si256(_mm256_cmpeq_epi16(a1, pa), _mm256_cmpeq_epi16(a1, pb)));
+    /* packs works per 128 bit lane, put the sigs back in order */
+    __m256i r = _mm256_permute4x64_epi64(_mm256_packs_epi16(r0, r1), 0xD8);
+    uint32_t alproto_ok = (uint32_t)_mm256_movemask_epi8(r);
+
+    return (mask_ok & alproto_ok);
+#elif defined(__SSE2__)
+    __m128i zero = _mm_setzero_si128();
+    __m128i pmask = _mm_set1_epi8((char)mask);
+    __m128i pa = _mm_set1_epi16((short)alproto);
+    __m128i pb = _mm_set1_epi16((short)alproto_alt);
+    uint32_t bits = 0;
+    uint32_t half;
+
+    for (half = 0; half < SIG_PREFILTER_BLOCK; half += 16) {
+        uint32_t i = base + half;
+
+        /* (mask & s->mask) == s->mask */
+        __m128i smask = _mm_loadu_si128((const __m128i *)&pf->mask[i]);
+        uint32_t mask_ok = (uint32_t)_mm_movemask_epi8(
+                _mm_cmpeq_epi8(_mm_andnot_si128(pmask, smask), zero));
+
+        __m128i a0 = _mm_loadu_si128((const __m128i *)&pf->alproto[i]);
+        __m128i a1 = _mm_loadu_si128((const __m128i *)&pf->alproto[i + 8]);
+        __m128i r0 = _mm_or_si128(_mm_cmpeq_epi16(a0, zero),
+                _mm_or_si128(_mm_cmpeq_epi16(a0, pa), _mm_cmpeq_epi16(a0, pb)));
+        __m128i r1 = _mm_or_si128(_mm_cmpeq_epi16(a1, zero),
+                _mm_or_si128(_mm_cmpeq_epi16(a1, pa), _mm_cmpeq_epi16(a1, pb)));
+        uint32_t alproto_ok = (uint32_t)_mm_movemask_epi8(_mm_packs_epi16(r0, r1));
+
+        bits |= (mask_ok & alproto_ok) << half;
+    }
+
+    return bits;
+#else
+    uint32_t bits = 0;
+    uint32_t i;
+
+    for (i = 0; i < SIG_PREFILTER_BLOCK; i++) {
+        uint16_t sa = pf->alproto[base + i];
+
+        if ((mask & pf->mask[base + i]) == pf->mask[base + i] &&
+            (sa == ALPROTO_UNKNOWN || sa == alproto || sa == alproto_alt))
+        {
+            bits |= (1U << i);
+        }
+    }
+
+    return bits;
+#endif
+}
+
+/**
+ *  \brief Check the mpm pattern ids and de_state of a sig that passed the
+ *         mask and alproto checks.
+ *
+ *  \retval 1 sig needs to be inspected
+ *  \retval 0 sig can be skipped
+ */
+static inline int SigMatchSignaturesPrefilterSig(DetectEngineThreadCtx *det_ctx,
+        Packet *p, const SigGroupHeadPrefilter *pf, uint32_t idx)
+{
+    const uint8_t *bitarray = det_ctx->pmq.pattern_id_bitarray;
+    SignatureHeader *s = &det_ctx->sgh->head_array[idx];
+
+    /* filter out sigs that want pattern matches, but have no matches */
+    if (pf->mpm_packet_bit[idx] != 0 &&
+        !(bitarray[pf->mpm_packet_byte[idx]] & pf->mpm_packet_bit[idx]))
+    {
+        /* pattern didn't match. There is one case where we will inspect
+         * the signature anyway: if the packet payload was added to the
+         * stream it is not scanned itself: the stream data is inspected.
+         * Inspecting both would result in duplicated alerts. There is
+         * one case where we are going to inspect the packet payload
+         * anyway: if a signature has the dsize option. */
+        if (!((p->flags & PKT_STREAM_ADD) && (s->flags & SIG_FLAG_DSIZE))) {
+            return 0;
+        }
+    }
+    if (pf->mpm_stream_bit[idx] != 0 &&
+        !(bitarray[pf->mpm_stream_byte[idx]] & pf->mpm_stream_bit[idx]))
+    {
+        if (!((p->flags & PKT_STREAM_ADD) && (s->flags & SIG_FLAG_DSIZE))) {
+            return 0;
+        }
+    }
+    if (pf->mpm_http_bit[idx] != 0 &&
+        !(bitarray[pf->mpm_http_byte[idx]] & pf->mpm_http_bit[idx]))
+    {
+        return 0;
+    }
+
+    /* de_state check, filter out all signatures that already had a match before
+     * or just partially match */
+    if (s->flags & SIG_FLAG_STATE_MATCH) {
+        /* we run after DeStateDetectContinueDetection, so we might have
+         * state NEW here. In that case we'd want to continue detection
+         * for this sig. If we have NOSTATE, stateful detection didn't
+         * start yet for this sig, so we will inspect it.
+         */
+        if (det_ctx->de_state_sig_array[s->num] != DE_STATE_MATCH_NEW &&
+                det_ctx->de_state_sig_array[s->num] != DE_STATE_MATCH_NOSTATE) {
+            SCLogDebug("de state not NEW or NOSTATE, ignoring");
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/**
+ *  \brief build the match array by prefiltering all sigs of the sgh
+ *
+ *  The mask and alproto of the sigs are checked a block of
+ *  SIG_PREFILTER_BLOCK sigs at a time using the sgh prefilter arrays. Only
+ *  the sigs that pass get their mpm pattern id(s) and de_state checked.
+ */
+static void SigMatchSignaturesBuildMatchArrayBlocks(DetectEngineThreadCtx *det_ctx,
+        Packet *p, SignatureMask mask, uint16_t alproto, uint16_t alproto_alt)
+{
+    SigGroupHead *sgh = det_ctx->sgh;
+    const SigGroupHeadPrefilter *pf = &sgh->prefilter;
+    uint32_t base;
+
+    for (base = 0; base < sgh->sig_cnt; base += SIG_PREFILTER_BLOCK) {
+        uint32_t bits = SigPrefilterBlock(pf, base, mask, alproto, alproto_alt);
+
+        /* the padding after the last sig passes, drop it */
+        if (sgh->sig_cnt - base < SIG_PREFILTER_BLOCK)
+            bits &= (1U << (sgh->sig_cnt - base)) - 1;
+
+        while (bits != 0) {
+            uint32_t idx = base + __builtin_ctz(bits);
+
+            bits &= (bits - 1);
+
+            if (SigMatchSignaturesPrefilterSig(det_ctx, p, pf, idx) == 0)
+                continue;
+
+            /* okay, store it */
+            det_ctx->match_array[det_ctx->match_array_cnt] = sgh->head_array[idx].full_sig;
+            det_ctx->match_array_cnt++;
+        }
+    }
+}
+
+static int SigMatchSignaturesCandCompare(const void *a, const void *b)
+{
+    uint32_t ia = *(const uint32_t *)a;
+    uint32_t ib = *(const uint32_t *)b;
+
+    return (ia < ib) ? -1 : (ia > ib);
+}
+
+/**
+ *  \brief Find a pattern id in the inverted index of a sgh
+ *
+ *  \retval i position in pf->pid, or -1 if the sgh doesn't use the pattern
+ */
+static inline int32_t SigMatchSignaturesPrefilterFindPid(const SigGroupHeadPrefilter *pf,
+        uint32_t pid)
+{
+    uint32_t lo = 0, hi = pf->pid_cnt;
+
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (pf->pid[mid] < pid)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if (lo < pf->pid_cnt && pf->pid[lo] == pid)
+        return (int32_t)lo;
+    return -1;
+}
+
+/**
+ *  \brief Get the packet header field value of a header prefilter engine
+ *
+ *  \retval 1 value set
+ *  \retval 0 packet doesn't have the field, none of the sigs of the engine
+ *          can match
+ */
+static inline int SigMatchSignaturesPrefilterEngineValue(const Packet *p,
+        int e, uint32_t *value)
+{
+    switch (e) {
+        case SIG_PREFILTER_ENGINE_FLAGS:
+            if (!PKT_IS_TCP(p))
+                return 0;
+            *value = p->tcph->th_flags;
+            return 1;
+        case SIG_PREFILTER_ENGINE_TTL:
+            if (PKT_IS_PSEUDOPKT(p))
+                return 0;
+            if (PKT_IS_IPV4(p))
+                *value = IPV4_GET_IPTTL(p);
+            else if (PKT_IS_IPV6(p))
+                *value = IPV6_GET_HLIM(p);
+            else
+                return 0;
+            return 1;
+        case SIG_PREFILTER_ENGINE_ITYPE:
+            if (PKT_IS_ICMPV4(p))
+                *value = ICMPV4_GET_TYPE(p);
+            else if (PKT_IS_ICMPV6(p))
+                *value = ICMPV6_GET_TYPE(p);
+            else
+                return 0;
+            return 1;
+        case SIG_PREFILTER_ENGINE_ICODE:
+            if (PKT_IS_ICMPV4(p))
+                *value = ICMPV4_GET_CODE(p);
+            else if (PKT_IS_ICMPV6(p))
+                *value = ICMPV6_GET_CODE(p);
+            else
+                return 0;
+            return 1;
+        case SIG_PREFILTER_ENGINE_DSIZE:
+            if (PKT_IS_PSEUDOPKT(p))
+                return 0;
+            *value = p->payload_len;
+            return 1;
+        case SIG_PREFILTER_ENGINE_WINDOW:
+            if (!PKT_IS_TCP(p) || PKT_IS_PSEUDOPKT(p))
+                return 0;
+            *value = TCP_GET_WINDOW(p);
+            return 1;
+        case SIG_PREFILTER_ENGINE_ICMP_ID:
+            /* the keyword also checks the type has an id */
+            if (PKT_IS_ICMPV4(p))
+                *value = ICMPV4_GET_ID(p);
+            else if (PKT_IS_ICMPV6(p))
+                *value = ICMPV6_GET_ID(p);
+            else
+                return 0;
+            return 1;
+        case SIG_PREFILTER_ENGINE_ACK:
+            if (!PKT_IS_TCP(p) || PKT_IS_PSEUDOPKT(p))
+                return 0;
+            *value = TCP_GET_ACK(p);
+            return 1;
+        case SIG_PREFILTER_ENGINE_SEQ:
+            if (!PKT_IS_TCP(p) || PKT_IS_PSEUDOPKT(p))
+                return 0;
+            *value = TCP_GET_SEQ(p);
+            return 1;
+    }
+
+    return 0;
+}
+
+/**
+ *  \brief Find the interval of a header prefilter engine a value is in
+ */
+static inline uint32_t SigMatchSignaturesPrefilterEngineFind(
+        const SigGroupHeadPrefilterEngine *engine, uint32_t value)
+{
+    uint32_t lo = 0, hi = engine->cnt;
+
+    if (engine->start == NULL)
+        return value;
+
+    /* last interval starting at or before value, start[0] is 0 */
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (engine->start[mid] <= value)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo - 1;
+}
+
+/**
+ *  \brief Check a candidate sig of the inverted index and add it to the
+ *         match array if it needs to be inspected.
+ */
+static inline void SigMatchSignaturesPrefilterCand(DetectEngineThreadCtx *det_ctx,
+        Packet *p, const SigGroupHeadPrefilter *pf, uint32_t idx,
+        SignatureMask mask, uint16_t alproto, uint16_t alproto_alt)
+{
+    if ((mask & pf->mask[idx]) != pf->mask[idx])
+        return;
+    if (pf->alproto[idx] != ALPROTO_UNKNOWN && pf->alproto[idx] != alproto &&
+        pf->alproto[idx] != alproto_alt)
+        return;
+
+    if (SigMatchSignaturesPrefilterSig(det_ctx, p, pf, idx) == 0)
+        return;
+
+    /* okay, store it */
+    det_ctx->match_array[det_ctx->match_array_cnt] = det_ctx->sgh->head_array[idx].full_sig;
+    det_ctx->match_array_cnt++;
+}
+
+/**
+ *  \brief build the match array from the pattern matches of the pmq, the
+ *         header prefilter engines and the always inspected sigs, using the
+ *         inverted pattern index of the sgh.
+ *
+ *  \retval 0 match array built
+ *  \retval -1 too many candidates, match array not built
+ */
+static int SigMatchSignaturesBuildMatchArrayIndex(DetectEngineThreadCtx *det_ctx,
+        Packet *p, SignatureMask mask, uint16_t alproto, uint16_t alproto_alt)
+{
+    SigGroupHead *sgh = det_ctx->sgh;
+    const SigGroupHeadPrefilter *pf = &sgh->prefilter;
+    uint32_t *cand = det_ctx->prefilter_cand;
+    uint32_t max = sgh->sig_cnt / SIG_PREFILTER_INDEX_RATIO;
+    uint32_t cand_cnt = 0;
+    uint32_t u, a;
+    int e;
+
+    /* every matched pattern of the sgh adds at least one candidate */
+    if (cand == NULL || pf->always_cnt + det_ctx->pmq.pattern_id_array_cnt > max)
+        return -1;
+
+    /* the header prefilter engines add the sigs for the value of their
+     * field in this packet with a single lookup */
+    for (e = 0; e < SIG_PREFILTER_ENGINE_MAX; e++) {
+        const SigGroupHeadPrefilterEngine *engine = &pf->engine[e];
+        uint32_t value;
+
+        if (engine->cnt == 0 ||
+            SigMatchSignaturesPrefilterEngineValue(p, e, &value) == 0)
+            continue;
+
+        uint32_t i = SigMatchSignaturesPrefilterEngineFind(engine, value);
+        uint32_t n = engine->offset[i + 1] - engine->offset[i];
+        if (pf->always_cnt + cand_cnt + n > max)
+            return -1;
+
+        memcpy(cand + cand_cnt, engine->sigs + engine->offset[i], n * sizeof(uint32_t));
+        cand_cnt += n;
+    }
+
+    for (u = 0; u < det_ctx->pmq.pattern_id_array_cnt; u++) {
+        int32_t i = SigMatchSignaturesPrefilterFindPid(pf, det_ctx->pmq.pattern_id_array[u]);
+        if (i < 0)
+            continue;
+
+        uint32_t n = pf->pid_offset[i + 1] - pf->pid_offset[i];
+        if (pf->always_cnt + cand_cnt + n > max)
+            return -1;
+
+        memcpy(cand + cand_cnt, pf->pid_sigs + pf->pid_offset[i], n * sizeof(uint32_t));
+        cand_cnt += n;
+    }
+
+    /* inspect in sgh order: sort the candidates and merge them
+     * with the always list, which is sorted already. A sig may be a
+     * candidate more than once. */
+    if (cand_cnt > 1)
+        qsort(cand, cand_cnt, sizeof(uint32_t), SigMatchSignaturesCandCompare);
+
+    for (u = 0, a = 0; u < cand_cnt || a < pf->always_cnt; ) {
+        uint32_t idx;
+
+        if (a == pf->always_cnt || (u < cand_cnt && cand[u] < pf->always[a])) {
+            idx = cand[u++];
+            if (u > 1 && idx == cand[u - 2])
+                continue;
+        } else {
+            idx = pf->always[a++];
+        }
+
+        SigMatchSignaturesPrefilterCand(det_ctx, p, pf, idx, mask, alproto, alproto_alt);
+    }
+
+    return 0;
+}
+
 /**
  *  \brief build an array of signatures that will be inspected
  *
@@ -678,6 +1095,43 @@ int SigLoadSignatures(DetectEngineCtx *de_ctx, char *sig_file)
  *  \param mask Packets mask
  *  \param alproto application layer protocol
  *
+ *  If few patterns matched, only the sigs using those patterns and the
+ *  always inspected sigs are looked at. Otherwise all sigs of the sgh are
+ *  prefiltered in blocks.
+ */
+static void SigMatchSignaturesBuildMatchArray(DetectEngineCtx *de_ctx,
+        DetectEngineThreadCtx *det_ctx, Packet *p, SignatureMask mask,
+        uint16_t alproto)
+{
+    uint16_t alproto_alt = alproto;
+
+    /* reset previous run */
+    det_ctx->match_array_cnt = 0;
+
+    /* DCERPC sigs also apply to SMB and SMB2 sessions */
+    if (alproto == ALPROTO_SMB || alproto == ALPROTO_SMB2)
+        alproto_alt = ALPROTO_DCERPC;
+
+    if (SigMatchSignaturesBuildMatchArrayIndex(det_ctx, p, mask, alproto, alproto_alt) == 0)
+        return;
+
+    SigMatchSignaturesBuildMatchArrayBlocks(det_ctx, p, mask, alproto, alproto_alt);
+}
+
+#ifdef UNITTESTS
+/**
+ *  \brief build an array of signatures that will be inspected, one
+ *         SignatureHeader at a time.
+ *
+ *  Reference implementation for SigMatchSignaturesBuildMatchArray, only
+ *  used by the unittests.
+ *
+ *  \param de_ctx detection engine ctx
+ *  \param det_ctx detection engine thread ctx -- array is stored here
+ *  \param p packet
+ *  \param mask Packets mask
+ *  \param alproto application layer protocol
+ *
  *  Order of SignatureHeader access:
  *  1. mask
  *  2. flags
@@ -688,7 +1142,7 @@ int SigLoadSignatures(DetectEngineCtx *de_ctx, char *sig_file)
  *  5. mpm_stream_pattern_id_mod8
  *  6. num
  */
-static void SigMatchSignaturesBuildMatchArray(DetectEngineCtx *de_ctx,
+static void SigMatchSignaturesBuildMatchArrayScalar(DetectEngineCtx *de_ctx,
         DetectEngineThreadCtx *det_ctx, Packet *p, SignatureMask mask,
         uint16_t alproto)
 {
@@ -851,6 +1305,8 @@ static void SigMatchSignaturesBuildMatchArray(DetectEngineCtx *de_ctx,
     }
 }
 
+#endif /* UNITTESTS */
+
 /**
  *  \brief Get the SigGroupHead for a packet.
  *
@@ -1047,7 +1503,11 @@ static inline void DetectMpmPrefilter(DetectEngineCtx *de_ctx,
         }
 
         /* all http based mpms */
-        if (alproto == ALPROTO_HTTP && alstate != NULL) {
+        if (alproto == ALPROTO_HTTP && alstate != NULL &&
+            det_ctx->sgh->flags & SIG_GROUP_HEAD_MPM_HTTP) {
+            cnt = DetectEngineRunHttpMpm(de_ctx, det_ctx, p->flow, alstate);
+            SCLogDebug("combined http search: cnt %" PRIu32, cnt);
+        } else if (alproto == ALPROTO_HTTP && alstate != NULL) {
             if (det_ctx->sgh->flags & SIG_GROUP_HEAD_MPM_URI) {
                 cnt = DetectUricontentInspectMpm(det_ctx, p->flow, alstate);
                 SCLogDebug("uri search: cnt %" PRIu32, cnt);
@@ -1076,6 +1536,12 @@ static inline void DetectMpmPrefilter(DetectEngineCtx *de_ctx,
     } else {
         SCLogDebug("NOT p->flowflags & FLOW_PKT_ESTABLISHED");
     }
+
+    /* the mpm ctxs are shared by all sghs, drop the patterns of the others */
+    if (det_ctx->sgh->mpm_pid_filter != NULL) {
+        PmqFilter(&det_ctx->pmq, det_ctx->sgh->mpm_pid_filter,
+                  det_ctx->sgh->mpm_pid_filter_size);
+    }
 }
 
 
@@ -1123,6 +1589,14 @@ int SigMatchSignatures(ThreadVars *th_v, DetectEngineCtx *de_ctx, DetectEngineTh
 
         SCMutexLock(&p->flow->m);
         {
+            /* the stored sghs belong to the engine from before a rule reload */
+            if (p->flow->de_ctx_version != de_ctx->version) {
+                p->flow->flags &= ~(FLOW_SGH_TOSERVER|FLOW_SGH_TOCLIENT);
+                p->flow->sgh_toserver = NULL;
+                p->flow->sgh_toclient = NULL;
+                p->flow->de_ctx_version = de_ctx->version;
+            }
+
             /* Get the stored sgh from the flow (if any). Make sure we're not using
              * the sgh for icmp error packets part of the same stream. */
             if (IP_GET_IPPROTO(p) == p->flow->proto) { /* filter out icmp */
@@ -1253,12 +1727,12 @@ int SigMatchSignatures(ThreadVars *th_v, DetectEngineCtx *de_ctx, DetectEngineTh
          * can't match and we skip it. */
         if (p->flags & PKT_HAS_FLOW && s->flags & SIG_FLAG_REQUIRE_FLOWVAR) {
             SCMutexLock(&p->flow->m);
-            int m  = p->flow->flowvar ? 1 : 0;
+            int m  = p->flow->flowbits_cnt ? 1 : 0;
             SCMutexUnlock(&p->flow->m);
 
-            /* no flowvars? skip this sig */
+            /* no flowbits? skip this sig */
             if (m == 0) {
-                SCLogDebug("skipping sig as the flow has no flowvars and sig "
+                SCLogDebug("skipping sig as the flow has no flowbits and sig "
                         "has SIG_FLAG_REQUIRE_FLOWVAR flag set.");
                 goto next;
             }
@@ -1535,7 +2009,13 @@ end:
         }
 
         SCMutexLock(&p->flow->m);
-        if (!(sms_runflags & SMS_USE_FLOW_SGH)) {
+        /* session tags, while we hold the flow lock anyway */
+        TagHandlePacketFlow(p->flow, p);
+
+        /* don't store our sgh if a thread on another engine version took
+         * the flow over in the meantime */
+        if (!(sms_runflags & SMS_USE_FLOW_SGH) &&
+            p->flow->de_ctx_version == de_ctx->version) {
             if (p->flowflags & FLOW_PKT_TOSERVER && !(p->flow->flags & FLOW_SGH_TOSERVER)) {
                 p->flow->sgh_toserver = det_ctx->sgh;
                 p->flow->flags |= FLOW_SGH_TOSERVER;
@@ -1587,6 +2067,13 @@ TmEcode Detect(ThreadVars *tv, Packet *p, void *data, PacketQueue *pq, PacketQue
         goto error;
     }
 
+    /* the rules were reloaded, swap to the new detection engine */
+    if (det_ctx->de_ctx != NULL &&
+        det_ctx->de_ctx->version != SC_ATOMIC_GET(detect_engine_version))
+    {
+        (void)DetectEngineThreadCtxUpdate(det_ctx);
+    }
+
     DetectEngineCtx *de_ctx = det_ctx->de_ctx;
     if (de_ctx == NULL) {
         printf("ERROR: Detect has no detection engine ctx\n");
@@ -1974,31 +2461,34 @@ static int SignatureCreateMask(Signature *s) {
 static void SigInitStandardMpmFactoryContexts(DetectEngineCtx *de_ctx)
 {
     de_ctx->sgh_mpm_context_packet =
-        MpmFactoryRegisterMpmCtxProfile("packet",
+        MpmFactoryRegisterMpmCtxProfile(de_ctx, "packet",
                                         MPM_CTX_FACTORY_FLAGS_PREPARE_WITH_SIG_GROUP_BUILD);
     de_ctx->sgh_mpm_context_uri =
-        MpmFactoryRegisterMpmCtxProfile("uri",
+        MpmFactoryRegisterMpmCtxProfile(de_ctx, "uri",
                                         MPM_CTX_FACTORY_FLAGS_PREPARE_WITH_SIG_GROUP_BUILD);
     de_ctx->sgh_mpm_context_stream =
-        MpmFactoryRegisterMpmCtxProfile("stream",
+        MpmFactoryRegisterMpmCtxProfile(de_ctx, "stream",
                                         MPM_CTX_FACTORY_FLAGS_PREPARE_WITH_SIG_GROUP_BUILD);
     de_ctx->sgh_mpm_context_hcbd =
-        MpmFactoryRegisterMpmCtxProfile("hcbd",
+        MpmFactoryRegisterMpmCtxProfile(de_ctx, "hcbd",
                                         MPM_CTX_FACTORY_FLAGS_PREPARE_WITH_SIG_GROUP_BUILD);
     de_ctx->sgh_mpm_context_hhd =
-        MpmFactoryRegisterMpmCtxProfile("hhd",
+        MpmFactoryRegisterMpmCtxProfile(de_ctx, "hhd",
                                         MPM_CTX_FACTORY_FLAGS_PREPARE_WITH_SIG_GROUP_BUILD);
     de_ctx->sgh_mpm_context_hrhd =
-        MpmFactoryRegisterMpmCtxProfile("hrhd",
+        MpmFactoryRegisterMpmCtxProfile(de_ctx, "hrhd",
                                         MPM_CTX_FACTORY_FLAGS_PREPARE_WITH_SIG_GROUP_BUILD);
     de_ctx->sgh_mpm_context_hmd =
-        MpmFactoryRegisterMpmCtxProfile("hmd",
+        MpmFactoryRegisterMpmCtxProfile(de_ctx, "hmd",
                                         MPM_CTX_FACTORY_FLAGS_PREPARE_WITH_SIG_GROUP_BUILD);
     de_ctx->sgh_mpm_context_hcd =
-        MpmFactoryRegisterMpmCtxProfile("hcd",
+        MpmFactoryRegisterMpmCtxProfile(de_ctx, "hcd",
+                                        MPM_CTX_FACTORY_FLAGS_PREPARE_WITH_SIG_GROUP_BUILD);
+    de_ctx->sgh_mpm_context_http =
+        MpmFactoryRegisterMpmCtxProfile(de_ctx, "http",
                                         MPM_CTX_FACTORY_FLAGS_PREPARE_WITH_SIG_GROUP_BUILD);
     de_ctx->sgh_mpm_context_app_proto_detect =
-        MpmFactoryRegisterMpmCtxProfile("app_proto_detect", 0);
+        MpmFactoryRegisterMpmCtxProfile(de_ctx, "app_proto_detect", 0);
 
     return;
 }
@@ -3229,6 +3719,59 @@ static void DetectEngineBuildDecoderEventSgh(DetectEngineCtx *de_ctx) {
     SigGroupHeadBuildMatchArray(de_ctx, de_ctx->decoder_event_sgh, max_idx);
 }
 
+/**
+ *  \brief Build the lookup structures for the final address and port
+ *         groups, used by SigMatchSignaturesGetSgh.
+ *
+ *  \param de_ctx detection engine ctx
+ *
+ *  \retval size memory used by the lookup structures
+ */
+static uint64_t SigAddressBuildLookups(DetectEngineCtx *de_ctx) {
+    uint64_t size = 0;
+    int f, proto, l, dl;
+
+    for (f = 0; f < FLOW_STATES; f++) {
+        for (proto = 0; proto < 256; proto++) {
+            DetectAddressHead *src_gh = de_ctx->flow_gh[f].src_gh[proto];
+            if (src_gh == NULL)
+                continue;
+
+            size += DetectAddressHeadBuildLookup(src_gh);
+
+            DetectAddress *src_lists[3] = { src_gh->any_head, src_gh->ipv4_head, src_gh->ipv6_head };
+            for (l = 0; l < 3; l++) {
+                DetectAddress *src_gr = src_lists[l];
+                for ( ; src_gr != NULL; src_gr = src_gr->next) {
+                    DetectAddressHead *dst_gh = src_gr->dst_gh;
+                    if (dst_gh == NULL)
+                        continue;
+
+                    size += DetectAddressHeadBuildLookup(dst_gh);
+
+                    DetectAddress *dst_lists[3] = { dst_gh->any_head, dst_gh->ipv4_head, dst_gh->ipv6_head };
+                    for (dl = 0; dl < 3; dl++) {
+                        DetectAddress *dst_gr = dst_lists[dl];
+                        for ( ; dst_gr != NULL; dst_gr = dst_gr->next) {
+                            if (!(dst_gr->flags & ADDRESS_HAVEPORT) || dst_gr->port == NULL)
+                                continue;
+
+                            size += DetectPortBuildLookup(dst_gr->port);
+
+                            DetectPort *sp = dst_gr->port;
+                            for ( ; sp != NULL; sp = sp->next) {
+                                size += DetectPortBuildLookup(sp->dst_ph);
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    return size;
+}
+
 int SigAddressPrepareStage3(DetectEngineCtx *de_ctx) {
     int r;
 
@@ -3310,6 +3853,9 @@ int SigAddressPrepareStage3(DetectEngineCtx *de_ctx) {
         }
     }
 
+    /* the groups are final now, set up the lookups */
+    uint64_t lookup_size = SigAddressBuildLookups(de_ctx);
+
     /* prepare the decoder event sgh */
     DetectEngineBuildDecoderEventSgh(de_ctx);
 
@@ -3335,6 +3881,7 @@ int SigAddressPrepareStage3(DetectEngineCtx *de_ctx) {
             de_ctx->mpm_unique ? de_ctx->mpm_memory_size / de_ctx->mpm_unique: 0);
 
         SCLogInfo("max sig id %" PRIu32 ", array size %" PRIu32 "", DetectEngineGetMaxSigId(de_ctx), DetectEngineGetMaxSigId(de_ctx) / 8 + 1);
+        SCLogInfo("address and port group lookup memory %" PRIu64 "", lookup_size);
         SCLogDebug("signature group heads: unique %" PRIu32 ", copies %" PRIu32 ".", de_ctx->gh_unique, de_ctx->gh_reuse);
         SCLogDebug("MPM instances: %" PRIu32 " unique, copies %" PRIu32 " (none %" PRIu32 ").",
                 de_ctx->mpm_unique, de_ctx->mpm_reuse, de_ctx->mpm_none);
@@ -3427,6 +3974,28 @@ void DbgSghContainsSig(DetectEngineCtx *de_ctx, SigGroupHead *sgh, uint32_t sid)
     printf("\n");
 }
 
+/**
+ * \internal
+ * \brief Memory used by the mpm ctxs of a sgh that aren't shared through
+ *        the mpm ctx factory.
+ */
+static uint64_t SigGroupHeadMpmCtxMemory(SigGroupHead *sgh)
+{
+    MpmCtx *ctxs[] = { sgh->mpm_ctx, sgh->mpm_stream_ctx, sgh->mpm_uri_ctx,
+                       sgh->mpm_hcbd_ctx, sgh->mpm_hhd_ctx, sgh->mpm_hrhd_ctx,
+                       sgh->mpm_hmd_ctx, sgh->mpm_hcd_ctx, sgh->mpm_http_ctx };
+    uint64_t memory = 0;
+    uint32_t i;
+
+    for (i = 0; i < sizeof(ctxs) / sizeof(ctxs[0]); i++) {
+        if (ctxs[i] == NULL || MpmFactoryIsMpmCtxAvailable(ctxs[i]))
+            continue;
+        memory += ctxs[i]->memory_size + sizeof(MpmCtx);
+    }
+
+    return memory;
+}
+
 /** \brief finalize preparing sgh's */
 int SigAddressPrepareStage4(DetectEngineCtx *de_ctx) {
     SCEnter();
@@ -3435,12 +4004,16 @@ int SigAddressPrepareStage4(DetectEngineCtx *de_ctx) {
 
     uint32_t idx = 0;
 
+    /* build the mpm ctxs of all sghs, in parallel if the matcher allows */
+    PatternMatchPrepareDeferred(de_ctx);
+
     for (idx = 0; idx < de_ctx->sgh_array_cnt; idx++) {
         SigGroupHead *sgh = de_ctx->sgh_array[idx];
         if (sgh == NULL)
             continue;
 
         SigGroupHeadBuildHeadArray(de_ctx, sgh);
+        de_ctx->mpm_sgh_ctx_memory_size += SigGroupHeadMpmCtxMemory(sgh);
     }
 
     if (de_ctx->decoder_event_sgh != NULL) {
@@ -3766,6 +4339,50 @@ int SigAddressPrepareStage5(DetectEngineCtx *de_ctx) {
     return 0;
 }
 
+/**
+ * \internal
+ * \brief Log the memory used by the mpm ctxs for the sgh-mpm-context in
+ *        use: the ctxs private to the sghs, the ones shared through the mpm
+ *        ctx factory and the pattern id filters of the sghs.
+ */
+static void SigGroupBuildReportMpmMemory(DetectEngineCtx *de_ctx)
+{
+    uint64_t shared = 0;
+    const char *mode = "full";
+
+    if (de_ctx->sgh_mpm_context != ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
+        int32_t profiles[] = { de_ctx->sgh_mpm_context_packet,
+                               de_ctx->sgh_mpm_context_stream,
+                               de_ctx->sgh_mpm_context_uri,
+                               de_ctx->sgh_mpm_context_hcbd,
+                               de_ctx->sgh_mpm_context_hhd,
+                               de_ctx->sgh_mpm_context_hrhd,
+                               de_ctx->sgh_mpm_context_hmd,
+                               de_ctx->sgh_mpm_context_hcd,
+                               de_ctx->sgh_mpm_context_http };
+        uint32_t i;
+
+        for (i = 0; i < sizeof(profiles) / sizeof(profiles[0]); i++) {
+            MpmCtx *mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, profiles[i]);
+            if (mpm_ctx != NULL)
+                shared += mpm_ctx->memory_size + sizeof(MpmCtx);
+        }
+
+        if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_SHARED)
+            mode = "shared";
+        else
+            mode = "single";
+    }
+
+    if (!(de_ctx->flags & DE_QUIET)) {
+        SCLogInfo("MPM memory with sgh-mpm-context %s: %" PRIu64 " (sgh ctxs %"
+                  PRIu64 ", shared ctxs %" PRIu64 ", sgh pattern filters %"
+                  PRIu32 ")", mode, de_ctx->mpm_sgh_ctx_memory_size + shared +
+                  de_ctx->mpm_filter_memory_size, de_ctx->mpm_sgh_ctx_memory_size,
+                  shared, de_ctx->mpm_filter_memory_size);
+    }
+}
+
 /**
  * \brief Convert the signature list into the runtime match structure.
  *
@@ -3775,12 +4392,15 @@ int SigAddressPrepareStage5(DetectEngineCtx *de_ctx) {
  * \retval 0 Always
  */
 int SigGroupBuild (DetectEngineCtx *de_ctx) {
-    /* if we are using single sgh_mpm_context then let us init the standard mpm
-     * contexts using the mpm_ctx factory */
-    if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_SINGLE) {
+    /* if we are using single or shared sgh_mpm_context then let us init the
+     * standard mpm contexts using the mpm_ctx factory */
+    if (de_ctx->sgh_mpm_context != ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
         SigInitStandardMpmFactoryContexts(de_ctx);
     }
 
+    /* the sgh mpm ctxs are prepared together in stage 4 */
+    de_ctx->mpm_prepare_defer = 1;
+
     if (SigAddressPrepareStage1(de_ctx) != 0) {
         SCLogError(SC_ERR_DETECT_PREPARE, "initializing the detection engine failed");
         exit(EXIT_FAILURE);
@@ -3850,57 +4470,27 @@ int SigGroupBuild (DetectEngineCtx *de_ctx) {
     }
 #endif
 
-    if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_SINGLE) {
-        MpmCtx *mpm_ctx = NULL;
-        mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx->sgh_mpm_context_packet);
-        if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
-        }
-        //printf("packet- %d\n", mpm_ctx->pattern_cnt);
-
-        mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx->sgh_mpm_context_uri);
-        if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
-        }
-        //printf("uri- %d\n", mpm_ctx->pattern_cnt);
-
-        mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx->sgh_mpm_context_hcbd);
-        if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
-        }
-        //printf("hcbd- %d\n", mpm_ctx->pattern_cnt);
-
-        mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx->sgh_mpm_context_hhd);
-        if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
-        }
-        //printf("hhd- %d\n", mpm_ctx->pattern_cnt);
-
-        mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx->sgh_mpm_context_hrhd);
-        if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
-        }
-        //printf("hrhd- %d\n", mpm_ctx->pattern_cnt);
+    if (de_ctx->sgh_mpm_context != ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
+        MpmCtx *ctxs[] = {
+            MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_packet),
+            MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_uri),
+            MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_hcbd),
+            MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_hhd),
+            MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_hrhd),
+            MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_hmd),
+            MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_hcd),
+            MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_stream),
+            de_ctx->http_mpm_combined ?
+                MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_http) : NULL,
+        };
 
-        mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx->sgh_mpm_context_hmd);
-        if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
-        }
-        //printf("hmd- %d\n", mpm_ctx->pattern_cnt);
-
-        mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx->sgh_mpm_context_hcd);
-        if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
-        }
-        //printf("hcd- %d\n", mpm_ctx->pattern_cnt);
-
-        mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx->sgh_mpm_context_stream);
-        if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
-        }
-        //printf("stream- %d\n", mpm_ctx->pattern_cnt);
+        /* ctxs that no sgh used were never initialized, MpmPrepareCtxs
+         * skips those as their matcher is not set */
+        MpmPrepareCtxs(ctxs, sizeof(ctxs) / sizeof(ctxs[0]), de_ctx->build_threads);
     }
 
+    SigGroupBuildReportMpmMemory(de_ctx);
+
 //    SigAddressPrepareStage5(de_ctx);
 //    DetectAddressPrintMemory();
 //    DetectSigGroupPrintMemory();
@@ -10230,6 +10820,548 @@ end:
     return result;
 }
 
+/** simple lcg, so the prefilter tests are repeatable */
+static uint32_t SigPrefilterTestRand(uint32_t *seed)
+{
+    *seed = (*seed * 1103515245 + 12345);
+    return ((*seed >> 16) & 0x7fff);
+}
+
+/**
+ * \brief Set up a sgh of random sigs and a det_ctx to run the match array
+ *        builders against.
+ *
+ * \param typical if set, like a real ruleset almost all sigs have a fast
+ *        pattern, otherwise all kinds of sigs are equally likely
+ *
+ * \retval sigs array of the sigs, NULL on error
+ */
+static Signature *SigPrefilterTestSetup(DetectEngineThreadCtx *det_ctx,
+        SigGroupHead *sgh, uint32_t sig_cnt, uint32_t pid_cnt, int typical,
+        uint32_t *seed)
+{
+    static const uint32_t fp_kinds[] = { 2, 3, 4, 5, 6, 7, 9 };
+    uint32_t i;
+
+    memset(det_ctx, 0, sizeof(DetectEngineThreadCtx));
+    memset(sgh, 0, sizeof(SigGroupHead));
+
+    Signature *sigs = SCMalloc(sig_cnt * sizeof(Signature));
+    sgh->match_array = SCMalloc(sig_cnt * sizeof(Signature *));
+    det_ctx->match_array = SCMalloc(sig_cnt * sizeof(Signature *));
+    det_ctx->de_state_sig_array = SCMalloc(sig_cnt);
+    det_ctx->prefilter_cand = SCMalloc(sig_cnt * sizeof(uint32_t));
+    det_ctx->pmq.pattern_id_bitarray = SCMalloc(pid_cnt / 8);
+    det_ctx->pmq.pattern_id_array = SCMalloc(pid_cnt * sizeof(uint32_t));
+    if (sigs == NULL || sgh->match_array == NULL || det_ctx->match_array == NULL ||
+        det_ctx->de_state_sig_array == NULL || det_ctx->prefilter_cand == NULL ||
+        det_ctx->pmq.pattern_id_bitarray == NULL || det_ctx->pmq.pattern_id_array == NULL)
+        return NULL;
+    memset(sigs, 0, sig_cnt * sizeof(Signature));
+
+    det_ctx->pmq.pattern_id_bitarray_size = pid_cnt / 8;
+    det_ctx->pmq.pattern_id_array_size = pid_cnt * sizeof(uint32_t);
+    det_ctx->de_state_sig_array_len = sig_cnt;
+    det_ctx->sgh = sgh;
+
+    for (i = 0; i < sig_cnt; i++) {
+        Signature *s = &sigs[i];
+        uint32_t r = SigPrefilterTestRand(seed);
+        uint32_t pid;
+
+        s->num = i;
+        /* mostly sigs with one or two mask bits */
+        s->mask = (1 << (r % 8)) | ((r & 0x100) ? (1 << ((r >> 3) % 8)) : 0);
+        if (r & 0x200) {
+            s->flags |= SIG_FLAG_APPLAYER;
+            s->alproto = SigPrefilterTestRand(seed) % (ALPROTO_DCERPC + 2);
+        }
+        if (typical ? ((r & 0x1c00) == 0x1c00) : (r & 0x400))
+            s->flags |= SIG_FLAG_DSIZE;
+        if (r & 0x800)
+            s->flags |= SIG_FLAG_STATE_MATCH;
+
+        r = SigPrefilterTestRand(seed);
+        pid = r % pid_cnt;
+        uint32_t kind = (r >> 6) % 10;
+        if (typical)
+            kind = ((r >> 6) % 32 == 0) ? 0 : fp_kinds[(r >> 11) % 7];
+        switch (kind) {
+            case 0:
+                break;
+            case 1:
+                s->flags |= (SIG_FLAG_MPM_PACKET|SIG_FLAG_MPM_PACKET_NEG);
+                break;
+            case 2:
+            case 3:
+                s->flags |= SIG_FLAG_MPM_PACKET;
+                break;
+            case 4:
+                s->flags |= SIG_FLAG_MPM_STREAM;
+                break;
+            case 5:
+                s->flags |= (SIG_FLAG_MPM_PACKET|SIG_FLAG_MPM_STREAM);
+                break;
+            case 6:
+                s->flags |= SIG_FLAG_MPM_URICONTENT;
+                break;
+            case 7:
+                s->flags |= (SIG_FLAG_MPM_URICONTENT|SIG_FLAG_MPM_HHDCONTENT|
+                             SIG_FLAG_MPM_HHDCONTENT_NEG);
+                break;
+            case 8:
+                s->flags |= (SIG_FLAG_MPM_HCBDCONTENT|SIG_FLAG_MPM_HCBDCONTENT_NEG);
+                break;
+            case 9:
+                s->flags |= SIG_FLAG_MPM_HCDCONTENT;
+                break;
+        }
+        s->mpm_pattern_id_div_8 = pid / 8;
+        s->mpm_pattern_id_mod_8 = 1 << (pid % 8);
+        s->mpm_stream_pattern_id_div_8 = pid / 8;
+        s->mpm_stream_pattern_id_mod_8 = 1 << (pid % 8);
+        s->mpm_http_pattern_id = pid;
+
+        sgh->match_array[i] = s;
+    }
+    sgh->sig_cnt = sig_cnt;
+
+    if (SigGroupHeadBuildHeadArray(NULL, sgh) < 0)
+        return NULL;
+
+    return sigs;
+}
+
+/**
+ * \brief randomize the packet dependent input of the match array builders
+ *
+ * \param density 1 in density pattern ids matched
+ */
+static void SigPrefilterTestShuffle(DetectEngineThreadCtx *det_ctx, Packet *p,
+        SignatureMask *mask, uint16_t *alproto, uint32_t density, uint32_t *seed)
+{
+    uint32_t i;
+
+    PmqReset(&det_ctx->pmq);
+    for (i = 0; i < det_ctx->pmq.pattern_id_bitarray_size * 8; i++) {
+        if (SigPrefilterTestRand(seed) % density == 0)
+            MpmVerifyMatch(NULL, &det_ctx->pmq, i);
+    }
+    for (i = 0; i < det_ctx->de_state_sig_array_len; i++)
+        det_ctx->de_state_sig_array[i] = SigPrefilterTestRand(seed) % 4;
+
+    p->flags = (SigPrefilterTestRand(seed) & 1) ? PKT_STREAM_ADD : 0;
+    *mask = SigPrefilterTestRand(seed) & 0xff;
+    *alproto = SigPrefilterTestRand(seed) % (ALPROTO_DCERPC + 2);
+}
+
+static void SigPrefilterTestCleanup(DetectEngineThreadCtx *det_ctx,
+        SigGroupHead *sgh, Signature *sigs)
+{
+    if (sigs != NULL)
+        SCFree(sigs);
+    if (sgh->match_array != NULL)
+        SCFree(sgh->match_array);
+    if (sgh->head_array != NULL)
+        SCFree(sgh->head_array);
+    SigGroupHeadFreePrefilter(sgh);
+    if (det_ctx->match_array != NULL)
+        SCFree(det_ctx->match_array);
+    if (det_ctx->de_state_sig_array != NULL)
+        SCFree(det_ctx->de_state_sig_array);
+    if (det_ctx->prefilter_cand != NULL)
+        SCFree(det_ctx->prefilter_cand);
+    PmqFree(&det_ctx->pmq);
+}
+
+/**
+ * \brief Compare the match arrays built by the prefilter and the sig by sig
+ *        reference, for random sigs and packets.
+ *
+ * \param index if set use the inverted pattern index only, and fail if
+ *        that doesn't work out
+ */
+static int SigPrefilterTestCompare(uint32_t sig_cnt, uint32_t pid_cnt,
+        int typical, uint32_t density, int index)
+{
+    DetectEngineThreadCtx det_ctx;
+    SigGroupHead sgh;
+    Packet p;
+    Signature **ref = NULL;
+    SignatureMask mask;
+    uint16_t alproto;
+    uint32_t seed = 1;
+    uint32_t matched = 0;
+    int result = 0;
+    int run;
+
+    memset(&p, 0, sizeof(Packet));
+
+    Signature *sigs = SigPrefilterTestSetup(&det_ctx, &sgh, sig_cnt, pid_cnt,
+                                            typical, &seed);
+    ref = SCMalloc(sig_cnt * sizeof(Signature *));
+    if (sigs == NULL || ref == NULL)
+        goto end;
+
+    for (run = 0; run < 200; run++) {
+        SigPrefilterTestShuffle(&det_ctx, &p, &mask, &alproto, density, &seed);
+        /* make sure the SMB -> DCERPC case is covered */
+        if (run % 10 == 0)
+            alproto = ALPROTO_SMB;
+
+        SigMatchSignaturesBuildMatchArrayScalar(NULL, &det_ctx, &p, mask, alproto);
+        SigIntId ref_cnt = det_ctx.match_array_cnt;
+        memcpy(ref, det_ctx.match_array, ref_cnt * sizeof(Signature *));
+
+        if (index) {
+            uint16_t alproto_alt = alproto;
+            if (alproto == ALPROTO_SMB || alproto == ALPROTO_SMB2)
+                alproto_alt = ALPROTO_DCERPC;
+
+            det_ctx.match_array_cnt = 0;
+            if (SigMatchSignaturesBuildMatchArrayIndex(&det_ctx, &p, mask,
+                        alproto, alproto_alt) != 0) {
+                printf("run %d: index not used: ", run);
+                goto end;
+            }
+        } else {
+            SigMatchSignaturesBuildMatchArray(NULL, &det_ctx, &p, mask, alproto);
+        }
+
+        if (det_ctx.match_array_cnt != ref_cnt) {
+            printf("run %d: %u sigs, expected %u: ", run,
+                    det_ctx.match_array_cnt, ref_cnt);
+            goto end;
+        }
+        if (memcmp(ref, det_ctx.match_array, ref_cnt * sizeof(Signature *)) != 0) {
+            printf("run %d: match array differs: ", run);
+            goto end;
+        }
+        matched += ref_cnt;
+    }
+
+    /* make sure the test isn't trivially passing */
+    if (matched == 0) {
+        printf("no sigs passed the prefilter in any run: ");
+        goto end;
+    }
+
+    result = 1;
+end:
+    if (ref != NULL)
+        SCFree(ref);
+    SigPrefilterTestCleanup(&det_ctx, &sgh, sigs);
+    return result;
+}
+
+/**
+ * \test Test that the prefilter builds the same match array as the sig by
+ *       sig reference. Half of the patterns match, so the sigs are
+ *       prefiltered in blocks. 1003 sigs so the last block is partial.
+ */
+static int SigTestPrefilter01(void)
+{
+    return SigPrefilterTestCompare(1003, 64, 0, 2, 0);
+}
+
+/**
+ * \test Test that the inverted pattern index builds the same match array
+ *       as the sig by sig reference, if few of the patterns match.
+ */
+static int SigTestPrefilter02(void)
+{
+    return SigPrefilterTestCompare(1003, 1024, 1, 64, 1);
+}
+
+/** \brief bitmask of the sids of the match array, 0 if it holds other sids */
+static uint32_t SigTestPrefilterEngineSids(DetectEngineThreadCtx *det_ctx)
+{
+    uint32_t sids = 0;
+    uint32_t i;
+
+    for (i = 0; i < det_ctx->match_array_cnt; i++) {
+        if (det_ctx->match_array[i]->id >= 32)
+            return 0;
+        sids |= 1 << det_ctx->match_array[i]->id;
+    }
+
+    return sids;
+}
+
+/**
+ * \test Test that sigs without a fast pattern are moved to the header
+ *       prefilter engines, and only end up in the match array for the
+ *       packets they can match.
+ */
+static int SigTestPrefilterEngine01(void)
+{
+    ThreadVars th_v;
+    DetectEngineThreadCtx *det_ctx = NULL;
+    DetectEngineCtx *de_ctx = NULL;
+    Packet *p = NULL;
+    uint8_t *buf = (uint8_t *)"0123456789";
+    char sig[128];
+    int result = 0;
+    int i;
+
+    memset(&th_v, 0, sizeof(th_v));
+
+    p = UTHBuildPacket(buf, strlen((char *)buf), IPPROTO_TCP);
+    if (p == NULL)
+        goto end;
+    p->ip4h->ip_ttl = 64;
+    p->tcph->th_flags = TH_SYN;
+
+    de_ctx = DetectEngineCtxInit();
+    if (de_ctx == NULL)
+        goto end;
+    de_ctx->flags |= DE_QUIET;
+
+    de_ctx->sig_list = SigInit(de_ctx, "alert tcp any any -> any any "
+                               "(flags:S; sid:1;)");
+    Signature *s = de_ctx->sig_list;
+    if (s == NULL)
+        goto end;
+    s = s->next = SigInit(de_ctx, "alert tcp any any -> any any "
+                          "(flags:A; sid:2;)");
+    if (s == NULL)
+        goto end;
+    s = s->next = SigInit(de_ctx, "alert tcp any any -> any any "
+                          "(dsize:>100; sid:3;)");
+    if (s == NULL)
+        goto end;
+    /* flowbits:set has to run whatever the flags are */
+    s = s->next = SigInit(de_ctx, "alert tcp any any -> any any "
+                          "(flowbits:set,pf; flags:A; sid:4;)");
+    if (s == NULL)
+        goto end;
+    /* flags:S is more selective than ttl:<10 */
+    s = s->next = SigInit(de_ctx, "alert tcp any any -> any any "
+                          "(ttl:<10; flags:S; sid:5;)");
+    if (s == NULL)
+        goto end;
+    /* enough pattern sigs for the match array to be built from the index */
+    for (i = 0; i < 40; i++) {
+        snprintf(sig, sizeof(sig), "alert tcp any any -> any any "
+                 "(content:\"nomatch%02d\"; sid:%d;)", i, 100 + i);
+        s = s->next = SigInit(de_ctx, sig);
+        if (s == NULL)
+            goto end;
+    }
+
+    SigGroupBuild(de_ctx);
+    DetectEngineThreadCtxInit(&th_v, (void *)de_ctx, (void *)&det_ctx);
+
+    SigMatchSignatures(&th_v, de_ctx, det_ctx, p);
+    if (!PacketAlertCheck(p, 1) || PacketAlertCheck(p, 2) ||
+        PacketAlertCheck(p, 3) || PacketAlertCheck(p, 5)) {
+        printf("syn: only sid 1 should alert: ");
+        goto end;
+    }
+
+    SigGroupHeadPrefilter *pf = &det_ctx->sgh->prefilter;
+    if (pf->always_cnt != 1 ||
+        pf->engine[SIG_PREFILTER_ENGINE_FLAGS].cnt != 256 ||
+        pf->engine[SIG_PREFILTER_ENGINE_DSIZE].cnt != 2 ||
+        pf->engine[SIG_PREFILTER_ENGINE_TTL].cnt != 0) {
+        printf("always %u, flags %u, dsize %u, ttl %u intervals: ",
+               pf->always_cnt, pf->engine[SIG_PREFILTER_ENGINE_FLAGS].cnt,
+               pf->engine[SIG_PREFILTER_ENGINE_DSIZE].cnt,
+               pf->engine[SIG_PREFILTER_ENGINE_TTL].cnt);
+        goto end;
+    }
+
+    /* sids 1 and 5 from the flags engine, sid 4 always */
+    if (SigTestPrefilterEngineSids(det_ctx) != ((1 << 1) | (1 << 4) | (1 << 5))) {
+        printf("syn: %u sigs in the match array, expected sids 1, 4, 5: ",
+               det_ctx->match_array_cnt);
+        goto end;
+    }
+
+    p->alerts.cnt = 0;
+    p->tcph->th_flags = TH_ACK;
+    SigMatchSignatures(&th_v, de_ctx, det_ctx, p);
+    if (PacketAlertCheck(p, 1) || !PacketAlertCheck(p, 2) ||
+        PacketAlertCheck(p, 3) || PacketAlertCheck(p, 5)) {
+        printf("ack: only sid 2 should alert: ");
+        goto end;
+    }
+    if (SigTestPrefilterEngineSids(det_ctx) != ((1 << 2) | (1 << 4))) {
+        printf("ack: %u sigs in the match array, expected sids 2, 4: ",
+               det_ctx->match_array_cnt);
+        goto end;
+    }
+
+    result = 1;
+end:
+    if (det_ctx != NULL)
+        DetectEngineThreadCtxDeinit(&th_v, (void *)det_ctx);
+    if (de_ctx != NULL) {
+        SigGroupCleanup(de_ctx);
+        SigCleanSignatures(de_ctx);
+        DetectEngineCtxFree(de_ctx);
+    }
+    if (p != NULL)
+        UTHFreePacket(p);
+    return result;
+}
+
+/**
+ * \test sgh-mpm-context shared: the sghs share a single mpm ctx, but the
+ *       pattern id filter of a sgh only keeps its own patterns.
+ */
+static int SigTestSharedMpm01(void)
+{
+    ThreadVars th_v;
+    DetectEngineThreadCtx *det_ctx = NULL;
+    DetectEngineCtx *de_ctx = NULL;
+    Packet *p = NULL;
+    uint8_t *buf = (uint8_t *)"one two three";
+    int result = 0;
+
+    memset(&th_v, 0, sizeof(th_v));
+
+    p = UTHBuildPacketSrcDstPorts(buf, strlen((char *)buf), IPPROTO_TCP, 1024, 80);
+    if (p == NULL)
+        goto end;
+
+    de_ctx = DetectEngineCtxInit();
+    if (de_ctx == NULL)
+        goto end;
+
+    de_ctx->flags |= DE_QUIET;
+    de_ctx->mpm_matcher = MPM_AC;
+    de_ctx->sgh_mpm_context = ENGINE_SGH_MPM_FACTORY_CONTEXT_SHARED;
+
+    de_ctx->sig_list = SigInit(de_ctx, "alert tcp any any -> any 80 "
+                               "(content:\"one\"; sid:1;)");
+    if (de_ctx->sig_list == NULL)
+        goto end;
+    de_ctx->sig_list->next = SigInit(de_ctx, "alert tcp any any -> any 8080 "
+                               "(content:\"two\"; sid:2;)");
+    if (de_ctx->sig_list->next == NULL)
+        goto end;
+
+    SigGroupBuild(de_ctx);
+    DetectEngineThreadCtxInit(&th_v, (void *)de_ctx, (void *)&det_ctx);
+
+    SigMatchSignatures(&th_v, de_ctx, det_ctx, p);
+    if (!PacketAlertCheck(p, 1) || PacketAlertCheck(p, 2)) {
+        printf("sid 1 should alert, sid 2 shouldn't: ");
+        goto end;
+    }
+
+    SigGroupHead *sgh = det_ctx->sgh;
+    if (sgh == NULL || sgh->mpm_ctx == NULL || sgh->mpm_pid_filter == NULL) {
+        printf("no sgh, mpm ctx or filter: ");
+        goto end;
+    }
+    if (sgh->mpm_ctx->pattern_cnt != 2) {
+        printf("shared ctx has %" PRIu32 " patterns, expected 2: ",
+               sgh->mpm_ctx->pattern_cnt);
+        goto end;
+    }
+
+    /* both patterns match, the filter only keeps the one of sid 1 */
+    PmqReset(&det_ctx->pmq);
+    mpm_table[sgh->mpm_ctx->mpm_type].Search(sgh->mpm_ctx, &det_ctx->mtc,
+            &det_ctx->pmq, buf, strlen((char *)buf));
+    if (det_ctx->pmq.pattern_id_array_cnt != 2) {
+        printf("search found %" PRIu32 " patterns, expected 2: ",
+               det_ctx->pmq.pattern_id_array_cnt);
+        goto end;
+    }
+    PmqFilter(&det_ctx->pmq, sgh->mpm_pid_filter, sgh->mpm_pid_filter_size);
+    if (det_ctx->pmq.pattern_id_array_cnt != 1 ||
+        !(det_ctx->pmq.pattern_id_bitarray[de_ctx->sig_list->mpm_pattern_id_div_8] &
+          de_ctx->sig_list->mpm_pattern_id_mod_8)) {
+        printf("filter kept %" PRIu32 " patterns, expected only sid 1's: ",
+               det_ctx->pmq.pattern_id_array_cnt);
+        goto end;
+    }
+    PmqReset(&det_ctx->pmq);
+
+    result = 1;
+end:
+    if (det_ctx != NULL)
+        DetectEngineThreadCtxDeinit(&th_v, (void *)det_ctx);
+    if (de_ctx != NULL) {
+        SigGroupCleanup(de_ctx);
+        SigCleanSignatures(de_ctx);
+        DetectEngineCtxFree(de_ctx);
+    }
+    if (p != NULL)
+        UTHFreePacket(p);
+    return result;
+}
+
+/** Uncomment this if you want stats
+ *  #define ENABLE_PREFILTER_STATS 1
+ */
+
+#ifdef ENABLE_PREFILTER_STATS
+
+/* Number of packets to build a match array for (for stats) */
+#define PREFILTER_STATS_TIMES 100000
+
+/** \param density 1 in density pattern ids matched */
+static void SigPrefilterStatsRun(uint32_t sig_cnt, uint32_t density)
+{
+    DetectEngineThreadCtx det_ctx;
+    SigGroupHead sgh;
+    Packet p;
+    SignatureMask mask;
+    uint16_t alproto;
+    uint32_t seed = 1;
+    int i;
+
+    memset(&p, 0, sizeof(Packet));
+
+    Signature *sigs = SigPrefilterTestSetup(&det_ctx, &sgh, sig_cnt, 4096, 1, &seed);
+    if (sigs == NULL)
+        goto end;
+    SigPrefilterTestShuffle(&det_ctx, &p, &mask, &alproto, density, &seed);
+
+    printf("%u sigs, 1/%u patterns matched, sig by sig: ", sig_cnt, density);
+    CLOCK_INIT;
+    CLOCK_START;
+    for (i = 0; i < PREFILTER_STATS_TIMES; i++) {
+        SigMatchSignaturesBuildMatchArrayScalar(NULL, &det_ctx, &p, mask, alproto);
+    }
+    CLOCK_END;
+    CLOCK_PRINT_SEC;
+
+    printf("%u sigs, 1/%u patterns matched, prefilter: ", sig_cnt, density);
+    CLOCK_START;
+    for (i = 0; i < PREFILTER_STATS_TIMES; i++) {
+        SigMatchSignaturesBuildMatchArray(NULL, &det_ctx, &p, mask, alproto);
+    }
+    CLOCK_END;
+    CLOCK_PRINT_SEC;
+
+end:
+    SigPrefilterTestCleanup(&det_ctx, &sgh, sigs);
+}
+
+/**
+ * \test Stats: match array building for sghs of 1k, 10k and 30k sigs,
+ *       sig by sig versus the prefilter. With many pattern matches the
+ *       sigs are prefiltered in blocks, with few the inverted pattern index
+ *       is used.
+ */
+static int SigTestPrefilterStats01(void)
+{
+    SigPrefilterStatsRun(1000, 2);
+    SigPrefilterStatsRun(10000, 2);
+    SigPrefilterStatsRun(30000, 2);
+    SigPrefilterStatsRun(1000, 512);
+    SigPrefilterStatsRun(10000, 512);
+    SigPrefilterStatsRun(30000, 512);
+    return 1;
+}
+
+#endif /* ENABLE_PREFILTER_STATS */
+
 #endif /* UNITTESTS */
 
 void SigRegisterTests(void) {
@@ -10437,6 +11569,14 @@ void SigRegisterTests(void) {
     UtRegisterTest("SigTestDropFlow03", SigTestDropFlow03, 1);
     UtRegisterTest("SigTestDropFlow04", SigTestDropFlow04, 1);
 
+    UtRegisterTest("SigTestPrefilter01", SigTestPrefilter01, 1);
+    UtRegisterTest("SigTestPrefilter02", SigTestPrefilter02, 1);
+    UtRegisterTest("SigTestPrefilterEngine01", SigTestPrefilterEngine01, 1);
+    UtRegisterTest("SigTestSharedMpm01", SigTestSharedMpm01, 1);
+#ifdef ENABLE_PREFILTER_STATS
+    UtRegisterTest("SigTestPrefilterStats01", SigTestPrefilterStats01, 1);
+#endif
+
 #endif /* UNITTESTS */
 }
 
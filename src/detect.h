@@ -151,11 +151,32 @@ typedef struct DetectAddress_ {
     uint32_t cnt;
 } DetectAddress;
 
+/** sorted lookup array entry for an ipv4 address group */
+typedef struct DetectAddressLookupIPv4_ {
+    uint32_t ip;    /**< address in host order, start of range */
+    uint32_t ip2;   /**< address in host order, end of range */
+    DetectAddress *ag;
+} DetectAddressLookupIPv4;
+
+/** sorted lookup array entry for an ipv6 address group */
+typedef struct DetectAddressLookupIPv6_ {
+    uint32_t ip[4];     /**< address in host order, start of range */
+    uint32_t ip2[4];    /**< address in host order, end of range */
+    DetectAddress *ag;
+} DetectAddressLookupIPv6;
+
 /** Signature grouping head. Here 'any', ipv4 and ipv6 are split out */
 typedef struct DetectAddressHead_ {
     DetectAddress *any_head;
     DetectAddress *ipv4_head;
     DetectAddress *ipv6_head;
+
+    /** ipv4 and ipv6 groups sorted for a binary search lookup. Only set
+     *  once the grouping is final, see DetectAddressHeadBuildLookup. */
+    DetectAddressLookupIPv4 *ipv4_lookup;
+    DetectAddressLookupIPv6 *ipv6_lookup;
+    uint32_t ipv4_lookup_cnt;
+    uint32_t ipv6_lookup_cnt;
 } DetectAddressHead;
 
 typedef struct DetectMatchAddressIPv4_ {
@@ -189,6 +210,19 @@ enum {
 #define PORT_SIGGROUPHEAD_COPY  0x04 /**< sgh is a ptr copy */
 #define PORT_GROUP_PORTS_COPY   0x08 /**< dst_ph is a ptr copy */
 
+/** lists with at least this many groups get a direct port table */
+#define DETECT_PORT_LOOKUP_TABLE_MIN_GROUPS 8
+
+/** \brief lookup structure hung off the head of a final port group list */
+typedef struct DetectPortGroupLookup_ {
+    /** groups sorted by port, for the binary search */
+    struct DetectPort_ **array;
+    /** direct table indexed by port, holding the array idx + 1 of the
+     *  group or 0 if no group has the port. NULL for small lists. */
+    uint16_t *table;
+    uint32_t cnt;
+} DetectPortGroupLookup;
+
 /** \brief Port structure for detection engine */
 typedef struct DetectPort_ {
     uint16_t port;
@@ -208,6 +242,10 @@ typedef struct DetectPort_ {
 
     uint32_t cnt;
     uint8_t flags;  /**< flags for this port */
+
+    /** lookup structure, only set on the head of a final group list,
+     *  see DetectPortBuildLookup */
+    DetectPortGroupLookup *lookup;
 } DetectPort;
 
 /* Signature flags */
@@ -333,6 +371,85 @@ typedef struct SignatureHeader_ {
     struct Signature_ *full_sig;
 } SignatureHeader;
 
+/** number of signatures the match array builder prefilters at once, the
+ *  SigGroupHeadPrefilter arrays are padded to a multiple of it */
+#define SIG_PREFILTER_BLOCK 32
+
+/** the match array is built from the inverted pattern index as long as
+ *  there are no more candidates than 1 in SIG_PREFILTER_INDEX_RATIO sigs of
+ *  the sgh, otherwise all sigs are prefiltered in blocks */
+#define SIG_PREFILTER_INDEX_RATIO 4
+
+/** packet header fields with a prefilter engine, see
+ *  SigGroupHeadPrefilterEngine */
+enum {
+    SIG_PREFILTER_ENGINE_FLAGS = 0,
+    SIG_PREFILTER_ENGINE_TTL,
+    SIG_PREFILTER_ENGINE_ITYPE,
+    SIG_PREFILTER_ENGINE_ICODE,
+    SIG_PREFILTER_ENGINE_DSIZE,
+    SIG_PREFILTER_ENGINE_WINDOW,
+    SIG_PREFILTER_ENGINE_ICMP_ID,
+    SIG_PREFILTER_ENGINE_ACK,
+    SIG_PREFILTER_ENGINE_SEQ,
+
+    SIG_PREFILTER_ENGINE_MAX,
+};
+
+/** \brief Prefilter engine of a header keyword: the sigs without a fast
+ *         pattern that need the keyword to match, by value of the header
+ *         field.
+ *
+ *  The values of the field are split in cnt intervals, interval i runs from
+ *  start[i] up to start[i + 1] - 1 and the sig indexes that can match in
+ *  it are sigs[offset[i]] up to sigs[offset[i + 1]]. For the 8 bit fields
+ *  start is NULL: there are 256 intervals of a single value. */
+typedef struct SigGroupHeadPrefilterEngine_ {
+    uint32_t cnt;
+    uint32_t *start;
+    uint32_t *offset;
+    uint32_t *sigs;
+} SigGroupHeadPrefilterEngine;
+
+/** \brief The prefilter fields of the signatures in a sgh as parallel
+ *         arrays, indexed like SigGroupHead::head_array. The mask and
+ *         alproto checks are done for SIG_PREFILTER_BLOCK signatures at a
+ *         time (SSE2/AVX2 if available), only the signatures that pass
+ *         have their mpm pattern ids checked.
+ *
+ *  The pattern a sig needs from the packet, stream or http mpm is stored
+ *  as byte offset and bit in the pmq bitarray. Bit 0 means the sig has no
+ *  such requirement (no fast pattern in that buffer or a negated one). */
+typedef struct SigGroupHeadPrefilter_ {
+    SignatureMask *mask;
+    /** alproto the sig needs, ALPROTO_UNKNOWN if it doesn't care */
+    uint16_t *alproto;
+
+    uint16_t *mpm_packet_byte;
+    uint8_t *mpm_packet_bit;
+    uint16_t *mpm_stream_byte;
+    uint8_t *mpm_stream_bit;
+    uint16_t *mpm_http_byte;
+    uint8_t *mpm_http_bit;
+
+    /** inverted index of the fast patterns: the sorted pattern ids used by
+     *  the sigs of the sgh, for pid[i] the sig indexes that need it are
+     *  pid_sigs[pid_offset[i]] up to pid_sigs[pid_offset[i + 1]] */
+    uint32_t pid_cnt;
+    uint32_t *pid;
+    uint32_t *pid_offset;
+    uint32_t *pid_sigs;
+
+    /** sigs that are inspected whatever the pattern matches are: no fast
+     *  pattern, a negated one or dsize, and no header prefilter engine */
+    uint32_t always_cnt;
+    uint32_t *always;
+
+    /** the sigs that would otherwise be always inspected, by the header
+     *  keyword they need */
+    SigGroupHeadPrefilterEngine engine[SIG_PREFILTER_ENGINE_MAX];
+} SigGroupHeadPrefilter;
+
 /** \brief a single match condition for a signature */
 typedef struct SigMatch_ {
     uint16_t idx; /**< position in the signature */
@@ -470,8 +587,10 @@ typedef struct Signature_ {
 } Signature;
 
 typedef struct DetectEngineIPOnlyThreadCtx_ {
-    uint8_t *sig_match_array; /* bit array of sig nums */
-    uint32_t sig_match_size;  /* size in bytes of the array */
+    /* non zero words of the src and dst sig num intersection */
+    uint64_t *match_words;
+    uint32_t *match_idx;    /* word index of each of the match_words */
+    uint32_t match_size;    /* size in words of the arrays */
 } DetectEngineIPOnlyThreadCtx;
 
 /** \brief IP only rules matching ctx.
@@ -525,24 +644,33 @@ typedef struct MpmPatternIdStore_ {
     uint32_t shared_patterns;
 } MpmPatternIdStore;
 
-/** \brief threshold ctx */
+/** \brief threshold ctx
+ *
+ *  The entries of all tracking types live in a single chained hash.
+ *  Row i is guarded by locks[i % THRESHOLD_HASH_LOCKS], so detect
+ *  threads only serialize when they update entries that map to the
+ *  same lock. */
 typedef struct ThresholdCtx_    {
-    HashListTable *threshold_hash_table_dst;        /**< Ipv4 dst hash table */
-    HashListTable *threshold_hash_table_src;        /**< Ipv4 src hash table */
-    HashListTable *threshold_hash_table_dst_ipv6;   /**< Ipv6 dst hash table */
-    HashListTable *threshold_hash_table_src_ipv6;   /**< Ipv6 src hash table */
-    SCMutex threshold_table_lock;                   /**< Mutex for hash table */
+    DetectThresholdEntry **rows;    /**< THRESHOLD_HASH_SIZE entry chains */
+    SCMutex *locks;                 /**< THRESHOLD_HASH_LOCKS row locks */
+
+    /** next row the incremental timeout pass looks at */
+    SC_ATOMIC_DECLARE(unsigned int, prune_row);
 
     /** to support rate_filter "by_rule" option */
     DetectThresholdEntry **th_entry;
     uint32_t th_size;
 } ThresholdCtx;
 
-/** \brief tag ctx */
+/** \brief tag ctx
+ *
+ *  Tagged hosts of both ip versions live in one chained hash. Row i
+ *  is guarded by locks[i % TAG_HASH_LOCKS]. */
 typedef struct DetectTagHostCtx_ {
-    HashListTable *tag_hash_table_ipv4;   /**< Ipv4 hash table      */
-    HashListTable *tag_hash_table_ipv6;   /**< Ipv6 hash table      */
-    SCMutex lock;                         /**< Mutex for the ctx    */
+    struct DetectTagDataEntryList_ **rows; /**< TAG_HASH_SIZE host chains */
+    SCMutex *locks;                       /**< TAG_HASH_LOCKS row locks */
+    SCMutex prune_lock;                   /**< Held by the thread doing the
+                                               timeout pass */
     struct timeval last_ts;               /**< Last time the ctx was pruned */
 } DetectTagHostCtx;
 
@@ -597,6 +725,34 @@ typedef struct DetectEngineCtx_ {
 
     /* memory counters */
     uint32_t mpm_memory_size;
+    /** memory of the sgh pattern id filters (sgh-mpm-context shared) */
+    uint32_t mpm_filter_memory_size;
+    /** memory of the mpm ctxs private to a sgh (sgh-mpm-context full) */
+    uint64_t mpm_sgh_ctx_memory_size;
+
+    /** while set, PatternMatchPrepareGroup queues the sgh mpm ctxs in
+     *  mpm_prepare_list instead of preparing them right away, so they can
+     *  be prepared in parallel by PatternMatchPrepareDeferred */
+    uint8_t mpm_prepare_defer;
+    MpmCtx **mpm_prepare_list;
+    uint32_t mpm_prepare_cnt;
+    uint32_t mpm_prepare_size;
+    /** max threads used to prepare the mpm ctxs, 0 for one per cpu */
+    uint16_t build_threads;
+
+    /** version of the engine, bumped by each rule reload. Flows and their
+     *  de_state record the version their sgh and sig ids belong to */
+    uint32_t version;
+    /** detect threads using the engine, plus one while it is the current
+     *  engine. Protected by the engine master lock */
+    uint32_t ref_cnt;
+    /** time it took to load the rules and build the engine, in ms */
+    uint64_t build_time_ms;
+    /** when the last user released the engine after it was replaced by a
+     *  reload, and the next engine on the list of replaced engines waiting
+     *  to be freed */
+    struct timeval released_ts;
+    struct DetectEngineCtx_ *replaced_next;
 
     DetectEngineIPOnlyCtx io_ctx;
     ThresholdCtx ths_ctx;
@@ -636,10 +792,20 @@ typedef struct DetectEngineCtx_ {
     /* specify the configuration for mpm context factory */
     uint8_t sgh_mpm_context;
 
+    /** run all http buffers of a sgh through a single combined mpm */
+    uint8_t http_mpm_combined;
+
+    /** pattern id -> http buffer tag table used by the combined http mpm */
+    uint8_t *mpm_http_pid_tags;
+    uint32_t mpm_http_pid_tags_size;
+
     /** hash table for looking up patterns for
      *  id sharing and id tracking. */
     MpmPatternIdStore *mpm_pattern_id_store;
 
+    /* mpm ctx factory profiles, used with sgh-mpm-context single or shared */
+    MpmCtxFactoryContainer *mpm_ctx_factory_container;
+
     /* maximum recursion depth for content inspection */
     int inspection_recursion_limit;
 
@@ -660,6 +826,7 @@ typedef struct DetectEngineCtx_ {
     int32_t sgh_mpm_context_hrhd;
     int32_t sgh_mpm_context_hmd;
     int32_t sgh_mpm_context_hcd;
+    int32_t sgh_mpm_context_http;
     int32_t sgh_mpm_context_app_proto_detect;
 
     /** sgh for signatures that match against invalid packets. In those cases
@@ -681,9 +848,47 @@ enum {
 enum {
     ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL,
     ENGINE_SGH_MPM_FACTORY_CONTEXT_SINGLE,
+    /** single ctxs plus a pattern id filter per sgh */
+    ENGINE_SGH_MPM_FACTORY_CONTEXT_SHARED,
     ENGINE_SGH_MPM_FACTORY_CONTEXT_AUTO
 };
 
+/** max number of buffers handed to the combined http mpm in one call */
+#define DETECT_HTTP_MPM_SEGS_MAX    48
+
+/** bounds of the content inspection fail memo size, powers of 2. The memo
+ *  is sized to twice the inspection budget within these */
+#define DETECT_ENGINE_INSPECTION_MEMO_MIN   1024
+#define DETECT_ENGINE_INSPECTION_MEMO_MAX   65536
+/** slots probed in the fail memo before giving up on a lookup or store */
+#define DETECT_ENGINE_INSPECTION_MEMO_PROBE 16
+
+/** sigmatch, by its position in the list, that is known not to match
+ *  at a certain payload_offset. Valid if gen equals the inspection
+ *  generation of the thread */
+typedef struct DetectEngineInspectionMemo_ {
+    uint32_t gen;
+    uint32_t offset;
+    uint16_t pos;
+} DetectEngineInspectionMemo;
+
+/** sigmatch on the path of the content inspection */
+typedef struct DetectEngineInspectionFrame_ {
+    SigMatch *sm;
+    /** payload_offset when the sigmatch was entered */
+    uint32_t entry_offset;
+    /** where to continue looking for the next occurence of a content
+     *  or pcre if the sigmatches after it don't match */
+    uint32_t prev_payload_offset;
+    uint32_t prev_offset;
+    uint8_t retry;
+    /** for sigmatches that fail at every offset after one they failed at,
+     *  the lowest such offset. Valid if fail_gen equals the inspection
+     *  generation of the thread */
+    uint32_t fail_gen;
+    uint32_t fail_offset;
+} DetectEngineInspectionFrame;
+
 /**
   * Detection engine thread data.
   */
@@ -698,6 +903,10 @@ typedef struct DetectionEngineThreadCtx_ {
     uint32_t payload_offset;
     /* used by pcre match function alone */
     uint32_t pcre_match_start_offset;
+#ifdef PCRE_HAVE_JIT
+    /* stack of the JIT compiled pcre regexes */
+    pcre_jit_stack *jit_stack;
+#endif
 
     /* http_uri stuff for uricontent */
     //char de_have_httpuri;
@@ -718,20 +927,41 @@ typedef struct DetectionEngineThreadCtx_ {
     uint8_t **hcbd_buffers;
     uint32_t *hcbd_buffers_len;
     uint16_t hcbd_buffers_list_len;
+    /** scratch pmq for the resumed hcbd mpm */
+    PatternMatcherQueue hcbd_pmq;
 
     uint8_t **hhd_buffers;
     uint32_t *hhd_buffers_len;
     uint16_t hhd_buffers_list_len;
 
+    /** buffer list for the combined http mpm */
+    MpmBufferSegment http_mpm_segs[DETECT_HTTP_MPM_SEGS_MAX];
+
     /** id for alert counter */
     uint16_t counter_alerts;
+    /** ids for the engine counters: version in use, its build time and
+     *  when this thread swapped to it */
+    uint16_t counter_engine_version;
+    uint16_t counter_engine_build_time;
+    uint16_t counter_engine_swap_time;
 
     /* used to discontinue any more matching */
     uint16_t discontinue_matching;
     uint16_t flags;
 
-    /* holds the current recursion depth on content inspection */
+    /* number of sigmatches inspected for the current buffer, bounded by
+     * de_ctx->inspection_recursion_limit */
     int inspection_recursion_counter;
+    /** id for the counter of inspections that ran out of budget */
+    uint16_t counter_inspection_budget;
+
+    /** path of the content inspection, one frame per sigmatch */
+    DetectEngineInspectionFrame *inspection_frames;
+    uint16_t inspection_frames_size;
+    /** sigmatch/offset pairs that failed during the current inspection */
+    DetectEngineInspectionMemo *inspection_memo;
+    uint32_t inspection_memo_size;
+    uint32_t inspection_memo_gen;
 
     /* dce stub data */
     uint8_t *dce_stub_data;
@@ -754,6 +984,10 @@ typedef struct DetectionEngineThreadCtx_ {
     SigIntId de_state_sig_array_len;
     uint8_t *de_state_sig_array;
 
+    /** candidate sig indexes when building the match array from the
+     *  inverted pattern index, match_array_len entries */
+    uint32_t *prefilter_cand;
+
     struct SigGroupHead_ *sgh;
     /** pointer to the current mpm ctx that is stored
      *  in a rule group head -- can be either a content
@@ -831,6 +1065,7 @@ typedef struct SigTableElmt_ {
 #define SIG_GROUP_HEAD_MPM_HMD          0x00040000
 #define SIG_GROUP_HEAD_MPM_HCD          0x00080000
 #define SIG_GROUP_HEAD_REFERENCED       0x00100000 /**< sgh is being referenced by others, don't clear */
+#define SIG_GROUP_HEAD_MPM_HTTP         0x00200000 /**< http buffers use the combined mpm_http_ctx */
 
 typedef struct SigGroupHeadInitData_ {
     /* list of content containers
@@ -866,6 +1101,8 @@ typedef struct SigGroupHead_ {
      *  signature ordered as an array. Used to pre-filter the
      *  signatures to be inspected in a cache efficient way. */
     SignatureHeader *head_array;
+    /** prefilter fields of head_array as parallel arrays */
+    SigGroupHeadPrefilter prefilter;
 
     /* pattern matcher instances */
     MpmCtx *mpm_ctx;
@@ -876,6 +1113,14 @@ typedef struct SigGroupHead_ {
     MpmCtx *mpm_hrhd_ctx;
     MpmCtx *mpm_hmd_ctx;
     MpmCtx *mpm_hcd_ctx;
+    /** combined ctx for all http buffers (SIG_GROUP_HEAD_MPM_HTTP) */
+    MpmCtx *mpm_http_ctx;
+
+    /** with sgh-mpm-context shared the ctxs above are shared by all sghs,
+     *  this bitarray has the pattern ids of our own sigs set. The pmq is
+     *  filtered with it after the searches. */
+    uint8_t *mpm_pid_filter;
+    uint32_t mpm_pid_filter_size;
 
     uint16_t mpm_streamcontent_maxlen;
     uint16_t mpm_uricontent_maxlen;
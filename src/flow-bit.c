@@ -24,11 +24,11 @@
  * but called that way because of Snort's flowbits.
  * It's a binary storage.
  *
- * \todo move away from a linked list implementation
- * \todo use different datatypes, such as string, int, etc.
- * \todo have more than one instance of the same var, and be able to match on a
- *       specific one, or one all at a time. So if a certain capture matches
- *       multiple times, we can operate on all of them.
+ * The bits live in an array of words in the flow, with a bit for each
+ * flowbit name idx. The array is sized to the number of flowbit names
+ * at the time the flow first uses it, and grows when a rule reload
+ * added names since. Like the var list, the array is protected by the
+ * flow mutex, as more than one detect thread can handle a flow.
  */
 
 #include "suricata-common.h"
@@ -39,84 +39,65 @@
 #include "flow-private.h"
 #include "detect.h"
 #include "util-var.h"
+#include "util-var-name.h"
 #include "util-debug.h"
 #include "util-unittest.h"
 
-/* get the flowbit with idx from the flow */
-static FlowBit *FlowBitGet(Flow *f, uint16_t idx) {
-    GenericVar *gv = f->flowvar;
-    for ( ; gv != NULL; gv = gv->next) {
-        if (gv->type == DETECT_FLOWBITS && gv->idx == idx) {
-            return (FlowBit *)gv;
-        }
-    }
+#define FLOWBITS_WORD(idx)  ((idx) >> 5)
+#define FLOWBITS_BIT(idx)   ((uint32_t)1 << ((idx) & 31))
 
-    return NULL;
+/**
+ *  \brief Make sure the flowbits array of the flow can hold idx
+ *
+ *  \warning flow mutex must be held
+ *
+ *  \retval 0 ok
+ *  \retval -1 allocation failed, the bit can't be stored
+ */
+static int FlowBitsGrow(Flow *f, uint16_t idx) {
+    uint16_t max_idx = VariableNameGetMaxIdx(DETECT_FLOWBITS);
+    if (max_idx < idx)
+        max_idx = idx;
+
+    uint16_t size = FLOWBITS_WORD(max_idx) + 1;
+    uint32_t *bits = SCRealloc(f->flowbits, size * sizeof(uint32_t));
+    if (bits == NULL)
+        return -1;
+
+    memset(bits + f->flowbits_size, 0, (size - f->flowbits_size) * sizeof(uint32_t));
+    f->flowbits = bits;
+    f->flowbits_size = size;
+    return 0;
 }
 
-/* add a flowbit to the flow */
-static void FlowBitAdd(Flow *f, uint16_t idx) {
-    FlowBit *fb = FlowBitGet(f, idx);
-    if (fb == NULL) {
-        fb = SCMalloc(sizeof(FlowBit));
-        if (fb == NULL)
-            return;
-
-        fb->type = DETECT_FLOWBITS;
-        fb->idx = idx;
-        fb->next = NULL;
-        GenericVarAppend(&f->flowvar, (GenericVar *)fb);
-
-        //printf("FlowBitAdd: adding flowbit with idx %" PRIu32 "\n", idx);
-#ifdef FLOWBITS_STATS
-        SCMutexLock(&flowbits_mutex);
-        flowbits_added++;
-        flowbits_memuse += sizeof(FlowBit);
-        if (flowbits_memuse > flowbits_memuse_max)
-            flowbits_memuse_max = flowbits_memuse;
-        SCMutexUnlock(&flowbits_mutex);
-#endif /* FLOWBITS_STATS */
-    }
-}
+/** \warning flow mutex must be held */
+static int FlowBitIssetLocked(Flow *f, uint16_t idx) {
+    if (FLOWBITS_WORD(idx) >= f->flowbits_size)
+        return 0;
 
-static void FlowBitRemove(Flow *f, uint16_t idx) {
-    FlowBit *fb = FlowBitGet(f, idx);
-    if (fb == NULL)
-        return;
-
-    GenericVarRemove(&f->flowvar, (GenericVar *)fb);
-
-    //printf("FlowBitRemove: remove flowbit with idx %" PRIu32 "\n", idx);
-#ifdef FLOWBITS_STATS
-    SCMutexLock(&flowbits_mutex);
-    flowbits_removed++;
-    if (flowbits_memuse >= sizeof(FlowBit))
-        flowbits_memuse -= sizeof(FlowBit);
-    else {
-        printf("ERROR: flowbits memory usage going below 0!\n");
-        flowbits_memuse = 0;
-    }
-    SCMutexUnlock(&flowbits_mutex);
-#endif /* FLOWBITS_STATS */
+    return (f->flowbits[FLOWBITS_WORD(idx)] & FLOWBITS_BIT(idx)) ? 1 : 0;
 }
 
 void FlowBitSet(Flow *f, uint16_t idx) {
     SCMutexLock(&f->m);
 
-    FlowBit *fb = FlowBitGet(f, idx);
-    if (fb == NULL) {
-        FlowBitAdd(f, idx);
-    }
+    if (FLOWBITS_WORD(idx) >= f->flowbits_size && FlowBitsGrow(f, idx) < 0)
+        goto end;
 
+    if (!FlowBitIssetLocked(f, idx)) {
+        f->flowbits[FLOWBITS_WORD(idx)] |= FLOWBITS_BIT(idx);
+        f->flowbits_cnt++;
+    }
+end:
     SCMutexUnlock(&f->m);
 }
 
 void FlowBitUnset(Flow *f, uint16_t idx) {
     SCMutexLock(&f->m);
 
-    FlowBit *fb = FlowBitGet(f, idx);
-    if (fb != NULL) {
-        FlowBitRemove(f, idx);
+    if (FlowBitIssetLocked(f, idx)) {
+        f->flowbits[FLOWBITS_WORD(idx)] &= ~FLOWBITS_BIT(idx);
+        f->flowbits_cnt--;
     }
 
     SCMutexUnlock(&f->m);
@@ -125,59 +106,42 @@ void FlowBitUnset(Flow *f, uint16_t idx) {
 void FlowBitToggle(Flow *f, uint16_t idx) {
     SCMutexLock(&f->m);
 
-    FlowBit *fb = FlowBitGet(f, idx);
-    if (fb != NULL) {
-        FlowBitRemove(f, idx);
-    } else {
-        FlowBitAdd(f, idx);
-    }
+    if (FLOWBITS_WORD(idx) >= f->flowbits_size && FlowBitsGrow(f, idx) < 0)
+        goto end;
 
+    if (FlowBitIssetLocked(f, idx))
+        f->flowbits_cnt--;
+    else
+        f->flowbits_cnt++;
+    f->flowbits[FLOWBITS_WORD(idx)] ^= FLOWBITS_BIT(idx);
+end:
     SCMutexUnlock(&f->m);
 }
 
 int FlowBitIsset(Flow *f, uint16_t idx) {
-    int r = 0;
     SCMutexLock(&f->m);
-
-    FlowBit *fb = FlowBitGet(f, idx);
-    if (fb != NULL) {
-        r = 1;
-    }
-
+    int r = FlowBitIssetLocked(f, idx);
     SCMutexUnlock(&f->m);
     return r;
 }
 
 int FlowBitIsnotset(Flow *f, uint16_t idx) {
-    int r = 0;
-    SCMutexLock(&f->m);
-
-    FlowBit *fb = FlowBitGet(f, idx);
-    if (fb == NULL) {
-        r = 1;
-    }
-
-    SCMutexUnlock(&f->m);
-    return r;
+    return FlowBitIsset(f, idx) ? 0 : 1;
 }
 
-void FlowBitFree(FlowBit *fb) {
-    if (fb == NULL)
-        return;
-
-    SCFree(fb);
+/** \brief clear all bits, keeping the array for the next use of the flow */
+void FlowBitsReset(Flow *f) {
+    if (f->flowbits != NULL)
+        memset(f->flowbits, 0, f->flowbits_size * sizeof(uint32_t));
+    f->flowbits_cnt = 0;
+}
 
-#ifdef FLOWBITS_STATS
-    SCMutexLock(&flowbits_mutex);
-    flowbits_removed++;
-    if (flowbits_memuse >= sizeof(FlowBit))
-        flowbits_memuse -= sizeof(FlowBit);
-    else {
-        printf("ERROR: flowbits memory usage going below 0!\n");
-        flowbits_memuse = 0;
-    }
-    SCMutexUnlock(&flowbits_mutex);
-#endif /* FLOWBITS_STATS */
+void FlowBitsFree(Flow *f) {
+    if (f->flowbits != NULL)
+        SCFree(f->flowbits);
+    f->flowbits = NULL;
+    f->flowbits_size = 0;
+    f->flowbits_cnt = 0;
 }
 
 
@@ -189,13 +153,13 @@ static int FlowBitTest01 (void) {
     Flow f;
     memset(&f, 0, sizeof(Flow));
 
-    FlowBitAdd(&f, 0);
+    FlowBitSet(&f, 0);
 
-    FlowBit *fb = FlowBitGet(&f,0);
-    if (fb != NULL)
+    int fb = FlowBitIsset(&f,0);
+    if (fb)
         ret = 1;
 
-    GenericVarFree(f.flowvar);
+    FlowBitsFree(&f);
     return ret;
 }
 
@@ -205,11 +169,11 @@ static int FlowBitTest02 (void) {
     Flow f;
     memset(&f, 0, sizeof(Flow));
 
-    FlowBit *fb = FlowBitGet(&f,0);
-    if (fb == NULL)
+    int fb = FlowBitIsset(&f,0);
+    if (!fb)
         ret = 1;
 
-    GenericVarFree(f.flowvar);
+    FlowBitsFree(&f);
     return ret;
 }
 
@@ -219,25 +183,25 @@ static int FlowBitTest03 (void) {
     Flow f;
     memset(&f, 0, sizeof(Flow));
 
-    FlowBitAdd(&f, 0);
+    FlowBitSet(&f, 0);
 
-    FlowBit *fb = FlowBitGet(&f,0);
-    if (fb == NULL) {
-        printf("fb == NULL although it was just added: ");
+    int fb = FlowBitIsset(&f,0);
+    if (!fb) {
+        printf("bit not set although it was just added: ");
         goto end;
     }
 
-    FlowBitRemove(&f, 0);
+    FlowBitUnset(&f, 0);
 
-    fb = FlowBitGet(&f,0);
-    if (fb != NULL) {
-        printf("fb != NULL although it was just removed: ");
+    fb = FlowBitIsset(&f,0);
+    if (fb) {
+        printf("bit set although it was just removed: ");
         goto end;
     } else {
         ret = 1;
     }
 end:
-    GenericVarFree(f.flowvar);
+    FlowBitsFree(&f);
     return ret;
 }
 
@@ -247,16 +211,16 @@ static int FlowBitTest04 (void) {
     Flow f;
     memset(&f, 0, sizeof(Flow));
 
-    FlowBitAdd(&f, 0);
-    FlowBitAdd(&f, 1);
-    FlowBitAdd(&f, 2);
-    FlowBitAdd(&f, 3);
+    FlowBitSet(&f, 0);
+    FlowBitSet(&f, 1);
+    FlowBitSet(&f, 2);
+    FlowBitSet(&f, 3);
 
-    FlowBit *fb = FlowBitGet(&f,0);
-    if (fb != NULL)
+    int fb = FlowBitIsset(&f,0);
+    if (fb)
         ret = 1;
 
-    GenericVarFree(f.flowvar);
+    FlowBitsFree(&f);
     return ret;
 }
 
@@ -266,16 +230,16 @@ static int FlowBitTest05 (void) {
     Flow f;
     memset(&f, 0, sizeof(Flow));
 
-    FlowBitAdd(&f, 0);
-    FlowBitAdd(&f, 1);
-    FlowBitAdd(&f, 2);
-    FlowBitAdd(&f, 3);
+    FlowBitSet(&f, 0);
+    FlowBitSet(&f, 1);
+    FlowBitSet(&f, 2);
+    FlowBitSet(&f, 3);
 
-    FlowBit *fb = FlowBitGet(&f,1);
-    if (fb != NULL)
+    int fb = FlowBitIsset(&f,1);
+    if (fb)
         ret = 1;
 
-    GenericVarFree(f.flowvar);
+    FlowBitsFree(&f);
     return ret;
 }
 
@@ -285,16 +249,16 @@ static int FlowBitTest06 (void) {
     Flow f;
     memset(&f, 0, sizeof(Flow));
 
-    FlowBitAdd(&f, 0);
-    FlowBitAdd(&f, 1);
-    FlowBitAdd(&f, 2);
-    FlowBitAdd(&f, 3);
+    FlowBitSet(&f, 0);
+    FlowBitSet(&f, 1);
+    FlowBitSet(&f, 2);
+    FlowBitSet(&f, 3);
 
-    FlowBit *fb = FlowBitGet(&f,2);
-    if (fb != NULL)
+    int fb = FlowBitIsset(&f,2);
+    if (fb)
         ret = 1;
 
-    GenericVarFree(f.flowvar);
+    FlowBitsFree(&f);
     return ret;
 }
 
@@ -304,16 +268,16 @@ static int FlowBitTest07 (void) {
     Flow f;
     memset(&f, 0, sizeof(Flow));
 
-    FlowBitAdd(&f, 0);
-    FlowBitAdd(&f, 1);
-    FlowBitAdd(&f, 2);
-    FlowBitAdd(&f, 3);
+    FlowBitSet(&f, 0);
+    FlowBitSet(&f, 1);
+    FlowBitSet(&f, 2);
+    FlowBitSet(&f, 3);
 
-    FlowBit *fb = FlowBitGet(&f,3);
-    if (fb != NULL)
+    int fb = FlowBitIsset(&f,3);
+    if (fb)
         ret = 1;
 
-    GenericVarFree(f.flowvar);
+    FlowBitsFree(&f);
     return ret;
 }
 
@@ -323,26 +287,26 @@ static int FlowBitTest08 (void) {
     Flow f;
     memset(&f, 0, sizeof(Flow));
 
-    FlowBitAdd(&f, 0);
-    FlowBitAdd(&f, 1);
-    FlowBitAdd(&f, 2);
-    FlowBitAdd(&f, 3);
+    FlowBitSet(&f, 0);
+    FlowBitSet(&f, 1);
+    FlowBitSet(&f, 2);
+    FlowBitSet(&f, 3);
 
-    FlowBit *fb = FlowBitGet(&f,0);
-    if (fb == NULL)
+    int fb = FlowBitIsset(&f,0);
+    if (!fb)
         goto end;
 
-    FlowBitRemove(&f,0);
+    FlowBitUnset(&f,0);
 
-    fb = FlowBitGet(&f,0);
-    if (fb != NULL) {
-        printf("fb != NULL even though it was removed: ");
+    fb = FlowBitIsset(&f,0);
+    if (fb) {
+        printf("bit set even though it was removed: ");
         goto end;
     }
 
     ret = 1;
 end:
-    GenericVarFree(f.flowvar);
+    FlowBitsFree(&f);
     return ret;
 }
 
@@ -352,26 +316,26 @@ static int FlowBitTest09 (void) {
     Flow f;
     memset(&f, 0, sizeof(Flow));
 
-    FlowBitAdd(&f, 0);
-    FlowBitAdd(&f, 1);
-    FlowBitAdd(&f, 2);
-    FlowBitAdd(&f, 3);
+    FlowBitSet(&f, 0);
+    FlowBitSet(&f, 1);
+    FlowBitSet(&f, 2);
+    FlowBitSet(&f, 3);
 
-    FlowBit *fb = FlowBitGet(&f,1);
-    if (fb == NULL)
+    int fb = FlowBitIsset(&f,1);
+    if (!fb)
         goto end;
 
-    FlowBitRemove(&f,1);
+    FlowBitUnset(&f,1);
 
-    fb = FlowBitGet(&f,1);
-    if (fb != NULL) {
-        printf("fb != NULL even though it was removed: ");
+    fb = FlowBitIsset(&f,1);
+    if (fb) {
+        printf("bit set even though it was removed: ");
         goto end;
     }
 
     ret = 1;
 end:
-    GenericVarFree(f.flowvar);
+    FlowBitsFree(&f);
     return ret;
 }
 
@@ -381,26 +345,26 @@ static int FlowBitTest10 (void) {
     Flow f;
     memset(&f, 0, sizeof(Flow));
 
-    FlowBitAdd(&f, 0);
-    FlowBitAdd(&f, 1);
-    FlowBitAdd(&f, 2);
-    FlowBitAdd(&f, 3);
+    FlowBitSet(&f, 0);
+    FlowBitSet(&f, 1);
+    FlowBitSet(&f, 2);
+    FlowBitSet(&f, 3);
 
-    FlowBit *fb = FlowBitGet(&f,2);
-    if (fb == NULL)
+    int fb = FlowBitIsset(&f,2);
+    if (!fb)
         goto end;
 
-    FlowBitRemove(&f,2);
+    FlowBitUnset(&f,2);
 
-    fb = FlowBitGet(&f,2);
-    if (fb != NULL) {
-        printf("fb != NULL even though it was removed: ");
+    fb = FlowBitIsset(&f,2);
+    if (fb) {
+        printf("bit set even though it was removed: ");
         goto end;
     }
 
     ret = 1;
 end:
-    GenericVarFree(f.flowvar);
+    FlowBitsFree(&f);
     return ret;
 }
 
@@ -410,26 +374,71 @@ static int FlowBitTest11 (void) {
     Flow f;
     memset(&f, 0, sizeof(Flow));
 
-    FlowBitAdd(&f, 0);
-    FlowBitAdd(&f, 1);
-    FlowBitAdd(&f, 2);
-    FlowBitAdd(&f, 3);
+    FlowBitSet(&f, 0);
+    FlowBitSet(&f, 1);
+    FlowBitSet(&f, 2);
+    FlowBitSet(&f, 3);
+
+    int fb = FlowBitIsset(&f,3);
+    if (!fb)
+        goto end;
+
+    FlowBitUnset(&f,3);
+
+    fb = FlowBitIsset(&f,3);
+    if (fb) {
+        printf("bit set even though it was removed: ");
+        goto end;
+    }
+
+    ret = 1;
+end:
+    FlowBitsFree(&f);
+    return ret;
+}
+
+/** \test bits past the size the array was created with, as after a rule
+ *        reload added flowbit names */
+static int FlowBitTest12 (void) {
+    int ret = 0;
+
+    Flow f;
+    memset(&f, 0, sizeof(Flow));
+
+    FlowBitSet(&f, 1);
+    if (f.flowbits_size == 0) {
+        printf("no flowbits array: ");
+        goto end;
+    }
 
-    FlowBit *fb = FlowBitGet(&f,3);
-    if (fb == NULL)
+    FlowBitToggle(&f, 200);
+    if (!FlowBitIsset(&f, 1) || !FlowBitIsset(&f, 200) ||
+            FlowBitIsset(&f, 199) || FlowBitIsset(&f, 1000)) {
+        printf("bits after grow: ");
         goto end;
+    }
+
+    FlowBitToggle(&f, 200);
+    FlowBitUnset(&f, 1000);
+    if (FlowBitIsset(&f, 200) || !FlowBitIsnotset(&f, 1000)) {
+        printf("bits after toggle/unset: ");
+        goto end;
+    }
 
-    FlowBitRemove(&f,3);
+    if (f.flowbits_cnt != 1) {
+        printf("flowbits_cnt %u, expected 1: ", f.flowbits_cnt);
+        goto end;
+    }
 
-    fb = FlowBitGet(&f,3);
-    if (fb != NULL) {
-        printf("fb != NULL even though it was removed: ");
+    FlowBitsReset(&f);
+    if (FlowBitIsset(&f, 1) || f.flowbits_cnt != 0) {
+        printf("bit set after reset: ");
         goto end;
     }
 
     ret = 1;
 end:
-    GenericVarFree(f.flowvar);
+    FlowBitsFree(&f);
     return ret;
 }
 
@@ -448,6 +457,7 @@ void FlowBitRegisterTests(void) {
     UtRegisterTest("FlowBitTest09", FlowBitTest09, 1);
     UtRegisterTest("FlowBitTest10", FlowBitTest10, 1);
     UtRegisterTest("FlowBitTest11", FlowBitTest11, 1);
+    UtRegisterTest("FlowBitTest12", FlowBitTest12, 1);
 #endif /* UNITTESTS */
 }
 
@@ -24,6 +24,9 @@
 #ifndef __FLOW_UTIL_H__
 #define __FLOW_UTIL_H__
 
+#include "flow-bit.h"
+#include "flow-var.h"
+
 #define COPY_TIMESTAMP(src,dst) ((dst)->tv_sec = (src)->tv_sec, (dst)->tv_usec = (src)->tv_usec)
 
 #define FLOW_INITIALIZE(f) do { \
@@ -42,11 +45,17 @@
         (f)->lastts.tv_sec = 0; \
         (f)->lastts.tv_usec = 0; \
         (f)->flowvar = NULL; \
+        (f)->flowbits = NULL; \
+        (f)->flowbits_size = 0; \
+        (f)->flowbits_cnt = 0; \
+        (f)->flowints = NULL; \
+        (f)->flowints_size = 0; \
         (f)->protoctx = NULL; \
         SC_ATOMIC_INIT((f)->use_cnt); \
         (f)->de_state = NULL; \
         (f)->sgh_toserver = NULL; \
         (f)->sgh_toclient = NULL; \
+        (f)->de_ctx_version = 0; \
         (f)->aldata = NULL; \
         (f)->alflags = 0; \
         (f)->alproto = 0; \
@@ -69,6 +78,8 @@
         (f)->lastts.tv_usec = 0; \
         GenericVarFree((f)->flowvar); \
         (f)->flowvar = NULL; \
+        FlowBitsReset((f)); \
+        FlowIntsReset((f)); \
         (f)->protoctx = NULL; \
         SC_ATOMIC_RESET((f)->use_cnt); \
         if ((f)->de_state != NULL) { \
@@ -77,6 +88,7 @@
         } \
         (f)->sgh_toserver = NULL; \
         (f)->sgh_toclient = NULL; \
+        (f)->de_ctx_version = 0; \
         AppLayerParserCleanupState(f); \
         FlowL7DataPtrFree(f); \
         if ((f)->aldata != NULL) { \
@@ -94,6 +106,8 @@
         SCMutexDestroy(&(f)->de_state_m); \
         GenericVarFree((f)->flowvar); \
         (f)->flowvar = NULL; \
+        FlowBitsFree((f)); \
+        FlowIntsFree((f)); \
         (f)->protoctx = NULL; \
         SC_ATOMIC_DESTROY((f)->use_cnt); \
         if ((f)->de_state != NULL) { \
@@ -30,6 +30,7 @@
 #include "flow-var.h"
 #include "flow.h"
 #include "detect.h"
+#include "util-var-name.h"
 #include "util-debug.h"
 
 /* puts a new value into a flowvar */
@@ -155,3 +156,91 @@ void FlowVarPrint(GenericVar *gv) {
     FlowVarPrint(gv->next);
 }
 
+/**
+ *  \brief Make sure the flowint slots of the flow can hold idx
+ *
+ *  \warning flow mutex must be held
+ *
+ *  \retval 0 ok
+ *  \retval -1 allocation failed
+ */
+static int FlowIntsGrow(Flow *f, uint16_t idx) {
+    uint16_t size = VariableNameGetMaxIdx(DETECT_FLOWINT) + 1;
+    if (size <= idx)
+        size = idx + 1;
+
+    FlowIntSlot *slots = SCRealloc(f->flowints, size * sizeof(FlowIntSlot));
+    if (slots == NULL)
+        return -1;
+
+    memset(slots + f->flowints_size, 0, (size - f->flowints_size) * sizeof(FlowIntSlot));
+    f->flowints = slots;
+    f->flowints_size = size;
+    return 0;
+}
+
+/** \brief set the flowint with name idx on the flow */
+void FlowIntSet(Flow *f, uint16_t idx, uint32_t value) {
+    SCMutexLock(&f->m);
+
+    if (idx >= f->flowints_size && FlowIntsGrow(f, idx) < 0)
+        goto end;
+
+    f->flowints[idx].value = value;
+    f->flowints[idx].set = 1;
+end:
+    SCMutexUnlock(&f->m);
+}
+
+/**
+ *  \brief add to the flowint with name idx, if it is set
+ *
+ *  The add is done under the flow mutex so that two threads updating
+ *  the same flowint don't lose an update. Substract by adding the
+ *  negated value.
+ *
+ *  \retval 1 flowint was set and is updated
+ *  \retval 0 flowint is not set
+ */
+int FlowIntAdd(Flow *f, uint16_t idx, uint32_t value) {
+    int r = 0;
+
+    SCMutexLock(&f->m);
+    if (idx < f->flowints_size && f->flowints[idx].set) {
+        f->flowints[idx].value += value;
+        r = 1;
+    }
+    SCMutexUnlock(&f->m);
+    return r;
+}
+
+/**
+ *  \brief get the flowint with name idx from the flow
+ *
+ *  \retval 1 flowint is set, value is in *value
+ *  \retval 0 flowint is not set
+ */
+int FlowIntGet(Flow *f, uint16_t idx, uint32_t *value) {
+    int r = 0;
+
+    SCMutexLock(&f->m);
+    if (idx < f->flowints_size && f->flowints[idx].set) {
+        *value = f->flowints[idx].value;
+        r = 1;
+    }
+    SCMutexUnlock(&f->m);
+    return r;
+}
+
+/** \brief unset all flowints, keeping the slots for the next use of the flow */
+void FlowIntsReset(Flow *f) {
+    if (f->flowints != NULL)
+        memset(f->flowints, 0, f->flowints_size * sizeof(FlowIntSlot));
+}
+
+void FlowIntsFree(Flow *f) {
+    if (f->flowints != NULL)
+        SCFree(f->flowints);
+    f->flowints = NULL;
+    f->flowints_size = 0;
+}
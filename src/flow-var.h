@@ -59,6 +59,12 @@ typedef struct FlowVar_ {
 
 } FlowVar;
 
+/** Flowint slot, one per flowint name idx in Flow::flowints */
+typedef struct FlowIntSlot_ {
+    uint32_t value;
+    uint8_t set;    /**< 1 if the flowint was set on this flow */
+} FlowIntSlot;
+
 
 /** Flowvar Interface API */
 
@@ -68,5 +74,11 @@ FlowVar *FlowVarGet(Flow *, uint8_t);
 void FlowVarFree(FlowVar *);
 void FlowVarPrint(GenericVar *);
 
+void FlowIntSet(Flow *, uint16_t, uint32_t);
+int FlowIntAdd(Flow *, uint16_t, uint32_t);
+int FlowIntGet(Flow *, uint16_t, uint32_t *);
+void FlowIntsReset(Flow *);
+void FlowIntsFree(Flow *);
+
 #endif /* __FLOW_VAR_H__ */
 
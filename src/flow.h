@@ -187,6 +187,8 @@ typedef struct Flow_
     /** toserver sgh for this flow. Only use when FLOW_SGH_TOSERVER flow flag
      *  has been set. */
     struct SigGroupHead_ *sgh_toserver;
+    /** version of the detection engine the sghs above belong to */
+    uint32_t de_ctx_version;
 
     /** List of tags of this flow (from "tag" keyword of type "session") */
     DetectTagDataEntryList *tag_list;
@@ -194,6 +196,15 @@ typedef struct Flow_
     /* pointer to the var list */
     GenericVar *flowvar;
 
+    /** flowbits, a bit per flowbit name idx. These and the flowints are
+     *  protected by the mutex "m", like the var list. */
+    uint32_t *flowbits;
+    /** flowints, a slot per flowint name idx */
+    struct FlowIntSlot_ *flowints;
+    uint16_t flowbits_size;     /**< words in flowbits */
+    uint16_t flowbits_cnt;      /**< number of bits set */
+    uint16_t flowints_size;     /**< slots in flowints */
+
     SCMutex de_state_m;          /**< mutex lock for the de_state object */
 
     /* list flow ptrs
@@ -25,6 +25,8 @@
 #define __STREAM_TCP_PRIVATE_H__
 
 #include "decode.h"
+#include "util-mpm.h"
+
 typedef struct TcpSegment_ {
     uint8_t *payload;
     uint16_t payload_len;       /**< actual size of the payload */
@@ -164,6 +166,8 @@ typedef struct TcpSession_ {
     struct StreamMsg_ *toserver_smsg_tail; /**< list of stream msgs (for detection inspection) */
     struct StreamMsg_ *toclient_smsg_head; /**< list of stream msgs (for detection inspection) */
     struct StreamMsg_ *toclient_smsg_tail; /**< list of stream msgs (for detection inspection) */
+    MpmStreamState toserver_mpm_state; /**< stream mpm state carried over stream msgs */
+    MpmStreamState toclient_mpm_state; /**< stream mpm state carried over stream msgs */
 } TcpSession;
 
 #endif /* __STREAM_TCP_PRIVATE_H__ */
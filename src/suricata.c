@@ -61,6 +61,7 @@
 #include "detect-engine-hcd.h"
 #include "detect-engine-state.h"
 #include "detect-engine-tag.h"
+#include "detect-engine-iponly.h"
 #include "detect-fast-pattern.h"
 
 #include "tm-queuehandlers.h"
@@ -155,6 +156,8 @@
 #include "util-ringbuffer.h"
 #include "util-mem.h"
 #include "util-memcmp.h"
+#include "util-checksum.h"
+#include "util-mpm-teddy.h"
 #include "util-proto-name.h"
 
 /*
@@ -163,6 +166,7 @@
 volatile sig_atomic_t sigint_count = 0;
 volatile sig_atomic_t sighup_count = 0;
 volatile sig_atomic_t sigterm_count = 0;
+volatile sig_atomic_t sigusr2_count = 0;
 
 /*
  * Flag to indicate if the engine is at the initialization
@@ -209,6 +213,12 @@ static void SignalHandlerSigterm(/*@unused@*/ int sig) {
     sigterm_count = 1;
     suricata_ctl_flags |= SURICATA_KILL;
 }
+#ifndef OS_WIN32
+/** SIGUSR2 reloads the rules, see DetectEngineReload */
+static void SignalHandlerSigusr2(/*@unused@*/ int sig) {
+    sigusr2_count = 1;
+}
+#endif
 #if 0
 static void SignalHandlerSighup(/*@unused@*/ int sig) {
     sighup_count = 1;
@@ -886,6 +896,15 @@ int main(int argc, char **argv)
             g_u8_lowercasetable[c] = c;
     }
 
+    /* bind the SIMD variants of the hot functions to what the cpu
+     * supports, or to what the config forces */
+    UtilCpuSimdSetup();
+    MemcmpSetup(UtilCpuSimdLevel());
+    SimdSearchSetup(UtilCpuSimdLevel());
+    SCTeddySetup(UtilCpuSimdLevel());
+    ChecksumSetup(UtilCpuSimdLevel());
+    IPOnlySetup(UtilCpuSimdLevel());
+
     /* hardcoded initialization code */
     MpmTableSetup(); /* load the pattern matchers */
     SigTableSetup(); /* load the rule keywords */
@@ -1033,6 +1052,7 @@ int main(int argc, char **argv)
         DeStateRegisterTests();
         DetectRingBufferRegisterTests();
         MemcmpRegisterTests();
+        ChecksumRegisterTests();
         DetectEngineHttpClientBodyRegisterTests();
         DetectEngineHttpHeaderRegisterTests();
         DetectEngineHttpRawHeaderRegisterTests();
@@ -1092,6 +1112,7 @@ int main(int argc, char **argv)
 #ifndef OS_WIN32
 	/* SIGHUP is not implemnetd on WIN32 */
     //SignalHandlerSetup(SIGHUP, SignalHandlerSighup);
+    SignalHandlerSetup(SIGUSR2, SignalHandlerSigusr2);
 
     /* Get the suricata user ID to given user ID */
     if (do_setuid == TRUE) {
@@ -1164,6 +1185,9 @@ int main(int argc, char **argv)
     SCThresholdConfInitContext(de_ctx,NULL);
     SCAsn1LoadConfig();
 
+    /* the detect threads run the current engine, rule reloads replace it */
+    DetectEngineSetCurrent(de_ctx);
+
     struct timeval start_time;
     memset(&start_time, 0, sizeof(start_time));
     gettimeofday(&start_time, NULL);
@@ -1307,6 +1331,12 @@ int main(int argc, char **argv)
 
         TmThreadCheckThreadState();
 
+        if (sigusr2_count) {
+            sigusr2_count = 0;
+            DetectEngineReloadStart(sig_file);
+        }
+        DetectEnginePruneFreeList(0);
+
         usleep(10* 1000);
     }
 
@@ -1314,11 +1344,18 @@ int main(int argc, char **argv)
     SC_ATOMIC_CAS(&engine_stage, SURICATA_RUNTIME, SURICATA_DEINIT);
 
 
+    /* all detect threads are gone, free the replaced engines */
+    DetectEngineReloadWait();
+    de_ctx = DetectEngineClearCurrent();
+    DetectEnginePruneFreeList(1);
+
     FlowShutdown();
     FlowPrintQueueInfo();
     StreamTcpFreeConfig(STREAM_VERBOSE);
     HTPFreeConfig();
     HTPAtExitPrintStats();
+    SMBAtExitPrintStats();
+    DCERPCAtExitPrintStats();
 
 #ifdef DBG_MEM_ALLOC
     SCLogInfo("Total memory used (without SCFree()): %"PRIdMAX, (intmax_t)global_mem);
@@ -1357,9 +1394,6 @@ int main(int argc, char **argv)
     AppLayerHtpPrintStats();
 
     SigCleanSignatures(de_ctx);
-    if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_SINGLE) {
-        MpmFactoryDeRegisterAllMpmCtxProfiles();
-    }
     DetectEngineCtxFree(de_ctx);
     AlpProtoDestroy();
 
@@ -0,0 +1,217 @@
+/* Copyright (C) 2007-2010 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Sum of the 16 bit words of a packet with SSE2 and AVX2 variants. The
+ * words are added into 32 bit lanes, which won't overflow for the 64KiB
+ * max length, so the result is the exact same sum as the plain version.
+ */
+
+#include "suricata-common.h"
+#include "util-checksum.h"
+#include "util-cpu.h"
+#include "util-debug.h"
+#include "util-unittest.h"
+
+#if defined(SC_CPU_DISPATCH)
+#include <immintrin.h>
+#elif defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/**
+ * \internal
+ * \brief Add the words of a buffer to a sum a few at a time, used for all
+ *        of it without SIMD and for what is left after the vector blocks
+ *        otherwise.
+ */
+static inline uint32_t ChecksumAddWordsTail(uint32_t csum, const uint16_t *pkt,
+        uint16_t len)
+{
+    uint16_t pad = 0;
+
+    while (len >= 32) {
+        csum += pkt[0] + pkt[1] + pkt[2] + pkt[3] + pkt[4] + pkt[5] + pkt[6] +
+            pkt[7] + pkt[8] + pkt[9] + pkt[10] + pkt[11] + pkt[12] + pkt[13] +
+            pkt[14] + pkt[15];
+        len -= 32;
+        pkt += 16;
+    }
+
+    while(len >= 8) {
+        csum += pkt[0] + pkt[1] + pkt[2] + pkt[3];
+        len -= 8;
+        pkt += 4;
+    }
+
+    while(len >= 4) {
+        csum += pkt[0] + pkt[1];
+        len -= 4;
+        pkt += 2;
+    }
+
+    while (len > 1) {
+        csum += pkt[0];
+        pkt += 1;
+        len -= 2;
+    }
+
+    if (len == 1) {
+        *(uint8_t *)(&pad) = (*(uint8_t *)pkt);
+        csum += pad;
+    }
+
+    return csum;
+}
+
+static uint32_t ChecksumAddWordsPlain(const uint16_t *pkt, uint16_t len)
+{
+    return ChecksumAddWordsTail(0, pkt, len);
+}
+
+#if defined(SC_CPU_DISPATCH) || defined(__SSE2__)
+static SC_CPU_TARGET("sse2") uint32_t ChecksumAddWordsSSE2(const uint16_t *pkt,
+        uint16_t len)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc = zero;
+    uint32_t lanes[4];
+
+    for ( ; len >= 16; len -= 16, pkt += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i *)pkt);
+
+        acc = _mm_add_epi32(acc, _mm_unpacklo_epi16(v, zero));
+        acc = _mm_add_epi32(acc, _mm_unpackhi_epi16(v, zero));
+    }
+
+    _mm_storeu_si128((__m128i *)lanes, acc);
+    return ChecksumAddWordsTail(lanes[0] + lanes[1] + lanes[2] + lanes[3],
+                                pkt, len);
+}
+#endif /* SSE2 */
+
+#if defined(SC_CPU_DISPATCH) || defined(__AVX2__)
+static SC_CPU_TARGET("avx2") uint32_t ChecksumAddWordsAVX2(const uint16_t *pkt,
+        uint16_t len)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i acc = zero;
+    uint32_t lanes[4];
+
+    for ( ; len >= 32; len -= 32, pkt += 16) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)pkt);
+
+        /* unpacks per 128 bit half, the word order doesn't matter here */
+        acc = _mm256_add_epi32(acc, _mm256_unpacklo_epi16(v, zero));
+        acc = _mm256_add_epi32(acc, _mm256_unpackhi_epi16(v, zero));
+    }
+
+    __m128i half = _mm_add_epi32(_mm256_castsi256_si128(acc),
+                                 _mm256_extracti128_si256(acc, 1));
+    _mm_storeu_si128((__m128i *)lanes, half);
+    return ChecksumAddWordsTail(lanes[0] + lanes[1] + lanes[2] + lanes[3],
+                                pkt, len);
+}
+#endif /* AVX2 */
+
+/** bound to the best variant by ChecksumSetup, plain until then */
+uint32_t (*ChecksumAddWordsFunc)(const uint16_t *, uint16_t) = ChecksumAddWordsPlain;
+
+/**
+ * \brief Bind ChecksumAddWords to the best variant for a SIMD level
+ *
+ * \param level max SIMD level to use, UTIL_CPU_SIMD_*
+ */
+void ChecksumSetup(int level)
+{
+    int used = UTIL_CPU_SIMD_NONE;
+
+    ChecksumAddWordsFunc = ChecksumAddWordsPlain;
+
+#if defined(SC_CPU_DISPATCH) || defined(__SSE2__)
+    if (level >= UTIL_CPU_SIMD_SSE2) {
+        ChecksumAddWordsFunc = ChecksumAddWordsSSE2;
+        used = UTIL_CPU_SIMD_SSE2;
+    }
+#endif
+#if defined(SC_CPU_DISPATCH) || defined(__AVX2__)
+    if (level >= UTIL_CPU_SIMD_AVX2) {
+        ChecksumAddWordsFunc = ChecksumAddWordsAVX2;
+        used = UTIL_CPU_SIMD_AVX2;
+    }
+#endif
+
+    SCLogInfo("checksum: using the %s variant", UtilCpuSimdLevelToString(used));
+}
+
+#ifdef UNITTESTS
+
+/**
+ * \test Every variant the cpu supports adds up to the same sum as the
+ *       plain one, for all lengths up to a full size packet.
+ */
+static int ChecksumAddWordsTest01(void)
+{
+    uint16_t buf[1600 / 2];
+    uint32_t seed = 11;
+    uint16_t len;
+    int result = 0;
+    int level, random;
+    uint32_t i;
+
+    for (level = 0; level <= UtilCpuSimdDetect(); level++) {
+        ChecksumSetup(level);
+
+        /* worst case for the sums first, then random words */
+        for (random = 0; random <= 1; random++) {
+            for (i = 0; i < sizeof(buf) / 2; i++) {
+                seed = seed * 1103515245 + 12345;
+                buf[i] = random ? (uint16_t)(seed >> 16) : 0xffff;
+            }
+
+            /* start past the first word to not only test aligned loads */
+            for (len = 0; len <= sizeof(buf) - 2; len++) {
+                uint32_t sum = ChecksumAddWords(buf + 1, len);
+                uint32_t ref = ChecksumAddWordsPlain(buf + 1, len);
+
+                if (sum != ref) {
+                    printf("level %s len %u: sum %u != %u: ",
+                           UtilCpuSimdLevelToString(level), len, sum, ref);
+                    goto end;
+                }
+            }
+        }
+    }
+
+    result = 1;
+end:
+    ChecksumSetup(UtilCpuSimdLevel());
+    return result;
+}
+
+#endif /* UNITTESTS */
+
+void ChecksumRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("ChecksumAddWordsTest01", ChecksumAddWordsTest01, 1);
+#endif /* UNITTESTS */
+}
@@ -0,0 +1,47 @@
+/* Copyright (C) 2007-2010 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Sum of the 16 bit words of a packet, the part of the TCP and UDP
+ * checksums that covers the payload.
+ */
+
+#ifndef __UTIL_CHECKSUM_H__
+#define __UTIL_CHECKSUM_H__
+
+extern uint32_t (*ChecksumAddWordsFunc)(const uint16_t *, uint16_t);
+
+/**
+ * \brief Add up the 16 bit words of a buffer, for a ones complement
+ *        checksum. An odd last byte is padded with a zero byte.
+ *
+ * \param pkt  the buffer
+ * \param len  length of the buffer in bytes
+ *
+ * \retval sum the sum of the words, not folded
+ */
+static inline uint32_t ChecksumAddWords(const uint16_t *pkt, uint16_t len)
+{
+    return ChecksumAddWordsFunc(pkt, len);
+}
+
+void ChecksumSetup(int);
+void ChecksumRegisterTests(void);
+
+#endif /* __UTIL_CHECKSUM_H__ */
@@ -20,7 +20,7 @@
  *
  * \author Pablo Rincon Crespo <pablo.rincon.crespo@gmail.com>
  *
- * Retrieve CPU information (configured CPUs, online CPUs)
+ * Retrieve CPU information (configured CPUs, online CPUs, SIMD support)
  */
 
 #include <unistd.h>
@@ -31,6 +31,8 @@
 #include "util-error.h"
 #include "util-debug.h"
 #include "suricata-common.h"
+#include "util-cpu.h"
+#include "conf.h"
 
 /**
  * Ok, if they should use sysconf, check that they have the macro's
@@ -192,3 +194,141 @@ uint64_t UtilCpuGetTicks(void)
 #endif
     return val;
 }
+
+/** names of the SIMD levels, as used in the "simd" config setting */
+static const char *util_cpu_simd_names[UTIL_CPU_SIMD_MAX] = {
+    "none", "sse2", "sse3", "ssse3", "sse4.1", "sse4.2", "avx2",
+};
+
+/** the SIMD level the dispatched functions are bound to */
+static int util_cpu_simd_level = UTIL_CPU_SIMD_NONE;
+
+/**
+ * \brief Get the name of a SIMD level
+ *
+ * \param level the level, UTIL_CPU_SIMD_*
+ *
+ * \retval name of the level, "unknown" if out of range
+ */
+const char *UtilCpuSimdLevelToString(int level)
+{
+    if (level < 0 || level >= UTIL_CPU_SIMD_MAX)
+        return "unknown";
+
+    return util_cpu_simd_names[level];
+}
+
+/**
+ * \brief Get the SIMD level by its name
+ *
+ * \param name name of the level, e.g. "sse4.2"
+ *
+ * \retval level UTIL_CPU_SIMD_* on success, -1 if the name is unknown
+ */
+int UtilCpuSimdLevelFromString(const char *name)
+{
+    int level;
+
+    for (level = 0; level < UTIL_CPU_SIMD_MAX; level++) {
+        if (strcasecmp(name, util_cpu_simd_names[level]) == 0)
+            return level;
+    }
+
+    return -1;
+}
+
+/**
+ * \brief Detect the highest SIMD level the cpu we run on supports. Without
+ *        runtime dispatch this is the level the build targets.
+ *
+ * \retval level UTIL_CPU_SIMD_*
+ */
+int UtilCpuSimdDetect(void)
+{
+    int level = UTIL_CPU_SIMD_NONE;
+
+#ifdef SC_CPU_DISPATCH
+    __builtin_cpu_init();
+
+    /* the levels build on each other, stop at the first missing one */
+    if (!__builtin_cpu_supports("sse2"))
+        return level;
+    level = UTIL_CPU_SIMD_SSE2;
+    if (!__builtin_cpu_supports("sse3"))
+        return level;
+    level = UTIL_CPU_SIMD_SSE3;
+    if (!__builtin_cpu_supports("ssse3"))
+        return level;
+    level = UTIL_CPU_SIMD_SSSE3;
+    if (!__builtin_cpu_supports("sse4.1"))
+        return level;
+    level = UTIL_CPU_SIMD_SSE4_1;
+    if (!__builtin_cpu_supports("sse4.2"))
+        return level;
+    level = UTIL_CPU_SIMD_SSE4_2;
+    if (!__builtin_cpu_supports("avx2"))
+        return level;
+    level = UTIL_CPU_SIMD_AVX2;
+#else
+#if defined(__AVX2__)
+    level = UTIL_CPU_SIMD_AVX2;
+#elif defined(__SSE4_2__)
+    level = UTIL_CPU_SIMD_SSE4_2;
+#elif defined(__SSE4_1__)
+    level = UTIL_CPU_SIMD_SSE4_1;
+#elif defined(__SSSE3__)
+    level = UTIL_CPU_SIMD_SSSE3;
+#elif defined(__SSE3__)
+    level = UTIL_CPU_SIMD_SSE3;
+#elif defined(__SSE2__)
+    level = UTIL_CPU_SIMD_SSE2;
+#endif
+#endif /* SC_CPU_DISPATCH */
+
+    return level;
+}
+
+/**
+ * \brief Set the SIMD level the memcmp, spm, mpm and checksum functions
+ *        are bound to. It's the highest level the cpu supports, unless
+ *        the "simd" config setting forces a lower one for benchmarking.
+ *        Call after the config is loaded and before the Setup functions
+ *        of those modules.
+ */
+void UtilCpuSimdSetup(void)
+{
+    int detected = UtilCpuSimdDetect();
+    int level = detected;
+    char *simd = NULL;
+
+    if (ConfGet("simd", &simd) == 1 && simd != NULL &&
+        strcasecmp(simd, "auto") != 0)
+    {
+        int forced = UtilCpuSimdLevelFromString(simd);
+        if (forced < 0) {
+            SCLogError(SC_ERR_INVALID_YAML_CONF_ENTRY, "Invalid simd setting "
+                       "\"%s\", using \"auto\"", simd);
+        } else if (forced > detected) {
+            SCLogWarning(SC_ERR_INVALID_VALUE, "simd setting \"%s\" is "
+                         "not supported by this cpu, using \"%s\"", simd,
+                         UtilCpuSimdLevelToString(detected));
+        } else {
+            level = forced;
+        }
+    }
+
+    util_cpu_simd_level = level;
+    SCLogInfo("SIMD support detected: %s, using: %s",
+              UtilCpuSimdLevelToString(detected),
+              UtilCpuSimdLevelToString(level));
+}
+
+/**
+ * \brief Get the SIMD level set by UtilCpuSimdSetup
+ *
+ * \retval level UTIL_CPU_SIMD_*
+ */
+int UtilCpuSimdLevel(void)
+{
+    return util_cpu_simd_level;
+}
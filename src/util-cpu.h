@@ -36,4 +36,35 @@ void UtilCpuPrintSummary();
 
 uint64_t UtilCpuGetTicks(void);
 
+/* On x86 with a compiler that takes a target attribute per function the
+ * SIMD variants are all built and the best one the cpu supports is picked
+ * at startup, so a binary built for the lowest common denominator still
+ * uses them. Elsewhere only what the build targets is available. */
+#if (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__clang__) || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define SC_CPU_DISPATCH 1
+#define SC_CPU_TARGET(isa) __attribute__((target(isa)))
+#else
+#define SC_CPU_TARGET(isa)
+#endif
+
+/** SIMD instruction set levels, every level includes the ones below it */
+enum {
+    UTIL_CPU_SIMD_NONE = 0,
+    UTIL_CPU_SIMD_SSE2,
+    UTIL_CPU_SIMD_SSE3,
+    UTIL_CPU_SIMD_SSSE3,
+    UTIL_CPU_SIMD_SSE4_1,
+    UTIL_CPU_SIMD_SSE4_2,
+    UTIL_CPU_SIMD_AVX2,
+
+    UTIL_CPU_SIMD_MAX,
+};
+
+int UtilCpuSimdDetect(void);
+void UtilCpuSimdSetup(void);
+int UtilCpuSimdLevel(void);
+const char *UtilCpuSimdLevelToString(int);
+int UtilCpuSimdLevelFromString(const char *);
+
 #endif /* __UTIL_CPU_H__ */
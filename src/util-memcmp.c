@@ -26,9 +26,306 @@
 #include "suricata-common.h"
 
 #include "util-memcmp.h"
+#include "util-cpu.h"
+#include "util-debug.h"
 #include "util-unittest.h"
 
-/* code is implemented in util-memcmp.h as it's all inlined */
+#if defined(SC_CPU_DISPATCH) || defined(__SSE2__)
+
+#if defined(SC_CPU_DISPATCH)
+#include <nmmintrin.h>
+#elif defined(__SSE4_2__)
+#include <nmmintrin.h>
+#elif defined(__SSE4_1__)
+#include <smmintrin.h>
+#else
+#include <emmintrin.h>
+#endif
+
+#define SCMEMCMP_BYTES  16
+
+#define UPPER_LOW   0x40 /* "A" - 1 */
+#define UPPER_HIGH  0x5B /* "Z" + 1 */
+#define UPPER_DELTA 0xDF /* 0xFF - 0x20 */
+
+/* wrapper around memcmp to match the retvals of the SIMD implementations */
+static int SCMemcmpPlain(void *s1, void *s2, size_t n)
+{
+    return memcmp(s1, s2, n) ? 1 : 0;
+}
+
+static int SCMemcmpLowercasePlainWrapper(void *s1, void *s2, size_t n)
+{
+    return SCMemcmpLowercasePlain(s1, s2, n);
+}
+
+/** bound to the best variant by MemcmpSetup, plain until then */
+int (*SCMemcmpFunc)(void *, void *, size_t) = SCMemcmpPlain;
+int (*SCMemcmpLowercaseFunc)(void *, void *, size_t) = SCMemcmpLowercasePlainWrapper;
+
+static SC_CPU_TARGET("sse2") int SCMemcmpSSE2(void *s1, void *s2, size_t len)
+{
+    size_t offset = 0;
+    __m128i b1, b2, c;
+
+    do {
+        /* do unaligned loads using _mm_loadu_si128. On my Core2 E6600 using
+         * _mm_lddqu_si128 was about 2% slower even though it's supposed to
+         * be faster. */
+        b1 = _mm_loadu_si128((const __m128i *) s1);
+        b2 = _mm_loadu_si128((const __m128i *) s2);
+        c = _mm_cmpeq_epi8(b1, b2);
+
+        int diff = len - offset;
+        if (diff < 16) {
+            int rmask = ~(0xFFFFFFFF << diff);
+
+            if ((_mm_movemask_epi8(c) & rmask) != rmask) {
+                return 1;
+            }
+        } else {
+            if (_mm_movemask_epi8(c) != 0x0000FFFF) {
+                return 1;
+            }
+        }
+
+        offset += SCMEMCMP_BYTES;
+        s1 += SCMEMCMP_BYTES;
+        s2 += SCMEMCMP_BYTES;
+    } while (len > offset);
+
+    return 0;
+}
+
+static SC_CPU_TARGET("sse2") int SCMemcmpLowercaseSSE2(void *s1, void *s2, size_t len)
+{
+    size_t offset = 0;
+    __m128i b1, b2, mask1, mask2, upper1, upper2, delta;
+
+    /* setup registers for upper to lower conversion */
+    upper1 = _mm_set1_epi8(UPPER_LOW);
+    upper2 = _mm_set1_epi8(UPPER_HIGH);
+    delta  = _mm_set1_epi8(UPPER_DELTA);
+
+    do {
+        /* unaligned loading of the bytes to compare */
+        b1 = _mm_loadu_si128((const __m128i *) s1);
+        b2 = _mm_loadu_si128((const __m128i *) s2);
+
+        /* mark all chars bigger than upper1 */
+        mask1 = _mm_cmpgt_epi8(b2, upper1);
+        /* mark all chars lower than upper2 */
+        mask2 = _mm_cmplt_epi8(b2, upper2);
+        /* merge the two, leaving only those that are true in both */
+        mask1 = _mm_cmpeq_epi8(mask1, mask2);
+
+        /* sub delta leaves 0x20 only for uppercase positions, the
+           rest is 0x00 due to the saturation (reuse mask1 reg)*/
+        mask1 = _mm_subs_epu8(mask1, delta);
+
+        /* add to b2, converting uppercase to lowercase */
+        b2 = _mm_add_epi8(b2, mask1);
+
+        /* now all is lowercase, let's do the actual compare (reuse mask1 reg) */
+        mask1 = _mm_cmpeq_epi8(b1, b2);
+
+        int diff = len - offset;
+        if (diff < 16) {
+            int rmask = ~(0xFFFFFFFF << diff);
+
+            if ((_mm_movemask_epi8(mask1) & rmask) != rmask) {
+                return 1;
+            }
+        } else {
+            if (_mm_movemask_epi8(mask1) != 0x0000FFFF) {
+                return 1;
+            }
+        }
+
+        offset += SCMEMCMP_BYTES;
+        s1 += SCMEMCMP_BYTES;
+        s2 += SCMEMCMP_BYTES;
+    } while (len > offset);
+
+    return 0;
+}
+
+#if defined(SC_CPU_DISPATCH) || defined(__SSE4_1__)
+static SC_CPU_TARGET("sse4.1") int SCMemcmpLowercaseSSE41(void *s1, void *s2, size_t len)
+{
+    size_t offset = 0;
+    __m128i b1, b2, mask1, mask2, upper1, upper2, nulls, uplow;
+
+    /* setup registers for upper to lower conversion */
+    upper1 = _mm_set1_epi8(UPPER_LOW);
+    upper2 = _mm_set1_epi8(UPPER_HIGH);
+    nulls = _mm_setzero_si128();
+    uplow = _mm_set1_epi8(0x20);
+
+    do {
+        /* unaligned loading of the bytes to compare */
+        b1 = _mm_loadu_si128((const __m128i *) s1);
+        b2 = _mm_loadu_si128((const __m128i *) s2);
+
+        /* mark all chars bigger than upper1 */
+        mask1 = _mm_cmpgt_epi8(b2, upper1);
+        /* mark all chars lower than upper2 */
+        mask2 = _mm_cmplt_epi8(b2, upper2);
+        /* merge the two, leaving only those that are true in both */
+        mask1 = _mm_cmpeq_epi8(mask1, mask2);
+        /* Next we use that mask to create a new: this one has 0x20 for
+         * the uppercase chars, 00 for all other. */
+        mask1 = _mm_blendv_epi8(nulls, uplow, mask1);
+
+        /* add to b2, converting uppercase to lowercase */
+        b2 = _mm_add_epi8(b2, mask1);
+
+        /* now all is lowercase, let's do the actual compare (reuse mask1 reg) */
+        mask1 = _mm_cmpeq_epi8(b1, b2);
+
+        int diff = len - offset;
+        if (diff < 16) {
+            int rmask = ~(0xFFFFFFFF << diff);
+
+            if ((_mm_movemask_epi8(mask1) & rmask) != rmask) {
+                return 1;
+            }
+        } else {
+            if (_mm_movemask_epi8(mask1) != 0x0000FFFF) {
+                return 1;
+            }
+        }
+
+        offset += SCMEMCMP_BYTES;
+        s1 += SCMEMCMP_BYTES;
+        s2 += SCMEMCMP_BYTES;
+    } while (len > offset);
+
+    return 0;
+}
+#endif /* SSE4.1 */
+
+#if defined(SC_CPU_DISPATCH) || defined(__SSE4_2__)
+static SC_CPU_TARGET("sse4.2") int SCMemcmpSSE42(void *s1, void *s2, size_t n)
+{
+    __m128i b1, b2;
+
+    int r;
+    /* counter for how far we already matched in the buffer */
+    size_t m = 0;
+
+    do {
+        /* load the buffers into the 128bit vars */
+        b1 = _mm_loadu_si128((const __m128i *) s1);
+        b2 = _mm_loadu_si128((const __m128i *) s2);
+
+        /* do the actual compare */
+        m += (r = _mm_cmpestri(b1, n - m, b2, 16,
+                    _SIDD_CMP_EQUAL_EACH | _SIDD_MASKED_NEGATIVE_POLARITY));
+
+        s1 += 16;
+        s2 += 16;
+    } while (r == 16);
+
+    return ((m == n) ? 0 : 1);
+}
+
+/* Range of values of uppercase characters */
+static char scmemcmp_uppercase[2] __attribute__((aligned(16))) = {
+    'A', 'Z' };
+
+/** \brief compare two buffers in a case insensitive way
+ *  \param s1 buffer already in lowercase
+ *  \param s2 buffer with mixed upper and lowercase
+ */
+static SC_CPU_TARGET("sse4.2") int SCMemcmpLowercaseSSE42(void *s1, void *s2, size_t n)
+{
+    __m128i b1, b2, mask;
+
+    int r;
+    /* counter for how far we already matched in the buffer */
+    size_t m = 0;
+
+    __m128i ucase = _mm_load_si128((const __m128i *) scmemcmp_uppercase);
+    __m128i nulls = _mm_setzero_si128();
+    __m128i uplow = _mm_set1_epi8(0x20);
+
+    do {
+        b1 = _mm_loadu_si128((const __m128i *) s1);
+        b2 = _mm_loadu_si128((const __m128i *) s2);
+        size_t len = n - m;
+
+        /* The first step is creating a mask that is FF for all uppercase
+         * characters, 00 for all others */
+        mask = _mm_cmpestrm(ucase, 2, b2, len, _SIDD_CMP_RANGES | _SIDD_UNIT_MASK);
+        /* Next we use that mask to create a new: this one has 0x20 for
+         * the uppercase chars, 00 for all other. */
+        mask = _mm_blendv_epi8(nulls, uplow, mask);
+        /* finally, merge the mask and the buffer converting the
+         * uppercase to lowercase */
+        b2 = _mm_add_epi8(b2, mask);
+
+        /* search using our converted buffer */
+        m += (r = _mm_cmpestri(b1, len, b2, 16,
+                    _SIDD_CMP_EQUAL_EACH | _SIDD_MASKED_NEGATIVE_POLARITY));
+
+        s1 += 16;
+        s2 += 16;
+    } while (r == 16);
+
+    return ((m == n) ? 0 : 1);
+}
+#endif /* SSE4.2 */
+
+/**
+ * \brief Bind SCMemcmp and SCMemcmpLowercase to the best variant for a
+ *        SIMD level. The SSE4.1 one only differs in the lowercase
+ *        conversion, its plain compare is the SSE2 one.
+ *
+ * \param level max SIMD level to use, UTIL_CPU_SIMD_*
+ */
+void MemcmpSetup(int level)
+{
+    int used = UTIL_CPU_SIMD_NONE;
+
+    SCMemcmpFunc = SCMemcmpPlain;
+    SCMemcmpLowercaseFunc = SCMemcmpLowercasePlainWrapper;
+
+    /* from the lowest level up, each one replaces what it improves on */
+    if (level >= UTIL_CPU_SIMD_SSE2) {
+        SCMemcmpFunc = SCMemcmpSSE2;
+        SCMemcmpLowercaseFunc = SCMemcmpLowercaseSSE2;
+        used = UTIL_CPU_SIMD_SSE2;
+    }
+#if defined(SC_CPU_DISPATCH) || defined(__SSE4_1__)
+    if (level >= UTIL_CPU_SIMD_SSE4_1) {
+        SCMemcmpLowercaseFunc = SCMemcmpLowercaseSSE41;
+        used = UTIL_CPU_SIMD_SSE4_1;
+    }
+#endif
+#if defined(SC_CPU_DISPATCH) || defined(__SSE4_2__)
+    if (level >= UTIL_CPU_SIMD_SSE4_2) {
+        SCMemcmpFunc = SCMemcmpSSE42;
+        SCMemcmpLowercaseFunc = SCMemcmpLowercaseSSE42;
+        used = UTIL_CPU_SIMD_SSE4_2;
+    }
+#endif
+
+    SCLogInfo("memcmp: using the %s variant", UtilCpuSimdLevelToString(used));
+}
+
+#else
+
+/**
+ * \brief No SIMD variants in this build, SCMemcmp is plain memcmp
+ */
+void MemcmpSetup(int level)
+{
+    SCLogInfo("memcmp: using the %s variant",
+              UtilCpuSimdLevelToString(UTIL_CPU_SIMD_NONE));
+}
+
+#endif /* SIMD */
 
 /* UNITTESTS */
 #ifdef UNITTESTS
@@ -166,6 +463,56 @@ static int MemcmpTest13 (void) {
     return 1;
 }
 
+/**
+ * \test Every variant the cpu supports gives the same results as memcmp
+ *       and the plain lowercase compare.
+ */
+static int MemcmpTest14 (void) {
+    /* room for the 16 byte loads past the compared range */
+    uint8_t a[64 + 16], b[64 + 16];
+    uint32_t seed = 7;
+    int result = 0;
+    int level;
+    size_t len;
+    int i;
+
+    for (level = 0; level <= UtilCpuSimdDetect(); level++) {
+        MemcmpSetup(level);
+
+        for (i = 0; i < 2000; i++) {
+            size_t j;
+
+            len = 1 + (seed = seed * 1103515245 + 12345) % 64;
+            for (j = 0; j < sizeof(a); j++) {
+                seed = seed * 1103515245 + 12345;
+                a[j] = "abcdeABCDE"[(seed >> 16) % 10];
+                b[j] = u8_tolower(a[j]);
+            }
+            /* most of the time make them differ in one place */
+            if (i % 4 != 0) {
+                size_t pos = (seed >> 8) % len;
+                b[pos] = (b[pos] == 'a') ? 'b' : 'a';
+            }
+
+            if (SCMemcmp(a, b, len) != (memcmp(a, b, len) ? 1 : 0)) {
+                printf("level %s: SCMemcmp mismatch, len %"PRIuMAX": ",
+                       UtilCpuSimdLevelToString(level), (uintmax_t)len);
+                goto end;
+            }
+            if (SCMemcmpLowercase(b, a, len) != SCMemcmpLowercasePlain(b, a, len)) {
+                printf("level %s: SCMemcmpLowercase mismatch, len %"PRIuMAX": ",
+                       UtilCpuSimdLevelToString(level), (uintmax_t)len);
+                goto end;
+            }
+        }
+    }
+
+    result = 1;
+end:
+    MemcmpSetup(UtilCpuSimdLevel());
+    return result;
+}
+
 #endif /* UNITTESTS */
 
 void MemcmpRegisterTests(void) {
@@ -183,6 +530,7 @@ void MemcmpRegisterTests(void) {
     UtRegisterTest("MemcmpTest11", MemcmpTest11, 1);
     UtRegisterTest("MemcmpTest12", MemcmpTest12, 1);
     UtRegisterTest("MemcmpTest13", MemcmpTest13, 1);
+    UtRegisterTest("MemcmpTest14", MemcmpTest14, 1);
 #endif /* UNITTESTS */
 }
 
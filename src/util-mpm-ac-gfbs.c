@@ -101,6 +101,7 @@ void MpmACGfbsRegister(void)
     mpm_table[MPM_AC_GFBS].PrintCtx = SCACGfbsPrintInfo;
     mpm_table[MPM_AC_GFBS].PrintThreadCtx = SCACGfbsPrintSearchStats;
     mpm_table[MPM_AC_GFBS].RegisterUnittests = SCACGfbsRegisterTests;
+    mpm_table[MPM_AC_GFBS].flags = MPM_TABLE_FLAG_PREPARE_MT;
 
     return;
 }
@@ -32,6 +32,11 @@
  *         - This version of the MPM is heavy on memory, but it performs well.
  *           If you can fit the ruleset with this mpm on your box without hitting
  *           swap, this is the MPM to go for.
+ *         - For very large rulesets the state table can be stored compressed
+ *           instead ("state_table: compressed" in the pattern-matcher conf).
+ *           The bytes are mapped to byte classes, the root state has a dense
+ *           row and the other states only store the transitions that differ
+ *           from the root's, in a sparse row.
  *
  * \todo - Do a proper analyis of our existing MPMs and suggest a good one based
  *         on the pattern distribution and the expected traffic(say http).
@@ -55,6 +60,15 @@
 #include "util-debug.h"
 #include "util-unittest.h"
 #include "util-memcmp.h"
+#include "util-clock.h"
+
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
+#ifdef UNITTESTS
+#include <dirent.h>
+#endif
 
 void SCACInitCtx(MpmCtx *, int);
 void SCACInitThreadCtx(MpmCtx *, MpmThreadCtx *, uint32_t);
@@ -67,6 +81,14 @@ int SCACAddPatternCS(MpmCtx *, uint8_t *, uint16_t, uint16_t, uint16_t,
 int SCACPreparePatterns(MpmCtx *mpm_ctx);
 uint32_t SCACSearch(MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
                     PatternMatcherQueue *pmq, uint8_t *buf, uint16_t buflen);
+uint32_t SCACSearchSegments(MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
+                            PatternMatcherQueue *pmq, MpmBufferSegment *segs,
+                            uint16_t segs_cnt, uint8_t *pid_tags);
+uint32_t SCACSearchBatch(MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
+                         MpmBatchBuffer *batch, uint16_t cnt);
+uint32_t SCACSearchResume(MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
+                          PatternMatcherQueue *pmq, MpmStreamState *ss,
+                          uint8_t *buf, uint32_t buflen);
 void SCACPrintInfo(MpmCtx *mpm_ctx);
 void SCACPrintSearchStats(MpmThreadCtx *mpm_thread_ctx);
 void SCACRegisterTests(void);
@@ -78,6 +100,11 @@ void SCACRegisterTests(void);
 
 #define STATE_QUEUE_CONTAINER_SIZE 65536
 
+/* use the compressed state table, set from the conf */
+static uint8_t ac_compressed_state_table = 0;
+/* directory of the state table cache, set from the conf */
+static const char *ac_cache_dir = NULL;
+
 /**
  * \brief Helper structure used by AC during state table creation
  */
@@ -104,26 +131,61 @@ void MpmACRegister(void)
     mpm_table[MPM_AC].AddPatternNocase = SCACAddPatternCI;
     mpm_table[MPM_AC].Prepare = SCACPreparePatterns;
     mpm_table[MPM_AC].Search = SCACSearch;
+    mpm_table[MPM_AC].SearchSegments = SCACSearchSegments;
+    mpm_table[MPM_AC].SearchResume = SCACSearchResume;
+    mpm_table[MPM_AC].SearchBatch = SCACSearchBatch;
     mpm_table[MPM_AC].Cleanup = NULL;
     mpm_table[MPM_AC].PrintCtx = SCACPrintInfo;
     mpm_table[MPM_AC].PrintThreadCtx = SCACPrintSearchStats;
     mpm_table[MPM_AC].RegisterUnittests = SCACRegisterTests;
+    mpm_table[MPM_AC].flags = MPM_TABLE_FLAG_PREPARE_MT;
 
     return;
 }
 
 /**
  * \internal
- * \brief Initialize the AC context with user specified conf parameters.  We
- *        aren't retrieving anything for AC conf now, but we will certainly
- *        need it, when we customize AC.
+ * \brief Initialize the AC context with user specified conf parameters.
+ *
+ *        pattern-matcher:
+ *          - ac:
+ *              state_table: full|compressed
+ *              cache-dir: <dir>
  */
 static void SCACGetConfig()
 {
-    //ConfNode *ac_conf;
-    //const char *hash_val = NULL;
+    ConfNode *ac_conf;
+    const char *state_table = NULL;
+
+    /* init defaults */
+    ac_compressed_state_table = 0;
+    ac_cache_dir = NULL;
 
-    //ConfNode *pm = ConfGetNode("pattern-matcher");
+    ConfNode *pm = ConfGetNode("pattern-matcher");
+
+    if (pm != NULL) {
+
+        TAILQ_FOREACH(ac_conf, &pm->head, next) {
+            if (strcmp(ac_conf->val, "ac") == 0) {
+
+                state_table = ConfNodeLookupChildValue
+                        (ac_conf->head.tqh_first, "state_table");
+
+                if (state_table != NULL) {
+                    if (strcmp(state_table, "compressed") == 0) {
+                        ac_compressed_state_table = 1;
+                    } else if (strcmp(state_table, "full") != 0) {
+                        SCLogWarning(SC_ERR_INVALID_YAML_CONF_ENTRY, "invalid "
+                                     "ac state_table \"%s\", using \"full\"",
+                                     state_table);
+                    }
+                }
+
+                ac_cache_dir = ConfNodeLookupChildValue
+                        (ac_conf->head.tqh_first, "cache-dir");
+            }
+        }
+    }
 
     return;
 }
@@ -861,6 +923,245 @@ static inline void SCACClubOutputStatePresenceWithDeltaTable(MpmCtx *mpm_ctx)
     return;
 }
 
+/**
+ * \internal
+ * \brief Create the compressed state table, instead of the delta table.
+ *
+ *        The root and the states directly below it get a dense row.  Every
+ *        other state s has an anchor, the first of those states in its
+ *        failure chain, and a sparse row with the transitions that differ
+ *        from the anchor's.  Where s has no goto transition, its transition
+ *        is the one of its failure state, so the row is the goto
+ *        transitions of s merged with the row of the failure state.  The
+ *        states are processed breadth first, so the row of the failure
+ *        state is always done first.
+ *
+ * \param mpm_ctx Pointer to the mpm context.
+ */
+static inline void SCACCreateCompressedTable(MpmCtx *mpm_ctx)
+{
+    SCACCtx *ctx = (SCACCtx *)mpm_ctx->ctx;
+    uint8_t used[256];
+    uint8_t class_byte[256];
+    uint32_t dense_state[256];
+    uint32_t *order = NULL;
+    uint8_t *pool_class = NULL;
+    uint32_t *pool_next = NULL;
+    uint32_t pool_size = 0, pool_cnt = 0;
+    uint32_t head = 0, tail = 0;
+    uint32_t i, u, cls, state;
+    int c;
+
+    /* every byte used in a pattern gets its own class.  All other bytes
+     * lead back to the root from every state, so they share class 0 */
+    memset(used, 0, sizeof(used));
+    for (i = 0; i < mpm_ctx->pattern_cnt; i++) {
+        for (u = 0; u < ctx->parray[i]->len; u++)
+            used[ctx->parray[i]->ci[u]] = 1;
+    }
+
+    memset(ctx->class_map, 0, sizeof(ctx->class_map));
+    class_byte[0] = 0;
+    ctx->class_cnt = 1;
+    for (c = 0; c < 256; c++) {
+        if (used[c]) {
+            class_byte[ctx->class_cnt] = c;
+            ctx->class_map[c] = ctx->class_cnt++;
+        }
+    }
+    /* the patterns are lowercase, fold the buffer's case in the map */
+    for (c = 0; c < 256; c++)
+        ctx->class_map[c] = ctx->class_map[u8_tolower(c)];
+
+    order = SCMalloc(ctx->state_count * sizeof(uint32_t));
+    ctx->rows = SCMalloc(ctx->state_count * sizeof(SCACRow));
+    if (order == NULL || ctx->rows == NULL) {
+        SCLogError(SC_ERR_MEM_ALLOC, "Error allocating memory");
+        exit(EXIT_FAILURE);
+    }
+    memset(ctx->rows, 0, ctx->state_count * sizeof(SCACRow));
+    mpm_ctx->memory_cnt++;
+    mpm_ctx->memory_size += ctx->state_count * sizeof(SCACRow);
+
+    /* the root and its children are the dense rows.  While building the
+     * sparse rows, start indexes the pool */
+    dense_state[0] = 0;
+    ctx->dense_cnt = 1;
+    for (cls = 1; cls < ctx->class_cnt; cls++) {
+        int32_t temp_state = ctx->goto_table[0][class_byte[cls]];
+        if (temp_state != 0) {
+            order[tail++] = temp_state;
+            ctx->rows[temp_state].anchor = ctx->dense_cnt;
+            dense_state[ctx->dense_cnt++] = temp_state;
+        }
+    }
+
+    while (head < tail) {
+        uint32_t r_state = order[head++];
+        uint32_t f_state = ctx->failure_table[r_state];
+        uint32_t f = ctx->rows[f_state].start;
+        uint32_t f_end = f + ctx->rows[f_state].cnt;
+
+        /* dense rows have no sparse row */
+        if (dense_state[ctx->rows[r_state].anchor] == r_state) {
+            for (cls = 1; cls < ctx->class_cnt; cls++) {
+                if (ctx->goto_table[r_state][class_byte[cls]] != SC_AC_FAIL)
+                    order[tail++] = ctx->goto_table[r_state][class_byte[cls]];
+            }
+            continue;
+        }
+
+        ctx->rows[r_state].anchor = ctx->rows[f_state].anchor;
+
+        /* a row never has more entries than there are classes */
+        if (pool_cnt + ctx->class_cnt > pool_size) {
+            pool_size = (pool_size * 2) + ctx->class_cnt;
+            pool_class = SCRealloc(pool_class, pool_size * sizeof(uint8_t));
+            pool_next = SCRealloc(pool_next, pool_size * sizeof(uint32_t));
+            if (pool_class == NULL || pool_next == NULL) {
+                SCLogError(SC_ERR_MEM_ALLOC, "Error allocating memory");
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        ctx->rows[r_state].start = pool_cnt;
+        for (cls = 1; cls < ctx->class_cnt; cls++) {
+            int32_t temp_state = ctx->goto_table[r_state][class_byte[cls]];
+
+            while (f < f_end && pool_class[f] < cls)
+                f++;
+
+            if (temp_state != SC_AC_FAIL) {
+                order[tail++] = temp_state;
+                pool_class[pool_cnt] = cls;
+                pool_next[pool_cnt++] = temp_state;
+            } else if (f < f_end && pool_class[f] == cls) {
+                pool_class[pool_cnt] = cls;
+                pool_next[pool_cnt++] = pool_next[f];
+            }
+        }
+        ctx->rows[r_state].cnt = pool_cnt - ctx->rows[r_state].start;
+    }
+
+    /* lay the rows out in state order, with 16 bit states if possible */
+    ctx->row_entries = pool_cnt;
+    ctx->row_class = SCMalloc(pool_cnt + 1);
+    if (ctx->row_class == NULL) {
+        SCLogError(SC_ERR_MEM_ALLOC, "Error allocating memory");
+        exit(EXIT_FAILURE);
+    }
+    mpm_ctx->memory_cnt++;
+    mpm_ctx->memory_size += (pool_cnt + 1);
+
+    uint32_t dense_size = ctx->dense_cnt * ctx->class_cnt;
+    if (ctx->state_count < 65536) {
+        ctx->dense_u16 = SCMalloc(dense_size * sizeof(SC_AC_STATE_TYPE_U16));
+        ctx->row_next_u16 = SCMalloc((pool_cnt + 1) * sizeof(SC_AC_STATE_TYPE_U16));
+        if (ctx->dense_u16 == NULL || ctx->row_next_u16 == NULL) {
+            SCLogError(SC_ERR_MEM_ALLOC, "Error allocating memory");
+            exit(EXIT_FAILURE);
+        }
+        mpm_ctx->memory_cnt += 2;
+        mpm_ctx->memory_size += (dense_size + pool_cnt + 1) *
+                                sizeof(SC_AC_STATE_TYPE_U16);
+    } else {
+        ctx->dense_u32 = SCMalloc(dense_size * sizeof(SC_AC_STATE_TYPE_U32));
+        ctx->row_next_u32 = SCMalloc((pool_cnt + 1) * sizeof(SC_AC_STATE_TYPE_U32));
+        if (ctx->dense_u32 == NULL || ctx->row_next_u32 == NULL) {
+            SCLogError(SC_ERR_MEM_ALLOC, "Error allocating memory");
+            exit(EXIT_FAILURE);
+        }
+        mpm_ctx->memory_cnt += 2;
+        mpm_ctx->memory_size += (dense_size + pool_cnt + 1) *
+                                sizeof(SC_AC_STATE_TYPE_U32);
+    }
+
+    for (i = 0; i < ctx->dense_cnt; i++) {
+        for (cls = 0; cls < ctx->class_cnt; cls++) {
+            int32_t temp_state = 0;
+
+            if (cls != 0) {
+                temp_state = ctx->goto_table[dense_state[i]][class_byte[cls]];
+                /* the failure state of the root's children is the root */
+                if (temp_state == SC_AC_FAIL)
+                    temp_state = ctx->goto_table[0][class_byte[cls]];
+            }
+
+            if (ctx->state_count < 65536)
+                ctx->dense_u16[i * ctx->class_cnt + cls] = temp_state;
+            else
+                ctx->dense_u32[i * ctx->class_cnt + cls] = temp_state;
+        }
+    }
+
+    u = 0;
+    for (state = 0; state < ctx->state_count; state++) {
+        uint32_t start = ctx->rows[state].start;
+
+        ctx->rows[state].start = u;
+        for (i = start; i < start + ctx->rows[state].cnt; i++) {
+            ctx->row_class[u] = pool_class[i];
+            if (ctx->state_count < 65536)
+                ctx->row_next_u16[u] = pool_next[i];
+            else
+                ctx->row_next_u32[u] = pool_next[i];
+            u++;
+        }
+    }
+
+    SCFree(order);
+    if (pool_class != NULL)
+        SCFree(pool_class);
+    if (pool_next != NULL)
+        SCFree(pool_next);
+
+    return;
+}
+
+/**
+ * \internal
+ * \brief Get the next state from the compressed state table.
+ *
+ * \param ctx   Pointer to the AC context.
+ * \param state Current state.
+ * \param cls   Byte class of the current byte.
+ *
+ * \retval The next state.
+ */
+static inline uint32_t SCACCompressedNext(const SCACCtx *ctx, uint32_t state,
+                                          uint8_t cls)
+{
+    /* bytes that are in no pattern always go back to the root */
+    if (cls == 0)
+        return 0;
+
+    const SCACRow *row = &ctx->rows[state];
+    uint32_t lo = row->start;
+    uint32_t hi = lo + row->cnt;
+
+    /* narrow long rows down with a binary search, scan the rest */
+    while (hi - lo > 8) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (ctx->row_class[mid] > cls)
+            hi = mid;
+        else
+            lo = mid;
+    }
+
+    for ( ; lo < hi; lo++) {
+        if (ctx->row_class[lo] == cls) {
+            if (ctx->state_count < 65536)
+                return ctx->row_next_u16[lo];
+            return ctx->row_next_u32[lo];
+        }
+    }
+
+    uint32_t dense = row->anchor * ctx->class_cnt + cls;
+    if (ctx->state_count < 65536)
+        return ctx->dense_u16[dense];
+    return ctx->dense_u32[dense];
+}
+
 static inline void SCACInsertCaseSensitiveEntriesForPatterns(MpmCtx *mpm_ctx)
 {
     SCACCtx *ctx = (SCACCtx *)mpm_ctx->ctx;
@@ -918,10 +1219,15 @@ static inline void SCACPrepareStateTable(MpmCtx *mpm_ctx)
     SCACCreateGotoTable(mpm_ctx);
     /* create the failure table */
     SCACCreateFailureTable(mpm_ctx);
-    /* create the final state(delta) table */
-    SCACCreateDeltaTable(mpm_ctx);
-    /* club the output state presence with delta transition entries */
-    SCACClubOutputStatePresenceWithDeltaTable(mpm_ctx);
+    if (ctx->compressed) {
+        /* create the compressed state table */
+        SCACCreateCompressedTable(mpm_ctx);
+    } else {
+        /* create the final state(delta) table */
+        SCACCreateDeltaTable(mpm_ctx);
+        /* club the output state presence with delta transition entries */
+        SCACClubOutputStatePresenceWithDeltaTable(mpm_ctx);
+    }
 
     /* club nocase entries */
     SCACInsertCaseSensitiveEntriesForPatterns(mpm_ctx);
@@ -939,162 +1245,711 @@ static inline void SCACPrepareStateTable(MpmCtx *mpm_ctx)
     return;
 }
 
-/**
- * \brief Process the patterns added to the mpm, and create the internal tables.
- *
- * \param mpm_ctx Pointer to the mpm context.
- */
-int SCACPreparePatterns(MpmCtx *mpm_ctx)
+#ifdef HAVE_SYS_MMAN_H
+
+/* state table cache file.  The file is the header below followed by the
+ * sections, each aligned to SC_AC_CACHE_ALIGN bytes and in host byte
+ * order, so it can only be shared between engines on the same arch */
+#define SC_AC_CACHE_MAGIC       0x43414353
+#define SC_AC_CACHE_VERSION     1
+#define SC_AC_CACHE_ALIGN       64
+
+enum {
+    /* the full state table, or the dense rows of the compressed one */
+    SC_AC_CACHE_SECT_STATES = 0,
+    /* SCACRow, row_class and row_next of the compressed state table */
+    SC_AC_CACHE_SECT_ROWS,
+    SC_AC_CACHE_SECT_ROW_CLASS,
+    SC_AC_CACHE_SECT_ROW_NEXT,
+    /* per state a SCACCacheOutput, and the pids they point to */
+    SC_AC_CACHE_SECT_OUTPUT,
+    SC_AC_CACHE_SECT_PIDS,
+    /* per pid a SCACCachePattern, and the case sensitive patterns they
+     * point to */
+    SC_AC_CACHE_SECT_PATTERNS,
+    SC_AC_CACHE_SECT_PATTERN_BYTES,
+
+    SC_AC_CACHE_SECT_MAX,
+};
+
+typedef struct SCACCacheHdr_ {
+    uint32_t magic;
+    uint32_t version;
+    /* hash of the patterns and the settings the tables depend on */
+    uint64_t key;
+    uint32_t pattern_cnt;
+    uint32_t max_pat_id;
+    uint32_t state_count;
+    uint32_t row_entries;
+    uint16_t class_cnt;
+    uint16_t dense_cnt;
+    uint8_t compressed;
+    uint8_t pad[3];
+    uint8_t class_map[256];
+    uint64_t sect_offset[SC_AC_CACHE_SECT_MAX];
+    uint64_t sect_size[SC_AC_CACHE_SECT_MAX];
+} SCACCacheHdr;
+
+typedef struct SCACCacheOutput_ {
+    uint32_t offset;
+    uint32_t no_of_entries;
+} SCACCacheOutput;
+
+typedef struct SCACCachePattern_ {
+    uint32_t offset;
+    uint16_t patlen;
+    uint16_t case_state;
+} SCACCachePattern;
+
+static inline uint64_t SCACCacheHash(uint64_t hash, const void *data, size_t len)
 {
-    SCACCtx *ctx = (SCACCtx *)mpm_ctx->ctx;
+    const uint8_t *d = (const uint8_t *)data;
+    size_t i;
 
-    if (mpm_ctx->pattern_cnt == 0) {
-        SCLogDebug("no patterns supplied to this mpm_ctx");
-        return 0;
-    }
-
-    /* alloc the pattern array */
-    ctx->parray = (SCACPattern **)SCMalloc(mpm_ctx->pattern_cnt *
-                                           sizeof(SCACPattern *));
-    if (ctx->parray == NULL)
-        goto error;
-    memset(ctx->parray, 0, mpm_ctx->pattern_cnt * sizeof(SCACPattern *));
-    mpm_ctx->memory_cnt++;
-    mpm_ctx->memory_size += (mpm_ctx->pattern_cnt * sizeof(SCACPattern *));
-
-    /* populate it with the patterns in the hash */
-    uint32_t i = 0, p = 0;
-    for (i = 0; i < INIT_HASH_SIZE; i++) {
-        SCACPattern *node = ctx->init_hash[i], *nnode = NULL;
-        while(node != NULL) {
-            nnode = node->next;
-            node->next = NULL;
-            ctx->parray[p++] = node;
-            node = nnode;
-        }
+    /* 64 bit FNV-1a */
+    for (i = 0; i < len; i++) {
+        hash ^= d[i];
+        hash *= 0x100000001b3ULL;
     }
 
-    /* we no longer need the hash, so free it's memory */
-    SCFree(ctx->init_hash);
-    ctx->init_hash = NULL;
+    return hash;
+}
 
-    /* the memory consumed by a single state in our goto table */
-    ctx->single_state_size = sizeof(int32_t) * 256;
+/**
+ * \internal
+ * \brief Hash everything the state tables are built from: the patterns in
+ *        the order they are inserted in the goto table and the layout of
+ *        the tables.
+ *
+ * \param mpm_ctx Pointer to the mpm context, with the parray set up.
+ *
+ * \retval key The cache key.
+ */
+static uint64_t SCACCacheKey(MpmCtx *mpm_ctx)
+{
+    SCACCtx *ctx = (SCACCtx *)mpm_ctx->ctx;
+    uint64_t key = 0xcbf29ce484222325ULL;
+    uint32_t version = SC_AC_CACHE_VERSION;
+    uint32_t i;
 
-    /* handle no case patterns */
-    ctx->pid_pat_list = SCMalloc((ctx->max_pat_id + 1)* sizeof(SCACPatternList));
-    if (ctx->pid_pat_list == NULL) {
-        SCLogError(SC_ERR_MEM_ALLOC, "Error allocating memory");
-        exit(EXIT_FAILURE);
-    }
-    memset(ctx->pid_pat_list, 0, (ctx->max_pat_id + 1) * sizeof(SCACPatternList));
+    key = SCACCacheHash(key, &version, sizeof(version));
+    key = SCACCacheHash(key, &ctx->compressed, sizeof(ctx->compressed));
+    key = SCACCacheHash(key, &mpm_ctx->pattern_cnt, sizeof(mpm_ctx->pattern_cnt));
+    key = SCACCacheHash(key, &ctx->max_pat_id, sizeof(ctx->max_pat_id));
 
     for (i = 0; i < mpm_ctx->pattern_cnt; i++) {
-        if (ctx->parray[i]->flags & MPM_PATTERN_FLAG_NOCASE) {
-            if (ctx->pid_pat_list[ctx->parray[i]->id].case_state == 0)
-                ctx->pid_pat_list[ctx->parray[i]->id].case_state = 1;
-            else if (ctx->pid_pat_list[ctx->parray[i]->id].case_state == 1)
-                ctx->pid_pat_list[ctx->parray[i]->id].case_state = 1;
-            else
-                ctx->pid_pat_list[ctx->parray[i]->id].case_state = 3;
-        } else {
-            //if (memcmp(ctx->parray[i]->original_pat, ctx->parray[i]->ci,
-            //           ctx->parray[i]->len) != 0) {
-                ctx->pid_pat_list[ctx->parray[i]->id].cs = SCMalloc(ctx->parray[i]->len);
-                if (ctx->pid_pat_list[ctx->parray[i]->id].cs == NULL) {
-                    SCLogError(SC_ERR_MEM_ALLOC, "Error allocating memory");
-                    exit(EXIT_FAILURE);
-                }
-                memcpy(ctx->pid_pat_list[ctx->parray[i]->id].cs,
-                       ctx->parray[i]->original_pat, ctx->parray[i]->len);
-                ctx->pid_pat_list[ctx->parray[i]->id].patlen = ctx->parray[i]->len;
-
-                if (ctx->pid_pat_list[ctx->parray[i]->id].case_state == 0)
-                    ctx->pid_pat_list[ctx->parray[i]->id].case_state = 2;
-                else if (ctx->pid_pat_list[ctx->parray[i]->id].case_state == 2)
-                    ctx->pid_pat_list[ctx->parray[i]->id].case_state = 2;
-                else
-                    ctx->pid_pat_list[ctx->parray[i]->id].case_state = 3;
-                //}
-        }
-    }
+        SCACPattern *p = ctx->parray[i];
 
-    /* prepare the state table required by AC */
-    SCACPrepareStateTable(mpm_ctx);
-
-    /* free all the stored patterns.  Should save us a good 100-200 mbs */
-    for (i = 0; i < mpm_ctx->pattern_cnt; i++) {
-        if (ctx->parray[i] != NULL) {
-            SCACFreePattern(mpm_ctx, ctx->parray[i]);
-        }
+        key = SCACCacheHash(key, &p->id, sizeof(p->id));
+        key = SCACCacheHash(key, &p->flags, sizeof(p->flags));
+        key = SCACCacheHash(key, &p->len, sizeof(p->len));
+        key = SCACCacheHash(key, p->original_pat, p->len);
     }
-    SCFree(ctx->parray);
-    ctx->parray = NULL;
-    mpm_ctx->memory_cnt--;
-    mpm_ctx->memory_size -= (mpm_ctx->pattern_cnt * sizeof(SCACPattern *));
 
-    return 0;
-
-error:
-    return -1;
+    return key;
 }
 
 /**
- * \brief Init the mpm thread context.
+ * \internal
+ * \brief Write a section to the cache file, aligned to SC_AC_CACHE_ALIGN.
  *
- * \param mpm_ctx        Pointer to the mpm context.
- * \param mpm_thread_ctx Pointer to the mpm thread context.
- * \param matchsize      We don't need this.
+ * \param fp   The cache file.
+ * \param hdr  Header to record the section offset and size in.
+ * \param sect The section.
+ * \param data Section data, or NULL if the caller writes the data itself.
+ * \param size Section size.
+ *
+ * \retval 0 on success, -1 on a write error.
  */
-void SCACInitThreadCtx(MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx, uint32_t matchsize)
+static int SCACCacheWriteSection(FILE *fp, SCACCacheHdr *hdr, int sect,
+                                 const void *data, uint64_t size)
 {
-    memset(mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    static const uint8_t zero[SC_AC_CACHE_ALIGN];
+    long pos = ftell(fp);
 
-    mpm_thread_ctx->ctx = SCMalloc(sizeof(SCACThreadCtx));
-    if (mpm_thread_ctx->ctx == NULL) {
-        exit(EXIT_FAILURE);
+    if (pos < 0)
+        return -1;
+
+    if (pos % SC_AC_CACHE_ALIGN != 0) {
+        size_t pad = SC_AC_CACHE_ALIGN - (pos % SC_AC_CACHE_ALIGN);
+        if (fwrite(zero, 1, pad, fp) != pad)
+            return -1;
+        pos += pad;
     }
-    memset(mpm_thread_ctx->ctx, 0, sizeof(SCACThreadCtx));
-    mpm_thread_ctx->memory_cnt++;
-    mpm_thread_ctx->memory_size += sizeof(SCACThreadCtx);
 
-    return;
+    hdr->sect_offset[sect] = (uint64_t)pos;
+    hdr->sect_size[sect] = size;
+
+    if (data != NULL && size > 0 && fwrite(data, 1, size, fp) != size)
+        return -1;
+
+    return 0;
 }
 
 /**
- * \brief Initialize the AC context.
+ * \internal
+ * \brief Store the state, output and pattern tables of a prepared ctx in
+ *        the cache.  The file is written under a temporary name and renamed,
+ *        so engines that have the previous file mapped keep a valid copy.
  *
- * \param mpm_ctx       Mpm context.
- * \param module_handle Cuda module handle from the cuda handler API.  We don't
- *                      have to worry about this here.
+ * \param mpm_ctx Pointer to the mpm context.
+ * \param key     Cache key from SCACCacheKey().
  */
-void SCACInitCtx(MpmCtx *mpm_ctx, int module_handle)
+static void SCACCacheStore(MpmCtx *mpm_ctx, uint64_t key)
 {
-    if (mpm_ctx->ctx != NULL)
+    SCACCtx *ctx = (SCACCtx *)mpm_ctx->ctx;
+    char path[PATH_MAX];
+    char tmp_path[PATH_MAX];
+    SCACCacheHdr hdr;
+    FILE *fp = NULL;
+    uint32_t state_size = (ctx->state_count < 65536) ?
+                          sizeof(SC_AC_STATE_TYPE_U16) : sizeof(SC_AC_STATE_TYPE_U32);
+    uint32_t i, offset;
+    int fd;
+
+    if (snprintf(path, sizeof(path), "%s/ac-%016" PRIx64 ".cache",
+                 ctx->cache_dir, key) >= (int)sizeof(path) ||
+        snprintf(tmp_path, sizeof(tmp_path), "%s.XXXXXX", path) >= (int)sizeof(tmp_path))
         return;
 
-    mpm_ctx->ctx = SCMalloc(sizeof(SCACCtx));
-    if (mpm_ctx->ctx == NULL) {
-        exit(EXIT_FAILURE);
+    fd = mkstemp(tmp_path);
+    if (fd < 0) {
+        SCLogWarning(SC_ERR_FOPEN, "failed to create ac cache file \"%s\": %s",
+                     tmp_path, strerror(errno));
+        return;
+    }
+    fp = fdopen(fd, "w");
+    if (fp == NULL) {
+        close(fd);
+        goto error;
     }
-    memset(mpm_ctx->ctx, 0, sizeof(SCACCtx));
 
-    mpm_ctx->memory_cnt++;
-    mpm_ctx->memory_size += sizeof(SCACCtx);
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = SC_AC_CACHE_MAGIC;
+    hdr.version = SC_AC_CACHE_VERSION;
+    hdr.key = key;
+    hdr.pattern_cnt = mpm_ctx->pattern_cnt;
+    hdr.max_pat_id = ctx->max_pat_id;
+    hdr.state_count = ctx->state_count;
+    hdr.compressed = ctx->compressed;
+
+    /* the header is rewritten once the section offsets are known */
+    if (fwrite(&hdr, 1, sizeof(hdr), fp) != sizeof(hdr))
+        goto error;
 
-    /* initialize the hash we use to speed up pattern insertions */
-    SCACCtx *ctx = (SCACCtx *)mpm_ctx->ctx;
-    ctx->init_hash = SCMalloc(sizeof(SCACPattern *) * INIT_HASH_SIZE);
-    if (ctx->init_hash == NULL) {
-        exit(EXIT_FAILURE);
+    if (ctx->compressed) {
+        hdr.row_entries = ctx->row_entries;
+        hdr.class_cnt = ctx->class_cnt;
+        hdr.dense_cnt = ctx->dense_cnt;
+        memcpy(hdr.class_map, ctx->class_map, sizeof(hdr.class_map));
+
+        uint64_t dense_size = (uint64_t)ctx->dense_cnt * ctx->class_cnt;
+        uint64_t next_size = (uint64_t)ctx->row_entries + 1;
+        if (SCACCacheWriteSection(fp, &hdr, SC_AC_CACHE_SECT_STATES,
+                    (state_size == 2) ? (void *)ctx->dense_u16 : (void *)ctx->dense_u32,
+                    dense_size * state_size) < 0 ||
+            SCACCacheWriteSection(fp, &hdr, SC_AC_CACHE_SECT_ROWS, ctx->rows,
+                    (uint64_t)ctx->state_count * sizeof(SCACRow)) < 0 ||
+            SCACCacheWriteSection(fp, &hdr, SC_AC_CACHE_SECT_ROW_CLASS,
+                    ctx->row_class, next_size) < 0 ||
+            SCACCacheWriteSection(fp, &hdr, SC_AC_CACHE_SECT_ROW_NEXT,
+                    (state_size == 2) ? (void *)ctx->row_next_u16 : (void *)ctx->row_next_u32,
+                    next_size * state_size) < 0)
+            goto error;
+    } else {
+        if (SCACCacheWriteSection(fp, &hdr, SC_AC_CACHE_SECT_STATES,
+                    (state_size == 2) ? (void *)ctx->state_table_u16 : (void *)ctx->state_table_u32,
+                    (uint64_t)ctx->state_count * 256 * state_size) < 0)
+            goto error;
     }
-    memset(ctx->init_hash, 0, sizeof(SCACPattern *) * INIT_HASH_SIZE);
 
-    /* get conf values for AC from our yaml file.  We have no conf values for
-     * now.  We will certainly need this, as we develop the algo */
-    SCACGetConfig();
+    /* output table index, then the pids it points to */
+    if (SCACCacheWriteSection(fp, &hdr, SC_AC_CACHE_SECT_OUTPUT, NULL,
+                (uint64_t)ctx->state_count * sizeof(SCACCacheOutput)) < 0)
+        goto error;
+    for (i = 0, offset = 0; i < ctx->state_count; i++) {
+        SCACCacheOutput out = { offset, ctx->output_table[i].no_of_entries };
+        if (fwrite(&out, 1, sizeof(out), fp) != sizeof(out))
+            goto error;
+        offset += out.no_of_entries;
+    }
+    if (SCACCacheWriteSection(fp, &hdr, SC_AC_CACHE_SECT_PIDS, NULL,
+                (uint64_t)offset * sizeof(uint32_t)) < 0)
+        goto error;
+    for (i = 0; i < ctx->state_count; i++) {
+        uint32_t cnt = ctx->output_table[i].no_of_entries;
+        if (cnt > 0 && fwrite(ctx->output_table[i].pids, sizeof(uint32_t), cnt, fp) != cnt)
+            goto error;
+    }
 
-    SCReturn;
+    /* pid to pattern list, then the case sensitive patterns */
+    if (SCACCacheWriteSection(fp, &hdr, SC_AC_CACHE_SECT_PATTERNS, NULL,
+                ((uint64_t)ctx->max_pat_id + 1) * sizeof(SCACCachePattern)) < 0)
+        goto error;
+    for (i = 0, offset = 0; i <= ctx->max_pat_id; i++) {
+        SCACCachePattern pat = { offset, ctx->pid_pat_list[i].patlen,
+                                 ctx->pid_pat_list[i].case_state };
+        if (ctx->pid_pat_list[i].cs == NULL)
+            pat.patlen = 0;
+        if (fwrite(&pat, 1, sizeof(pat), fp) != sizeof(pat))
+            goto error;
+        offset += pat.patlen;
+    }
+    if (SCACCacheWriteSection(fp, &hdr, SC_AC_CACHE_SECT_PATTERN_BYTES, NULL,
+                offset) < 0)
+        goto error;
+    for (i = 0; i <= ctx->max_pat_id; i++) {
+        uint16_t len = ctx->pid_pat_list[i].patlen;
+        if (ctx->pid_pat_list[i].cs != NULL && len > 0 &&
+            fwrite(ctx->pid_pat_list[i].cs, 1, len, fp) != len)
+            goto error;
+    }
+
+    if (fseek(fp, 0, SEEK_SET) != 0 ||
+        fwrite(&hdr, 1, sizeof(hdr), fp) != sizeof(hdr))
+        goto error;
+    if (fclose(fp) != 0) {
+        fp = NULL;
+        goto error;
+    }
+    fp = NULL;
+
+    if (rename(tmp_path, path) != 0)
+        goto error;
+
+    SCLogDebug("stored ac state tables in \"%s\"", path);
+    return;
+
+error:
+    SCLogWarning(SC_ERR_FOPEN, "failed to write ac cache file \"%s\": %s",
+                 path, strerror(errno));
+    if (fp != NULL)
+        fclose(fp);
+    unlink(tmp_path);
+    return;
+}
+
+/**
+ * \internal
+ * \brief Check that a section of the mapped cache file is within the file
+ *        and has the expected size.
+ */
+static inline int SCACCacheSectionValid(const SCACCacheHdr *hdr, size_t map_size,
+                                        int sect, uint64_t size)
+{
+    return (hdr->sect_size[sect] == size &&
+            hdr->sect_offset[sect] % SC_AC_CACHE_ALIGN == 0 &&
+            hdr->sect_offset[sect] <= map_size &&
+            size <= map_size - hdr->sect_offset[sect]);
+}
+
+/**
+ * \internal
+ * \brief Check that the cnt states of a cached state array all lie below
+ *        state_count.
+ *
+ * \param mask Mask for the state bits of a u32 state, 0x00FFFFFF for the
+ *             full table that carries the output flag in the high bits.
+ */
+static int SCACCacheStatesValid(const uint8_t *states, uint64_t cnt,
+                                uint64_t state_size, uint32_t state_count,
+                                uint32_t mask)
+{
+    uint64_t i;
+
+    if (state_size == sizeof(SC_AC_STATE_TYPE_U16)) {
+        const SC_AC_STATE_TYPE_U16 *s16 = (const SC_AC_STATE_TYPE_U16 *)states;
+        for (i = 0; i < cnt; i++) {
+            if (s16[i] >= state_count)
+                return 0;
+        }
+    } else {
+        const SC_AC_STATE_TYPE_U32 *s32 = (const SC_AC_STATE_TYPE_U32 *)states;
+        for (i = 0; i < cnt; i++) {
+            if ((s32[i] & mask) >= state_count)
+                return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * \internal
+ * \brief Set up the tables of a ctx from the cache, if it has a file for
+ *        the key.  The file is mapped read only and shared, the state and
+ *        row tables are used in place and their pages are only read in as
+ *        the search touches them.  Only the output table and the pid to
+ *        pattern list are rebuilt on the heap, pointing into the mapping.
+ *
+ *        The sections are bounds checked, and so are the state, row and
+ *        pattern id values in them, as the search uses them as indexes.
+ *        A truncated, stale or corrupt file is rebuilt.
+ *
+ * \param mpm_ctx Pointer to the mpm context.
+ * \param key     Cache key from SCACCacheKey().
+ *
+ * \retval 1 if the tables were loaded, 0 if they have to be built.
+ */
+static int SCACCacheLoad(MpmCtx *mpm_ctx, uint64_t key)
+{
+    SCACCtx *ctx = (SCACCtx *)mpm_ctx->ctx;
+    char path[PATH_MAX];
+    struct stat st;
+    void *map = NULL;
+    size_t map_size = 0;
+    uint32_t i;
+    int fd;
+
+    if (snprintf(path, sizeof(path), "%s/ac-%016" PRIx64 ".cache",
+                 ctx->cache_dir, key) >= (int)sizeof(path))
+        return 0;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return 0;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(SCACCacheHdr)) {
+        close(fd);
+        goto invalid;
+    }
+    map_size = (size_t)st.st_size;
+    map = mmap(NULL, map_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        map = NULL;
+        goto invalid;
+    }
+
+    const SCACCacheHdr *hdr = (const SCACCacheHdr *)map;
+    if (hdr->magic != SC_AC_CACHE_MAGIC || hdr->version != SC_AC_CACHE_VERSION ||
+        hdr->key != key || hdr->pattern_cnt != mpm_ctx->pattern_cnt ||
+        hdr->max_pat_id != ctx->max_pat_id || hdr->compressed != ctx->compressed ||
+        hdr->state_count == 0)
+        goto invalid;
+
+    uint32_t state_count = hdr->state_count;
+    uint64_t state_size = (state_count < 65536) ?
+                          sizeof(SC_AC_STATE_TYPE_U16) : sizeof(SC_AC_STATE_TYPE_U32);
+    uint8_t *base = (uint8_t *)map;
+
+    if (hdr->compressed) {
+        uint64_t next_size = (uint64_t)hdr->row_entries + 1;
+        if (hdr->class_cnt == 0 || hdr->class_cnt > 256 ||
+            !SCACCacheSectionValid(hdr, map_size, SC_AC_CACHE_SECT_STATES,
+                (uint64_t)hdr->dense_cnt * hdr->class_cnt * state_size) ||
+            !SCACCacheSectionValid(hdr, map_size, SC_AC_CACHE_SECT_ROWS,
+                (uint64_t)state_count * sizeof(SCACRow)) ||
+            !SCACCacheSectionValid(hdr, map_size, SC_AC_CACHE_SECT_ROW_CLASS,
+                next_size) ||
+            !SCACCacheSectionValid(hdr, map_size, SC_AC_CACHE_SECT_ROW_NEXT,
+                next_size * state_size))
+            goto invalid;
+
+        /* the values the search indexes with: classes, row ranges, anchors
+         * and next states */
+        for (i = 0; i < 256; i++) {
+            if (hdr->class_map[i] >= hdr->class_cnt)
+                goto invalid;
+        }
+        const SCACRow *rows = (const SCACRow *)(base + hdr->sect_offset[SC_AC_CACHE_SECT_ROWS]);
+        for (i = 0; i < state_count; i++) {
+            if ((uint64_t)rows[i].start + rows[i].cnt > hdr->row_entries ||
+                rows[i].anchor >= hdr->dense_cnt)
+                goto invalid;
+        }
+        if (!SCACCacheStatesValid(base + hdr->sect_offset[SC_AC_CACHE_SECT_STATES],
+                (uint64_t)hdr->dense_cnt * hdr->class_cnt, state_size, state_count,
+                0xFFFFFFFF) ||
+            !SCACCacheStatesValid(base + hdr->sect_offset[SC_AC_CACHE_SECT_ROW_NEXT],
+                hdr->row_entries, state_size, state_count, 0xFFFFFFFF))
+            goto invalid;
+    } else {
+        if (!SCACCacheSectionValid(hdr, map_size, SC_AC_CACHE_SECT_STATES,
+                (uint64_t)state_count * 256 * state_size) ||
+            !SCACCacheStatesValid(base + hdr->sect_offset[SC_AC_CACHE_SECT_STATES],
+                (uint64_t)state_count * 256, state_size, state_count, 0x00FFFFFF))
+            goto invalid;
+    }
+    if (!SCACCacheSectionValid(hdr, map_size, SC_AC_CACHE_SECT_OUTPUT,
+            (uint64_t)state_count * sizeof(SCACCacheOutput)) ||
+        !SCACCacheSectionValid(hdr, map_size, SC_AC_CACHE_SECT_PIDS,
+            hdr->sect_size[SC_AC_CACHE_SECT_PIDS]) ||
+        hdr->sect_size[SC_AC_CACHE_SECT_PIDS] % sizeof(uint32_t) != 0 ||
+        !SCACCacheSectionValid(hdr, map_size, SC_AC_CACHE_SECT_PATTERNS,
+            ((uint64_t)hdr->max_pat_id + 1) * sizeof(SCACCachePattern)) ||
+        !SCACCacheSectionValid(hdr, map_size, SC_AC_CACHE_SECT_PATTERN_BYTES,
+            hdr->sect_size[SC_AC_CACHE_SECT_PATTERN_BYTES]))
+        goto invalid;
+
+    /* output table and pid to pattern list, pointing into the mapping */
+    const SCACCacheOutput *out =
+        (const SCACCacheOutput *)(base + hdr->sect_offset[SC_AC_CACHE_SECT_OUTPUT]);
+    uint32_t *pids = (uint32_t *)(base + hdr->sect_offset[SC_AC_CACHE_SECT_PIDS]);
+    uint64_t pid_cnt = hdr->sect_size[SC_AC_CACHE_SECT_PIDS] / sizeof(uint32_t);
+    uint64_t u;
+
+    /* the pids index the pattern list and the pmq */
+    for (u = 0; u < pid_cnt; u++) {
+        if ((pids[u] & 0x0000FFFF) > ctx->max_pat_id)
+            goto invalid;
+    }
+
+    ctx->output_table = SCMalloc(state_count * sizeof(SCACOutputTable));
+    if (ctx->output_table == NULL)
+        goto error;
+    for (i = 0; i < state_count; i++) {
+        if ((uint64_t)out[i].offset + out[i].no_of_entries > pid_cnt)
+            goto error;
+        ctx->output_table[i].pids = pids + out[i].offset;
+        ctx->output_table[i].no_of_entries = out[i].no_of_entries;
+    }
+
+    const SCACCachePattern *pat =
+        (const SCACCachePattern *)(base + hdr->sect_offset[SC_AC_CACHE_SECT_PATTERNS]);
+    uint8_t *pat_bytes = base + hdr->sect_offset[SC_AC_CACHE_SECT_PATTERN_BYTES];
+    uint64_t pat_bytes_size = hdr->sect_size[SC_AC_CACHE_SECT_PATTERN_BYTES];
+
+    ctx->pid_pat_list = SCMalloc((ctx->max_pat_id + 1) * sizeof(SCACPatternList));
+    if (ctx->pid_pat_list == NULL)
+        goto error;
+    memset(ctx->pid_pat_list, 0, (ctx->max_pat_id + 1) * sizeof(SCACPatternList));
+    for (i = 0; i <= ctx->max_pat_id; i++) {
+        if ((uint64_t)pat[i].offset + pat[i].patlen > pat_bytes_size)
+            goto error;
+        ctx->pid_pat_list[i].case_state = pat[i].case_state;
+        if (pat[i].patlen > 0) {
+            ctx->pid_pat_list[i].cs = pat_bytes + pat[i].offset;
+            ctx->pid_pat_list[i].patlen = pat[i].patlen;
+        }
+    }
+
+    /* the state tables are used in place */
+    ctx->state_count = state_count;
+    if (hdr->compressed) {
+        ctx->class_cnt = hdr->class_cnt;
+        ctx->dense_cnt = hdr->dense_cnt;
+        ctx->row_entries = hdr->row_entries;
+        memcpy(ctx->class_map, hdr->class_map, sizeof(ctx->class_map));
+        ctx->rows = (SCACRow *)(base + hdr->sect_offset[SC_AC_CACHE_SECT_ROWS]);
+        ctx->row_class = base + hdr->sect_offset[SC_AC_CACHE_SECT_ROW_CLASS];
+        if (state_size == sizeof(SC_AC_STATE_TYPE_U16)) {
+            ctx->dense_u16 = (SC_AC_STATE_TYPE_U16 *)(base + hdr->sect_offset[SC_AC_CACHE_SECT_STATES]);
+            ctx->row_next_u16 = (SC_AC_STATE_TYPE_U16 *)(base + hdr->sect_offset[SC_AC_CACHE_SECT_ROW_NEXT]);
+        } else {
+            ctx->dense_u32 = (SC_AC_STATE_TYPE_U32 *)(base + hdr->sect_offset[SC_AC_CACHE_SECT_STATES]);
+            ctx->row_next_u32 = (SC_AC_STATE_TYPE_U32 *)(base + hdr->sect_offset[SC_AC_CACHE_SECT_ROW_NEXT]);
+        }
+    } else {
+        if (state_size == sizeof(SC_AC_STATE_TYPE_U16)) {
+            ctx->state_table_u16 = (SC_AC_STATE_TYPE_U16 (*)[256])
+                (base + hdr->sect_offset[SC_AC_CACHE_SECT_STATES]);
+        } else {
+            ctx->state_table_u32 = (SC_AC_STATE_TYPE_U32 (*)[256])
+                (base + hdr->sect_offset[SC_AC_CACHE_SECT_STATES]);
+        }
+    }
+
+    ctx->cache_map = map;
+    ctx->cache_map_size = map_size;
+
+    /* only the heap part counts, the mapping is shared page cache */
+    mpm_ctx->memory_cnt += 2;
+    mpm_ctx->memory_size += (state_count * sizeof(SCACOutputTable)) +
+                            ((ctx->max_pat_id + 1) * sizeof(SCACPatternList));
+
+    SCLogDebug("loaded ac state tables from \"%s\"", path);
+    return 1;
+
+error:
+    if (ctx->output_table != NULL) {
+        SCFree(ctx->output_table);
+        ctx->output_table = NULL;
+    }
+    if (ctx->pid_pat_list != NULL) {
+        SCFree(ctx->pid_pat_list);
+        ctx->pid_pat_list = NULL;
+    }
+invalid:
+    SCLogWarning(SC_ERR_FOPEN, "ignoring invalid ac cache file \"%s\", "
+                 "rebuilding it", path);
+    if (map != NULL)
+        munmap(map, map_size);
+    return 0;
+}
+
+#endif /* HAVE_SYS_MMAN_H */
+
+/**
+ * \brief Process the patterns added to the mpm, and create the internal tables.
+ *
+ * \param mpm_ctx Pointer to the mpm context.
+ */
+int SCACPreparePatterns(MpmCtx *mpm_ctx)
+{
+    SCACCtx *ctx = (SCACCtx *)mpm_ctx->ctx;
+
+    if (mpm_ctx->pattern_cnt == 0) {
+        SCLogDebug("no patterns supplied to this mpm_ctx");
+        return 0;
+    }
+
+    /* alloc the pattern array */
+    ctx->parray = (SCACPattern **)SCMalloc(mpm_ctx->pattern_cnt *
+                                           sizeof(SCACPattern *));
+    if (ctx->parray == NULL)
+        goto error;
+    memset(ctx->parray, 0, mpm_ctx->pattern_cnt * sizeof(SCACPattern *));
+    mpm_ctx->memory_cnt++;
+    mpm_ctx->memory_size += (mpm_ctx->pattern_cnt * sizeof(SCACPattern *));
+
+    /* populate it with the patterns in the hash */
+    uint32_t i = 0, p = 0;
+    for (i = 0; i < INIT_HASH_SIZE; i++) {
+        SCACPattern *node = ctx->init_hash[i], *nnode = NULL;
+        while(node != NULL) {
+            nnode = node->next;
+            node->next = NULL;
+            ctx->parray[p++] = node;
+            node = nnode;
+        }
+    }
+
+    /* we no longer need the hash, so free it's memory */
+    SCFree(ctx->init_hash);
+    ctx->init_hash = NULL;
+
+#ifdef HAVE_SYS_MMAN_H
+    uint64_t cache_key = 0;
+    if (ctx->cache_dir != NULL) {
+        cache_key = SCACCacheKey(mpm_ctx);
+        if (SCACCacheLoad(mpm_ctx, cache_key) == 1)
+            goto free_patterns;
+    }
+#endif
+
+    /* the memory consumed by a single state in our goto table */
+    ctx->single_state_size = sizeof(int32_t) * 256;
+
+    /* handle no case patterns */
+    ctx->pid_pat_list = SCMalloc((ctx->max_pat_id + 1)* sizeof(SCACPatternList));
+    if (ctx->pid_pat_list == NULL) {
+        SCLogError(SC_ERR_MEM_ALLOC, "Error allocating memory");
+        exit(EXIT_FAILURE);
+    }
+    memset(ctx->pid_pat_list, 0, (ctx->max_pat_id + 1) * sizeof(SCACPatternList));
+
+    for (i = 0; i < mpm_ctx->pattern_cnt; i++) {
+        if (ctx->parray[i]->flags & MPM_PATTERN_FLAG_NOCASE) {
+            if (ctx->pid_pat_list[ctx->parray[i]->id].case_state == 0)
+                ctx->pid_pat_list[ctx->parray[i]->id].case_state = 1;
+            else if (ctx->pid_pat_list[ctx->parray[i]->id].case_state == 1)
+                ctx->pid_pat_list[ctx->parray[i]->id].case_state = 1;
+            else
+                ctx->pid_pat_list[ctx->parray[i]->id].case_state = 3;
+        } else {
+            //if (memcmp(ctx->parray[i]->original_pat, ctx->parray[i]->ci,
+            //           ctx->parray[i]->len) != 0) {
+                ctx->pid_pat_list[ctx->parray[i]->id].cs = SCMalloc(ctx->parray[i]->len);
+                if (ctx->pid_pat_list[ctx->parray[i]->id].cs == NULL) {
+                    SCLogError(SC_ERR_MEM_ALLOC, "Error allocating memory");
+                    exit(EXIT_FAILURE);
+                }
+                memcpy(ctx->pid_pat_list[ctx->parray[i]->id].cs,
+                       ctx->parray[i]->original_pat, ctx->parray[i]->len);
+                ctx->pid_pat_list[ctx->parray[i]->id].patlen = ctx->parray[i]->len;
+
+                if (ctx->pid_pat_list[ctx->parray[i]->id].case_state == 0)
+                    ctx->pid_pat_list[ctx->parray[i]->id].case_state = 2;
+                else if (ctx->pid_pat_list[ctx->parray[i]->id].case_state == 2)
+                    ctx->pid_pat_list[ctx->parray[i]->id].case_state = 2;
+                else
+                    ctx->pid_pat_list[ctx->parray[i]->id].case_state = 3;
+                //}
+        }
+    }
+
+    /* prepare the state table required by AC */
+    SCACPrepareStateTable(mpm_ctx);
+
+#ifdef HAVE_SYS_MMAN_H
+    if (ctx->cache_dir != NULL)
+        SCACCacheStore(mpm_ctx, cache_key);
+
+free_patterns:
+#endif
+    /* free all the stored patterns.  Should save us a good 100-200 mbs */
+    for (i = 0; i < mpm_ctx->pattern_cnt; i++) {
+        if (ctx->parray[i] != NULL) {
+            SCACFreePattern(mpm_ctx, ctx->parray[i]);
+        }
+    }
+    SCFree(ctx->parray);
+    ctx->parray = NULL;
+    mpm_ctx->memory_cnt--;
+    mpm_ctx->memory_size -= (mpm_ctx->pattern_cnt * sizeof(SCACPattern *));
+
+    return 0;
+
+error:
+    return -1;
+}
+
+/**
+ * \brief Init the mpm thread context.
+ *
+ * \param mpm_ctx        Pointer to the mpm context.
+ * \param mpm_thread_ctx Pointer to the mpm thread context.
+ * \param matchsize      We don't need this.
+ */
+void SCACInitThreadCtx(MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx, uint32_t matchsize)
+{
+    memset(mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+
+    mpm_thread_ctx->ctx = SCMalloc(sizeof(SCACThreadCtx));
+    if (mpm_thread_ctx->ctx == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    memset(mpm_thread_ctx->ctx, 0, sizeof(SCACThreadCtx));
+    mpm_thread_ctx->memory_cnt++;
+    mpm_thread_ctx->memory_size += sizeof(SCACThreadCtx);
+
+    return;
+}
+
+/**
+ * \brief Initialize the AC context.
+ *
+ * \param mpm_ctx       Mpm context.
+ * \param module_handle Cuda module handle from the cuda handler API.  We don't
+ *                      have to worry about this here.
+ */
+void SCACInitCtx(MpmCtx *mpm_ctx, int module_handle)
+{
+    if (mpm_ctx->ctx != NULL)
+        return;
+
+    mpm_ctx->ctx = SCMalloc(sizeof(SCACCtx));
+    if (mpm_ctx->ctx == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    memset(mpm_ctx->ctx, 0, sizeof(SCACCtx));
+
+    mpm_ctx->memory_cnt++;
+    mpm_ctx->memory_size += sizeof(SCACCtx);
+
+    /* initialize the hash we use to speed up pattern insertions */
+    SCACCtx *ctx = (SCACCtx *)mpm_ctx->ctx;
+    ctx->init_hash = SCMalloc(sizeof(SCACPattern *) * INIT_HASH_SIZE);
+    if (ctx->init_hash == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    memset(ctx->init_hash, 0, sizeof(SCACPattern *) * INIT_HASH_SIZE);
+
+    /* get conf values for AC from our yaml file */
+    SCACGetConfig();
+    ctx->compressed = ac_compressed_state_table;
+    ctx->cache_dir = ac_cache_dir;
+
+    SCReturn;
 }
 
 /**
@@ -1149,6 +2004,30 @@ void SCACDestroyCtx(MpmCtx *mpm_ctx)
         mpm_ctx->memory_size -= (mpm_ctx->pattern_cnt * sizeof(SCACPattern *));
     }
 
+#ifdef HAVE_SYS_MMAN_H
+    if (ctx->cache_map != NULL) {
+        /* the tables point into the cache file mapping */
+        SCFree(ctx->output_table);
+        ctx->output_table = NULL;
+        SCFree(ctx->pid_pat_list);
+        ctx->pid_pat_list = NULL;
+        mpm_ctx->memory_cnt -= 2;
+        mpm_ctx->memory_size -= (ctx->state_count * sizeof(SCACOutputTable)) +
+                                ((ctx->max_pat_id + 1) * sizeof(SCACPatternList));
+
+        munmap(ctx->cache_map, ctx->cache_map_size);
+        ctx->cache_map = NULL;
+        ctx->state_table_u16 = NULL;
+        ctx->state_table_u32 = NULL;
+        ctx->rows = NULL;
+        ctx->row_class = NULL;
+        ctx->dense_u16 = NULL;
+        ctx->dense_u32 = NULL;
+        ctx->row_next_u16 = NULL;
+        ctx->row_next_u32 = NULL;
+    }
+#endif
+
     if (ctx->state_count < 65536) {
         if (ctx->state_table_u16 != NULL) {
             SCFree(ctx->state_table_u16);
@@ -1167,6 +2046,34 @@ void SCACDestroyCtx(MpmCtx *mpm_ctx)
         }
     }
 
+    if (ctx->rows != NULL) {
+        SCFree(ctx->rows);
+        ctx->rows = NULL;
+        SCFree(ctx->row_class);
+        ctx->row_class = NULL;
+        mpm_ctx->memory_cnt -= 2;
+        mpm_ctx->memory_size -= (ctx->state_count * sizeof(SCACRow)) +
+                                (ctx->row_entries + 1);
+
+        uint32_t dense_size = ctx->dense_cnt * ctx->class_cnt;
+        if (ctx->dense_u16 != NULL) {
+            SCFree(ctx->dense_u16);
+            ctx->dense_u16 = NULL;
+            SCFree(ctx->row_next_u16);
+            ctx->row_next_u16 = NULL;
+            mpm_ctx->memory_size -= (dense_size + ctx->row_entries + 1) *
+                                    sizeof(SC_AC_STATE_TYPE_U16);
+        } else {
+            SCFree(ctx->dense_u32);
+            ctx->dense_u32 = NULL;
+            SCFree(ctx->row_next_u32);
+            ctx->row_next_u32 = NULL;
+            mpm_ctx->memory_size -= (dense_size + ctx->row_entries + 1) *
+                                    sizeof(SC_AC_STATE_TYPE_U32);
+        }
+        mpm_ctx->memory_cnt -= 2;
+    }
+
     SCFree(mpm_ctx->ctx);
     mpm_ctx->memory_cnt--;
     mpm_ctx->memory_size -= sizeof(SCACCtx);
@@ -1175,7 +2082,54 @@ void SCACDestroyCtx(MpmCtx *mpm_ctx)
 }
 
 /**
- * \brief The aho corasick search function.
+ * \internal
+ * \brief Add the patterns of a state with output to the pmq.  Shared by
+ *        all state table layouts and search variants.
+ *
+ *        A case sensitive pattern that doesn't fit in buf up to i started
+ *        in an earlier chunk of a resumed search.  It can't be verified,
+ *        so it is reported as a match.
+ *
+ * \param state    The state, without flags.
+ * \param buf      Buffer searched, the match ends at buf[i].
+ * \param pid_tags Pattern id to buffer tag table, NULL for no tag check.
+ * \param tag      Tag of buf, for the pid_tags check.
+ *
+ * \retval matches Match count.
+ */
+static inline uint32_t SCACOutput(const SCACCtx *ctx,
+        MpmThreadCtx *mpm_thread_ctx, PatternMatcherQueue *pmq,
+        uint32_t state, uint8_t *buf, uint32_t i,
+        const uint8_t *pid_tags, uint8_t tag)
+{
+    SCACPatternList *pid_pat_list = ctx->pid_pat_list;
+    uint32_t no_of_entries = ctx->output_table[state].no_of_entries;
+    uint32_t *pids = ctx->output_table[state].pids;
+    uint32_t matches = 0;
+    uint32_t k;
+
+    for (k = 0; k < no_of_entries; k++) {
+        uint32_t pid = pids[k] & 0x0000FFFF;
+
+        if (pid_tags != NULL && !(pid_tags[pid] & tag))
+            continue;
+
+        if ((pids[k] & 0xFFFF0000) && (i + 1) >= pid_pat_list[pid].patlen) {
+            if (SCMemcmp(pid_pat_list[pid].cs,
+                         buf + i - pid_pat_list[pid].patlen + 1,
+                         pid_pat_list[pid].patlen) != 0) {
+                if (pid_pat_list[pid].case_state != 3)
+                    continue;
+            }
+        }
+        matches += MpmVerifyMatch(mpm_thread_ctx, pmq, pid);
+    }
+
+    return matches;
+}
+
+/**
+ * \brief The aho corasick search function.
  *
  * \param mpm_ctx        Pointer to the mpm context.
  * \param mpm_thread_ctx Pointer to the mpm thread context.
@@ -1190,9 +2144,26 @@ uint32_t SCACSearch(MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
                     PatternMatcherQueue *pmq, uint8_t *buf, uint16_t buflen)
 {
     SCACCtx *ctx = (SCACCtx *)mpm_ctx->ctx;
-    int i = 0;
-    int matches = 0;
-    //int j = 0;
+    uint32_t i = 0;
+    uint32_t matches = 0;
+
+    if (ctx->compressed) {
+        uint32_t state = 0;
+
+        if (ctx->rows == NULL)
+            return 0;
+
+        for (i = 0; i < buflen; i++) {
+            state = SCACCompressedNext(ctx, state, ctx->class_map[buf[i]]);
+            if (ctx->output_table[state].no_of_entries == 0)
+                continue;
+
+            matches += SCACOutput(ctx, mpm_thread_ctx, pmq, state, buf, i,
+                                  NULL, 0);
+        }
+
+        return matches;
+    }
 
     if (ctx->state_count < 65536) {
         /* \todo tried loop unrolling with register var, with no perf increase.  Need
@@ -1201,77 +2172,393 @@ uint32_t SCACSearch(MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
         register SC_AC_STATE_TYPE_U16 state = 0;
         for (i = 0; i < buflen; i++) {
             state = ctx->state_table_u16[state][u8_tolower(buf[i])];
-            if (ctx->output_table[state].no_of_entries != 0) {
-                uint32_t k = 0;
-                uint32_t no_of_entries = ctx->output_table[state].no_of_entries;
-                uint32_t *pids = ctx->output_table[state].pids;
-                for (k = 0; k < no_of_entries; k++) {
-                    if (pids[k] & 0xFFFF0000) {
-                        if (SCMemcmp(ctx->pid_pat_list[pids[k] & 0x0000FFFF].cs,
-                                   buf + i - ctx->pid_pat_list[pids[k] & 0x0000FFFF].patlen + 1,
-                                   ctx->pid_pat_list[pids[k] & 0x0000FFFF].patlen) != 0) {
-                            /* inside loop */
-                            if (ctx->pid_pat_list[pids[k] & 0x0000FFFF].case_state != 3)
-                                continue;
-                        }
-                        matches += MpmVerifyMatch(mpm_thread_ctx, pmq, pids[k] & 0x0000FFFF);
-                    } else {
-                        matches += MpmVerifyMatch(mpm_thread_ctx, pmq, pids[k]);
-                    }
-                    //loop:
-                    //;
-                }
-            }
+            if (ctx->output_table[state].no_of_entries == 0)
+                continue;
+
+            matches += SCACOutput(ctx, mpm_thread_ctx, pmq, state, buf, i,
+                                  NULL, 0);
         } /* for (i = 0; i < buflen; i++) */
     } else {
         /* \todo tried loop unrolling with register var, with no perf increase.  Need
          * to dig deeper */
         /* \todo Change it for stateful MPM.  Supply the state using mpm_thread_ctx */
         SC_AC_STATE_TYPE_U32 (*state_table_u32)[256] = ctx->state_table_u32;
-        SCACPatternList *pid_pat_list = ctx->pid_pat_list;
         register SC_AC_STATE_TYPE_U32 state = 0;
         for (i = 0; i < buflen; i++) {
             state = state_table_u32[state & 0x00FFFFFF][u8_tolower(buf[i])];
-            if (state & 0xFF000000) {
-                uint32_t no_of_entries = ctx->output_table[state & 0x00FFFFFF].no_of_entries;
-                uint32_t *pids = ctx->output_table[state & 0x00FFFFFF].pids;
-                uint32_t k;
-                for (k = 0; k < no_of_entries; k++) {
-                    if (pids[k] & 0xFFFF0000) {
-                        if (SCMemcmp(pid_pat_list[pids[k] & 0x0000FFFF].cs,
-                                   buf + i - pid_pat_list[pids[k] & 0x0000FFFF].patlen + 1,
-                                   pid_pat_list[pids[k] & 0x0000FFFF].patlen) != 0) {
-                            /* inside loop */
-                            if (pid_pat_list[pids[k] & 0x0000FFFF].case_state != 3) {
-                                continue;
-                            }
-                        }
-                        if (pmq->pattern_id_bitarray[(pids[k] & 0x0000FFFF) / 8] & (1 << ((pids[k] & 0x0000FFFF) % 8))) {
-                            ;
-                        } else {
-                            pmq->pattern_id_bitarray[(pids[k] & 0x0000FFFF) / 8] |= (1 << ((pids[k] & 0x0000FFFF) % 8));
-                            pmq->pattern_id_array[pmq->pattern_id_array_cnt++] = pids[k] & 0x0000FFFF;
-                        }
-                        matches++;
-                    } else {
-                        if (pmq->pattern_id_bitarray[pids[k] / 8] & (1 << (pids[k] % 8))) {
-                            ;
-                        } else {
-                            pmq->pattern_id_bitarray[pids[k] / 8] |= (1 << (pids[k] % 8));
-                            pmq->pattern_id_array[pmq->pattern_id_array_cnt++] = pids[k];
-                        }
-                        matches++;
-                    }
-                    //loop1:
-                    //;
-                }
-            }
+            if (!(state & 0xFF000000))
+                continue;
+
+            matches += SCACOutput(ctx, mpm_thread_ctx, pmq, state & 0x00FFFFFF,
+                                  buf, i, NULL, 0);
         } /* for (i = 0; i < buflen; i++) */
     } /* else - if (ctx->state_count < 65536) */
 
     return matches;
 }
 
+/* number of buffers searched interleaved by SearchSegments/SearchBatch */
+#define SC_AC_SEARCH_LANES 8
+
+/* state table layouts, for SCACSearchLanes */
+#define SC_AC_LANES_U16         0
+#define SC_AC_LANES_U32         1
+#define SC_AC_LANES_COMPRESSED  2
+
+/**
+ * \internal
+ * \brief A buffer that is searched interleaved with others.
+ */
+typedef struct SCACLane_ {
+    uint8_t *buf;
+    uint32_t pos;
+    uint32_t end;
+    uint32_t state;
+    PatternMatcherQueue *pmq;
+    uint32_t *matches;
+    uint8_t tag;
+} SCACLane;
+
+/**
+ * \internal
+ * \brief The buffers to hand out to the lanes, either the segments of a
+ *        SearchSegments call or the buffers of a SearchBatch call.
+ */
+typedef struct SCACLaneSource_ {
+    MpmBufferSegment *segs;
+    MpmBatchBuffer *batch;
+    PatternMatcherQueue *pmq;
+    uint16_t cnt;
+    uint16_t next;
+    uint32_t matches;
+} SCACLaneSource;
+
+/**
+ * \internal
+ * \brief Put the next non empty buffer of the source in a lane.
+ *
+ * \retval 1 if the lane was filled, 0 if the source is exhausted.
+ */
+static inline int SCACLaneFill(SCACLaneSource *src, SCACLane *lane)
+{
+    for ( ; src->next < src->cnt; src->next++) {
+        if (src->segs != NULL) {
+            MpmBufferSegment *seg = &src->segs[src->next];
+            if (seg->buf == NULL || seg->buflen == 0)
+                continue;
+
+            lane->buf = seg->buf;
+            lane->end = seg->buflen;
+            lane->tag = seg->tag;
+            lane->pmq = src->pmq;
+            lane->matches = &src->matches;
+        } else {
+            MpmBatchBuffer *bb = &src->batch[src->next];
+            bb->matches = 0;
+            if (bb->buf == NULL || bb->buflen == 0)
+                continue;
+
+            lane->buf = bb->buf;
+            lane->end = bb->buflen;
+            lane->tag = 0;
+            lane->pmq = bb->pmq;
+            lane->matches = &bb->matches;
+        }
+        lane->pos = 0;
+        lane->state = 0;
+        src->next++;
+        return 1;
+    }
+
+    return 0;
+}
+
+/**
+ * \internal
+ * \brief Search the buffers of a source, up to SC_AC_SEARCH_LANES at a
+ *        time.
+ *
+ *        The lanes advance in lockstep, a byte of each lane per round.
+ *        The transitions of the lanes don't depend on each other, so
+ *        their state table loads overlap instead of each waiting on the
+ *        previous one.  A finished lane takes the next buffer.
+ *
+ * \param layout SC_AC_LANES_*, a constant so each layout gets its own
+ *               inlined copy.
+ *
+ * \retval matches Match count.
+ */
+static inline uint32_t SCACSearchLanes(const SCACCtx *ctx,
+        MpmThreadCtx *mpm_thread_ctx, SCACLaneSource *src,
+        const uint8_t *pid_tags, const int layout)
+{
+    SCACLane lanes[SC_AC_SEARCH_LANES];
+    uint32_t matches = 0;
+    uint32_t n = 0;
+    uint32_t j;
+    /* the compressed table lookups are bound by the row searches, not by
+     * memory latency, so there is nothing to gain from interleaving */
+    const uint32_t max_lanes =
+        (layout == SC_AC_LANES_COMPRESSED) ? 1 : SC_AC_SEARCH_LANES;
+
+    while (n < max_lanes && SCACLaneFill(src, &lanes[n]))
+        n++;
+
+    while (n > 0) {
+        /* all lanes can take as many steps as the shortest has left */
+        uint32_t steps = lanes[0].end - lanes[0].pos;
+        for (j = 1; j < n; j++) {
+            if (lanes[j].end - lanes[j].pos < steps)
+                steps = lanes[j].end - lanes[j].pos;
+        }
+
+        /* keep the cursors and states in locals for the hot loop, the
+         * lanes are only synced when a state has output */
+        uint8_t *cur[SC_AC_SEARCH_LANES];
+        uint32_t st[SC_AC_SEARCH_LANES];
+        for (j = 0; j < n; j++) {
+            cur[j] = lanes[j].buf + lanes[j].pos;
+            st[j] = lanes[j].state;
+        }
+
+        uint32_t s;
+        for (s = 0; s < steps; s++) {
+            for (j = 0; j < n; j++) {
+                uint8_t c = cur[j][s];
+                uint32_t state;
+                uint32_t out = 0;
+
+                if (layout == SC_AC_LANES_U16) {
+                    state = ctx->state_table_u16[st[j]][u8_tolower(c)];
+                    out = (ctx->output_table[state].no_of_entries != 0);
+                } else if (layout == SC_AC_LANES_U32) {
+                    state = ctx->state_table_u32[st[j] & 0x00FFFFFF][u8_tolower(c)];
+                    out = (state & 0xFF000000);
+                } else {
+                    state = SCACCompressedNext(ctx, st[j], ctx->class_map[c]);
+                    out = (ctx->output_table[state].no_of_entries != 0);
+                }
+                st[j] = state;
+
+                if (out) {
+                    lanes[j].pos = (cur[j] - lanes[j].buf) + s;
+                    uint32_t m = SCACOutput(ctx, mpm_thread_ctx, lanes[j].pmq,
+                                            state & 0x00FFFFFF, lanes[j].buf,
+                                            lanes[j].pos, pid_tags, lanes[j].tag);
+                    *lanes[j].matches += m;
+                    matches += m;
+                }
+            }
+        }
+
+        for (j = 0; j < n; j++) {
+            lanes[j].pos = (cur[j] - lanes[j].buf) + steps;
+            lanes[j].state = st[j];
+        }
+
+        /* refill the finished lanes, or drop them if we are out of buffers */
+        for (j = 0; j < n; ) {
+            if (lanes[j].pos < lanes[j].end) {
+                j++;
+            } else if (SCACLaneFill(src, &lanes[j])) {
+                j++;
+            } else {
+                lanes[j] = lanes[--n];
+            }
+        }
+    }
+
+    return matches;
+}
+
+/**
+ * \internal
+ * \brief Run SCACSearchLanes with the state table layout of the ctx.
+ */
+static uint32_t SCACSearchLanesDispatch(const SCACCtx *ctx,
+        MpmThreadCtx *mpm_thread_ctx, SCACLaneSource *src,
+        const uint8_t *pid_tags)
+{
+    if (ctx->compressed)
+        return SCACSearchLanes(ctx, mpm_thread_ctx, src, pid_tags,
+                               SC_AC_LANES_COMPRESSED);
+    else if (ctx->state_count < 65536)
+        return SCACSearchLanes(ctx, mpm_thread_ctx, src, pid_tags,
+                               SC_AC_LANES_U16);
+    else
+        return SCACSearchLanes(ctx, mpm_thread_ctx, src, pid_tags,
+                               SC_AC_LANES_U32);
+}
+
+/**
+ * \brief The aho corasick search function for a list of tagged buffers.
+ *
+ *        All segments are run through the same state table in a single
+ *        call, up to SC_AC_SEARCH_LANES of them interleaved.  The state is
+ *        reset at the start of every segment, so a pattern can't match
+ *        across 2 segments.  A matching pattern id is only added to the
+ *        pmq if its entry in pid_tags shares a bit with the tag of the
+ *        segment it was found in.
+ *
+ * \param mpm_ctx        Pointer to the mpm context.
+ * \param mpm_thread_ctx Pointer to the mpm thread context.
+ * \param pmq            Pointer to the Pattern Matcher Queue to hold
+ *                       search matches.
+ * \param segs           Array of buffers to be searched.
+ * \param segs_cnt       Number of entries in segs.
+ * \param pid_tags       Pattern id to buffer tag table.
+ *
+ * \retval matches Match count.
+ */
+uint32_t SCACSearchSegments(MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
+                            PatternMatcherQueue *pmq, MpmBufferSegment *segs,
+                            uint16_t segs_cnt, uint8_t *pid_tags)
+{
+    SCACCtx *ctx = (SCACCtx *)mpm_ctx->ctx;
+    SCACLaneSource src;
+
+    if (ctx->state_count == 0)
+        return 0;
+
+    memset(&src, 0, sizeof(src));
+    src.segs = segs;
+    src.pmq = pmq;
+    src.cnt = segs_cnt;
+
+    return SCACSearchLanesDispatch(ctx, mpm_thread_ctx, &src, pid_tags);
+}
+
+/**
+ * \brief The aho corasick search function for a batch of independent
+ *        buffers, like the payloads of several packets.  With a full
+ *        state table up to SC_AC_SEARCH_LANES buffers are searched
+ *        interleaved, see SCACSearchLanes.
+ *
+ * \param mpm_ctx        Pointer to the mpm context.
+ * \param mpm_thread_ctx Pointer to the mpm thread context.
+ * \param batch          Buffers to search, each with its own pmq.
+ * \param cnt            Number of entries in batch.
+ *
+ * \retval matches Total match count, the count per buffer is set in batch.
+ */
+uint32_t SCACSearchBatch(MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
+                         MpmBatchBuffer *batch, uint16_t cnt)
+{
+    SCACCtx *ctx = (SCACCtx *)mpm_ctx->ctx;
+    SCACLaneSource src;
+    uint16_t i;
+
+    if (ctx->state_count == 0) {
+        for (i = 0; i < cnt; i++)
+            batch[i].matches = 0;
+        return 0;
+    }
+
+    /* the compressed table gains nothing from interleaving, see
+     * SCACSearchLanes, so use the tighter single buffer loop */
+    if (ctx->compressed) {
+        uint32_t matches = 0;
+        for (i = 0; i < cnt; i++) {
+            batch[i].matches = 0;
+            if (batch[i].buf == NULL || batch[i].buflen == 0)
+                continue;
+            batch[i].matches = SCACSearch(mpm_ctx, mpm_thread_ctx,
+                                          batch[i].pmq, batch[i].buf,
+                                          batch[i].buflen);
+            matches += batch[i].matches;
+        }
+        return matches;
+    }
+
+    memset(&src, 0, sizeof(src));
+    src.batch = batch;
+    src.cnt = cnt;
+
+    return SCACSearchLanesDispatch(ctx, mpm_thread_ctx, &src, NULL);
+}
+
+/**
+ * \brief The aho corasick search function for data that arrives in chunks.
+ *
+ *        The search starts in the state left behind by the previous chunk
+ *        and stores the state it ends in, so a pattern spanning 2 chunks is
+ *        found without rescanning any data.  If the state was created for
+ *        another mpm ctx the search starts from scratch.
+ *
+ *        A case sensitive pattern that started in an earlier chunk can't be
+ *        verified as that data is gone.  It is reported as a match, which is
+ *        safe as the mpm is only a prefilter.
+ *
+ * \param mpm_ctx        Pointer to the mpm context.
+ * \param mpm_thread_ctx Pointer to the mpm thread context.
+ * \param pmq            Pointer to the Pattern Matcher Queue to hold
+ *                       search matches.
+ * \param ss             Pointer to the stream state to resume from/save to.
+ * \param buf            Buffer to be searched.
+ * \param buflen         Buffer length.
+ *
+ * \retval matches Match count.
+ */
+uint32_t SCACSearchResume(MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
+                          PatternMatcherQueue *pmq, MpmStreamState *ss,
+                          uint8_t *buf, uint32_t buflen)
+{
+    SCACCtx *ctx = (SCACCtx *)mpm_ctx->ctx;
+    uint32_t matches = 0;
+    uint32_t i = 0;
+
+    if (ss->mpm_ctx != mpm_ctx) {
+        ss->mpm_ctx = mpm_ctx;
+        ss->state = 0;
+    }
+
+    if (ctx->state_count == 0)
+        return 0;
+
+    /* a state that doesn't fit this automaton can't be from it */
+    if (ss->state >= ctx->state_count)
+        ss->state = 0;
+
+    if (ctx->compressed) {
+        uint32_t state = ss->state;
+        for (i = 0; i < buflen; i++) {
+            state = SCACCompressedNext(ctx, state, ctx->class_map[buf[i]]);
+            if (ctx->output_table[state].no_of_entries == 0)
+                continue;
+
+            matches += SCACOutput(ctx, mpm_thread_ctx, pmq, state, buf, i,
+                                  NULL, 0);
+        }
+        ss->state = state;
+    } else if (ctx->state_count < 65536) {
+        register SC_AC_STATE_TYPE_U16 state = (SC_AC_STATE_TYPE_U16)ss->state;
+        for (i = 0; i < buflen; i++) {
+            state = ctx->state_table_u16[state][u8_tolower(buf[i])];
+            if (ctx->output_table[state].no_of_entries == 0)
+                continue;
+
+            matches += SCACOutput(ctx, mpm_thread_ctx, pmq, state, buf, i,
+                                  NULL, 0);
+        }
+        ss->state = state;
+    } else {
+        SC_AC_STATE_TYPE_U32 (*state_table_u32)[256] = ctx->state_table_u32;
+        register SC_AC_STATE_TYPE_U32 state = ss->state;
+        for (i = 0; i < buflen; i++) {
+            state = state_table_u32[state & 0x00FFFFFF][u8_tolower(buf[i])];
+            if (!(state & 0xFF000000))
+                continue;
+
+            matches += SCACOutput(ctx, mpm_thread_ctx, pmq, state & 0x00FFFFFF,
+                                  buf, i, NULL, 0);
+        }
+        /* without the output flag, it's no state index */
+        ss->state = state & 0x00FFFFFF;
+    }
+
+    return matches;
+}
+
 /**
  * \brief Add a case insensitive pattern.  Although we have different calls for
  *        adding case sensitive and insensitive patterns, we make a single call
@@ -1321,45 +2608,355 @@ int SCACAddPatternCS(MpmCtx *mpm_ctx, uint8_t *pat, uint16_t patlen,
     return SCACAddPattern(mpm_ctx, pat, patlen, offset, depth, pid, sid, flags);
 }
 
-void SCACPrintSearchStats(MpmThreadCtx *mpm_thread_ctx)
-{
+void SCACPrintSearchStats(MpmThreadCtx *mpm_thread_ctx)
+{
+
+#ifdef SC_AC_COUNTERS
+    SCACThreadCtx *ctx = (SCACThreadCtx *)mpm_thread_ctx->ctx;
+    printf("AC Thread Search stats (ctx %p)\n", ctx);
+    printf("Total calls: %" PRIu32 "\n", ctx->total_calls);
+    printf("Total matches: %" PRIu64 "\n", ctx->total_matches);
+#endif /* SC_AC_COUNTERS */
+
+    return;
+}
+
+void SCACPrintInfo(MpmCtx *mpm_ctx)
+{
+    SCACCtx *ctx = (SCACCtx *)mpm_ctx->ctx;
+
+    printf("MPM AC Information:\n");
+    printf("Memory allocs:   %" PRIu32 "\n", mpm_ctx->memory_cnt);
+    printf("Memory alloced:  %" PRIu32 "\n", mpm_ctx->memory_size);
+    printf(" Sizeof:\n");
+    printf("  MpmCtx         %" PRIuMAX "\n", (uintmax_t)sizeof(MpmCtx));
+    printf("  SCACCtx:         %" PRIuMAX "\n", (uintmax_t)sizeof(SCACCtx));
+    printf("  SCACPattern      %" PRIuMAX "\n", (uintmax_t)sizeof(SCACPattern));
+    printf("  SCACPattern     %" PRIuMAX "\n", (uintmax_t)sizeof(SCACPattern));
+    printf("Unique Patterns: %" PRIu32 "\n", mpm_ctx->pattern_cnt);
+    printf("Smallest:        %" PRIu32 "\n", mpm_ctx->minlen);
+    printf("Largest:         %" PRIu32 "\n", mpm_ctx->maxlen);
+    printf("Total states in the state table:    %" PRIu32 "\n", ctx->state_count);
+
+    /* what the full table takes, or would take */
+    uint32_t state_size = (ctx->state_count < 65536) ?
+        sizeof(SC_AC_STATE_TYPE_U16) : sizeof(SC_AC_STATE_TYPE_U32);
+    uint64_t full_size = (uint64_t)ctx->state_count * 256 * state_size;
+
+    if (ctx->compressed) {
+        uint64_t compressed_size = (uint64_t)ctx->state_count * sizeof(SCACRow) +
+            ((uint64_t)ctx->row_entries + 1) * (1 + state_size) +
+            (uint64_t)ctx->dense_cnt * ctx->class_cnt * state_size;
+
+        printf("State table:     compressed, %" PRIu32 " bit states\n",
+               state_size * 8);
+        printf("Byte classes:    %" PRIu32 "\n", ctx->class_cnt);
+        printf("Dense rows:      %" PRIu32 "\n", ctx->dense_cnt);
+        printf("Sparse entries:  %" PRIu32 " (%.2f per state)\n",
+               ctx->row_entries, ctx->state_count ?
+               (double)ctx->row_entries / ctx->state_count : 0.0);
+        printf("Table size:      %" PRIu64 " bytes, full table would be %"
+               PRIu64 " bytes (%.1f%%)\n", compressed_size, full_size,
+               full_size ? (double)compressed_size * 100 / full_size : 0.0);
+    } else {
+        printf("State table:     full, %" PRIu32 " bit states\n", state_size * 8);
+        printf("Table size:      %" PRIu64 " bytes\n", full_size);
+    }
+    printf("\n");
+
+    return;
+}
+
+/*************************************Unittests********************************/
+
+#ifdef UNITTESTS
+
+static int SCACTest01(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_AC, -1);
+    SCACInitThreadCtx(&mpm_ctx, &mpm_thread_ctx, 0);
+
+    /* 1 match */
+    SCACAddPatternCS(&mpm_ctx, (uint8_t *)"abcd", 4, 0, 0, 0, 0, 0);
+
+    SCACPreparePatterns(&mpm_ctx);
+
+    char *buf = "abcdefghjiklmnopqrstuvwxyz";
+    uint32_t cnt = SCACSearch(&mpm_ctx, &mpm_thread_ctx, NULL,
+                               (uint8_t *)buf, strlen(buf));
+
+    if (cnt == 1)
+        result = 1;
+    else
+        printf("1 != %" PRIu32 " ",cnt);
+
+    SCACDestroyCtx(&mpm_ctx);
+    SCACDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    return result;
+}
+
+static int SCACTest02(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_AC, -1);
+    SCACInitThreadCtx(&mpm_ctx, &mpm_thread_ctx, 0);
+
+    /* 1 match */
+    SCACAddPatternCS(&mpm_ctx, (uint8_t *)"abce", 4, 0, 0, 0, 0, 0);
+
+    SCACPreparePatterns(&mpm_ctx);
+
+    char *buf = "abcdefghjiklmnopqrstuvwxyz";
+    uint32_t cnt = SCACSearch(&mpm_ctx, &mpm_thread_ctx, NULL,
+                               (uint8_t *)buf, strlen(buf));
+
+    if (cnt == 0)
+        result = 1;
+    else
+        printf("0 != %" PRIu32 " ",cnt);
+
+    SCACDestroyCtx(&mpm_ctx);
+    SCACDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    return result;
+}
+
+static int SCACTest03(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+
+    memset(&mpm_ctx, 0x00, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_AC, -1);
+    SCACInitThreadCtx(&mpm_ctx, &mpm_thread_ctx, 0);
+
+    /* 1 match */
+    SCACAddPatternCS(&mpm_ctx, (uint8_t *)"abcd", 4, 0, 0, 0, 0, 0);
+    /* 1 match */
+    SCACAddPatternCS(&mpm_ctx, (uint8_t *)"bcde", 4, 0, 0, 1, 0, 0);
+    /* 1 match */
+    SCACAddPatternCS(&mpm_ctx, (uint8_t *)"fghj", 4, 0, 0, 2, 0, 0);
+
+    SCACPreparePatterns(&mpm_ctx);
+
+    char *buf = "abcdefghjiklmnopqrstuvwxyz";
+    uint32_t cnt = SCACSearch(&mpm_ctx, &mpm_thread_ctx, NULL,
+                               (uint8_t *)buf, strlen(buf));
+
+    if (cnt == 3)
+        result = 1;
+    else
+        printf("3 != %" PRIu32 " ",cnt);
+
+    SCACDestroyCtx(&mpm_ctx);
+    SCACDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    return result;
+}
+
+static int SCACTest04(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_AC, -1);
+    SCACInitThreadCtx(&mpm_ctx, &mpm_thread_ctx, 0);
+
+    SCACAddPatternCS(&mpm_ctx, (uint8_t *)"abcd", 4, 0, 0, 0, 0, 0);
+    SCACAddPatternCS(&mpm_ctx, (uint8_t *)"bcdegh", 6, 0, 0, 1, 0, 0);
+    SCACAddPatternCS(&mpm_ctx, (uint8_t *)"fghjxyz", 7, 0, 0, 2, 0, 0);
+
+    SCACPreparePatterns(&mpm_ctx);
+
+    char *buf = "abcdefghjiklmnopqrstuvwxyz";
+    uint32_t cnt = SCACSearch(&mpm_ctx, &mpm_thread_ctx, NULL,
+                               (uint8_t *)buf, strlen(buf));
+
+    if (cnt == 1)
+        result = 1;
+    else
+        printf("1 != %" PRIu32 " ",cnt);
+
+    SCACDestroyCtx(&mpm_ctx);
+    SCACDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    return result;
+}
+
+static int SCACTest05(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+
+    memset(&mpm_ctx, 0x00, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_AC, -1);
+    SCACInitThreadCtx(&mpm_ctx, &mpm_thread_ctx, 0);
+
+    SCACAddPatternCI(&mpm_ctx, (uint8_t *)"ABCD", 4, 0, 0, 0, 0, 0);
+    SCACAddPatternCI(&mpm_ctx, (uint8_t *)"bCdEfG", 6, 0, 0, 1, 0, 0);
+    SCACAddPatternCI(&mpm_ctx, (uint8_t *)"fghJikl", 7, 0, 0, 2, 0, 0);
+
+    SCACPreparePatterns(&mpm_ctx);
+
+    char *buf = "abcdefghjiklmnopqrstuvwxyz";
+    uint32_t cnt = SCACSearch(&mpm_ctx, &mpm_thread_ctx, NULL,
+                               (uint8_t *)buf, strlen(buf));
+
+    if (cnt == 3)
+        result = 1;
+    else
+        printf("3 != %" PRIu32 " ",cnt);
+
+    SCACDestroyCtx(&mpm_ctx);
+    SCACDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    return result;
+}
+
+static int SCACTest06(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_AC, -1);
+    SCACInitThreadCtx(&mpm_ctx, &mpm_thread_ctx, 0);
+
+    SCACAddPatternCS(&mpm_ctx, (uint8_t *)"abcd", 4, 0, 0, 0, 0, 0);
+
+    SCACPreparePatterns(&mpm_ctx);
+
+    char *buf = "abcd";
+    uint32_t cnt = SCACSearch(&mpm_ctx, &mpm_thread_ctx, NULL,
+                               (uint8_t *)buf, strlen(buf));
+
+    if (cnt == 1)
+        result = 1;
+    else
+        printf("1 != %" PRIu32 " ",cnt);
+
+    SCACDestroyCtx(&mpm_ctx);
+    SCACDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    return result;
+}
+
+static int SCACTest07(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_AC, -1);
+    SCACInitThreadCtx(&mpm_ctx, &mpm_thread_ctx, 0);
+
+    /* should match 30 times */
+    SCACAddPatternCS(&mpm_ctx, (uint8_t *)"A", 1, 0, 0, 0, 0, 0);
+    /* should match 29 times */
+    SCACAddPatternCS(&mpm_ctx, (uint8_t *)"AA", 2, 0, 0, 1, 0, 0);
+    /* should match 28 times */
+    SCACAddPatternCS(&mpm_ctx, (uint8_t *)"AAA", 3, 0, 0, 2, 0, 0);
+    /* 26 */
+    SCACAddPatternCS(&mpm_ctx, (uint8_t *)"AAAAA", 5, 0, 0, 3, 0, 0);
+    /* 21 */
+    SCACAddPatternCS(&mpm_ctx, (uint8_t *)"AAAAAAAAAA", 10, 0, 0, 4, 0, 0);
+    /* 1 */
+    SCACAddPatternCS(&mpm_ctx, (uint8_t *)"AAAAAAAAAAAAAAAAAAAAAAAAAAAAAA",
+                     30, 0, 0, 5, 0, 0);
+    /* total matches: 135 */
+
+    SCACPreparePatterns(&mpm_ctx);
+
+    char *buf = "AAAAAAAAAAAAAAAAAAAAAAAAAAAAAA";
+    uint32_t cnt = SCACSearch(&mpm_ctx, &mpm_thread_ctx, NULL,
+                               (uint8_t *)buf, strlen(buf));
+
+    if (cnt == 135)
+        result = 1;
+    else
+        printf("135 != %" PRIu32 " ",cnt);
+
+    SCACDestroyCtx(&mpm_ctx);
+    SCACDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    return result;
+}
+
+static int SCACTest08(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_AC, -1);
+    SCACInitThreadCtx(&mpm_ctx, &mpm_thread_ctx, 0);
+
+    /* 1 match */
+    SCACAddPatternCS(&mpm_ctx, (uint8_t *)"abcd", 4, 0, 0, 0, 0, 0);
+
+    SCACPreparePatterns(&mpm_ctx);
+
+    uint32_t cnt = SCACSearch(&mpm_ctx, &mpm_thread_ctx, NULL,
+                               (uint8_t *)"a", 1);
 
-#ifdef SC_AC_COUNTERS
-    SCACThreadCtx *ctx = (SCACThreadCtx *)mpm_thread_ctx->ctx;
-    printf("AC Thread Search stats (ctx %p)\n", ctx);
-    printf("Total calls: %" PRIu32 "\n", ctx->total_calls);
-    printf("Total matches: %" PRIu64 "\n", ctx->total_matches);
-#endif /* SC_AC_COUNTERS */
+    if (cnt == 0)
+        result = 1;
+    else
+        printf("0 != %" PRIu32 " ",cnt);
 
-    return;
+    SCACDestroyCtx(&mpm_ctx);
+    SCACDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    return result;
 }
 
-void SCACPrintInfo(MpmCtx *mpm_ctx)
+static int SCACTest09(void)
 {
-    SCACCtx *ctx = (SCACCtx *)mpm_ctx->ctx;
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
 
-    printf("MPM AC Information:\n");
-    printf("Memory allocs:   %" PRIu32 "\n", mpm_ctx->memory_cnt);
-    printf("Memory alloced:  %" PRIu32 "\n", mpm_ctx->memory_size);
-    printf(" Sizeof:\n");
-    printf("  MpmCtx         %" PRIuMAX "\n", (uintmax_t)sizeof(MpmCtx));
-    printf("  SCACCtx:         %" PRIuMAX "\n", (uintmax_t)sizeof(SCACCtx));
-    printf("  SCACPattern      %" PRIuMAX "\n", (uintmax_t)sizeof(SCACPattern));
-    printf("  SCACPattern     %" PRIuMAX "\n", (uintmax_t)sizeof(SCACPattern));
-    printf("Unique Patterns: %" PRIu32 "\n", mpm_ctx->pattern_cnt);
-    printf("Smallest:        %" PRIu32 "\n", mpm_ctx->minlen);
-    printf("Largest:         %" PRIu32 "\n", mpm_ctx->maxlen);
-    printf("Total states in the state table:    %" PRIu32 "\n", ctx->state_count);
-    printf("\n");
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_AC, -1);
+    SCACInitThreadCtx(&mpm_ctx, &mpm_thread_ctx, 0);
 
-    return;
-}
+    /* 1 match */
+    SCACAddPatternCS(&mpm_ctx, (uint8_t *)"ab", 2, 0, 0, 0, 0, 0);
 
-/*************************************Unittests********************************/
+    SCACPreparePatterns(&mpm_ctx);
 
-#ifdef UNITTESTS
+    uint32_t cnt = SCACSearch(&mpm_ctx, &mpm_thread_ctx, NULL,
+                               (uint8_t *)"ab", 2);
 
-static int SCACTest01(void)
+    if (cnt == 1)
+        result = 1;
+    else
+        printf("1 != %" PRIu32 " ",cnt);
+
+    SCACDestroyCtx(&mpm_ctx);
+    SCACDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    return result;
+}
+
+static int SCACTest10(void)
 {
     int result = 0;
     MpmCtx mpm_ctx;
@@ -1371,11 +2968,15 @@ static int SCACTest01(void)
     SCACInitThreadCtx(&mpm_ctx, &mpm_thread_ctx, 0);
 
     /* 1 match */
-    SCACAddPatternCS(&mpm_ctx, (uint8_t *)"abcd", 4, 0, 0, 0, 0, 0);
+    SCACAddPatternCS(&mpm_ctx, (uint8_t *)"abcdefgh", 8, 0, 0, 0, 0, 0);
 
     SCACPreparePatterns(&mpm_ctx);
 
-    char *buf = "abcdefghjiklmnopqrstuvwxyz";
+    char *buf = "01234567890123456789012345678901234567890123456789"
+                "01234567890123456789012345678901234567890123456789"
+                "abcdefgh"
+                "01234567890123456789012345678901234567890123456789"
+                "01234567890123456789012345678901234567890123456789";
     uint32_t cnt = SCACSearch(&mpm_ctx, &mpm_thread_ctx, NULL,
                                (uint8_t *)buf, strlen(buf));
 
@@ -1389,7 +2990,7 @@ static int SCACTest01(void)
     return result;
 }
 
-static int SCACTest02(void)
+static int SCACTest11(void)
 {
     int result = 0;
     MpmCtx mpm_ctx;
@@ -1400,26 +3001,72 @@ static int SCACTest02(void)
     MpmInitCtx(&mpm_ctx, MPM_AC, -1);
     SCACInitThreadCtx(&mpm_ctx, &mpm_thread_ctx, 0);
 
+    if (SCACAddPatternCS(&mpm_ctx, (uint8_t *)"he", 2, 0, 0, 1, 0, 0) == -1)
+        goto end;
+    if (SCACAddPatternCS(&mpm_ctx, (uint8_t *)"she", 3, 0, 0, 2, 0, 0) == -1)
+        goto end;
+    if (SCACAddPatternCS(&mpm_ctx, (uint8_t *)"his", 3, 0, 0, 3, 0, 0) == -1)
+        goto end;
+    if (SCACAddPatternCS(&mpm_ctx, (uint8_t *)"hers", 4, 0, 0, 4, 0, 0) == -1)
+        goto end;
+
+    if (SCACPreparePatterns(&mpm_ctx) == -1)
+        goto end;
+
+    result = 1;
+
+    char *buf = "he";
+    result &= (SCACSearch(&mpm_ctx, &mpm_thread_ctx, NULL, (uint8_t *)buf,
+                          strlen(buf)) == 1);
+    buf = "she";
+    result &= (SCACSearch(&mpm_ctx, &mpm_thread_ctx, NULL, (uint8_t *)buf,
+                          strlen(buf)) == 2);
+    buf = "his";
+    result &= (SCACSearch(&mpm_ctx, &mpm_thread_ctx, NULL, (uint8_t *)buf,
+                          strlen(buf)) == 1);
+    buf = "hers";
+    result &= (SCACSearch(&mpm_ctx, &mpm_thread_ctx, NULL, (uint8_t *)buf,
+                          strlen(buf)) == 2);
+
+ end:
+    SCACDestroyCtx(&mpm_ctx);
+    SCACDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    return result;
+}
+
+static int SCACTest12(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+
+    memset(&mpm_ctx, 0x00, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_AC, -1);
+    SCACInitThreadCtx(&mpm_ctx, &mpm_thread_ctx, 0);
+
     /* 1 match */
-    SCACAddPatternCS(&mpm_ctx, (uint8_t *)"abce", 4, 0, 0, 0, 0, 0);
+    SCACAddPatternCS(&mpm_ctx, (uint8_t *)"wxyz", 4, 0, 0, 0, 0, 0);
+    /* 1 match */
+    SCACAddPatternCS(&mpm_ctx, (uint8_t *)"vwxyz", 5, 0, 0, 1, 0, 0);
 
     SCACPreparePatterns(&mpm_ctx);
 
-    char *buf = "abcdefghjiklmnopqrstuvwxyz";
+    char *buf = "abcdefghijklmnopqrstuvwxyz";
     uint32_t cnt = SCACSearch(&mpm_ctx, &mpm_thread_ctx, NULL,
                                (uint8_t *)buf, strlen(buf));
 
-    if (cnt == 0)
+    if (cnt == 2)
         result = 1;
     else
-        printf("0 != %" PRIu32 " ",cnt);
+        printf("2 != %" PRIu32 " ",cnt);
 
     SCACDestroyCtx(&mpm_ctx);
     SCACDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
     return result;
 }
 
-static int SCACTest03(void)
+static int SCACTest13(void)
 {
     int result = 0;
     MpmCtx mpm_ctx;
@@ -1431,46 +3078,43 @@ static int SCACTest03(void)
     SCACInitThreadCtx(&mpm_ctx, &mpm_thread_ctx, 0);
 
     /* 1 match */
-    SCACAddPatternCS(&mpm_ctx, (uint8_t *)"abcd", 4, 0, 0, 0, 0, 0);
-    /* 1 match */
-    SCACAddPatternCS(&mpm_ctx, (uint8_t *)"bcde", 4, 0, 0, 1, 0, 0);
-    /* 1 match */
-    SCACAddPatternCS(&mpm_ctx, (uint8_t *)"fghj", 4, 0, 0, 2, 0, 0);
+    char *pat = "abcdefghijklmnopqrstuvwxyzABCD";
+    SCACAddPatternCS(&mpm_ctx, (uint8_t *)pat, strlen(pat), 0, 0, 0, 0, 0);
 
     SCACPreparePatterns(&mpm_ctx);
 
-    char *buf = "abcdefghjiklmnopqrstuvwxyz";
+    char *buf = "abcdefghijklmnopqrstuvwxyzABCD";
     uint32_t cnt = SCACSearch(&mpm_ctx, &mpm_thread_ctx, NULL,
                                (uint8_t *)buf, strlen(buf));
 
-    if (cnt == 3)
+    if (cnt == 1)
         result = 1;
     else
-        printf("3 != %" PRIu32 " ",cnt);
+        printf("1 != %" PRIu32 " ",cnt);
 
     SCACDestroyCtx(&mpm_ctx);
     SCACDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
     return result;
 }
 
-static int SCACTest04(void)
+static int SCACTest14(void)
 {
     int result = 0;
     MpmCtx mpm_ctx;
     MpmThreadCtx mpm_thread_ctx;
 
-    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_ctx, 0x00, sizeof(MpmCtx));
     memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
     MpmInitCtx(&mpm_ctx, MPM_AC, -1);
     SCACInitThreadCtx(&mpm_ctx, &mpm_thread_ctx, 0);
 
-    SCACAddPatternCS(&mpm_ctx, (uint8_t *)"abcd", 4, 0, 0, 0, 0, 0);
-    SCACAddPatternCS(&mpm_ctx, (uint8_t *)"bcdegh", 6, 0, 0, 1, 0, 0);
-    SCACAddPatternCS(&mpm_ctx, (uint8_t *)"fghjxyz", 7, 0, 0, 2, 0, 0);
+    /* 1 match */
+    char *pat = "abcdefghijklmnopqrstuvwxyzABCDE";
+    SCACAddPatternCS(&mpm_ctx, (uint8_t *)pat, strlen(pat), 0, 0, 0, 0, 0);
 
     SCACPreparePatterns(&mpm_ctx);
 
-    char *buf = "abcdefghjiklmnopqrstuvwxyz";
+    char *buf = "abcdefghijklmnopqrstuvwxyzABCDE";
     uint32_t cnt = SCACSearch(&mpm_ctx, &mpm_thread_ctx, NULL,
                                (uint8_t *)buf, strlen(buf));
 
@@ -1484,7 +3128,7 @@ static int SCACTest04(void)
     return result;
 }
 
-static int SCACTest05(void)
+static int SCACTest15(void)
 {
     int result = 0;
     MpmCtx mpm_ctx;
@@ -1495,42 +3139,44 @@ static int SCACTest05(void)
     MpmInitCtx(&mpm_ctx, MPM_AC, -1);
     SCACInitThreadCtx(&mpm_ctx, &mpm_thread_ctx, 0);
 
-    SCACAddPatternCI(&mpm_ctx, (uint8_t *)"ABCD", 4, 0, 0, 0, 0, 0);
-    SCACAddPatternCI(&mpm_ctx, (uint8_t *)"bCdEfG", 6, 0, 0, 1, 0, 0);
-    SCACAddPatternCI(&mpm_ctx, (uint8_t *)"fghJikl", 7, 0, 0, 2, 0, 0);
+    /* 1 match */
+    char *pat = "abcdefghijklmnopqrstuvwxyzABCDEF";
+    SCACAddPatternCS(&mpm_ctx, (uint8_t *)pat, strlen(pat), 0, 0, 0, 0, 0);
 
     SCACPreparePatterns(&mpm_ctx);
 
-    char *buf = "abcdefghjiklmnopqrstuvwxyz";
+    char *buf = "abcdefghijklmnopqrstuvwxyzABCDEF";
     uint32_t cnt = SCACSearch(&mpm_ctx, &mpm_thread_ctx, NULL,
                                (uint8_t *)buf, strlen(buf));
 
-    if (cnt == 3)
+    if (cnt == 1)
         result = 1;
     else
-        printf("3 != %" PRIu32 " ",cnt);
+        printf("1 != %" PRIu32 " ",cnt);
 
     SCACDestroyCtx(&mpm_ctx);
     SCACDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
     return result;
 }
 
-static int SCACTest06(void)
+static int SCACTest16(void)
 {
     int result = 0;
     MpmCtx mpm_ctx;
     MpmThreadCtx mpm_thread_ctx;
 
-    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_ctx, 0x00, sizeof(MpmCtx));
     memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
     MpmInitCtx(&mpm_ctx, MPM_AC, -1);
     SCACInitThreadCtx(&mpm_ctx, &mpm_thread_ctx, 0);
 
-    SCACAddPatternCS(&mpm_ctx, (uint8_t *)"abcd", 4, 0, 0, 0, 0, 0);
+    /* 1 match */
+    char *pat = "abcdefghijklmnopqrstuvwxyzABC";
+    SCACAddPatternCS(&mpm_ctx, (uint8_t *)pat, strlen(pat), 0, 0, 0, 0, 0);
 
     SCACPreparePatterns(&mpm_ctx);
 
-    char *buf = "abcd";
+    char *buf = "abcdefghijklmnopqrstuvwxyzABC";
     uint32_t cnt = SCACSearch(&mpm_ctx, &mpm_thread_ctx, NULL,
                                (uint8_t *)buf, strlen(buf));
 
@@ -1544,95 +3190,118 @@ static int SCACTest06(void)
     return result;
 }
 
-static int SCACTest07(void)
+static int SCACTest17(void)
 {
     int result = 0;
     MpmCtx mpm_ctx;
     MpmThreadCtx mpm_thread_ctx;
 
-    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_ctx, 0x00, sizeof(MpmCtx));
     memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
     MpmInitCtx(&mpm_ctx, MPM_AC, -1);
     SCACInitThreadCtx(&mpm_ctx, &mpm_thread_ctx, 0);
 
-    /* should match 30 times */
-    SCACAddPatternCS(&mpm_ctx, (uint8_t *)"A", 1, 0, 0, 0, 0, 0);
-    /* should match 29 times */
-    SCACAddPatternCS(&mpm_ctx, (uint8_t *)"AA", 2, 0, 0, 1, 0, 0);
-    /* should match 28 times */
-    SCACAddPatternCS(&mpm_ctx, (uint8_t *)"AAA", 3, 0, 0, 2, 0, 0);
-    /* 26 */
-    SCACAddPatternCS(&mpm_ctx, (uint8_t *)"AAAAA", 5, 0, 0, 3, 0, 0);
-    /* 21 */
-    SCACAddPatternCS(&mpm_ctx, (uint8_t *)"AAAAAAAAAA", 10, 0, 0, 4, 0, 0);
-    /* 1 */
-    SCACAddPatternCS(&mpm_ctx, (uint8_t *)"AAAAAAAAAAAAAAAAAAAAAAAAAAAAAA",
-                     30, 0, 0, 5, 0, 0);
-    /* total matches: 135 */
+    /* 1 match */
+    char *pat = "abcdefghijklmnopqrstuvwxyzAB";
+    SCACAddPatternCS(&mpm_ctx, (uint8_t *)pat, strlen(pat), 0, 0, 0, 0, 0);
 
     SCACPreparePatterns(&mpm_ctx);
 
-    char *buf = "AAAAAAAAAAAAAAAAAAAAAAAAAAAAAA";
+    char *buf = "abcdefghijklmnopqrstuvwxyzAB";
     uint32_t cnt = SCACSearch(&mpm_ctx, &mpm_thread_ctx, NULL,
                                (uint8_t *)buf, strlen(buf));
 
-    if (cnt == 135)
+    if (cnt == 1)
         result = 1;
     else
-        printf("135 != %" PRIu32 " ",cnt);
+        printf("1 != %" PRIu32 " ",cnt);
 
     SCACDestroyCtx(&mpm_ctx);
     SCACDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
     return result;
 }
 
-static int SCACTest08(void)
+static int SCACTest18(void)
 {
     int result = 0;
     MpmCtx mpm_ctx;
     MpmThreadCtx mpm_thread_ctx;
 
-    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_ctx, 0x00, sizeof(MpmCtx));
     memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
     MpmInitCtx(&mpm_ctx, MPM_AC, -1);
     SCACInitThreadCtx(&mpm_ctx, &mpm_thread_ctx, 0);
 
     /* 1 match */
-    SCACAddPatternCS(&mpm_ctx, (uint8_t *)"abcd", 4, 0, 0, 0, 0, 0);
+    char *pat = "abcde""fghij""klmno""pqrst""uvwxy""z";
+    SCACAddPatternCS(&mpm_ctx, (uint8_t *)pat, strlen(pat), 0, 0, 0, 0, 0);
 
     SCACPreparePatterns(&mpm_ctx);
 
+    char *buf = "abcde""fghij""klmno""pqrst""uvwxy""z";
     uint32_t cnt = SCACSearch(&mpm_ctx, &mpm_thread_ctx, NULL,
-                               (uint8_t *)"a", 1);
+                               (uint8_t *)buf, strlen(buf));
 
-    if (cnt == 0)
+    if (cnt == 1)
         result = 1;
     else
-        printf("0 != %" PRIu32 " ",cnt);
+        printf("1 != %" PRIu32 " ",cnt);
 
     SCACDestroyCtx(&mpm_ctx);
     SCACDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
     return result;
 }
 
-static int SCACTest09(void)
+static int SCACTest19(void)
 {
     int result = 0;
     MpmCtx mpm_ctx;
     MpmThreadCtx mpm_thread_ctx;
 
-    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_ctx, 0x00, sizeof(MpmCtx));
     memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
     MpmInitCtx(&mpm_ctx, MPM_AC, -1);
     SCACInitThreadCtx(&mpm_ctx, &mpm_thread_ctx, 0);
 
-    /* 1 match */
-    SCACAddPatternCS(&mpm_ctx, (uint8_t *)"ab", 2, 0, 0, 0, 0, 0);
+    /* 1 */
+    char *pat = "AAAAAAAAAAAAAAAAAAAAAAAAAAAAAA";
+    SCACAddPatternCS(&mpm_ctx, (uint8_t *)pat, strlen(pat), 0, 0, 0, 0, 0);
+
+    SCACPreparePatterns(&mpm_ctx);
+
+    char *buf = "AAAAAAAAAAAAAAAAAAAAAAAAAAAAAA";
+    uint32_t cnt = SCACSearch(&mpm_ctx, &mpm_thread_ctx, NULL,
+                               (uint8_t *)buf, strlen(buf));
+
+    if (cnt == 1)
+        result = 1;
+    else
+        printf("1 != %" PRIu32 " ",cnt);
+
+    SCACDestroyCtx(&mpm_ctx);
+    return result;
+}
+
+static int SCACTest20(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+
+    memset(&mpm_ctx, 0x00, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_AC, -1);
+    SCACInitThreadCtx(&mpm_ctx, &mpm_thread_ctx, 0);
+
+    /* 1 */
+    char *pat = "AAAAA""AAAAA""AAAAA""AAAAA""AAAAA""AAAAA""AA";
+    SCACAddPatternCS(&mpm_ctx, (uint8_t *)pat, strlen(pat), 0, 0, 0, 0, 0);
 
     SCACPreparePatterns(&mpm_ctx);
 
+    char *buf = "AAAAA""AAAAA""AAAAA""AAAAA""AAAAA""AAAAA""AA";
     uint32_t cnt = SCACSearch(&mpm_ctx, &mpm_thread_ctx, NULL,
-                               (uint8_t *)"ab", 2);
+                               (uint8_t *)buf, strlen(buf));
 
     if (cnt == 1)
         result = 1;
@@ -1644,29 +3313,24 @@ static int SCACTest09(void)
     return result;
 }
 
-static int SCACTest10(void)
+static int SCACTest21(void)
 {
     int result = 0;
     MpmCtx mpm_ctx;
     MpmThreadCtx mpm_thread_ctx;
 
-    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_ctx, 0x00, sizeof(MpmCtx));
     memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
     MpmInitCtx(&mpm_ctx, MPM_AC, -1);
     SCACInitThreadCtx(&mpm_ctx, &mpm_thread_ctx, 0);
 
-    /* 1 match */
-    SCACAddPatternCS(&mpm_ctx, (uint8_t *)"abcdefgh", 8, 0, 0, 0, 0, 0);
+    /* 1 */
+    SCACAddPatternCS(&mpm_ctx, (uint8_t *)"AA", 2, 0, 0, 0, 0, 0);
 
     SCACPreparePatterns(&mpm_ctx);
 
-    char *buf = "01234567890123456789012345678901234567890123456789"
-                "01234567890123456789012345678901234567890123456789"
-                "abcdefgh"
-                "01234567890123456789012345678901234567890123456789"
-                "01234567890123456789012345678901234567890123456789";
     uint32_t cnt = SCACSearch(&mpm_ctx, &mpm_thread_ctx, NULL,
-                               (uint8_t *)buf, strlen(buf));
+                              (uint8_t *)"AA", 2);
 
     if (cnt == 1)
         result = 1;
@@ -1678,51 +3342,39 @@ static int SCACTest10(void)
     return result;
 }
 
-static int SCACTest11(void)
+static int SCACTest22(void)
 {
     int result = 0;
     MpmCtx mpm_ctx;
     MpmThreadCtx mpm_thread_ctx;
 
-    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_ctx, 0x00, sizeof(MpmCtx));
     memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
     MpmInitCtx(&mpm_ctx, MPM_AC, -1);
     SCACInitThreadCtx(&mpm_ctx, &mpm_thread_ctx, 0);
 
-    if (SCACAddPatternCS(&mpm_ctx, (uint8_t *)"he", 2, 0, 0, 1, 0, 0) == -1)
-        goto end;
-    if (SCACAddPatternCS(&mpm_ctx, (uint8_t *)"she", 3, 0, 0, 2, 0, 0) == -1)
-        goto end;
-    if (SCACAddPatternCS(&mpm_ctx, (uint8_t *)"his", 3, 0, 0, 3, 0, 0) == -1)
-        goto end;
-    if (SCACAddPatternCS(&mpm_ctx, (uint8_t *)"hers", 4, 0, 0, 4, 0, 0) == -1)
-        goto end;
+    /* 1 match */
+    SCACAddPatternCS(&mpm_ctx, (uint8_t *)"abcd", 4, 0, 0, 0, 0, 0);
+    /* 1 match */
+    SCACAddPatternCS(&mpm_ctx, (uint8_t *)"abcde", 5, 0, 0, 1, 0, 0);
 
-    if (SCACPreparePatterns(&mpm_ctx) == -1)
-        goto end;
+    SCACPreparePatterns(&mpm_ctx);
 
-    result = 1;
+    char *buf = "abcdefghijklmnopqrstuvwxyz";
+    uint32_t cnt = SCACSearch(&mpm_ctx, &mpm_thread_ctx, NULL,
+                              (uint8_t *)buf, strlen(buf));
 
-    char *buf = "he";
-    result &= (SCACSearch(&mpm_ctx, &mpm_thread_ctx, NULL, (uint8_t *)buf,
-                          strlen(buf)) == 1);
-    buf = "she";
-    result &= (SCACSearch(&mpm_ctx, &mpm_thread_ctx, NULL, (uint8_t *)buf,
-                          strlen(buf)) == 2);
-    buf = "his";
-    result &= (SCACSearch(&mpm_ctx, &mpm_thread_ctx, NULL, (uint8_t *)buf,
-                          strlen(buf)) == 1);
-    buf = "hers";
-    result &= (SCACSearch(&mpm_ctx, &mpm_thread_ctx, NULL, (uint8_t *)buf,
-                          strlen(buf)) == 2);
+    if (cnt == 2)
+        result = 1;
+    else
+        printf("2 != %" PRIu32 " ",cnt);
 
- end:
     SCACDestroyCtx(&mpm_ctx);
     SCACDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
     return result;
 }
 
-static int SCACTest12(void)
+static int SCACTest23(void)
 {
     int result = 0;
     MpmCtx mpm_ctx;
@@ -1733,28 +3385,25 @@ static int SCACTest12(void)
     MpmInitCtx(&mpm_ctx, MPM_AC, -1);
     SCACInitThreadCtx(&mpm_ctx, &mpm_thread_ctx, 0);
 
-    /* 1 match */
-    SCACAddPatternCS(&mpm_ctx, (uint8_t *)"wxyz", 4, 0, 0, 0, 0, 0);
-    /* 1 match */
-    SCACAddPatternCS(&mpm_ctx, (uint8_t *)"vwxyz", 5, 0, 0, 1, 0, 0);
+    /* 1 */
+    SCACAddPatternCS(&mpm_ctx, (uint8_t *)"AA", 2, 0, 0, 0, 0, 0);
 
     SCACPreparePatterns(&mpm_ctx);
 
-    char *buf = "abcdefghijklmnopqrstuvwxyz";
     uint32_t cnt = SCACSearch(&mpm_ctx, &mpm_thread_ctx, NULL,
-                               (uint8_t *)buf, strlen(buf));
+                              (uint8_t *)"aa", 2);
 
-    if (cnt == 2)
+    if (cnt == 0)
         result = 1;
     else
-        printf("2 != %" PRIu32 " ",cnt);
+        printf("1 != %" PRIu32 " ",cnt);
 
     SCACDestroyCtx(&mpm_ctx);
     SCACDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
     return result;
 }
 
-static int SCACTest13(void)
+static int SCACTest24(void)
 {
     int result = 0;
     MpmCtx mpm_ctx;
@@ -1765,15 +3414,13 @@ static int SCACTest13(void)
     MpmInitCtx(&mpm_ctx, MPM_AC, -1);
     SCACInitThreadCtx(&mpm_ctx, &mpm_thread_ctx, 0);
 
-    /* 1 match */
-    char *pat = "abcdefghijklmnopqrstuvwxyzABCD";
-    SCACAddPatternCS(&mpm_ctx, (uint8_t *)pat, strlen(pat), 0, 0, 0, 0, 0);
+    /* 1 */
+    SCACAddPatternCI(&mpm_ctx, (uint8_t *)"AA", 2, 0, 0, 0, 0, 0);
 
     SCACPreparePatterns(&mpm_ctx);
 
-    char *buf = "abcdefghijklmnopqrstuvwxyzABCD";
     uint32_t cnt = SCACSearch(&mpm_ctx, &mpm_thread_ctx, NULL,
-                               (uint8_t *)buf, strlen(buf));
+                              (uint8_t *)"aa", 2);
 
     if (cnt == 1)
         result = 1;
@@ -1785,7 +3432,7 @@ static int SCACTest13(void)
     return result;
 }
 
-static int SCACTest14(void)
+static int SCACTest25(void)
 {
     int result = 0;
     MpmCtx mpm_ctx;
@@ -1796,27 +3443,27 @@ static int SCACTest14(void)
     MpmInitCtx(&mpm_ctx, MPM_AC, -1);
     SCACInitThreadCtx(&mpm_ctx, &mpm_thread_ctx, 0);
 
-    /* 1 match */
-    char *pat = "abcdefghijklmnopqrstuvwxyzABCDE";
-    SCACAddPatternCS(&mpm_ctx, (uint8_t *)pat, strlen(pat), 0, 0, 0, 0, 0);
+    SCACAddPatternCI(&mpm_ctx, (uint8_t *)"ABCD", 4, 0, 0, 0, 0, 0);
+    SCACAddPatternCI(&mpm_ctx, (uint8_t *)"bCdEfG", 6, 0, 0, 1, 0, 0);
+    SCACAddPatternCI(&mpm_ctx, (uint8_t *)"fghiJkl", 7, 0, 0, 2, 0, 0);
 
     SCACPreparePatterns(&mpm_ctx);
 
-    char *buf = "abcdefghijklmnopqrstuvwxyzABCDE";
+    char *buf = "ABCDEFGHIJKLMNOPQRSTUVWXYZ";
     uint32_t cnt = SCACSearch(&mpm_ctx, &mpm_thread_ctx, NULL,
                                (uint8_t *)buf, strlen(buf));
 
-    if (cnt == 1)
+    if (cnt == 3)
         result = 1;
     else
-        printf("1 != %" PRIu32 " ",cnt);
+        printf("3 != %" PRIu32 " ",cnt);
 
     SCACDestroyCtx(&mpm_ctx);
     SCACDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
     return result;
 }
 
-static int SCACTest15(void)
+static int SCACTest26(void)
 {
     int result = 0;
     MpmCtx mpm_ctx;
@@ -1827,420 +3474,1313 @@ static int SCACTest15(void)
     MpmInitCtx(&mpm_ctx, MPM_AC, -1);
     SCACInitThreadCtx(&mpm_ctx, &mpm_thread_ctx, 0);
 
-    /* 1 match */
-    char *pat = "abcdefghijklmnopqrstuvwxyzABCDEF";
-    SCACAddPatternCS(&mpm_ctx, (uint8_t *)pat, strlen(pat), 0, 0, 0, 0, 0);
+    SCACAddPatternCI(&mpm_ctx, (uint8_t *)"Works", 5, 0, 0, 1, 0, 0);
+    SCACAddPatternCS(&mpm_ctx, (uint8_t *)"Works", 5, 0, 0, 1, 0, 0);
 
     SCACPreparePatterns(&mpm_ctx);
 
-    char *buf = "abcdefghijklmnopqrstuvwxyzABCDEF";
+    char *buf = "works";
     uint32_t cnt = SCACSearch(&mpm_ctx, &mpm_thread_ctx, NULL,
                                (uint8_t *)buf, strlen(buf));
 
     if (cnt == 1)
         result = 1;
     else
-        printf("1 != %" PRIu32 " ",cnt);
+        printf("3 != %" PRIu32 " ",cnt);
 
     SCACDestroyCtx(&mpm_ctx);
     SCACDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
     return result;
 }
 
-static int SCACTest16(void)
+static int SCACTest27(void)
 {
     int result = 0;
     MpmCtx mpm_ctx;
     MpmThreadCtx mpm_thread_ctx;
 
-    memset(&mpm_ctx, 0x00, sizeof(MpmCtx));
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
     memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
     MpmInitCtx(&mpm_ctx, MPM_AC, -1);
     SCACInitThreadCtx(&mpm_ctx, &mpm_thread_ctx, 0);
 
-    /* 1 match */
-    char *pat = "abcdefghijklmnopqrstuvwxyzABC";
-    SCACAddPatternCS(&mpm_ctx, (uint8_t *)pat, strlen(pat), 0, 0, 0, 0, 0);
+    /* 0 match */
+    SCACAddPatternCS(&mpm_ctx, (uint8_t *)"ONE", 3, 0, 0, 0, 0, 0);
 
     SCACPreparePatterns(&mpm_ctx);
 
-    char *buf = "abcdefghijklmnopqrstuvwxyzABC";
+    char *buf = "tone";
     uint32_t cnt = SCACSearch(&mpm_ctx, &mpm_thread_ctx, NULL,
                                (uint8_t *)buf, strlen(buf));
 
-    if (cnt == 1)
+    if (cnt == 0)
         result = 1;
     else
-        printf("1 != %" PRIu32 " ",cnt);
+        printf("0 != %" PRIu32 " ",cnt);
 
     SCACDestroyCtx(&mpm_ctx);
     SCACDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
     return result;
 }
 
-static int SCACTest17(void)
+static int SCACTest28(void)
 {
     int result = 0;
     MpmCtx mpm_ctx;
     MpmThreadCtx mpm_thread_ctx;
 
-    memset(&mpm_ctx, 0x00, sizeof(MpmCtx));
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
     memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
     MpmInitCtx(&mpm_ctx, MPM_AC, -1);
     SCACInitThreadCtx(&mpm_ctx, &mpm_thread_ctx, 0);
 
-    /* 1 match */
-    char *pat = "abcdefghijklmnopqrstuvwxyzAB";
-    SCACAddPatternCS(&mpm_ctx, (uint8_t *)pat, strlen(pat), 0, 0, 0, 0, 0);
+    /* 0 match */
+    SCACAddPatternCS(&mpm_ctx, (uint8_t *)"one", 3, 0, 0, 0, 0, 0);
 
     SCACPreparePatterns(&mpm_ctx);
 
-    char *buf = "abcdefghijklmnopqrstuvwxyzAB";
+    char *buf = "tONE";
     uint32_t cnt = SCACSearch(&mpm_ctx, &mpm_thread_ctx, NULL,
                                (uint8_t *)buf, strlen(buf));
 
-    if (cnt == 1)
+    if (cnt == 0)
         result = 1;
     else
-        printf("1 != %" PRIu32 " ",cnt);
+        printf("0 != %" PRIu32 " ",cnt);
 
     SCACDestroyCtx(&mpm_ctx);
     SCACDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
     return result;
 }
 
-static int SCACTest18(void)
+/**
+ * \test Segmented search: a pattern only matches in the segments that
+ *       carry its tag.
+ */
+static int SCACTest29(void)
 {
     int result = 0;
     MpmCtx mpm_ctx;
     MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+    uint8_t pid_tags[3] = { 0x01, 0x02, 0x03 };
 
-    memset(&mpm_ctx, 0x00, sizeof(MpmCtx));
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
     memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    memset(&pmq, 0, sizeof(PatternMatcherQueue));
     MpmInitCtx(&mpm_ctx, MPM_AC, -1);
     SCACInitThreadCtx(&mpm_ctx, &mpm_thread_ctx, 0);
+    if (PmqSetup(&pmq, 0, 3) == -1)
+        goto end;
 
-    /* 1 match */
-    char *pat = "abcde""fghij""klmno""pqrst""uvwxy""z";
-    SCACAddPatternCS(&mpm_ctx, (uint8_t *)pat, strlen(pat), 0, 0, 0, 0, 0);
+    /* only valid in segments with tag 0x01 */
+    SCACAddPatternCS(&mpm_ctx, (uint8_t *)"abcd", 4, 0, 0, 0, 0, 0);
+    /* only valid in segments with tag 0x02 */
+    SCACAddPatternCI(&mpm_ctx, (uint8_t *)"efgh", 4, 0, 0, 1, 0, 0);
+    /* valid in both */
+    SCACAddPatternCS(&mpm_ctx, (uint8_t *)"xyz", 3, 0, 0, 2, 0, 0);
 
     SCACPreparePatterns(&mpm_ctx);
 
-    char *buf = "abcde""fghij""klmno""pqrst""uvwxy""z";
-    uint32_t cnt = SCACSearch(&mpm_ctx, &mpm_thread_ctx, NULL,
-                               (uint8_t *)buf, strlen(buf));
+    MpmBufferSegment segs[2];
+    segs[0].buf = (uint8_t *)"efghxyz";
+    segs[0].buflen = 7;
+    segs[0].tag = 0x01;
+    segs[1].buf = (uint8_t *)"abcdEFGH";
+    segs[1].buflen = 8;
+    segs[1].tag = 0x02;
+
+    uint32_t cnt = SCACSearchSegments(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                                      segs, 2, pid_tags);
+    if (cnt != 2) {
+        printf("2 != %" PRIu32 " ", cnt);
+        goto end;
+    }
 
-    if (cnt == 1)
-        result = 1;
-    else
-        printf("1 != %" PRIu32 " ",cnt);
+    if (pmq.pattern_id_bitarray[0] != 0x06) {
+        printf("pmq bitarray 0x%02X != 0x06 ", pmq.pattern_id_bitarray[0]);
+        goto end;
+    }
 
+    result = 1;
+end:
+    PmqFree(&pmq);
     SCACDestroyCtx(&mpm_ctx);
     SCACDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
     return result;
 }
 
-static int SCACTest19(void)
+/**
+ * \test Segmented search: patterns don't match across segment boundaries
+ *       and give the same count as separate searches.
+ */
+static int SCACTest30(void)
 {
     int result = 0;
     MpmCtx mpm_ctx;
     MpmThreadCtx mpm_thread_ctx;
+    uint8_t pid_tags[2] = { 0xFF, 0xFF };
 
-    memset(&mpm_ctx, 0x00, sizeof(MpmCtx));
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
     memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
     MpmInitCtx(&mpm_ctx, MPM_AC, -1);
     SCACInitThreadCtx(&mpm_ctx, &mpm_thread_ctx, 0);
 
-    /* 1 */
-    char *pat = "AAAAAAAAAAAAAAAAAAAAAAAAAAAAAA";
-    SCACAddPatternCS(&mpm_ctx, (uint8_t *)pat, strlen(pat), 0, 0, 0, 0, 0);
+    SCACAddPatternCS(&mpm_ctx, (uint8_t *)"GET /", 5, 0, 0, 0, 0, 0);
+    SCACAddPatternCS(&mpm_ctx, (uint8_t *)"TT", 2, 0, 0, 1, 0, 0);
 
     SCACPreparePatterns(&mpm_ctx);
 
-    char *buf = "AAAAAAAAAAAAAAAAAAAAAAAAAAAAAA";
-    uint32_t cnt = SCACSearch(&mpm_ctx, &mpm_thread_ctx, NULL,
-                               (uint8_t *)buf, strlen(buf));
+    MpmBufferSegment segs[3];
+    segs[0].buf = (uint8_t *)"GET";
+    segs[0].buflen = 3;
+    segs[0].tag = 0x01;
+    segs[1].buf = (uint8_t *)" /index.html";
+    segs[1].buflen = 12;
+    segs[1].tag = 0x01;
+    segs[2].buf = (uint8_t *)"HTTP";
+    segs[2].buflen = 4;
+    segs[2].tag = 0x01;
+
+    uint32_t cnt = SCACSearchSegments(&mpm_ctx, &mpm_thread_ctx, NULL,
+                                      segs, 3, pid_tags);
+    uint32_t sep = 0;
+    int i;
+    for (i = 0; i < 3; i++) {
+        sep += SCACSearch(&mpm_ctx, &mpm_thread_ctx, NULL,
+                          segs[i].buf, segs[i].buflen);
+    }
 
-    if (cnt == 1)
+    if (cnt == 1 && sep == 1)
         result = 1;
     else
-        printf("1 != %" PRIu32 " ",cnt);
+        printf("1 != %" PRIu32 " (separate %" PRIu32 ") ", cnt, sep);
 
     SCACDestroyCtx(&mpm_ctx);
+    SCACDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
     return result;
 }
 
-static int SCACTest20(void)
+/**
+ * \test Resumed search: a pattern spanning 2 chunks is found and the chunks
+ *       give the same matches as a search over the whole buffer.
+ */
+static int SCACTest31(void)
 {
     int result = 0;
     MpmCtx mpm_ctx;
     MpmThreadCtx mpm_thread_ctx;
+    MpmStreamState ss;
+    uint8_t *buf = (uint8_t *)"abcdefghjiklmnopqrstuvwxyz";
 
-    memset(&mpm_ctx, 0x00, sizeof(MpmCtx));
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
     memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmStreamStateReset(&ss);
     MpmInitCtx(&mpm_ctx, MPM_AC, -1);
     SCACInitThreadCtx(&mpm_ctx, &mpm_thread_ctx, 0);
 
-    /* 1 */
-    char *pat = "AAAAA""AAAAA""AAAAA""AAAAA""AAAAA""AAAAA""AA";
-    SCACAddPatternCS(&mpm_ctx, (uint8_t *)pat, strlen(pat), 0, 0, 0, 0, 0);
+    SCACAddPatternCI(&mpm_ctx, (uint8_t *)"ghjik", 5, 0, 0, 0, 0, 0);
+    SCACAddPatternCS(&mpm_ctx, (uint8_t *)"mnop", 4, 0, 0, 1, 0, 0);
+    SCACAddPatternCI(&mpm_ctx, (uint8_t *)"xyz", 3, 0, 0, 2, 0, 0);
 
     SCACPreparePatterns(&mpm_ctx);
 
-    char *buf = "AAAAA""AAAAA""AAAAA""AAAAA""AAAAA""AAAAA""AA";
-    uint32_t cnt = SCACSearch(&mpm_ctx, &mpm_thread_ctx, NULL,
-                               (uint8_t *)buf, strlen(buf));
+    uint32_t full = SCACSearch(&mpm_ctx, &mpm_thread_ctx, NULL, buf, 26);
 
-    if (cnt == 1)
+    /* split in the middle of "ghjik" and "mnop" */
+    uint32_t cnt = SCACSearchResume(&mpm_ctx, &mpm_thread_ctx, NULL, &ss, buf, 8);
+    cnt += SCACSearchResume(&mpm_ctx, &mpm_thread_ctx, NULL, &ss, buf + 8, 6);
+    cnt += SCACSearchResume(&mpm_ctx, &mpm_thread_ctx, NULL, &ss, buf + 14, 12);
+
+    if (cnt == 3 && full == 3)
         result = 1;
     else
-        printf("1 != %" PRIu32 " ",cnt);
+        printf("3 != %" PRIu32 " (full %" PRIu32 ") ", cnt, full);
 
     SCACDestroyCtx(&mpm_ctx);
     SCACDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
     return result;
 }
 
-static int SCACTest21(void)
+/** simple lcg, so the random tests are repeatable */
+static uint32_t SCACTestRand(uint32_t *seed)
+{
+    *seed = (*seed * 1103515245 + 12345);
+    return ((*seed >> 16) & 0x7fff);
+}
+
+/** patterns of the ctx of SCACTestBigCtx */
+#define SC_AC_TEST_BIG_PATTERNS 2400
+
+/**
+ * \internal
+ * \brief Setup and prepare an AC ctx with more than 65535 states, so it
+ *        uses u32 states.  Pattern 0 is "ab" and pattern 1 "abcd", the
+ *        others are long random patterns.
+ *
+ * \param dir Cache directory, NULL for none.
+ */
+static void SCACTestBigCtx(MpmCtx *mpm_ctx, const char *dir, uint8_t compressed)
+{
+    uint8_t pat[32];
+    uint32_t seed = 3;
+    uint32_t j, u;
+
+    memset(mpm_ctx, 0, sizeof(MpmCtx));
+    MpmInitCtx(mpm_ctx, MPM_AC, -1);
+    ((SCACCtx *)mpm_ctx->ctx)->compressed = compressed;
+    ((SCACCtx *)mpm_ctx->ctx)->cache_dir = dir;
+
+    SCACAddPatternCI(mpm_ctx, (uint8_t *)"ab", 2, 0, 0, 0, 0, 0);
+    SCACAddPatternCI(mpm_ctx, (uint8_t *)"abcd", 4, 0, 0, 1, 0, 0);
+    for (j = 2; j < SC_AC_TEST_BIG_PATTERNS; j++) {
+        for (u = 0; u < sizeof(pat); u++)
+            pat[u] = "abcdefghijklmnopqrstuvwxyz"[SCACTestRand(&seed) % 26];
+        if (j % 2)
+            SCACAddPatternCI(mpm_ctx, pat, sizeof(pat), 0, 0, j, 0, 0);
+        else
+            SCACAddPatternCS(mpm_ctx, pat, sizeof(pat), 0, 0, j, 0, 0);
+    }
+
+    SCACPreparePatterns(mpm_ctx);
+}
+
+/**
+ * \test Resumed search: a reset state or a state of another ctx doesn't
+ *       carry a partial match into the next chunk.
+ */
+static int SCACTest32(void)
 {
     int result = 0;
     MpmCtx mpm_ctx;
+    MpmCtx big_ctx;
     MpmThreadCtx mpm_thread_ctx;
+    MpmStreamState ss;
 
-    memset(&mpm_ctx, 0x00, sizeof(MpmCtx));
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&big_ctx, 0, sizeof(MpmCtx));
     memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmStreamStateReset(&ss);
     MpmInitCtx(&mpm_ctx, MPM_AC, -1);
     SCACInitThreadCtx(&mpm_ctx, &mpm_thread_ctx, 0);
 
-    /* 1 */
-    SCACAddPatternCS(&mpm_ctx, (uint8_t *)"AA", 2, 0, 0, 0, 0, 0);
+    SCACAddPatternCI(&mpm_ctx, (uint8_t *)"abcd", 4, 0, 0, 0, 0, 0);
 
     SCACPreparePatterns(&mpm_ctx);
 
-    uint32_t cnt = SCACSearch(&mpm_ctx, &mpm_thread_ctx, NULL,
-                              (uint8_t *)"AA", 2);
+    uint32_t cnt = SCACSearchResume(&mpm_ctx, &mpm_thread_ctx, NULL, &ss,
+                                    (uint8_t *)"xxab", 4);
+    MpmStreamStateReset(&ss);
+    cnt += SCACSearchResume(&mpm_ctx, &mpm_thread_ctx, NULL, &ss,
+                            (uint8_t *)"cdxx", 4);
+    if (cnt != 0) {
+        printf("0 != %" PRIu32 " after reset ", cnt);
+        goto end;
+    }
 
-    if (cnt == 1)
-        result = 1;
-    else
-        printf("1 != %" PRIu32 " ",cnt);
+    cnt = SCACSearchResume(&mpm_ctx, &mpm_thread_ctx, NULL, &ss,
+                           (uint8_t *)"xxab", 4);
+    ss.mpm_ctx = NULL;
+    cnt += SCACSearchResume(&mpm_ctx, &mpm_thread_ctx, NULL, &ss,
+                            (uint8_t *)"cdxx", 4);
+    if (cnt != 0) {
+        printf("0 != %" PRIu32 " after ctx change ", cnt);
+        goto end;
+    }
+
+    /* a state out of range of this ctx, as left by another automaton */
+    ss.state = 0xFFFFFF;
+    cnt = SCACSearchResume(&mpm_ctx, &mpm_thread_ctx, NULL, &ss,
+                           (uint8_t *)"abcd", 4);
+    if (cnt != 1) {
+        printf("1 != %" PRIu32 " after out of range state ", cnt);
+        goto end;
+    }
+
+    /* u32 states: a chunk ending in an output state ("ab") still carries
+     * "abcd" into the next chunk */
+    SCACTestBigCtx(&big_ctx, NULL, 0);
+    MpmStreamStateReset(&ss);
+    cnt = SCACSearchResume(&big_ctx, &mpm_thread_ctx, NULL, &ss,
+                           (uint8_t *)"xxab", 4);
+    cnt += SCACSearchResume(&big_ctx, &mpm_thread_ctx, NULL, &ss,
+                            (uint8_t *)"cdxx", 4);
+    if (cnt != 2) {
+        printf("2 != %" PRIu32 " over u32 chunks ", cnt);
+        goto end;
+    }
+
+    ss.state = 0xFFFFFF;
+    cnt = SCACSearchResume(&big_ctx, &mpm_thread_ctx, NULL, &ss,
+                           (uint8_t *)"abcd", 4);
+    if (cnt != 2) {
+        printf("2 != %" PRIu32 " after out of range u32 state ", cnt);
+        goto end;
+    }
+
+    result = 1;
+end:
+    SCACDestroyCtx(&mpm_ctx);
+    SCACDestroyCtx(&big_ctx);
+    SCACDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    return result;
+}
+
+
+/**
+ * \internal
+ * \brief Setup a full and a compressed AC ctx with the same random
+ *        patterns, from a small alphabet so there are plenty of matches.
+ */
+static void SCACTestSetupPair(MpmCtx *full_ctx, MpmCtx *cmp_ctx,
+                              uint32_t pat_cnt, uint32_t *seed)
+{
+    uint8_t pat[12];
+    uint32_t i, u;
+
+    memset(full_ctx, 0, sizeof(MpmCtx));
+    memset(cmp_ctx, 0, sizeof(MpmCtx));
+    MpmInitCtx(full_ctx, MPM_AC, -1);
+    MpmInitCtx(cmp_ctx, MPM_AC, -1);
+    ((SCACCtx *)full_ctx->ctx)->compressed = 0;
+    ((SCACCtx *)cmp_ctx->ctx)->compressed = 1;
+
+    for (i = 0; i < pat_cnt; i++) {
+        uint16_t len = 1 + SCACTestRand(seed) % sizeof(pat);
+        for (u = 0; u < len; u++)
+            pat[u] = "abcdeABCDE"[SCACTestRand(seed) % 10];
+
+        if (SCACTestRand(seed) & 1) {
+            SCACAddPatternCI(full_ctx, pat, len, 0, 0, i, 0, 0);
+            SCACAddPatternCI(cmp_ctx, pat, len, 0, 0, i, 0, 0);
+        } else {
+            SCACAddPatternCS(full_ctx, pat, len, 0, 0, i, 0, 0);
+            SCACAddPatternCS(cmp_ctx, pat, len, 0, 0, i, 0, 0);
+        }
+    }
+
+    SCACPreparePatterns(full_ctx);
+    SCACPreparePatterns(cmp_ctx);
+}
+
+/**
+ * \test The compressed state table finds the same patterns as the full
+ *       one, for whole buffers and for buffers searched in 2 chunks.
+ */
+static int SCACTest33(void)
+{
+    int result = 0;
+    uint32_t seed = 1;
+    uint8_t buf[1500];
+    int run;
+
+    for (run = 0; run < 50; run++) {
+        MpmCtx full_ctx, cmp_ctx;
+        MpmThreadCtx mpm_thread_ctx;
+        PatternMatcherQueue full_pmq, cmp_pmq;
+        MpmStreamState full_ss, cmp_ss;
+        uint32_t pat_cnt = 1 + SCACTestRand(&seed) % 300;
+        uint32_t full_cnt, cmp_cnt;
+        uint32_t u;
+        int ok = 1;
+
+        SCACTestSetupPair(&full_ctx, &cmp_ctx, pat_cnt, &seed);
+        memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+        SCACInitThreadCtx(&full_ctx, &mpm_thread_ctx, 0);
+        PmqSetup(&full_pmq, 0, pat_cnt);
+        PmqSetup(&cmp_pmq, 0, pat_cnt);
+
+        uint16_t buflen = SCACTestRand(&seed) % sizeof(buf);
+        for (u = 0; u < buflen; u++)
+            buf[u] = "abcdeABCDE."[SCACTestRand(&seed) % 11];
+
+        full_cnt = SCACSearch(&full_ctx, &mpm_thread_ctx, &full_pmq, buf, buflen);
+        cmp_cnt = SCACSearch(&cmp_ctx, &mpm_thread_ctx, &cmp_pmq, buf, buflen);
+        if (full_cnt != cmp_cnt ||
+            full_pmq.pattern_id_array_cnt != cmp_pmq.pattern_id_array_cnt ||
+            memcmp(full_pmq.pattern_id_bitarray, cmp_pmq.pattern_id_bitarray,
+                   full_pmq.pattern_id_bitarray_size) != 0) {
+            printf("run %d: search full %" PRIu32 " compressed %" PRIu32 ": ",
+                   run, full_cnt, cmp_cnt);
+            ok = 0;
+        }
+
+        PmqReset(&full_pmq);
+        PmqReset(&cmp_pmq);
+        MpmStreamStateReset(&full_ss);
+        MpmStreamStateReset(&cmp_ss);
+        uint16_t split = buflen / 2;
+        full_cnt = SCACSearchResume(&full_ctx, &mpm_thread_ctx, &full_pmq,
+                                    &full_ss, buf, split);
+        full_cnt += SCACSearchResume(&full_ctx, &mpm_thread_ctx, &full_pmq,
+                                     &full_ss, buf + split, buflen - split);
+        cmp_cnt = SCACSearchResume(&cmp_ctx, &mpm_thread_ctx, &cmp_pmq,
+                                   &cmp_ss, buf, split);
+        cmp_cnt += SCACSearchResume(&cmp_ctx, &mpm_thread_ctx, &cmp_pmq,
+                                    &cmp_ss, buf + split, buflen - split);
+        if (ok && (full_cnt != cmp_cnt ||
+            memcmp(full_pmq.pattern_id_bitarray, cmp_pmq.pattern_id_bitarray,
+                   full_pmq.pattern_id_bitarray_size) != 0)) {
+            printf("run %d: resume full %" PRIu32 " compressed %" PRIu32 ": ",
+                   run, full_cnt, cmp_cnt);
+            ok = 0;
+        }
+
+        PmqFree(&full_pmq);
+        PmqFree(&cmp_pmq);
+        SCACDestroyCtx(&full_ctx);
+        SCACDestroyCtx(&cmp_ctx);
+        SCACDestroyThreadCtx(&full_ctx, &mpm_thread_ctx);
+
+        if (!ok)
+            goto end;
+    }
 
-    SCACDestroyCtx(&mpm_ctx);
-    SCACDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    result = 1;
+end:
     return result;
 }
 
-static int SCACTest22(void)
+/**
+ * \test Compressed state table: nocase and case sensitive patterns, bytes
+ *       that are in no pattern and segmented searches.
+ */
+static int SCACTest34(void)
 {
     int result = 0;
     MpmCtx mpm_ctx;
     MpmThreadCtx mpm_thread_ctx;
+    uint8_t pid_tags[3] = { 0x01, 0x01, 0x02 };
+    MpmBufferSegment segs[2];
 
-    memset(&mpm_ctx, 0x00, sizeof(MpmCtx));
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
     memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
     MpmInitCtx(&mpm_ctx, MPM_AC, -1);
+    ((SCACCtx *)mpm_ctx.ctx)->compressed = 1;
     SCACInitThreadCtx(&mpm_ctx, &mpm_thread_ctx, 0);
 
-    /* 1 match */
-    SCACAddPatternCS(&mpm_ctx, (uint8_t *)"abcd", 4, 0, 0, 0, 0, 0);
-    /* 1 match */
-    SCACAddPatternCS(&mpm_ctx, (uint8_t *)"abcde", 5, 0, 0, 1, 0, 0);
+    SCACAddPatternCI(&mpm_ctx, (uint8_t *)"abcd", 4, 0, 0, 0, 0, 0);
+    SCACAddPatternCS(&mpm_ctx, (uint8_t *)"Bcde", 4, 0, 0, 1, 0, 0);
+    SCACAddPatternCS(&mpm_ctx, (uint8_t *)"fghj", 4, 0, 0, 2, 0, 0);
 
     SCACPreparePatterns(&mpm_ctx);
 
-    char *buf = "abcdefghijklmnopqrstuvwxyz";
+    SCACCtx *ctx = (SCACCtx *)mpm_ctx.ctx;
+    /* class 0 and a class per lowercase pattern byte */
+    if (ctx->class_cnt != 10 || ctx->class_map['z'] != 0 ||
+        ctx->class_map['A'] != ctx->class_map['a']) {
+        printf("classes %" PRIu32 ": ", ctx->class_cnt);
+        goto end;
+    }
+
+    /* abcd (nocase) and fghj, not Bcde */
+    char *buf = "xABCDefghjz";
     uint32_t cnt = SCACSearch(&mpm_ctx, &mpm_thread_ctx, NULL,
                               (uint8_t *)buf, strlen(buf));
+    if (cnt != 2) {
+        printf("2 != %" PRIu32 " ", cnt);
+        goto end;
+    }
 
-    if (cnt == 2)
-        result = 1;
-    else
-        printf("2 != %" PRIu32 " ",cnt);
+    /* abcd and Bcde in segment 0, fghj isn't tagged for segment 1 */
+    segs[0].buf = (uint8_t *)"aBcde";
+    segs[0].buflen = 5;
+    segs[0].tag = 0x01;
+    segs[1].buf = (uint8_t *)"fghj";
+    segs[1].buflen = 4;
+    segs[1].tag = 0x01;
+    cnt = SCACSearchSegments(&mpm_ctx, &mpm_thread_ctx, NULL, segs, 2, pid_tags);
+    if (cnt != 2) {
+        printf("segments 2 != %" PRIu32 " ", cnt);
+        goto end;
+    }
 
+    result = 1;
+end:
     SCACDestroyCtx(&mpm_ctx);
     SCACDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
     return result;
 }
 
-static int SCACTest23(void)
+/**
+ * \test A batch search finds the same patterns as searching the buffers
+ *       one by one, for more buffers than lanes, empty buffers and
+ *       buffers of very different lengths.  Full and compressed tables.
+ */
+static int SCACTest35(void)
 {
     int result = 0;
-    MpmCtx mpm_ctx;
-    MpmThreadCtx mpm_thread_ctx;
-
-    memset(&mpm_ctx, 0x00, sizeof(MpmCtx));
-    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
-    MpmInitCtx(&mpm_ctx, MPM_AC, -1);
-    SCACInitThreadCtx(&mpm_ctx, &mpm_thread_ctx, 0);
-
-    /* 1 */
-    SCACAddPatternCS(&mpm_ctx, (uint8_t *)"AA", 2, 0, 0, 0, 0, 0);
+    uint32_t seed = 7;
+    uint8_t bufs[21][600];
+    int run;
+
+    for (run = 0; run < 30; run++) {
+        MpmCtx ctx[2];
+        MpmThreadCtx mpm_thread_ctx;
+        MpmBatchBuffer batch[21];
+        PatternMatcherQueue batch_pmq[21];
+        PatternMatcherQueue pmq;
+        uint32_t pat_cnt = 1 + SCACTestRand(&seed) % 200;
+        uint16_t cnt = 1 + SCACTestRand(&seed) % 21;
+        uint32_t total, sum, one;
+        uint16_t i, u;
+        int c;
+        int ok = 1;
+
+        SCACTestSetupPair(&ctx[0], &ctx[1], pat_cnt, &seed);
+        memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+        SCACInitThreadCtx(&ctx[0], &mpm_thread_ctx, 0);
+        PmqSetup(&pmq, 0, pat_cnt);
+
+        for (i = 0; i < cnt; i++) {
+            uint16_t len = SCACTestRand(&seed) % sizeof(bufs[i]);
+            /* some empty and some tiny buffers */
+            if (i % 5 == 1)
+                len = 0;
+            else if (i % 5 == 3)
+                len %= 4;
+            for (u = 0; u < len; u++)
+                bufs[i][u] = "abcdeABCDE."[SCACTestRand(&seed) % 11];
+
+            batch[i].buf = (i == 6) ? NULL : bufs[i];
+            batch[i].buflen = (i == 6) ? 0 : len;
+            batch[i].pmq = &batch_pmq[i];
+            PmqSetup(&batch_pmq[i], 0, pat_cnt);
+        }
 
-    SCACPreparePatterns(&mpm_ctx);
+        for (c = 0; c < 2 && ok; c++) {
+            for (i = 0; i < cnt; i++)
+                PmqReset(&batch_pmq[i]);
+
+            total = SCACSearchBatch(&ctx[c], &mpm_thread_ctx, batch, cnt);
+
+            sum = 0;
+            for (i = 0; i < cnt; i++) {
+                PmqReset(&pmq);
+                one = 0;
+                if (batch[i].buf != NULL)
+                    one = SCACSearch(&ctx[c], &mpm_thread_ctx, &pmq,
+                                     batch[i].buf, batch[i].buflen);
+                if (one != batch[i].matches ||
+                    pmq.pattern_id_array_cnt != batch_pmq[i].pattern_id_array_cnt ||
+                    memcmp(pmq.pattern_id_bitarray, batch_pmq[i].pattern_id_bitarray,
+                           pmq.pattern_id_bitarray_size) != 0) {
+                    printf("run %d ctx %d buf %" PRIu16 ": %" PRIu32 " != %"
+                           PRIu32 ": ", run, c, i, one, batch[i].matches);
+                    ok = 0;
+                    break;
+                }
+                sum += one;
+            }
+            if (ok && sum != total) {
+                printf("run %d ctx %d: total %" PRIu32 " != %" PRIu32 ": ",
+                       run, c, total, sum);
+                ok = 0;
+            }
+        }
 
-    uint32_t cnt = SCACSearch(&mpm_ctx, &mpm_thread_ctx, NULL,
-                              (uint8_t *)"aa", 2);
+        for (i = 0; i < cnt; i++)
+            PmqFree(&batch_pmq[i]);
+        PmqFree(&pmq);
+        SCACDestroyCtx(&ctx[0]);
+        SCACDestroyCtx(&ctx[1]);
+        SCACDestroyThreadCtx(&ctx[0], &mpm_thread_ctx);
 
-    if (cnt == 0)
-        result = 1;
-    else
-        printf("1 != %" PRIu32 " ",cnt);
+        if (!ok)
+            goto end;
+    }
 
-    SCACDestroyCtx(&mpm_ctx);
-    SCACDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    result = 1;
+end:
     return result;
 }
 
-static int SCACTest24(void)
+/**
+ * \test Preparing ctxs on a pool of threads gives the same ctxs as
+ *       preparing them one after the other.
+ */
+static int SCACTest36(void)
 {
     int result = 0;
-    MpmCtx mpm_ctx;
+    MpmCtx seq_ctx[16], par_ctx[16];
+    MpmCtx *seq[16], *par[16];
     MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue seq_pmq, par_pmq;
+    uint8_t pat[12];
+    uint8_t buf[1000];
+    uint32_t seed = 3;
+    uint32_t i, j, u;
 
-    memset(&mpm_ctx, 0x00, sizeof(MpmCtx));
     memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
-    MpmInitCtx(&mpm_ctx, MPM_AC, -1);
-    SCACInitThreadCtx(&mpm_ctx, &mpm_thread_ctx, 0);
+    memset(&seq_pmq, 0, sizeof(seq_pmq));
+    memset(&par_pmq, 0, sizeof(par_pmq));
+
+    for (i = 0; i < 16; i++) {
+        uint32_t pat_cnt = 1 + SCACTestRand(&seed) % 500;
+
+        memset(&seq_ctx[i], 0, sizeof(MpmCtx));
+        memset(&par_ctx[i], 0, sizeof(MpmCtx));
+        MpmInitCtx(&seq_ctx[i], MPM_AC, -1);
+        MpmInitCtx(&par_ctx[i], MPM_AC, -1);
+        ((SCACCtx *)seq_ctx[i].ctx)->compressed = i % 2;
+        ((SCACCtx *)par_ctx[i].ctx)->compressed = i % 2;
+        seq[i] = &seq_ctx[i];
+        par[i] = &par_ctx[i];
+
+        for (j = 0; j < pat_cnt; j++) {
+            uint16_t len = 1 + SCACTestRand(&seed) % sizeof(pat);
+            for (u = 0; u < len; u++)
+                pat[u] = "abcdeABCDE"[SCACTestRand(&seed) % 10];
+            SCACAddPatternCI(seq[i], pat, len, 0, 0, j, 0, 0);
+            SCACAddPatternCI(par[i], pat, len, 0, 0, j, 0, 0);
+        }
+    }
 
-    /* 1 */
-    SCACAddPatternCI(&mpm_ctx, (uint8_t *)"AA", 2, 0, 0, 0, 0, 0);
+    MpmPrepareCtxs(seq, 16, 1);
+    MpmPrepareCtxs(par, 16, 4);
 
-    SCACPreparePatterns(&mpm_ctx);
+    SCACInitThreadCtx(seq[0], &mpm_thread_ctx, 0);
+    PmqSetup(&seq_pmq, 0, 500);
+    PmqSetup(&par_pmq, 0, 500);
+    for (u = 0; u < sizeof(buf); u++)
+        buf[u] = "abcdeABCDE."[SCACTestRand(&seed) % 11];
 
-    uint32_t cnt = SCACSearch(&mpm_ctx, &mpm_thread_ctx, NULL,
-                              (uint8_t *)"aa", 2);
+    for (i = 0; i < 16; i++) {
+        SCACCtx *s = (SCACCtx *)seq[i]->ctx;
+        SCACCtx *p = (SCACCtx *)par[i]->ctx;
 
-    if (cnt == 1)
-        result = 1;
-    else
-        printf("1 != %" PRIu32 " ",cnt);
+        if (s->state_count != p->state_count ||
+            seq[i]->memory_size != par[i]->memory_size) {
+            printf("ctx %" PRIu32 ": states %" PRIu32 " != %" PRIu32 ": ",
+                   i, s->state_count, p->state_count);
+            goto end;
+        }
 
-    SCACDestroyCtx(&mpm_ctx);
-    SCACDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+        PmqReset(&seq_pmq);
+        PmqReset(&par_pmq);
+        uint32_t seq_cnt = SCACSearch(seq[i], &mpm_thread_ctx, &seq_pmq, buf, sizeof(buf));
+        uint32_t par_cnt = SCACSearch(par[i], &mpm_thread_ctx, &par_pmq, buf, sizeof(buf));
+        if (seq_cnt != par_cnt ||
+            memcmp(seq_pmq.pattern_id_bitarray, par_pmq.pattern_id_bitarray,
+                   seq_pmq.pattern_id_bitarray_size) != 0) {
+            printf("ctx %" PRIu32 ": %" PRIu32 " != %" PRIu32 " matches: ",
+                   i, seq_cnt, par_cnt);
+            goto end;
+        }
+    }
+
+    result = 1;
+end:
+    PmqFree(&seq_pmq);
+    PmqFree(&par_pmq);
+    SCACDestroyThreadCtx(seq[0], &mpm_thread_ctx);
+    for (i = 0; i < 16; i++) {
+        SCACDestroyCtx(seq[i]);
+        SCACDestroyCtx(par[i]);
+    }
     return result;
 }
 
-static int SCACTest25(void)
+#ifdef HAVE_SYS_MMAN_H
+/**
+ * \internal
+ * \brief Setup and prepare an AC ctx using the cache in dir, with
+ *        pat_cnt random patterns from seed.
+ */
+static void SCACTestCacheCtx(MpmCtx *mpm_ctx, const char *dir, uint8_t compressed,
+                             uint32_t seed, uint32_t pat_cnt)
+{
+    uint8_t pat[12];
+    uint32_t j, u;
+
+    memset(mpm_ctx, 0, sizeof(MpmCtx));
+    MpmInitCtx(mpm_ctx, MPM_AC, -1);
+    ((SCACCtx *)mpm_ctx->ctx)->compressed = compressed;
+    ((SCACCtx *)mpm_ctx->ctx)->cache_dir = dir;
+
+    for (j = 0; j < pat_cnt; j++) {
+        uint16_t len = 1 + SCACTestRand(&seed) % sizeof(pat);
+        for (u = 0; u < len; u++)
+            pat[u] = "abcdeABCDE"[SCACTestRand(&seed) % 10];
+        if (j % 2)
+            SCACAddPatternCI(mpm_ctx, pat, len, 0, 0, j, 0, 0);
+        else
+            SCACAddPatternCS(mpm_ctx, pat, len, 0, 0, j, 0, 0);
+    }
+
+    SCACPreparePatterns(mpm_ctx);
+}
+
+/**
+ * \internal
+ * \brief Remove the cache files from dir.
+ */
+static void SCACTestCacheDirClean(const char *dir)
+{
+    DIR *d = opendir(dir);
+    if (d != NULL) {
+        struct dirent *de;
+        char path[PATH_MAX];
+        while ((de = readdir(d)) != NULL) {
+            if (de->d_name[0] == '.')
+                continue;
+            snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+            unlink(path);
+        }
+        closedir(d);
+    }
+}
+
+/**
+ * \test A ctx with the same patterns as a cached one is loaded from the
+ *       cache file and matches the same, a ctx with other patterns is not.
+ */
+static int SCACTest37(void)
 {
     int result = 0;
-    MpmCtx mpm_ctx;
+    char dir[] = "/tmp/sc-ac-cache-XXXXXX";
+    MpmCtx built_ctx, cached_ctx, other_ctx;
     MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue built_pmq, cached_pmq;
+    uint8_t buf[1000];
+    uint32_t seed = 5;
+    uint32_t u;
+    uint8_t compressed;
 
-    memset(&mpm_ctx, 0x00, sizeof(MpmCtx));
     memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
-    MpmInitCtx(&mpm_ctx, MPM_AC, -1);
-    SCACInitThreadCtx(&mpm_ctx, &mpm_thread_ctx, 0);
+    memset(&built_pmq, 0, sizeof(built_pmq));
+    memset(&cached_pmq, 0, sizeof(cached_pmq));
+    memset(&built_ctx, 0, sizeof(MpmCtx));
+    memset(&cached_ctx, 0, sizeof(MpmCtx));
+    memset(&other_ctx, 0, sizeof(MpmCtx));
 
-    SCACAddPatternCI(&mpm_ctx, (uint8_t *)"ABCD", 4, 0, 0, 0, 0, 0);
-    SCACAddPatternCI(&mpm_ctx, (uint8_t *)"bCdEfG", 6, 0, 0, 1, 0, 0);
-    SCACAddPatternCI(&mpm_ctx, (uint8_t *)"fghiJkl", 7, 0, 0, 2, 0, 0);
+    if (mkdtemp(dir) == NULL)
+        return 0;
 
-    SCACPreparePatterns(&mpm_ctx);
+    PmqSetup(&built_pmq, 0, 400);
+    PmqSetup(&cached_pmq, 0, 400);
+    for (u = 0; u < sizeof(buf); u++)
+        buf[u] = "abcdeABCDE."[SCACTestRand(&seed) % 11];
+
+    for (compressed = 0; compressed < 2; compressed++) {
+        SCACTestCacheCtx(&built_ctx, dir, compressed, 7, 400);
+        SCACTestCacheCtx(&cached_ctx, dir, compressed, 7, 400);
+        SCACTestCacheCtx(&other_ctx, dir, compressed, 7, 399);
+
+        SCACCtx *b = (SCACCtx *)built_ctx.ctx;
+        SCACCtx *c = (SCACCtx *)cached_ctx.ctx;
+        if (b->cache_map != NULL || c->cache_map == NULL ||
+            ((SCACCtx *)other_ctx.ctx)->cache_map != NULL) {
+            printf("compressed %u: cache not used as expected: ", compressed);
+            goto end;
+        }
+        if (b->state_count != c->state_count) {
+            printf("compressed %u: states %" PRIu32 " != %" PRIu32 ": ",
+                   compressed, b->state_count, c->state_count);
+            goto end;
+        }
 
-    char *buf = "ABCDEFGHIJKLMNOPQRSTUVWXYZ";
-    uint32_t cnt = SCACSearch(&mpm_ctx, &mpm_thread_ctx, NULL,
-                               (uint8_t *)buf, strlen(buf));
+        if (compressed == 0)
+            SCACInitThreadCtx(&built_ctx, &mpm_thread_ctx, 0);
+        PmqReset(&built_pmq);
+        PmqReset(&cached_pmq);
+        uint32_t built_cnt = SCACSearch(&built_ctx, &mpm_thread_ctx, &built_pmq, buf, sizeof(buf));
+        uint32_t cached_cnt = SCACSearch(&cached_ctx, &mpm_thread_ctx, &cached_pmq, buf, sizeof(buf));
+        if (built_cnt == 0 || built_cnt != cached_cnt ||
+            memcmp(built_pmq.pattern_id_bitarray, cached_pmq.pattern_id_bitarray,
+                   built_pmq.pattern_id_bitarray_size) != 0) {
+            printf("compressed %u: %" PRIu32 " != %" PRIu32 " matches: ",
+                   compressed, built_cnt, cached_cnt);
+            goto end;
+        }
 
-    if (cnt == 3)
-        result = 1;
-    else
-        printf("3 != %" PRIu32 " ",cnt);
+        SCACDestroyCtx(&built_ctx);
+        SCACDestroyCtx(&cached_ctx);
+        SCACDestroyCtx(&other_ctx);
+        memset(&built_ctx, 0, sizeof(MpmCtx));
+        memset(&cached_ctx, 0, sizeof(MpmCtx));
+        memset(&other_ctx, 0, sizeof(MpmCtx));
+    }
 
-    SCACDestroyCtx(&mpm_ctx);
-    SCACDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    result = 1;
+end:
+    PmqFree(&built_pmq);
+    PmqFree(&cached_pmq);
+    if (mpm_thread_ctx.ctx != NULL)
+        SCACDestroyThreadCtx(&built_ctx, &mpm_thread_ctx);
+    SCACDestroyCtx(&built_ctx);
+    SCACDestroyCtx(&cached_ctx);
+    SCACDestroyCtx(&other_ctx);
+
+    SCACTestCacheDirClean(dir);
+    rmdir(dir);
     return result;
 }
 
-static int SCACTest26(void)
+/**
+ * \internal
+ * \brief Overwrite the first 4 bytes of a section of the cache file in
+ *        dir with 0xff.
+ *
+ * \retval 1 ok, 0 no cache file or write error
+ */
+static int SCACTestCacheCorrupt(const char *dir, uint32_t sect)
+{
+    SCACCacheHdr hdr;
+    uint32_t bad = 0xFFFFFFFF;
+    int r = 0;
+    int fd = -1;
+
+    DIR *d = opendir(dir);
+    if (d == NULL)
+        return 0;
+    struct dirent *de;
+    char path[PATH_MAX];
+    while ((de = readdir(d)) != NULL) {
+        if (de->d_name[0] == '.')
+            continue;
+        snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+        fd = open(path, O_RDWR);
+        break;
+    }
+    closedir(d);
+    if (fd < 0)
+        return 0;
+
+    if (pread(fd, &hdr, sizeof(hdr), 0) == (ssize_t)sizeof(hdr) &&
+        hdr.sect_size[sect] >= sizeof(bad) &&
+        pwrite(fd, &bad, sizeof(bad), hdr.sect_offset[sect]) == (ssize_t)sizeof(bad))
+        r = 1;
+    close(fd);
+    return r;
+}
+
+/**
+ * \test A cache file with state or pattern id values out of range is not
+ *       used, the tables are rebuilt instead.
+ */
+static int SCACTest38(void)
 {
     int result = 0;
-    MpmCtx mpm_ctx;
-    MpmThreadCtx mpm_thread_ctx;
+    char dir[] = "/tmp/sc-ac-cache-XXXXXX";
+    MpmCtx built_ctx, cached_ctx;
+    uint32_t sects[] = { SC_AC_CACHE_SECT_STATES, SC_AC_CACHE_SECT_PIDS,
+                         SC_AC_CACHE_SECT_ROW_NEXT };
+    uint32_t u;
+    uint8_t compressed;
 
-    memset(&mpm_ctx, 0x00, sizeof(MpmCtx));
-    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
-    MpmInitCtx(&mpm_ctx, MPM_AC, -1);
-    SCACInitThreadCtx(&mpm_ctx, &mpm_thread_ctx, 0);
+    memset(&built_ctx, 0, sizeof(MpmCtx));
+    memset(&cached_ctx, 0, sizeof(MpmCtx));
 
-    SCACAddPatternCI(&mpm_ctx, (uint8_t *)"Works", 5, 0, 0, 1, 0, 0);
-    SCACAddPatternCS(&mpm_ctx, (uint8_t *)"Works", 5, 0, 0, 1, 0, 0);
+    if (mkdtemp(dir) == NULL)
+        return 0;
 
-    SCACPreparePatterns(&mpm_ctx);
+    for (compressed = 0; compressed < 2; compressed++) {
+        for (u = 0; u < sizeof(sects) / sizeof(sects[0]); u++) {
+            /* the row tables only exist in a compressed ctx */
+            if (!compressed && sects[u] == SC_AC_CACHE_SECT_ROW_NEXT)
+                continue;
 
-    char *buf = "works";
-    uint32_t cnt = SCACSearch(&mpm_ctx, &mpm_thread_ctx, NULL,
-                               (uint8_t *)buf, strlen(buf));
+            SCACTestCacheCtx(&built_ctx, dir, compressed, 7, 400);
+            if (!SCACTestCacheCorrupt(dir, sects[u])) {
+                printf("compressed %u sect %u: corrupting the cache failed: ",
+                       compressed, sects[u]);
+                goto end;
+            }
 
-    if (cnt == 1)
-        result = 1;
-    else
-        printf("3 != %" PRIu32 " ",cnt);
+            SCACTestCacheCtx(&cached_ctx, dir, compressed, 7, 400);
+            SCACCtx *c = (SCACCtx *)cached_ctx.ctx;
+            if (c->cache_map != NULL ||
+                c->state_count != ((SCACCtx *)built_ctx.ctx)->state_count) {
+                printf("compressed %u sect %u: corrupt cache used: ",
+                       compressed, sects[u]);
+                goto end;
+            }
 
-    SCACDestroyCtx(&mpm_ctx);
-    SCACDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+            SCACDestroyCtx(&built_ctx);
+            SCACDestroyCtx(&cached_ctx);
+            memset(&built_ctx, 0, sizeof(MpmCtx));
+            memset(&cached_ctx, 0, sizeof(MpmCtx));
+            SCACTestCacheDirClean(dir);
+        }
+    }
+
+    result = 1;
+end:
+    SCACDestroyCtx(&built_ctx);
+    SCACDestroyCtx(&cached_ctx);
+    SCACTestCacheDirClean(dir);
+    rmdir(dir);
     return result;
 }
 
-static int SCACTest27(void)
+/**
+ * \test An automaton with more than 65535 states, so u32 states, is loaded
+ *       from the cache file and matches the same as the built one.
+ */
+static int SCACTest39(void)
 {
     int result = 0;
-    MpmCtx mpm_ctx;
+    char dir[] = "/tmp/sc-ac-cache-XXXXXX";
+    MpmCtx built_ctx, cached_ctx;
     MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue built_pmq, cached_pmq;
+    uint8_t buf[4000];
+    uint32_t seed = 11;
+    uint32_t u;
+    uint8_t compressed;
 
-    memset(&mpm_ctx, 0, sizeof(MpmCtx));
     memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
-    MpmInitCtx(&mpm_ctx, MPM_AC, -1);
-    SCACInitThreadCtx(&mpm_ctx, &mpm_thread_ctx, 0);
+    memset(&built_pmq, 0, sizeof(built_pmq));
+    memset(&cached_pmq, 0, sizeof(cached_pmq));
+    memset(&built_ctx, 0, sizeof(MpmCtx));
+    memset(&cached_ctx, 0, sizeof(MpmCtx));
 
-    /* 0 match */
-    SCACAddPatternCS(&mpm_ctx, (uint8_t *)"ONE", 3, 0, 0, 0, 0, 0);
+    if (mkdtemp(dir) == NULL)
+        return 0;
 
-    SCACPreparePatterns(&mpm_ctx);
+    PmqSetup(&built_pmq, 0, SC_AC_TEST_BIG_PATTERNS);
+    PmqSetup(&cached_pmq, 0, SC_AC_TEST_BIG_PATTERNS);
+    for (u = 0; u < sizeof(buf); u++)
+        buf[u] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ"[SCACTestRand(&seed) % 52];
+
+    for (compressed = 0; compressed < 2; compressed++) {
+        SCACTestBigCtx(&built_ctx, dir, compressed);
+        SCACTestBigCtx(&cached_ctx, dir, compressed);
+
+        SCACCtx *b = (SCACCtx *)built_ctx.ctx;
+        SCACCtx *c = (SCACCtx *)cached_ctx.ctx;
+        if (b->state_count < 65536) {
+            printf("compressed %u: only %" PRIu32 " states: ", compressed,
+                   b->state_count);
+            goto end;
+        }
+        if (b->cache_map != NULL || c->cache_map == NULL ||
+            b->state_count != c->state_count) {
+            printf("compressed %u: cache not used as expected: ", compressed);
+            goto end;
+        }
 
-    char *buf = "tone";
-    uint32_t cnt = SCACSearch(&mpm_ctx, &mpm_thread_ctx, NULL,
-                               (uint8_t *)buf, strlen(buf));
+        if (compressed == 0)
+            SCACInitThreadCtx(&built_ctx, &mpm_thread_ctx, 0);
+        PmqReset(&built_pmq);
+        PmqReset(&cached_pmq);
+        uint32_t built_cnt = SCACSearch(&built_ctx, &mpm_thread_ctx, &built_pmq, buf, sizeof(buf));
+        uint32_t cached_cnt = SCACSearch(&cached_ctx, &mpm_thread_ctx, &cached_pmq, buf, sizeof(buf));
+        if (built_cnt == 0 || built_cnt != cached_cnt ||
+            memcmp(built_pmq.pattern_id_bitarray, cached_pmq.pattern_id_bitarray,
+                   built_pmq.pattern_id_bitarray_size) != 0) {
+            printf("compressed %u: %" PRIu32 " != %" PRIu32 " matches: ",
+                   compressed, built_cnt, cached_cnt);
+            goto end;
+        }
 
-    if (cnt == 0)
-        result = 1;
-    else
-        printf("0 != %" PRIu32 " ",cnt);
+        SCACDestroyCtx(&built_ctx);
+        SCACDestroyCtx(&cached_ctx);
+        memset(&built_ctx, 0, sizeof(MpmCtx));
+        memset(&cached_ctx, 0, sizeof(MpmCtx));
+        SCACTestCacheDirClean(dir);
+    }
 
-    SCACDestroyCtx(&mpm_ctx);
-    SCACDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    result = 1;
+end:
+    PmqFree(&built_pmq);
+    PmqFree(&cached_pmq);
+    if (mpm_thread_ctx.ctx != NULL)
+        SCACDestroyThreadCtx(&built_ctx, &mpm_thread_ctx);
+    SCACDestroyCtx(&built_ctx);
+    SCACDestroyCtx(&cached_ctx);
+    SCACTestCacheDirClean(dir);
+    rmdir(dir);
     return result;
 }
+#endif /* HAVE_SYS_MMAN_H */
 
-static int SCACTest28(void)
+
+/** Uncomment this if you want stats
+ *  #define ENABLE_AC_SEARCH_STATS 1
+ */
+
+#ifdef ENABLE_AC_SEARCH_STATS
+
+/* Number of times to repeat the search (for stats) */
+#define AC_STATS_TIMES 1000000
+
+/**
+ * \test Stats: the buffers of a typical http request searched one by one
+ *       versus in a single segmented pass.
+ */
+static int SCACSearchStatsTest01(void)
 {
-    int result = 0;
     MpmCtx mpm_ctx;
     MpmThreadCtx mpm_thread_ctx;
+    uint8_t pid_tags[6] = { 0x01, 0x02, 0x04, 0x08, 0x10, 0x20 };
+    uint32_t cnt_sep = 0, cnt_seg = 0;
+    int i, j;
 
     memset(&mpm_ctx, 0, sizeof(MpmCtx));
     memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
     MpmInitCtx(&mpm_ctx, MPM_AC, -1);
     SCACInitThreadCtx(&mpm_ctx, &mpm_thread_ctx, 0);
 
-    /* 0 match */
-    SCACAddPatternCS(&mpm_ctx, (uint8_t *)"one", 3, 0, 0, 0, 0, 0);
+    SCACAddPatternCI(&mpm_ctx, (uint8_t *)"/index.php", 10, 0, 0, 0, 0, 0);
+    SCACAddPatternCI(&mpm_ctx, (uint8_t *)"user=", 5, 0, 0, 1, 0, 0);
+    SCACAddPatternCI(&mpm_ctx, (uint8_t *)"mozilla", 7, 0, 0, 2, 0, 0);
+    SCACAddPatternCS(&mpm_ctx, (uint8_t *)"Host: ", 6, 0, 0, 3, 0, 0);
+    SCACAddPatternCS(&mpm_ctx, (uint8_t *)"POST", 4, 0, 0, 4, 0, 0);
+    SCACAddPatternCI(&mpm_ctx, (uint8_t *)"session=", 8, 0, 0, 5, 0, 0);
 
     SCACPreparePatterns(&mpm_ctx);
 
-    char *buf = "tONE";
-    uint32_t cnt = SCACSearch(&mpm_ctx, &mpm_thread_ctx, NULL,
-                               (uint8_t *)buf, strlen(buf));
+    MpmBufferSegment segs[6];
+    segs[0].buf = (uint8_t *)"/index.php?id=1";
+    segs[1].buf = (uint8_t *)"user=admin&pass=admin";
+    segs[2].buf = (uint8_t *)"Host: www.example.org\r\nUser-Agent: Mozilla/5.0\r\n";
+    segs[3].buf = (uint8_t *)"Host: www.example.org\r\nUser-Agent: Mozilla/5.0\r\n";
+    segs[4].buf = (uint8_t *)"POST";
+    segs[5].buf = (uint8_t *)"session=abcdef";
+    for (i = 0; i < 6; i++) {
+        segs[i].buflen = strlen((char *)segs[i].buf);
+        segs[i].tag = pid_tags[i];
+    }
 
-    if (cnt == 0)
-        result = 1;
-    else
-        printf("0 != %" PRIu32 " ",cnt);
+    printf("AC separate searches: ");
+    CLOCK_INIT;
+    CLOCK_START;
+    for (j = 0; j < AC_STATS_TIMES; j++) {
+        cnt_sep = 0;
+        for (i = 0; i < 6; i++) {
+            cnt_sep += SCACSearch(&mpm_ctx, &mpm_thread_ctx, NULL,
+                                  segs[i].buf, segs[i].buflen);
+        }
+    }
+    CLOCK_END;
+    CLOCK_PRINT_SEC;
+
+    printf("AC segmented search: ");
+    CLOCK_START;
+    for (j = 0; j < AC_STATS_TIMES; j++) {
+        cnt_seg = SCACSearchSegments(&mpm_ctx, &mpm_thread_ctx, NULL,
+                                     segs, 6, pid_tags);
+    }
+    CLOCK_END;
+    CLOCK_PRINT_SEC;
 
     SCACDestroyCtx(&mpm_ctx);
     SCACDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
-    return result;
+
+    /* separate searches count the patterns of other buffers too */
+    return (cnt_seg == 6 && cnt_sep >= cnt_seg);
+}
+
+/**
+ * \test Stats: full versus compressed state table, for rule like sets of
+ *       random 4 to 20 byte patterns on a 1500 byte http request like
+ *       buffer.  With many contexts, like with sgh-mpm-context full, each
+ *       search uses the next context.
+ */
+static int SCACSearchStatsTest02(void)
+{
+    uint32_t pat_cnts[] = { 100, 2000, 2000, 20000 };
+    uint32_t ctx_cnts[] = { 1, 1, 32, 1 };
+    MpmCtx mpm_ctx[32];
+    uint8_t pat[20];
+    uint8_t buf[1500];
+    uint32_t seed = 1;
+    uint32_t c, i, u, n;
+    int compressed;
+    char *req = "GET /images/logo.png?v=20101018 HTTP/1.1\r\n"
+                "Host: www.example.org\r\n"
+                "User-Agent: Mozilla/5.0 (X11; U; Linux x86_64; en-US) Firefox/3.6.10\r\n"
+                "Accept: image/png,image/*;q=0.8,*/*;q=0.5\r\n"
+                "Accept-Encoding: gzip,deflate\r\n"
+                "Referer: http://www.example.org/index.html\r\n\r\n";
+
+    for (u = 0; u < sizeof(buf); u++)
+        buf[u] = req[u % strlen(req)];
+
+    for (c = 0; c < sizeof(pat_cnts) / sizeof(pat_cnts[0]); c++) {
+        for (compressed = 0; compressed < 2; compressed++) {
+            MpmThreadCtx mpm_thread_ctx;
+            PatternMatcherQueue pmq;
+            uint32_t cnt = 0;
+
+            memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+            PmqSetup(&pmq, 0, pat_cnts[c]);
+
+            /* printable patterns, some of them taken from the buffer */
+            seed = 1;
+            for (n = 0; n < ctx_cnts[c]; n++) {
+                memset(&mpm_ctx[n], 0, sizeof(MpmCtx));
+                MpmInitCtx(&mpm_ctx[n], MPM_AC, -1);
+                ((SCACCtx *)mpm_ctx[n].ctx)->compressed = compressed;
+
+                for (i = 0; i < pat_cnts[c]; i++) {
+                    uint16_t len = 4 + SCACTestRand(&seed) % 17;
+                    if (i % 50 == 0) {
+                        memcpy(pat, buf + SCACTestRand(&seed) % (sizeof(buf) - len), len);
+                    } else {
+                        for (u = 0; u < len; u++)
+                            pat[u] = 0x20 + SCACTestRand(&seed) % 0x5f;
+                    }
+                    SCACAddPatternCI(&mpm_ctx[n], pat, len, 0, 0, i, 0, 0);
+                }
+                SCACPreparePatterns(&mpm_ctx[n]);
+            }
+            SCACInitThreadCtx(&mpm_ctx[0], &mpm_thread_ctx, 0);
+            SCACPrintInfo(&mpm_ctx[0]);
+
+            printf("AC %s, %" PRIu32 " ctx of %" PRIu32 " patterns: ",
+                   compressed ? "compressed" : "full", ctx_cnts[c], pat_cnts[c]);
+            CLOCK_INIT;
+            CLOCK_START;
+            for (i = 0; i < AC_STATS_TIMES / 100; i++) {
+                cnt = SCACSearch(&mpm_ctx[i % ctx_cnts[c]], &mpm_thread_ctx,
+                                 &pmq, buf, sizeof(buf));
+                PmqReset(&pmq);
+            }
+            CLOCK_END;
+            printf("%" PRIu32 " matches, ", cnt);
+            CLOCK_PRINT_SEC;
+
+            PmqFree(&pmq);
+            for (n = 0; n < ctx_cnts[c]; n++)
+                SCACDestroyCtx(&mpm_ctx[n]);
+            SCACDestroyThreadCtx(&mpm_ctx[0], &mpm_thread_ctx);
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * \test Stats: a mix of packet payloads searched one by one versus as a
+ *       batch, for a small and a large rule like pattern set.  No pcaps
+ *       ship with the tree, so the payloads are typical http, smtp, dns
+ *       and tls ones.
+ */
+static int SCACSearchStatsTest03(void)
+{
+    uint32_t pat_cnts[] = { 100, 5000, 30000 };
+    uint8_t pat[20];
+    uint8_t tls[300];
+    uint32_t seed = 1;
+    uint32_t c, i, u;
+    int compressed;
+    MpmBatchBuffer batch[16];
+    char *payloads[] = {
+        "GET /images/logo.png?v=20101018 HTTP/1.1\r\n"
+        "Host: www.example.org\r\n"
+        "User-Agent: Mozilla/5.0 (X11; U; Linux x86_64; en-US) Firefox/3.6.10\r\n"
+        "Accept: image/png,image/*;q=0.8,*/*;q=0.5\r\n"
+        "Accept-Encoding: gzip,deflate\r\n"
+        "Referer: http://www.example.org/index.html\r\n\r\n",
+        "HTTP/1.1 200 OK\r\nDate: Mon, 18 Oct 2010 10:00:00 GMT\r\n"
+        "Server: Apache/2.2.16 (Unix)\r\nContent-Type: text/html; charset=UTF-8\r\n"
+        "Content-Length: 4211\r\n\r\n<html><head><title>Example</title>"
+        "<script type=\"text/javascript\" src=\"/js/jquery.min.js\"></script>"
+        "</head><body><div id=\"content\"><p>Lorem ipsum dolor sit amet</p>",
+        "MAIL FROM:<alice@example.org>\r\nRCPT TO:<bob@example.net>\r\nDATA\r\n"
+        "Subject: report\r\nMIME-Version: 1.0\r\n"
+        "Content-Type: multipart/mixed; boundary=\"xyz\"\r\n\r\n--xyz\r\n",
+        "\x12\x34\x01\x00\x00\x01\x00\x00\x00\x00\x00\x00\x03www\x07example\x03org\x00\x00\x01\x00\x01",
+        "POST /login.php HTTP/1.1\r\nHost: www.example.org\r\n"
+        "Content-Type: application/x-www-form-urlencoded\r\n"
+        "Content-Length: 29\r\n\r\nuser=admin&pass=secret&x=1",
+    };
+    uint32_t payload_cnt = sizeof(payloads) / sizeof(payloads[0]);
+
+    /* a tls client hello like binary payload */
+    for (u = 0; u < sizeof(tls); u++)
+        tls[u] = SCACTestRand(&seed) & 0xff;
+    tls[0] = 0x16; tls[1] = 0x03; tls[2] = 0x01;
+
+    for (i = 0; i < 16; i++) {
+        if (i % (payload_cnt + 1) == payload_cnt) {
+            batch[i].buf = tls;
+            batch[i].buflen = sizeof(tls);
+        } else {
+            batch[i].buf = (uint8_t *)payloads[i % (payload_cnt + 1)];
+            batch[i].buflen = strlen(payloads[i % (payload_cnt + 1)]);
+        }
+    }
+
+    for (c = 0; c < sizeof(pat_cnts) / sizeof(pat_cnts[0]); c++) {
+        for (compressed = 0; compressed < 2; compressed++) {
+            MpmCtx mpm_ctx;
+            MpmThreadCtx mpm_thread_ctx;
+            PatternMatcherQueue pmq[16];
+            uint32_t cnt_sep = 0, cnt_batch = 0;
+            uint32_t j;
+
+            memset(&mpm_ctx, 0, sizeof(MpmCtx));
+            memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+            MpmInitCtx(&mpm_ctx, MPM_AC, -1);
+            ((SCACCtx *)mpm_ctx.ctx)->compressed = compressed;
+
+            /* printable patterns, some of them taken from the payloads */
+            seed = 1;
+            for (i = 0; i < pat_cnts[c]; i++) {
+                uint16_t len = 4 + SCACTestRand(&seed) % 17;
+                char *src = payloads[SCACTestRand(&seed) % payload_cnt];
+                if (i % 50 == 0 && strlen(src) > len) {
+                    memcpy(pat, src + SCACTestRand(&seed) % (strlen(src) - len), len);
+                } else {
+                    for (u = 0; u < len; u++)
+                        pat[u] = 0x20 + SCACTestRand(&seed) % 0x5f;
+                }
+                SCACAddPatternCI(&mpm_ctx, pat, len, 0, 0, i, 0, 0);
+            }
+            SCACPreparePatterns(&mpm_ctx);
+            SCACInitThreadCtx(&mpm_ctx, &mpm_thread_ctx, 0);
+            for (i = 0; i < 16; i++) {
+                PmqSetup(&pmq[i], 0, pat_cnts[c]);
+                batch[i].pmq = &pmq[i];
+            }
+
+            printf("AC %s, %" PRIu32 " patterns, separate searches: ",
+                   compressed ? "compressed" : "full", pat_cnts[c]);
+            CLOCK_INIT;
+            CLOCK_START;
+            for (j = 0; j < AC_STATS_TIMES / 100; j++) {
+                cnt_sep = 0;
+                for (i = 0; i < 16; i++) {
+                    cnt_sep += SCACSearch(&mpm_ctx, &mpm_thread_ctx, &pmq[i],
+                                          batch[i].buf, batch[i].buflen);
+                    PmqReset(&pmq[i]);
+                }
+            }
+            CLOCK_END;
+            printf("%" PRIu32 " matches, ", cnt_sep);
+            CLOCK_PRINT_SEC;
+
+            printf("AC %s, %" PRIu32 " patterns, batch search: ",
+                   compressed ? "compressed" : "full", pat_cnts[c]);
+            CLOCK_START;
+            for (j = 0; j < AC_STATS_TIMES / 100; j++) {
+                cnt_batch = SCACSearchBatch(&mpm_ctx, &mpm_thread_ctx, batch, 16);
+                for (i = 0; i < 16; i++)
+                    PmqReset(&pmq[i]);
+            }
+            CLOCK_END;
+            printf("%" PRIu32 " matches, ", cnt_batch);
+            CLOCK_PRINT_SEC;
+
+            for (i = 0; i < 16; i++)
+                PmqFree(&pmq[i]);
+            SCACDestroyCtx(&mpm_ctx);
+            SCACDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+
+            if (cnt_sep != cnt_batch)
+                return 0;
+        }
+    }
+
+    return 1;
 }
 
+#endif /* ENABLE_AC_SEARCH_STATS */
+
 #endif /* UNITTESTS */
 
 void SCACRegisterTests(void)
@@ -2275,6 +4815,24 @@ void SCACRegisterTests(void)
     UtRegisterTest("SCACTest26", SCACTest26, 1);
     UtRegisterTest("SCACTest27", SCACTest27, 1);
     UtRegisterTest("SCACTest28", SCACTest28, 1);
+    UtRegisterTest("SCACTest29", SCACTest29, 1);
+    UtRegisterTest("SCACTest30", SCACTest30, 1);
+    UtRegisterTest("SCACTest31", SCACTest31, 1);
+    UtRegisterTest("SCACTest32", SCACTest32, 1);
+    UtRegisterTest("SCACTest33", SCACTest33, 1);
+    UtRegisterTest("SCACTest34", SCACTest34, 1);
+    UtRegisterTest("SCACTest35", SCACTest35, 1);
+    UtRegisterTest("SCACTest36", SCACTest36, 1);
+#ifdef HAVE_SYS_MMAN_H
+    UtRegisterTest("SCACTest37", SCACTest37, 1);
+    UtRegisterTest("SCACTest38", SCACTest38, 1);
+    UtRegisterTest("SCACTest39", SCACTest39, 1);
+#endif
+#ifdef ENABLE_AC_SEARCH_STATS
+    UtRegisterTest("SCACSearchStatsTest01", SCACSearchStatsTest01, 1);
+    UtRegisterTest("SCACSearchStatsTest02", SCACSearchStatsTest02, 1);
+    UtRegisterTest("SCACSearchStatsTest03", SCACSearchStatsTest03, 1);
+#endif
 #endif
 
     return;
@@ -55,6 +55,16 @@ typedef struct SCACOutputTable_ {
     uint32_t no_of_entries;
 } SCACOutputTable;
 
+/* sparse row of a state in the compressed state table.  The row is
+ * row_class/row_next[start] up to [start + cnt] and only holds the
+ * classes, in ascending order, for which the transition differs from the
+ * one in dense row anchor */
+typedef struct SCACRow_ {
+    uint32_t start;
+    uint8_t cnt;
+    uint8_t anchor;
+} SCACRow;
+
 typedef struct SCACCtx_ {
     /* hash used during ctx initialization */
     SCACPattern **init_hash;
@@ -79,6 +89,32 @@ typedef struct SCACCtx_ {
     /* the size of each state */
     uint16_t single_state_size;
     uint16_t max_pat_id;
+
+    /* use the compressed state table below instead of state_table_u16/u32 */
+    uint8_t compressed;
+    /* number of byte classes.  Class 0 holds all bytes that are not in any
+     * pattern */
+    uint16_t class_cnt;
+    /* byte (not yet lowercased) to byte class */
+    uint8_t class_map[256];
+    /* dense rows, indexed by class, of the root (row 0) and of the states
+     * directly below it */
+    SC_AC_STATE_TYPE_U16 *dense_u16;
+    SC_AC_STATE_TYPE_U32 *dense_u32;
+    uint16_t dense_cnt;
+    /* sparse rows of the other states, see SCACRow */
+    SCACRow *rows;
+    uint8_t *row_class;
+    SC_AC_STATE_TYPE_U16 *row_next_u16;
+    SC_AC_STATE_TYPE_U32 *row_next_u32;
+    uint32_t row_entries;
+
+    /* directory of the state table cache, NULL if disabled */
+    const char *cache_dir;
+    /* read only mapping of the cache file the state, row and output tables
+     * point into, NULL if the tables were built on the heap */
+    void *cache_map;
+    size_t cache_map_size;
 } SCACCtx;
 
 typedef struct SCACThreadCtx_ {
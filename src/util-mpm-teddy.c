@@ -0,0 +1,1322 @@
+/* Copyright (C) 2007-2010 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Teddy multi pattern matcher.
+ *
+ *  - The patterns are spread over SC_TEDDY_BUCKETS buckets. Patterns with
+ *    similar leading bytes go into the same bucket.
+ *  - The first fp_len (up to SC_TEDDY_MAX_FP, at most the shortest pattern
+ *    length) bytes of each pattern are its fingerprint. For every
+ *    fingerprint position there are two 16 byte tables, indexed by the low
+ *    and the high nibble of a byte, holding the buckets that have a pattern
+ *    with that nibble at that position.
+ *  - With SSSE3 the tables are looked up for 16 buffer positions at once
+ *    using PSHUFB. AND-ing the lookups of all fingerprint positions gives,
+ *    per buffer position, the buckets that may have a pattern starting
+ *    there. Only at those positions the patterns starting with the same
+ *    leading bytes, found through a small hash, are compared against the
+ *    buffer.
+ *  - Without SSSE3, and for the last bytes of the buffer, the same tables
+ *    are looked up one position at a time. SCTeddySetup picks the SSSE3
+ *    block loop if the cpu supports it.
+ *
+ * The nibble tables are a superset filter, every candidate is verified, so
+ * the results are the same as those of the other matchers. Teddy beats
+ * ac for up to about a hundred patterns. With more the nibble tables fill
+ * up, most positions become candidates and ac is the better choice.
+ */
+
+#include "suricata-common.h"
+#include "suricata.h"
+
+#include "detect.h"
+#include "util-mpm-teddy.h"
+
+#include "util-debug.h"
+#include "util-unittest.h"
+#include "util-memcmp.h"
+#include "util-clock.h"
+#include "util-cpu.h"
+
+#if defined(SC_CPU_DISPATCH) || defined(__SSSE3__)
+#include <tmmintrin.h>
+#endif
+
+void SCTeddyInitCtx(MpmCtx *, int);
+void SCTeddyInitThreadCtx(MpmCtx *, MpmThreadCtx *, uint32_t);
+void SCTeddyDestroyCtx(MpmCtx *);
+void SCTeddyDestroyThreadCtx(MpmCtx *, MpmThreadCtx *);
+int SCTeddyAddPatternCI(MpmCtx *, uint8_t *, uint16_t, uint16_t, uint16_t,
+                        uint32_t, uint32_t, uint8_t);
+int SCTeddyAddPatternCS(MpmCtx *, uint8_t *, uint16_t, uint16_t, uint16_t,
+                        uint32_t, uint32_t, uint8_t);
+int SCTeddyPreparePatterns(MpmCtx *mpm_ctx);
+uint32_t SCTeddySearch(MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
+                       PatternMatcherQueue *pmq, uint8_t *buf, uint16_t buflen);
+void SCTeddyPrintInfo(MpmCtx *mpm_ctx);
+void SCTeddyPrintSearchStats(MpmThreadCtx *mpm_thread_ctx);
+void SCTeddyRegisterTests(void);
+
+/* size of the hash table used to cull duplicate patterns on insertion */
+#define SC_TEDDY_INIT_HASH_SIZE 4096
+/* size of the hash on the leading pattern bytes used to verify candidates,
+ * must be a power of 2 */
+#define SC_TEDDY_VERIFY_HASH_SIZE 4096
+
+/**
+ * \brief Register the teddy mpm.
+ */
+void MpmTeddyRegister(void)
+{
+    mpm_table[MPM_TEDDY].name = "teddy";
+    mpm_table[MPM_TEDDY].max_pattern_length = 0;
+
+    mpm_table[MPM_TEDDY].InitCtx = SCTeddyInitCtx;
+    mpm_table[MPM_TEDDY].InitThreadCtx = SCTeddyInitThreadCtx;
+    mpm_table[MPM_TEDDY].DestroyCtx = SCTeddyDestroyCtx;
+    mpm_table[MPM_TEDDY].DestroyThreadCtx = SCTeddyDestroyThreadCtx;
+    mpm_table[MPM_TEDDY].AddPattern = SCTeddyAddPatternCS;
+    mpm_table[MPM_TEDDY].AddPatternNocase = SCTeddyAddPatternCI;
+    mpm_table[MPM_TEDDY].Prepare = SCTeddyPreparePatterns;
+    mpm_table[MPM_TEDDY].Search = SCTeddySearch;
+    mpm_table[MPM_TEDDY].SearchSegments = NULL;
+    mpm_table[MPM_TEDDY].SearchResume = NULL;
+    mpm_table[MPM_TEDDY].SearchBatch = NULL;
+    mpm_table[MPM_TEDDY].Cleanup = NULL;
+    mpm_table[MPM_TEDDY].PrintCtx = SCTeddyPrintInfo;
+    mpm_table[MPM_TEDDY].PrintThreadCtx = SCTeddyPrintSearchStats;
+    mpm_table[MPM_TEDDY].RegisterUnittests = SCTeddyRegisterTests;
+    mpm_table[MPM_TEDDY].flags = MPM_TABLE_FLAG_PREPARE_MT;
+
+    return;
+}
+
+static inline uint32_t SCTeddyInitHash(uint32_t pid)
+{
+    return (pid % SC_TEDDY_INIT_HASH_SIZE);
+}
+
+static inline uint32_t SCTeddyVerifyHash(uint8_t c0, uint8_t c1)
+{
+    return (((uint32_t)c0 << 4) ^ c1) & (SC_TEDDY_VERIFY_HASH_SIZE - 1);
+}
+
+/**
+ * \internal
+ * \brief Used to free SCTeddyPattern instances.
+ *
+ * \param mpm_ctx Pointer to the mpm context.
+ * \param p       Pointer to the SCTeddyPattern instance to be freed.
+ */
+static void SCTeddyFreePattern(MpmCtx *mpm_ctx, SCTeddyPattern *p)
+{
+    if (p == NULL)
+        return;
+
+    if (p->pat != NULL) {
+        SCFree(p->pat);
+        mpm_ctx->memory_cnt--;
+        mpm_ctx->memory_size -= p->len;
+    }
+
+    SCFree(p);
+    mpm_ctx->memory_cnt--;
+    mpm_ctx->memory_size -= sizeof(SCTeddyPattern);
+}
+
+/**
+ * \internal
+ * \brief Add a pattern to the mpm-teddy context.
+ *
+ * \param mpm_ctx Mpm context.
+ * \param pat     Pointer to the pattern.
+ * \param patlen  Length of the pattern.
+ * \param offset  Pattern offset, used with MPM_PATTERN_FLAG_OFFSET.
+ * \param depth   Pattern depth, used with MPM_PATTERN_FLAG_DEPTH.
+ * \param pid     Pattern id
+ * \param sid     Signature id (internal id).
+ * \param flags   Pattern's MPM_PATTERN_* flags.
+ *
+ * \retval  0 On success.
+ * \retval -1 On failure.
+ */
+static int SCTeddyAddPattern(MpmCtx *mpm_ctx, uint8_t *pat, uint16_t patlen,
+                             uint16_t offset, uint16_t depth, uint32_t pid,
+                             uint32_t sid, uint8_t flags)
+{
+    SCTeddyCtx *ctx = (SCTeddyCtx *)mpm_ctx->ctx;
+    uint16_t u;
+
+    SCLogDebug("Adding pattern for ctx %p, patlen %"PRIu16" and pid %" PRIu32,
+               ctx, patlen, pid);
+
+    if (patlen == 0) {
+        SCLogWarning(SC_ERR_INVALID_ARGUMENTS, "pattern length 0");
+        return 0;
+    }
+
+    if (ctx->init_hash == NULL) {
+        SCLogError(SC_ERR_INVALID_ARGUMENTS, "pattern added after the teddy "
+                   "ctx was prepared");
+        return -1;
+    }
+
+    /* check if we have already inserted this pattern */
+    uint32_t hash = SCTeddyInitHash(pid);
+    SCTeddyPattern *p = ctx->init_hash[hash];
+    for ( ; p != NULL; p = p->next) {
+        if (p->flags == flags && p->id == pid)
+            return 0;
+    }
+
+    p = SCMalloc(sizeof(SCTeddyPattern));
+    if (p == NULL)
+        return -1;
+    memset(p, 0, sizeof(SCTeddyPattern));
+    mpm_ctx->memory_cnt++;
+    mpm_ctx->memory_size += sizeof(SCTeddyPattern);
+
+    p->len = patlen;
+    p->flags = flags;
+    p->offset = offset;
+    p->depth = depth;
+    p->id = pid;
+
+    p->pat = SCMalloc(patlen);
+    if (p->pat == NULL) {
+        SCTeddyFreePattern(mpm_ctx, p);
+        return -1;
+    }
+    mpm_ctx->memory_cnt++;
+    mpm_ctx->memory_size += patlen;
+
+    if (flags & MPM_PATTERN_FLAG_NOCASE) {
+        for (u = 0; u < patlen; u++)
+            p->pat[u] = u8_tolower(pat[u]);
+    } else {
+        memcpy(p->pat, pat, patlen);
+    }
+
+    p->next = ctx->init_hash[hash];
+    ctx->init_hash[hash] = p;
+
+    mpm_ctx->pattern_cnt++;
+
+    if (mpm_ctx->maxlen < patlen)
+        mpm_ctx->maxlen = patlen;
+
+    if (mpm_ctx->minlen == 0 || mpm_ctx->minlen > patlen)
+        mpm_ctx->minlen = patlen;
+
+    return 0;
+}
+
+/**
+ * \internal
+ * \brief Order patterns by their leading bytes, so that patterns that look
+ *        alike end up in the same bucket.
+ */
+static int SCTeddyPatternCompare(const void *a, const void *b)
+{
+    const SCTeddyPattern *pa = *(SCTeddyPattern * const *)a;
+    const SCTeddyPattern *pb = *(SCTeddyPattern * const *)b;
+    uint16_t len = (pa->len < pb->len) ? pa->len : pb->len;
+    uint16_t u;
+
+    if (len > SC_TEDDY_MAX_FP)
+        len = SC_TEDDY_MAX_FP;
+
+    for (u = 0; u < len; u++) {
+        uint8_t ca = u8_tolower(pa->pat[u]);
+        uint8_t cb = u8_tolower(pb->pat[u]);
+        if (ca != cb)
+            return (ca < cb) ? -1 : 1;
+    }
+
+    if (pa->len != pb->len)
+        return (pa->len < pb->len) ? -1 : 1;
+    if (pa->id != pb->id)
+        return (pa->id < pb->id) ? -1 : 1;
+    return 0;
+}
+
+/**
+ * \internal
+ * \brief Add byte c at fingerprint position k of a pattern in bucket b to
+ *        the nibble masks.
+ */
+static inline void SCTeddyMaskAdd(SCTeddyCtx *ctx, uint16_t k, uint8_t c,
+                                  uint32_t b)
+{
+    ctx->lo_mask[k][c & 0x0f] |= (1 << b);
+    ctx->hi_mask[k][c >> 4] |= (1 << b);
+}
+
+/**
+ * \brief Process the patterns added to the mpm, and create the buckets and
+ *        nibble masks.
+ *
+ * \param mpm_ctx Pointer to the mpm context.
+ *
+ * \retval  0 On success.
+ * \retval -1 On failure.
+ */
+int SCTeddyPreparePatterns(MpmCtx *mpm_ctx)
+{
+    SCTeddyCtx *ctx = (SCTeddyCtx *)mpm_ctx->ctx;
+    uint32_t i, u = 0;
+    uint32_t b;
+    uint16_t k;
+
+    if (ctx->init_hash == NULL)
+        return 0;
+
+    if (mpm_ctx->pattern_cnt > 0) {
+        ctx->parray = SCMalloc(mpm_ctx->pattern_cnt * sizeof(SCTeddyPattern *));
+        if (ctx->parray == NULL)
+            goto error;
+        mpm_ctx->memory_cnt++;
+        mpm_ctx->memory_size += (mpm_ctx->pattern_cnt * sizeof(SCTeddyPattern *));
+
+        for (i = 0; i < SC_TEDDY_INIT_HASH_SIZE; i++) {
+            SCTeddyPattern *p = ctx->init_hash[i];
+            while (p != NULL) {
+                SCTeddyPattern *next = p->next;
+                p->next = NULL;
+                ctx->parray[u++] = p;
+                p = next;
+            }
+        }
+
+        qsort(ctx->parray, mpm_ctx->pattern_cnt, sizeof(SCTeddyPattern *),
+              SCTeddyPatternCompare);
+    }
+
+    /* we don't need the hash anymore */
+    SCFree(ctx->init_hash);
+    ctx->init_hash = NULL;
+    mpm_ctx->memory_cnt--;
+    mpm_ctx->memory_size -= (SC_TEDDY_INIT_HASH_SIZE * sizeof(SCTeddyPattern *));
+
+    ctx->fp_len = mpm_ctx->minlen;
+    if (ctx->fp_len > SC_TEDDY_MAX_FP)
+        ctx->fp_len = SC_TEDDY_MAX_FP;
+
+    /* split the ordered patterns in SC_TEDDY_BUCKETS equal parts */
+    for (b = 0; b <= SC_TEDDY_BUCKETS; b++) {
+        ctx->bucket_start[b] = (b * mpm_ctx->pattern_cnt) / SC_TEDDY_BUCKETS;
+    }
+
+    memset(ctx->lo_mask, 0, sizeof(ctx->lo_mask));
+    memset(ctx->hi_mask, 0, sizeof(ctx->hi_mask));
+
+    for (b = 0; b < SC_TEDDY_BUCKETS; b++) {
+        for (u = ctx->bucket_start[b]; u < ctx->bucket_start[b + 1]; u++) {
+            SCTeddyPattern *p = ctx->parray[u];
+
+            for (k = 0; k < ctx->fp_len; k++) {
+                SCTeddyMaskAdd(ctx, k, p->pat[k], b);
+                /* nocase patterns are stored lowercase, the buffer may
+                 * have either case */
+                if (p->flags & MPM_PATTERN_FLAG_NOCASE)
+                    SCTeddyMaskAdd(ctx, k, toupper(p->pat[k]), b);
+            }
+        }
+    }
+
+    /* the nibble masks only tell there may be a pattern at a position,
+     * the verify hash gives the patterns that start with those bytes */
+    ctx->verify_hash = SCMalloc(SC_TEDDY_VERIFY_HASH_SIZE * sizeof(SCTeddyPattern *));
+    if (ctx->verify_hash == NULL)
+        goto error;
+    memset(ctx->verify_hash, 0, SC_TEDDY_VERIFY_HASH_SIZE * sizeof(SCTeddyPattern *));
+    mpm_ctx->memory_cnt++;
+    mpm_ctx->memory_size += (SC_TEDDY_VERIFY_HASH_SIZE * sizeof(SCTeddyPattern *));
+
+    /* insert in reverse, so the chains keep the bucket order */
+    for (u = mpm_ctx->pattern_cnt; u > 0; u--) {
+        SCTeddyPattern *p = ctx->parray[u - 1];
+        uint8_t c0 = u8_tolower(p->pat[0]);
+        uint8_t c1 = (ctx->fp_len > 1) ? u8_tolower(p->pat[1]) : 0;
+        uint32_t hash = SCTeddyVerifyHash(c0, c1);
+
+        p->next = ctx->verify_hash[hash];
+        ctx->verify_hash[hash] = p;
+    }
+
+    return 0;
+
+error:
+    return -1;
+}
+
+/**
+ * \brief Initialize the teddy thread context.
+ *
+ * \param mpm_ctx        Pointer to the mpm context.
+ * \param mpm_thread_ctx Pointer to the mpm thread context.
+ * \param matchsize      We don't need this.
+ */
+void SCTeddyInitThreadCtx(MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx, uint32_t matchsize)
+{
+    memset(mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+
+    mpm_thread_ctx->ctx = SCMalloc(sizeof(SCTeddyThreadCtx));
+    if (mpm_thread_ctx->ctx == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    memset(mpm_thread_ctx->ctx, 0, sizeof(SCTeddyThreadCtx));
+    mpm_thread_ctx->memory_cnt++;
+    mpm_thread_ctx->memory_size += sizeof(SCTeddyThreadCtx);
+
+    return;
+}
+
+/**
+ * \brief Initialize the teddy context.
+ *
+ * \param mpm_ctx       Mpm context.
+ * \param module_handle Cuda module handle from the cuda handler API.  We don't
+ *                      have to worry about this here.
+ */
+void SCTeddyInitCtx(MpmCtx *mpm_ctx, int module_handle)
+{
+    if (mpm_ctx->ctx != NULL)
+        return;
+
+    mpm_ctx->ctx = SCMalloc(sizeof(SCTeddyCtx));
+    if (mpm_ctx->ctx == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    memset(mpm_ctx->ctx, 0, sizeof(SCTeddyCtx));
+
+    mpm_ctx->memory_cnt++;
+    mpm_ctx->memory_size += sizeof(SCTeddyCtx);
+
+    /* initialize the hash we use to cull duplicate patterns */
+    SCTeddyCtx *ctx = (SCTeddyCtx *)mpm_ctx->ctx;
+    ctx->init_hash = SCMalloc(sizeof(SCTeddyPattern *) * SC_TEDDY_INIT_HASH_SIZE);
+    if (ctx->init_hash == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    memset(ctx->init_hash, 0, sizeof(SCTeddyPattern *) * SC_TEDDY_INIT_HASH_SIZE);
+    mpm_ctx->memory_cnt++;
+    mpm_ctx->memory_size += (SC_TEDDY_INIT_HASH_SIZE * sizeof(SCTeddyPattern *));
+
+    SCReturn;
+}
+
+/**
+ * \brief Destroy the mpm thread context.
+ *
+ * \param mpm_ctx        Pointer to the mpm context.
+ * \param mpm_thread_ctx Pointer to the mpm thread context.
+ */
+void SCTeddyDestroyThreadCtx(MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx)
+{
+    SCTeddyPrintSearchStats(mpm_thread_ctx);
+
+    if (mpm_thread_ctx->ctx != NULL) {
+        SCFree(mpm_thread_ctx->ctx);
+        mpm_thread_ctx->ctx = NULL;
+        mpm_thread_ctx->memory_cnt--;
+        mpm_thread_ctx->memory_size -= sizeof(SCTeddyThreadCtx);
+    }
+
+    return;
+}
+
+/**
+ * \brief Destroy the mpm context.
+ *
+ * \param mpm_ctx Pointer to the mpm context.
+ */
+void SCTeddyDestroyCtx(MpmCtx *mpm_ctx)
+{
+    SCTeddyCtx *ctx = (SCTeddyCtx *)mpm_ctx->ctx;
+    uint32_t i;
+
+    if (ctx == NULL)
+        return;
+
+    if (ctx->init_hash != NULL) {
+        for (i = 0; i < SC_TEDDY_INIT_HASH_SIZE; i++) {
+            SCTeddyPattern *p = ctx->init_hash[i];
+            while (p != NULL) {
+                SCTeddyPattern *next = p->next;
+                SCTeddyFreePattern(mpm_ctx, p);
+                p = next;
+            }
+        }
+
+        SCFree(ctx->init_hash);
+        ctx->init_hash = NULL;
+        mpm_ctx->memory_cnt--;
+        mpm_ctx->memory_size -= (SC_TEDDY_INIT_HASH_SIZE * sizeof(SCTeddyPattern *));
+    }
+
+    if (ctx->verify_hash != NULL) {
+        SCFree(ctx->verify_hash);
+        ctx->verify_hash = NULL;
+        mpm_ctx->memory_cnt--;
+        mpm_ctx->memory_size -= (SC_TEDDY_VERIFY_HASH_SIZE * sizeof(SCTeddyPattern *));
+    }
+
+    if (ctx->parray != NULL) {
+        for (i = 0; i < mpm_ctx->pattern_cnt; i++) {
+            SCTeddyFreePattern(mpm_ctx, ctx->parray[i]);
+        }
+
+        SCFree(ctx->parray);
+        ctx->parray = NULL;
+        mpm_ctx->memory_cnt--;
+        mpm_ctx->memory_size -= (mpm_ctx->pattern_cnt * sizeof(SCTeddyPattern *));
+    }
+
+    SCFree(mpm_ctx->ctx);
+    mpm_ctx->ctx = NULL;
+    mpm_ctx->memory_cnt--;
+    mpm_ctx->memory_size -= sizeof(SCTeddyCtx);
+
+    return;
+}
+
+/**
+ * \internal
+ * \brief Compare the patterns starting with the same (lowercased) leading
+ *        bytes as the buffer at position i against the buffer.
+ *
+ * \retval matches Match count.
+ */
+static inline uint32_t SCTeddyVerify(const SCTeddyCtx *ctx,
+        MpmThreadCtx *mpm_thread_ctx, PatternMatcherQueue *pmq,
+        uint8_t *buf, uint16_t buflen, uint32_t i)
+{
+    uint32_t matches = 0;
+    uint8_t c0 = u8_tolower(buf[i]);
+    uint8_t c1 = (ctx->fp_len > 1) ? u8_tolower(buf[i + 1]) : 0;
+    SCTeddyPattern *p = ctx->verify_hash[SCTeddyVerifyHash(c0, c1)];
+
+    for ( ; p != NULL; p = p->next) {
+        if (p->len > buflen - i)
+            continue;
+
+        if (p->flags & MPM_PATTERN_FLAG_NOCASE) {
+            if (p->pat[0] != c0 ||
+                SCMemcmpLowercase(p->pat, buf + i, p->len) != 0)
+                continue;
+        } else {
+            if (p->pat[0] != buf[i] ||
+                SCMemcmp(p->pat, buf + i, p->len) != 0)
+                continue;
+        }
+
+        if ((p->flags & MPM_PATTERN_FLAG_OFFSET) && i < p->offset)
+            continue;
+        if ((p->flags & MPM_PATTERN_FLAG_DEPTH) && i + p->len > p->depth)
+            continue;
+
+        matches += MpmVerifyMatch(mpm_thread_ctx, pmq, p->id);
+    }
+
+    return matches;
+}
+
+#if defined(SC_CPU_DISPATCH) || defined(__SSSE3__)
+/**
+ * \internal
+ * \brief Look up the nibble tables for 16 positions at a time with PSHUFB,
+ *        for as many full blocks as the buffer has.
+ *
+ * \param next Set to the first position not searched yet.
+ *
+ * \retval matches Match count.
+ */
+static SC_CPU_TARGET("ssse3") uint32_t SCTeddySearchBlocksSSSE3(
+        const SCTeddyCtx *ctx, MpmThreadCtx *mpm_thread_ctx,
+        PatternMatcherQueue *pmq, uint8_t *buf, uint16_t buflen, uint32_t *next)
+{
+    const __m128i nibble = _mm_set1_epi8(0x0f);
+    const __m128i zero = _mm_setzero_si128();
+    __m128i lo[SC_TEDDY_MAX_FP];
+    __m128i hi[SC_TEDDY_MAX_FP];
+    uint32_t fp_len = ctx->fp_len;
+    uint32_t matches = 0;
+    uint32_t i = 0;
+    uint32_t k;
+
+    for (k = 0; k < fp_len; k++) {
+        lo[k] = _mm_load_si128((const __m128i *)ctx->lo_mask[k]);
+        hi[k] = _mm_load_si128((const __m128i *)ctx->hi_mask[k]);
+    }
+
+    /* the fingerprint at the last position of a block reaches fp_len - 1
+     * bytes past the block */
+    for ( ; i + 16 + fp_len - 1 <= buflen; i += 16) {
+        __m128i res = _mm_cmpeq_epi8(zero, zero);
+
+        for (k = 0; k < fp_len; k++) {
+            __m128i in = _mm_loadu_si128((const __m128i *)(buf + i + k));
+            __m128i in_lo = _mm_and_si128(in, nibble);
+            __m128i in_hi = _mm_and_si128(_mm_srli_epi16(in, 4), nibble);
+
+            res = _mm_and_si128(res, _mm_and_si128(_mm_shuffle_epi8(lo[k], in_lo),
+                                                   _mm_shuffle_epi8(hi[k], in_hi)));
+        }
+
+        uint32_t cand = ~_mm_movemask_epi8(_mm_cmpeq_epi8(res, zero)) & 0xffff;
+        if (cand == 0)
+            continue;
+
+        while (cand != 0) {
+            uint32_t j = __builtin_ctz(cand);
+            cand &= (cand - 1);
+
+            matches += SCTeddyVerify(ctx, mpm_thread_ctx, pmq, buf, buflen,
+                                     i + j);
+        }
+    }
+
+    *next = i;
+    return matches;
+}
+#endif /* SSSE3 */
+
+/** the block loop bound by SCTeddySetup, NULL to search a position at
+ *  a time */
+static uint32_t (*SCTeddySearchBlocks)(const SCTeddyCtx *, MpmThreadCtx *,
+        PatternMatcherQueue *, uint8_t *, uint16_t, uint32_t *) = NULL;
+
+/**
+ * \brief Bind the block loop of the search for a SIMD level
+ *
+ * \param level max SIMD level to use, UTIL_CPU_SIMD_*
+ */
+void SCTeddySetup(int level)
+{
+    int used = UTIL_CPU_SIMD_NONE;
+
+    SCTeddySearchBlocks = NULL;
+#if defined(SC_CPU_DISPATCH) || defined(__SSSE3__)
+    if (level >= UTIL_CPU_SIMD_SSSE3) {
+        SCTeddySearchBlocks = SCTeddySearchBlocksSSSE3;
+        used = UTIL_CPU_SIMD_SSSE3;
+    }
+#endif
+
+    SCLogInfo("teddy mpm: using the %s variant", UtilCpuSimdLevelToString(used));
+}
+
+/**
+ * \brief The teddy search function.
+ *
+ * \param mpm_ctx        Pointer to the mpm context.
+ * \param mpm_thread_ctx Pointer to the mpm thread context.
+ * \param pmq            Pointer to the Pattern Matcher Queue to hold
+ *                       search matches.
+ * \param buf            Buffer to be searched.
+ * \param buflen         Buffer length.
+ *
+ * \retval matches Match count.
+ */
+uint32_t SCTeddySearch(MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
+                       PatternMatcherQueue *pmq, uint8_t *buf, uint16_t buflen)
+{
+    const SCTeddyCtx *ctx = (SCTeddyCtx *)mpm_ctx->ctx;
+    uint32_t fp_len = ctx->fp_len;
+    uint32_t matches = 0;
+    uint32_t i = 0;
+    uint32_t k;
+
+    if (mpm_ctx->pattern_cnt == 0 || buflen < mpm_ctx->minlen)
+        return 0;
+
+    if (SCTeddySearchBlocks != NULL) {
+        matches += SCTeddySearchBlocks(ctx, mpm_thread_ctx, pmq, buf, buflen, &i);
+    }
+
+    /* what is left (everything without SSSE3), one position at a time */
+    for ( ; i + fp_len <= buflen; i++) {
+        uint32_t buckets = 0xff;
+
+        for (k = 0; k < fp_len; k++) {
+            uint8_t c = buf[i + k];
+            buckets &= (ctx->lo_mask[k][c & 0x0f] & ctx->hi_mask[k][c >> 4]);
+        }
+
+        if (buckets != 0) {
+            matches += SCTeddyVerify(ctx, mpm_thread_ctx, pmq, buf, buflen, i);
+        }
+    }
+
+#ifdef SC_TEDDY_COUNTERS
+    SCTeddyThreadCtx *tctx = (SCTeddyThreadCtx *)mpm_thread_ctx->ctx;
+    tctx->total_calls++;
+    tctx->total_matches += matches;
+#endif /* SC_TEDDY_COUNTERS */
+
+    return matches;
+}
+
+/**
+ * \brief Add a case insensitive pattern.
+ *
+ * \param mpm_ctx Pointer to the mpm context.
+ * \param pat     The pattern to add.
+ * \param patnen  The pattern length.
+ * \param offset  Pattern offset, used with MPM_PATTERN_FLAG_OFFSET.
+ * \param depth   Pattern depth, used with MPM_PATTERN_FLAG_DEPTH.
+ * \param pid     The pattern id.
+ * \param sid     Ignored.
+ * \param flags   Flags associated with this pattern.
+ *
+ * \retval  0 On success.
+ * \retval -1 On failure.
+ */
+int SCTeddyAddPatternCI(MpmCtx *mpm_ctx, uint8_t *pat, uint16_t patlen,
+                        uint16_t offset, uint16_t depth, uint32_t pid,
+                        uint32_t sid, uint8_t flags)
+{
+    flags |= MPM_PATTERN_FLAG_NOCASE;
+    return SCTeddyAddPattern(mpm_ctx, pat, patlen, offset, depth, pid, sid, flags);
+}
+
+/**
+ * \brief Add a case sensitive pattern.
+ *
+ * \param mpm_ctx Pointer to the mpm context.
+ * \param pat     The pattern to add.
+ * \param patnen  The pattern length.
+ * \param offset  Pattern offset, used with MPM_PATTERN_FLAG_OFFSET.
+ * \param depth   Pattern depth, used with MPM_PATTERN_FLAG_DEPTH.
+ * \param pid     The pattern id.
+ * \param sid     Ignored.
+ * \param flags   Flags associated with this pattern.
+ *
+ * \retval  0 On success.
+ * \retval -1 On failure.
+ */
+int SCTeddyAddPatternCS(MpmCtx *mpm_ctx, uint8_t *pat, uint16_t patlen,
+                        uint16_t offset, uint16_t depth, uint32_t pid,
+                        uint32_t sid, uint8_t flags)
+{
+    return SCTeddyAddPattern(mpm_ctx, pat, patlen, offset, depth, pid, sid, flags);
+}
+
+void SCTeddyPrintSearchStats(MpmThreadCtx *mpm_thread_ctx)
+{
+
+#ifdef SC_TEDDY_COUNTERS
+    SCTeddyThreadCtx *ctx = (SCTeddyThreadCtx *)mpm_thread_ctx->ctx;
+    printf("Teddy Thread Search stats (ctx %p)\n", ctx);
+    printf("Total calls: %" PRIu32 "\n", ctx->total_calls);
+    printf("Total matches: %" PRIu64 "\n", ctx->total_matches);
+#endif /* SC_TEDDY_COUNTERS */
+
+    return;
+}
+
+void SCTeddyPrintInfo(MpmCtx *mpm_ctx)
+{
+    SCTeddyCtx *ctx = (SCTeddyCtx *)mpm_ctx->ctx;
+    uint32_t b;
+
+    printf("MPM Teddy Information:\n");
+    printf("Memory allocs:   %" PRIu32 "\n", mpm_ctx->memory_cnt);
+    printf("Memory alloced:  %" PRIu32 "\n", mpm_ctx->memory_size);
+    printf(" Sizeof:\n");
+    printf("  MpmCtx         %" PRIuMAX "\n", (uintmax_t)sizeof(MpmCtx));
+    printf("  SCTeddyCtx:      %" PRIuMAX "\n", (uintmax_t)sizeof(SCTeddyCtx));
+    printf("  SCTeddyPattern   %" PRIuMAX "\n", (uintmax_t)sizeof(SCTeddyPattern));
+    printf("Unique Patterns: %" PRIu32 "\n", mpm_ctx->pattern_cnt);
+    printf("Smallest:        %" PRIu32 "\n", mpm_ctx->minlen);
+    printf("Largest:         %" PRIu32 "\n", mpm_ctx->maxlen);
+    printf("Fingerprint:     %" PRIu32 " bytes\n", ctx->fp_len);
+    printf("Bucket sizes:   ");
+    for (b = 0; b < SC_TEDDY_BUCKETS; b++)
+        printf(" %" PRIu32, ctx->bucket_start[b + 1] - ctx->bucket_start[b]);
+    printf("\n\n");
+
+    return;
+}
+
+/*************************************Unittests********************************/
+
+#ifdef UNITTESTS
+
+static int SCTeddyTest01(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_TEDDY, -1);
+    SCTeddyInitThreadCtx(&mpm_ctx, &mpm_thread_ctx, 0);
+
+    /* 1 match */
+    SCTeddyAddPatternCS(&mpm_ctx, (uint8_t *)"abcd", 4, 0, 0, 0, 0, 0);
+
+    SCTeddyPreparePatterns(&mpm_ctx);
+
+    char *buf = "abcdefghjiklmnopqrstuvwxyz";
+    uint32_t cnt = SCTeddySearch(&mpm_ctx, &mpm_thread_ctx, NULL,
+                                 (uint8_t *)buf, strlen(buf));
+
+    if (cnt == 1)
+        result = 1;
+    else
+        printf("1 != %" PRIu32 " ",cnt);
+
+    SCTeddyDestroyCtx(&mpm_ctx);
+    SCTeddyDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    return result;
+}
+
+static int SCTeddyTest02(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_TEDDY, -1);
+    SCTeddyInitThreadCtx(&mpm_ctx, &mpm_thread_ctx, 0);
+
+    /* 0 match */
+    SCTeddyAddPatternCS(&mpm_ctx, (uint8_t *)"abce", 4, 0, 0, 0, 0, 0);
+
+    SCTeddyPreparePatterns(&mpm_ctx);
+
+    char *buf = "abcdefghjiklmnopqrstuvwxyz";
+    uint32_t cnt = SCTeddySearch(&mpm_ctx, &mpm_thread_ctx, NULL,
+                                 (uint8_t *)buf, strlen(buf));
+
+    if (cnt == 0)
+        result = 1;
+    else
+        printf("0 != %" PRIu32 " ",cnt);
+
+    SCTeddyDestroyCtx(&mpm_ctx);
+    SCTeddyDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    return result;
+}
+
+static int SCTeddyTest03(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_TEDDY, -1);
+    SCTeddyInitThreadCtx(&mpm_ctx, &mpm_thread_ctx, 0);
+
+    /* 3 matches */
+    SCTeddyAddPatternCS(&mpm_ctx, (uint8_t *)"abcd", 4, 0, 0, 0, 0, 0);
+    SCTeddyAddPatternCS(&mpm_ctx, (uint8_t *)"bcde", 4, 0, 0, 1, 0, 0);
+    SCTeddyAddPatternCS(&mpm_ctx, (uint8_t *)"fghj", 4, 0, 0, 2, 0, 0);
+
+    SCTeddyPreparePatterns(&mpm_ctx);
+
+    char *buf = "abcdefghjiklmnopqrstuvwxyz";
+    uint32_t cnt = SCTeddySearch(&mpm_ctx, &mpm_thread_ctx, NULL,
+                                 (uint8_t *)buf, strlen(buf));
+
+    if (cnt == 3)
+        result = 1;
+    else
+        printf("3 != %" PRIu32 " ",cnt);
+
+    SCTeddyDestroyCtx(&mpm_ctx);
+    SCTeddyDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    return result;
+}
+
+/** \test nocase patterns match either case, case sensitive ones don't */
+static int SCTeddyTest04(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_TEDDY, -1);
+    SCTeddyInitThreadCtx(&mpm_ctx, &mpm_thread_ctx, 0);
+
+    /* 2 matches */
+    SCTeddyAddPatternCI(&mpm_ctx, (uint8_t *)"ABCD", 4, 0, 0, 0, 0, 0);
+    SCTeddyAddPatternCI(&mpm_ctx, (uint8_t *)"fGhJ", 4, 0, 0, 1, 0, 0);
+    SCTeddyAddPatternCS(&mpm_ctx, (uint8_t *)"KLMN", 4, 0, 0, 2, 0, 0);
+
+    SCTeddyPreparePatterns(&mpm_ctx);
+
+    char *buf = "abcdeFGHJiklmnopqrstuvwxyz";
+    uint32_t cnt = SCTeddySearch(&mpm_ctx, &mpm_thread_ctx, NULL,
+                                 (uint8_t *)buf, strlen(buf));
+
+    if (cnt == 2)
+        result = 1;
+    else
+        printf("2 != %" PRIu32 " ",cnt);
+
+    SCTeddyDestroyCtx(&mpm_ctx);
+    SCTeddyDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    return result;
+}
+
+/** \test one byte patterns, every occurance counts */
+static int SCTeddyTest05(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_TEDDY, -1);
+    SCTeddyInitThreadCtx(&mpm_ctx, &mpm_thread_ctx, 0);
+
+    SCTeddyAddPatternCS(&mpm_ctx, (uint8_t *)"A", 1, 0, 0, 0, 0, 0);
+    SCTeddyAddPatternCS(&mpm_ctx, (uint8_t *)"AA", 2, 0, 0, 1, 0, 0);
+
+    SCTeddyPreparePatterns(&mpm_ctx);
+
+    /* 30 times "A", 29 times "AA" */
+    char *buf = "AAAAAAAAAAAAAAAAAAAAAAAAAAAAAA";
+    uint32_t cnt = SCTeddySearch(&mpm_ctx, &mpm_thread_ctx, NULL,
+                                 (uint8_t *)buf, strlen(buf));
+
+    if (cnt == 59)
+        result = 1;
+    else
+        printf("59 != %" PRIu32 " ",cnt);
+
+    SCTeddyDestroyCtx(&mpm_ctx);
+    SCTeddyDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    return result;
+}
+
+/** \test matches around the 16 byte block boundaries and at the end of
+ *        the buffer */
+static int SCTeddyTest06(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_TEDDY, -1);
+    SCTeddyInitThreadCtx(&mpm_ctx, &mpm_thread_ctx, 0);
+    PmqSetup(&pmq, 0, 4);
+
+    SCTeddyAddPatternCS(&mpm_ctx, (uint8_t *)"0123", 4, 0, 0, 0, 0, 0);
+    SCTeddyAddPatternCS(&mpm_ctx, (uint8_t *)"wxyz", 4, 0, 0, 1, 0, 0);
+    SCTeddyAddPatternCS(&mpm_ctx, (uint8_t *)"EFGH", 4, 0, 0, 2, 0, 0);
+    SCTeddyAddPatternCS(&mpm_ctx, (uint8_t *)"6789", 4, 0, 0, 3, 0, 0);
+
+    SCTeddyPreparePatterns(&mpm_ctx);
+
+    /* "0123" at 0, "EFGH" at 14 over the block boundary, "wxyz" at 32 and
+     * "6789" at the very end */
+    char *buf = "0123..........EFGH..............wxyz....6789";
+    uint32_t cnt = SCTeddySearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                                 (uint8_t *)buf, strlen(buf));
+
+    if (cnt != 4) {
+        printf("4 != %" PRIu32 " ",cnt);
+        goto end;
+    }
+    if (pmq.pattern_id_array_cnt != 4 || pmq.pattern_id_bitarray[0] != 0x0f) {
+        printf("pmq %" PRIu32 " ids, bits %02x: ", pmq.pattern_id_array_cnt,
+               pmq.pattern_id_bitarray[0]);
+        goto end;
+    }
+
+    result = 1;
+end:
+    PmqFree(&pmq);
+    SCTeddyDestroyCtx(&mpm_ctx);
+    SCTeddyDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    return result;
+}
+
+/** \test more patterns than buckets */
+static int SCTeddyTest07(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    char *pats[] = { "GET ", "POST ", "HEAD ", "Host: ", "User-Agent: ",
+                     "Cookie: ", "Accept: ", "Referer: ", ".php", ".asp",
+                     "cmd.exe", "/etc/passwd", "union select", "<script",
+                     "HTTP/1.1", "Content-Length: ", "admin", "passwd",
+                     "wget ", "%00", NULL };
+    uint32_t i;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_TEDDY, -1);
+    SCTeddyInitThreadCtx(&mpm_ctx, &mpm_thread_ctx, 0);
+
+    for (i = 0; pats[i] != NULL; i++) {
+        SCTeddyAddPatternCS(&mpm_ctx, (uint8_t *)pats[i], strlen(pats[i]),
+                            0, 0, i, 0, 0);
+    }
+
+    SCTeddyPreparePatterns(&mpm_ctx);
+
+    /* GET , .php, admin, HTTP/1.1, Host: , User-Agent:  */
+    char *buf = "GET /admin/index.php HTTP/1.1\r\nHost: www.example.org\r\n"
+                "User-Agent: Mozilla/5.0\r\n\r\n";
+    uint32_t cnt = SCTeddySearch(&mpm_ctx, &mpm_thread_ctx, NULL,
+                                 (uint8_t *)buf, strlen(buf));
+
+    if (cnt == 6)
+        result = 1;
+    else
+        printf("6 != %" PRIu32 " ",cnt);
+
+    SCTeddyDestroyCtx(&mpm_ctx);
+    SCTeddyDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    return result;
+}
+
+/** \test offset and depth */
+static int SCTeddyTest08(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_TEDDY, -1);
+    SCTeddyInitThreadCtx(&mpm_ctx, &mpm_thread_ctx, 0);
+
+    /* "abc" at 0 and 10, only the one at 0 is within depth 3 */
+    SCTeddyAddPatternCS(&mpm_ctx, (uint8_t *)"abc", 3, 0, 3, 0, 0,
+                        MPM_PATTERN_FLAG_DEPTH);
+    /* "xyz" at 4 and 14, only the one at 14 is past offset 5 */
+    SCTeddyAddPatternCS(&mpm_ctx, (uint8_t *)"xyz", 3, 5, 0, 1, 0,
+                        MPM_PATTERN_FLAG_OFFSET);
+
+    SCTeddyPreparePatterns(&mpm_ctx);
+
+    char *buf = "abc.xyz...abc.xyz...";
+    uint32_t cnt = SCTeddySearch(&mpm_ctx, &mpm_thread_ctx, NULL,
+                                 (uint8_t *)buf, strlen(buf));
+
+    if (cnt == 2)
+        result = 1;
+    else
+        printf("2 != %" PRIu32 " ",cnt);
+
+    SCTeddyDestroyCtx(&mpm_ctx);
+    SCTeddyDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    return result;
+}
+
+/** \test duplicate patterns are only added once, empty ctx and short
+ *        buffers don't match */
+static int SCTeddyTest09(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_TEDDY, -1);
+    SCTeddyInitThreadCtx(&mpm_ctx, &mpm_thread_ctx, 0);
+
+    SCTeddyPreparePatterns(&mpm_ctx);
+    if (SCTeddySearch(&mpm_ctx, &mpm_thread_ctx, NULL, (uint8_t *)"abcd", 4) != 0) {
+        printf("empty ctx matched: ");
+        goto end;
+    }
+    SCTeddyDestroyCtx(&mpm_ctx);
+
+    MpmInitCtx(&mpm_ctx, MPM_TEDDY, -1);
+    SCTeddyAddPatternCS(&mpm_ctx, (uint8_t *)"abcd", 4, 0, 0, 0, 0, 0);
+    SCTeddyAddPatternCS(&mpm_ctx, (uint8_t *)"abcd", 4, 0, 0, 0, 0, 0);
+    SCTeddyPreparePatterns(&mpm_ctx);
+
+    if (mpm_ctx.pattern_cnt != 1) {
+        printf("%" PRIu32 " patterns, expected 1: ", mpm_ctx.pattern_cnt);
+        goto end;
+    }
+    if (SCTeddySearch(&mpm_ctx, &mpm_thread_ctx, NULL, (uint8_t *)"abcdabcd", 8) != 2) {
+        printf("expected 2 matches: ");
+        goto end;
+    }
+    if (SCTeddySearch(&mpm_ctx, &mpm_thread_ctx, NULL, (uint8_t *)"abc", 3) != 0) {
+        printf("short buffer matched: ");
+        goto end;
+    }
+
+    result = 1;
+end:
+    SCTeddyDestroyCtx(&mpm_ctx);
+    SCTeddyDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    return result;
+}
+
+/** simple lcg, so the random tests are repeatable */
+static uint32_t SCTeddyTestRand(uint32_t *seed)
+{
+    *seed = (*seed * 1103515245 + 12345);
+    return ((*seed >> 16) & 0x7fff);
+}
+
+/** \test random pattern sets and buffers, from a small alphabet so there
+ *        are plenty of matches: the pmq must be the same as with ac, with
+ *        and without the SIMD block loop */
+static int SCTeddyTest10(void)
+{
+    int result = 0;
+    uint32_t seed = 1;
+    uint8_t pat[8];
+    uint8_t buf[1500];
+    int run;
+
+    for (run = 0; run < 50; run++) {
+        MpmCtx teddy_ctx, ac_ctx;
+        MpmThreadCtx teddy_tctx, ac_tctx;
+        PatternMatcherQueue teddy_pmq, ac_pmq;
+        uint32_t pat_cnt = 1 + SCTeddyTestRand(&seed) % 200;
+        uint32_t i, u;
+
+        /* every other run without the SIMD block loop */
+        SCTeddySetup((run & 1) ? UTIL_CPU_SIMD_NONE : UtilCpuSimdDetect());
+
+        memset(&teddy_ctx, 0, sizeof(MpmCtx));
+        memset(&ac_ctx, 0, sizeof(MpmCtx));
+        MpmInitCtx(&teddy_ctx, MPM_TEDDY, -1);
+        MpmInitCtx(&ac_ctx, MPM_AC, -1);
+        MpmInitThreadCtx(&teddy_tctx, MPM_TEDDY, 0);
+        MpmInitThreadCtx(&ac_tctx, MPM_AC, 0);
+        PmqSetup(&teddy_pmq, 0, pat_cnt);
+        PmqSetup(&ac_pmq, 0, pat_cnt);
+
+        for (i = 0; i < pat_cnt; i++) {
+            uint16_t len = 1 + SCTeddyTestRand(&seed) % sizeof(pat);
+            for (u = 0; u < len; u++)
+                pat[u] = "abcdABCD"[SCTeddyTestRand(&seed) % 8];
+
+            if (SCTeddyTestRand(&seed) & 1) {
+                mpm_table[MPM_TEDDY].AddPatternNocase(&teddy_ctx, pat, len, 0, 0, i, 0, 0);
+                mpm_table[MPM_AC].AddPatternNocase(&ac_ctx, pat, len, 0, 0, i, 0, 0);
+            } else {
+                mpm_table[MPM_TEDDY].AddPattern(&teddy_ctx, pat, len, 0, 0, i, 0, 0);
+                mpm_table[MPM_AC].AddPattern(&ac_ctx, pat, len, 0, 0, i, 0, 0);
+            }
+        }
+        mpm_table[MPM_TEDDY].Prepare(&teddy_ctx);
+        mpm_table[MPM_AC].Prepare(&ac_ctx);
+
+        uint16_t buflen = SCTeddyTestRand(&seed) % sizeof(buf);
+        for (u = 0; u < buflen; u++)
+            buf[u] = "abcdABCD."[SCTeddyTestRand(&seed) % 9];
+
+        uint32_t teddy_cnt = mpm_table[MPM_TEDDY].Search(&teddy_ctx, &teddy_tctx,
+                &teddy_pmq, buf, buflen);
+        uint32_t ac_cnt = mpm_table[MPM_AC].Search(&ac_ctx, &ac_tctx,
+                &ac_pmq, buf, buflen);
+
+        int ok = (teddy_cnt == ac_cnt &&
+                  teddy_pmq.pattern_id_array_cnt == ac_pmq.pattern_id_array_cnt &&
+                  memcmp(teddy_pmq.pattern_id_bitarray, ac_pmq.pattern_id_bitarray,
+                         ac_pmq.pattern_id_bitarray_size) == 0);
+        if (!ok) {
+            printf("run %d: teddy %" PRIu32 " matches %" PRIu32 " ids, ac %"
+                   PRIu32 " matches %" PRIu32 " ids: ", run, teddy_cnt,
+                   teddy_pmq.pattern_id_array_cnt, ac_cnt,
+                   ac_pmq.pattern_id_array_cnt);
+        }
+
+        PmqFree(&teddy_pmq);
+        PmqFree(&ac_pmq);
+        mpm_table[MPM_TEDDY].DestroyCtx(&teddy_ctx);
+        mpm_table[MPM_AC].DestroyCtx(&ac_ctx);
+        mpm_table[MPM_TEDDY].DestroyThreadCtx(&teddy_ctx, &teddy_tctx);
+        mpm_table[MPM_AC].DestroyThreadCtx(&ac_ctx, &ac_tctx);
+
+        if (!ok)
+            goto end;
+    }
+
+    result = 1;
+end:
+    SCTeddySetup(UtilCpuSimdLevel());
+    return result;
+}
+
+/** Uncomment this if you want stats
+ *  #define ENABLE_TEDDY_SEARCH_STATS 1
+ */
+
+#ifdef ENABLE_TEDDY_SEARCH_STATS
+
+/* Number of times to repeat the search (for stats) */
+#define TEDDY_STATS_TIMES 100000
+
+/* fast patterns as they are commonly found in http and shellcode rules */
+static char *teddy_stats_patterns[] = {
+    "/cgi-bin/", ".php?", ".asp", ".jsp", "cmd.exe", "/etc/passwd",
+    "union select", "UNION SELECT", "<script", "javascript:", "onload=",
+    "document.cookie", "eval(", "base64_decode", "../..", "%2e%2e",
+    "wget ", "curl ", "/bin/sh", "/tmp/", "chmod ", "xp_cmdshell",
+    "exec(", "system(", "passthru", "shell_exec", "phpinfo", "Nikto",
+    "sqlmap", "nessus", "Havij", "w3af", "DirBuster", "masscan",
+    "User-Agent|3a| Mozilla/4.0", "/admin/", "/wp-login.php", "/xmlrpc.php",
+    "/phpmyadmin/", "/manager/html", "/.git/", "/.svn/", "/.env",
+    "/server-status", "/solr/", "/jmx-console", "/invoker/", "/axis2/",
+    "MSIE 6.0", "Java/1.", "Python-urllib", "libwww-perl", "WinHttp",
+    "|90 90 90 90|", "|eb fe|", "|e8 ff ff ff ff|", "MZ", "PE|00 00|",
+    "This program cannot", ".exe", ".dll", ".scr", ".vbs", ".jar",
+    "Content-Disposition: attachment", "application/x-msdownload",
+    "boundary=", "multipart/form-data", "filename=", "X-Forwarded-For",
+    "Authorization: Basic", "Cookie: PHPSESSID", "Set-Cookie", "Location: http",
+    "iframe", "unescape(", "fromCharCode", "createElement", "appendChild",
+    "ActiveXObject", "WScript.Shell", "Scripting.FileSystemObject",
+    "powershell", "-enc ", "IEX(", "DownloadString", "Invoke-", "certutil",
+    "bitsadmin", "regsvr32", "rundll32", "mshta", "schtasks", "vssadmin",
+    "net user", "whoami", "ipconfig", "uname -a", "id;", "cat /etc",
+    "SELECT * FROM", "INSERT INTO", "DROP TABLE", "OR 1=1", "' or '1'='1",
+    "sleep(", "benchmark(", "waitfor delay", "load_file", "into outfile",
+    "${jndi:", "ldap://", "rmi://", "class.module", "Runtime.getRuntime",
+    "ProcessBuilder", "ObjectInputStream", "rO0AB", "aced0005",
+    "__VIEWSTATE", "/owa/", "/ecp/", "autodiscover", "/remote/login",
+    "/vpn/", "/dana-na/", "/cgi-bin/luci", "/HNAP1/", "/boaform/",
+    "/goform/", "/setup.cgi", "/shell?", "/tmUnblock.cgi", "/GponForm/",
+    NULL,
+};
+
+/* http request like data that doesn't contain most of the patterns */
+static void SCTeddyStatsBuffer(uint8_t *buf, uint16_t buflen)
+{
+    char *req = "GET /images/logo.png?v=20101018 HTTP/1.1\r\n"
+                "Host: www.example.org\r\n"
+                "User-Agent: Mozilla/5.0 (X11; U; Linux x86_64; en-US; rv:1.9.2.10) "
+                "Gecko/20100915 Ubuntu/10.04 (lucid) Firefox/3.6.10\r\n"
+                "Accept: image/png,image/*;q=0.8,*/*;q=0.5\r\n"
+                "Accept-Language: en-us,en;q=0.5\r\n"
+                "Accept-Encoding: gzip,deflate\r\n"
+                "Accept-Charset: ISO-8859-1,utf-8;q=0.7,*;q=0.7\r\n"
+                "Keep-Alive: 115\r\nConnection: keep-alive\r\n"
+                "Referer: http://www.example.org/index.html\r\n\r\n";
+    uint16_t reqlen = strlen(req);
+    uint16_t u;
+
+    for (u = 0; u < buflen; u++)
+        buf[u] = req[u % reqlen];
+}
+
+static void SCTeddyStatsRun(uint16_t matcher, uint32_t pat_cnt,
+                            uint8_t *buf, uint16_t buflen)
+{
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+    uint32_t cnt = 0;
+    uint32_t i;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    MpmInitCtx(&mpm_ctx, matcher, -1);
+    MpmInitThreadCtx(&mpm_thread_ctx, matcher, pat_cnt);
+    PmqSetup(&pmq, 0, pat_cnt);
+
+    for (i = 0; i < pat_cnt && teddy_stats_patterns[i] != NULL; i++) {
+        mpm_table[matcher].AddPatternNocase(&mpm_ctx, (uint8_t *)teddy_stats_patterns[i],
+                strlen(teddy_stats_patterns[i]), 0, 0, i, 0, 0);
+    }
+    mpm_table[matcher].Prepare(&mpm_ctx);
+
+    printf("%-6s %3" PRIu32 " patterns, %" PRIu16 " bytes: ",
+           mpm_table[matcher].name, mpm_ctx.pattern_cnt, buflen);
+    CLOCK_INIT;
+    CLOCK_START;
+    for (i = 0; i < TEDDY_STATS_TIMES; i++) {
+        cnt = mpm_table[matcher].Search(&mpm_ctx, &mpm_thread_ctx, &pmq, buf, buflen);
+        PmqReset(&pmq);
+    }
+    CLOCK_END;
+    printf("%" PRIu32 " matches, ", cnt);
+    CLOCK_PRINT_SEC;
+
+    PmqFree(&pmq);
+    mpm_table[matcher].DestroyCtx(&mpm_ctx);
+    mpm_table[matcher].DestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+}
+
+/**
+ * \test Stats: teddy versus ac and b2g for 10 up to 150 rule like
+ *       patterns on a 1500 byte http request like buffer.
+ */
+static int SCTeddySearchStatsTest01(void)
+{
+    uint16_t matchers[] = { MPM_TEDDY, MPM_AC, MPM_B2G };
+    uint32_t pat_cnts[] = { 10, 50, 150 };
+    uint8_t buf[1500];
+    uint32_t m, c;
+
+    SCTeddyStatsBuffer(buf, sizeof(buf));
+
+    for (c = 0; c < sizeof(pat_cnts) / sizeof(pat_cnts[0]); c++) {
+        for (m = 0; m < sizeof(matchers) / sizeof(matchers[0]); m++) {
+            SCTeddyStatsRun(matchers[m], pat_cnts[c], buf, sizeof(buf));
+        }
+    }
+
+    return 1;
+}
+
+#endif /* ENABLE_TEDDY_SEARCH_STATS */
+
+#endif /* UNITTESTS */
+
+void SCTeddyRegisterTests(void)
+{
+
+#ifdef UNITTESTS
+    UtRegisterTest("SCTeddyTest01", SCTeddyTest01, 1);
+    UtRegisterTest("SCTeddyTest02", SCTeddyTest02, 1);
+    UtRegisterTest("SCTeddyTest03", SCTeddyTest03, 1);
+    UtRegisterTest("SCTeddyTest04", SCTeddyTest04, 1);
+    UtRegisterTest("SCTeddyTest05", SCTeddyTest05, 1);
+    UtRegisterTest("SCTeddyTest06", SCTeddyTest06, 1);
+    UtRegisterTest("SCTeddyTest07", SCTeddyTest07, 1);
+    UtRegisterTest("SCTeddyTest08", SCTeddyTest08, 1);
+    UtRegisterTest("SCTeddyTest09", SCTeddyTest09, 1);
+    UtRegisterTest("SCTeddyTest10", SCTeddyTest10, 1);
+#ifdef ENABLE_TEDDY_SEARCH_STATS
+    UtRegisterTest("SCTeddySearchStatsTest01", SCTeddySearchStatsTest01, 1);
+#endif
+#endif
+
+    return;
+}
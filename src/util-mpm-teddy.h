@@ -0,0 +1,82 @@
+/* Copyright (C) 2007-2010 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Teddy, a SIMD nibble mask multi pattern matcher for small and medium
+ * sized pattern sets.
+ */
+
+#ifndef __UTIL_MPM_TEDDY_H__
+#define __UTIL_MPM_TEDDY_H__
+
+/** number of buckets the patterns are spread over, one bit each in the
+ *  nibble masks */
+#define SC_TEDDY_BUCKETS    8
+/** max number of leading pattern bytes used as fingerprint */
+#define SC_TEDDY_MAX_FP     3
+
+typedef struct SCTeddyPattern_ {
+    /* length of the pattern */
+    uint16_t len;
+    /* flags decribing the pattern */
+    uint8_t flags;
+    /* offset and depth, only used if the flags say so */
+    uint16_t offset;
+    uint16_t depth;
+    /* the pattern, lowercased if nocase */
+    uint8_t *pat;
+    /* pattern id */
+    uint32_t id;
+
+    struct SCTeddyPattern_ *next;
+} SCTeddyPattern;
+
+typedef struct SCTeddyCtx_ {
+    /* hash used during ctx initialization */
+    SCTeddyPattern **init_hash;
+
+    /* all patterns, ordered by bucket. The patterns of bucket b are
+     * parray[bucket_start[b]] up to parray[bucket_start[b + 1]] */
+    SCTeddyPattern **parray;
+    uint32_t bucket_start[SC_TEDDY_BUCKETS + 1];
+
+    /* patterns hashed on their lowercased leading bytes, chained through
+     * their next pointer. Used to verify the candidate positions */
+    SCTeddyPattern **verify_hash;
+
+    /* number of leading pattern bytes in the fingerprint */
+    uint16_t fp_len;
+
+    /* per fingerprint byte, the buckets that have a pattern with that low
+     * or high nibble at that position */
+    uint8_t lo_mask[SC_TEDDY_MAX_FP][16] __attribute__((aligned(16)));
+    uint8_t hi_mask[SC_TEDDY_MAX_FP][16] __attribute__((aligned(16)));
+} SCTeddyCtx;
+
+typedef struct SCTeddyThreadCtx_ {
+    /* the total calls we make to the search function */
+    uint32_t total_calls;
+    /* the total patterns that we ended up matching against */
+    uint64_t total_matches;
+} SCTeddyThreadCtx;
+
+void MpmTeddyRegister(void);
+void SCTeddySetup(int);
+
+#endif /* __UTIL_MPM_TEDDY_H__ */
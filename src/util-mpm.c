@@ -36,7 +36,9 @@
 #include "util-mpm-b2gm.h"
 #include "util-mpm-ac.h"
 #include "util-mpm-ac-gfbs.h"
+#include "util-mpm-teddy.h"
 #include "util-hashlist.h"
+#include "util-cpu.h"
 
 #include "detect-engine.h"
 #include "util-cuda-handlers.h"
@@ -46,25 +48,25 @@
 #include "queue.h"
 #include "util-unittest.h"
 
-MpmCtxFactoryContainer *mpm_ctx_factory_container = NULL;
-
 /**
  * \brief Register a new Mpm Context.
  *
- * \param name A new profile to be registered to store this MpmCtx.
+ * \param de_ctx Detection engine the profile belongs to.
+ * \param name   A new profile to be registered to store this MpmCtx.
  *
  * \retval id Return the id created for the new MpmCtx profile.
  */
-int32_t MpmFactoryRegisterMpmCtxProfile(const char *name, uint8_t flags)
+int32_t MpmFactoryRegisterMpmCtxProfile(DetectEngineCtx *de_ctx, const char *name,
+                                        uint8_t flags)
 {
     /* the very first entry */
-    if (mpm_ctx_factory_container == NULL) {
-        mpm_ctx_factory_container = SCMalloc(sizeof(MpmCtxFactoryContainer));
-        if (mpm_ctx_factory_container == NULL) {
+    if (de_ctx->mpm_ctx_factory_container == NULL) {
+        de_ctx->mpm_ctx_factory_container = SCMalloc(sizeof(MpmCtxFactoryContainer));
+        if (de_ctx->mpm_ctx_factory_container == NULL) {
             SCLogError(SC_ERR_MEM_ALLOC, "Error allocating memory");
             exit(EXIT_FAILURE);
         }
-        memset(mpm_ctx_factory_container, 0, sizeof(MpmCtxFactoryContainer));
+        memset(de_ctx->mpm_ctx_factory_container, 0, sizeof(MpmCtxFactoryContainer));
 
         MpmCtxFactoryItem *item = SCMalloc(sizeof(MpmCtxFactoryItem));
         if (item == NULL) {
@@ -84,6 +86,7 @@ int32_t MpmFactoryRegisterMpmCtxProfile(const char *name, uint8_t flags)
             exit(EXIT_FAILURE);
         }
         memset(item[0].mpm_ctx, 0, sizeof(MpmCtx));
+        item[0].mpm_ctx->flags |= MPM_CTX_FLAG_FACTORY;
 
         /* our id starts from 0 always.  Helps us with the ctx retrieval from
          * the array */
@@ -93,15 +96,15 @@ int32_t MpmFactoryRegisterMpmCtxProfile(const char *name, uint8_t flags)
         item[0].flags = flags;
 
         /* store the newly created item */
-        mpm_ctx_factory_container->items = item;
-        mpm_ctx_factory_container->no_of_items++;
+        de_ctx->mpm_ctx_factory_container->items = item;
+        de_ctx->mpm_ctx_factory_container->no_of_items++;
 
         /* the first id is always 0 */
         return item[0].id;
     } else {
         int i;
-        MpmCtxFactoryItem *items = mpm_ctx_factory_container->items;
-        for (i = 0; i < mpm_ctx_factory_container->no_of_items; i++) {
+        MpmCtxFactoryItem *items = de_ctx->mpm_ctx_factory_container->items;
+        for (i = 0; i < de_ctx->mpm_ctx_factory_container->no_of_items; i++) {
             if (items[i].name != NULL && strcmp(items[i].name, name) == 0) {
                 /* looks like we have this mpm_ctx freed */
                 if (items[i].mpm_ctx == NULL) {
@@ -111,6 +114,7 @@ int32_t MpmFactoryRegisterMpmCtxProfile(const char *name, uint8_t flags)
                         exit(EXIT_FAILURE);
                     }
                     memset(items[i].mpm_ctx, 0, sizeof(MpmCtx));
+                    items[i].mpm_ctx->flags |= MPM_CTX_FLAG_FACTORY;
                 }
                 items[i].flags = flags;
                 return items[i].id;
@@ -119,15 +123,15 @@ int32_t MpmFactoryRegisterMpmCtxProfile(const char *name, uint8_t flags)
 
         /* let's make the new entry */
         items = realloc(items,
-                        (mpm_ctx_factory_container->no_of_items + 1) * sizeof(MpmCtxFactoryItem));
+                        (de_ctx->mpm_ctx_factory_container->no_of_items + 1) * sizeof(MpmCtxFactoryItem));
         if (items == NULL) {
             SCLogError(SC_ERR_MEM_ALLOC, "Error allocating memory");
             exit(EXIT_FAILURE);
         }
 
-        mpm_ctx_factory_container->items = items;
+        de_ctx->mpm_ctx_factory_container->items = items;
 
-        MpmCtxFactoryItem *new_item = &items[mpm_ctx_factory_container->no_of_items];
+        MpmCtxFactoryItem *new_item = &items[de_ctx->mpm_ctx_factory_container->no_of_items];
         new_item[0].name = strdup(name);
         if (new_item[0].name == NULL) {
             SCLogError(SC_ERR_MEM_ALLOC, "Error allocating memory");
@@ -140,10 +144,11 @@ int32_t MpmFactoryRegisterMpmCtxProfile(const char *name, uint8_t flags)
             exit(EXIT_FAILURE);
         }
         memset(new_item[0].mpm_ctx, 0, sizeof(MpmCtx));
+        new_item[0].mpm_ctx->flags |= MPM_CTX_FLAG_FACTORY;
 
-        new_item[0].id = mpm_ctx_factory_container->no_of_items;
+        new_item[0].id = de_ctx->mpm_ctx_factory_container->no_of_items;
         new_item[0].flags = flags;
-        mpm_ctx_factory_container->no_of_items++;
+        de_ctx->mpm_ctx_factory_container->no_of_items++;
 
         /* the newly created id */
         return new_item[0].id;
@@ -155,19 +160,11 @@ int32_t MpmFactoryIsMpmCtxAvailable(MpmCtx *mpm_ctx)
     if (mpm_ctx == NULL)
         return 0;
 
-    if (mpm_ctx_factory_container == NULL) {
-        return 0;
-    } else {
-        int i;
-        for (i = 0; i < mpm_ctx_factory_container->no_of_items; i++) {
-            if (mpm_ctx == mpm_ctx_factory_container->items[i].mpm_ctx)
-                return 1;
-        }
-        return 0;
-    }
+    /* factory ctxs belong to the profile of their detection engine */
+    return (mpm_ctx->flags & MPM_CTX_FLAG_FACTORY) ? 1 : 0;
 }
 
-MpmCtx *MpmFactoryGetMpmCtxForProfile(int32_t id)
+MpmCtx *MpmFactoryGetMpmCtxForProfile(DetectEngineCtx *de_ctx, int32_t id)
 {
     if (id == MPM_CTX_FACTORY_UNIQUE_CONTEXT) {
         MpmCtx *mpm_ctx = SCMalloc(sizeof(MpmCtx));
@@ -180,11 +177,12 @@ MpmCtx *MpmFactoryGetMpmCtxForProfile(int32_t id)
     } else if (id < -1) {
         SCLogError(SC_ERR_INVALID_ARGUMENTS, "Invalid argument - %d\n", id);
         return NULL;
-    } else if (id >= mpm_ctx_factory_container->no_of_items) {
+    } else if (de_ctx->mpm_ctx_factory_container == NULL ||
+               id >= de_ctx->mpm_ctx_factory_container->no_of_items) {
         /* this id does not exist */
         return NULL;
     } else {
-        return mpm_ctx_factory_container->items[id].mpm_ctx;
+        return de_ctx->mpm_ctx_factory_container->items[id].mpm_ctx;
     }
 }
 
@@ -199,23 +197,26 @@ void MpmFactoryReClaimMpmCtx(MpmCtx *mpm_ctx)
     return;
 }
 
-void MpmFactoryDeRegisterAllMpmCtxProfiles(void)
+void MpmFactoryDeRegisterAllMpmCtxProfiles(DetectEngineCtx *de_ctx)
 {
-    if (mpm_ctx_factory_container == NULL)
+    if (de_ctx->mpm_ctx_factory_container == NULL)
         return;
 
     int i = 0;
-    MpmCtxFactoryItem *items = mpm_ctx_factory_container->items;
-    for (i = 0; i < mpm_ctx_factory_container->no_of_items; i++) {
+    MpmCtxFactoryItem *items = de_ctx->mpm_ctx_factory_container->items;
+    for (i = 0; i < de_ctx->mpm_ctx_factory_container->no_of_items; i++) {
         if (items[i].name != NULL)
             SCFree(items[i].name);
-        if (items[i].mpm_ctx != NULL)
+        if (items[i].mpm_ctx != NULL) {
+            if (items[i].mpm_ctx->ctx != NULL)
+                mpm_table[items[i].mpm_ctx->mpm_type].DestroyCtx(items[i].mpm_ctx);
             SCFree(items[i].mpm_ctx);
+        }
     }
 
-    SCFree(mpm_ctx_factory_container->items);
-    SCFree(mpm_ctx_factory_container);
-    mpm_ctx_factory_container = NULL;
+    SCFree(de_ctx->mpm_ctx_factory_container->items);
+    SCFree(de_ctx->mpm_ctx_factory_container);
+    de_ctx->mpm_ctx_factory_container = NULL;
 
     return;
 }
@@ -302,7 +303,10 @@ MpmVerifyMatch(MpmThreadCtx *thread_ctx, PatternMatcherQueue *pmq, uint32_t pati
 }
 
 /**
- *  \brief Merge two pmq's bitarrays
+ *  \brief Merge two pmq's
+ *
+ *  The pattern ids of src that are not in dst yet are added to both the
+ *  bitarray and the array of dst.
  *
  *  \param src source pmq
  *  \param dst destination pmq to merge into
@@ -313,13 +317,50 @@ void PmqMerge(PatternMatcherQueue *src, PatternMatcherQueue *dst) {
     if (src->pattern_id_array_cnt == 0)
         return;
 
-    for (u = 0; u < src->pattern_id_bitarray_size && u < dst->pattern_id_bitarray_size; u++) {
-        dst->pattern_id_bitarray[u] |= src->pattern_id_bitarray[u];
+    for (u = 0; u < src->pattern_id_array_cnt; u++) {
+        uint32_t patid = src->pattern_id_array[u];
+
+        if ((patid / 8) >= dst->pattern_id_bitarray_size)
+            continue;
+
+        if (!(dst->pattern_id_bitarray[(patid / 8)] & (1<<(patid % 8)))) {
+            dst->pattern_id_bitarray[(patid / 8)] |= (1<<(patid % 8));
+            dst->pattern_id_array[dst->pattern_id_array_cnt] = patid;
+            dst->pattern_id_array_cnt++;
+        }
     }
 
     /** \todo now set merged flag? */
 }
 
+/**
+ *  \brief Drop the pattern ids that are not in a filter from a pmq
+ *
+ *  Used when a single mpm ctx is shared by many sig groups: the search
+ *  reports the patterns of all groups, the filter of a group only has the
+ *  bits of its own pattern ids set.
+ *
+ *  \param pmq pmq to filter
+ *  \param filter bitarray of the pattern ids to keep
+ *  \param filter_size size of filter in bytes, pattern ids beyond it are
+ *         dropped
+ */
+void PmqFilter(PatternMatcherQueue *pmq, const uint8_t *filter,
+               uint32_t filter_size) {
+    uint32_t u, cnt = 0;
+
+    for (u = 0; u < pmq->pattern_id_array_cnt; u++) {
+        uint32_t patid = pmq->pattern_id_array[u];
+
+        if ((patid / 8) < filter_size && (filter[(patid / 8)] & (1<<(patid % 8)))) {
+            pmq->pattern_id_array[cnt++] = patid;
+        } else {
+            pmq->pattern_id_bitarray[(patid / 8)] &= ~(1<<(patid % 8));
+        }
+    }
+    pmq->pattern_id_array_cnt = cnt;
+}
+
 /** \brief Reset a Pmq for reusage. Meant to be called after a single search.
  *  \param pmq Pattern matcher to be reset.
  *  \todo memset is expensive, but we need it as we merge pmq's. We might use
@@ -371,6 +412,163 @@ void PmqFree(PatternMatcherQueue *pmq) {
     PmqCleanup(pmq);
 }
 
+/**
+ *  \internal
+ *  \brief The ctxs to prepare, shared by the threads of MpmPrepareCtxs.
+ */
+typedef struct MpmPrepareQueue_ {
+    SCMutex m;
+    MpmCtx **ctxs;
+    uint32_t cnt;
+    uint32_t next;      /**< next ctx to hand out */
+} MpmPrepareQueue;
+
+/** \internal \brief prepare ctxs from the queue until it is empty */
+static void *MpmPrepareCtxsThread(void *data)
+{
+    MpmPrepareQueue *q = (MpmPrepareQueue *)data;
+
+    while (1) {
+        MpmCtx *mpm_ctx = NULL;
+
+        SCMutexLock(&q->m);
+        if (q->next < q->cnt)
+            mpm_ctx = q->ctxs[q->next++];
+        SCMutexUnlock(&q->m);
+
+        if (mpm_ctx == NULL)
+            break;
+
+        mpm_table[mpm_ctx->mpm_type].Prepare(mpm_ctx);
+    }
+
+    return NULL;
+}
+
+/**
+ *  \brief Prepare a list of mpm ctxs, spread over a pool of threads.
+ *
+ *  Each ctx is only touched by the thread that prepares it, so the result
+ *  doesn't depend on the number of threads. Matchers that keep state
+ *  outside of the ctx while preparing don't set MPM_TABLE_FLAG_PREPARE_MT,
+ *  their ctxs are prepared by the calling thread.
+ *
+ *  \param ctxs ctxs to prepare, NULL entries and ctxs of matchers without
+ *              a Prepare function are skipped
+ *  \param cnt number of entries in ctxs
+ *  \param threads max number of threads to use, 0 for one per cpu
+ */
+void MpmPrepareCtxs(MpmCtx **ctxs, uint32_t cnt, uint16_t threads)
+{
+    MpmPrepareQueue q;
+    pthread_t *tids = NULL;
+    uint32_t i, mt_cnt = 0;
+
+    memset(&q, 0, sizeof(q));
+
+    q.ctxs = SCMalloc(cnt * sizeof(MpmCtx *));
+    if (q.ctxs == NULL)
+        threads = 1;
+
+    /* queue what can be done concurrently, do the rest right away */
+    for (i = 0; i < cnt; i++) {
+        MpmCtx *mpm_ctx = ctxs[i];
+        if (mpm_ctx == NULL || mpm_table[mpm_ctx->mpm_type].Prepare == NULL)
+            continue;
+
+        if (q.ctxs != NULL &&
+            (mpm_table[mpm_ctx->mpm_type].flags & MPM_TABLE_FLAG_PREPARE_MT)) {
+            q.ctxs[mt_cnt++] = mpm_ctx;
+        } else {
+            mpm_table[mpm_ctx->mpm_type].Prepare(mpm_ctx);
+        }
+    }
+    q.cnt = mt_cnt;
+
+    if (threads == 0)
+        threads = UtilCpuGetNumProcessorsOnline();
+    if (threads > mt_cnt)
+        threads = mt_cnt;
+
+    if (threads > 1)
+        tids = SCMalloc(threads * sizeof(pthread_t));
+
+    SCMutexInit(&q.m, NULL);
+    if (tids != NULL) {
+        uint16_t started = 0;
+
+        for (i = 0; i < threads; i++) {
+            if (pthread_create(&tids[started], NULL, MpmPrepareCtxsThread, &q) != 0) {
+                SCLogWarning(SC_ERR_THREAD_CREATE, "creating mpm prepare thread "
+                             "failed: %s", strerror(errno));
+                break;
+            }
+            started++;
+        }
+        SCLogDebug("preparing %" PRIu32 " mpm ctxs with %" PRIu16 " threads",
+                   mt_cnt, started);
+
+        /* help out, this also covers failing to start any thread */
+        MpmPrepareCtxsThread(&q);
+
+        for (i = 0; i < started; i++)
+            pthread_join(tids[i], NULL);
+        SCFree(tids);
+    } else {
+        MpmPrepareCtxsThread(&q);
+    }
+    SCMutexDestroy(&q.m);
+
+    if (q.ctxs != NULL)
+        SCFree(q.ctxs);
+}
+
+/** \brief Reset a stream state so the next SearchResume starts from scratch
+  * \param ss Stream state to reset.
+  */
+void MpmStreamStateReset(MpmStreamState *ss) {
+    ss->mpm_ctx = NULL;
+    ss->version = 0;
+    ss->state = 0;
+    ss->offset = 0;
+}
+
+/**
+ * \brief Search a batch of buffers against the same mpm ctx.  Uses the
+ *        SearchBatch of the matcher if it has one, otherwise the buffers
+ *        are searched one by one.
+ *
+ * \param mpm_ctx        Mpm context.
+ * \param mpm_thread_ctx Mpm thread context.
+ * \param batch          Buffers to search, each with its own pmq.
+ * \param cnt            Number of entries in batch.
+ *
+ * \retval matches Total match count, the count per buffer is set in batch.
+ */
+uint32_t MpmSearchBatch(MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
+                        MpmBatchBuffer *batch, uint16_t cnt)
+{
+    uint32_t matches = 0;
+    uint16_t i;
+
+    if (mpm_table[mpm_ctx->mpm_type].SearchBatch != NULL) {
+        return mpm_table[mpm_ctx->mpm_type].SearchBatch(mpm_ctx,
+                mpm_thread_ctx, batch, cnt);
+    }
+
+    for (i = 0; i < cnt; i++) {
+        batch[i].matches = 0;
+        if (batch[i].buf == NULL || batch[i].buflen == 0)
+            continue;
+
+        batch[i].matches = mpm_table[mpm_ctx->mpm_type].Search(mpm_ctx,
+                mpm_thread_ctx, batch[i].pmq, batch[i].buf, batch[i].buflen);
+        matches += batch[i].matches;
+    }
+
+    return matches;
+}
+
 /**
  * \brief Return the pattern max length of a registered matcher
  * \retval 0 if it has no limit
@@ -406,6 +604,7 @@ void MpmTableSetup(void) {
     MpmB2gmRegister();
     MpmACRegister();
     MpmACGfbsRegister();
+    MpmTeddyRegister();
 }
 
 /** \brief  Function to return the default hash size for the mpm algorithm,
@@ -77,6 +77,8 @@ enum {
     MPM_AC,
     /* aho-corasick-goto-failure state based */
     MPM_AC_GFBS,
+    /* simd nibble mask matcher */
+    MPM_TEDDY,
     /* table size */
     MPM_TABLE_SIZE,
 };
@@ -117,8 +119,13 @@ typedef struct MpmCtx_ {
 
     uint32_t memory_cnt;
     uint32_t memory_size;
+
+    uint8_t flags;
 } MpmCtx;
 
+/** the ctx is owned by a mpm ctx factory profile */
+#define MPM_CTX_FLAG_FACTORY    0x01
+
 /* if we want to retrieve an unique mpm context from the mpm context factory
  * we should supply this as the key */
 #define MPM_CTX_FACTORY_UNIQUE_CONTEXT -1
@@ -137,6 +144,41 @@ typedef struct MpmCtxFactoryContainer_ {
     int32_t no_of_items;
 } MpmCtxFactoryContainer;
 
+/** \brief A single buffer in a segmented search. All segments are scanned
+ *         in one call against the same mpm ctx. A pattern id only matches
+ *         in a segment if its tag (from the per pattern id tag table) has a
+ *         bit in common with the segment tag. The search state is reset at
+ *         each segment start, so patterns never match across segments. */
+typedef struct MpmBufferSegment_ {
+    uint8_t *buf;
+    uint32_t buflen;
+    uint8_t tag;
+} MpmBufferSegment;
+
+/** \brief A single buffer in a batch search. All buffers of a batch are
+ *         searched against the same mpm ctx, each with its own pmq. The
+ *         matcher sets matches to the match count of the buffer. */
+typedef struct MpmBatchBuffer_ {
+    uint8_t *buf;
+    uint16_t buflen;
+    PatternMatcherQueue *pmq;
+    uint32_t matches;
+} MpmBatchBuffer;
+
+/** \brief  State of a search that is continued over consecutive chunks of
+ *          the same data (SearchResume). The state is only valid for the
+ *          mpm ctx it was created with, for any other ctx the search starts
+ *          from scratch. As a freed ctx's address can be reused by the ctx
+ *          of a reloaded engine, callers also check the engine version. */
+typedef struct MpmStreamState_ {
+    struct MpmCtx_ *mpm_ctx;    /**< ctx the state belongs to */
+    uint32_t version;           /**< version of the detection engine the
+                                     ctx belongs to */
+    uint32_t state;             /**< matcher state after the last chunk */
+    uint32_t offset;            /**< caller defined position the next chunk
+                                     is expected at */
+} MpmStreamState;
+
 /** pattern is case insensitive */
 #define MPM_PATTERN_FLAG_NOCASE     0x01
 /** pattern is negated */
@@ -171,6 +213,16 @@ typedef struct MpmTableElmt_ {
     int  (*AddPatternNocase)(struct MpmCtx_ *, uint8_t *, uint16_t, uint16_t, uint16_t, uint32_t, uint32_t, uint8_t);
     int  (*Prepare)(struct MpmCtx_ *);
     uint32_t (*Search)(struct MpmCtx_ *, struct MpmThreadCtx_ *, PatternMatcherQueue *, uint8_t *, uint16_t);
+    /** optional: search a list of tagged buffers in one pass. Last arg is
+     *  the pattern id -> tag table. NULL if the matcher doesn't support it. */
+    uint32_t (*SearchSegments)(struct MpmCtx_ *, struct MpmThreadCtx_ *, PatternMatcherQueue *, MpmBufferSegment *, uint16_t, uint8_t *);
+    /** optional: search the next chunk of a data stream, continuing from
+     *  and updating the stream state. NULL if the matcher doesn't support it. */
+    uint32_t (*SearchResume)(struct MpmCtx_ *, struct MpmThreadCtx_ *, PatternMatcherQueue *, MpmStreamState *, uint8_t *, uint32_t);
+    /** optional: search a batch of independent buffers, each with its own
+     *  pmq, in one call. NULL if the matcher doesn't support it, use
+     *  MpmSearchBatch() to fall back to Search. */
+    uint32_t (*SearchBatch)(struct MpmCtx_ *, struct MpmThreadCtx_ *, MpmBatchBuffer *, uint16_t);
     void (*Cleanup)(struct MpmThreadCtx_ *);
     void (*PrintCtx)(struct MpmCtx_ *);
     void (*PrintThreadCtx)(struct MpmThreadCtx_ *);
@@ -178,12 +230,18 @@ typedef struct MpmTableElmt_ {
     uint8_t flags;
 } MpmTableElmt;
 
+/** Prepare only touches the ctx, so different ctxs can be prepared
+ *  concurrently (MpmPrepareCtxs) */
+#define MPM_TABLE_FLAG_PREPARE_MT   0x01
+
 MpmTableElmt mpm_table[MPM_TABLE_SIZE];
 
-int32_t MpmFactoryRegisterMpmCtxProfile(const char *, uint8_t);
+struct DetectEngineCtx_;
+
+int32_t MpmFactoryRegisterMpmCtxProfile(struct DetectEngineCtx_ *, const char *, uint8_t);
 void MpmFactoryReClaimMpmCtx(MpmCtx *);
-MpmCtx *MpmFactoryGetMpmCtxForProfile(int32_t);
-void MpmFactoryDeRegisterAllMpmCtxProfiles(void);
+MpmCtx *MpmFactoryGetMpmCtxForProfile(struct DetectEngineCtx_ *, int32_t);
+void MpmFactoryDeRegisterAllMpmCtxProfiles(struct DetectEngineCtx_ *);
 int32_t MpmFactoryIsMpmCtxAvailable(MpmCtx *);
 
 /* macros decides if cuda is enabled for the platform or not */
@@ -207,9 +265,13 @@ typedef struct MpmCudaConf_ {
 
 int PmqSetup(PatternMatcherQueue *, uint32_t, uint32_t);
 void PmqMerge(PatternMatcherQueue *src, PatternMatcherQueue *dst);
+void PmqFilter(PatternMatcherQueue *, const uint8_t *, uint32_t);
 void PmqReset(PatternMatcherQueue *);
 void PmqCleanup(PatternMatcherQueue *);
 void PmqFree(PatternMatcherQueue *);
+void MpmStreamStateReset(MpmStreamState *);
+void MpmPrepareCtxs(MpmCtx **, uint32_t, uint16_t);
+uint32_t MpmSearchBatch(MpmCtx *, MpmThreadCtx *, MpmBatchBuffer *, uint16_t);
 
 #ifdef __SC_CUDA_SUPPORT__
 MpmCudaConf *MpmCudaConfParse(void);
@@ -33,6 +33,7 @@
 #include "suricata-common.h"
 #include "suricata.h"
 #include "util-spm-bm.h"
+#include "util-spm-simd.h"
 #include "util-debug.h"
 #include "util-error.h"
 #include <time.h>
@@ -85,6 +86,8 @@ BmCtx *BoyerMooreCtxInit(uint8_t *needle, uint32_t needle_len) {
         exit(EXIT_FAILURE);
     }
 
+    /* Boyer Moore can't skip much on short patterns */
+    new->simd = (SimdSearchAvailable() && needle_len <= SPM_SIMD_MAX_LEN);
 
     return new;
 }
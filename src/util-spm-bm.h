@@ -34,6 +34,8 @@
 typedef struct BmCtx_ {
     int32_t bmBc[ALPHABET_SIZE];
     int32_t *bmGs; // = SCMalloc(sizeof(int32_t)*(needlelen + 1));
+    /** short pattern, SpmCtxSearch uses the SIMD filter instead */
+    uint8_t simd;
 }BmCtx;
 
 /** Prepare and return a Boyer Moore context */
@@ -0,0 +1,340 @@
+/* Copyright (C) 2007-2010 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * SIMD first and last byte filter search. For every position of a block
+ * of the text the first byte of the pattern is compared to the text at
+ * that position and the last byte of the pattern to the text pattern
+ * length - 1 further, both as one vector compare. Only the positions where
+ * both match are verified. For short patterns Boyer Moore can't skip much
+ * and this beats it, it needs no context either.
+ *
+ * There are SSE2 and AVX2 variants, SimdSearchSetup binds the best one the
+ * cpu supports. Without either the filter runs a byte at a time.
+ */
+
+#include "suricata-common.h"
+#include "suricata.h"
+#include "util-debug.h"
+#include "util-cpu.h"
+
+#include "util-spm-simd.h"
+
+#if defined(SC_CPU_DISPATCH)
+#include <immintrin.h>
+#elif defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/**
+ * \internal
+ * \brief Verify a candidate: the bytes between the first and last one,
+ *        those were checked by the filter already
+ */
+static inline int SimdSearchVerify(const uint8_t *text, const uint8_t *needle,
+        uint32_t needlelen, const int nocase)
+{
+    uint32_t i;
+
+    if (needlelen <= 2)
+        return 1;
+
+    if (!nocase)
+        return (memcmp(text + 1, needle + 1, needlelen - 2) == 0);
+
+    for (i = 1; i < needlelen - 1; i++) {
+        if (u8_tolower(text[i]) != u8_tolower(needle[i]))
+            return 0;
+    }
+    return 1;
+}
+
+/** the first and last byte of the pattern, in lower and upper case if
+ *  nocase */
+typedef struct SimdSearchBytes_ {
+    uint8_t first_lc;
+    uint8_t first_uc;
+    uint8_t last_lc;
+    uint8_t last_uc;
+} SimdSearchBytes;
+
+static inline void SimdSearchBytesSetup(SimdSearchBytes *sb,
+        const uint8_t *needle, uint32_t needlelen, const int nocase)
+{
+    sb->first_lc = sb->first_uc = needle[0];
+    sb->last_lc = sb->last_uc = needle[needlelen - 1];
+
+    if (nocase) {
+        sb->first_lc = u8_tolower(sb->first_lc);
+        sb->first_uc = toupper(sb->first_lc);
+        sb->last_lc = u8_tolower(sb->last_lc);
+        sb->last_uc = toupper(sb->last_lc);
+    }
+}
+
+/**
+ * \internal
+ * \brief The filter a byte at a time, from position i on. Runs the part of
+ *        the text that is too short for a full block, or all of it if
+ *        there is no SIMD.
+ */
+static inline uint8_t *SimdSearchTail(const uint8_t *text, uint32_t textlen,
+        const uint8_t *needle, uint32_t needlelen, const SimdSearchBytes *sb,
+        uint32_t i, const int nocase)
+{
+    const uint32_t last = needlelen - 1;
+
+    for ( ; i + last < textlen; i++) {
+        uint8_t f = text[i], l = text[i + last];
+
+        if ((f == sb->first_lc || f == sb->first_uc) &&
+            (l == sb->last_lc || l == sb->last_uc) &&
+            SimdSearchVerify(text + i, needle, needlelen, nocase))
+            return (uint8_t *)text + i;
+    }
+
+    return NULL;
+}
+
+/**
+ * \internal
+ * \brief The search without SIMD. nocase is a constant after inlining in
+ *        all of these, so the case sensitive versions don't pay for the
+ *        extra compares.
+ */
+static inline uint8_t *SimdSearchPlainInternal(const uint8_t *text,
+        uint32_t textlen, const uint8_t *needle, uint32_t needlelen,
+        const int nocase)
+{
+    SimdSearchBytes sb;
+
+    if (needlelen == 0 || needlelen > textlen)
+        return NULL;
+
+    SimdSearchBytesSetup(&sb, needle, needlelen, nocase);
+    return SimdSearchTail(text, textlen, needle, needlelen, &sb, 0, nocase);
+}
+
+#if defined(SC_CPU_DISPATCH) || defined(__SSE2__)
+static inline SC_CPU_TARGET("sse2") uint8_t *SimdSearchSSE2Internal(
+        const uint8_t *text, uint32_t textlen, const uint8_t *needle,
+        uint32_t needlelen, const int nocase)
+{
+    SimdSearchBytes sb;
+    uint32_t i = 0;
+
+    if (needlelen == 0 || needlelen > textlen)
+        return NULL;
+
+    const uint32_t last = needlelen - 1;
+    SimdSearchBytesSetup(&sb, needle, needlelen, nocase);
+
+    __m128i v_first_lc = _mm_set1_epi8((char)sb.first_lc);
+    __m128i v_first_uc = _mm_set1_epi8((char)sb.first_uc);
+    __m128i v_last_lc = _mm_set1_epi8((char)sb.last_lc);
+    __m128i v_last_uc = _mm_set1_epi8((char)sb.last_uc);
+
+    for ( ; i + last + 16 <= textlen; i += 16) {
+        __m128i b_first = _mm_loadu_si128((const __m128i *)(text + i));
+        __m128i b_last = _mm_loadu_si128((const __m128i *)(text + i + last));
+
+        __m128i eq_first = _mm_cmpeq_epi8(b_first, v_first_lc);
+        __m128i eq_last = _mm_cmpeq_epi8(b_last, v_last_lc);
+        if (nocase) {
+            eq_first = _mm_or_si128(eq_first, _mm_cmpeq_epi8(b_first, v_first_uc));
+            eq_last = _mm_or_si128(eq_last, _mm_cmpeq_epi8(b_last, v_last_uc));
+        }
+
+        uint32_t mask = (uint32_t)_mm_movemask_epi8(_mm_and_si128(eq_first, eq_last));
+        while (mask != 0) {
+            uint32_t pos = i + __builtin_ctz(mask);
+
+            if (SimdSearchVerify(text + pos, needle, needlelen, nocase))
+                return (uint8_t *)text + pos;
+            mask &= (mask - 1);
+        }
+    }
+
+    return SimdSearchTail(text, textlen, needle, needlelen, &sb, i, nocase);
+}
+
+static SC_CPU_TARGET("sse2") uint8_t *SimdSearchSSE2(const uint8_t *text,
+        uint32_t textlen, const uint8_t *needle, uint32_t needlelen)
+{
+    return SimdSearchSSE2Internal(text, textlen, needle, needlelen, 0);
+}
+
+static SC_CPU_TARGET("sse2") uint8_t *SimdNocaseSearchSSE2(const uint8_t *text,
+        uint32_t textlen, const uint8_t *needle, uint32_t needlelen)
+{
+    return SimdSearchSSE2Internal(text, textlen, needle, needlelen, 1);
+}
+#endif /* SSE2 */
+
+#if defined(SC_CPU_DISPATCH) || defined(__AVX2__)
+static inline SC_CPU_TARGET("avx2") uint8_t *SimdSearchAVX2Internal(
+        const uint8_t *text, uint32_t textlen, const uint8_t *needle,
+        uint32_t needlelen, const int nocase)
+{
+    SimdSearchBytes sb;
+    uint32_t i = 0;
+
+    if (needlelen == 0 || needlelen > textlen)
+        return NULL;
+
+    const uint32_t last = needlelen - 1;
+    SimdSearchBytesSetup(&sb, needle, needlelen, nocase);
+
+    __m256i v_first_lc = _mm256_set1_epi8((char)sb.first_lc);
+    __m256i v_first_uc = _mm256_set1_epi8((char)sb.first_uc);
+    __m256i v_last_lc = _mm256_set1_epi8((char)sb.last_lc);
+    __m256i v_last_uc = _mm256_set1_epi8((char)sb.last_uc);
+
+    for ( ; i + last + 32 <= textlen; i += 32) {
+        __m256i b_first = _mm256_loadu_si256((const __m256i *)(text + i));
+        __m256i b_last = _mm256_loadu_si256((const __m256i *)(text + i + last));
+
+        __m256i eq_first = _mm256_cmpeq_epi8(b_first, v_first_lc);
+        __m256i eq_last = _mm256_cmpeq_epi8(b_last, v_last_lc);
+        if (nocase) {
+            eq_first = _mm256_or_si256(eq_first, _mm256_cmpeq_epi8(b_first, v_first_uc));
+            eq_last = _mm256_or_si256(eq_last, _mm256_cmpeq_epi8(b_last, v_last_uc));
+        }
+
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_and_si256(eq_first, eq_last));
+        while (mask != 0) {
+            uint32_t pos = i + __builtin_ctz(mask);
+
+            if (SimdSearchVerify(text + pos, needle, needlelen, nocase))
+                return (uint8_t *)text + pos;
+            mask &= (mask - 1);
+        }
+    }
+
+    return SimdSearchTail(text, textlen, needle, needlelen, &sb, i, nocase);
+}
+
+static SC_CPU_TARGET("avx2") uint8_t *SimdSearchAVX2(const uint8_t *text,
+        uint32_t textlen, const uint8_t *needle, uint32_t needlelen)
+{
+    return SimdSearchAVX2Internal(text, textlen, needle, needlelen, 0);
+}
+
+static SC_CPU_TARGET("avx2") uint8_t *SimdNocaseSearchAVX2(const uint8_t *text,
+        uint32_t textlen, const uint8_t *needle, uint32_t needlelen)
+{
+    return SimdSearchAVX2Internal(text, textlen, needle, needlelen, 1);
+}
+#endif /* AVX2 */
+
+static uint8_t *SimdSearchPlain(const uint8_t *text, uint32_t textlen,
+        const uint8_t *needle, uint32_t needlelen)
+{
+    return SimdSearchPlainInternal(text, textlen, needle, needlelen, 0);
+}
+
+static uint8_t *SimdNocaseSearchPlain(const uint8_t *text, uint32_t textlen,
+        const uint8_t *needle, uint32_t needlelen)
+{
+    return SimdSearchPlainInternal(text, textlen, needle, needlelen, 1);
+}
+
+/** bound to the best variant by SimdSearchSetup, plain until then */
+static uint8_t *(*SimdSearchFunc)(const uint8_t *, uint32_t,
+        const uint8_t *, uint32_t) = SimdSearchPlain;
+static uint8_t *(*SimdNocaseSearchFunc)(const uint8_t *, uint32_t,
+        const uint8_t *, uint32_t) = SimdNocaseSearchPlain;
+static int simd_search_level = UTIL_CPU_SIMD_NONE;
+
+/**
+ * \brief Bind the search to the best variant for a SIMD level
+ *
+ * \param level max SIMD level to use, UTIL_CPU_SIMD_*
+ */
+void SimdSearchSetup(int level)
+{
+    simd_search_level = UTIL_CPU_SIMD_NONE;
+    SimdSearchFunc = SimdSearchPlain;
+    SimdNocaseSearchFunc = SimdNocaseSearchPlain;
+
+#if defined(SC_CPU_DISPATCH) || defined(__SSE2__)
+    if (level >= UTIL_CPU_SIMD_SSE2) {
+        simd_search_level = UTIL_CPU_SIMD_SSE2;
+        SimdSearchFunc = SimdSearchSSE2;
+        SimdNocaseSearchFunc = SimdNocaseSearchSSE2;
+    }
+#endif
+#if defined(SC_CPU_DISPATCH) || defined(__AVX2__)
+    if (level >= UTIL_CPU_SIMD_AVX2) {
+        simd_search_level = UTIL_CPU_SIMD_AVX2;
+        SimdSearchFunc = SimdSearchAVX2;
+        SimdNocaseSearchFunc = SimdNocaseSearchAVX2;
+    }
+#endif
+
+    SCLogInfo("spm: using the %s variant for short patterns",
+              UtilCpuSimdLevelToString(simd_search_level));
+}
+
+/**
+ * \brief Check if the search runs with SIMD instructions
+ *
+ * \retval 1 yes
+ * \retval 0 no, it would just be a basic search
+ */
+int SimdSearchAvailable(void)
+{
+    return (simd_search_level != UTIL_CPU_SIMD_NONE);
+}
+
+/**
+ * \brief Search a pattern in the text with the SIMD first and last byte
+ *        filter
+ *
+ * \param text Text to search in
+ * \param textlen length of the text
+ * \param needle pattern to search for
+ * \param needlelen length of the pattern
+ *
+ * \retval ptr to the first match in the text, NULL if not found
+ */
+uint8_t *SimdSearch(const uint8_t *text, uint32_t textlen,
+        const uint8_t *needle, uint32_t needlelen)
+{
+    return SimdSearchFunc(text, textlen, needle, needlelen);
+}
+
+/**
+ * \brief Search a pattern in the text with the SIMD first and last byte
+ *        filter, case insensitive
+ *
+ * \param text Text to search in
+ * \param textlen length of the text
+ * \param needle pattern to search for, any case
+ * \param needlelen length of the pattern
+ *
+ * \retval ptr to the first match in the text, NULL if not found
+ */
+uint8_t *SimdNocaseSearch(const uint8_t *text, uint32_t textlen,
+        const uint8_t *needle, uint32_t needlelen)
+{
+    return SimdNocaseSearchFunc(text, textlen, needle, needlelen);
+}
@@ -21,9 +21,10 @@
  * \author Pablo Rincon Crespo <pablo.rincon.crespo@gmail.com>
  *
  * PR (17/01/2010): Single pattern search algorithms:
- * Currently there are 3 algorithms to choose: BasicSearch, Bs2Bm and
- * BoyerMoore (Boyer Moores algorithm). The first one doesn't need a context.
- * But for Bs2Bm and BoyerMoore, you'll need to build some arrays.
+ * Currently there are 4 algorithms to choose: BasicSearch, Bs2Bm,
+ * BoyerMoore (Boyer Moores algorithm) and SimdSearch. BasicSearch and
+ * SimdSearch don't need a context. But for Bs2Bm and BoyerMoore, you'll
+ * need to build some arrays.
  *
  * !! If you are going to use the same pattern multiple times,
  * please, try to store the context some where. For Bs2Bm, the
@@ -56,6 +57,7 @@
 #include "util-spm-bs2bm.h"
 #include "util-spm-bm.h"
 #include "util-clock.h"
+#include "util-cpu.h"
 
 
 /**
@@ -283,6 +285,38 @@ uint8_t *BoyerMooreNocaseWrapper(uint8_t *text, uint8_t *needle, int times) {
 
 }
 
+uint8_t *SimdSearchWrapper(uint8_t *text, uint8_t *needle, int times) {
+    uint32_t textlen = strlen((char *)text);
+    uint32_t needlelen = strlen((char *)needle);
+
+    uint8_t *ret = NULL;
+    int i = 0;
+
+    CLOCK_INIT;
+    if (times > 1) CLOCK_START;
+    for (i = 0; i < times; i++) {
+        ret = SimdSearch(text, textlen, needle, needlelen);
+    }
+    if (times > 1) { CLOCK_END; CLOCK_PRINT_SEC; };
+    return ret;
+}
+
+uint8_t *SimdSearchNocaseWrapper(uint8_t *text, uint8_t *needle, int times) {
+    uint32_t textlen = strlen((char *)text);
+    uint32_t needlelen = strlen((char *)needle);
+
+    uint8_t *ret = NULL;
+    int i = 0;
+
+    CLOCK_INIT;
+    if (times > 1) CLOCK_START;
+    for (i = 0; i < times; i++) {
+        ret = SimdNocaseSearch(text, textlen, needle, needlelen);
+    }
+    if (times > 1) { CLOCK_END; CLOCK_PRINT_SEC; };
+    return ret;
+}
+
 /**
  * \brief Unittest helper function wrappers for the search algorithms
  * \param text pointer to the buffer to search in
@@ -606,6 +640,74 @@ int UtilSpmBoyerMooreSearchNocaseTest02() {
         return 1;
 }
 
+/**
+ * \test Check the SIMD search and SpmCtxSearch against the basic search,
+ *       for patterns at any offset of a text longer than a few vector
+ *       blocks, with partial matches all over it.
+ */
+int UtilSpmSimdSearchTest01() {
+    uint8_t text[200];
+    uint8_t needle[24];
+    uint32_t len, pos, i;
+    int nocase, level;
+    int result = 0;
+
+    for (level = 0; level <= UtilCpuSimdDetect(); level++) {
+        SimdSearchSetup(level);
+
+        for (len = 1; len <= sizeof(needle); len++) {
+            for (i = 0; i < len; i++)
+                needle[i] = "aBcDeFgHiJkLmNoPqRsTuVwX"[i];
+
+            BmCtx *bm_ctx = BoyerMooreCtxInit(needle, len);
+            BmCtx *bm_ctx_nocase = BoyerMooreCtxInit(needle, len);
+            BoyerMooreCtxToNocase(bm_ctx_nocase, needle, len);
+
+            for (pos = 0; pos <= sizeof(text); pos++) {
+                /* first and last byte of the needle all over */
+                for (i = 0; i < sizeof(text); i++)
+                    text[i] = (i % 3 == 0) ? 'a' : ((i % 3 == 1) ? needle[len - 1] : 'z');
+                /* the needle at pos, upper case for the nocase search */
+                if (pos + len <= sizeof(text)) {
+                    for (i = 0; i < len; i++)
+                        text[pos + i] = (pos & 1) ? toupper(needle[i]) : needle[i];
+                }
+
+                for (nocase = 0; nocase <= 1; nocase++) {
+                    uint8_t *ref, *found, *found_ctx;
+
+                    if (nocase) {
+                        ref = BasicSearchNocase(text, sizeof(text), needle, len);
+                        found = SimdNocaseSearch(text, sizeof(text), needle, len);
+                        found_ctx = SpmCtxNocaseSearch(needle, len, text, sizeof(text), bm_ctx_nocase);
+                    } else {
+                        ref = BasicSearch(text, sizeof(text), needle, len);
+                        found = SimdSearch(text, sizeof(text), needle, len);
+                        found_ctx = SpmCtxSearch(needle, len, text, sizeof(text), bm_ctx);
+                    }
+
+                    if (found != ref || found_ctx != ref) {
+                        printf("level %s len %u pos %u nocase %d: found %p/%p, "
+                               "expected %p: ", UtilCpuSimdLevelToString(level),
+                               len, pos, nocase, found, found_ctx, ref);
+                        BoyerMooreCtxDeInit(bm_ctx);
+                        BoyerMooreCtxDeInit(bm_ctx_nocase);
+                        goto end;
+                    }
+                }
+            }
+
+            BoyerMooreCtxDeInit(bm_ctx);
+            BoyerMooreCtxDeInit(bm_ctx_nocase);
+        }
+    }
+
+    result = 1;
+end:
+    SimdSearchSetup(UtilCpuSimdLevel());
+    return result;
+}
+
 /**
  * \test Check that all the algorithms work at any offset and any pattern length
  */
@@ -1036,6 +1138,11 @@ int UtilSpmSearchOffsetsTest01() {
                 printf("Error3 searching for %s in text %s\n", needle[i], text[i][j]);
                 return 0;
             }
+            found = SimdSearchWrapper((uint8_t *)text[i][j], (uint8_t *)needle[i], 1);
+            if (found == 0) {
+                printf("Error4 searching for %s in text %s\n", needle[i], text[i][j]);
+                return 0;
+            }
         }
     }
     return 1;
@@ -1471,6 +1578,11 @@ int UtilSpmSearchOffsetsNocaseTest01() {
                 printf("Error3 searching for %s in text %s\n", needle[i], text[i][j]);
                 return 0;
             }
+            found = SimdSearchNocaseWrapper((uint8_t *)text[i][j], (uint8_t *)needle[i], 1);
+            if (found == 0) {
+                printf("Error4 searching for %s in text %s\n", needle[i], text[i][j]);
+                return 0;
+            }
         }
     }
     return 1;
@@ -1538,6 +1650,12 @@ int UtilSpmSearchStatsTest01() {
             printf("Error3 searching for %s in text %s\n", needle[i], text[i]);
             return 0;
         }
+        printf("Pattern length %d with SimdSearch:", i+1);
+        found = SimdSearchWrapper((uint8_t *)text[i], (uint8_t *)needle[i], STATS_TIMES);
+        if (found == 0) {
+            printf("Error4 searching for %s in text %s\n", needle[i], text[i]);
+            return 0;
+        }
         printf("\n");
     }
     return 1;
@@ -1605,6 +1723,12 @@ int UtilSpmSearchStatsTest02() {
             printf("Error3 searching for %s in text %s\n", needle[i], text[i]);
             return 0;
         }
+        printf("Pattern length %d with SimdSearch:", i+1);
+        found = SimdSearchWrapper((uint8_t *)text[i], (uint8_t *)needle[i], STATS_TIMES);
+        if (found == 0) {
+            printf("Error4 searching for %s in text %s\n", needle[i], text[i]);
+            return 0;
+        }
         printf("\n");
     }
     return 1;
@@ -1670,6 +1794,12 @@ int UtilSpmSearchStatsTest03() {
             printf("Error3 searching for %s in text %s\n", needle[i], text[i]);
             return 0;
         }
+        printf("Pattern length %d with SimdSearch:", i+1);
+        found = SimdSearchWrapper((uint8_t *)text[i], (uint8_t *)needle[i], STATS_TIMES);
+        if (found == 0) {
+            printf("Error4 searching for %s in text %s\n", needle[i], text[i]);
+            return 0;
+        }
         printf("\n");
     }
     return 1;
@@ -1963,6 +2093,12 @@ int UtilSpmNocaseSearchStatsTest01() {
             printf("Error3 searching for %s in text %s\n", needle[i], text[i]);
             return 0;
         }
+        printf("Pattern length %d with SimdSearch:", i+1);
+        found = SimdSearchNocaseWrapper((uint8_t *)text[i], (uint8_t *)needle[i], STATS_TIMES);
+        if (found == 0) {
+            printf("Error4 searching for %s in text %s\n", needle[i], text[i]);
+            return 0;
+        }
         printf("\n");
     }
     return 1;
@@ -2027,6 +2163,12 @@ int UtilSpmNocaseSearchStatsTest02() {
             printf("Error3 searching for %s in text %s\n", needle[i], text[i]);
             return 0;
         }
+        printf("Pattern length %d with SimdSearch:", i+1);
+        found = SimdSearchNocaseWrapper((uint8_t *)text[i], (uint8_t *)needle[i], STATS_TIMES);
+        if (found == 0) {
+            printf("Error4 searching for %s in text %s\n", needle[i], text[i]);
+            return 0;
+        }
         printf("\n");
     }
     return 1;
@@ -2070,6 +2212,12 @@ int UtilSpmNocaseSearchStatsTest03() {
             printf("Error3 searching for %s in text %s\n", needle[i], text[i]);
             return 0;
         }
+        printf("Pattern length %d with SimdSearch:", i+1);
+        found = SimdSearchNocaseWrapper((uint8_t *)text[i], (uint8_t *)needle[i], STATS_TIMES);
+        if (found == 0) {
+            printf("Error4 searching for %s in text %s\n", needle[i], text[i]);
+            return 0;
+        }
         printf("\n");
     }
     return 1;
@@ -2320,6 +2468,8 @@ void UtilSpmSearchRegistertests(void) {
     UtRegisterTest("UtilSpmSearchOffsetsTest01", UtilSpmSearchOffsetsTest01, 1);
     UtRegisterTest("UtilSpmSearchOffsetsNocaseTest01", UtilSpmSearchOffsetsNocaseTest01, 1);
 
+    UtRegisterTest("UtilSpmSimdSearchTest01", UtilSpmSimdSearchTest01, 1);
+
 #ifdef ENABLE_SEARCH_STATS
     /* Give some stats searching given a prepared context (look at the wrappers) */
     UtRegisterTest("UtilSpmSearchStatsTest01", UtilSpmSearchStatsTest01, 1);
@@ -27,6 +27,7 @@
 #include "util-spm-bs.h"
 #include "util-spm-bs2bm.h"
 #include "util-spm-bm.h"
+#include "util-spm-simd.h"
 
 /** Default algorithm to use: Boyer Moore */
 uint8_t *Bs2bmSearch(uint8_t *text, uint32_t textlen, uint8_t *needle, uint32_t needlelen);
@@ -57,5 +58,36 @@ uint8_t *BoyerMooreNocaseSearch(uint8_t *text, uint32_t textlen, uint8_t *needle
     mfound; \
     })
 
+/**
+ * \brief Search a pattern using its context: short patterns with the SIMD
+ *        filter, the others with Boyer Moore. Offset and depth are applied
+ *        by passing only that part of the text.
+ *
+ * \param needle pattern to search for
+ * \param needlelen length of the pattern
+ * \param text Text to search in
+ * \param textlen length of the text
+ * \param bm_ctx context of the pattern, built with BoyerMooreCtxInit()
+ */
+static inline uint8_t *SpmCtxSearch(uint8_t *needle, uint16_t needlelen,
+        uint8_t *text, uint32_t textlen, BmCtx *bm_ctx)
+{
+    if (bm_ctx->simd)
+        return SimdSearch(text, textlen, needle, needlelen);
+    return BoyerMoore(needle, needlelen, text, textlen, bm_ctx->bmGs, bm_ctx->bmBc);
+}
+
+/**
+ * \brief Case insensitive SpmCtxSearch, the context has to be converted
+ *        with BoyerMooreCtxToNocase()
+ */
+static inline uint8_t *SpmCtxNocaseSearch(uint8_t *needle, uint16_t needlelen,
+        uint8_t *text, uint32_t textlen, BmCtx *bm_ctx)
+{
+    if (bm_ctx->simd)
+        return SimdNocaseSearch(text, textlen, needle, needlelen);
+    return BoyerMooreNocase(needle, needlelen, text, textlen, bm_ctx->bmGs, bm_ctx->bmBc);
+}
+
 void UtilSpmSearchRegistertests(void);
 #endif /* __UTIL_SPM_H__ */
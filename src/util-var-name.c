@@ -29,7 +29,16 @@
 
 HashListTable *variable_names;
 HashListTable *variable_idxs;
-uint16_t variable_names_idx;
+/** last idx handed out, per variable type. Idxs only need to be unique
+ *  per type, so each type gets a dense range starting at 1. */
+static uint16_t variable_names_idx[DETECT_TBLSIZE];
+
+/** number of detection engines using the hashes. A reloaded engine shares
+ *  them with the one it replaces, so flows keep their variable idxs. */
+static uint32_t variable_names_users = 0;
+/** protects the hashes, a reload adds names while the detect and output
+ *  threads look them up */
+static SCMutex variable_names_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 /** \brief Name2idx mapping structure for flowbits, flowvars and pktvars. */
 typedef struct VariableName_ {
@@ -99,29 +108,52 @@ static void VariableNameFree(void *data) {
     SCFree(fn);
 }
 
-/** \brief Initialize the Name idx hash.
- *  \param de_ctx Ptr to the detection engine ctx.
+/** \brief Initialize the Name idx hash, or take a reference to it if
+ *         another detection engine already did.
  *  \retval -1 in case of error
  *  \retval 0 in case of success
  */
 int VariableNameInitHash() {
+    int r = 0;
+
+    SCMutexLock(&variable_names_mutex);
+    if (variable_names_users++ > 0)
+        goto end;
+
     variable_names = HashListTableInit(4096, VariableNameHash, VariableNameCompare, VariableNameFree);
-    if (variable_names == NULL)
-        return -1;
+    if (variable_names == NULL) {
+        r = -1;
+        goto end;
+    }
 
     variable_idxs = HashListTableInit(4096, VariableIdxHash, VariableIdxCompare, NULL);
-    if (variable_idxs == NULL)
-        return -1;
+    if (variable_idxs == NULL) {
+        r = -1;
+        goto end;
+    }
 
-    variable_names_idx = 0;
-    return 0;
+    memset(variable_names_idx, 0, sizeof(variable_names_idx));
+end:
+    SCMutexUnlock(&variable_names_mutex);
+    return r;
 }
 
+/** \brief Release a reference to the Name idx hash, it's freed with the
+ *         last detection engine using it. */
 void VariableNameFreeHash() {
+    SCMutexLock(&variable_names_mutex);
+    if (variable_names_users > 0 && --variable_names_users > 0) {
+        SCMutexUnlock(&variable_names_mutex);
+        return;
+    }
+
     if (variable_names != NULL) {
         HashListTableFree(variable_names);
         HashListTableFree(variable_idxs);
+        variable_names = NULL;
+        variable_idxs = NULL;
     }
+    SCMutexUnlock(&variable_names_mutex);
 }
 
 /** \brief Get a name idx for a name. If the name is already used reuse the idx.
@@ -144,17 +176,19 @@ uint16_t VariableNameGetIdx(char *name, uint8_t type) {
     if (fn->name == NULL)
         goto error;
 
+    SCMutexLock(&variable_names_mutex);
     VariableName *lookup_fn = (VariableName *)HashListTableLookup(variable_names, (void *)fn, 0);
     if (lookup_fn == NULL) {
-        variable_names_idx++;
+        variable_names_idx[type]++;
 
-        idx = fn->idx = variable_names_idx;
+        idx = fn->idx = variable_names_idx[type];
         HashListTableAdd(variable_names, (void *)fn, 0);
         HashListTableAdd(variable_idxs, (void *)fn, 0);
     } else {
         idx = lookup_fn->idx;
         VariableNameFree(fn);
     }
+    SCMutexUnlock(&variable_names_mutex);
 
     return idx;
 error:
@@ -180,12 +214,13 @@ char *VariableIdxGetName(uint16_t idx, uint8_t type)
     fn->type = type;
     fn->idx = idx;
 
+    SCMutexLock(&variable_names_mutex);
     VariableName *lookup_fn = (VariableName *)HashListTableLookup(variable_idxs, (void *)fn, 0);
-    if (lookup_fn != NULL) {
+    if (lookup_fn != NULL)
         name = SCStrdup(lookup_fn->name);
-        if (name == NULL)
-            goto error;
+    SCMutexUnlock(&variable_names_mutex);
 
+    if (name != NULL) {
         VariableNameFree(fn);
     } else {
         goto error;
@@ -195,4 +230,17 @@ char *VariableIdxGetName(uint16_t idx, uint8_t type)
 error:
     VariableNameFree(fn);
     return NULL;
-}
\ No newline at end of file
+}
+
+/** \brief Get the highest idx handed out for a variable type.
+ *
+ *  Read without the lock: the value only grows, and it's used to size
+ *  the per flow arrays, which grow again if a later idx shows up.
+ *
+ *  \param type variable type (DETECT_FLOWBITS, DETECT_FLOWINT, etc)
+ *  \retval idx the highest idx, 0 if no names of this type exist
+ */
+uint16_t VariableNameGetMaxIdx(uint8_t type)
+{
+    return variable_names_idx[type];
+}
@@ -29,6 +29,7 @@ void VariableNameFreeHash();
 
 uint16_t VariableNameGetIdx(char *, uint8_t);
 char * VariableIdxGetName(uint16_t , uint8_t);
+uint16_t VariableNameGetMaxIdx(uint8_t);
 
 #endif
 